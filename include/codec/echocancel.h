@@ -35,7 +35,8 @@
 #if OPAL_AEC
 
 #include <rtp/rtp.h>
-#include <ptclib/qchannel.h>
+
+#include <vector>
 
 #ifndef SPEEX_ECHO_H
 struct SpeexEchoState;
@@ -89,6 +90,83 @@ public:
       const int clockRate     ///> Clock Rate for the preprocessor
     );
 
+    /**Get the estimated delay, in samples, between the far end audio being
+       sent to the speaker and the reference being used for cancellation.
+      */
+    unsigned GetEstimatedDelay() const { return m_reference.GetEstimatedDelay(); }
+  //@}
+
+  /**Single producer, single consumer ring buffer of far end (speaker)
+     audio, used as the reference signal for the echo canceler.
+
+     The producer (SentPacket) writes samples at a position derived from
+     the RTP timestamp, so gaps due to silence suppression or lost packets
+     are filled with silence and the reference stays time aligned. The
+     consumer (ReceivedPacket) reads a frame at a time and tracks the fill
+     level to estimate the delay, discarding excess samples if the two
+     clocks drift apart. No locks are used by either side and all memory is
+     allocated at construction.
+    */
+  class ReferenceBuffer
+  {
+    public:
+      ReferenceBuffer(
+        unsigned size = 65536  ///< Size in samples, rounded up to power of two
+      );
+
+      /**Write far end audio, called only from the producer thread.
+        */
+      void Write(
+        const short * samples, ///< PCM-16 samples
+        unsigned count,        ///< Number of samples
+        unsigned timestamp     ///< RTP timestamp of first sample
+      );
+
+      /**Read reference audio, called only from the consumer thread.
+         If fewer than \p count samples are available, the remainder is
+         filled with silence.
+         @return false if there was no reference audio at all.
+        */
+      bool Read(
+        short * samples,       ///< PCM-16 samples
+        unsigned count         ///< Number of samples
+      );
+
+      /**Discard all buffered audio and start again.
+         May be called from any thread.
+        */
+      void Resynchronise() { m_resynchronise = true; }
+
+      /// Get estimated delay in samples.
+      unsigned GetEstimatedDelay() const { return m_estimatedDelay; }
+
+      /// Get number of times drift compensation has discarded samples.
+      unsigned GetDriftAdjustments() const { return m_driftAdjustments; }
+
+      /// Get number of times the consumer was starved of reference audio.
+      unsigned GetUnderruns() const { return m_underruns; }
+
+    protected:
+      std::vector<short> m_samples;
+      uint64_t           m_mask;
+      atomic<uint64_t>   m_writePosition;
+      atomic<uint64_t>   m_readPosition;
+      atomic<bool>       m_resynchronise;
+
+      // Producer only
+      bool     m_firstWrite;
+      unsigned m_nextTimestamp;
+
+      // Consumer only
+      uint64_t m_minimumFill;
+      unsigned m_readsInWindow;
+
+      // Statistics
+      atomic<unsigned> m_estimatedDelay;
+      atomic<unsigned> m_driftAdjustments;
+      atomic<unsigned> m_underruns;
+  };
+
 protected:
   PDECLARE_NOTIFIER(RTP_DataFrame, OpalEchoCanceler, ReceivedPacket);
   PDECLARE_NOTIFIER(RTP_DataFrame, OpalEchoCanceler, SentPacket);
@@ -100,16 +178,17 @@ protected:
 
   double mean;
   int clockRate;
-  PQueueChannel *echo_chan;
+  ReferenceBuffer m_reference;
   PDECLARE_MUTEX(stateMutex);
   SpeexEchoState *echoState;
   SpeexPreprocessState *preprocessState;
+  unsigned m_frameSamples;
 
-  // the following types are all void * to avoid including Speex header files
-  void * ref_buf;
-  void * echo_buf;
-  void * e_buf;
-  void * noise;
+  // Work buffers, sized at construction for the largest expected frame.
+  std::vector<short>    m_refBuffer;
+  std::vector<short>    m_echoBuffer;
+  std::vector<short>    m_cancelledBuffer;
+  std::vector<uint32_t> m_noiseBuffer; // float or spx_int32_t, both 32 bits, to avoid including Speex header files
 };
 
 
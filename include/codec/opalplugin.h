@@ -230,6 +230,46 @@ struct PluginCodec_Definition;
 #define PLUGINCODEC_CONTROL_SET_LOG_FUNCTION      "set_log_function"
 #define PLUGINCODEC_CONTROL_GET_STATISTICS        "get_statistics"
 #define PLUGINCODEC_CONTROL_TERMINATE_CODEC       "terminate_codec"
+#define PLUGINCODEC_CONTROL_TRANSCODE_FRAME       "transcode_frame"
+
+
+/* Optional frame level transcode, used via the PLUGINCODEC_CONTROL_TRANSCODE_FRAME
+   control with parm pointing to a PluginCodec_FrameBatch and *parmLen set to its
+   size. This converts a whole frame in one call, rather than one packet per call
+   of codecFunction, using buffers provided by the caller.
+
+   A video encoder is given one raw frame as input[0] and fills output buffers
+   with RTP packets until PluginCodec_ReturnCoderLastFrame is returned in flags.
+   If the buffers run out first, inputCount is returned as zero and the caller
+   calls again with the same input to collect the rest of the frame. A video
+   decoder is given all the packets of an access unit, and fills one output
+   buffer per completed frame. Audio codecs convert input[n] to output[n].
+
+   On input, the length member of each packet is the data size, or for outputs
+   the buffer size, and the flags are PluginCodec_CoderFlags. On return, the
+   inputCount and outputCount are set to the number of packets consumed and
+   produced, each output has its length and PluginCodec_ReturnCoderFlags set,
+   and the batch flags are all the returned flags or'ed together.
+
+   The control returns -1 if the version is not supported, in which case the
+   caller should use codecFunction on a per packet basis instead.
+ */
+#define PLUGINCODEC_FRAME_BATCH_VERSION 1
+
+struct PluginCodec_Packet {
+  unsigned char * data;       // RTP packet including header
+  unsigned        length;     // Packet length, or buffer size for outputs
+  unsigned        flags;      // PluginCodec_CoderFlags in, PluginCodec_ReturnCoderFlags out
+};
+
+struct PluginCodec_FrameBatch {
+  unsigned                    version;      // PLUGINCODEC_FRAME_BATCH_VERSION
+  struct PluginCodec_Packet * input;
+  unsigned                    inputCount;   // Packets provided, returns number consumed
+  struct PluginCodec_Packet * output;
+  unsigned                    outputCount;  // Buffers provided, returns number produced
+  unsigned                    flags;        // Returned PluginCodec_ReturnCoderFlags for whole batch
+};
 
 
 /* Log function, plug in gets a pointer to this function which allows
@@ -674,6 +674,26 @@ class PluginCodec : public PluginCodec_Utilities
                              unsigned & flags) = 0;
 
 
+    /** Convert a whole frame in one call, see PLUGINCODEC_CONTROL_TRANSCODE_FRAME.
+        The default converts each input packet into the corresponding output.
+      */
+    virtual bool TranscodeFrame(PluginCodec_FrameBatch & batch)
+    {
+      unsigned count = batch.inputCount < batch.outputCount ? batch.inputCount : batch.outputCount;
+      batch.flags = 0;
+      for (unsigned i = 0; i < count; ++i) {
+        unsigned fromLen = batch.input[i].length;
+        unsigned flags = batch.input[i].flags;
+        if (!this->Transcode(batch.input[i].data, fromLen, batch.output[i].data, batch.output[i].length, flags))
+          return false;
+        batch.output[i].flags = flags;
+        batch.flags |= flags;
+      }
+      batch.inputCount = batch.outputCount = count;
+      return true;
+    }
+
+
     /// Gather any statistics as a string into the provide buffer.
     virtual int GetStatistics(char * /*bufferPtr*/, unsigned /*bufferSize*/)
     {
@@ -904,6 +924,21 @@ class PluginCodec : public PluginCodec_Utilities
     }
 
 
+    static int TranscodeFrame_s(const PluginCodec_Definition *, void * context, const char *, void * parm, unsigned * len)
+    {
+      PluginCodec_FrameBatch * batch = (PluginCodec_FrameBatch *)parm;
+      if (context == NULL || batch == NULL || len == NULL || *len != sizeof(PluginCodec_FrameBatch)) {
+        PTRACE(1, "Plugin", "Invalid parameter to TranscodeFrame.");
+        return false;
+      }
+
+      if (batch->version != PLUGINCODEC_FRAME_BATCH_VERSION)
+        return -1;
+
+      return ((PluginCodec *)context)->TranscodeFrame(*batch);
+    }
+
+
     static int GetOutputDataSize_s(const PluginCodec_Definition *, void * context, const char *, void *, unsigned *)
     {
       return context != NULL ? (int)((PluginCodec *)context)->GetOutputDataSize() : 0;
@@ -1008,6 +1043,7 @@ class PluginCodec : public PluginCodec_Utilities
         { PLUGINCODEC_CONTROL_SET_INSTANCE_ID,       PluginCodec::SetInstanceID_s },
         { PLUGINCODEC_CONTROL_GET_STATISTICS,        PluginCodec::GetStatistics_s },
         { PLUGINCODEC_CONTROL_TERMINATE_CODEC,       PluginCodec::Terminate_s },
+        { PLUGINCODEC_CONTROL_TRANSCODE_FRAME,       PluginCodec::TranscodeFrame_s },
         PLUGINCODEC_CONTROL_LOG_FUNCTION_INC
         { NULL }
       };
@@ -1130,6 +1166,30 @@ class PluginVideoEncoder : public PluginVideoCodec<NAME>
     }
 
 
+    /// Encode one raw frame into as many packets as the output buffers allow.
+    virtual bool TranscodeFrame(PluginCodec_FrameBatch & batch)
+    {
+      if (batch.inputCount == 0)
+        return false;
+
+      PluginCodec_Packet & input = batch.input[0];
+      unsigned produced = 0;
+      batch.flags = 0;
+      while (produced < batch.outputCount && (batch.flags & PluginCodec_ReturnCoderLastFrame) == 0) {
+        PluginCodec_Packet & output = batch.output[produced++];
+        unsigned fromLen = input.length;
+        output.flags = input.flags;
+        if (!this->Transcode(input.data, fromLen, output.data, output.length, output.flags))
+          return false;
+        batch.flags |= output.flags;
+      }
+
+      batch.inputCount = (batch.flags & PluginCodec_ReturnCoderLastFrame) != 0 ? 1 : 0;
+      batch.outputCount = produced;
+      return true;
+    }
+
+
     virtual size_t GetPacketSpace(const PluginCodec_RTP & rtp, size_t total)
     {
       size_t space = rtp.GetMaxSize();
@@ -1180,6 +1240,37 @@ class PluginVideoDecoder : public PluginVideoCodec<NAME>
     }
 
 
+    /// Decode all the packets of an access unit, producing an output for each completed frame.
+    virtual bool TranscodeFrame(PluginCodec_FrameBatch & batch)
+    {
+      unsigned consumed = 0, produced = 0;
+      batch.flags = 0;
+      while (consumed < batch.inputCount && produced < batch.outputCount) {
+        PluginCodec_Packet & input = batch.input[consumed++];
+        PluginCodec_Packet & output = batch.output[produced];
+        unsigned fromLen = input.length;
+        unsigned toLen = output.length;
+        unsigned flags = input.flags;
+        if (!this->Transcode(input.data, fromLen, output.data, toLen, flags))
+          return false;
+
+        batch.flags |= flags;
+        if ((flags & PluginCodec_ReturnCoderBufferTooSmall) != 0)
+          break;
+
+        if ((flags & PluginCodec_ReturnCoderLastFrame) != 0) {
+          output.length = toLen;
+          output.flags = flags;
+          ++produced;
+        }
+      }
+
+      batch.inputCount = consumed;
+      batch.outputCount = produced;
+      return true;
+    }
+
+
     virtual bool CanOutputImage(unsigned width, unsigned height, PluginCodec_RTP & rtp, unsigned & flags)
     {
       if (width == 0 || height == 0)
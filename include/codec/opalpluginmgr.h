@@ -218,6 +218,10 @@ class OpalPluginTranscoder
       return codecDef != NULL && codecDef->codecFunction != NULL &&
             (codecDef->codecFunction)(codecDef, context, from, fromLen, to, toLen, flags) != 0;
     }
+    int TranscodeFrame(PluginCodec_FrameBatch & batch) const
+    {
+      return transcodeFrameControl.Call(&batch, sizeof(batch), context);
+    }
 
   protected:
     bool CreateContext(const BYTE * instance, unsigned instanceLen);
@@ -234,6 +238,7 @@ class OpalPluginTranscoder
     OpalPluginControl getOutputDataSizeControl;
     OpalPluginControl getCodecStatistics;
     OpalPluginControl setInstanceId;
+    OpalPluginControl transcodeFrameControl;
 #if PTRACING
     bool m_firstLoggedUpdateOptions[2];
 #endif
@@ -338,12 +343,27 @@ class OpalPluginVideoTranscoder : public OpalVideoTranscoder, public OpalPluginT
                            const OpalMediaFormat & destFormat,
                            const BYTE * instance, unsigned instanceLen);
     bool EncodeFrames(const RTP_DataFrame & src, RTP_DataFrameList & dstList);
+    int EncodeFrameBatch(const RTP_DataFrame & src, unsigned outputDataSize, unsigned flags, RTP_DataFrameList & dstList);
     bool DecodeFrames(const RTP_DataFrame & src, RTP_DataFrameList & dstList);
     bool DecodeFrame(const RTP_DataFrame & src, RTP_DataFrameList & dstList);
+    bool RetryDecode(const RTP_DataFrame & src, unsigned & toLen, unsigned & flags);
+    bool CompleteDecode(const RTP_DataFrame & src, bool packetsLost, unsigned flags, unsigned toLen, RTP_DataFrameList & dstList);
+    bool QueueAccessUnit(const RTP_DataFrame & src, RTP_DataFrameList & dstList);
+    bool DecodeAccessUnit(RTP_DataFrameList & dstList);
 
     RTP_DataFrame * m_bufferRTP;
     unsigned        m_totalFrames;
 
+    // Frame level transcoding, if plug in supports it
+    bool                            m_useTranscodeFrame;
+    std::vector<RTP_DataFrame *>    m_encodeBuffers;
+    std::vector<PluginCodec_Packet> m_encodePackets;
+    unsigned                        m_encodeBatchSize;
+    PBYTEArray                      m_accessUnitData;
+    PINDEX                          m_accessUnitSize;
+    std::vector<PINDEX>             m_accessUnitOffsets;
+    std::vector<PluginCodec_Packet> m_accessUnitPackets;
+
     // Check for bad markers, or abd timestamps, work arounds
     enum {
       e_MarkersInitial,
@@ -210,7 +210,9 @@ class OpalSilenceDetector : public PObject
     ) = 0;
 
     /**Calculate the average signal level for PCM-16 data.
-       This code is adapted from the reference in RFC6465.
+       This code is adapted from the reference in RFC6465, but uses an
+       integer sum of squares (vectorised where the CPU allows) and a table
+       lookup instead of floating point logarithms.
       */
     class CalculateDB
     {
@@ -222,9 +224,42 @@ class OpalSilenceDetector : public PObject
           PINDEX size       /// Size, in bytes, of PCM-16 data
         );
         int Finalise();
+
+        /**Calculate the sum of the squares of the PCM-16 samples.
+           SSE2 or NEON instructions are used if available.
+          */
+        static uint64_t SumOfSquares(
+          const short * samples, /// Pointer to PCM-16 samples
+          PINDEX count           /// Number of samples
+        );
+
+        /**Convert a sum of squares of PCM-16 samples to dBov.
+           @return 0 to -127 dBov as per RFC6464
+          */
+        static int SumOfSquaresToDB(
+          uint64_t sumOfSquares, /// Sum of the squares of the samples
+          uint64_t sampleCount   /// Number of samples summed
+        );
+
+        /// Description of one block of PCM-16 data for CalculateBatch()
+        struct Block {
+          Block(const void * pcm = NULL, PINDEX size = 0) : m_pcm(pcm), m_size(size) { }
+          const void * m_pcm;  /// Pointer to PCM-16 data
+          PINDEX       m_size; /// Size, in bytes, of PCM-16 data
+        };
+
+        /**Calculate the levels for many blocks at once, e.g. every input
+           stream to a mixer. The \p levels array must have \p count entries.
+          */
+        static void CalculateBatch(
+          const Block * blocks, /// Array of blocks of PCM-16 data
+          size_t count,         /// Number of entries in blocks
+          int * levels          /// Array to receive 0 to -127 dBov levels
+        );
+
       protected:
-        double   m_rmsSum;
-        unsigned m_rmsSamples;
+        uint64_t m_rmsSum;
+        uint64_t m_rmsSamples;
     };
 
   private:
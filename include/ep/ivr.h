@@ -39,15 +39,112 @@
 #include <ep/opalvxml.h>
 #include <ep/localep.h>
 
+#include <map>
+
 class OpalIVRConnection;
 
 
 #define OPAL_IVR_PREFIX "ivr"
 
-/// IVR supports this codec type natively, defulat to none.
+/**IVR supports this codec type natively, defulat to none.
+   With the OpalIVRPromptCache, PCM-16 WAV prompts are encoded once to this
+   codec and shared by all calls, so no transcoding is needed.
+  */
 #define OPAL_OPT_IVR_NATIVE_CODEC "IVR-Native-Codec"
 
 
+/**Cache of prompt files for IVR playback.
+   Each PCM-16 mono WAV prompt is read once, and calls playing it at the
+   same sample rate share that copy, so there is no per call file I/O or
+   copying. For calls using a native codec, see OPAL_OPT_IVR_NATIVE_CODEC,
+   the prompt is encoded on first use, and all later calls share the encoded
+   data, so neither the IVR nor the media patch do any transcoding.
+
+   Only codecs with a fixed frame size, e.g. G.711, G.729, GSM, are encoded,
+   as the IVR media stream packetises the encoded data by whole frames to
+   the negotiated packet time. Anything that cannot be cached is played from
+   the file as usual.
+
+   The size and modification time of the file are checked each time a
+   prompt is played, and a changed prompt is read again. Calls already
+   playing the old version keep it until they are done. A file that could
+   not be cached is tried again when it changes, or after a minute.
+  */
+class OpalIVRPromptCache : public PObject
+{
+    PCLASSINFO(OpalIVRPromptCache, PObject);
+  public:
+    OpalIVRPromptCache();
+    ~OpalIVRPromptCache();
+
+    /**Get prompt data for playing in the media format.
+       @return false if the prompt cannot be cached for this format.
+      */
+    bool GetPrompt(
+      const PFilePath & fn,           ///< Prompt file name
+      const OpalMediaFormat & format, ///< Format of IVR media stream
+      PBYTEArray & data               ///< Data for PVXMLSession::PlayData()
+    );
+
+    /// Indicate cache is in use.
+    bool IsEnabled() const { return m_enabled; }
+
+    /// Set cache in use.
+    void SetEnabled(bool enabled) { m_enabled = enabled; }
+
+    struct Statistics
+    {
+      Statistics();
+      void PrintOn(ostream & strm) const;
+      friend ostream & operator<<(ostream & strm, const Statistics & stats) { stats.PrintOn(strm); return strm; }
+
+      unsigned m_prompts;       ///< Number of prompts held
+      uint64_t m_pcmBytes;      ///< Total PCM data held
+      unsigned m_encodings;     ///< Number of prompt/format encodings held
+      uint64_t m_encodedBytes;  ///< Total encoded data held
+      uint64_t m_reloads;       ///< Prompts read again as the file changed
+      uint64_t m_hits;          ///< Prompts played from cache
+      uint64_t m_misses;        ///< Prompts that could not be played from cache
+    };
+
+    /// Get statistics for cache.
+    void GetStatistics(Statistics & statistics) const;
+
+  protected:
+    struct Prompt
+    {
+      Prompt(PInt64 fileSize = -1, const PTime & modified = PTime(0));
+
+      bool Load(const PFilePath & fn);
+
+      PInt64       m_fileSize; ///< Negative if file does not exist
+      PTime        m_modified;
+      PTime        m_loaded;
+      unsigned     m_sampleRate;
+      PBYTEArray   m_pcm;      ///< Empty if file cannot be cached
+      std::map<PString, PBYTEArray> m_encoded; ///< By format, empty if format cannot be encoded
+    };
+
+    bool IsCurrent(const PFilePath & fn, PInt64 fileSize, const PTime & modified);
+    bool IsCurrent(const Prompt & prompt, PInt64 fileSize, const PTime & modified) const;
+    void Store(const PFilePath & fn, const Prompt & prompt);
+
+    static bool Encode(
+      const PBYTEArray & pcm,
+      unsigned sampleRate,
+      const OpalMediaFormat & format,
+      PBYTEArray & encoded
+    );
+
+    typedef std::map<PFilePath, Prompt> PromptMap;
+    PromptMap      m_prompts;
+    atomic<bool>   m_enabled;
+    PTimeInterval  m_failureLifetime;
+    Statistics     m_statistics;
+    PDECLARE_MUTEX(m_mutex);
+};
+
+
 /**Interactive Voice Response endpoint.
  */
 class OpalIVREndPoint : public OpalLocalEndPoint
@@ -195,12 +292,16 @@ class OpalIVREndPoint : public OpalLocalEndPoint
     // Allow users to override cache algorithm
     virtual PVXMLCache & GetTextToSpeechCache() { return m_ttsCache; }
 
+    /// Get cache of pre-loaded, and pre-encoded, prompts.
+    OpalIVRPromptCache & GetPromptCache() { return m_promptCache; }
+
   protected:
     PString        m_defaultVXML;
     PString        m_defaultTTS;
     PDECLARE_MUTEX(m_defaultsMutex);
     PVXMLCache     m_ttsCache;
     PDirectory     m_recordDirectory;
+    OpalIVRPromptCache m_promptCache;
 
   private:
     P_REMOVE_VIRTUAL(OpalIVRConnection *, CreateConnection(OpalCall &,const PString &,void *,const PString &,OpalConnection::StringOptions *),0);
@@ -328,6 +429,14 @@ class OpalIVRConnection : public OpalLocalConnection
     PTextToSpeech * SetTextToSpeech(const PString & ttsName) { return m_vxmlSession.SetTextToSpeech(ttsName); }
     PTextToSpeech * SetTextToSpeech(PTextToSpeech * tts, PBoolean autoDelete = false) { return m_vxmlSession.SetTextToSpeech(tts, autoDelete); }
 
+    /**Get prompt from the endpoints cache, in the format of the audio
+       stream being sent by the IVR.
+      */
+    virtual bool GetCachedPrompt(
+      const PFilePath & fn,
+      PBYTEArray & data
+    );
+
   protected:
     virtual bool StartVXML();
     virtual bool StartScript();
@@ -46,6 +46,7 @@
 
 class RTP_DataFrame;
 class OpalJitterBuffer;
+class OpalPlacementPolicy;
 class OpalMixerConnection;
 
 
@@ -162,6 +163,14 @@ class OpalBaseMixer : public PSmartObject
       */
     unsigned GetPeriodTS() const { return m_periodTS; }
 
+    /**Set the CPU core group the mixer threads are pinned to.
+       See OpalPlacementPolicy.
+      */
+    void SetPlacement(
+      OpalPlacementPolicy & policy,
+      int group
+    ) { m_placementPolicy = &policy; m_placementGroup = group; }
+
   protected:
     struct Stream : public PObject {
       virtual ~Stream() { }
@@ -185,6 +194,8 @@ class OpalBaseMixer : public PSmartObject
     RTP_DataFrame * m_pushFrame;        // Cached frame for pushing RTP
     PThread *       m_workerThread;     // reader thread handle
     bool            m_threadRunning;    // used to stop reader thread
+    OpalPlacementPolicy * m_placementPolicy; // CPU cores for push thread
+    int                   m_placementGroup;
    PDECLARE_MUTEX(m_mutex);             // mutex for list of streams and thread handle
 };
 
@@ -250,6 +261,16 @@ class OpalAudioMixer : public OpalBaseMixer
       const OpalJitterBuffer::Init & init   ///< Initialisation information
     );
 
+    typedef std::map<Key_T, int> AudioLevelMap;
+
+    /**Get the audio level of every input stream for the last mixed period.
+       The levels are in dBov (0 to -127) as per RFC6464, and are calculated
+       together using OpalSilenceDetector::CalculateDB::CalculateBatch().
+      */
+    void GetAudioLevels(
+      AudioLevelMap & levels    ///< Map of key to level for each stream
+    );
+
   protected:
     struct AudioStream : public Stream
     {
@@ -315,8 +336,8 @@ class OpalVideoMixer : public OpalBaseMixer
                                  of output frame. It is expected that the output frame be
                                  double the height of the input data to maintain aspect
                                  ratio. e.g. for CIF inputs, output would be 352x576. */
-      eGrid,                /**< Standard 2x2, 3x3, 4x4 grid pattern. Size of grid is
-                                 dependent on the number of video streams. */
+      eGrid,                /**< Standard 2x2, 3x3, 4x4, 5x5 etc grid pattern. Size of grid
+                                 is dependent on the number of video streams. */
       eUser                 /**< User defined */
     };
 
@@ -328,7 +349,7 @@ class OpalVideoMixer : public OpalBaseMixer
       bool pushThread = true  ///< A push thread is to be created
     );
 
-    ~OpalVideoMixer() { StopPushThread(); }
+    ~OpalVideoMixer();
 
     /**Get output video frame width.
       */
@@ -357,14 +378,59 @@ class OpalVideoMixer : public OpalBaseMixer
       unsigned height   ///< new height
     );
 
+    /**Set the maximum number of compositor pool threads used to scale tiles
+       into the frame store. The pool is shared by all video mixers in the
+       process, and has one less thread than the number of CPU cores, up to a
+       maximum of eight. Tiles are only scaled in parallel when there is more
+       than one to do and the output frame is large enough to make it
+       worthwhile. A value of zero means all scaling is done in the mixer
+       thread. The default is to use the whole pool.
+      */
+    void SetCompositorThreads(
+      unsigned threads  ///< Maximum number of compositor threads
+    );
+
+    /// Area of the output frame.
+    struct Region
+    {
+      Region(unsigned x = 0, unsigned y = 0, unsigned w = 0, unsigned h = 0)
+        : m_x(x), m_y(y), m_width(w), m_height(h) { }
+      unsigned m_x, m_y, m_width, m_height;
+    };
+    typedef std::vector<Region> RegionList;
+
+    /**Get the areas of the output frame that changed in the last mix.
+       An empty list indicates the output frame is identical to the previous
+       one. Encoders may use this to, for example, skip motion estimation on
+       unchanged areas, or send a frame repeat.
+      */
+    const RegionList & GetChangedRegions() const { return m_changedRegions; }
+
+    // Work space for scaling, kept per thread so it is not reallocated every frame
+    struct ScaleScratch
+    {
+      struct Step
+      {
+        unsigned m_index0;
+        unsigned m_index1;
+        unsigned m_fraction;
+      };
+      std::vector<BYTE> m_line;
+      std::vector<Step> m_columns;
+      std::vector<Step> m_rows;
+    };
+
   protected:
     struct VideoStream : public Stream
     {
       VideoStream(OpalVideoMixer & mixer);
       virtual void QueuePacket(const RTP_DataFrame & rtp);
       void InsertVideoFrame(unsigned x, unsigned y, unsigned w, unsigned h);
+      void CompositeVideoFrame(BYTE * frameStore, ScaleScratch & scratch);
 
       OpalVideoMixer & m_mixer;
+      RTP_DataFrame    m_lastFrame;   // Last source frame, for redraw without a new frame
+      Region           m_tile;        // Where m_lastFrame was last placed
     };
 
     friend struct VideoStream;
@@ -377,6 +443,11 @@ class OpalVideoMixer : public OpalBaseMixer
     virtual bool StartMix(unsigned & x, unsigned & y, unsigned & w, unsigned & h, unsigned & left);
     virtual bool NextMix(unsigned & x, unsigned & y, unsigned & w, unsigned & h, unsigned & left);
     void InsertVideoFrame(const StreamMap_T::iterator & it, unsigned x, unsigned y, unsigned w, unsigned h);
+    void FillFrameStore();
+    void CompositeTiles();
+    void CompositeNextTiles(ScaleScratch & scratch);
+
+    friend class OpalVideoCompositorPool;
 
   protected:
     Styles     m_style;
@@ -385,6 +456,17 @@ class OpalVideoMixer : public OpalBaseMixer
 
     PBYTEArray m_frameStore;
     size_t     m_lastStreamCount;
+    bool       m_redrawAll;         // Frame store was cleared, all tiles need drawing
+    RegionList m_changedRegions;
+
+    // Tiles to be scaled into the frame store for this mix
+    std::vector<VideoStream *> m_tiles;
+    atomic<size_t>             m_nextTile;
+    BYTE                     * m_compositeTarget;
+
+    unsigned                   m_compositorThreads;
+    PSemaphore                 m_compositeDone;
+    ScaleScratch               m_scratch;
 };
 
 #endif // OPAL_VIDEO
@@ -410,6 +492,7 @@ struct OpalMixerNodeInfo
     , m_width(PVideoFrameInfo::CIFWidth)
     , m_height(PVideoFrameInfo::CIFHeight)
     , m_rate(15)
+    , m_selectiveForwarding(false)
 #endif
     , m_mediaPassThru(false)
   { }
@@ -428,6 +511,8 @@ struct OpalMixerNodeInfo
   unsigned m_width;               ///< Width of mixed video
   unsigned m_height;              ///< Height of mixed video
   unsigned m_rate;                ///< Frame rate of mixed video
+  bool     m_selectiveForwarding; /**< Forward encoded video from one participant
+                                       to the others, rather than compositing. */
 #endif
   bool     m_mediaPassThru;       /**< Enable media pass through to optimise mixer node
                                        with precisely two attached connections. */
@@ -444,6 +529,7 @@ struct OpalMixerNodeInfo
 class OpalMixerNode;
 class OpalAudioStreamMixer;
 class OpalVideoStreamMixer;
+class OpalVideoStreamForwarder;
 
 
 /** Mixer node manager.
@@ -565,6 +651,9 @@ class OpalMixerNodeManager
 #if OPAL_VIDEO
     /// Create the instance of the video mixer
     virtual OpalVideoStreamMixer * CreateVideoMixer(const OpalMixerNodeInfo & info);
+
+    /// Create the instance of the video forwarder, when in selective forwarding mode
+    virtual OpalVideoStreamForwarder * CreateVideoForwarder(const OpalMixerNodeInfo & info);
 #endif
 
     /// Get manager
@@ -996,6 +1085,14 @@ class OpalMixerMediaStream : public OpalMediaStream
       RTP_DataFrame & packet
     );
 
+    /**Set the data size in bytes that is expected to be used.
+       Overrides so mixer can detect a change in output configuration.
+      */
+    virtual PBoolean SetDataSize(
+      PINDEX dataSize,  ///< New data size (in total)
+      PINDEX frameTime  ///< Individual frame time (if applicable)
+    );
+
     /**Indicate if the media stream is synchronous.
        Returns true for LID streams.
       */
@@ -1012,6 +1109,14 @@ class OpalMixerMediaStream : public OpalMediaStream
        then threading is from the mixer class.
       */
     virtual PBoolean RequiresPatchThread() const;
+
+    /**Execute a command on the stream.
+       For a source stream in a selective forwarding node, commands from the
+       receiver, e.g. bandwidth or picture update, are passed to the node.
+      */
+    virtual bool InternalExecuteCommand(const OpalMediaCommand & command);
+
+    virtual bool InternalUpdateMediaFormat(const OpalMediaFormat & mediaFormat);
   //@}
 
   /**@name Member variable access */
@@ -1019,6 +1124,11 @@ class OpalMixerMediaStream : public OpalMediaStream
     /**Get the mixer node for this stream.
      */
     PSafePtr<OpalMixerNode> GetNode() { return m_node; }
+
+    /**Get a counter that changes whenever the media format or data size
+       changes. Used by mixers to know when to re-evaluate the encoder needed.
+     */
+    unsigned GetFormatGeneration() const { return m_formatGeneration; }
   //@}
 
 #if OPAL_VIDEO
@@ -1031,6 +1141,7 @@ class OpalMixerMediaStream : public OpalMediaStream
 
     PSafePtr<OpalMixerNode> m_node;
     bool m_listenOnly;
+    atomic<unsigned> m_formatGeneration;
 #if OPAL_VIDEO
     unsigned m_mixedVideoWidth;
     unsigned m_mixedVideoHeight;
@@ -1042,13 +1153,81 @@ class OpalMediaStreamMixer
 {
   public:
     OpalMediaStreamMixer();
+    virtual ~OpalMediaStreamMixer();
     void Append(const PSafePtr<OpalMixerMediaStream> & stream);
-    void Remove(const PSafePtr<OpalMixerMediaStream> & stream) { m_outputStreams.RemoveAt(stream->GetID()); }
+    void Remove(const PSafePtr<OpalMixerMediaStream> & stream);
     void CloseOne(const PSafePtr<OpalMixerMediaStream> & stream);
 
   protected:
+    /**Output streams that get identical media.
+       Output streams are grouped by their encoder configuration, so media is
+       encoded once per group and the same frames pushed to every member.
+       Frames are not altered after being pushed, only the RTP header, and
+       any encryption, differ per member and that is done downstream.
+      */
+    struct OutputGroup
+    {
+      OutputGroup() { }
+      virtual ~OutputGroup() { }
+
+      void PushToMembers(const RTP_DataFrame & frame);
+      void PushToMembers(const RTP_DataFrameList & frames);
+
+      struct Member
+      {
+        Member(const PSafePtr<OpalMixerMediaStream> & stream);
+        PSafePtr<OpalMixerMediaStream> m_stream;
+        unsigned                       m_formatGeneration;
+      };
+      std::vector<Member> m_members; // Protected by m_outputGroupsMutex
+      std::vector<Member> m_pushing; // Copy of m_members, only used by mixer thread
+    };
+    typedef std::map<PString, OutputGroup *> OutputGroupMap;
+    typedef std::vector<OutputGroup *> OutputGroupList;
+
+    /**Get the key for the group the output stream belongs to.
+       Streams with the same key must require exactly the same media. An
+       empty string indicates stream is not to get any media.
+
+       The default behaviour returns the stream ID, i.e. no sharing.
+      */
+    virtual PString GetOutputGroupKey(
+      PSafePtr<OpalMixerMediaStream> & stream
+    );
+
+    /**Create the group, and any encoder needed, for the output stream.
+       Returns NULL if the stream cannot be supported, and it is closed.
+      */
+    virtual OutputGroup * CreateOutputGroup(
+      const PString & key,
+      PSafePtr<OpalMixerMediaStream> & stream
+    );
+
+    /**Make sure groups are correct for the output streams.
+       Regrouping only happens if streams were added, removed or changed
+       format, otherwise this is a quick check. Only called from the thread
+       doing the mixing, with m_outputGroupsMutex locked.
+
+       The groups are returned, with the members copied so the mixer thread
+       can encode and push after releasing m_outputGroupsMutex. Groups are
+       only created or deleted by the mixer thread, so remain valid.
+      */
+    void UpdateOutputGroups(
+      OutputGroupList & groups  ///< Groups to push to
+    );
+    void RegroupOutputStreams();
+
+    /// Force regrouping on next UpdateOutputGroups()
+    void InvalidateOutputGroups() { m_outputGroupsValid = false; }
+
+    /// Close all streams in group
+    void CloseGroup(OutputGroup & group);
+
     typedef PSafeDictionary<PString, OpalMixerMediaStream> StreamDict;
-    StreamDict m_outputStreams;
+    StreamDict     m_outputStreams;
+    OutputGroupMap m_outputGroups;
+    atomic<bool>   m_outputGroupsValid;
+    PDECLARE_MUTEX(m_outputGroupsMutex);
 };
 
 /** Audio mixer.
@@ -1061,28 +1240,28 @@ class OpalAudioStreamMixer : public OpalAudioMixer, public OpalMediaStreamMixer
     OpalAudioStreamMixer(const OpalMixerNodeInfo & info);
     ~OpalAudioStreamMixer();
 
+    virtual bool AddStream(const Key_T & key);
+    virtual void RemoveStream(const Key_T & key);
+    virtual void RemoveAllStreams();
     virtual bool OnPush();
 
   protected:
-    struct CachedAudio
+    struct AudioGroup : OutputGroup
     {
-      CachedAudio();
-      ~CachedAudio();
-      enum
-      {
-        Collecting, Collected, Completed
-      } m_state;
+      AudioGroup(const Key_T & inputKey, const OpalMediaFormat & format);
+      ~AudioGroup();
+
+      Key_T            m_inputKey; // Participant whose own audio is removed, empty for listeners
+      OpalMediaFormat  m_format;
+      PINDEX           m_rawSize;
       RTP_DataFrame    m_raw;
       RTP_DataFrame    m_encoded;
       OpalTranscoder * m_transcoder;
     };
-    std::map<PString, CachedAudio> m_cache;
 
-    void PushOne(
-      PSafePtr<OpalMixerMediaStream> & stream,
-      CachedAudio & cache,
-      const short * audioToSubtract
-    );
+    virtual PString GetOutputGroupKey(PSafePtr<OpalMixerMediaStream> & stream);
+    virtual OutputGroup * CreateOutputGroup(const PString & key, PSafePtr<OpalMixerMediaStream> & stream);
+    void PushGroup(AudioGroup & group);
 
 #ifdef OPAL_MIXER_AUDIO_DEBUG
     class PAudioMixerDebug * m_audioDebug;
@@ -1109,8 +1288,168 @@ class OpalVideoStreamMixer : public OpalVideoMixer, public OpalMediaStreamMixer
     virtual bool OnMixed(RTP_DataFrame * & output);
 
   protected:
-    typedef PDictionary<PString, OpalTranscoder> TranscoderMap;
-    TranscoderMap m_transcoders;
+    struct VideoGroup : OutputGroup
+    {
+      VideoGroup(const OpalMediaFormat & format, unsigned width, unsigned height);
+      ~VideoGroup();
+
+      OpalMediaFormat   m_format;
+      unsigned          m_width;
+      unsigned          m_height;
+      OpalTranscoder  * m_transcoder;
+      RTP_DataFrameList m_packets;
+    };
+
+    virtual PString GetOutputGroupKey(PSafePtr<OpalMixerMediaStream> & stream);
+    virtual OutputGroup * CreateOutputGroup(const PString & key, PSafePtr<OpalMixerMediaStream> & stream);
+
+    unsigned     m_mixedWidth;
+    unsigned     m_mixedHeight;
+    atomic<bool> m_frameRateChanged;
+};
+
+
+/** Video selective forwarder.
+    This class forwards the encoded video of one participant to each of the
+    others, without any decoding or encoding, so the CPU used per participant
+    is very small. It is used instead of OpalVideoStreamMixer when
+    OpalMixerNodeInfo::m_selectiveForwarding is set.
+
+    If a participant sends more than one SSRC in the session, e.g. simulcast,
+    each is treated as a layer, ranked by the bit rate actually received. The
+    layer sent to each receiver is the best that fits the bandwidth indicated
+    by OpalMediaFlowControl, reduced when OpalMediaPacketLoss reports loss.
+    For VP8, temporal layers are also dropped when even the lowest layer does
+    not fit. Changes of layer, or of participant, are done on an intra frame,
+    which is requested from the participant via OpalVideoUpdatePicture.
+
+    The SSRC, sequence number and timestamp of forwarded packets are
+    rewritten, so each receiver sees one continuous stream.
+*/
+class OpalVideoStreamForwarder : public OpalBaseMixer, public OpalMediaStreamMixer
+{
+    PCLASSINFO(OpalVideoStreamForwarder, OpalBaseMixer);
+  public:
+    OpalVideoStreamForwarder(const OpalMixerNodeInfo & info);
+    ~OpalVideoStreamForwarder();
+
+    /**Add a participant, whose video may be forwarded.
+      */
+    bool AddInput(
+      OpalMixerMediaStream & stream   ///< Sink stream from participant
+    );
+
+    /**Add a receiver of forwarded video.
+      */
+    void AddOutput(
+      const PSafePtr<OpalMixerMediaStream> & stream   ///< Source stream to receiver
+    );
+
+    /**Remove a receiver of forwarded video.
+      */
+    void RemoveOutput(
+      const PSafePtr<OpalMixerMediaStream> & stream   ///< Source stream to receiver
+    );
+
+    virtual void RemoveStream(const Key_T & key);
+    virtual void RemoveAllStreams();
+
+    /**Forward an RTP data frame to the receivers that have selected it.
+      */
+    virtual bool WriteStream(
+      const Key_T & key,          ///< key for mixer stream
+      const RTP_DataFrame & input ///< Input RTP data for media
+    );
+
+    /**Execute a command from a receiver.
+       Handles OpalMediaFlowControl, OpalMediaPacketLoss and
+       OpalVideoUpdatePicture.
+      */
+    bool ExecuteCommand(
+      const OpalMixerMediaStream & stream,  ///< Source stream to receiver
+      const OpalMediaCommand & command      ///< Command from receiver
+    );
+
+    /**Set the participant whose video is forwarded.
+       The participant itself receives the video of the first other
+       participant. If empty, or not present, every receiver gets the first
+       participant that is not itself.
+      */
+    void SetFocus(
+      const PString & token   ///< Token of connection to forward
+    );
+
+  protected:
+    virtual Stream * CreateStream() { return NULL; }
+    virtual bool MixStreams(RTP_DataFrame &) { return false; }
+    virtual size_t GetOutputSize() const { return 0; }
+
+    enum { MaxTemporalId = 3 };
+
+    struct Layer
+    {
+      Layer(RTP_SyncSourceId ssrc);
+
+      RTP_SyncSourceId                  m_ssrc;
+      OpalVideoFormat::FrameDetectorPtr m_detector;
+      PTimeInterval                     m_windowStart;
+      unsigned                          m_windowBytes;
+      unsigned                          m_bitRate;
+      PTimeInterval                     m_lastPacket;
+      PTimeInterval                     m_lastUpdateRequest;
+    };
+    typedef std::map<RTP_SyncSourceId, Layer *> LayerMap;
+
+    struct Input
+    {
+      Input(OpalMixerMediaStream & stream);
+      ~Input();
+      bool Rank(const PTimeInterval & now);
+
+      PSafePtr<OpalMixerMediaStream> m_stream;
+      PString                        m_token;
+      OpalVideoFormat                m_format;
+      bool                           m_temporalLayers;
+      LayerMap                       m_layers;
+      std::vector<RTP_SyncSourceId>  m_ranked; // Highest bit rate first
+    };
+    typedef std::map<Key_T, Input *> InputMap;
+
+    struct Output
+    {
+      Output();
+
+      PString            m_token;
+      OpalMediaFormat    m_format;
+      Key_T              m_currentInput;
+      RTP_SyncSourceId   m_currentSSRC;
+      unsigned           m_currentTemporalId;
+      Key_T              m_targetInput;
+      RTP_SyncSourceId   m_targetSSRC;
+      unsigned           m_targetTemporalId;
+      unsigned           m_maxBitRate;
+      unsigned           m_bandwidth;
+      RTP_SyncSourceId   m_ssrc;
+      RTP_SequenceNumber m_sequenceNumber;
+      RTP_Timestamp      m_timestampOffset;
+      RTP_Timestamp      m_lastTimestamp;
+      PTimeInterval      m_lastTick;
+      bool               m_started;
+    };
+    typedef std::map<PString, Output> OutputMap;
+
+    typedef std::vector< std::pair<PSafePtr<OpalMixerMediaStream>, RTP_SyncSourceId> > UpdateRequests;
+    typedef std::vector< std::pair<PSafePtr<OpalMixerMediaStream>, RTP_DataFrame> > Forwards;
+
+    virtual Input * SelectInput(const Output & output);
+    void SelectTarget(Output & output, const PTimeInterval & now, UpdateRequests & requests);
+    void RequestUpdate(Input & input, RTP_SyncSourceId ssrc, const PTimeInterval & now, UpdateRequests & requests);
+    void SendUpdateRequests(const UpdateRequests & requests);
+    bool RewritePacket(Output & output, const RTP_DataFrame & rtp, bool switched, const PTimeInterval & now, RTP_DataFrame & packet);
+
+    InputMap  m_inputs;
+    OutputMap m_outputs;
+    PString   m_focus;
 };
 #endif // OPAL_VIDEO
 
@@ -1204,6 +1543,23 @@ class OpalMixerNode : public PSafeObject
       const RTP_DataFrame & input           ///< Input RTP data for media
     );
 
+    /**Execute a command from a receiver of the nodes media.
+       This is only used in selective forwarding mode.
+      */
+    bool ExecuteCommand(
+      const OpalMixerMediaStream & stream,  ///< Source stream to receiver
+      const OpalMediaCommand & command      ///< Command from receiver
+    );
+
+#if OPAL_VIDEO
+    /**Set the participant whose video is forwarded to everyone else.
+       This is only used in selective forwarding mode.
+      */
+    void SetVideoFocus(
+      const PString & token   ///< Token of connection to forward
+    );
+#endif
+
     /**Send a user input indication to all connections.
       */
     virtual void BroadcastUserInput(
@@ -1296,6 +1652,7 @@ class OpalMixerNode : public PSafeObject
     OpalMixerNodeInfo    * m_info;
     PTime                  m_creationTime;
     atomic<bool>           m_shuttingDown;
+    int                    m_placementGroup;
 
     PSafeArray<OpalConnection> m_connections;
     PString                    m_ownerConnection;
@@ -1304,6 +1661,8 @@ class OpalMixerNode : public PSafeObject
 #if OPAL_VIDEO
     typedef std::map<OpalVideoFormat::ContentRole, OpalVideoStreamMixer *> VideoMixerMap;
     VideoMixerMap m_videoMixers;
+    typedef std::map<OpalVideoFormat::ContentRole, OpalVideoStreamForwarder *> VideoForwarderMap;
+    VideoForwarderMap m_videoForwarders;
 #endif // OPAL_VIDEO
 
     typedef std::map<PString, OpalBaseMixer *> MixerByIdMap;
@@ -61,6 +61,7 @@ class OpalVXMLSession : public PVXMLSession
     virtual void OnEndDialog();
     virtual void OnEndSession();
     virtual bool OnTransfer(const PString & destination, TransferType type);
+    virtual PBoolean PlayFile(const PString & fn, PINDEX repeat = 1, PINDEX delay = 0, PBoolean autoDelete = false);
 
   protected:
     OpalIVRConnection & m_connection;
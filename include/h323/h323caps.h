@@ -42,6 +42,8 @@
 #include <h323/channels.h>
 #include <opal/mediasession.h>
 
+#include <list>
+
 
 /* The following classes have forward references to avoid including the VERY
    large header files for H225 and H245. If an application requires access
@@ -150,6 +152,18 @@ class H323Capability : public PObject
     /**Get the name of the media data format this class represents.
      */
     virtual PString GetFormatName() const = 0;
+
+    /**Get a key for the PDU this capability generates in a
+       TerminalCapabilitySet. Two capabilities with the same key must produce
+       identical PDUs, see H323CapabilitiesPDUCache.
+
+       The default behaviour uses the class, format name, capability number,
+       types, direction, media format options and, for generic capabilities,
+       the identifier and bit rate. An empty string is returned for
+       non-standard capabilities, as their data may vary, which prevents
+       caching.
+     */
+    virtual PString GetCapabilityPDUKey() const;
   //@}
 
   /**@name Operations */
@@ -529,6 +543,9 @@ class H323GenericCapabilityInfo
 
     virtual ~H323GenericCapabilityInfo() { }
 
+    /// Output the members that go into the PDU, see H323Capability::GetCapabilityPDUKey()
+    void PrintCapabilityPDUKey(ostream & strm) const;
+
   protected:
     virtual PBoolean OnSendingGenericPDU(
       H245_GenericCapability & pdu,
@@ -1406,6 +1423,11 @@ class H323ExtendedVideoCapability : public H323GenericVideoCapability
        This returns H245_VideoCapability::e_extendedVideoCapability.
      */
     virtual unsigned GetSubType() const;
+
+    /**Get a key for the PDU this capability generates.
+       This includes all the extended video formats.
+     */
+    virtual PString GetCapabilityPDUKey() const;
   //@}
 
   /**@name Protocol manipulation */
@@ -1669,6 +1691,11 @@ class H235SecurityCapability : public H323Capability
      */
     virtual PString GetFormatName() const;
 
+    /**Get a key for the PDU this capability generates.
+       This includes the media capability number and crypto suites.
+     */
+    virtual PString GetCapabilityPDUKey() const;
+
     /**This function is called whenever and outgoing TerminalCapabilitySet
        PDU is being constructed for the control channel. It allows the
        capability to set the PDU fields from information in members specific
@@ -1875,6 +1902,11 @@ class H323DataCapability : public H323Capability
        The default behaviour returns 3, indicating a data session.
       */
     virtual unsigned GetDefaultSessionID() const;
+
+    /**Get a key for the PDU this capability generates.
+       This includes the maximum bit rate.
+     */
+    virtual PString GetCapabilityPDUKey() const;
   //@}
 
   /**@name Protocol manipulation */
@@ -2427,6 +2459,11 @@ public:
   */
   virtual PString GetFormatName() const;
 
+  /**Get a key for the PDU this capability generates.
+     This includes the protected capability number.
+  */
+  virtual PString GetCapabilityPDUKey() const;
+
   /** This function is called whenever and outgoing TerminalCapabilitySet
       PDU is being constructed for the control channel. It allows the
       capability to set the PDU fields from information in members specific
@@ -2822,6 +2859,58 @@ class H323Capabilities : public PObject
 };
 
 
+/**Cache of capability table PDUs built by H323Capabilities::BuildPDU().
+   Building the capability table and descriptors, via each capabilities
+   OnSendingPDU(), is repeated for every call, although most calls from an
+   endpoint use the same capabilities. The cache key is made from the
+   usable capabilities, their numbers and media format options, and the
+   capability descriptors, so any change to the capabilities yields a new
+   key rather than a stale entry. The key cannot be a generation count, as
+   the capabilities, and their media formats, are new objects for each call.
+   samples/test/asnpdu times BuildPDU() with and without the cache.
+  */
+class H323CapabilitiesPDUCache : public PObject
+{
+    PCLASSINFO(H323CapabilitiesPDUCache, PObject);
+  public:
+    H323CapabilitiesPDUCache(
+      PINDEX maxSize = 16  ///< Maximum entries, zero disables cache
+    );
+    ~H323CapabilitiesPDUCache();
+
+    /**Get the capability table and descriptors previously built.
+       @return true if \p key was present.
+      */
+    bool Lookup(
+      const PString & key,
+      H245_TerminalCapabilitySet & pdu
+    );
+
+    /**Save the capability table and descriptors.
+      */
+    void Store(
+      const PString & key,
+      const H245_TerminalCapabilitySet & pdu
+    );
+
+    /// Set maximum entries, zero disables cache.
+    void SetMaxSize(PINDEX maxSize);
+
+    /// Get maximum entries.
+    PINDEX GetMaxSize() const { return m_maxSize; }
+
+    /// Remove all entries.
+    void RemoveAll();
+
+  protected:
+    PINDEX m_maxSize;
+    typedef std::map<PString, H245_TerminalCapabilitySet *> EntryMap;
+    EntryMap m_entries;
+    std::list<PString> m_order; // Oldest at front
+    PDECLARE_MUTEX(m_mutex);
+};
+
+
 ///////////////////////////////////////////////////////////////////////////////
 
 /* New capability registration macros based on abstract factories
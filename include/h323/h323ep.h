@@ -1038,6 +1038,10 @@ class H323EndPoint : public OpalRTPEndPoint
      */
     const H323Capabilities & GetCapabilities() const { return m_capabilities; }
 
+    /**Get the cache of capability table PDUs sent to remotes.
+     */
+    H323CapabilitiesPDUCache & GetCapabilitiesPDUCache() { return m_capabilitiesPDUCache; }
+
     /**Endpoint types.
      */
     enum TerminalTypes {
@@ -1459,7 +1463,8 @@ class H323EndPoint : public OpalRTPEndPoint
     std::set<OpalTransportPtr> m_reusableTransports;
     PDECLARE_MUTEX(            m_reusableTransportMutex);
 
-    H323Capabilities m_capabilities;
+    H323Capabilities         m_capabilities;
+    H323CapabilitiesPDUCache m_capabilitiesPDUCache;
 
     typedef PDictionary<PString, H323Gatekeeper> GatekeeperByAlias;
 
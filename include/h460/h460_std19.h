@@ -41,6 +41,7 @@
 #if OPAL_H460_NAT
 
 #include <rtp/rtp.h>
+#include <rtp/rtpmux.h>
 
 #if _MSC_VER
 #pragma once
@@ -107,21 +108,19 @@ class H46019Server : public PObject
     H323EndPoint & m_endpoint;
     unsigned       m_keepAliveTTL;         ///< KeepAlive TTL
 
-    PUDPSocket * m_keepAliveSocket;
-    PUDPSocket * m_rtpSocket;
-    PUDPSocket * m_rtcpSocket;
-
-    struct SocketPair {
+    // Relay from the shared ports to the real session sockets
+    struct SocketPair : OpalMediaMuxListener::Target {
       SocketPair(const PIPSocketAddressAndPort & rtp, const PIPSocketAddressAndPort & rtcp) : m_rtp(rtp), m_rtcp(rtcp) { }
+      virtual void OnMuxData(OpalMediaMuxListener & listener, OpalMediaTransportChannelTypes::SubChannels subchannel, const PBYTEArray & data, const PIPSocketAddressAndPort & remote, unsigned shard);
       PIPSocketAddressAndPort m_rtp;
       PIPSocketAddressAndPort m_rtcp;
     };
     typedef map<uint32_t, SocketPair> MuxMap;
     MuxMap m_multiplexedSockets;
+    PDECLARE_MUTEX(m_mutex);
 
-    PThread * m_multiplexThread;
-    void MultiplexThread();
-    bool Multiplex(bool rtcp);
+    OpalMediaMuxListener m_rtpListener;
+    OpalMediaMuxListener m_rtcpListener;
 };
 
 
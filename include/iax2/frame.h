@@ -41,6 +41,9 @@
 
 #include <ptlib/sockets.h>
 
+#include <map>
+#include <vector>
+
 #ifdef P_USE_PRAGMA
 #pragma interface
 #endif
@@ -77,6 +80,15 @@ class IAX2Frame :  public PObject
   
   /**Destructor - which is empty */
   virtual ~IAX2Frame();
+
+#if !PMEMORY_CHECK
+  /**At least one frame is created for every packet sent or received, so
+     the memory for frames is kept on free lists and reused. */
+  void * operator new(size_t nSize);
+
+  /**Return the memory for a frame to the free list */
+  void operator delete(void * ptr, size_t nSize);
+#endif
   
   /**Wait on the designated socket for an incoming UDP packet. This
      method is only called by the receiver. This method does NO interpretation*/
@@ -94,6 +106,26 @@ class IAX2Frame :  public PObject
   /**True if is is an audio frame */
   PBoolean IsAudio() const { return isAudio; }
 
+  /**True if this is a meta trunk frame, which carries the mini frames
+     of several calls to/from the same remote host */
+  PBoolean IsMetaTrunkFrame() const { return isMetaTrunk; }
+
+  /**Values for the meta command and command data bytes of a meta frame */
+  enum MetaTrunkValues {
+    metaTrunkCommand    = 1,   /*!< Meta command for a trunk frame */
+    metaTrunkTimeStamps = 1,   /*!< Command data flag, each entry carries its own time stamp */
+    metaTrunkHeaderSize = 8    /*!< Zeros, command, command data and 32 bit time stamp */
+  };
+
+  /**Split a meta trunk frame up into the mini frames it carries. Each
+     mini frame is processed (as by ProcessNetworkPacket) and added to the
+     supplied list. If the entries carry no time stamp, the time stamp of
+     the trunk frame is used.
+
+     This method will never delete the input frame.
+     @return false if this is not a valid meta trunk frame. */
+  PBoolean SplitMetaTrunkFrame(IAX2FrameList & frames);
+
   /**Pointer to the beginning of the media (after the header) in this packet.
      The low level frame has no idea on headers, so just return pointer to beginning
      of data. */
@@ -274,6 +306,9 @@ class IAX2Frame :  public PObject
   
   /**Flag to indicate if this is a MiniFrame with audio */
   PBoolean               isAudio;
+
+  /**Flag to indicate if this is a meta trunk frame */
+  PBoolean               isMetaTrunk;
   
   /**Index of where we are reading from the internal data area */
   PINDEX               currentReadIndex;  
@@ -354,9 +389,19 @@ class IAX2MiniFrame : public IAX2Frame
   /**Get the offset to the beginning of the encrypted region */
   virtual PINDEX GetEncryptionOffset();
 
+  /**True if this frame may be sent inside a meta trunk frame. Only
+     unencrypted audio frames can be trunked */
+  PBoolean CanTrunk() const { return canTrunk; }
+
+  /**Set the flag indicating this frame may be sent inside a meta trunk frame */
+  void SetCanTrunk(PBoolean newValue) { canTrunk = newValue; }
+
  protected:
   /**Initialise valus in this class to some preset value */
   void ZeroAllValues();
+
+  /**Flag to indicate this frame may be sent inside a meta trunk frame */
+  PBoolean canTrunk;
 };
 
 /////////////////////////////////////////////////////////////////////////////    
@@ -500,6 +545,16 @@ class IAX2FullFrame : public IAX2Frame
   /**Get flag to see if this frame is ready for deletion. In other
      words. Has it been sent too many times? */
   PBoolean  DeleteFrameNow() { return deleteFrameNow; }
+
+  /**Get the tick at which this frame should be resent, if it has not
+     been acknowledged by then. This is set on transmission. */
+  const PTimeInterval & GetRetransmitTick() const { return retransmitTick; }
+
+  /**Cope with timeout, when transmitting a full frame.  This happens when
+     a full frame has not been acknowledged in the required time
+     period. This frame is marked to be resent, or deleted if it has been
+     resent too many times. This is called by the IAX2AckingFrameList. */
+  void OnTransmissionTimeout();
   
   /**Get the sequence number info (inSeqNo and outSeqNo) */
   IAX2SequenceNumbers & GetSequenceInfo() { return sequence; }
@@ -547,16 +602,8 @@ class IAX2FullFrame : public IAX2Frame
      Whenever a frame is transmitted, this method will be called.*/
   virtual void InitialiseHeader(IAX2Processor *processor);
   
-#ifdef DOC_PLUS_PLUS
-  /** pwlib constructs to cope with timeout, when transmitting a full frame.  This
-      happens when a full frame has not been acknowledged in the
-      required time period. This frame will be resent.*/
-  void OnTransmissionTimeout(PTimer &, INT);
-#else
-  PDECLARE_NOTIFIER(PTimer, IAX2FullFrame, OnTransmissionTimeout);
-#endif
-  /** The timer which is used to test for no reply to this frame (on transmission) */
-  PTimer transmissionTimer;
+  /** The tick at which this frame is resent, if there has been no reply to it */
+  PTimeInterval retransmitTick;
   
   /** integer variable specifying the uncompressed subClass value for this particular frame */
   int subClass;
@@ -1165,6 +1212,10 @@ class IAX2FrameList : public PList<IAX2Frame>
      reply. The reply is the argument. */
   void DeleteMatchingSendFrame(IAX2FullFrame *reply);
 
+  /**Return true if the reply is the answer to the sent frame, so the
+     sent frame need not be retransmitted */
+  static PBoolean IsMatchingSendFrame(IAX2FullFrame *sent, IAX2FullFrame *reply);
+
   /** A Vnak frame has been received (voice not acknowledged) which actually
       means, retransmit all those frames you have on this particular call
       number from the oseqno specified in the supplied frame */
@@ -1195,6 +1246,98 @@ class IAX2ActiveFrameList : public IAX2FrameList
  public:
   IAX2ActiveFrameList() { Initialise(); }
 };
+
+/////////////////////////////////////////////////////////////////////////////
+/**The full frames which have been transmitted, and are waiting for an ack
+   (or some other reply).
+
+   The frames are held on a timer wheel, with a slot for each
+   WheelSlotTime milliseconds, so finding the frames that are to be resent
+   only looks at the frames which are due, rather than at every frame
+   waiting on an ack. The frames are also indexed by source call number,
+   as a reply always has a destination call number matching the sent frame.
+
+   Note please, this class is thread safe. Any frames left in this list
+   are deleted by the destructor.
+*/
+class IAX2AckingFrameList : public PObject
+{
+  PCLASSINFO(IAX2AckingFrameList, PObject);
+ public:
+  /**Construct an empty list */
+  IAX2AckingFrameList();
+
+  /**Destroy the list, and all frames in it */
+  ~IAX2AckingFrameList();
+
+  /**Report the frames queued in this list*/
+  void ReportList(PString & answer);
+
+  /**Get the number of frames waiting on a reply*/
+  PINDEX GetSize();
+
+  /**Add the frame, which has just been transmitted, to this list. The
+     frame is scheduled according to its GetRetransmitTick(). */
+  void AddNewFrame(IAX2FullFrame *src);
+
+  /**Delete the frame that has been sent, which is waiting for this
+     reply. The reply is the argument. */
+  void DeleteMatchingSendFrame(IAX2FullFrame *reply);
+
+  /** A Vnak frame has been received (voice not acknowledged) which actually
+      means, retransmit all those frames you have on this particular call
+      number from the oseqno specified in the supplied frame */
+  void SendVnakRequestedFrames(IAX2FullFrameProtocol &src);
+
+  /**Get a list of frames to send, and delete the timed out frames. Only
+     the timer wheel slots which have come due are examined. */
+  void GetResendFramesDeleteOldFrames(IAX2FrameList & framesToSend);
+
+  /**Get the tick at which GetResendFramesDeleteOldFrames() next needs to be
+     called. Return false if there are no frames waiting. */
+  PBoolean GetNextTimeout(PTimeInterval & tick);
+
+ protected:
+  enum {
+    WheelSlotTime = 50,   /*!< Milliseconds per slot */
+    WheelSlots    = 128   /*!< Number of slots, a span of 6.4 seconds */
+  };
+
+  typedef std::vector<IAX2FullFrame *> FrameVector;
+
+  /**Get the slot a tick falls in */
+  static PINDEX SlotOf(PInt64 tick) { return (PINDEX)((tick/WheelSlotTime) % WheelSlots); }
+
+  /**Put the frame in the wheel slot for its retransmit tick */
+  void ScheduleFrame(IAX2FullFrame *frame);
+
+  /**Take the frame out of the wheel, or the due list */
+  void RemoveFromWheel(IAX2FullFrame *frame);
+
+  /**Take the frame out of the call number index, and the count */
+  void RemoveFromCallIndex(IAX2FullFrame *frame);
+
+  /**Remove a pointer from the vector, return true if it was there */
+  static PBoolean RemoveFromVector(FrameVector & frames, IAX2FullFrame *frame);
+
+  /**The timer wheel */
+  FrameVector wheel[WheelSlots];
+
+  /**Frames which are to be resent as soon as possible, as a Vnak has been received */
+  FrameVector dueNow;
+
+  /**Frames indexed by their source call number */
+  std::map<PINDEX, FrameVector> byCallNumber;
+
+  /**The tick (in milliseconds, aligned to a slot) of the next slot to be examined */
+  PInt64 wheelTick;
+
+  /**Total number of frames in the list */
+  PINDEX count;
+
+  /**Local variable which protects access. */
+  PDECLARE_MUTEX(mutex);
+};
 /////////////////////////////////////////////////////////////////////////////    
 
 
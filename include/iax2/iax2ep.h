@@ -41,6 +41,7 @@
 #if OPAL_IAX2
 
 #include <opal/endpoint.h>
+#include <opal/eventpool.h>
 #include <iax2/iax2con.h>
 #include <iax2/processor.h>
 #include <iax2/regprocessor.h>
@@ -107,7 +108,8 @@ class IAX2EndPoint : public OpalEndPoint
   //@{
   /**Create the endpoint, and define local variables */
   IAX2EndPoint(
-    OpalManager & manager
+    OpalManager & manager,
+    WORD listenPort = DefaultUdpPort  ///< UDP port to send and receive on
   );
   
   /**Destroy the endpoint, and all associated connections*/
@@ -230,6 +232,34 @@ class IAX2EndPoint : public OpalEndPoint
   /**Set the password to some value */
   void SetPassword(PString newValue);
 
+  /**Modes for sending audio mini frames inside meta trunk frames. Trunking
+     puts the audio for all calls to the one remote host into a single
+     datagram, sent on a shared tick. Incoming trunk frames are always
+     accepted. */
+  enum TrunkModes {
+    TrunkDisabled,  /*!< Never send trunk frames */
+    TrunkEnabled,   /*!< Trunk the audio to every remote host */
+    TrunkAuto       /*!< Trunk the audio to remote hosts which send trunk frames to us */
+  };
+
+  /**Set the trunk mode, the interval (in ms) at which trunk frames are sent,
+     and if each trunk entry carries its own time stamp. */
+  void SetTrunking(TrunkModes mode, PINDEX period = 20, PBoolean withTimeStamps = true);
+
+  /**Get the current trunk mode */
+  TrunkModes GetTrunkMode() const { return m_trunkMode; }
+
+  /**Get the interval, in ms, at which trunk frames are sent */
+  PINDEX GetTrunkPeriod() const { return m_trunkPeriod; }
+
+  /**Get flag indicating each trunk entry carries its own time stamp */
+  PBoolean GetTrunkTimeStamps() const { return m_trunkTimeStamps; }
+
+  /**Get the pool of worker threads on which the call, registration and
+     special packet processors run. Work for one processor is always
+     executed in order, and never concurrently. */
+  OpalEventPool & GetProcessorPool() { return m_processorPool; }
+
   /**It is possible that a retransmitted frame has been in the transmit queue,
      and while sitting there that frames sending connection has died.  Thus,
      prior to transmission, call tis method.
@@ -419,6 +449,13 @@ class IAX2EndPoint : public OpalEndPoint
   /**The socket on which all data is sent/received.*/
   PUDPSocket  *m_sock;
 
+  /**The UDP port m_sock is bound to */
+  WORD m_listenPort;
+
+  /**Worker threads shared by all the processors, so there is not a thread
+     per call */
+  OpalEventPool m_processorPool;
+
   /**Number of active calls */
   int m_callnumbs;
   
@@ -436,6 +473,15 @@ class IAX2EndPoint : public OpalEndPoint
   
   /**Password for this user, which is used when processing an authentication request */
   PString m_password;
+
+  /**Trunk mode for outgoing audio */
+  TrunkModes m_trunkMode;
+
+  /**Interval, in ms, at which trunk frames are sent */
+  PINDEX m_trunkPeriod;
+
+  /**Flag to indicate each trunk entry carries its own time stamp */
+  PBoolean m_trunkTimeStamps;
   
   /**Counter to use for sending on status query frames */
   PINDEX m_statusQueryCounter;
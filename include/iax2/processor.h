@@ -126,10 +126,13 @@ class IAX2WaitingForAck : public PObject
     frames) are used to determine which processor will handle which incoming
     packet.
  
-    Each processor runs in its own thread so as to process incoming packets in
-    a timely fashion.
+    Processors do not have their own thread. When there is something for a
+    processor to do, it is scheduled on the endpoints processor pool, keyed
+    by the source call number. A processor is only ever run by one worker
+    at a time, so incoming packets for a call are handled in order. Thus,
+    thousands of calls do not need thousands of threads.
  */
-class IAX2Processor : public PThread
+class IAX2Processor : public PObject
 {
   PCLASSINFO(IAX2Processor, PObject);
   
@@ -176,8 +179,9 @@ class IAX2Processor : public PThread
   /**Get the call start tick */
   const PTimeInterval & GetCallStartTick() { return callStartTick; }
   
-  /**The worker method of this thread. In here, all incoming frames (for this call)
-     are handled.
+  /**The worker method of this processor, which is executed on a thread
+     from the processor pool. In here, all incoming frames (for this call)
+     are handled. It runs until there is nothing left to do.
   */
   void Main();
   
@@ -189,13 +193,25 @@ class IAX2Processor : public PThread
      packets which are not sent to any particular call) */
   void SetSpecialPackets(PBoolean newValue) { specialPackets = newValue; }
   
-  /**Cause this thread to die immediately */
+  /**Cause this processor to finish up. Any pending work is done, and
+     then no further work is scheduled. */
   void Terminate();
+
+  /**Wait for the processor to finish after Terminate() has been called.
+
+     @return false if timed out */
+  PBoolean WaitForTermination(const PTimeInterval & maxWait = PMaxTimeInterval);
+
+  /**Return true if the processor has finished, and will not run again */
+  PBoolean IsTerminated() const { return terminated; }
   
-  /**Cause this thread to come to life, and process events that are
-   * pending at IAX2Connection. This method does not start this
-   * thread. This method causes this thread to be joggled back into
-   * life, after waiting on a PSyncPoint. */
+  /**Allow this processor to run. Until this is called, Activate() records
+     that there is work pending, but does not schedule the processor. */
+  void Start();
+  
+  /**Cause this processor to process events that are pending at
+   * IAX2Connection. If the processor has been started, and is not already
+   * scheduled, it is queued on the processor pool. */
   void Activate();
 
   /**Test the sequence number of the incoming frame. This is only
@@ -232,18 +248,40 @@ class IAX2Processor : public PThread
   /** The timer which is used to test for no reply to our outgoing call setup messages */
   PTimer noResponseTimer;
   
-  /**Activate this thread to process all the lists of queued frames */
-  void CleanPendingLists() { activate.Signal(); }
+  /**Activate this processor to process all the lists of queued frames */
+  void CleanPendingLists() { Activate(); }
   
   /**Action to perform on receiving an ACK packet (which is required
      during call setup phase for receiver */
   IAX2WaitingForAck nextTask;
   
-   /**Flag which is used to activate this thread, so all pending tasks/packets are processed */
-  PSyncPoint activate;
+  /**Queue this processor on the endpoints processor pool */
+  void Schedule();
+  
+  /**Flag to indicate, end this processor */
+  atomic<bool> endProcessing;
+  
+  /**Flag to indicate Start() has been called */
+  PBoolean started;
+  
+  /**Flag to indicate the processor is queued on, or running in, the pool */
+  PBoolean scheduled;
+  
+  /**Flag to indicate Activate() was called, and there is work to do */
+  PBoolean activatePending;
+  
+  /**Flag to indicate the processor has finished */
+  atomic<bool> terminated;
+  
+  /**Protect the started/scheduled/pending flags */
+  PDECLARE_MUTEX(scheduleMutex);
+  
+  /**Signalled when the processor has finished */
+  PSyncPoint terminatedSync;
   
-  /**Flag to indicate, end this thread */
-  PBoolean endThread;
+  /**Maximum number of times ProcessLists() is called before giving up the
+     worker thread to other processors */
+  enum { MaxPassesPerRun = 8 };
   
   /**Status of encryption for this processor - by default, no encryption */
   IAX2Encryption encryption;
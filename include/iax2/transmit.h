@@ -47,6 +47,53 @@
 #pragma interface
 #endif
 
+/**Collect the audio mini frames being sent to one remote host, and build
+   them into a meta trunk frame. The whole buffer is sent as one datagram
+   on the next trunk tick, or sooner if it gets full. */
+class IAX2TrunkBuffer : public PObject
+{
+  PCLASSINFO(IAX2TrunkBuffer, PObject);
+ public:
+  /**Largest trunk frame we build, which keeps clear of fragmentation */
+  enum { MaxTrunkFrameSize = 1400 };
+
+  /**Constructor, for the designated remote host */
+  IAX2TrunkBuffer(IAX2Remote & remote, PBoolean withTimeStamps);
+
+  /**Add the media of the supplied mini frame to the buffer.
+     @return false if there is no room for it. */
+  PBoolean AddMiniFrame(IAX2MiniFrame & frame);
+
+  /**Send the meta trunk frame, and empty the buffer.
+     @return number of bytes sent, 0 if empty or failed. */
+  PINDEX Transmit(PUDPSocket & sock, DWORD timeStamp);
+
+  /**True if there are no mini frames in the buffer */
+  PBoolean IsEmpty() const { return entries == 0; }
+
+  /**Number of mini frames in the buffer */
+  PINDEX GetEntries() const { return entries; }
+
+  /**Number of trunk ticks since anything was put in this buffer */
+  PINDEX idleTicks;
+
+ protected:
+  /**Where the trunk frame is sent to */
+  IAX2Remote remote;
+
+  /**Flag to indicate each entry has its own time stamp */
+  PBoolean withTimeStamps;
+
+  /**The trunk frame being built, including space for the header */
+  PBYTEArray data;
+
+  /**Number of bytes used in data */
+  PINDEX dataSize;
+
+  /**Number of mini frames in data */
+  PINDEX entries;
+};
+
 /**Manage the transmission of ethernet packets on the specified
    port.  All transmitted packets are received from any of the current
    connections.  A separate thread is used to wait on the request to
@@ -111,6 +158,17 @@ class IAX2Transmit : public PThread
 
   /** Report on the contents of the lists waiting for transmission */
   void ReportLists(PString & answer, bool getFullReport=false);
+
+  /** A meta trunk frame has been received from the remote host. If the
+      endpoint is in TrunkAuto mode, audio to this host is now trunked */
+  void OnMetaTrunkReceived(IAX2Remote & remote);
+
+  /** Get the number of datagrams and bytes sent, and the number of meta
+      trunk frames and the mini frames they carried. */
+  void GetTrafficCounts(PUInt64 & packets,
+			PUInt64 & bytes,
+			PUInt64 & trunkFrames,
+			PUInt64 & trunkedMiniFrames);
   //@}
   
  protected:
@@ -121,6 +179,20 @@ class IAX2Transmit : public PThread
   
   /**Go through the send list:: send all frames on this list */
   void ProcessSendList();
+
+  /**If the supplied frame can be trunked, add it to the trunk buffer for
+     its remote host and delete it.
+     @return true if the frame was taken. */
+  PBoolean TrunkFrame(IAX2Frame *frame);
+
+  /**If the trunk tick has arrived, send all the trunk frames */
+  void ProcessTrunks();
+
+  /**Send one trunk buffer. trunkMutex must be held */
+  void TransmitTrunk(IAX2TrunkBuffer & buffer);
+
+  /**Build the key used to find the trunk buffer for a remote host */
+  static PString TrunkKey(IAX2Remote & remote);
   
   /**Global variable specifying application specific variables */
   IAX2EndPoint &ep;
@@ -135,13 +207,37 @@ class IAX2Transmit : public PThread
      ack. Full frames in this list will be resent an additional 3
      times if not replied to. There are no mini frames in this list -
      mini frames are not acked.*/
-  IAX2ActiveFrameList  ackingFrames;   
+  IAX2AckingFrameList  ackingFrames;   
   
   /**Send Now list of frames - These frames are to be sent now */
   IAX2ActiveFrameList  sendNowFrames;  
   
   /**Flag to indicate that this thread should keep working */
   PBoolean       keepGoing;
+
+  /**Trunk buffers, indexed by remote host address and port */
+  PDictionary<PString, IAX2TrunkBuffer> trunkBuffers;
+
+  /**Remote hosts which have sent meta trunk frames to us */
+  PStringSet     trunkPeers;
+
+  /**Number of mini frames waiting in all the trunk buffers */
+  PINDEX         trunkPending;
+
+  /**When the next trunk frames are to be sent, from PTimer::Tick() */
+  PTimeInterval  nextTrunkTick;
+
+  /**Base for the time stamp in the meta trunk frame header */
+  PTimeInterval  trunkStartTick;
+
+  /**Mutex protecting the trunk buffers and the traffic counts */
+  PDECLARE_MUTEX(trunkMutex);
+
+  /**Traffic counts, for reporting */
+  PUInt64        packetsSent;
+  PUInt64        bytesSent;
+  PUInt64        trunkFramesSent;
+  PUInt64        trunkedMiniFrames;
 };
 
 
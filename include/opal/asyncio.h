@@ -0,0 +1,266 @@
+/*
+ * asyncio.h
+ *
+ * Asynchronous, write behind, file output
+ *
+ * Open Phone Abstraction Library (OPAL)
+ *
+ * Copyright (c) 2021 Vox Lucida Pty. Ltd.
+ *
+ * The contents of this file are subject to the Mozilla Public License
+ * Version 1.0 (the "License"); you may not use this file except in
+ * compliance with the License. You may obtain a copy of the License at
+ * http://www.mozilla.org/MPL/
+ *
+ * Software distributed under the License is distributed on an "AS IS"
+ * basis, WITHOUT WARRANTY OF ANY KIND, either express or implied. See
+ * the License for the specific language governing rights and limitations
+ * under the License.
+ *
+ * The Original Code is Open Phone Abstraction Library.
+ *
+ * The Initial Developer of the Original Code is Vox Lucida Pty. Ltd.
+ *
+ * Contributor(s): ______________________________________.
+ */
+
+#ifndef OPAL_OPAL_ASYNCIO_H
+#define OPAL_OPAL_ASYNCIO_H
+
+#ifdef P_USE_PRAGMA
+#pragma interface
+#endif
+
+#include <opal_config.h>
+
+#include <ptlib/notifier.h>
+
+#include <deque>
+#include <vector>
+
+
+class OpalAsyncWriter;
+
+
+/**Service executing file writes on behalf of media threads.
+   A small pool of threads performs the actual I/O for any number of
+   OpalAsyncWriter instances, so a slow disk delays only the pool, never
+   the media patch or mixer threads that produced the data. Writes for any
+   one writer are always executed in order, and by one thread at a time.
+
+   The total memory held, across all writers, is bounded. When exceeded,
+   writers reject further data until the pool catches up.
+  */
+class OpalAsyncIOService : public PObject
+{
+    PCLASSINFO(OpalAsyncIOService, PObject);
+  public:
+    /**Create service.
+       If \p threads is zero, a default of two is used.
+      */
+    OpalAsyncIOService(
+      unsigned threads = 0,
+      PINDEX maxBuffered = 64*1024*1024
+    );
+
+    /**Destroy service.
+       All writers must be closed before this is called.
+      */
+    ~OpalAsyncIOService();
+
+    /// Get the process wide service used by default.
+    static OpalAsyncIOService & GetInstance();
+
+    /// Get the limit on memory held by all writers.
+    PINDEX GetMaxBuffered() const { return m_maxBuffered; }
+
+    /// Set the limit on memory held by all writers.
+    void SetMaxBuffered(PINDEX bytes) { m_maxBuffered = bytes; }
+
+    /// Get the bytes currently waiting to be written, across all writers.
+    PINDEX GetBuffered() const { return m_buffered; }
+
+  protected:
+    void Schedule(OpalAsyncWriter & writer);
+    void Unschedule(OpalAsyncWriter & writer);
+    bool Reserve(PINDEX bytes);
+    void Release(PINDEX bytes);
+    void ThreadMain();
+
+    std::vector<PThread *>        m_threads;
+    std::deque<OpalAsyncWriter *> m_ready;
+    PDECLARE_MUTEX(               m_mutex);
+    PSemaphore                    m_available;
+    atomic<bool>                  m_running;
+    atomic<PINDEX>                m_maxBuffered;
+    atomic<PINDEX>                m_buffered;
+
+  friend class OpalAsyncWriter;
+};
+
+
+/**Write behind buffer for a single output.
+   Data given to Write() is copied into batches of up to the batch size,
+   which are handed to the OpalAsyncIOService as they fill. The service
+   calls OnWrite() from one of its threads.
+
+   If \p coalesce is true, consecutive writes with the same tag are joined
+   so OnWrite() is called with large, batch size, blocks, suitable for byte
+   stream files. Otherwise OnWrite() is called once for each Write(), as is
+   needed for frame oriented outputs such as PMediaFile.
+
+   Derived classes must call Close() in their destructor.
+  */
+class OpalAsyncWriter : public PObject
+{
+    PCLASSINFO(OpalAsyncWriter, PObject);
+  public:
+    OpalAsyncWriter(
+      const PString & name,
+      bool coalesce,
+      PINDEX batchSize = 65536,
+      PINDEX maxBuffered = 4*1024*1024,
+      OpalAsyncIOService & service = OpalAsyncIOService::GetInstance()
+    );
+    ~OpalAsyncWriter();
+
+    /**Queue data to be written.
+       This never blocks on I/O. If the writer, or the service as a whole,
+       has reached its limit of buffered data, the data is rejected and
+       false is returned. The caller may drop the data, or retry later.
+      */
+    bool Write(
+      const void * data,
+      PINDEX length,
+      unsigned tag = 0
+    );
+
+    /**Hand partially filled batch to the service.
+       If \p wait is true, then this blocks until all data written so far
+       has been passed to OnWrite().
+      */
+    bool Flush(
+      bool wait = false
+    );
+
+    /**Flush and wait for all data to be written.
+       No further writes are accepted.
+      */
+    void Close();
+
+    /// Indicate further data is rejected due to too much buffering.
+    bool IsBackPressured() const { return m_backPressured; }
+
+    /**Notification of back pressure changes.
+       Called with true when Write() starts rejecting data, and false when
+       less than half the writers limit is buffered again.
+      */
+    typedef PNotifierTemplate<bool> BackPressureNotifier;
+    #define PDECLARE_BackPressureNotifier(cls, fn) PDECLARE_NOTIFIER2(OpalAsyncWriter, cls, fn, bool)
+    #define PCREATE_BackPressureNotifier(fn) PCREATE_NOTIFIER2(fn, bool)
+
+    void SetBackPressureNotifier(const BackPressureNotifier & notifier) { m_backPressureNotifier = notifier; }
+
+    struct Statistics
+    {
+      Statistics();
+      void PrintOn(ostream & strm) const;
+      friend ostream & operator<<(ostream & strm, const Statistics & stats) { stats.PrintOn(strm); return strm; }
+
+      uint64_t      m_bytesWritten;   ///< Total bytes passed to OnWrite()
+      uint64_t      m_writes;         ///< Number of calls to OnWrite()
+      uint64_t      m_batches;        ///< Number of batches handed to the service
+      uint64_t      m_flushes;        ///< Number of explicit Flush() calls
+      uint64_t      m_failures;       ///< Number of times OnWrite() returned false
+      uint64_t      m_rejected;       ///< Number of Write() calls rejected by back pressure
+      uint64_t      m_rejectedBytes;  ///< Bytes rejected by back pressure
+      PINDEX        m_buffered;       ///< Bytes currently waiting to be written
+      PINDEX        m_maxBuffered;    ///< High water mark of bytes waiting
+      PTimeInterval m_writeTime;      ///< Total time spent in OnWrite()
+      PTimeInterval m_maxWriteTime;   ///< Longest time for a single batch
+    };
+
+    /// Get statistics for this writer.
+    void GetStatistics(Statistics & statistics) const;
+
+    /// Get name of writer, e.g. file name, for logging.
+    const PString & GetName() const { return m_name; }
+
+  protected:
+    /**Perform the actual write, called from a service thread.
+       Return false on error, the failure is counted, but following data is
+       still written.
+      */
+    virtual bool OnWrite(
+      const BYTE * data,
+      PINDEX length,
+      unsigned tag
+    ) = 0;
+
+    struct Segment
+    {
+      Segment(PINDEX offset, PINDEX length, unsigned tag) : m_offset(offset), m_length(length), m_tag(tag) { }
+      PINDEX   m_offset;
+      PINDEX   m_length;
+      unsigned m_tag;
+    };
+    struct Batch
+    {
+      PBYTEArray           m_data;
+      PINDEX               m_used;
+      std::vector<Segment> m_segments;
+    };
+
+    bool InternalSubmit();
+    void InternalSetBackPressure(bool pressure);
+    void ExecutePending();
+
+    OpalAsyncIOService & m_service;
+    PString              m_name;
+    bool                 m_coalesce;
+    PINDEX               m_batchSize;
+    PINDEX               m_maxBuffered;
+
+    Batch              * m_current;
+    std::deque<Batch *>  m_pending;
+    bool                 m_scheduled;
+    bool                 m_executing;
+    bool                 m_closed;
+    atomic<bool>         m_backPressured;
+    BackPressureNotifier m_backPressureNotifier;
+    PSyncPoint           m_drained;
+    Statistics           m_statistics;
+    PDECLARE_MUTEX(      m_mutex);
+
+    PTRACE_THROTTLE(m_throttleRejected, 2, 5000);
+
+  friend class OpalAsyncIOService;
+};
+
+
+/**Write behind buffer for a PChannel, usually a PFile.
+   The channel is not owned, and must not be closed until after Close().
+  */
+class OpalAsyncChannelWriter : public OpalAsyncWriter
+{
+    PCLASSINFO(OpalAsyncChannelWriter, OpalAsyncWriter);
+  public:
+    OpalAsyncChannelWriter(
+      PChannel & channel,
+      PINDEX batchSize = 65536,
+      PINDEX maxBuffered = 4*1024*1024,
+      OpalAsyncIOService & service = OpalAsyncIOService::GetInstance()
+    );
+    ~OpalAsyncChannelWriter();
+
+  protected:
+    virtual bool OnWrite(const BYTE * data, PINDEX length, unsigned tag);
+
+    PChannel & m_channel;
+};
+
+
+#endif // OPAL_OPAL_ASYNCIO_H
+
+
+// End of File ///////////////////////////////////////////////////////////////
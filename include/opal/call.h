@@ -549,6 +549,12 @@ class OpalCall : public PSafeObject, protected OpalCallStatistics
      */
     const PString & GetToken() const { return m_token; }
 
+    /**Get the CPU core group this call was placed on.
+       Returns -1 if OpalManager placement is not enabled.
+       See OpalPlacementPolicy.
+     */
+    int GetPlacementGroup() const { return m_placementGroup; }
+
     /**Get the A party URI for the call.
        Note this will be available even after the A party connection has been
        released from the call.
@@ -661,6 +667,11 @@ class OpalCall : public PSafeObject, protected OpalCallStatistics
       */
     bool IsRecording() const;
 
+    /**Indicate if the active recording takes encoded media as is, rather
+       than decoded audio and video. See OpalRecordManager::IsPassThrough().
+      */
+    bool IsRecordingPassThrough() const;
+
     /** Stop a recording.
         Returns true if the call does exists, an active call is not indicated.
       */
@@ -694,6 +705,14 @@ class OpalCall : public PSafeObject, protected OpalCallStatistics
       const RTP_DataFrame & frame     ///< Media data
     );
 #endif
+
+    /** Call back for having a packet of encoded media to record.
+        This is only used when IsRecordingPassThrough() is true.
+      */
+    virtual void OnRecordEncoded(
+      const PString & streamId,       ///< Unique ID for stream within call
+      const RTP_DataFrame & frame     ///< Media data, as sent/received
+    );
 #endif // OPAL_HAS_MIXER
 
     void InternalOnClear();
@@ -719,6 +738,7 @@ class OpalCall : public PSafeObject, protected OpalCallStatistics
     OpalManager & m_manager;
 
     PString m_token;
+    int     m_placementGroup;
 
     bool    m_isEstablished;
     bool    m_isClearing;
@@ -1967,6 +1967,8 @@ class OpalConnection : public PSafeObject, protected OpalConnectionInfo
     PDECLARE_NOTIFIER(RTP_DataFrame, OpalConnection, OnRecordVideo);
     void InternalOnRecordVideo(PString key, std::auto_ptr<RTP_DataFrame> frame);
 #endif
+    PDECLARE_NOTIFIER(RTP_DataFrame, OpalConnection, OnRecordEncoded);
+    void InternalOnRecordEncoded(PString key, std::auto_ptr<RTP_DataFrame> frame);
 
     virtual void OnStartRecording(OpalMediaPatch * patch);
     virtual void OnStopRecording(OpalMediaPatch * patch);
@@ -2051,6 +2053,7 @@ class OpalConnection : public PSafeObject, protected OpalConnectionInfo
 #if OPAL_VIDEO
     PNotifier     m_recordVideoNotifier;
 #endif
+    PNotifier     m_recordEncodedNotifier;
 #endif
 
     OpalMediaType::AutoStartMap m_autoStartInfo;
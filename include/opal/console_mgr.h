@@ -550,6 +550,7 @@ class OpalManagerCLI : public OpalManagerConsole
 
 #if PTRACING
     PDECLARE_NOTIFIER(PCLI::Arguments, OpalManagerCLI, CmdTrace);
+    PDECLARE_NOTIFIER(PCLI::Arguments, OpalManagerCLI, CmdEventTrace);
 #endif
 
 #if OPAL_STATISTICS
@@ -579,6 +580,7 @@ class OpalManagerCLI : public OpalManagerConsole
     PDECLARE_NOTIFIER(PCLI::Arguments, OpalManagerCLI, CmdCodecMask);
     PDECLARE_NOTIFIER(PCLI::Arguments, OpalManagerCLI, CmdCodecOption);
     PDECLARE_NOTIFIER(PCLI::Arguments, OpalManagerCLI, CmdShowCalls);
+    PDECLARE_NOTIFIER(PCLI::Arguments, OpalManagerCLI, CmdShowPlacement);
     PDECLARE_NOTIFIER(PCLI::Arguments, OpalManagerCLI, CmdSendUserInput);
     PDECLARE_NOTIFIER(PCLI::Arguments, OpalManagerCLI, CmdHangUp);
     PDECLARE_NOTIFIER(PCLI::Arguments, OpalManagerCLI, CmdDelay);
@@ -0,0 +1,220 @@
+/*
+ * eventpool.h
+ *
+ * Adaptive, affinity ordered, work stealing thread pool for decoupled events.
+ *
+ * Open Phone Abstraction Library (OPAL)
+ *
+ * Copyright (c) 2021 Vox Lucida Pty. Ltd.
+ *
+ * The contents of this file are subject to the Mozilla Public License
+ * Version 1.0 (the "License"); you may not use this file except in
+ * compliance with the License. You may obtain a copy of the License at
+ * http://www.mozilla.org/MPL/
+ *
+ * Software distributed under the License is distributed on an "AS IS"
+ * basis, WITHOUT WARRANTY OF ANY KIND, either express or implied. See
+ * the License for the specific language governing rights and limitations
+ * under the License.
+ *
+ * The Original Code is Open Phone Abstraction Library.
+ *
+ * The Initial Developer of the Original Code is Vox Lucida Pty. Ltd.
+ *
+ * Contributor(s): ______________________________________.
+ */
+
+#ifndef OPAL_OPAL_EVENTPOOL_H
+#define OPAL_OPAL_EVENTPOOL_H
+
+#ifdef P_USE_PRAGMA
+#pragma interface
+#endif
+
+#include <opal_config.h>
+
+#include <ptlib/safecoll.h>
+
+#include <queue>
+#include <map>
+#include <deque>
+
+
+///////////////////////////////////////////////////////////////////////////////
+
+/**Thread pool for executing PSafeWork items, e.g. decoupled events.
+
+   Work items queued with the same affinity key (typically a call token) are
+   executed strictly in the order they were queued, and never concurrently.
+   Items with different keys run in parallel, so a slow handler for one call
+   does not hold up any other call.
+
+   Each worker thread has its own ready list of affinity queues. An idle
+   worker will take (steal) ready queues from the other workers. The number
+   of workers grows, up to a maximum, when all of them are busy and work is
+   waiting, and shrinks back to the minimum when they have been idle for a
+   while.
+  */
+class OpalEventPool : public PObject
+{
+    PCLASSINFO(OpalEventPool, PObject);
+  public:
+  /**@name Construction */
+  //@{
+    /**Create a new pool.
+       If \p minWorkers is zero, the number of CPU cores is used. If
+       \p maxWorkers is zero, four times the number of CPU cores is used.
+      */
+    OpalEventPool(
+      unsigned minWorkers = 0,        ///< Minimum worker threads
+      unsigned maxWorkers = 0,        ///< Maximum worker threads
+      const char * threadName = NULL  ///< Name for worker threads
+    );
+
+    /**Destroy the pool, waiting for all workers to stop.
+       Any queued, but not executed, work is deleted.
+      */
+    ~OpalEventPool();
+  //@}
+
+  /**@name Operations */
+  //@{
+    /**Queue some work.
+       The pool takes ownership of \p work and will delete it after it has
+       been executed.
+
+       @return false if the pool has been shut down.
+      */
+    bool AddWork(
+      PSafeWork * work,                              ///< Work to do
+      const PString & affinity = PString::Empty()    ///< Ordering key, empty is no ordering
+    );
+
+    /**Stop all workers and delete any outstanding work.
+      */
+    void Shutdown();
+
+    /**Set the limits on the number of worker threads.
+       Zero values are as for the constructor. The maximum cannot be raised
+       above the larger of that given to the constructor, or four times the
+       number of CPU cores.
+      */
+    void SetWorkerLimits(
+      unsigned minWorkers,
+      unsigned maxWorkers
+    );
+
+    /**Get the minimum number of workers.
+      */
+    unsigned GetMinWorkers() const { return m_minWorkers; }
+
+    /**Get the maximum number of workers.
+      */
+    unsigned GetMaxWorkers() const { return m_maxWorkers; }
+  //@}
+
+  /**@name Statistics */
+  //@{
+    /// Histogram of times, in microseconds.
+    struct Histogram
+    {
+      enum { NumBuckets = 12 };
+      static const unsigned BucketLimits[NumBuckets];
+
+      Histogram();
+      void Add(PInt64 microseconds);
+      void Merge(const Histogram & other);
+
+      /// Get approximate percentile, as the upper limit of the bucket containing it.
+      PInt64 GetPercentile(unsigned percent) const;
+
+      uint64_t m_counts[NumBuckets];
+      uint64_t m_total;
+      PInt64   m_maximum;
+    };
+
+    struct Statistics
+    {
+      Statistics();
+      void PrintOn(ostream & strm) const;
+      friend ostream & operator<<(ostream & strm, const Statistics & stats) { stats.PrintOn(strm); return strm; }
+
+      unsigned  m_workers;        ///< Current number of worker threads
+      unsigned  m_busyWorkers;    ///< Workers currently executing an item
+      unsigned  m_peakWorkers;    ///< Maximum number of worker threads ever running
+      unsigned  m_queueDepth;     ///< Items queued but not yet executing
+      unsigned  m_peakQueueDepth; ///< Maximum value of m_queueDepth
+      unsigned  m_affinityQueues; ///< Number of active affinity keys
+      uint64_t  m_executed;       ///< Total items executed
+      uint64_t  m_stolen;         ///< Items taken from another worker's ready list
+      Histogram m_queueLatency;   ///< Time from AddWork() to execution start
+      Histogram m_executionTime;  ///< Time spent executing items
+    };
+
+    /**Get statistics for pool.
+      */
+    void GetStatistics(
+      Statistics & statistics
+    ) const;
+  //@}
+
+  protected:
+    struct Item
+    {
+      Item(PSafeWork * work = NULL) : m_work(work) { }
+      PSafeWork * m_work;
+      PTime       m_queued;
+    };
+
+    struct AffinityQueue
+    {
+      AffinityQueue(const PString & key) : m_key(key), m_scheduled(false) { }
+      PString          m_key;
+      std::queue<Item> m_items;
+      bool             m_scheduled;
+    };
+
+    struct Worker
+    {
+      Worker() : m_thread(NULL), m_running(false), m_executed(0), m_stolen(0) { }
+      PThread                    * m_thread;
+      bool                         m_running;
+      PDECLARE_MUTEX(              m_mutex);
+      std::deque<AffinityQueue *>  m_ready;
+      Histogram                    m_queueLatency;
+      Histogram                    m_executionTime;
+      uint64_t                     m_executed;
+      uint64_t                     m_stolen;
+    };
+
+    void Schedule(AffinityQueue * queue, size_t preferredWorker);
+    AffinityQueue * GetReady(size_t index);
+    void Execute(size_t index, AffinityQueue * queue);
+    void StartWorker();
+    void WorkerMain(size_t index);
+
+    PString  m_threadName;
+    unsigned m_minWorkers;
+    unsigned m_maxWorkers;
+
+    std::vector<Worker *> m_workers; // Fixed size, set in constructor
+    PDECLARE_MUTEX(       m_workersMutex);
+    atomic<unsigned>      m_runningWorkers;
+    atomic<unsigned>      m_busyWorkers;
+    unsigned              m_peakWorkers;
+    atomic<size_t>        m_nextWorker;
+    PSemaphore            m_readySignal;
+    atomic<bool>          m_shutdown;
+
+    typedef std::map<PString, AffinityQueue *> AffinityMap;
+    AffinityMap      m_affinityQueues;
+    PDECLARE_MUTEX(  m_queuesMutex);
+    unsigned         m_queueDepth;
+    unsigned         m_peakQueueDepth;
+};
+
+
+#endif // OPAL_OPAL_EVENTPOOL_H
+
+
+// End of File ///////////////////////////////////////////////////////////////
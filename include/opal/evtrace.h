@@ -0,0 +1,227 @@
+/*
+ * evtrace.h
+ *
+ * Binary event tracing for media hot paths
+ *
+ * Open Phone Abstraction Library (OPAL)
+ *
+ * Copyright (c) 2021 Vox Lucida Pty. Ltd.
+ *
+ * The contents of this file are subject to the Mozilla Public License
+ * Version 1.0 (the "License"); you may not use this file except in
+ * compliance with the License. You may obtain a copy of the License at
+ * http://www.mozilla.org/MPL/
+ *
+ * Software distributed under the License is distributed on an "AS IS"
+ * basis, WITHOUT WARRANTY OF ANY KIND, either express or implied. See
+ * the License for the specific language governing rights and limitations
+ * under the License.
+ *
+ * The Original Code is Open Phone Abstraction Library.
+ *
+ * The Initial Developer of the Original Code is Vox Lucida Pty. Ltd.
+ *
+ * Contributor(s): ______________________________________.
+ */
+
+#ifndef OPAL_OPAL_EVTRACE_H
+#define OPAL_OPAL_EVTRACE_H
+
+#ifdef P_USE_PRAGMA
+#pragma interface
+#endif
+
+#include <opal_config.h>
+
+#include <vector>
+
+
+#ifndef OPAL_EVENT_TRACING
+  #define OPAL_EVENT_TRACING PTRACING
+#endif
+
+
+/**Binary event tracer for media hot paths.
+   Per packet tracing via PTRACE is too expensive to enable on a loaded
+   system, every call pays for the ostream formatting and the global trace
+   lock. This tracer instead records a fixed size binary record, with an
+   event ID known at compile time, into a lock free ring buffer belonging
+   to the calling thread. A background thread drains the buffers to a file,
+   which is formatted later by Decode(), e.g. via the evtrace test program.
+
+   Recording can be restricted to a small set of PTRACE context identifiers,
+   which are shared by all the objects of a call, or RTP SSRC values. When
+   the tracer is stopped, the cost of an OPAL_EVENT_TRACE() is a single
+   load and test.
+
+   If a threads buffer is full because the drain thread has fallen behind,
+   the event is discarded and counted, the media thread never waits.
+  */
+class OpalEventTracer : public PObject
+{
+    PCLASSINFO(OpalEventTracer, PObject);
+  public:
+    /// Event identifiers, values are stored in trace files so must never change.
+    enum Events {
+      e_ThreadName,       ///< Internal: thread name for buffer
+      e_Dropped,          ///< Internal: count of events discarded
+      e_TransportRead,    ///< length, subchannel
+      e_RTPReceive,       ///< sequence number, timestamp, payload size
+      e_RTPSend,          ///< sequence number, timestamp, payload size
+      e_RTPOutOfOrder,    ///< sequence number, expected sequence number
+      e_RTPTransportSN,   ///< transport wide sequence number, header length
+      e_PatchWrite,       ///< timestamp, payload size, bypassed
+      e_PatchVideoFrame,  ///< timestamp, total frames, key frames
+      e_SRTPProtect,      ///< subchannel, input size, output size
+      e_SRTPUnprotect,    ///< subchannel, input size, output size
+      NumEvents
+    };
+
+    enum { MaxFilters = 16 };
+
+    /// Get the process wide tracer.
+    static OpalEventTracer & GetInstance();
+
+    /**Start tracing to the file.
+       Each thread that records an event gets a buffer of \p bufferRecords
+       records, rounded up to a power of two. The file is written by a
+       background thread every \p drainInterval.
+      */
+    bool Start(
+      const PFilePath & filename,
+      unsigned bufferRecords = 8192,
+      const PTimeInterval & drainInterval = 100
+    );
+
+    /**Stop tracing, all buffered events are written and the file closed.
+      */
+    void Stop();
+
+    /**Only record events for these PTRACE context identifiers, or RTP SSRC
+       values. An empty list records everything. At most MaxFilters are used.
+      */
+    void SetFilter(
+      const std::vector<uint32_t> & contexts
+    );
+
+    /// Indicate tracer is started, tested first by OPAL_EVENT_TRACE().
+    static bool IsRunning() { return s_active; }
+
+    /// Indicate event should be recorded, used by OPAL_EVENT_TRACE().
+    static bool IsActive(uint32_t context, uint32_t ssrc)
+    {
+      return s_active && (s_filterCount == 0 || MatchFilter(context, ssrc));
+    }
+
+    /// Record an event, used by OPAL_EVENT_TRACE().
+    static void Record(
+      Events event,
+      uint32_t context,
+      uint32_t ssrc,
+      uint32_t arg1 = 0,
+      uint32_t arg2 = 0,
+      uint32_t arg3 = 0
+    );
+
+    struct Statistics
+    {
+      Statistics();
+      void PrintOn(ostream & strm) const;
+      friend ostream & operator<<(ostream & strm, const Statistics & stats) { stats.PrintOn(strm); return strm; }
+
+      unsigned m_buffers;   ///< Thread buffers allocated
+      uint64_t m_recorded;  ///< Events written to file
+      uint64_t m_dropped;   ///< Events discarded as buffer was full
+      uint64_t m_bytes;     ///< Bytes written to file
+    };
+
+    /// Get statistics for tracer.
+    void GetStatistics(Statistics & statistics) const;
+
+    /**Format a binary trace file as text.
+       If \p contexts is not empty, only events for those PTRACE context
+       identifiers or SSRC values are output.
+      */
+    static bool Decode(
+      const PFilePath & filename,
+      ostream & output,
+      const std::vector<uint32_t> & contexts = std::vector<uint32_t>()
+    );
+
+  protected:
+    OpalEventTracer();
+    ~OpalEventTracer();
+
+    struct Entry
+    {
+      uint64_t m_time;      // Microseconds since tracer started
+      uint16_t m_event;
+      uint16_t m_thread;
+      uint32_t m_context;
+      uint32_t m_ssrc;
+      uint32_t m_args[3];
+    };
+
+    struct Buffer
+    {
+      Buffer(unsigned size, unsigned index);
+
+      std::vector<Entry> m_entries;
+      uint64_t           m_mask;
+      unsigned           m_index;
+      atomic<uint64_t>   m_head;      // Only changed by owning thread
+      atomic<uint64_t>   m_tail;      // Only changed by drain thread
+      atomic<uint64_t>   m_dropped;
+      atomic<bool>       m_released;  // Owning thread has exited
+      uint64_t           m_reported;  // Drops already written to file
+      bool               m_named;
+      PString            m_threadName;
+    };
+
+    static bool MatchFilter(uint32_t context, uint32_t ssrc);
+    Buffer * AllocateBuffer();
+    void DrainMain();
+    bool Drain();
+
+    static atomic<bool>     s_active;
+    static atomic<unsigned> s_filterCount;
+    static atomic<uint32_t> s_filters[MaxFilters];
+    static atomic<unsigned> s_generation;
+
+    PFile                 m_file;
+    unsigned              m_bufferSize;
+    PTimeInterval         m_drainInterval;
+    PTimeInterval         m_startTick;
+    std::vector<Buffer *> m_buffers;
+    std::vector<Buffer *> m_spare;
+    unsigned              m_nextIndex;
+    PThread             * m_drainThread;
+    PSyncPoint            m_drainWakeUp;
+    atomic<bool>          m_draining;
+    Statistics            m_statistics;
+    PDECLARE_MUTEX(       m_mutex);
+
+  friend struct OpalEventTracerThreadBuffer;
+};
+
+
+#if OPAL_EVENT_TRACING
+  /**Record a binary trace event.
+     The \p obj is used for its PTRACE context identifier, the \p ssrc may
+     be zero if not known. Nothing, not even \p obj or \p ssrc, is evaluated
+     unless the tracer is running, and the arguments are not evaluated unless
+     the context or SSRC also passes the filter.
+    */
+  #define OPAL_EVENT_TRACE(event, obj, ssrc, arg1, arg2, arg3) \
+    if (!OpalEventTracer::IsRunning() || \
+        !OpalEventTracer::IsActive((obj).GetTraceContextIdentifier(), (ssrc))) ; else \
+      OpalEventTracer::Record(OpalEventTracer::event, (obj).GetTraceContextIdentifier(), (ssrc), (arg1), (arg2), (arg3))
+#else
+  #define OPAL_EVENT_TRACE(event, obj, ssrc, arg1, arg2, arg3)
+#endif
+
+
+#endif // OPAL_OPAL_EVTRACE_H
+
+
+// End of File ///////////////////////////////////////////////////////////////
@@ -38,6 +38,8 @@
 #include <opal/call.h>
 #include <opal/connection.h> //OpalConnection::AnswerCallResponse
 #include <opal/guid.h>
+#include <opal/eventpool.h>
+#include <opal/placement.h>
 #include <codec/silencedetect.h>
 #include <codec/echocancel.h>
 #include <im/im.h>
@@ -56,6 +58,8 @@
 class OpalEndPoint;
 class OpalMediaPatch;
 class OpalLocalConnection;
+class OpalMediaMuxListener;
+class OpalDTLSIdentityPool;
 class PSSLCertificate;
 class PSSLPrivateKey;
 
@@ -1649,6 +1653,40 @@ class OpalManager : public PObject
     PIPSocket::PortRange & GetRtpIpPortRange() { return m_rtpIpPorts; }
     const PIPSocket::PortRange & GetRtpIpPortRange() const { return m_rtpIpPorts; }
 
+    /**Set a single shared UDP port for RTP sessions.
+       All RTP sessions that do not disable OPAL_OPT_MEDIA_MUX send and
+       receive on this one port, instead of a pair from GetRtpIpPortRange().
+       Packets are routed to sessions by remote address, SSRC or ICE user.
+       If \p shards is zero, a socket and thread per CPU core is used, where
+       the platform supports it. A \p port of zero closes the shared port.
+      */
+    bool SetMediaMuxPort(
+      const PString & iface,
+      WORD port,
+      unsigned shards = 0
+    );
+
+    /**Get the shared UDP port listener for RTP sessions.
+       Returns NULL if SetMediaMuxPort() has not been called.
+      */
+    OpalMediaMuxListener * GetMediaMuxListener() const { return m_mediaMuxListener; }
+
+    /**Set the placement of calls and their media threads on CPU cores.
+       The \p mode is "none", "node" for one group per NUMA node, or
+       "group[,<n>]" for groups of n cores. Each new call is assigned to the
+       least loaded group, and its media patch, transport and mixer threads
+       are pinned to the cores of that group. If the shared media port is
+       opened after this, its sockets are also spread across the cores.
+      */
+    bool SetPlacementMode(
+      const PString & mode
+    ) { return m_placementPolicy.Configure(mode); }
+
+    /**Get the placement policy for calls and media threads.
+      */
+    OpalPlacementPolicy & GetPlacementPolicy() { return m_placementPolicy; }
+    const OpalPlacementPolicy & GetPlacementPolicy() const { return m_placementPolicy; }
+
     /**Get the IP Type Of Service byte for media (eg RTP) channels.
      */
     BYTE GetMediaTypeOfService() const;
@@ -1999,6 +2037,10 @@ class OpalManager : public PObject
     void SetDTLSTimeout(
       const PTimeInterval & newInterval  ///<  New timeout
     ) { m_dtlsTimeout = newInterval; }
+
+    /**Get the pre-generated keys and certificates used for DTLS.
+    */
+    OpalDTLSIdentityPool & GetDTLSIdentityPool() const { return *m_dtlsIdentityPool; }
 #endif // OPAL_SRTP
 
     /**Get the default ILS server to use for user lookup.
@@ -2071,8 +2113,21 @@ class OpalManager : public PObject
     // needs to be public for gcc 3.4
     void GarbageCollection();
 
-    // Decoupled event to avoid deadlocks, especially from patch threads
-    void QueueDecoupledEvent(PSafeWork * work, const char * group = NULL) { m_decoupledEventPool.AddWork(work, group); }
+    /**Indicate that an object has been released and garbage collection should
+       be performed as soon as possible, rather than waiting for the periodic
+       sweep. This is called when calls and connections are removed.
+      */
+    void SignalGarbageCollection() { m_garbageCollectSignal.Signal(); }
+
+    /**Queue a decoupled event to avoid deadlocks, especially from patch threads.
+       Events with the same \p group, usually the call token, are executed in
+       the order they were queued, and never concurrently.
+      */
+    void QueueDecoupledEvent(PSafeWork * work, const PString & group = PString::Empty()) { m_decoupledEventPool.AddWork(work, group); }
+
+    /**Get the pool used for decoupled events, e.g. to set worker limits or get statistics.
+      */
+    OpalEventPool & GetDecoupledEventPool() { return m_decoupledEventPool; }
 
     typedef std::map<OpalMediaType, PIPSocket::QoS> MediaQoSMap;
 
@@ -2104,6 +2159,7 @@ class OpalManager : public PObject
     PTimeInterval m_staleReceiverTimeout;
 #if OPAL_SRTP
     PTimeInterval m_dtlsTimeout;
+    OpalDTLSIdentityPool * m_dtlsIdentityPool;
 #endif
     PString       m_ilsServer;
 
@@ -2119,6 +2175,8 @@ class OpalManager : public PObject
 #endif
 
     PIPSocket::PortRange m_tcpPorts, m_udpPorts, m_rtpIpPorts;
+    OpalMediaMuxListener * m_mediaMuxListener;
+    OpalPlacementPolicy    m_placementPolicy;
     
 #if OPAL_PTLIB_SSL
     PString   m_caFiles;
@@ -2143,12 +2201,42 @@ class OpalManager : public PObject
 
     atomic<unsigned> lastCallTokenID;
 
-    class CallDict : public PSafeDictionary<PString, OpalCall>
+    /* Active calls, striped across a number of independently locked shards
+       selected by a hash of the call token. This keeps SetUpCall() and
+       FindCallWithLock() from contending on a single dictionary lock at high
+       call rates. Shards are only swept for deletion when a call has been
+       removed from them, see GarbageCollection(). */
+    class CallDict
     {
       public:
-        CallDict(OpalManager & mgr) : manager(mgr) { }
-        virtual void DeleteObject(PObject * object) const;
-        OpalManager & manager;
+        enum { NumShards = 16 }; // Must be power of two
+
+        CallDict(OpalManager & mgr);
+        ~CallDict();
+
+        PSafePtr<OpalCall> Find(const PString & token, PSafetyMode mode = PSafeReadWrite) const;
+        void SetAt(const PString & token, OpalCall * call);
+        void RemoveAt(const PString & token);
+        PINDEX GetSize() const { return m_size; }
+        PArray<PString> GetKeys() const;
+        bool DeleteObjectsToBeRemoved();
+
+        typedef PSafeDictionary<PString, OpalCall> ShardBase;
+        const ShardBase & GetShard(PINDEX idx) const { return *m_shards[idx]; }
+
+      protected:
+        struct Shard : ShardBase
+        {
+          Shard(OpalManager & mgr) : m_manager(mgr), m_removed(false) { }
+          virtual void DeleteObject(PObject * object) const;
+          OpalManager & m_manager;
+          atomic<bool>  m_removed;
+        };
+        Shard & GetShard(const PString & token) const;
+
+        OpalManager  & m_manager;
+        Shard        * m_shards[NumShards];
+        atomic<PINDEX> m_size;
     } m_activeCalls;
 
 #if OPAL_HAS_PRESENCE
@@ -2161,14 +2249,15 @@ class OpalManager : public PObject
     void InternalClearAllCalls(OpalConnection::CallEndReason reason, bool wait, bool first);
 
     PThread    * m_garbageCollector;
-    PSyncPoint   m_garbageCollectExit;
+    PSyncPoint   m_garbageCollectSignal;
+    atomic<bool> m_garbageCollectExit;
     PTime        m_garbageCollectChangeTime;
     PDECLARE_NOTIFIER(PThread, OpalManager, GarbageMain);
 
     friend OpalCall::OpalCall(OpalManager & mgr);
     friend void OpalCall::InternalOnClear();
 
-    PSafeThreadPool m_decoupledEventPool;
+    OpalEventPool m_decoupledEventPool;
 
 #if OPAL_SCRIPT
     PScriptLanguage * m_script;
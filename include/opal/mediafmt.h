@@ -784,6 +784,7 @@ class OpalMediaFormatInternal : public PObject
     time_t                       codecVersionTime;
     bool                         forceIsTransportable;
     bool                         m_allowMultiple;
+    unsigned                     m_generation;
 
   friend bool operator==(const char * other, const OpalMediaFormat & fmt);
   friend bool operator!=(const char * other, const OpalMediaFormat & fmt);
@@ -998,6 +999,12 @@ class OpalMediaFormat : public PContainer
       */
     PBoolean IsTransportable() const { PWaitAndSignal m(m_mutex); return m_info != NULL && m_info->IsTransportable(); }
 
+    /**Get the generation of the media format contents.
+       This changes whenever the format, or any of its options, may have been
+       altered, so values derived from the format can be cached against it.
+      */
+    unsigned GetGeneration() const { PWaitAndSignal m(m_mutex); return m_info == NULL ? 0 : m_info->m_generation; }
+
     /**Get the RTP payload type that is to be used for this media format.
        This will either be an intrinsic one for the media format eg GSM or it
        will be automatically calculated as a dynamic media format that will be
@@ -44,6 +44,7 @@ class OpalMediaStream;
 class OpalMediaFormat;
 class OpalMediaFormatList;
 class OpalMediaCryptoSuite;
+class OpalPlacementPolicy;
 class RTP_TransportWideCongestionControl;
 class H235SecurityCapability;
 class H323Capability;
@@ -540,6 +541,7 @@ class OpalMediaTransport : public PSafeObject, public OpalMediaTransportChannelT
     virtual void InternalClose();
     virtual bool GarbageCollection(); // Override from PSafeObject
     virtual bool InternalRxData(SubChannels subchannel, const PBYTEArray & data);
+    void SetPlacement(OpalMediaSession & session);
 
     PString       m_name;
     bool          m_remoteBehindNAT;
@@ -552,6 +554,9 @@ class OpalMediaTransport : public PSafeObject, public OpalMediaTransportChannelT
     atomic<bool>  m_established;
     atomic<bool>  m_started;
 
+    OpalPlacementPolicy * m_placementPolicy;
+    int                   m_placementGroup;
+
     atomic<CongestionControl *> m_congestionControl;
     PTimer m_ccTimer;
     PDECLARE_NOTIFIER(PTimer, OpalMediaTransport, ProcessCongestionControl);
@@ -48,6 +48,7 @@ class OpalMediaPatch;
 class OpalLine;
 class OpalConnection;
 class OpalMediaStatistics;
+class OpalAsyncChannelWriter;
 
 
 typedef PSafePtr<OpalMediaPatch, PSafePtrMultiThreaded> OpalMediaPatchPtr;
@@ -698,6 +699,10 @@ class OpalFileMediaStream : public OpalRawMediaStream, public OpalMediaStreamPac
       bool isSource,                       ///<  Is a source stream
       const PFilePath & path               ///<  File path to stream to/from
     );
+
+    /**Destroy stream, waiting for any buffered writes to complete.
+      */
+    ~OpalFileMediaStream();
   //@}
 
   /**@name Overrides of OpalMediaStream class */
@@ -714,7 +719,8 @@ class OpalFileMediaStream : public OpalRawMediaStream, public OpalMediaStreamPac
     );
 
     /**Write raw media data to the sink media stream.
-       The default behaviour writes to the PChannel object.
+       The data is queued to an OpalAsyncChannelWriter, so the patch thread
+       is never blocked by the disk.
       */
     virtual PBoolean WriteData(
       const BYTE * data,   ///<  Data to write
@@ -724,7 +730,10 @@ class OpalFileMediaStream : public OpalRawMediaStream, public OpalMediaStreamPac
   //@}
 
   protected:
+    virtual void InternalClose();
+
     PFile file;
+    OpalAsyncChannelWriter * m_writer;
 };
 
 
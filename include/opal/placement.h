@@ -0,0 +1,207 @@
+/*
+ * placement.h
+ *
+ * NUMA and core aware placement of calls and media threads
+ *
+ * Open Phone Abstraction Library (OPAL)
+ *
+ * Copyright (c) 2021 Vox Lucida Pty. Ltd.
+ *
+ * The contents of this file are subject to the Mozilla Public License
+ * Version 1.0 (the "License"); you may not use this file except in
+ * compliance with the License. You may obtain a copy of the License at
+ * http://www.mozilla.org/MPL/
+ *
+ * Software distributed under the License is distributed on an "AS IS"
+ * basis, WITHOUT WARRANTY OF ANY KIND, either express or implied. See
+ * the License for the specific language governing rights and limitations
+ * under the License.
+ *
+ * The Original Code is Open Phone Abstraction Library.
+ *
+ * The Initial Developer of the Original Code is Vox Lucida Pty. Ltd.
+ *
+ * Contributor(s): ______________________________________.
+ */
+
+#ifndef OPAL_OPAL_PLACEMENT_H
+#define OPAL_OPAL_PLACEMENT_H
+
+#ifdef P_USE_PRAGMA
+#pragma interface
+#endif
+
+#include <opal_config.h>
+
+#include <ptlib/sockets.h>
+
+#include <map>
+#include <vector>
+
+
+/**Policy for placing the work of a call on a group of CPU cores.
+   Each OpalCall is assigned to the least loaded core group when created.
+   The media patch threads, media transport read threads and mixer threads
+   for that call then pin themselves to the cores of that group, so all the
+   processing of a call's packets shares one L3 cache and NUMA node.
+
+   Groups are either whole NUMA nodes, or sets of a fixed number of cores
+   within a node. The topology is read from the operating system, and only
+   cores the process is allowed to run on are used.
+
+   Binding threads and sockets is only supported on Linux, elsewhere calls
+   are still assigned and counted, but the threads are not pinned.
+  */
+class OpalPlacementPolicy : public PObject
+{
+    PCLASSINFO(OpalPlacementPolicy, PObject);
+  public:
+    enum Modes {
+      e_Disabled,     ///< No placement, operating system decides
+      e_ByNode,       ///< One group per NUMA node
+      e_ByCoreGroup   ///< Groups of a fixed number of cores, within a node
+    };
+
+    OpalPlacementPolicy();
+
+    /**Set the placement mode.
+       For e_ByCoreGroup, the \p groupSize is the number of cores in each
+       group, zero uses a default of four.
+       Calls already assigned keep their group until released.
+      */
+    bool Configure(
+      Modes mode,
+      unsigned groupSize = 0
+    );
+
+    /**Set the placement mode from a string.
+       Format is "none", "node" or "group[,<size>]".
+      */
+    bool Configure(
+      const PString & str
+    );
+
+    /// Get the placement mode
+    Modes GetMode() const { return m_mode; }
+
+    /// Indicate placement is active
+    bool IsEnabled() const { return m_mode != e_Disabled; }
+
+    /// Get the number of core groups
+    unsigned GetGroupCount() const;
+
+    /// Get the total number of cores available for placement
+    unsigned GetCPUCount() const;
+
+    /// Get the core number for index, 0 to GetCPUCount()-1.
+    unsigned GetCPU(unsigned index) const;
+
+    /// Get the group containing the core, -1 if not found.
+    int GetGroupOfCPU(unsigned cpu) const;
+
+    /**Assign a key, typically a call token, to the least loaded group.
+       If the key is already assigned, its existing group is returned.
+       @return group index, or -1 if placement disabled.
+      */
+    int AssignGroup(
+      const PString & key
+    );
+
+    /**Release the group assignment for the key.
+      */
+    void ReleaseGroup(
+      const PString & key
+    );
+
+    /**Get the group assigned to the key, -1 if none.
+      */
+    int GetGroup(
+      const PString & key
+    ) const;
+
+    /**Pin the calling thread to the cores of the group.
+       Does nothing, and returns false, if \p group is -1.
+      */
+    bool BindThread(
+      int group
+    );
+
+    /**Set the core whose receive processing the socket is preferred for.
+       This uses SO_INCOMING_CPU, which, for a SO_REUSEPORT group of sockets,
+       has the kernel deliver a packet to the socket for the core that
+       processed its receive interrupt.
+      */
+    bool BindSocket(
+      PIPSocket & socket,
+      unsigned cpu
+    );
+
+    struct GroupStatistics
+    {
+      GroupStatistics();
+
+      unsigned              m_node;         ///< NUMA node group is on
+      std::vector<unsigned> m_cpus;         ///< Cores in group
+      std::vector<unsigned> m_cpuLoad;      ///< Percentage busy for each core, since last statistics
+      unsigned              m_calls;        ///< Keys currently assigned
+      uint64_t              m_assigned;     ///< Total keys ever assigned
+      uint64_t              m_threadsBound; ///< Total threads pinned
+    };
+
+    struct Statistics
+    {
+      Statistics();
+      void PrintOn(ostream & strm) const;
+      friend ostream & operator<<(ostream & strm, const Statistics & stats) { stats.PrintOn(strm); return strm; }
+
+      Modes                        m_mode;
+      std::vector<GroupStatistics> m_groups;
+      uint64_t                     m_socketsBound; ///< Total sockets given a core
+      uint64_t                     m_bindFailures; ///< Total threads or sockets that could not be bound
+    };
+
+    /**Get statistics for all groups.
+       The core load is calculated since the previous call to this function.
+      */
+    void GetStatistics(Statistics & statistics);
+
+  protected:
+    struct Group
+    {
+      Group(unsigned node) : m_node(node), m_calls(0), m_assigned(0), m_threadsBound(0) { }
+
+      unsigned              m_node;
+      std::vector<unsigned> m_cpus;
+      unsigned              m_calls;
+      uint64_t              m_assigned;
+      uint64_t              m_threadsBound;
+    };
+
+    typedef std::map<unsigned, std::vector<unsigned> > Topology;
+    static void GetTopology(Topology & topology);
+
+    struct CPUTimes
+    {
+      CPUTimes() : m_busy(0), m_total(0) { }
+      uint64_t m_busy;
+      uint64_t m_total;
+    };
+    typedef std::map<unsigned, CPUTimes> CPUTimesMap;
+    static void GetCPUTimes(CPUTimesMap & times);
+
+    typedef std::map<PString, int> AssignmentMap;
+
+    Modes                m_mode;
+    std::vector<Group>   m_groups;
+    AssignmentMap        m_assignments;
+    CPUTimesMap          m_lastTimes;
+    uint64_t             m_socketsBound;
+    uint64_t             m_bindFailures;
+    PDECLARE_MUTEX(      m_mutex);
+};
+
+
+#endif // OPAL_OPAL_PLACEMENT_H
+
+
+// End of File ///////////////////////////////////////////////////////////////
@@ -40,6 +40,7 @@
 
 class OpalMediaFormat;
 class RTP_DataFrame;
+class OpalAsyncChannelWriter;
 
 
 /** This is an abstract class for recording OPAL calls.
@@ -150,6 +151,16 @@ class OpalRecordManager : public PObject
       */
     virtual bool IsOpen() const = 0;
 
+    /**Indicate the recording takes media exactly as sent or received.
+       If true, OpenStream() is given the encoded media format, and
+       WriteStream() is given every encoded RTP packet, instead of decoded
+       PCM-16 or YUV420P via WriteAudio()/WriteVideo(). No transcoding or
+       mixing is done during the call.
+
+       Default behaviour returns false.
+      */
+    virtual bool IsPassThrough() const { return false; }
+
     /**Close the recording file.
        Note this may block until various sub-threads are termianted so
        care may be needed to avoid deadlocks.
@@ -250,6 +261,119 @@ class OpalRecordManager : public PObject
     PTimeInterval m_maxJumpTime;
 };
 
+
+/** Compact, indexed, append only file of encoded media.
+    This is the container used by the pass through record manager, selected
+    by the ".oprec" file extension. Every packet of every stream in the call
+    is kept as it was on the wire, with its RTP timestamp, sequence number and
+    arrival time, so recording costs no more than a memory copy per packet.
+    Decoding and mixing is deferred until, and unless, Render() is used to
+    produce a WAV or other media file.
+
+    The file is a sequence of records, each with a small fixed header. When
+    closed, a copy of the stream descriptions and an index of file offsets
+    at about one second intervals is appended, with a trailer pointing to
+    it. A file that was never closed, e.g. a crash, can still be read, it is
+    just scanned sequentially to rebuild the index.
+  */
+class OpalEncodedRecordFile : public PObject
+{
+    PCLASSINFO(OpalEncodedRecordFile, PObject);
+  public:
+    OpalEncodedRecordFile(
+      PINDEX bufferSize = 65536 ///< Bytes held in memory between writes to disk
+    );
+    ~OpalEncodedRecordFile();
+
+    /// Create a new file for writing.
+    bool Create(const PFilePath & fn);
+
+    /// Open an existing file for reading.
+    bool Open(const PFilePath & fn);
+
+    /// Indicate file is open for reading or writing.
+    bool IsOpen() const { return m_file.IsOpen(); }
+
+    /// Close file, writing index if created for writing.
+    bool Close();
+
+    struct StreamInfo
+    {
+      StreamInfo(const PString & id = PString::Empty(), const PString & format = PString::Empty())
+        : m_id(id), m_format(format) { }
+      PString m_id;       ///< Identifier for media stream within call
+      PString m_format;   ///< Name of encoded media format
+    };
+    typedef std::vector<StreamInfo> StreamList;
+
+    /**Add a stream to the file being written.
+       @return index of stream for WritePacket(), or P_MAX_INDEX if too many streams.
+      */
+    PINDEX AddStream(const PString & id, const PString & format);
+
+    /**Write a packet, the time is taken from the current real time.
+       This is thread safe.
+      */
+    bool WritePacket(PINDEX stream, const RTP_DataFrame & rtp);
+
+    /// Get the streams in the file.
+    const StreamList & GetStreams() const { return m_streams; }
+
+    /// Get the real time the file was created.
+    const PTime & GetStartTime() const { return m_startTime; }
+
+    /**Read next packet from file.
+       The \p offset is the time since GetStartTime() that the packet was
+       recorded. The \p rtp has the payload type, marker, timestamp and
+       sequence number of the original packet, but not the SSRC or any
+       header extensions.
+      */
+    bool ReadPacket(PINDEX & stream, PTimeInterval & offset, RTP_DataFrame & rtp);
+
+    /**Position file to read from the packet recorded at, or just before, the
+       \p offset from GetStartTime().
+      */
+    bool Seek(const PTimeInterval & offset);
+
+    /**Render a file to any type supported by OpalRecordManager::Factory.
+       Each stream is decoded and mixed exactly as it would have been if the
+       call had been recorded to that file type in real time.
+      */
+    static bool Render(
+      const PFilePath & input,
+      const PFilePath & output,
+      const OpalRecordManager::Options & options = OpalRecordManager::Options()
+    );
+
+  protected:
+    bool Flush();
+    bool WriteRecord(BYTE type, BYTE stream, const void * data, PINDEX length, const RTP_DataFrame * rtp = NULL, unsigned time = 0);
+    bool ReadDirectory(off_t position);
+    bool ScanFile();
+
+    struct IndexEntry
+    {
+      IndexEntry(unsigned time = 0, off_t position = 0) : m_time(time), m_position(position) { }
+      unsigned m_time;
+      off_t    m_position;
+    };
+    typedef std::vector<IndexEntry> Index;
+
+    PFile      m_file;
+    PTime      m_startTime;
+    StreamList m_streams;
+    Index      m_index;
+    off_t      m_endOfPackets;
+
+    // Writing
+    bool       m_writing;
+    OpalAsyncChannelWriter * m_writer;
+    PBYTEArray m_buffer;
+    PINDEX     m_bufferUsed;
+    off_t      m_position;
+    PDECLARE_MUTEX(m_mutex);
+};
+
 #endif // OPAL_HAS_MIXER
 
 #endif // OPAL_OPAL_AUDIORECORD_H
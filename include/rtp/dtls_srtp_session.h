@@ -51,6 +51,81 @@
 #define OPAL_OPT_DTLS_TIMEOUT "DTLS-Timeout"
 
 
+/**Key, certificate and fingerprints used for DTLS.
+  */
+struct OpalDTLSIdentity
+{
+  OpalDTLSIdentity();
+
+  PSSLCertificateFingerprint GetFingerprint(PSSLCertificateFingerprint::HashType hashType) const;
+
+  PSSLCertificate m_certificate;
+  PSSLPrivateKey  m_privateKey;
+  PSSLCertificateFingerprint m_fingerprints[PSSLCertificateFingerprint::NumHashType];
+  PTime           m_created;
+};
+
+
+/**Process wide set of DTLS identities.
+   Generating a key and certificate is far too slow to do on the call set up
+   path, so a small set of ECDSA P-256 identities are generated in a
+   background thread, and each is replaced when it reaches its lifetime.
+   Transports take one in turn, along with the commonly used fingerprints
+   already calculated for SDP.
+
+   The pool also holds the key used to encrypt DTLS session tickets, so a
+   renegotiation with a remote that kept its ticket is an abbreviated
+   handshake. The ticket key is replaced with the same lifetime as the
+   identities, limiting how long a stolen ticket key is useful.
+  */
+class OpalDTLSIdentityPool : public PObject
+{
+    PCLASSINFO(OpalDTLSIdentityPool, PObject);
+  public:
+    OpalDTLSIdentityPool(
+      unsigned size = 4,
+      const PTimeInterval & lifetime = PTimeInterval(0, 0, 0, 1) // One hour
+    );
+    ~OpalDTLSIdentityPool();
+
+    /**Get an identity for a new transport.
+       The background generation is started on first use. If none are ready
+       yet, one is generated before returning.
+      */
+    bool GetIdentity(
+      OpalDTLSIdentity & identity
+    );
+
+    /// Get current key for DTLS session tickets, same for all new contexts in process
+    PBYTEArray GetTicketKeys() const;
+
+    void SetSize(unsigned size);
+    unsigned GetSize() const { return m_size; }
+
+    void SetLifetime(const PTimeInterval & lifetime) { m_lifetime = lifetime; }
+    const PTimeInterval & GetLifetime() const { return m_lifetime; }
+
+    static bool Generate(
+      OpalDTLSIdentity & identity
+    );
+
+  protected:
+    void GeneratorMain();
+    void RotateTicketKeys();
+
+    unsigned                      m_size;
+    PTimeInterval                 m_lifetime;
+    std::vector<OpalDTLSIdentity> m_identities;
+    size_t                        m_next;
+    PBYTEArray                    m_ticketKeys;
+    PTime                         m_ticketKeysCreated;
+    PDECLARE_MUTEX(               m_mutex);
+    PThread                     * m_thread;
+    PSyncPoint                    m_wakeUp;
+    atomic<bool>                  m_running;
+};
+
+
 #if OPAL_ICE
 typedef OpalICEMediaTransport OpalDTLSMediaTransportParent;
 #else
@@ -99,8 +174,8 @@ class OpalDTLSMediaTransport : public OpalDTLSMediaTransportParent
     bool            m_passiveMode;
     PTimeInterval   m_handshakeTimeout;
     unsigned        m_MTU;
-    PSSLCertificate m_certificate;
-    PSSLPrivateKey  m_privateKey;
+    OpalDTLSIdentity m_identity;
+    PBYTEArray      m_ticketKeys;
     PSSLCertificateFingerprint m_remoteFingerprint;
     std::auto_ptr<OpalMediaCryptoKeyInfo> m_keyInfo[2];
 
@@ -37,20 +37,34 @@
 #include <opal/mediafmt.h>
 #include <ptlib/sockets.h>
 
+#include <vector>
+
 
 class OpalTranscoder;
 
 
 /**Class for a reading RTP from an Ethernet Capture (PCAP) file.
+   Both the classic libpcap and the pcapng formats are read. When opened for
+   reading, the file is memory mapped if possible, and frames are parsed in
+   place without copying them out of the mapping.
  */
 class OpalPCAPFile : public PFile
 {
     PCLASSINFO(OpalPCAPFile, PFile);
   public:
     OpalPCAPFile();
+    ~OpalPCAPFile();
+
+    virtual PBoolean Close();
+    virtual PBoolean IsEndOfFile() const;
+    virtual off_t GetPosition() const;
+    virtual PBoolean SetPosition(off_t pos, FilePositionOrigin origin = Start);
 
     bool Restart();
 
+    /// Indicate file is being read via a memory mapping
+    bool IsMapped() const { return m_mappedData != NULL; }
+
     void PrintOn(ostream & strm) const;
 
     bool WriteFrame(const PEthSocket::Frame & frame);
@@ -122,6 +136,7 @@ class OpalPCAPFile : public PFile
     struct DiscoveredRTPInfo : DiscoveredRTPKey {
       RTP_DataFrame::PayloadTypes m_payloadType;
       OpalMediaFormat             m_mediaFormat;
+      unsigned                    m_packets;      ///< Number of packets found by DiscoverRTP()
 
       DiscoveredRTPInfo();
       DiscoveredRTPInfo(const DiscoveredRTPKey & key);
@@ -146,7 +161,49 @@ class OpalPCAPFile : public PFile
     };
     typedef PNotifierTemplate<Progress &> ProgressNotifier;
 
-    bool DiscoverRTP(DiscoveredRTP & discoveredRTP, const ProgressNotifier & progressNotifier = NULL);
+    /**Scan the file for RTP streams.
+       If the file is memory mapped, the file is divided into chunks at
+       record boundaries, which are analysed by \p threads worker threads
+       in parallel and the per stream results merged in file order. A value
+       of zero uses the number of CPU cores.
+      */
+    bool DiscoverRTP(
+      DiscoveredRTP & discoveredRTP,
+      const ProgressNotifier & progressNotifier = NULL,
+      unsigned threads = 0
+    );
+
+    /// Set the approximate size of the chunks DiscoverRTP() divides the file into.
+    void SetDiscoveryChunkSize(off_t size) { m_discoveryChunkSize = size; }
+    off_t GetDiscoveryChunkSize() const { return m_discoveryChunkSize; }
+
+    struct DecodedRTP
+    {
+      DecodedRTP(PINDEX stream, const DiscoveredRTPInfo & info) : m_stream(stream), m_info(info) { }
+
+      PINDEX                    m_stream;      ///< Index into DiscoveredRTP passed to DecodeStreams()
+      const DiscoveredRTPInfo & m_info;        ///< Stream being decoded
+      RTP_DataFrame             m_decoded;     ///< Decoded media
+      PTime                     m_packetTime;  ///< Capture time of encoded packet
+    };
+    typedef PNotifierTemplate<DecodedRTP &> DecodedNotifier;
+
+    /**Decode the streams concurrently.
+       The file is read once, with the RTP for each stream passed to a
+       thread per stream which re-orders and transcodes it. The \p notifier
+       is called from those threads, so may be called concurrently for
+       different streams, but is always called in sequence number order for
+       any one stream. The progress notifier is called from the reading
+       thread.
+
+       The streams m_mediaFormat is used to decode, if valid, otherwise
+       the payload map is used as for DecodeRTP().
+      */
+    bool DecodeStreams(
+      const DiscoveredRTP & streams,
+      const DecodedNotifier & notifier,
+      const ProgressNotifier & progressNotifier = NULL
+    );
 
     bool SetFilters(
       const DiscoveredRTPInfo & discoveredRTP,
@@ -169,6 +226,10 @@ class OpalPCAPFile : public PFile
   protected:
     bool InternalOpen(OpenMode mode, OpenOptions opt, PFileInfo::Permissions permissions);
     int InternalDecodeRTP(RTP_DataFrame & encodedRTP, RTP_DataFrame & decodedRTP, DecodeContext & context);
+    int OpenTranscoder(DecodeContext & context, const OpalMediaFormat & srcFmt);
+    int TranscodeRTP(RTP_DataFrame & encodedRTP, RTP_DataFrame & decodedRTP, DecodeContext & context);
+    bool MapFile();
+    void UnmapFile();
 
     struct FileHeader { 
       DWORD magic_number;   /* magic number */
@@ -192,15 +253,49 @@ class OpalPCAPFile : public PFile
 
     class Frame : public PEthSocket::Frame {
       public:
-        Frame() : m_otherEndian(false) { }
-
-        virtual bool Read(
-          PChannel & channel,
-          PINDEX packetSize = P_MAX_INDEX
-        );
+        void Attach(const BYTE * data, PINDEX size, time_t seconds, unsigned microseconds, unsigned linkType);
+    };
 
-        bool m_otherEndian;
+    /* State needed to parse records, which can change as pcapng section
+       and interface blocks are encountered. A copy is taken at the start
+       of each chunk processed in parallel. */
+    struct RecordFormat
+    {
+      RecordFormat();
+
+      /* Parse the record at data. Returns the length of the record, or zero
+         if truncated or corrupt. If it is a packet, isPacket is set and,
+         if frame is not NULL, frame is attached to the data in place. */
+      size_t Parse(const BYTE * data, size_t available, bool & isPacket, Frame * frame);
+
+      struct Interface
+      {
+        Interface(unsigned linkType = 1, unsigned snapLength = 65535) : m_linkType(linkType), m_snapLength(snapLength), m_unitsPerSecond(1000000) { }
+        unsigned m_linkType;
+        unsigned m_snapLength;
+        uint64_t m_unitsPerSecond;
+      };
+
+      bool     m_nextGen;       // pcapng
+      bool     m_otherEndian;
+      bool     m_nanoSeconds;   // Classic file with nanosecond timestamps
+      std::vector<Interface> m_interfaces;
     };
+    RecordFormat m_format;
+    off_t        m_dataStart;
+    off_t        m_discoveryChunkSize;
+    PBYTEArray   m_recordBuffer;  // Used when not mapped
+
+    const BYTE * m_mappedData;
+    off_t        m_mappedSize;
+    off_t        m_mappedPosition;
+#ifdef _WIN32
+    HANDLE       m_mappingHandle;
+#endif
+
+    bool ReadRecord(const BYTE * & data, size_t & available);
+    bool ReadFrame(Frame & frame);
+
     Frame m_rawPacket;
     PDECLARE_MUTEX(m_writeMutex);
 
@@ -214,6 +309,14 @@ class OpalPCAPFile : public PFile
 
     struct DiscoveryInfo;
     typedef std::map<DiscoveredRTPKey, DiscoveryInfo> DiscoveryMap;
+
+    struct DiscoveryChunk;
+    void DiscoverChunk(DiscoveryChunk & chunk);
+    bool DiscoverParallel(DiscoveryMap & discoveryMap, Progress & progress, const ProgressNotifier & progressNotifier, unsigned threads);
+    void DiscoveryWorker(DiscoveryChunk * chunk);
+
+    struct DecodeStream;
+    void DecodeWorker(DecodeStream * stream);
 };
 
 
@@ -0,0 +1,326 @@
+/*
+ * rtpmux.h
+ *
+ * Shared socket, demultiplexing, media listener
+ *
+ * Open Phone Abstraction Library (OPAL)
+ *
+ * Copyright (c) 2021 Vox Lucida Pty. Ltd.
+ *
+ * The contents of this file are subject to the Mozilla Public License
+ * Version 1.0 (the "License"); you may not use this file except in
+ * compliance with the License. You may obtain a copy of the License at
+ * http://www.mozilla.org/MPL/
+ *
+ * Software distributed under the License is distributed on an "AS IS"
+ * basis, WITHOUT WARRANTY OF ANY KIND, either express or implied. See
+ * the License for the specific language governing rights and limitations
+ * under the License.
+ *
+ * The Original Code is Open Phone Abstraction Library.
+ *
+ * The Initial Developer of the Original Code is Vox Lucida Pty. Ltd.
+ *
+ * Contributor(s): ______________________________________.
+ */
+
+#ifndef OPAL_RTP_RTPMUX_H
+#define OPAL_RTP_RTPMUX_H
+
+#ifdef P_USE_PRAGMA
+#pragma interface
+#endif
+
+#include <opal_config.h>
+
+#include <opal/mediasession.h>
+#include <ptlib/sockets.h>
+
+#include <vector>
+
+
+class OpalManager;
+
+
+/**Option for OpalRTPSession to use the managers OpalMediaMuxListener, if
+   one has been opened via OpalManager::SetMediaMuxPort(). Defaults to true.
+   SDP sessions that offer or accept ICE always use their own ports, as the
+   connectivity checks are not answered on the shared port.
+  */
+#define OPAL_OPT_MEDIA_MUX "Media-Mux"
+
+
+///////////////////////////////////////////////////////////////////////////////
+
+/**Media listener shared by many sessions.
+   A small number of UDP sockets, all bound to the same port, receive packets
+   for any number of sessions. Each packet is routed to the owning session by,
+   in order, the remote address it came from, an H.460.19 multiplex ID prefix,
+   the local ICE user fragment in a STUN request, or the RTP/RTCP SSRC.
+
+   On platforms with SO_REUSEPORT, one socket and read thread is created per
+   "shard", and the kernel spreads remote addresses across them, so the load
+   is shared by that many cores. Otherwise a single socket is used. If the
+   managers OpalPlacementPolicy is enabled, each shard socket is given a core
+   with SO_INCOMING_CPU, and its read thread is pinned to that cores group,
+   so a packet is received and processed on the core that took the interrupt.
+
+   The routing table is a fixed size, open addressed hash table. Lookups are
+   lock free, changes are serialised by a mutex. Routes are removed before a
+   target is destroyed, and the target waits, via IsQuiescent(), for any read
+   thread that might still be using it.
+  */
+class OpalMediaMuxListener : public PObject, public OpalMediaTransportChannelTypes
+{
+    PCLASSINFO(OpalMediaMuxListener, PObject);
+  public:
+    /// Destination for packets routed by the listener
+    class Target
+    {
+      public:
+        virtual ~Target() { }
+
+        /**Called from listener read thread for each packet routed to target.
+           The \p subchannel is e_Control for RTCP, when listener is using
+           automatic demultiplexing.
+          */
+        virtual void OnMuxData(
+          OpalMediaMuxListener & listener,
+          SubChannels subchannel,
+          const PBYTEArray & data,
+          const PIPSocketAddressAndPort & remote,
+          unsigned shard
+        ) = 0;
+    };
+
+    /// Types of routing key
+    enum KeyTypes {
+      e_RemoteAddress,
+      e_MuxID,
+      e_ICEUser,
+      e_SSRC,
+      NumKeyTypes
+    };
+
+    typedef uint64_t Key;
+    static Key MakeKey(const PIPSocketAddressAndPort & remote);
+    static Key MakeKey(KeyTypes type, uint32_t value);
+    static Key MakeKey(const PString & iceUser);
+
+  /**@name Construction */
+  //@{
+    /**Create listener.
+       The \p maxRoutes is the total number of keys that may be in use, the
+       routing table is sized to keep it less than half full.
+      */
+    OpalMediaMuxListener(
+      OpalManager & manager,
+      unsigned maxRoutes = 65536
+    );
+
+    /**Destroy listener, closing sockets and stopping threads.
+      */
+    ~OpalMediaMuxListener();
+  //@}
+
+  /**@name Operations */
+  //@{
+    /**Open the shared port.
+       If \p shards is zero, the number of CPU cores is used.
+
+       If \p muxIdPrefix is true, every packet is expected to have a four
+       byte H.460.19 multiplex ID before it, which is removed.
+
+       If \p subchannel is e_AllSubChannels, then RTCP packets are delivered
+       to targets as e_Control and everything else as e_Media, as per
+       RFC 5761. Otherwise everything is delivered as that subchannel.
+      */
+    bool Open(
+      const PIPAddress & localInterface,
+      WORD port = 0,
+      unsigned shards = 0,
+      bool muxIdPrefix = false,
+      SubChannels subchannel = e_AllSubChannels
+    );
+
+    /**Close the shared port.
+      */
+    void Close();
+
+    /// Indicate is open
+    bool IsOpen() const { return !m_shards.empty(); }
+
+    /// Get the shared local address
+    const PIPSocketAddressAndPort & GetLocalAddress() const { return m_localAddress; }
+
+    /// Get the number of sockets and threads in use
+    unsigned GetShardCount() const { return (unsigned)m_shards.size(); }
+
+    /**Add a route to target.
+       @return false if key already used by another target, or table is full.
+      */
+    bool AddRoute(
+      Key key,
+      Target & target
+    );
+
+    /**Remove a route.
+       If \p target is not NULL, the key is only removed if it routes to it.
+      */
+    bool RemoveRoute(
+      Key key,
+      Target * target = NULL
+    );
+
+    /**Find the current target for the key.
+      */
+    Target * FindRoute(
+      Key key
+    ) const;
+
+    /**Write a packet to the remote, via the shared port.
+      */
+    bool WriteTo(
+      const void * data,
+      PINDEX length,
+      const PIPSocketAddressAndPort & remote,
+      unsigned shard = 0
+    );
+
+    typedef std::vector<uint64_t> Epoch;
+
+    /**Get the current state of the read threads, for IsQuiescent().
+      */
+    void GetEpoch(Epoch & epoch) const;
+
+    /**Determine if all read threads have finished any dispatch that was in
+       progress at the time of GetEpoch(). A target may be destroyed when this
+       is true, after it has removed all its routes before getting the epoch.
+      */
+    bool IsQuiescent(const Epoch & epoch) const;
+  //@}
+
+  /**@name Statistics */
+  //@{
+    struct Statistics
+    {
+      Statistics();
+      void PrintOn(ostream & strm) const;
+      friend ostream & operator<<(ostream & strm, const Statistics & stats) { stats.PrintOn(strm); return strm; }
+
+      unsigned m_shards;                ///< Number of sockets/threads
+      unsigned m_routes;                ///< Routes in table
+      unsigned m_capacity;              ///< Size of table
+      uint64_t m_received;              ///< Packets received
+      uint64_t m_routed[NumKeyTypes];   ///< Packets routed by each key type
+      uint64_t m_unrouted;              ///< Packets with no route
+    };
+
+    void GetStatistics(Statistics & statistics) const;
+  //@}
+
+  protected:
+    struct Slot
+    {
+      Slot() : m_key(EmptyKey), m_target(NULL) { }
+      atomic<Key>      m_key;
+      atomic<Target *> m_target;
+    };
+    enum { EmptyKey = 0 };
+    static const Key DeletedKey;
+
+    class Socket : public PUDPSocket
+    {
+        PCLASSINFO(Socket, PUDPSocket);
+      public:
+        bool ListenShared(const PIPAddress & localInterface, WORD port);
+    };
+
+    struct Shard
+    {
+      Shard() : m_socket(NULL), m_thread(NULL), m_placementGroup(-1), m_dispatch(0), m_received(0), m_unrouted(0)
+      {
+        for (PINDEX i = 0; i < NumKeyTypes; ++i)
+          m_routed[i] = 0;
+      }
+      Socket         * m_socket;
+      PThread        * m_thread;
+      int              m_placementGroup;
+      atomic<uint64_t> m_dispatch; // Odd while dispatching a packet
+      uint64_t         m_received;
+      uint64_t         m_routed[NumKeyTypes];
+      uint64_t         m_unrouted;
+    };
+
+    size_t GetSlotIndex(Key key) const;
+    void ReadMain(size_t index);
+    void Dispatch(size_t index, PBYTEArray & data, const PIPSocketAddressAndPort & remote);
+    Target * FindSTUNRoute(const BYTE * data, PINDEX length) const;
+
+    OpalManager           & m_manager;
+    PIPSocketAddressAndPort m_localAddress;
+    bool                    m_muxIdPrefix;
+    SubChannels             m_subchannel;
+    std::vector<Shard *>    m_shards;
+
+    Slot            * m_table;
+    size_t            m_tableMask;
+    atomic<unsigned>  m_routeCount;
+    PDECLARE_MUTEX(   m_tableMutex);
+
+    PTRACE_THROTTLE(m_throttleUnrouted, 3, 10000);
+};
+
+
+///////////////////////////////////////////////////////////////////////////////
+
+/**Media transport using an OpalMediaMuxListener.
+   This has no sockets or threads of its own. It adds routes to the listener
+   for the remote address, and any remote SSRC or ICE user fragment it is
+   told about, and writes via the listeners socket.
+  */
+class OpalMuxMediaTransport : public OpalMediaTransport, public OpalMediaMuxListener::Target
+{
+    PCLASSINFO(OpalMuxMediaTransport, OpalMediaTransport);
+  public:
+    OpalMuxMediaTransport(const PString & name, OpalMediaMuxListener & listener);
+    ~OpalMuxMediaTransport();
+
+    virtual PString GetType();
+    virtual bool Open(OpalMediaSession & session, PINDEX count, const PString & localInterface, const OpalTransportAddress & remoteAddress);
+    virtual bool SetRemoteAddress(const OpalTransportAddress & remoteAddress, SubChannels subchannel = e_Media);
+    virtual bool Write(const void * data, PINDEX length, SubChannels = e_Media, const PIPSocketAddressAndPort * = NULL, int * = NULL);
+    virtual void SetCandidates(const PString & user, const PString & pass, const PNatCandidateList & candidates);
+
+    /// Route packets with this SSRC, from any address, to this transport
+    bool AddSyncSource(uint32_t ssrc);
+
+    /// Route STUN requests with this local user fragment to this transport
+    bool AddICEUser(const PString & user);
+
+  protected:
+    virtual void InternalClose();
+    virtual bool GarbageCollection();
+    virtual void OnMuxData(OpalMediaMuxListener & listener, SubChannels subchannel, const PBYTEArray & data, const PIPSocketAddressAndPort & remote, unsigned shard);
+    bool InternalSetRemoteAddress(const PIPSocketAddressAndPort & ap, SubChannels subchannel, RemoteAddressSources source);
+    bool InternalAddRoute(OpalMediaMuxListener::Key key);
+    void InternalRemoveRoute(OpalMediaMuxListener::Key key);
+
+    OpalMediaMuxListener & m_listener;
+    atomic<unsigned>       m_shard;
+    PIPSocketAddressAndPort m_remoteAddress[2];
+
+    std::vector<OpalMediaMuxListener::Key> m_routes;
+    PDECLARE_MUTEX(m_routesMutex);
+    OpalMediaMuxListener::Epoch m_closedEpoch;
+    bool                        m_routesRemoved;
+
+    PDECLARE_NOTIFIER(PTimer, OpalMuxMediaTransport, CheckMediaTimeout);
+    PTimer m_timeoutTimer;
+};
+
+
+#endif // OPAL_RTP_RTPMUX_H
+
+
+// End of File ///////////////////////////////////////////////////////////////
@@ -42,6 +42,9 @@
 #include <rtp/rtp_session.h>
 #include <ptclib/pssl.h>
 
+#include <list>
+#include <vector>
+
 
 /**OpalConnection::StringOption key to a boolean indicating the SDP ptime
    parameter should be included in audio session streams. Default true.
@@ -157,6 +160,11 @@ class SDPMediaFormat : public PObject
     virtual bool PreEncode();
     virtual bool PostDecode(const OpalMediaFormatList & mediaFormats, unsigned bandwidth);
 
+    /**Set the media format from a previous PostDecode() of identical SDP.
+       @return false if \p mediaFormat is invalid, i.e. did not match.
+      */
+    bool SetCachedMediaFormat(const OpalMediaFormat & mediaFormat);
+
   protected:
     virtual bool AdjustMediaFormat(OpalMediaFormat & mediaFormat, unsigned bandwidth) const;
     virtual void SetMediaFormatOptions(OpalMediaFormat & mediaFormat) const;
@@ -177,6 +185,93 @@ class SDPMediaFormat : public PObject
 typedef PList<SDPMediaFormat> SDPMediaFormatList;
 
 
+/////////////////////////////////////////////////////////
+
+/**Cache of the media format matching done when decoding an SDP offer.
+   Matching offered formats against the local media formats, with all the
+   FMTP parsing and option normalisation, is a large part of the cost of
+   handling an INVITE. Trunks will typically send the same media
+   descriptions on every call, so the result is memoised.
+
+   The key is the media description text, excluding things that change
+   from call to call, e.g. addresses, ports, crypto keys and ICE
+   credentials, along with a fingerprint of the local media formats. The
+   cached value is the OpalMediaFormat matched for each payload type, which
+   is shared with every call using it. These are reference counted, so any
+   per call change makes a copy.
+
+   Entries are discarded on a least recently used basis.
+  */
+class SDPMediaFormatCache : public PObject
+{
+    PCLASSINFO(SDPMediaFormatCache, PObject);
+  public:
+    SDPMediaFormatCache(
+      PINDEX maxSize = 1000  ///< Maximum entries, zero disables cache
+    );
+
+    /// Matched media format for each payload type, invalid format is no match.
+    typedef std::map<RTP_DataFrame::PayloadTypes, OpalMediaFormat> Matches;
+
+    /**Look up previous matching result.
+       @return true if \p key was present.
+      */
+    bool Lookup(
+      const PString & key,
+      Matches & matches
+    );
+
+    /**Save a matching result.
+      */
+    void Store(
+      const PString & key,
+      const Matches & matches
+    );
+
+    /// Set maximum entries, zero disables cache.
+    void SetMaxSize(PINDEX maxSize);
+
+    /// Get maximum entries.
+    PINDEX GetMaxSize() const { return m_maxSize; }
+
+    /// Remove all entries.
+    void RemoveAll();
+
+    /**Get a fingerprint for the media formats being matched against.
+       Fingerprints of recently used lists are remembered against the
+       generation of each format, so are only recalculated when the list, or a
+       format in it, changes.
+      */
+    PString GetFingerprint(
+      const OpalMediaFormatList & mediaFormats
+    );
+
+    struct Statistics
+    {
+      Statistics() : m_entries(0), m_hits(0), m_misses(0) { }
+      PINDEX   m_entries;
+      uint64_t m_hits;
+      uint64_t m_misses;
+    };
+
+    /// Get cache statistics.
+    void GetStatistics(Statistics & statistics) const;
+
+  protected:
+    typedef std::list< std::pair<PString, Matches> > LRUList;
+    typedef std::map<PString, LRUList::iterator> KeyMap;
+    typedef std::map<std::vector<unsigned>, PString> FingerprintMap;
+
+    PINDEX         m_maxSize;
+    LRUList        m_entries; // Most recently used at front
+    KeyMap         m_keys;
+    FingerprintMap m_fingerprints;
+    uint64_t       m_hits;
+    uint64_t       m_misses;
+    PDECLARE_MUTEX(m_mutex);
+};
+
+
 /////////////////////////////////////////////////////////
 
 class SDPCommonAttributes
@@ -304,6 +399,11 @@ class SDPMediaDescription : public PObject, public SDPCommonAttributes
     virtual bool Decode(char key, const PString & value);
     virtual bool PostDecode(const OpalMediaFormatList & mediaFormats);
 
+    /**Set the cache for media format matching in PostDecode().
+       The \p key is the normalised media description text.
+      */
+    void SetFormatCache(SDPMediaFormatCache * cache, const PString & key);
+
     // return the string used within SDP to identify this media type
     virtual PString GetSDPMediaType() const;
 
@@ -387,6 +487,8 @@ class SDPMediaDescription : public PObject, public SDPCommonAttributes
     PNatCandidateList    m_candidates;
 #endif //OPAL_ICE
     SDPMediaFormatList   m_formats;
+    SDPMediaFormatCache * m_formatCache;
+    PString               m_formatCacheKey;
 
   P_REMOVE_VIRTUAL(SDPMediaFormat *,CreateSDPMediaFormat(const PString &),0);
   P_REMOVE_VIRTUAL(OpalTransportAddress,GetTransportAddress(),OpalTransportAddress());
@@ -673,6 +775,11 @@ class SDPSessionDescription : public PObject, public SDPCommonAttributes
 
     OpalMediaFormatList GetMediaFormats() const;
 
+    /**Set the cache for media format matching in Decode().
+       The cache is not owned by the SDP, and may be NULL to disable.
+      */
+    void SetFormatCache(SDPMediaFormatCache * cache) { m_formatCache = cache; }
+
   protected:
     void ParseOwner(const PString & str);
 
@@ -690,6 +797,8 @@ class SDPSessionDescription : public PObject, public SDPCommonAttributes
     GroupDict    m_groups;
 
     PStringArray m_mediaStreamIds;
+
+    SDPMediaFormatCache * m_formatCache;
 };
 
 /////////////////////////////////////////////////////////
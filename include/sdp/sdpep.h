@@ -128,10 +128,23 @@ class OpalSDPEndPoint : public OpalRTPEndPoint
       const PTimeInterval & t
     ) { m_holdTimeout = t; }
     const PTimeInterval & GetHoldTimeout() const { return m_holdTimeout; }
+
+    /**Set the maximum number of entries in the cache of media format
+       matching results for received SDP. Zero disables the cache.
+      */
+    void SetSDPFormatCacheSize(
+      PINDEX size
+    ) { m_formatCache.SetMaxSize(size); }
+    PINDEX GetSDPFormatCacheSize() const { return m_formatCache.GetMaxSize(); }
+
+    /**Get the cache of media format matching results for received SDP.
+      */
+    SDPMediaFormatCache & GetSDPFormatCache() { return m_formatCache; }
   //@}
 
   protected:
-    PTimeInterval m_holdTimeout;
+    PTimeInterval       m_holdTimeout;
+    SDPMediaFormatCache m_formatCache;
 };
 
 
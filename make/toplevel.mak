@@ -77,6 +77,32 @@ ifeq ($(OPAL_SAMPLES),yes)
     SUBDIRS += $(OPAL_TOP_LEVEL_DIR)/samples/gstreamer
   endif
 
+  # Test programs that are also run by "make check"
+  OPAL_TEST_DIRS := $(OPAL_TOP_LEVEL_DIR)/samples/test/evtrace
+  OPAL_TEST_DIRS += $(OPAL_TOP_LEVEL_DIR)/samples/test/rtpmux
+  OPAL_TEST_DIRS += $(OPAL_TOP_LEVEL_DIR)/samples/test/pcap
+  OPAL_TEST_DIRS += $(OPAL_TOP_LEVEL_DIR)/samples/test/silence
+  OPAL_TEST_DIRS += $(OPAL_TOP_LEVEL_DIR)/samples/test/callrate
+  ifeq ($(OPAL_VIDEO)$(OPAL_HAS_MIXER),yesyes)
+    OPAL_TEST_DIRS += $(OPAL_TOP_LEVEL_DIR)/samples/test/vidmix
+  endif
+  ifeq ($(OPAL_H323),yes)
+    OPAL_TEST_DIRS += $(OPAL_TOP_LEVEL_DIR)/samples/test/asnpdu
+  endif
+  ifeq ($(OPAL_AEC),yes)
+    OPAL_TEST_DIRS += $(OPAL_TOP_LEVEL_DIR)/samples/test/aec
+  endif
+  ifeq ($(OPAL_IAX2),yes)
+    OPAL_TEST_DIRS += $(OPAL_TOP_LEVEL_DIR)/samples/test/iax2trunk
+  endif
+  ifeq ($(OPAL_SDP),yes)
+    OPAL_TEST_DIRS += $(OPAL_TOP_LEVEL_DIR)/samples/test/sdpcache
+  endif
+  ifeq ($(OPAL_VIDEO),yes)
+    OPAL_TEST_DIRS += $(OPAL_TOP_LEVEL_DIR)/samples/test/videnc
+  endif
+  SUBDIRS += $(OPAL_TEST_DIRS)
+
 endif # OPAL_SAMPLES
 
 
@@ -119,6 +145,10 @@ VPATH_C := $(OPAL_SRCDIR)/codec
 ###############################################################################
 
 SOURCES += $(OPAL_SRCDIR)/opal/manager.cxx \
+           $(OPAL_SRCDIR)/opal/eventpool.cxx \
+           $(OPAL_SRCDIR)/opal/asyncio.cxx \
+           $(OPAL_SRCDIR)/opal/placement.cxx \
+           $(OPAL_SRCDIR)/opal/evtrace.cxx \
            $(OPAL_SRCDIR)/opal/endpoint.cxx \
            $(OPAL_SRCDIR)/opal/connection.cxx \
            $(OPAL_SRCDIR)/opal/call.cxx \
@@ -137,6 +167,7 @@ SOURCES += $(OPAL_SRCDIR)/opal/manager.cxx \
            $(OPAL_SRCDIR)/rtp/jitter.cxx \
            $(OPAL_SRCDIR)/rtp/metrics.cxx \
            $(OPAL_SRCDIR)/rtp/pcapfile.cxx \
+           $(OPAL_SRCDIR)/rtp/rtpmux.cxx \
            $(OPAL_SRCDIR)/rtp/rtpep.cxx \
            $(OPAL_SRCDIR)/rtp/rtpconn.cxx \
            $(OPAL_SRCDIR)/ep/localep.cxx \
@@ -516,6 +547,13 @@ ifneq (,$(SWIG))
 endif
 
 
+################################################################################
+
+.PHONY: check
+check:
+	set -e ; for dir in $(OPAL_TEST_DIRS) ; do $(MAKE) -C $$dir check ; done
+
+
 ################################################################################
 
 ifeq ($(prefix),$(OPALDIR))
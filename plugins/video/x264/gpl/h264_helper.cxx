@@ -54,7 +54,7 @@
 #include "../../common/dyna.cxx"
 
 
-static const unsigned Version = 1; // API version
+static const unsigned Version = SHARED_MEMORY_VERSION; // API version
 
 
 #ifdef WIN32
@@ -119,6 +119,7 @@ void WritePipe(LPCVOID data, unsigned bytes)
 
 #include <errno.h>
 #include <fcntl.h>
+#include <sys/mman.h>
 
 int downLink;
 int upLink;
@@ -160,6 +161,41 @@ void WritePipe(const void * data, unsigned bytes)
 }
 
 
+int sharedFile = -1;
+unsigned char * sharedMemory;
+size_t sharedSize;
+
+
+void OpenSharedMemory(const char * name)
+{
+  if ((sharedFile = open(name, O_RDWR)) < 0) {
+    PTRACE(2, HelperTraceName, "Error when opening shared memory \"" << name << "\" - " << strerror(errno));
+  }
+}
+
+
+bool MapSharedMemory(size_t size)
+{
+  if (sharedMemory != NULL) {
+    if (size == sharedSize)
+      return true;
+    munmap(sharedMemory, sharedSize);
+    sharedMemory = NULL;
+  }
+
+  void * mapping = mmap(NULL, size, PROT_READ|PROT_WRITE, MAP_SHARED, sharedFile, 0);
+  if (mapping == MAP_FAILED) {
+    PTRACE(1, HelperTraceName, "Error mapping " << size << " bytes of shared memory - " << strerror(errno));
+    return false;
+  }
+
+  sharedMemory = (unsigned char *)mapping;
+  sharedSize = size;
+  PTRACE(4, HelperTraceName, "Mapped " << size << " bytes of shared memory");
+  return true;
+}
+
+
 #endif // WIN32
 
 
@@ -174,6 +210,10 @@ unsigned flags;
 
 H264Encoder x264;
 
+#ifndef WIN32
+SharedEncodeRequest sharedRequest;
+#endif
+
 
 void ResizeBuffer(size_t len)
 {
@@ -193,6 +233,52 @@ void ResizeBuffer(size_t len)
 }
 
 
+#ifndef WIN32
+
+/* Encode from the raw frame in shared memory, and packetise as much of it
+   as fits into the output area, all in one round trip. */
+void EncodeShared(unsigned msg)
+{
+  SharedEncodeReply reply = { msg, 0, 0, 1 };
+
+  const unsigned char * header = sharedMemory + sharedRequest.m_srcLen;
+  size_t offset = SHARED_OUTPUT_OFFSET(sharedRequest.m_srcLen, sharedRequest.m_headerLen);
+  while (offset + SHARED_PACKET_SIZE(rtpSize) <= sharedSize) {
+    SharedEncodePacket * packet = (SharedEncodePacket *)(sharedMemory + offset);
+    unsigned char * rtp = (unsigned char *)(packet+1);
+    memcpy(rtp, header, sharedRequest.m_headerLen);
+
+    unsigned dstLen = (unsigned)rtpSize;
+    unsigned packetFlags = sharedRequest.m_flags;
+    reply.m_result = x264.EncodeFrames(sharedMemory, sharedRequest.m_srcLen, rtp, dstLen, sharedRequest.m_headerLen, packetFlags);
+    if (reply.m_result == 0) {
+      reply.m_complete = 1;
+      break;
+    }
+
+    packet->m_length = dstLen;
+    packet->m_flags = packetFlags;
+    offset += SHARED_PACKET_SIZE(dstLen);
+    ++reply.m_packets;
+
+    if ((packetFlags & PluginCodec_ReturnCoderLastFrame) != 0) {
+      reply.m_complete = 1;
+      break;
+    }
+  }
+
+  if (reply.m_packets == 0 && reply.m_complete == 0) {
+    PTRACE(1, HelperTraceName, "Shared memory of " << sharedSize << " bytes too small for a packet");
+    reply.m_complete = 1;
+    reply.m_result = 0;
+  }
+
+  WritePipe(&reply, sizeof(reply));
+}
+
+#endif // WIN32
+
+
 int main(int argc, char *argv[])
 {
   if (argc < 2) {
@@ -208,6 +294,11 @@ int main(int argc, char *argv[])
 
   OpenPipe(argv[1], argv[2]);
 
+#ifndef WIN32
+  if (argc > 3)
+    OpenSharedMemory(argv[3]);
+#endif
+
   PTRACE(5, HelperTraceName, "GPL executable ready");
 
   rtpSize = 1500;
@@ -218,6 +309,13 @@ int main(int argc, char *argv[])
 
     switch (msg) {
       case H264ENCODERCONTEXT_CREATE:
+#ifndef WIN32
+          if (sharedFile < 0) {
+            static const unsigned PipeOnlyVersion = 1;
+            WritePipe(&PipeOnlyVersion, sizeof(PipeOnlyVersion));
+            break;
+          }
+#endif
           WritePipe(&Version, sizeof(Version)); 
         break;
       case H264ENCODERCONTEXT_DELETE:
@@ -286,6 +384,20 @@ int main(int argc, char *argv[])
           WritePipe(&ret, sizeof(ret));
         }
         break;
+#ifndef WIN32
+      case ENCODE_FRAMES_SHARED:
+          sharedRequest.m_msg = msg;
+          ReadPipe(&sharedRequest.m_sharedSize, sizeof(sharedRequest)-sizeof(sharedRequest.m_msg));
+          if (!MapSharedMemory(sharedRequest.m_sharedSize)) {
+            SharedEncodeReply reply = { msg, 0, 1, 0 };
+            WritePipe(&reply, sizeof(reply));
+            break;
+          }
+          // fall through
+      case ENCODE_FRAMES_SHARED_MORE:
+          EncodeShared(msg);
+        break;
+#endif
       case SET_MAX_PAYLOAD_SIZE:
           ReadPipe(&val, sizeof(val));
           x264.SetMaxRTPPayloadSize(val);
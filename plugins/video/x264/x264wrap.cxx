@@ -603,6 +603,11 @@ bool H264Encoder::WritePipe(const void * ptr, size_t len)
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <sys/wait.h>
+#include <sys/mman.h>
+
+
+// Big enough for 1080p plus its encoded output, grows if needed
+static const size_t InitialSharedSize = 1920*1088*3/2 + 512*1024;
 
 
 static const char DefaultPluginDirs[] = "." DIR_TOKENISER
@@ -620,8 +625,18 @@ H264Encoder::H264Encoder()
   : m_loaded(false)
   , m_pipeToProcess(-1)
   , m_pipeFromProcess(-1)
+  , m_pid(0)
+  , m_shmFile(-1)
+  , m_sharedMemory(NULL)
+  , m_sharedSize(0)
+  , m_batchStart(0)
+  , m_batchOffset(0)
+  , m_batchPackets(0)
+  , m_batchResult(0)
+  , m_batchComplete(true)
   , m_startNewFrame(true)
 {
+  m_shmName[0] = '\0';
 }
 
 
@@ -644,6 +659,8 @@ H264Encoder::~H264Encoder()
     PTRACE(1, PipeTraceName, "Error when trying to remove DL named pipe - " << strerror(errno));
   }
 
+  CloseSharedMemory();
+
   if (m_pid != 0) {
     kill(m_pid, 9);
     int status;
@@ -679,6 +696,9 @@ bool H264Encoder::OpenPipeAndExecute(void * instance, const char * executablePat
   }
 #endif /* HAVE_MKFIFO */
 
+  // Optional, older helpers, or failure, fall back to sending frames down the pipe
+  CreateSharedMemory(instance);
+
   m_pid = vfork();
   if (m_pid < 0) {
     PTRACE(1, PipeTraceName, "Error when trying to vfork");
@@ -687,7 +707,10 @@ bool H264Encoder::OpenPipeAndExecute(void * instance, const char * executablePat
 
   if (m_pid == 0) {
     // If succeeds, execl does not return
-    execl(executablePath, executablePath, m_dlName, m_ulName, NULL);
+    if (m_sharedMemory != NULL)
+      execl(executablePath, executablePath, m_dlName, m_ulName, m_shmName, NULL);
+    else
+      execl(executablePath, executablePath, m_dlName, m_ulName, NULL);
     // With vfork() we must not do anything other than execl or _exit
     _exit(1);
     return false;
@@ -710,6 +733,139 @@ bool H264Encoder::OpenPipeAndExecute(void * instance, const char * executablePat
 }
 
 
+bool H264Encoder::CreateSharedMemory(void * instance)
+{
+  // Allows comparison with the old transport
+  if (::getenv("X264_HELPER_PIPES") != NULL) {
+    PTRACE(3, PipeTraceName, "Shared memory disabled by environment");
+    return false;
+  }
+
+  snprintf(m_shmName, sizeof(m_shmName), "%s/x264-%d-%p-shm",
+           access("/dev/shm", W_OK) == 0 ? "/dev/shm" : "/tmp", getpid(), instance);
+
+  m_shmFile = open(m_shmName, O_RDWR|O_CREAT|O_EXCL, S_IRUSR|S_IWUSR);
+  if (m_shmFile < 0) {
+    PTRACE(2, PipeTraceName, "Could not create shared memory \"" << m_shmName << "\" - " << strerror(errno));
+    m_shmName[0] = '\0';
+    return false;
+  }
+
+  if (ResizeSharedMemory(InitialSharedSize))
+    return true;
+
+  CloseSharedMemory();
+  return false;
+}
+
+
+bool H264Encoder::ResizeSharedMemory(size_t size)
+{
+  if (m_sharedMemory != NULL) {
+    if (size <= m_sharedSize)
+      return true;
+    munmap(m_sharedMemory, m_sharedSize);
+    m_sharedMemory = NULL;
+  }
+
+  if (ftruncate(m_shmFile, size) < 0) {
+    PTRACE(1, PipeTraceName, "Could not set shared memory size to " << size << " - " << strerror(errno));
+    return false;
+  }
+
+  void * mapping = mmap(NULL, size, PROT_READ|PROT_WRITE, MAP_SHARED, m_shmFile, 0);
+  if (mapping == MAP_FAILED) {
+    PTRACE(1, PipeTraceName, "Could not map shared memory of " << size << " bytes - " << strerror(errno));
+    return false;
+  }
+
+  m_sharedMemory = (unsigned char *)mapping;
+  m_sharedSize = size;
+  PTRACE(4, PipeTraceName, "Shared memory is " << size << " bytes");
+  return true;
+}
+
+
+void H264Encoder::CloseSharedMemory()
+{
+  if (m_sharedMemory != NULL) {
+    munmap(m_sharedMemory, m_sharedSize);
+    m_sharedMemory = NULL;
+    m_sharedSize = 0;
+  }
+
+  if (m_shmFile >= 0) {
+    close(m_shmFile);
+    m_shmFile = -1;
+  }
+
+  if (m_shmName[0] != '\0') {
+    remove(m_shmName);
+    m_shmName[0] = '\0';
+  }
+}
+
+
+bool H264Encoder::ReadSharedReply()
+{
+  SharedEncodeReply reply;
+  if (!ReadPipe(&reply, sizeof(reply)))
+    return false;
+
+  m_batchOffset = m_batchStart;
+  m_batchPackets = reply.m_packets;
+  m_batchComplete = reply.m_complete != 0;
+  m_batchResult = reply.m_result;
+  return true;
+}
+
+
+bool H264Encoder::EncodeShared(const unsigned char * src, unsigned & srcLen,
+                               unsigned char * dst, unsigned & dstLen,
+                               unsigned headerLen, unsigned int & flags)
+{
+  if (m_startNewFrame) {
+    m_batchStart = SHARED_OUTPUT_OFFSET(srcLen, headerLen);
+    // Usually enough for all the packets of the frame in one batch
+    if (!ResizeSharedMemory(m_batchStart + srcLen/4 + 65536))
+      return false;
+
+    memcpy(m_sharedMemory, src, srcLen);
+    memcpy(m_sharedMemory+srcLen, dst, headerLen);
+
+    SharedEncodeRequest request = { ENCODE_FRAMES_SHARED, (unsigned)m_sharedSize, srcLen, headerLen, flags };
+    if (!WritePipe(&request, sizeof(request)) || !ReadSharedReply())
+      return false;
+  }
+  else if (m_batchPackets == 0 && !m_batchComplete) {
+    unsigned msg = ENCODE_FRAMES_SHARED_MORE;
+    if (!WritePipe(&msg, sizeof(msg)) || !ReadSharedReply())
+      return false;
+  }
+
+  if (m_batchPackets == 0) {
+    m_startNewFrame = true;
+    dstLen = 0;
+    return m_batchResult != 0;
+  }
+
+  const SharedEncodePacket * packet = (const SharedEncodePacket *)(m_sharedMemory + m_batchOffset);
+  if (packet->m_length > dstLen) {
+    PTRACE(1, PipeTraceName, "Packet of " << packet->m_length << " bytes too large for " << dstLen << " byte buffer");
+    return false;
+  }
+
+  memcpy(dst, packet+1, packet->m_length);
+  dstLen = packet->m_length;
+  flags = packet->m_flags;
+  m_batchOffset += SHARED_PACKET_SIZE(packet->m_length);
+  --m_batchPackets;
+
+  m_startNewFrame = (flags & PluginCodec_ReturnCoderLastFrame) != 0;
+  return m_batchResult != 0;
+}
+
+
 bool H264Encoder::ReadPipe(void * ptr, size_t len)
 {
   int result = read(m_pipeFromProcess, ptr, len);
@@ -805,6 +961,17 @@ bool H264Encoder::Load(void * instance)
   }
 
   PTRACE(4, PipeTraceName, "Successfully established communication with GPL process version " << msg);
+
+#ifndef WIN32
+  if (msg >= SHARED_MEMORY_VERSION && m_sharedMemory != NULL) {
+    // Helper has it open now, so name no longer needed
+    remove(m_shmName);
+    m_shmName[0] = '\0';
+    PTRACE(4, PipeTraceName, "Using shared memory for frames");
+  }
+  else
+    CloseSharedMemory();
+#endif
   m_loaded = true;
   return true;
 }
@@ -902,6 +1069,11 @@ bool H264Encoder::EncodeFrames(const unsigned char * src, unsigned & srcLen,
                                unsigned char * dst, unsigned & dstLen,
                                unsigned headerLen, unsigned int & flags)
 {
+#ifndef WIN32
+  if (m_sharedMemory != NULL)
+    return EncodeShared(src, srcLen, dst, dstLen, headerLen, flags);
+#endif
+
   unsigned msg;
   if (m_startNewFrame) {
     msg = ENCODE_FRAMES;
@@ -69,6 +69,49 @@ extern "C" {
 #define SET_PROFILE_LEVEL         13
 #define SET_MAX_NALU_SIZE         14
 #define SET_RATE_CONTROL_PERIOD   15
+#define ENCODE_FRAMES_SHARED      16
+#define ENCODE_FRAMES_SHARED_MORE 17
+
+
+/* Shared memory frame transport, helper version 2 and later.
+   The plug in writes the raw frame, followed by the RTP header to use, at
+   the start of the shared memory, and sends an ENCODE_FRAMES_SHARED with
+   an SharedEncodeRequest over the pipe. The helper encodes directly from
+   the shared memory and packetises the whole frame into the area after
+   the input, each packet as a SharedEncodePacket followed by the RTP data
+   padded to a multiple of four bytes. A single SharedEncodeReply is then
+   returned. If the output area fills before the last packet of the frame
+   is produced, m_complete is zero and the plug in sends an
+   ENCODE_FRAMES_SHARED_MORE, after it has used the packets, to get the
+   next batch in the same output area.
+ */
+#define SHARED_MEMORY_VERSION     2
+
+struct SharedEncodeRequest
+{
+  unsigned m_msg;
+  unsigned m_sharedSize;  // Total size, helper re-maps if changed
+  unsigned m_srcLen;      // Raw frame at offset zero
+  unsigned m_headerLen;   // RTP header immediately after frame
+  unsigned m_flags;
+};
+
+struct SharedEncodeReply
+{
+  unsigned m_msg;
+  unsigned m_packets;     // Number of packets in output area
+  unsigned m_complete;    // Last packet of frame is in output area
+  unsigned m_result;      // Return value of EncodeFrames()
+};
+
+struct SharedEncodePacket
+{
+  unsigned m_length;
+  unsigned m_flags;
+};
+
+#define SHARED_OUTPUT_OFFSET(srcLen, headerLen) ((((srcLen)+(headerLen))+15)&~15)
+#define SHARED_PACKET_SIZE(length) (sizeof(SharedEncodePacket)+(((length)+3)&~3))
 
 
 class H264Encoder
@@ -134,6 +177,29 @@ class H264Encoder
     int   m_pipeToProcess;
     int   m_pipeFromProcess;
     pid_t m_pid;
+
+    bool CreateSharedMemory(void * instance);
+    bool ResizeSharedMemory(size_t size);
+    void CloseSharedMemory();
+    bool ReadSharedReply();
+    bool EncodeShared(
+      const unsigned char * src,
+      unsigned & srcLen,
+      unsigned char * dst,
+      unsigned & dstLen,
+      unsigned headerLen,
+      unsigned int & flags
+    );
+
+    char            m_shmName[100];
+    int             m_shmFile;
+    unsigned char * m_sharedMemory;
+    size_t          m_sharedSize;
+    unsigned        m_batchStart;     // Offset of output area
+    unsigned        m_batchOffset;    // Next packet in output area
+    unsigned        m_batchPackets;   // Remaining in output area
+    unsigned        m_batchResult;
+    bool            m_batchComplete;
   #endif // WIN32
 
     bool m_startNewFrame;
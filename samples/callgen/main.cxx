@@ -27,6 +27,10 @@
 #include <ptclib/pvidfile.h>
 #include <opal/transcoders.h>
 
+#ifdef P_LINUX
+#include <sys/resource.h>
+#endif
+
 
 #define PTraceModule() "CallGen"
 
@@ -58,6 +62,7 @@ static PMutex g_coutMutex;
 MyManager::MyManager()
   : m_totalCalls(0)
   , m_totalEstablished(0)
+  , m_benchmark(*this)
 {
 }
 
@@ -85,6 +90,16 @@ PString MyManager::GetArgumentSpec() const
          "-tmaxcall:             Maximum call duration in seconds [60]\n"
          "-tminwait:             Minimum interval between calls in seconds [10]\n"
          "-tmaxwait:             Maximum interval between calls in seconds [30]\n"
+         "[Benchmark:]"
+         "-bench:                Run load test, looping calls back to this process via\r"
+                                "protocol sip, h323 or iax2.\n"
+         "-cps:                  Target calls per second [10]\n"
+         "-hold:                 Call hold time once established, in milliseconds [5000]\n"
+         "-duration:             Time to generate calls, in seconds [30]\n"
+         "-codec:                Media format to use, may be multiple entries [all]\n"
+         "-srtp:                 SRTP crypto suite to use, SIP and H.323 only [none]\n"
+         "-ice.                  Offer ICE, SIP only\n"
+         "-json:                 File for JSON results [stdout]\n"
          "[Reporting:]"
          "q-quiet.               Do not display call progress output.\n"
          "c-cdr:                 Specify Call Detail Record file [none]\n"
@@ -102,6 +117,12 @@ void MyManager::Usage(ostream & strm, const PArgList & args)
              "  the call running once established. If zero (the default) then --tmincall\n"
              "  is the length of the call from initiation. The call may or may not be\n"
              "  \"answered\" within that time.\n"
+             "\n"
+             "  If --bench is used, no destination is needed, calls are made to the\n"
+             "  listener for the protocol on the loopback interface. The --max option\n"
+             "  limits concurrent calls, --repeat limits the total calls and --tmaxest\n"
+             "  (default 10) is the setup timeout. Only the JSON results are written to\n"
+             "  stdout, progress is written to stderr.\n"
              "\n";
 }
 
@@ -110,14 +131,18 @@ bool MyManager::Initialise(PArgList & args, bool, const PString &)
 {
   args.Parse(GetArgumentSpec());
 
-  if (args.GetCount() == 0 && !args.HasOption('l')) {
-    cerr << "\nNeed either --listen or a destination argument\n\n";
+  if (args.GetCount() == 0 && !args.HasOption('l') && !args.HasOption("bench")) {
+    cerr << "\nNeed either --listen, --bench or a destination argument\n\n";
     Usage(cerr, args);
     return false;
   }
 
+  // Benchmark keeps stdout for the JSON results
+  std::streambuf * stdoutBuffer = cout.rdbuf();
   if (args.HasOption('q'))
     cout.rdbuf(NULL);
+  else if (args.HasOption("bench"))
+    cout.rdbuf(cerr.rdbuf());
 
   if (!OpalManagerConsole::Initialise(args, !args.HasOption('q'), "local:"))
     return false;
@@ -141,6 +166,9 @@ bool MyManager::Initialise(PArgList & args, bool, const PString &)
     }
   }
 
+  if (args.HasOption("bench"))
+    return m_benchmark.Initialise(args, stdoutBuffer);
+
   if (args.HasOption('l')) {
     cout << "Endpoint is listening for incoming calls, press ^C to exit.\n";
     return true;
@@ -199,6 +227,11 @@ bool MyManager::Initialise(PArgList & args, bool, const PString &)
 
 void MyManager::Run()
 {
+  if (m_benchmark.IsEnabled()) {
+    m_benchmark.Run(m_endRun, m_interrupted);
+    return;
+  }
+
   for (;;) {
     m_endRun.Wait();
 
@@ -364,6 +397,10 @@ MyManager::~MyManager()
 
 OpalCall * MyManager:: CreateCall(void * userData)
 {
+  if (userData == &m_benchmark) {
+    m_benchmark.OnCreated();
+    return new MyCall(*this, NULL, true);
+  }
   return new MyCall(*this, (CallThread *)userData);
 }
 
@@ -375,15 +412,28 @@ PBoolean MyManager::OnOpenMediaStream(OpalConnection & connection, OpalMediaStre
 }
 
 
+#if OPAL_STATISTICS
+void MyManager::OnClosedMediaStream(const OpalMediaStream & stream)
+{
+  if (m_benchmark.IsEnabled())
+    m_benchmark.OnClosedMediaStream(stream);
+  OpalManagerConsole::OnClosedMediaStream(stream);
+}
+#endif
+
+
 ///////////////////////////////////////////////////////////////////////////////
 
-MyCall::MyCall(MyManager & mgr, CallThread * caller)
+MyCall::MyCall(MyManager & mgr, CallThread * caller, bool benchmark)
   : OpalCall(mgr)
   , m_manager(mgr)
   , m_index(caller != NULL ? caller->m_index : 0)
+  , m_benchmark(benchmark)
+  , m_output(!mgr.m_benchmark.IsEnabled())
   , m_openedTransmitMedia(0)
   , m_openedReceiveMedia(0)
   , m_receivedMedia(0)
+  , m_clearRequested(0)
 {
 }
 
@@ -394,7 +444,7 @@ void MyCall::OnNewConnection(OpalConnection & connection)
 
   if (connection.IsNetworkConnection()) {
     m_callIdentifier = connection.GetIdentifier();
-    if (IsNetworkOriginated()) {
+    if (IsNetworkOriginated() && m_output) {
       OUTPUT(m_index, GetToken(), "Started \"" << GetRemoteName() << "\""
                                            " " << GetRemoteParty() <<
                                     " active=" << m_manager.GetActiveCalls() <<
@@ -406,21 +456,31 @@ void MyCall::OnNewConnection(OpalConnection & connection)
 
 void MyCall::OnEstablishedCall()
 {
-  OUTPUT(m_index, GetToken(), "Established \"" << GetRemoteName() << "\""
-                                           " " << GetRemoteParty() <<
-                                    " active=" << m_manager.GetActiveCalls() <<
-                                     " total=" << ++m_manager.m_totalEstablished);
+  if (m_benchmark)
+    m_manager.m_benchmark.OnEstablished(*this);
+
+  if (m_output) {
+    OUTPUT(m_index, GetToken(), "Established \"" << GetRemoteName() << "\""
+                                             " " << GetRemoteParty() <<
+                                      " active=" << m_manager.GetActiveCalls() <<
+                                       " total=" << ++m_manager.m_totalEstablished);
+  }
   OpalCall::OnEstablishedCall();
 }
 
 
 void MyCall::OnCleared()
 {
-  OUTPUT(m_index, GetToken(), "Cleared \"" << GetRemoteName() << "\""
-                                       " " << GetRemoteParty() <<
-                                " reason=" << GetCallEndReason() <<
-                                " active=" << (m_manager.GetActiveCalls()-1) <<
-                                 " total=" << m_manager.m_totalEstablished);
+  if (m_benchmark)
+    m_manager.m_benchmark.OnCleared(*this);
+
+  if (m_output) {
+    OUTPUT(m_index, GetToken(), "Cleared \"" << GetRemoteName() << "\""
+                                         " " << GetRemoteParty() <<
+                                  " reason=" << GetCallEndReason() <<
+                                  " active=" << (m_manager.GetActiveCalls()-1) <<
+                                   " total=" << m_manager.m_totalEstablished);
+  }
 
   PTextFile & cdrFile = m_manager.m_cdrFile;
 
@@ -480,12 +540,571 @@ void MyCall::OnOpenMediaStream(OpalMediaStream & stream)
 {
   (stream.IsSink() ? m_openedTransmitMedia : m_openedReceiveMedia) = PTime();
 
-  OUTPUT(m_index, GetToken(),
-         "Opened " << (stream.IsSink() ? "transmitter" : "receiver")
-                   << " for " << stream.GetMediaFormat());
+  if (m_output) {
+    OUTPUT(m_index, GetToken(),
+           "Opened " << (stream.IsSink() ? "transmitter" : "receiver")
+                     << " for " << stream.GetMediaFormat());
+  }
 }
 
 
+///////////////////////////////////////////////////////////////////////////////
+
+Benchmark::Benchmark(MyManager & manager)
+  : m_manager(manager)
+  , m_jsonOutput(NULL)
+  , m_ice(false)
+  , m_targetCPS(10)
+  , m_holdTime(5000)
+  , m_duration(0, 30)
+  , m_setupTimeout(0, 10)
+  , m_maxCalls(0)
+  , m_maxConcurrent(0)
+  , m_active(0)
+  , m_peakActive(0)
+  , m_attempted(0)
+  , m_established(0)
+  , m_completed(0)
+  , m_failed(0)
+  , m_timedOut(0)
+  , m_skipped(0)
+  , m_startTime(0)
+  , m_packetsReceived(0)
+  , m_packetsSent(0)
+  , m_bytesReceived(0)
+  , m_bytesSent(0)
+  , m_threads(0)
+  , m_peakThreads(0)
+  , m_residentMemory(0)
+  , m_peakResidentMemory(0)
+{
+}
+
+
+bool Benchmark::Initialise(PArgList & args, std::streambuf * output)
+{
+  m_jsonOutput = output;
+  m_jsonFile = args.GetOptionString("json");
+
+  PCaselessString protocol = args.GetOptionString("bench");
+  if (protocol != "sip" && protocol != "h323" && protocol != "iax2") {
+    cerr << "Benchmark protocol must be sip, h323 or iax2!" << endl;
+    return false;
+  }
+
+#if OPAL_IAX2
+  if (protocol == "iax2" && m_manager.FindEndPoint("iax2") == NULL) {
+    new IAX2EndPoint(m_manager);
+    m_manager.AddRouteEntry("iax2:.* = local:");
+  }
+#endif
+
+  OpalEndPoint * ep = m_manager.FindEndPoint(protocol);
+  if (ep == NULL) {
+    cerr << "Benchmark protocol " << protocol << " unavailable!" << endl;
+    return false;
+  }
+
+  // Loop back to our own listener for the protocol
+  WORD port = ep->GetDefaultSignalPort();
+  if (!ep->GetListeners().IsEmpty()) {
+    PIPSocket::Address dummy;
+    ep->GetListeners()[0].GetLocalAddress().GetIpAndPort(dummy, port);
+  }
+
+  if (protocol == "iax2")
+    m_destination = PSTRSTRM("iax2:bench@127.0.0.1:" << port << "/bench");
+  else
+    m_destination = PSTRSTRM(protocol << ":bench@127.0.0.1:" << port);
+
+  m_codecs = args.GetOptionString("codec").Lines();
+  if (!m_codecs.IsEmpty()) {
+    OpalMediaFormatList allFormats = OpalMediaFormat::GetAllRegisteredMediaFormats();
+
+    PStringArray keep;
+    for (PINDEX i = 0; i < m_codecs.GetSize(); ++i)
+      keep += '!' + m_codecs[i];
+    OpalMediaFormatList wanted = allFormats;
+    wanted.Remove(keep);
+    if (wanted.IsEmpty()) {
+      cerr << "No media formats match " << setfill(',') << m_codecs << setfill(' ') << endl;
+      return false;
+    }
+
+    // Mask all other encoded formats, the raw ones are needed by the local endpoint
+    PStringArray mask = m_manager.GetMediaFormatMask();
+    for (OpalMediaFormatList::iterator it = allFormats.begin(); it != allFormats.end(); ++it) {
+      if (it->IsTransportable() &&
+         (it->IsMediaType(OpalMediaType::Audio())
+#if OPAL_VIDEO
+          || it->IsMediaType(OpalMediaType::Video())
+#endif
+         ) && !wanted.HasFormat(it->GetName()))
+        mask += it->GetName();
+    }
+    m_manager.SetMediaFormatMask(mask);
+    m_manager.SetMediaFormatOrder(m_codecs);
+  }
+
+  m_cryptoSuites = args.GetOptionString("srtp").Lines();
+  if (!m_cryptoSuites.IsEmpty()) {
+    PStringArray available = ep->GetAllMediaCryptoSuites();
+    for (PINDEX i = 0; i < m_cryptoSuites.GetSize(); ++i) {
+      if (protocol == "iax2" || available.GetValuesIndex(m_cryptoSuites[i]) == P_MAX_INDEX) {
+        cerr << "Crypto suite \"" << m_cryptoSuites[i] << "\" not available for " << protocol << endl;
+        return false;
+      }
+    }
+    ep->SetMediaCryptoSuites(m_cryptoSuites);
+  }
+
+  m_ice = args.HasOption("ice");
+  if (m_ice) {
+#if OPAL_ICE
+    if (protocol != "sip") {
+      cerr << "ICE is only available for sip" << endl;
+      return false;
+    }
+    ep->SetDefaultStringOption(OPAL_OPT_OFFER_ICE, "true");
+#else
+    cerr << "ICE is unavailable" << endl;
+    return false;
+#endif
+  }
+
+  m_targetCPS = args.GetOptionString("cps", "10").AsReal();
+  m_holdTime = PTimeInterval((PInt64)args.GetOptionString("hold", "5000").AsUnsigned());
+  m_duration.SetInterval(0, args.GetOptionString("duration", "30").AsUnsigned());
+  m_setupTimeout.SetInterval(0, args.GetOptionString("tmaxest", "10").AsUnsigned());
+  m_maxCalls = args.GetOptionString('r').AsUnsigned();
+  m_maxConcurrent = args.GetOptionString('m').AsUnsigned();
+
+  if (m_targetCPS <= 0 || m_duration == 0) {
+    cerr << "Invalid benchmark call rate or duration!" << endl;
+    return false;
+  }
+
+  m_protocol = protocol;
+
+  cout << "Benchmark calling " << m_destination << " at " << m_targetCPS << " calls/second"
+          " for " << m_duration << " seconds, holding for " << m_holdTime << " seconds.\n"
+          "Press ^C at any time to stop.\n" << endl;
+  return true;
+}
+
+
+void Benchmark::Run(PSyncPoint & endRun, const bool & interrupted)
+{
+  static PTimeInterval const SampleInterval(1000);
+  static PTimeInterval const MaxWait(10);
+  static PTimeInterval const DrainGrace(0, 5);
+
+  // Baseline, so only resources used by the run are reported
+  SampleProcess();
+  m_categoryTicks.clear();
+  m_startUserCPU = m_userCPU;
+  m_startSystemCPU = m_systemCPU;
+  m_lastCPU = m_userCPU + m_systemCPU;
+
+  m_startTime.SetCurrentTime();
+  m_startTick = m_lastSampleTick = PTimer::Tick();
+
+  PTimeInterval nextSample = m_startTick + SampleInterval;
+  PTimeInterval nextCall = m_startTick;
+  PTimeInterval drainEnd;
+  unsigned scheduled = 0;
+  bool generating = true;
+
+  for (;;) {
+    PTimeInterval now = PTimer::Tick();
+
+    if (generating) {
+      if (interrupted || now - m_startTick >= m_duration || (m_maxCalls > 0 && scheduled >= m_maxCalls)) {
+        generating = false;
+        m_generationTime = now - m_startTick;
+        drainEnd = now + m_setupTimeout + m_holdTime + DrainGrace;
+        cout << "Call generation complete." << endl;
+      }
+      else {
+        // Calls are paced from the start, so a slow SetUpCall() does not reduce the rate
+        while (nextCall <= now && (m_maxCalls == 0 || scheduled < m_maxCalls)) {
+          PlaceCall();
+          ++scheduled;
+          nextCall = m_startTick + PTimeInterval((PInt64)(scheduled*1000.0/m_targetCPS));
+        }
+      }
+    }
+
+    ProcessTimers(now);
+
+    if (now >= nextSample) {
+      SampleProcess();
+      OutputProgress(now - m_startTick);
+      nextSample += SampleInterval;
+    }
+
+    if (!generating) {
+      PWaitAndSignal lock(m_mutex);
+      if (m_active == 0 || interrupted || now >= drainEnd)
+        break;
+    }
+
+    PTimeInterval wait = std::min(generating ? nextCall : nextSample, nextSample) - now;
+    if (wait > MaxWait)
+      wait = MaxWait;
+    if (wait > 0)
+      endRun.Wait(wait);
+  }
+
+  m_elapsedTime = PTimer::Tick() - m_startTick;
+  if (m_generationTime == 0)
+    m_generationTime = m_elapsedTime;
+
+  if (m_manager.GetActiveCalls() > 0) {
+    cout << "Clearing " << m_manager.GetActiveCalls() << " remaining calls." << endl;
+    m_manager.ClearAllCalls();
+  }
+
+  SampleProcess();
+
+  if (m_jsonFile.IsEmpty()) {
+    ostream strm(m_jsonOutput);
+    OutputJSON(strm);
+  }
+  else {
+    PTextFile file;
+    if (file.Open(m_jsonFile, PFile::WriteOnly))
+      OutputJSON(file);
+    else
+      cerr << "Could not open \"" << m_jsonFile << "\"!" << endl;
+  }
+}
+
+
+void Benchmark::PlaceCall()
+{
+  {
+    PWaitAndSignal lock(m_mutex);
+    if (m_maxConcurrent > 0 && m_active >= m_maxConcurrent) {
+      ++m_skipped;
+      return;
+    }
+    ++m_attempted;
+  }
+
+  // If this fails, the call is still cleared and counted via OnCleared()
+  PSafePtr<OpalCall> call = m_manager.SetUpCall("local:*", m_destination, this);
+  if (call != NULL && m_setupTimeout > 0) {
+    PWaitAndSignal lock(m_mutex);
+    m_setupTimers.push_back(Timer(call->GetToken(), PTimer::Tick() + m_setupTimeout));
+  }
+}
+
+
+void Benchmark::ProcessTimers(const PTimeInterval & now)
+{
+  std::vector<PString> timedOut, holdExpired;
+
+  m_mutex.Wait();
+  while (!m_setupTimers.empty() && m_setupTimers.front().m_due <= now) {
+    timedOut.push_back(m_setupTimers.front().m_token);
+    m_setupTimers.pop_front();
+  }
+  while (!m_holdTimers.empty() && m_holdTimers.front().m_due <= now) {
+    holdExpired.push_back(m_holdTimers.front().m_token);
+    m_holdTimers.pop_front();
+  }
+  m_mutex.Signal();
+
+  for (size_t i = 0; i < timedOut.size(); ++i) {
+    PSafePtr<MyCall> call = PSafePtrCast<OpalCall, MyCall>(m_manager.FindCallWithLock(timedOut[i], PSafeReference));
+    if (call != NULL && !call->IsEstablished()) {
+      m_mutex.Wait();
+      ++m_timedOut;
+      m_mutex.Signal();
+      call->m_clearRequested.SetCurrentTime();
+      call->Clear(OpalConnection::EndedByNoAnswer);
+    }
+  }
+
+  for (size_t i = 0; i < holdExpired.size(); ++i) {
+    PSafePtr<MyCall> call = PSafePtrCast<OpalCall, MyCall>(m_manager.FindCallWithLock(holdExpired[i], PSafeReference));
+    if (call != NULL) {
+      call->m_clearRequested.SetCurrentTime();
+      call->Clear();
+    }
+  }
+}
+
+
+void Benchmark::OnCreated()
+{
+  PWaitAndSignal lock(m_mutex);
+  if (++m_active > m_peakActive)
+    m_peakActive = m_active;
+}
+
+
+void Benchmark::OnEstablished(MyCall & call)
+{
+  PWaitAndSignal lock(m_mutex);
+  ++m_established;
+  m_setupLatency.Add((call.m_establishedTime - call.m_startTime).GetMicroSeconds());
+  m_holdTimers.push_back(Timer(call.GetToken(), PTimer::Tick() + m_holdTime));
+}
+
+
+void Benchmark::OnCleared(MyCall & call)
+{
+  PWaitAndSignal lock(m_mutex);
+
+  if (m_active > 0)
+    --m_active;
+
+  if (call.m_clearRequested.IsValid())
+    m_teardownLatency.Add((PTime() - call.m_clearRequested).GetMicroSeconds());
+
+  if (call.m_establishedTime.IsValid())
+    ++m_completed;
+  else {
+    ++m_failed;
+    ++m_failureReasons[call.GetCallEndReasonText()];
+  }
+}
+
+
+#if OPAL_STATISTICS
+void Benchmark::OnClosedMediaStream(const OpalMediaStream & stream)
+{
+  if (!stream.GetConnection().IsNetworkConnection())
+    return;
+
+  OpalMediaStatistics stats;
+  stream.GetStatistics(stats);
+
+  PWaitAndSignal lock(m_mutex);
+  if (stream.IsSource()) {
+    m_packetsReceived += stats.m_totalPackets;
+    m_bytesReceived += stats.m_totalBytes;
+  }
+  else {
+    m_packetsSent += stats.m_totalPackets;
+    m_bytesSent += stats.m_totalBytes;
+  }
+}
+#endif
+
+
+#ifdef P_LINUX
+
+static uint64_t GetThreadTicks(const PString & statLine, PString & category)
+{
+  // Format is: tid (name) state ppid ..., utime and stime are 12th and 13th fields after the name
+  PINDEX open = statLine.Find('(');
+  PINDEX close = statLine.FindLast(')');
+  if (open == P_MAX_INDEX || close == P_MAX_INDEX || close < open)
+    return 0;
+
+  PStringArray fields = statLine.Mid(close+2).Tokenise(' ', false);
+  if (fields.GetSize() < 13)
+    return 0;
+
+  // Categorise by thread name without any instance number
+  category = statLine(open+1, close-1);
+  PINDEX len = category.GetLength();
+  while (len > 1 && strchr("0123456789:-# ", category[len-1]) != NULL)
+    --len;
+  category = category.Left(len);
+
+  return fields[11].AsUnsigned64() + fields[12].AsUnsigned64();
+}
+
+
+void Benchmark::SampleProcess()
+{
+  struct rusage usage;
+  if (getrusage(RUSAGE_SELF, &usage) == 0) {
+    m_userCPU.SetInterval(usage.ru_utime.tv_usec/1000, usage.ru_utime.tv_sec);
+    m_systemCPU.SetInterval(usage.ru_stime.tv_usec/1000, usage.ru_stime.tv_sec);
+  }
+
+  PString line;
+
+  PTextFile status("/proc/self/status", PFile::ReadOnly);
+  while (status.ReadLine(line)) {
+    if (line.NumCompare("Threads:", 8) == EqualTo)
+      m_threads = line.Mid(8).AsUnsigned();
+    else if (line.NumCompare("VmRSS:", 6) == EqualTo)
+      m_residentMemory = line.Mid(6).AsUnsigned64()*1024;
+    else if (line.NumCompare("VmHWM:", 6) == EqualTo)
+      m_peakResidentMemory = line.Mid(6).AsUnsigned64()*1024;
+  }
+  if (m_peakThreads < m_threads)
+    m_peakThreads = m_threads;
+
+  /* CPU used by threads since the last sample. Threads that exit between
+     samples lose their last interval, that is reported as the difference
+     from the process total in the results. */
+  std::map<unsigned, ThreadTicks> threads;
+  PDirectory tasks("/proc/self/task");
+  if (tasks.Open()) {
+    do {
+      unsigned tid = tasks.GetEntryName().AsUnsigned();
+      PTextFile stat(tasks + tasks.GetEntryName() + "/stat", PFile::ReadOnly);
+      if (tid == 0 || !stat.IsOpen() || !stat.ReadLine(line))
+        continue;
+
+      ThreadTicks & thread = threads[tid];
+      thread.m_ticks = GetThreadTicks(line, thread.m_category);
+
+      uint64_t previous = 0;
+      std::map<unsigned, ThreadTicks>::iterator it = m_threadTicks.find(tid);
+      if (it != m_threadTicks.end() && it->second.m_category == thread.m_category)
+        previous = it->second.m_ticks;
+      if (thread.m_ticks > previous)
+        m_categoryTicks[thread.m_category] += thread.m_ticks - previous;
+    } while (tasks.Next());
+  }
+  m_threadTicks.swap(threads);
+}
+
+#else // P_LINUX
+
+void Benchmark::SampleProcess()
+{
+}
+
+#endif // P_LINUX
+
+
+void Benchmark::OutputProgress(const PTimeInterval & elapsed)
+{
+  PTimeInterval cpu = m_userCPU + m_systemCPU;
+  PTimeInterval tick = PTimer::Tick();
+  PInt64 interval = (tick - m_lastSampleTick).GetMilliSeconds();
+  unsigned percent = interval > 0 ? (unsigned)((cpu - m_lastCPU).GetMilliSeconds()*100/interval) : 0;
+  m_lastCPU = cpu;
+  m_lastSampleTick = tick;
+
+  PWaitAndSignal lock(m_mutex);
+  cout << setw(5) << elapsed.GetSeconds() << "s:"
+          " attempted=" << m_attempted <<
+          " established=" << m_established <<
+          " failed=" << m_failed <<
+          " active=" << m_active <<
+          " cpu=" << percent << "%"
+          " threads=" << m_threads <<
+          " rss=" << m_residentMemory/1000000 << "MB" << endl;
+}
+
+
+static void HistogramToJSON(PJSON::Object & json, const OpalEventPool::Histogram & histogram)
+{
+  json.SetString("Units", "us");
+  json.SetNumber("Count", (PJSON::NumberType)histogram.m_total);
+  json.SetNumber("P50", (PJSON::NumberType)histogram.GetPercentile(50));
+  json.SetNumber("P90", (PJSON::NumberType)histogram.GetPercentile(90));
+  json.SetNumber("P99", (PJSON::NumberType)histogram.GetPercentile(99));
+  json.SetNumber("Maximum", (PJSON::NumberType)histogram.m_maximum);
+
+  PJSON::Array & buckets = json.SetArray("Buckets");
+  for (PINDEX i = 0; i < OpalEventPool::Histogram::NumBuckets; ++i) {
+    PJSON::Object & bucket = buckets.AppendObject();
+    if (i < OpalEventPool::Histogram::NumBuckets-1)
+      bucket.SetNumber("UpTo", OpalEventPool::Histogram::BucketLimits[i]);
+    bucket.SetNumber("Count", (PJSON::NumberType)histogram.m_counts[i]);
+  }
+}
+
+
+void Benchmark::OutputJSON(ostream & strm)
+{
+  PWaitAndSignal lock(m_mutex);
+
+  double elapsed = std::max(m_elapsedTime.GetMilliSeconds(), (PInt64)1)/1000.0;
+  double generation = std::max(m_generationTime.GetMilliSeconds(), (PInt64)1)/1000.0;
+  PTimeInterval userCPU = m_userCPU - m_startUserCPU;
+  PTimeInterval systemCPU = m_systemCPU - m_startSystemCPU;
+  double totalCPU = (userCPU + systemCPU).GetMilliSeconds()/1000.0;
+
+  PJSON json(PJSON::e_Object);
+  PJSON::Object & root = json.GetObject();
+
+  PJSON::Object & scenario = root.SetObject("Scenario");
+  scenario.SetString("Protocol", m_protocol);
+  scenario.SetString("Destination", m_destination);
+  scenario.SetString("Codecs", PSTRSTRM(setfill(',') << m_codecs));
+  scenario.SetString("CryptoSuites", PSTRSTRM(setfill(',') << m_cryptoSuites));
+  scenario.SetBoolean("ICE", m_ice);
+  scenario.SetNumber("TargetCPS", m_targetCPS);
+  scenario.SetNumber("HoldTime", m_holdTime.GetMilliSeconds()/1000.0);
+  scenario.SetNumber("Duration", m_duration.GetMilliSeconds()/1000.0);
+  scenario.SetNumber("SetupTimeout", m_setupTimeout.GetMilliSeconds()/1000.0);
+  scenario.SetNumber("MaxCalls", m_maxCalls);
+  scenario.SetNumber("MaxConcurrent", m_maxConcurrent);
+
+  PJSON::Object & host = root.SetObject("System");
+  host.SetString("Application", PProcess::Current().GetName() + ' ' + PProcess::Current().GetVersion(true));
+  host.SetString("OPAL", OpalGetVersion());
+  host.SetString("OperatingSystem", PProcess::GetOSName() + ' ' + PProcess::GetOSVersion());
+  host.SetNumber("Processors", PThread::GetNumProcessors());
+  host.SetTime("StartTime", m_startTime);
+
+  PJSON::Object & calls = root.SetObject("Calls");
+  calls.SetNumber("Attempted", m_attempted);
+  calls.SetNumber("Established", m_established);
+  calls.SetNumber("Completed", m_completed);
+  calls.SetNumber("Failed", m_failed);
+  calls.SetNumber("TimedOut", m_timedOut);
+  calls.SetNumber("Skipped", m_skipped);
+  calls.SetNumber("PeakConcurrent", m_peakActive);
+  calls.SetNumber("GenerationTime", generation);
+  calls.SetNumber("AchievedCPS", m_attempted/generation);
+  calls.SetNumber("EstablishedCPS", m_established/generation);
+  PJSON::Object & reasons = calls.SetObject("FailureReasons");
+  for (std::map<PString, unsigned>::const_iterator it = m_failureReasons.begin(); it != m_failureReasons.end(); ++it)
+    reasons.SetNumber(it->first, it->second);
+
+  HistogramToJSON(root.SetObject("SetupLatency"), m_setupLatency);
+  HistogramToJSON(root.SetObject("TeardownLatency"), m_teardownLatency);
+
+  PJSON::Object & media = root.SetObject("Media");
+  media.SetNumber("PacketsReceived", (PJSON::NumberType)m_packetsReceived);
+  media.SetNumber("PacketsSent", (PJSON::NumberType)m_packetsSent);
+  media.SetNumber("BytesReceived", (PJSON::NumberType)m_bytesReceived);
+  media.SetNumber("BytesSent", (PJSON::NumberType)m_bytesSent);
+  media.SetNumber("ReceivePacketRate", m_packetsReceived/elapsed);
+  media.SetNumber("SendPacketRate", m_packetsSent/elapsed);
+
+  PJSON::Object & process = root.SetObject("Process");
+  process.SetNumber("ElapsedTime", elapsed);
+  process.SetNumber("UserCPU", userCPU.GetMilliSeconds()/1000.0);
+  process.SetNumber("SystemCPU", systemCPU.GetMilliSeconds()/1000.0);
+  process.SetNumber("CPUPercent", totalCPU*100/elapsed);
+  process.SetNumber("CPUPerCall", m_attempted > 0 ? totalCPU*1000/m_attempted : 0); // milliseconds
+  process.SetNumber("Threads", m_threads);
+  process.SetNumber("PeakThreads", m_peakThreads);
+  process.SetNumber("ResidentMemory", (PJSON::NumberType)m_residentMemory);
+  process.SetNumber("PeakResidentMemory", (PJSON::NumberType)m_peakResidentMemory);
+
+  PJSON::Object & threadCPU = process.SetObject("ThreadCPU");
+#ifdef P_LINUX
+  double ticksPerSecond = sysconf(_SC_CLK_TCK);
+  double categorised = 0;
+  for (std::map<PString, uint64_t>::const_iterator it = m_categoryTicks.begin(); it != m_categoryTicks.end(); ++it) {
+    threadCPU.SetNumber(it->first, it->second/ticksPerSecond);
+    categorised += it->second/ticksPerSecond;
+  }
+  if (totalCPU > categorised)
+    threadCPU.SetNumber("(exited)", totalCPU - categorised);
+#endif
+
+  strm << json.AsString() << endl;
+}
+
+
+///////////////////////////////////////////////////////////////////////////////
+
 MyLocalEndPoint::MyLocalEndPoint(OpalManager & mgr)
   : OpalLocalEndPoint(mgr)
   , m_incomingMediaDir(PString::Empty())
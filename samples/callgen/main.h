@@ -74,7 +74,7 @@ class MyCall : public OpalCall
 {
     PCLASSINFO(MyCall, OpalCall);
   public:
-    MyCall(MyManager & manager, CallThread * caller);
+    MyCall(MyManager & manager, CallThread * caller, bool benchmark = false);
 
     virtual void OnNewConnection(OpalConnection & connection);
     virtual void OnEstablishedCall();
@@ -84,11 +84,120 @@ class MyCall : public OpalCall
 
     MyManager          & m_manager;
     unsigned             m_index;
+    bool                 m_benchmark;
+    bool                 m_output;
     PString              m_callIdentifier;
     PTime                m_openedTransmitMedia;
     PTime                m_openedReceiveMedia;
     PTime                m_receivedMedia;
     OpalTransportAddress m_mediaGateway;
+    PTime                m_clearRequested;
+};
+
+
+///////////////////////////////////////////////////////////////////////////////
+
+/**Call setup load test.
+   Calls are looped back through a signalling protocol to this process, at a
+   target rate of calls per second, and held for a fixed time once
+   established. Setup and teardown latency, media packet counts and the
+   resources used by the process are reported as JSON at the end of the run.
+  */
+class Benchmark
+{
+  public:
+    Benchmark(MyManager & manager);
+
+    bool Initialise(PArgList & args, std::streambuf * output);
+    void Run(PSyncPoint & endRun, const bool & interrupted);
+
+    bool IsEnabled() const { return !m_protocol.IsEmpty(); }
+
+    void OnCreated();
+    void OnEstablished(MyCall & call);
+    void OnCleared(MyCall & call);
+#if OPAL_STATISTICS
+    void OnClosedMediaStream(const OpalMediaStream & stream);
+#endif
+
+  protected:
+    typedef OpalEventPool::Histogram Histogram;
+
+    struct Timer
+    {
+      Timer(const PString & token, const PTimeInterval & due) : m_token(token), m_due(due) { }
+      PString       m_token;
+      PTimeInterval m_due;
+    };
+    typedef std::deque<Timer> TimerQueue;
+
+    void PlaceCall();
+    void ProcessTimers(const PTimeInterval & now);
+    void SampleProcess();
+    void OutputProgress(const PTimeInterval & elapsed);
+    void OutputJSON(ostream & strm);
+
+    MyManager       & m_manager;
+    std::streambuf  * m_jsonOutput;
+    PString           m_jsonFile;
+
+    // Scenario
+    PCaselessString   m_protocol;
+    PString           m_destination;
+    PStringArray      m_codecs;
+    PStringArray      m_cryptoSuites;
+    bool              m_ice;
+    double            m_targetCPS;
+    PTimeInterval     m_holdTime;
+    PTimeInterval     m_duration;
+    PTimeInterval     m_setupTimeout;
+    unsigned          m_maxCalls;
+    unsigned          m_maxConcurrent;
+
+    // Call results
+    PDECLARE_MUTEX(   m_mutex);
+    TimerQueue        m_setupTimers;
+    TimerQueue        m_holdTimers;
+    unsigned          m_active;
+    unsigned          m_peakActive;
+    unsigned          m_attempted;
+    unsigned          m_established;
+    unsigned          m_completed;
+    unsigned          m_failed;
+    unsigned          m_timedOut;
+    unsigned          m_skipped;
+    std::map<PString, unsigned> m_failureReasons;
+    Histogram         m_setupLatency;
+    Histogram         m_teardownLatency;
+    PTime             m_startTime;
+    PTimeInterval     m_startTick;
+    PTimeInterval     m_generationTime;
+    PTimeInterval     m_elapsedTime;
+
+    // Media results
+    uint64_t          m_packetsReceived;
+    uint64_t          m_packetsSent;
+    uint64_t          m_bytesReceived;
+    uint64_t          m_bytesSent;
+
+    // Process resources, from operating system
+    struct ThreadTicks
+    {
+      PString  m_category;
+      uint64_t m_ticks;
+    };
+    std::map<unsigned, ThreadTicks> m_threadTicks;
+    std::map<PString, uint64_t>     m_categoryTicks;
+    PTimeInterval     m_userCPU;
+    PTimeInterval     m_systemCPU;
+    PTimeInterval     m_startUserCPU;
+    PTimeInterval     m_startSystemCPU;
+    PTimeInterval     m_lastCPU;
+    PTimeInterval     m_lastSampleTick;
+    unsigned          m_threads;
+    unsigned          m_peakThreads;
+    uint64_t          m_residentMemory;
+    uint64_t          m_peakResidentMemory;
 };
 
 
@@ -164,6 +273,9 @@ class MyManager : public OpalManagerConsole
     virtual OpalCall * CreateCall(void * userData);
 
     virtual PBoolean OnOpenMediaStream(OpalConnection & connection, OpalMediaStream & stream);
+#if OPAL_STATISTICS
+    virtual void OnClosedMediaStream(const OpalMediaStream & stream);
+#endif
 
     PINDEX GetActiveCalls() const { return m_activeCalls.GetSize(); }
 
@@ -171,6 +283,7 @@ class MyManager : public OpalManagerConsole
     unsigned       m_totalCalls;
     unsigned       m_totalEstablished;
     CallThreadList m_threadList;
+    Benchmark      m_benchmark;
 };
 
 
@@ -36,6 +36,12 @@
 #include <sip/sipep.h>
 #include <codec/vidcodec.h>
 #include <rtp/pcapfile.h>
+#include <opal/eventpool.h>
+#if OPAL_IAX2
+#include <iax2/iax2ep.h>
+#endif
+
+#include <deque>
 
 
 // End of File ///////////////////////////////////////////////////////////////
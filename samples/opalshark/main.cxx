@@ -47,6 +47,8 @@
 #include <wx/rawbmp.h>
 #include <wx/tokenzr.h>
 
+#include <algorithm>
+
 
 #if defined(__WXGTK__)   || \
     defined(__WXMOTIF__) || \
@@ -546,6 +548,7 @@ MyPlayer::MyPlayer(MyManager * manager, const PFilePath & filepath)
   , m_pcapFilePath(filepath)
   , m_backgroundThread(NULL)
   , m_packetCount(0)
+  , m_exportRecorder(NULL)
   , m_playThreadCtrl(CtlIdle)
   , m_pausePacket(UINT_MAX)
 {
@@ -1318,8 +1321,7 @@ void MyPlayer::Export(OpalPCAPFile * pcapFile, OpalRecordManager * recorder)
 {
   PTRACE(3, "Starting export to " << pcapFile->GetName());
 
-  std::map<OpalPCAPFile::DiscoveredRTPKey, OpalPCAPFile::DecodeContext> decodeContext;
-  OpalPCAPFile::PayloadMap payloadMap;
+  OpalPCAPFile::DiscoveredRTP streams;
 
   for (std::set<unsigned>::iterator selectedRow = m_selectedRows.begin(); selectedRow != m_selectedRows.end(); ++selectedRow) {
     OpalPCAPFile::DiscoveredRTPInfo & selectedInfo = m_discoveredRTP[*selectedRow];
@@ -1334,36 +1336,21 @@ void MyPlayer::Export(OpalPCAPFile * pcapFile, OpalRecordManager * recorder)
 
     OpalPCAPFile::DiscoveredRTPKey key = selectedInfo;
     if (recorder->OpenStream(PSTRSTRM(key), raw)) {
-      decodeContext.insert(make_pair(selectedInfo, OpalPCAPFile::DecodeContext()));
-      payloadMap[selectedInfo.m_payloadType] = selectedInfo.m_mediaFormat;
+      streams.Append(new OpalPCAPFile::DiscoveredRTPInfo(selectedInfo));
       PTRACE(4, "Added stream " << key << " with " << selectedInfo << " to " << pcapFile->GetName());
     }
   }
 
-  pcapFile->SetPayloadMap(payloadMap);
-
-  off_t fileLength = pcapFile->GetLength();
-  while (!pcapFile->IsEndOfFile() && !m_progressDialog->WasCancelled()) {
-    m_progressDialog->Update(pcapFile->GetPosition()*1000LL/fileLength);
+  m_exportRecorder = recorder;
+  m_exportTimes.assign(streams.GetSize(), PTime((time_t)0));
 
-    RTP_DataFrame rtp;
-    if (pcapFile->GetRTP(rtp) < 0)
-      continue;
+  // Each stream is decoded in its own thread, using its m_mediaFormat
+  pcapFile->DecodeStreams(streams, PCREATE_NOTIFIER(ExportDecoded), PCREATE_NOTIFIER(ExportProgress));
 
-    OpalPCAPFile::DiscoveredRTPKey rtpKey;
-    rtpKey.m_src.SetAddress(pcapFile->GetSrcIP(), pcapFile->GetSrcPort());
-    rtpKey.m_dst.SetAddress(pcapFile->GetDstIP(), pcapFile->GetDstPort());
-    rtpKey.m_ssrc = rtp.GetSyncSource();
-    std::map<OpalPCAPFile::DiscoveredRTPKey, OpalPCAPFile::DecodeContext>::iterator itContext = decodeContext.find(rtpKey);
-    if (itContext == decodeContext.end())
-      continue;
-
-    RTP_DataFrame decoded;
-    if (pcapFile->DecodeRTP(rtp, decoded, itContext->second) > 0) {
-      recorder->WriteStream(PSTRSTRM(itContext->first), decoded);
-      recorder->OnPushMedia(pcapFile->GetPacketTime());
-    }
-  }
+  // Push out whatever the mixers have left
+  if (!m_exportTimes.empty())
+    recorder->OnPushMedia(*std::max_element(m_exportTimes.begin(), m_exportTimes.end()));
+  m_exportRecorder = NULL;
 
   PTRACE(3, "Ending export to " << pcapFile->GetName());
   delete pcapFile;
@@ -1372,4 +1359,28 @@ void MyPlayer::Export(OpalPCAPFile * pcapFile, OpalRecordManager * recorder)
 }
 
 
+void MyPlayer::ExportDecoded(OpalPCAPFile &, OpalPCAPFile::DecodedRTP & decoded)
+{
+  OpalPCAPFile::DiscoveredRTPKey key = decoded.m_info;
+
+  PWaitAndSignal mutex(m_exportMutex);
+
+  m_exportRecorder->WriteStream(PSTRSTRM(key), decoded.m_decoded);
+
+  /* Streams run ahead of each other, so only push the mixers up to the time
+     every stream has reached, or the slower ones are missing from the mix. */
+  m_exportTimes[decoded.m_stream] = decoded.m_packetTime;
+  PTime earliest = *std::min_element(m_exportTimes.begin(), m_exportTimes.end());
+  if (earliest.IsValid())
+    m_exportRecorder->OnPushMedia(earliest);
+}
+
+
+void MyPlayer::ExportProgress(OpalPCAPFile &, OpalPCAPFile::Progress & progress)
+{
+  progress.m_abort = m_progressDialog->WasCancelled();
+  m_progressDialog->Update(progress.m_filePosition*1000LL/progress.m_fileLength);
+}
+
+
 // End of File ///////////////////////////////////////////////////////////////
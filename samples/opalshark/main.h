@@ -170,6 +170,8 @@ class MyPlayer : public wxMDIChildFrame
     void StartExport(const PFilePath & mediaFile);
     void Export(OpalPCAPFile * pcapFile, OpalRecordManager * recorder);
     void OnExportComplete();
+    PDECLARE_NOTIFIER2(OpalPCAPFile, MyPlayer, ExportDecoded, OpalPCAPFile::DecodedRTP &);
+    PDECLARE_NOTIFIER2(OpalPCAPFile, MyPlayer, ExportProgress, OpalPCAPFile::Progress &);
 
   private:
     MyManager        & m_manager;
@@ -180,6 +182,10 @@ class MyPlayer : public wxMDIChildFrame
     OpalPCAPFile::DiscoveredRTP m_discoveredRTP;
     unsigned                    m_packetCount;
 
+    OpalRecordManager * m_exportRecorder;
+    std::vector<PTime>  m_exportTimes; // Last packet time of each stream
+    PDECLARE_MUTEX(     m_exportMutex);
+
     enum
     {
       ColSrcIP,
@@ -80,6 +80,7 @@ void PlayRTP::Main()
              "P-payload-file: write RTP payload to file\n"
              "i-info. Display per-frame information.\n"
              "f-find. find and display list of RTP sessions.\n"
+             "-decode. with -f, decode all sessions found and display counts.\n"
              "E: write event log to file\n"
              "T: put text in extra video information\n"
              "X. enable extra video information\n"
@@ -147,6 +148,17 @@ void PlayRTP::Main()
       return;
     }
     cout << "Found " << discoveredRTP.size() << " sessions:\n" << discoveredRTP << endl;
+
+    if (args.HasOption("decode")) {
+      m_decodedCounts.assign(discoveredRTP.size(), 0);
+      if (!pcap.DecodeStreams(discoveredRTP, PCREATE_NOTIFIER(OnDecoded))) {
+        cerr << "Could not decode RTP sessions" << endl;
+        return;
+      }
+      for (size_t i = 0; i < discoveredRTP.size(); ++i)
+        cout << (i + 1) << ' ' << discoveredRTP[i] << ", decoded " << m_decodedCounts[i] << " packets\n";
+      cout << endl;
+    }
     return;
   }
 
@@ -800,6 +812,13 @@ void PlayRTP::Play(OpalPCAPFile & pcap)
 }
 
 
+void PlayRTP::OnDecoded(OpalPCAPFile &, OpalPCAPFile::DecodedRTP & decoded)
+{
+  // Called from a thread per stream, so each only touches its own count
+  ++m_decodedCounts[decoded.m_stream];
+}
+
+
 void PlayRTP::OnTranscoderCommand(OpalMediaCommand & command, P_INT_PTR /*extra*/)
 {
 #if OPAL_VIDEO
@@ -27,9 +27,7 @@
 #define _PlayRTP_MAIN_H
 
 #include <ptclib/pvidfile.h>
-
-
-class OpalPCAPFile;
+#include <rtp/pcapfile.h>
 
 
 class PlayRTP : public PProcess
@@ -44,6 +42,7 @@ class PlayRTP : public PProcess
     void Play(OpalPCAPFile & pcap);
 
     PDECLARE_NOTIFIER(OpalMediaCommand, PlayRTP, OnTranscoderCommand);
+    PDECLARE_NOTIFIER2(OpalPCAPFile, PlayRTP, OnDecoded, OpalPCAPFile::DecodedRTP &);
 
     bool m_singleStep;
     int  m_info;
@@ -57,6 +56,7 @@ class PlayRTP : public PProcess
     PFilePath m_encodedFileName;
 
     unsigned m_packetCount;
+    std::vector<unsigned> m_decodedCounts; // Per stream, for --decode
 
     OpalTranscoder     * m_transcoder;
     PSoundChannel      * m_player;
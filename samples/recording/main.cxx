@@ -37,6 +37,7 @@ PString MyManager::GetArgumentSpec() const
 {
   return "[Application options:]"
          "m-mix. Mix all incoming calls to single WAV file.\n"
+         "R-render: Render the pass through recording given as argument to this media file, and exit.\n"
        + OpalManagerConsole::GetArgumentSpec();
 }
 
@@ -61,7 +62,12 @@ void MyManager::Usage(ostream & strm, const PArgList & args)
 "\n"
 "The mix option will force audio only calls and mix the audio into\n"
 "a single media file. Note in this case no template is used, the argument\n"
-"is a normal file path\n";
+"is a normal file path\n"
+"\n"
+"A template with the \".oprec\" extension records the media exactly as it\n"
+"was received, without decoding or mixing. The render option may then be\n"
+"used at any later time to produce a WAV, or other, file from it, e.g.\n"
+"  " << args.GetCommandName() << " --render /somewhere/call.wav /somewhere/call.oprec\n";
 }
 
 
@@ -75,6 +81,11 @@ bool MyManager::Initialise(PArgList & args, bool verbose, const PString & defaul
     return false;
   }
 
+  if (args.HasOption("render")) {
+    m_renderFile = args.GetOptionString("render");
+    return true;
+  }
+
   if (!OpalManagerConsole::Initialise(args, verbose, defaultRoute))
     return false;
 
@@ -103,6 +114,23 @@ bool MyManager::Initialise(PArgList & args, bool verbose, const PString & defaul
 }
 
 
+void MyManager::Run()
+{
+  if (m_renderFile.IsEmpty()) {
+    OpalManagerConsole::Run();
+    return;
+  }
+
+  PFilePath input = PProcess::Current().GetArguments()[0];
+  if (OpalEncodedRecordFile::Render(input, m_renderFile, m_options))
+    *LockedOutput() << "Rendered \"" << input << "\" to \"" << m_renderFile << '"' << endl;
+  else {
+    *LockedOutput() << "Could not render \"" << input << "\" to \"" << m_renderFile << '"' << endl;
+    PProcess::Current().SetTerminationValue(1);
+  }
+}
+
+
 void MyManager::OnEstablishedCall(OpalCall & call)
 {
   call.StartRecording(m_outputDir, m_fileTemplate, m_fileType,  m_options);
@@ -125,6 +125,7 @@ class MyManager : public OpalManagerConsole
       bool verbose,
       const PString & defaultRoute = EXTERNAL_SCHEME":"
     );
+    virtual void Run();
 
     /**A call back function whenever a call is completed.
        In telephony terminology a completed call is one where there is an
@@ -143,6 +144,7 @@ class MyManager : public OpalManagerConsole
     PString    m_fileTemplate;
     PString    m_fileType;
     OpalRecordManager::Options m_options;
+    PFilePath  m_renderFile;
 };
 
 
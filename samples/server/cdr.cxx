@@ -31,6 +31,10 @@
 static const PConstString CDRTextFileKey("CDR Text File");
 static const PConstString CDRTextHeadingsKey("CDR Text Headings");
 static const PConstString CDRTextFormatKey("CDR Text Format");
+static const PConstString CDRSpoolFileKey("CDR Spool File");
+static const PConstString CDRFlushIntervalKey("CDR Flush Interval");
+static const PConstString CDRSyncIntervalKey("CDR Sync Interval");
+static const PConstString CDRQueueLimitKey("CDR Queue Limit");
 
 #if P_ODBC
 static const PConstString CDRDriverKey("CDR Database Driver");
@@ -106,13 +110,27 @@ static PString GetDefaultTextFormats()
 }
 
 
+static void SyncFile(PFile & file)
+{
+  if (!file.IsOpen())
+    return;
+
+#ifdef _WIN32
+  _commit((int)file.GetHandle());
+#else
+  fsync(file.GetHandle());
+#endif
+}
+
+
 ///////////////////////////////////////////////////////////////////////////////
 
 bool MyManager::ConfigureCDR(PConfig & cfg, PConfigPage * rsrc)
 {
-  m_cdrMutex.Wait();
+  PWaitAndSignal mutex(m_cdrOutputMutex);
 
   m_cdrTextFile.Close();
+  m_cdrSpoolFile.Close();
 
   PString filename = rsrc->AddStringField(CDRTextFileKey, 0, m_cdrTextFile.GetFilePath(), "Call Detail Record text file name", 1, 75);
   PString cdrHeadings = rsrc->AddStringField(CDRTextHeadingsKey, 0, GetDefaultTextHeadings(), "Call Detail Record text output headings", 1, 75);
@@ -128,6 +146,23 @@ bool MyManager::ConfigureCDR(PConfig & cfg, PConfigPage * rsrc)
       PSYSTEMLOG(Error, "Could not open CDR text file \"" << filename << '"');
   }
 
+  filename = rsrc->AddStringField(CDRSpoolFileKey, 0, m_cdrSpoolFile.GetFilePath(),
+                                  "Call Detail Record overflow file name, used when queue full or database unavailable", 1, 75);
+  if (!filename.IsEmpty()) {
+    if (m_cdrSpoolFile.Open(filename, PFile::WriteOnly, PFile::Create))
+      m_cdrSpoolFile.SetPosition(0, PFile::End);
+    else
+      PSYSTEMLOG(Error, "Could not open CDR spool file \"" << filename << '"');
+  }
+
+  m_cdrFlushInterval = rsrc->AddIntegerField(CDRFlushIntervalKey, 10, 60000, m_cdrFlushInterval.GetMilliSeconds(), "ms",
+                                             "Maximum time Call Detail Records are queued before being written");
+  m_cdrSyncInterval.SetInterval(0, rsrc->AddIntegerField(CDRSyncIntervalKey, 0, 3600, m_cdrSyncInterval.GetSeconds(), "seconds",
+                                             "Time between forcing text files to disk, zero is every write"));
+  m_cdrQueueLimit = rsrc->AddIntegerField(CDRQueueLimitKey, 10, 10000000, m_cdrQueueLimit, "",
+                                          "Call Detail Record queue depth before intermediate records are discarded"
+                                          " and database is bypassed for the spool file");
+
 #if P_ODBC
   PHTML sources(PHTML::InBody);
   sources << "Call Detail Record source name for ODBC";
@@ -180,54 +215,245 @@ bool MyManager::ConfigureCDR(PConfig & cfg, PConfigPage * rsrc)
   }
 #endif // P_ODBC
 
-  m_cdrListMax = rsrc->AddIntegerField("Web Page CDR Limit", 1, 1000000, m_cdrListMax,
-                                       "", "Maximum number of CDR records saved for display on web page.");
-
+  size_t listMax = rsrc->AddIntegerField("Web Page CDR Limit", 1, 1000000, m_cdrListMax,
+                                         "", "Maximum number of CDR records saved for display on web page.");
+  m_cdrMutex.Wait();
+  m_cdrListMax = listMax;
   m_cdrMutex.Signal();
 
   return true;
 }
 
 
+/* This is called on the call set up and clearing paths, so must never wait
+   for a file or database. The record is pushed on to a lock free list and
+   the writer thread does the output in batches. */
 void MyManager::DropCDR(const MyCall & call, bool final)
 {
-  m_cdrMutex.Wait();
-
   if (final) {
+    PWaitAndSignal mutex(m_cdrMutex);
     m_cdrList.push_back(call);
     while (m_cdrList.size() > m_cdrListMax)
       m_cdrList.pop_front();
+  }
 
-    if (m_cdrTextFile.IsOpen()) {
-      call.OutputText(m_cdrTextFile, m_cdrFormat.IsEmpty() ? GetDefaultTextFormats() : m_cdrFormat);
-      PSYSTEMLOG(Info, "Dropped text CDR for " << call.GetGUID());
+  unsigned depth = ++m_cdrQueueDepth;
+  if (!final && depth > m_cdrQueueLimit) {
+    // Back pressure, a later record for this call will supersede this one
+    --m_cdrQueueDepth;
+    PWaitAndSignal mutex(m_cdrStatisticsMutex);
+    ++m_cdrStatistics.m_dropped;
+    return;
+  }
+
+  CDRQueueEntry * entry = new CDRQueueEntry(call, final);
+  entry->m_next = m_cdrQueue.load();
+  while (!m_cdrQueue.compare_exchange_weak(entry->m_next, entry))
+    ;
+
+  m_cdrStatisticsMutex.Wait();
+  if (m_cdrStatistics.m_peakQueueDepth < depth)
+    m_cdrStatistics.m_peakQueueDepth = depth;
+  m_cdrStatisticsMutex.Signal();
+
+  /* Flush early rather than let the queue get too deep. Concurrent pushes
+     mean no single caller is guaranteed to see exactly half, so latch the
+     request until the writer has drained the queue. */
+  if (depth >= m_cdrQueueLimit/2 && !m_cdrFlushRequested.exchange(true))
+    m_cdrWriterSignal.Signal();
+}
+
+
+void MyManager::CDRWriterMain()
+{
+  PTRACE(4, "CDR writer started");
+
+  for (;;) {
+    bool running = m_cdrWriterRunning;
+
+    m_cdrOutputMutex.Wait();
+    PTimeInterval flushInterval = m_cdrFlushInterval;
+    m_cdrOutputMutex.Signal();
+
+    if (running)
+      m_cdrWriterSignal.Wait(flushInterval);
+
+    CDRQueueEntry * entries = m_cdrQueue.exchange(NULL);
+    if (entries != NULL)
+      WriteCDRs(entries);
+    else if (!running)
+      break;
+  }
+
+  PTRACE(4, "CDR writer ended");
+}
+
+
+void MyManager::WriteCDRs(CDRQueueEntry * entries)
+{
+  // List is newest first, so reverse it
+  CDRQueueEntry * oldestFirst = NULL;
+  unsigned count = 0;
+  while (entries != NULL) {
+    CDRQueueEntry * entry = entries;
+    entries = entry->m_next;
+    entry->m_next = oldestFirst;
+    oldestFirst = entry;
+    ++count;
+  }
+  PTime oldest = oldestFirst->m_queued;
+
+  // Only the latest record for each call needs writing
+  std::vector<CDRQueueEntry *> batch;
+  std::map<PString, size_t> latest;
+  while (oldestFirst != NULL) {
+    CDRQueueEntry * entry = oldestFirst;
+    oldestFirst = entry->m_next;
+
+    PString guid = entry->m_cdr.GetGUID();
+    std::map<PString, size_t>::iterator it = latest.find(guid);
+    if (it == latest.end()) {
+      latest[guid] = batch.size();
+      batch.push_back(entry);
+    }
+    else {
+      delete batch[it->second];
+      batch[it->second] = entry;
     }
   }
 
-#if P_ODBC
-  if (m_odbc.IsConnected()) {
-    PODBC::RecordSet data(m_odbc);
-    if (data.Select(m_cdrTable, m_cdrFieldNames[MyCall::CallId] + "='" + call.GetGUID() + '\'') && data.First()) {
-      call.OutputSQL(data[1], m_cdrFieldNames);
-      if (data.Commit())
-        PSYSTEMLOG(Info, "Dropped " << (final ? "final" : "intermediate") << " SQL CDR for " << call.GetGUID());
-      else
-        PSYSTEMLOG(Info, "Could not drop " << (final ? "final" : "intermediate") << " SQL CDR for " << call.GetGUID());
+  bool overflow = m_cdrQueueDepth > m_cdrQueueLimit;
+  m_cdrQueueDepth -= count;
+  m_cdrFlushRequested = false;
+
+  // On overflow the spool file is used instead of the slower database, if there is one
+  bool spoolOnly = overflow && m_cdrSpoolFile.IsOpen();
+  unsigned written = 0, spooled = 0, lost = 0;
+
+  m_cdrOutputMutex.Wait();
+
+  if (m_cdrTextFile.IsOpen()) {
+    PString format = m_cdrFormat.IsEmpty() ? GetDefaultTextFormats() : m_cdrFormat;
+    PStringStream text;
+    unsigned finals = 0;
+    for (size_t i = 0; i < batch.size(); ++i) {
+      if (batch[i]->m_final) {
+        batch[i]->m_cdr.OutputText(text, format);
+        ++finals;
+      }
     }
-    else if (data.Query(m_cdrTable)) {
-      call.OutputSQL(data.NewRow(), m_cdrFieldNames);
-      if (data.Commit())
-        PSYSTEMLOG(Info, "Dropped first SQL CDR for " << call.GetGUID());
+    if (finals > 0) {
+      if (m_cdrTextFile.WriteString(text))
+        PSYSTEMLOG(Info, "Dropped " << finals << " text CDRs");
       else
-        PSYSTEMLOG(Info, "Could not drop first SQL CDR for " << call.GetGUID());
+        PSYSTEMLOG(Error, "Could not write text CDRs - " << m_cdrTextFile.GetErrorText());
     }
-    else {
-      PSYSTEMLOG(Info, "Could not drop SQL CDR for " << call.GetGUID());
+  }
+
+  for (size_t i = 0; i < batch.size(); ++i) {
+    const CDRQueueEntry & entry = *batch[i];
+    bool sent = false, toDatabase = false;
+#if P_ODBC
+    if (m_odbc.IsConnected()) {
+      toDatabase = true;
+      if (!spoolOnly)
+        sent = WriteSQLCDR(entry.m_cdr, entry.m_final);
+    }
+#endif
+    if (sent)
+      ++written;
+    else if (m_cdrSpoolFile.IsOpen() && (entry.m_final || overflow)) {
+      SpoolCDR(entry.m_cdr);
+      ++spooled;
+    }
+    else if (toDatabase) {
+      if (entry.m_final)
+        ++lost;
+    }
+    else if (m_cdrTextFile.IsOpen() && entry.m_final)
+      ++written;
+    delete batch[i];
+  }
+
+  PTime now;
+  if (m_cdrSyncInterval == 0 || now - m_cdrLastSync > m_cdrSyncInterval) {
+    SyncFile(m_cdrTextFile);
+    SyncFile(m_cdrSpoolFile);
+    m_cdrLastSync = now;
+  }
+
+  m_cdrOutputMutex.Signal();
+
+  if (lost > 0)
+    PSYSTEMLOG(Error, "Lost " << lost << " final SQL CDRs, not written and no spool file");
+
+  PTimeInterval latency = PTime() - oldest;
+
+  PWaitAndSignal mutex(m_cdrStatisticsMutex);
+  m_cdrStatistics.m_written += written;
+  m_cdrStatistics.m_spooled += spooled;
+  m_cdrStatistics.m_dropped += lost;
+  ++m_cdrStatistics.m_batches;
+  m_cdrStatistics.m_lastFlushLatency = latency;
+  if (m_cdrStatistics.m_maxFlushLatency < latency)
+    m_cdrStatistics.m_maxFlushLatency = latency;
+}
+
+
+bool MyManager::WriteSQLCDR(const CallDetailRecord & cdr, bool final)
+{
+#if P_ODBC
+  PODBC::RecordSet data(m_odbc);
+  if (data.Select(m_cdrTable, m_cdrFieldNames[MyCall::CallId] + "='" + cdr.GetGUID() + '\'') && data.First()) {
+    cdr.OutputSQL(data[1], m_cdrFieldNames);
+    if (data.Commit()) {
+      PSYSTEMLOG(Info, "Dropped " << (final ? "final" : "intermediate") << " SQL CDR for " << cdr.GetGUID());
+      return true;
     }
+    PSYSTEMLOG(Info, "Could not drop " << (final ? "final" : "intermediate") << " SQL CDR for " << cdr.GetGUID());
+  }
+  else if (data.Query(m_cdrTable)) {
+    cdr.OutputSQL(data.NewRow(), m_cdrFieldNames);
+    if (data.Commit()) {
+      PSYSTEMLOG(Info, "Dropped first SQL CDR for " << cdr.GetGUID());
+      return true;
+    }
+    PSYSTEMLOG(Info, "Could not drop first SQL CDR for " << cdr.GetGUID());
+  }
+  else {
+    PSYSTEMLOG(Info, "Could not drop SQL CDR for " << cdr.GetGUID());
   }
 #endif // P_ODBC
+  return false;
+}
 
-  m_cdrMutex.Signal();
+
+void MyManager::SpoolCDR(const CallDetailRecord & cdr)
+{
+  // Always all fields, so can be loaded into database later
+  PStringStream text;
+  cdr.OutputText(text, GetDefaultTextFormats());
+  if (!m_cdrSpoolFile.WriteString(text))
+    PSYSTEMLOG(Error, "Could not write CDR spool file - " << m_cdrSpoolFile.GetErrorText());
+}
+
+
+void MyManager::GetCDRStatistics(CDRStatistics & stats) const
+{
+  PWaitAndSignal mutex(m_cdrStatisticsMutex);
+  stats = m_cdrStatistics;
+  stats.m_queueDepth = m_cdrQueueDepth;
+}
+
+
+MyManager::CDRStatistics::CDRStatistics()
+  : m_queueDepth(0)
+  , m_peakQueueDepth(0)
+  , m_written(0)
+  , m_spooled(0)
+  , m_dropped(0)
+  , m_batches(0)
+{
 }
 
 
@@ -676,6 +902,30 @@ const char * CDRListPage::GetTitle() const
 
 void CDRListPage::CreateContent(PHTML & html, const PStringToString &) const
 {
+  MyManager::CDRStatistics stats;
+  m_manager.GetCDRStatistics(stats);
+  html << PHTML::TableStart(PHTML::Border1, PHTML::CellPad4)
+       << PHTML::TableRow()
+       << PHTML::TableHeader() << "Queue" << PHTML::NonBreakSpace() << "Depth"
+       << PHTML::TableHeader() << "Peak" << PHTML::NonBreakSpace() << "Depth"
+       << PHTML::TableHeader() << "Written"
+       << PHTML::TableHeader() << "Spooled"
+       << PHTML::TableHeader() << "Dropped"
+       << PHTML::TableHeader() << "Batches"
+       << PHTML::TableHeader() << "Flush" << PHTML::NonBreakSpace() << "Latency"
+       << PHTML::TableHeader() << "Max" << PHTML::NonBreakSpace() << "Latency"
+       << PHTML::TableRow()
+       << PHTML::TableData() << stats.m_queueDepth
+       << PHTML::TableData() << stats.m_peakQueueDepth
+       << PHTML::TableData() << stats.m_written
+       << PHTML::TableData() << stats.m_spooled
+       << PHTML::TableData() << stats.m_dropped
+       << PHTML::TableData() << stats.m_batches
+       << PHTML::TableData() << stats.m_lastFlushLatency
+       << PHTML::TableData() << stats.m_maxFlushLatency
+       << PHTML::TableEnd()
+       << PHTML::Paragraph();
+
   html << PHTML::TableStart(PHTML::Border1, PHTML::CellPad4)
        << PHTML::TableRow()
        << PHTML::TableHeader() << "Call" << PHTML::NonBreakSpace() << "Identifier"
@@ -481,17 +481,32 @@ MyManager::MyManager()
   , m_enableCAPI(true)
 #endif
   , m_cdrListMax(100)
+  , m_cdrFlushInterval(1000)
+  , m_cdrSyncInterval(0, 10)
+  , m_cdrQueue(NULL)
+  , m_cdrQueueDepth(0)
+  , m_cdrQueueLimit(10000)
+  , m_cdrFlushRequested(false)
+  , m_cdrWriterRunning(true)
 {
   OpalLocalEndPoint * ep = new OpalLocalEndPoint(*this, LoopbackPrefix);
   ep->SetDefaultAudioSynchronicity(OpalLocalEndPoint::e_SimulateSynchronous);
   OpalMediaFormat::RegisterKnownMediaFormats(); // Make sure codecs are loaded
   m_outputStream = &m_systemLog;
   DisableDetectInBandDTMF(true);
+
+  m_cdrWriterThread = new PThreadObj<MyManager>(*this, &MyManager::CDRWriterMain, false, "CDR Writer");
 }
 
 
 MyManager::~MyManager()
 {
+  // Make sure last CDRs are queued before writer does final flush
+  ShutDownEndpoints();
+
+  m_cdrWriterRunning = false;
+  m_cdrWriterSignal.Signal();
+  PThread::WaitAndDelete(m_cdrWriterThread);
 }
 
 
@@ -598,6 +598,21 @@ class MyManager : public MyManagerParent
 
     void DropCDR(const MyCall & call, bool final);
 
+    struct CDRStatistics
+    {
+      CDRStatistics();
+
+      unsigned      m_queueDepth;       // Records waiting for writer thread
+      unsigned      m_peakQueueDepth;
+      uint64_t      m_written;          // Records written to text file or database
+      uint64_t      m_spooled;          // Records written to overflow spool file
+      uint64_t      m_dropped;          // Records discarded when queue full, or could not be written anywhere
+      uint64_t      m_batches;
+      PTimeInterval m_lastFlushLatency; // Oldest record queue time to written
+      PTimeInterval m_maxFlushLatency;
+    };
+    void GetCDRStatistics(CDRStatistics & stats) const;
+
     typedef std::list<CallDetailRecord> CDRList;
     CDRList::const_iterator BeginCDR();
     bool NotEndCDR(const CDRList::const_iterator & it);
@@ -633,16 +648,48 @@ class MyManager : public MyManagerParent
     PString m_scriptText;
 #endif
 
+    struct CDRQueueEntry
+    {
+      CDRQueueEntry(const CallDetailRecord & cdr, bool final) : m_cdr(cdr), m_final(final), m_next(NULL) { }
+
+      CallDetailRecord m_cdr;
+      bool             m_final;
+      PTime            m_queued;
+      CDRQueueEntry  * m_next;
+    };
+    void CDRWriterMain();
+    void WriteCDRs(CDRQueueEntry * entries);
+    bool WriteSQLCDR(const CallDetailRecord & cdr, bool final);
+    void SpoolCDR(const CallDetailRecord & cdr);
+
     CDRList   m_cdrList;
     size_t    m_cdrListMax;
-    PTextFile m_cdrTextFile;
-    PString   m_cdrFormat;
-    PString   m_cdrTable;
-    PString   m_cdrFieldNames[MyCall::NumFieldCodes];
+    PDECLARE_MUTEX(m_cdrMutex);
+
+    // Output, only touched by writer thread and ConfigureCDR()
+    PTextFile     m_cdrTextFile;
+    PString       m_cdrFormat;
+    PTextFile     m_cdrSpoolFile;
+    PTimeInterval m_cdrFlushInterval;
+    PTimeInterval m_cdrSyncInterval;
+    PTime         m_cdrLastSync;
+    PString       m_cdrTable;
+    PString       m_cdrFieldNames[MyCall::NumFieldCodes];
 #if P_ODBC
-    PODBC     m_odbc;
+    PODBC         m_odbc;
 #endif
-    PDECLARE_MUTEX(m_cdrMutex);
+    PDECLARE_MUTEX(m_cdrOutputMutex);
+
+    // Producers push on to lock free list, writer thread takes whole list
+    atomic<CDRQueueEntry *> m_cdrQueue;
+    atomic<unsigned>        m_cdrQueueDepth;
+    unsigned                m_cdrQueueLimit;
+    atomic<bool>            m_cdrFlushRequested;
+    PThread               * m_cdrWriterThread;
+    PSyncPoint              m_cdrWriterSignal;
+    atomic<bool>            m_cdrWriterRunning;
+    CDRStatistics           m_cdrStatistics;
+    PDECLARE_MUTEX(         m_cdrStatisticsMutex);
 };
 
 
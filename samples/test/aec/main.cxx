@@ -0,0 +1,281 @@
+/*
+ * main.cxx
+ *
+ * OPAL echo canceler CPU and latency benchmark
+ *
+ * Copyright (c) 2021 Vox Lucida Pty. Ltd.
+ *
+ * The contents of this file are subject to the Mozilla Public License
+ * Version 1.0 (the "License"); you may not use this file except in
+ * compliance with the License. You may obtain a copy of the License at
+ * http://www.mozilla.org/MPL/
+ *
+ * Software distributed under the License is distributed on an "AS IS"
+ * basis, WITHOUT WARRANTY OF ANY KIND, either express or implied. See
+ * the License for the specific language governing rights and limitations
+ * under the License.
+ *
+ * The Original Code is Open Phone Abstraction Library.
+ *
+ * The Initial Developer of the Original Code is Vox Lucida Pty. Ltd.
+ *
+ * Contributor(s): ______________________________________.
+ *
+ */
+
+#include "../opaltest.h"
+
+#include <codec/echocancel.h>
+#include <codec/opalwavfile.h>
+
+#include <algorithm>
+
+
+class EchoTest : public OpalTestProcess
+{
+    PCLASSINFO(EchoTest, OpalTestProcess)
+  public:
+    EchoTest() : OpalTestProcess("Echo Cancel Test") { }
+
+    virtual void Main();
+
+#if OPAL_AEC
+  protected:
+    void TestReferenceBuffer();
+    void Benchmark(PArgList & args);
+    bool Check(bool ok, const char * what);
+#endif
+};
+
+
+PCREATE_PROCESS(EchoTest);
+
+
+static void OutputPercentiles(const char * title, std::vector<PInt64> & times)
+{
+  if (times.empty())
+    return;
+
+  std::sort(times.begin(), times.end());
+  PInt64 total = 0;
+  for (size_t i = 0; i < times.size(); ++i)
+    total += times[i];
+
+  cout << "  " << title << ":"
+          " mean=" << total/(PInt64)times.size() << "us"
+          " p50=" << times[times.size()/2] << "us"
+          " p99=" << times[times.size()*99/100] << "us"
+          " max=" << times.back() << "us\n";
+}
+
+
+void EchoTest::Main()
+{
+  if (!ParseArguments("o-output: Output WAV file for echo cancelled near end audio\n"
+                      "f-frame: Frame time in milliseconds, default 20\n"
+                      "d-duration: Echo tail length in milliseconds, default 250\n"
+                      "D-drift: Far end clock drift in parts per million, default 0\n"
+                      "l-loops: Number of times to process the files, default 1\n",
+                      "[ options ] [ far-end.wav near-end.wav ]"))
+    return;
+
+#if OPAL_AEC
+  TestReferenceBuffer();
+
+  PArgList & args = GetArguments();
+  if (args.GetCount() >= 2)
+    Benchmark(args);
+
+  if (GetTerminationValue() == 0)
+    cout << "All echo cancel tests passed." << endl;
+#else
+  cerr << "Echo cancellation not available" << endl;
+#endif // OPAL_AEC
+}
+
+
+#if OPAL_AEC
+bool EchoTest::Check(bool ok, const char * what)
+{
+  if (!ok)
+    Fail(PSTRSTRM("Failed: " << what));
+  return ok;
+}
+
+
+static std::vector<short> Ramp(short first, unsigned count)
+{
+  std::vector<short> samples(count);
+  for (unsigned i = 0; i < count; ++i)
+    samples[i] = (short)(first + i);
+  return samples;
+}
+
+
+static bool IsRamp(const std::vector<short> & samples, short first)
+{
+  for (size_t i = 0; i < samples.size(); ++i) {
+    if (samples[i] != (short)(first + i))
+      return false;
+  }
+  return true;
+}
+
+
+void EchoTest::TestReferenceBuffer()
+{
+  static const unsigned Frame = 160;
+  std::vector<short> frame(Frame);
+
+  {
+    OpalEchoCanceler::ReferenceBuffer buffer(1024);
+
+    // Sample values are the same as their timestamps, so alignment is easy to see
+    buffer.Write(Ramp(0, Frame).data(), Frame, 0);
+    buffer.Write(Ramp(Frame, Frame).data(), Frame, Frame);
+    Check(buffer.Read(frame.data(), Frame) && IsRamp(frame, 0), "read first frame");
+    Check(buffer.GetEstimatedDelay() == 2*Frame, "delay is the fill before reading");
+    Check(buffer.Read(frame.data(), Frame) && IsRamp(frame, Frame), "read second frame");
+
+    Check(!buffer.Read(frame.data(), Frame) && buffer.GetUnderruns() == 1, "underrun when empty");
+
+    // Timestamp gap of half a frame is played out as silence
+    buffer.Write(Ramp(400, Frame).data(), Frame, 400);
+    std::vector<short> gap(80);
+    Check(buffer.Read(gap.data(), 80) && std::count(gap.begin(), gap.end(), 0) == 80, "gap filled with silence");
+    Check(buffer.Read(frame.data(), Frame) && IsRamp(frame, 400), "read after gap");
+
+    // Duplicate is ignored, overlap only adds the new part
+    buffer.Write(Ramp(400, Frame).data(), Frame, 400);
+    buffer.Write(Ramp(480, Frame).data(), Frame, 480);
+    Check(buffer.Read(gap.data(), 80) && IsRamp(gap, 560), "read after duplicate and overlap");
+    Check(!buffer.Read(frame.data(), Frame), "nothing left after overlap");
+
+    // Writer laps the reader, so reader skips to the most recent frame
+    unsigned timestamp = 720;
+    for (unsigned i = 0; i < 10; ++i, timestamp += Frame)
+      buffer.Write(Ramp((short)timestamp, Frame).data(), Frame, timestamp);
+    Check(buffer.Read(frame.data(), Frame) && IsRamp(frame, (short)(timestamp - Frame)), "overrun skips to latest");
+
+    buffer.Write(Ramp((short)timestamp, Frame).data(), Frame, timestamp);
+    buffer.Resynchronise();
+    Check(!buffer.Read(frame.data(), Frame), "resynchronise discards buffered audio");
+  }
+
+  {
+    OpalEchoCanceler::ReferenceBuffer buffer(4096);
+
+    // Far end clock fast by one sample per frame, unchecked the fill would be this
+    static const unsigned Reads = 300;
+    unsigned uncompensated = Reads*(Frame+1) - (Reads-1)*Frame;
+
+    unsigned timestamp = 0;
+    for (unsigned i = 0; i < Reads; ++i, timestamp += Frame+1) {
+      buffer.Write(Ramp((short)timestamp, Frame+1).data(), Frame+1, timestamp);
+      buffer.Read(frame.data(), Frame);
+    }
+    Check(buffer.GetDriftAdjustments() > 0, "drift compensation happened");
+    Check(buffer.GetEstimatedDelay() < uncompensated, "drift compensation reduced the delay");
+    Check(buffer.GetUnderruns() == 0, "no underruns with fast far end");
+  }
+}
+
+
+void EchoTest::Benchmark(PArgList & args)
+{
+  OpalWAVFile farFile(args[0], PFile::ReadOnly);
+  if (!farFile.IsOpen()) {
+    Fail("Could not open far end file " + args[0]);
+    return;
+  }
+
+  OpalWAVFile nearFile(args[1], PFile::ReadOnly);
+  if (!nearFile.IsOpen()) {
+    Fail("Could not open near end file " + args[1]);
+    return;
+  }
+
+  unsigned sampleRate = nearFile.GetSampleRate();
+  if (farFile.GetSampleRate() != sampleRate) {
+    Fail("Far and near end files must have the same sample rate");
+    return;
+  }
+
+  OpalWAVFile outFile;
+  if (args.HasOption('o') && !outFile.Open(args.GetOptionString('o'), PFile::WriteOnly)) {
+    Fail("Could not create output file " + args.GetOptionString('o'));
+    return;
+  }
+  if (outFile.IsOpen())
+    outFile.SetSampleRate(sampleRate);
+
+  unsigned frameSamples = sampleRate*args.GetOptionAs('f', 20U)/1000;
+  unsigned driftPPM = args.GetOptionAs('D', 0U);
+  unsigned loops = args.GetOptionAs('l', 1U);
+
+  OpalEchoCanceler::Params params;
+  params.m_enabled = true;
+  params.m_duration = sampleRate*args.GetOptionAs('d', 250U)/1000;
+
+  OpalEchoCanceler canceler;
+  canceler.SetParameters(params);
+  canceler.SetClockRate(sampleRate);
+
+  RTP_DataFrame farFrame(frameSamples*sizeof(short));
+  RTP_DataFrame nearFrame(frameSamples*sizeof(short));
+  unsigned farTimestamp = 0;
+  unsigned nearTimestamp = 0;
+  uint64_t driftAccumulator = 0;
+  std::vector<PInt64> sendTimes, receiveTimes;
+
+  PTime start;
+  for (unsigned loop = 0; loop < loops; ++loop) {
+    farFile.SetPosition(0);
+    nearFile.SetPosition(0);
+
+    for (;;) {
+      if (!farFile.Read(farFrame.GetPayloadPtr(), frameSamples*sizeof(short)) ||
+          !nearFile.Read(nearFrame.GetPayloadPtr(), frameSamples*sizeof(short)))
+        break;
+
+      farFrame.SetTimestamp(farTimestamp);
+      farTimestamp += frameSamples;
+      nearFrame.SetTimestamp(nearTimestamp);
+      nearTimestamp += frameSamples;
+
+      PTime tick;
+      canceler.GetSendHandler()(farFrame, 0);
+      sendTimes.push_back((PTime() - tick).GetMicroSeconds());
+
+      // Simulate the far end clock running fast, by sending an extra frame now and then
+      driftAccumulator += (uint64_t)driftPPM*frameSamples;
+      if (driftAccumulator >= 1000000ULL*frameSamples) {
+        driftAccumulator -= 1000000ULL*frameSamples;
+        farFrame.SetTimestamp(farTimestamp);
+        farTimestamp += frameSamples;
+        canceler.GetSendHandler()(farFrame, 0);
+      }
+
+      tick.SetCurrentTime();
+      canceler.GetReceiveHandler()(nearFrame, 0);
+      receiveTimes.push_back((PTime() - tick).GetMicroSeconds());
+
+      if (outFile.IsOpen())
+        outFile.Write(nearFrame.GetPayloadPtr(), nearFrame.GetPayloadSize());
+    }
+  }
+  PTimeInterval elapsed = PTime() - start;
+
+  size_t frames = receiveTimes.size();
+  double audioSeconds = (double)frames*frameSamples/sampleRate;
+  cout << "Processed " << frames << " frames of " << frameSamples << " samples,"
+          " " << audioSeconds << " seconds of audio in " << elapsed << " seconds,"
+          " " << (audioSeconds*1000/std::max(elapsed.GetMilliSeconds(), (PInt64)1)) << "x real time\n";
+  OutputPercentiles("Far end (send) latency", sendTimes);
+  OutputPercentiles("Near end (receive) latency", receiveTimes);
+  cout << "  Estimated reference delay: " << canceler.GetEstimatedDelay() << " samples" << endl;
+}
+#endif // OPAL_AEC
+
+
+// End of File ///////////////////////////////////////////////////////////////
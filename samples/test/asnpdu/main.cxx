@@ -0,0 +1,308 @@
+/*
+ * main.cxx
+ *
+ * OPAL H.225/H.245 ASN.1 PDU decode and encode benchmark
+ *
+ * Copyright (c) 2021 Vox Lucida Pty. Ltd.
+ *
+ * The contents of this file are subject to the Mozilla Public License
+ * Version 1.0 (the "License"); you may not use this file except in
+ * compliance with the License. You may obtain a copy of the License at
+ * http://www.mozilla.org/MPL/
+ *
+ * Software distributed under the License is distributed on an "AS IS"
+ * basis, WITHOUT WARRANTY OF ANY KIND, either express or implied. See
+ * the License for the specific language governing rights and limitations
+ * under the License.
+ *
+ * The Original Code is Open Phone Abstraction Library.
+ *
+ * The Initial Developer of the Original Code is Vox Lucida Pty. Ltd.
+ *
+ * Contributor(s): ______________________________________.
+ *
+ */
+
+#include "../opaltest.h"
+
+#include <h323/h323pdu.h>
+#include <h323/h323caps.h>
+#include <h323/h323ep.h>
+#include <h323/h323con.h>
+#include <opal/manager.h>
+#include <opal/call.h>
+#include <opal/guid.h>
+
+#include <algorithm>
+
+
+class ASNTest : public OpalTestProcess
+{
+    PCLASSINFO(ASNTest, OpalTestProcess)
+  public:
+    ASNTest() : OpalTestProcess("ASN PDU Test") { }
+
+    virtual void Main();
+
+  protected:
+    void TestCapabilitiesCache(unsigned iterations);
+};
+
+
+PCREATE_PROCESS(ASNTest);
+
+
+struct Message
+{
+  Message(const char * name, const PBYTEArray & data, bool h225) : m_name(name), m_data(data), m_h225(h225) { }
+  PString    m_name;
+  PBYTEArray m_data;
+  bool       m_h225; // else H.245
+};
+
+
+static void BuildOLC(H245_OpenLogicalChannel & open, const H323Capability & capability, unsigned channel)
+{
+  open.m_forwardLogicalChannelNumber = channel;
+  capability.OnSendingPDU(open.m_forwardLogicalChannelParameters.m_dataType);
+  open.m_forwardLogicalChannelParameters.m_multiplexParameters.SetTag(
+              H245_OpenLogicalChannel_forwardLogicalChannelParameters_multiplexParameters::e_h2250LogicalChannelParameters);
+  H245_H2250LogicalChannelParameters & param = open.m_forwardLogicalChannelParameters.m_multiplexParameters;
+  param.m_sessionID = capability.GetDefaultSessionID();
+  param.IncludeOptionalField(H245_H2250LogicalChannelParameters::e_mediaControlChannel);
+  H323TransportAddress("192.168.1.1", 5001).SetPDU(param.m_mediaControlChannel);
+}
+
+
+static PBYTEArray Encode(const PASN_Object & pdu)
+{
+  PPER_Stream strm;
+  pdu.Encode(strm);
+  strm.CompleteEncoding();
+  return strm;
+}
+
+
+// Synthetic SETUP with fast start and tunnelled TCS, plus the H.245 messages
+static void BuildCorpus(std::vector<Message> & corpus)
+{
+  H323CapabilityFactory::KeyList_T keys = H323CapabilityFactory::GetKeyList();
+  PList<H323Capability> capabilities;
+  for (H323CapabilityFactory::KeyList_T::iterator it = keys.begin(); it != keys.end(); ++it) {
+    H323Capability * capability = H323Capability::Create(*it);
+    if (capability != NULL)
+      capabilities.Append(capability);
+  }
+
+  H323ControlPDU tcs;
+  H245_TerminalCapabilitySet & cap = tcs.Build(H245_RequestMessage::e_terminalCapabilitySet);
+  cap.m_sequenceNumber = 1;
+  cap.m_protocolIdentifier.SetValue("0.0.8.245.0.13");
+  cap.IncludeOptionalField(H245_TerminalCapabilitySet::e_capabilityTable);
+  cap.m_capabilityTable.SetSize(capabilities.GetSize());
+  for (PINDEX i = 0; i < capabilities.GetSize(); ++i) {
+    H245_CapabilityTableEntry & entry = cap.m_capabilityTable[i];
+    entry.m_capabilityTableEntryNumber = i+1;
+    entry.IncludeOptionalField(H245_CapabilityTableEntry::e_capability);
+    capabilities[i].OnSendingPDU(entry.m_capability);
+  }
+  corpus.push_back(Message("TCS", Encode(tcs), false));
+
+  H323ControlPDU olc;
+  BuildOLC(olc.Build(H245_RequestMessage::e_openLogicalChannel), capabilities.front(), 1);
+  corpus.push_back(Message("OLC", Encode(olc), false));
+
+  H323SignalPDU setupPDU;
+  setupPDU.m_h323_uu_pdu.m_h323_message_body.SetTag(H225_H323_UU_PDU_h323_message_body::e_setup);
+  H225_Setup_UUIE & setup = setupPDU.m_h323_uu_pdu.m_h323_message_body;
+  setup.m_protocolIdentifier.SetValue("0.0.8.2250.0.7");
+  setup.m_conferenceID.SetValue(OpalGloballyUniqueID());
+  setup.m_callIdentifier.m_guid.SetValue(OpalGloballyUniqueID());
+  setup.IncludeOptionalField(H225_Setup_UUIE::e_sourceAddress);
+  setup.m_sourceAddress.SetSize(1);
+  H323SetAliasAddress(PString("+61299999999"), setup.m_sourceAddress[0]);
+  setup.IncludeOptionalField(H225_Setup_UUIE::e_sourceCallSignalAddress);
+  H323TransportAddress("192.168.1.1", 1720).SetPDU(setup.m_sourceCallSignalAddress);
+  setup.IncludeOptionalField(H225_Setup_UUIE::e_fastStart);
+  for (PINDEX i = 0; i < capabilities.GetSize() && i < 8; ++i) {
+    H245_OpenLogicalChannel open;
+    BuildOLC(open, capabilities[i], i+1);
+    PINDEX last = setup.m_fastStart.GetSize();
+    setup.m_fastStart.SetSize(last+1);
+    setup.m_fastStart[last].EncodeSubType(open);
+  }
+  setupPDU.m_h323_uu_pdu.m_h245Tunneling = true;
+  setupPDU.m_h323_uu_pdu.IncludeOptionalField(H225_H323_UU_PDU::e_h245Control);
+  setupPDU.m_h323_uu_pdu.m_h245Control.SetSize(1);
+  setupPDU.m_h323_uu_pdu.m_h245Control[0].SetValue(corpus.front().m_data);
+  corpus.insert(corpus.begin(), Message("SETUP", Encode(setupPDU), true));
+}
+
+
+// Decode as the stack does, including nested fast start and tunnelled H.245
+static bool DecodeMessage(const Message & msg, PBYTEArray * reencoded)
+{
+  PPER_Stream strm(msg.m_data);
+
+  if (!msg.m_h225) {
+    H323ControlPDU pdu;
+    if (!pdu.Decode(strm))
+      return false;
+    if (reencoded != NULL)
+      *reencoded = Encode(pdu);
+    return true;
+  }
+
+  H323SignalPDU pdu;
+  if (!pdu.Decode(strm))
+    return false;
+
+  if (pdu.m_h323_uu_pdu.m_h323_message_body.GetTag() == H225_H323_UU_PDU_h323_message_body::e_setup) {
+    H225_Setup_UUIE & setup = pdu.m_h323_uu_pdu.m_h323_message_body;
+    for (PINDEX i = 0; i < setup.m_fastStart.GetSize(); ++i) {
+      H245_OpenLogicalChannel open;
+      if (!setup.m_fastStart[i].DecodeSubType(open))
+        return false;
+    }
+  }
+
+  for (PINDEX i = 0; i < pdu.m_h323_uu_pdu.m_h245Control.GetSize(); ++i) {
+    PPER_Stream h245 = pdu.m_h323_uu_pdu.m_h245Control[i].GetValue();
+    H323ControlPDU control;
+    if (!control.Decode(h245))
+      return false;
+  }
+
+  if (reencoded != NULL)
+    *reencoded = Encode(pdu);
+  return true;
+}
+
+
+void ASNTest::Main()
+{
+  if (!ParseArguments("i-iterations: Number of times to process corpus, default 10000\n"
+                      "u-uuie. Corpus files are raw PER H.225 UU-IE, default is H.245\n"
+                      "n-no-capabilities. Do not time building the capability set, with and without cache\n",
+                      "[ options ] [ raw-per-file ... ]"))
+    return;
+
+  PArgList & args = GetArguments();
+
+  std::vector<Message> corpus;
+  if (args.GetCount() == 0)
+    BuildCorpus(corpus);
+  else {
+    for (PINDEX i = 0; i < args.GetCount(); ++i) {
+      PFile file;
+      PBYTEArray data;
+      if (!file.Open(args[i], PFile::ReadOnly) || !file.Read(data.GetPointer(file.GetLength()), file.GetLength())) {
+        Fail("Could not read " + args[i]);
+        return;
+      }
+      corpus.push_back(Message(PFilePath(args[i]).GetTitle(), data, args.HasOption('u')));
+    }
+  }
+
+  unsigned iterations = std::max(args.GetOptionAs('i', 10000U), 1U);
+
+  for (size_t m = 0; m < corpus.size(); ++m) {
+    const Message & msg = corpus[m];
+
+    PBYTEArray reencoded;
+    if (!DecodeMessage(msg, &reencoded)) {
+      Fail(msg.m_name + ": decode FAILED");
+      continue;
+    }
+
+#if PMEMORY_CHECK
+    PMemoryHeap::State before, after;
+    PMemoryHeap::GetState(before);
+    DecodeMessage(msg, NULL);
+    PMemoryHeap::GetState(after);
+#endif
+
+    PTime start;
+    for (unsigned i = 0; i < iterations; ++i)
+      DecodeMessage(msg, NULL);
+    PInt64 decodeTime = (PTime() - start).GetMicroSeconds();
+
+    start.SetCurrentTime();
+    for (unsigned i = 0; i < iterations; ++i)
+      DecodeMessage(msg, &reencoded);
+    PInt64 roundTripTime = (PTime() - start).GetMicroSeconds();
+
+    cout << msg.m_name << ": " << msg.m_data.GetSize() << " bytes"
+         << (reencoded == msg.m_data ? "" : ", re-encode DIFFERENT")
+         << fixed << setprecision(2)
+         << ", decode=" << (double)decodeTime/iterations << "us"
+         << ", decode+encode=" << (double)roundTripTime/iterations << "us"
+#if PMEMORY_CHECK
+         << ", allocations=" << (after.allocationNumber - before.allocationNumber)
+#endif
+         << endl;
+  }
+
+  if (!args.HasOption('n'))
+    TestCapabilitiesCache(iterations);
+}
+
+
+/* Time H323Capabilities::BuildPDU() with and without the endpoint cache. A
+   connection rebuilds its local capabilities for every call, so each pass
+   works on a fresh copy, as the copy is not part of what is being timed. */
+void ASNTest::TestCapabilitiesCache(unsigned iterations)
+{
+  OpalManager manager;
+  H323EndPoint * endpoint = new H323EndPoint(manager);
+
+  // Non-standard capabilities are never cached, so leave them out
+  H323Capabilities capabilities;
+  H323CapabilityFactory::KeyList_T keys = H323CapabilityFactory::GetKeyList();
+  for (H323CapabilityFactory::KeyList_T::iterator it = keys.begin(); it != keys.end(); ++it) {
+    H323Capability * capability = H323Capability::Create(*it);
+    if (capability == NULL)
+      continue;
+    if (dynamic_cast<H323NonStandardCapabilityInfo *>(capability) != NULL)
+      delete capability;
+    else
+      capabilities.SetCapability(0, P_MAX_INDEX, capability);
+  }
+
+  OpalCall * call = manager.InternalCreateCall();
+  H323Connection * connection = new H323Connection(*call, *endpoint, "asnpdu", PString::Empty(), H323TransportAddress());
+  H323CapabilitiesPDUCache & cache = endpoint->GetCapabilitiesPDUCache();
+  PINDEX cacheSize = std::max(cache.GetMaxSize(), (PINDEX)1);
+
+  PBYTEArray encoded[2];
+  PInt64 times[2] = { 0, 0 };
+  for (int cached = 0; cached < 2; ++cached) {
+    cache.RemoveAll();
+    cache.SetMaxSize(cached ? cacheSize : 0);
+    for (unsigned i = 0; i < iterations; ++i) {
+      H323Capabilities local = capabilities;
+      H245_TerminalCapabilitySet pdu;
+      PTime start;
+      local.BuildPDU(*connection, pdu);
+      times[cached] += (PTime() - start).GetMicroSeconds();
+      if (i == iterations-1)
+        encoded[cached] = Encode(pdu);
+    }
+  }
+
+  cout << "Capability set: " << capabilities.GetSize() << " capabilities, "
+       << encoded[0].GetSize() << " bytes" << fixed << setprecision(2)
+       << ", uncached=" << (double)times[0]/iterations << "us"
+       << ", cached=" << (double)times[1]/iterations << "us"
+       << ", gain=" << setprecision(1) << (double)times[0]/std::max(times[1], (PInt64)1) << 'x'
+       << endl;
+
+  if (encoded[1] != encoded[0])
+    Fail("Capability set: cached PDU DIFFERENT to uncached");
+
+  delete connection;
+  manager.ShutDownEndpoints();
+}
+
+
+// End of File ///////////////////////////////////////////////////////////////
@@ -0,0 +1,260 @@
+/*
+ * main.cxx
+ *
+ * OPAL call setup rate benchmark, using a loopback pair of local endpoints
+ *
+ * Copyright (c) 2021 Vox Lucida Pty. Ltd.
+ *
+ * The contents of this file are subject to the Mozilla Public License
+ * Version 1.0 (the "License"); you may not use this file except in
+ * compliance with the License. You may obtain a copy of the License at
+ * http://www.mozilla.org/MPL/
+ *
+ * Software distributed under the License is distributed on an "AS IS"
+ * basis, WITHOUT WARRANTY OF ANY KIND, either express or implied. See
+ * the License for the specific language governing rights and limitations
+ * under the License.
+ *
+ * The Original Code is Open Phone Abstraction Library.
+ *
+ * The Initial Developer of the Original Code is Vox Lucida Pty. Ltd.
+ *
+ * Contributor(s): ______________________________________.
+ *
+ */
+
+#include "../opaltest.h"
+
+#include <opal/manager.h>
+#include <opal/call.h>
+#include <ep/localep.h>
+
+#include <algorithm>
+
+
+class RateManager : public OpalManager
+{
+    PCLASSINFO(RateManager, OpalManager)
+  public:
+    RateManager(PTimeInterval holdTime);
+    ~RateManager();
+
+    virtual void OnEstablishedCall(OpalCall & call);
+    virtual void OnClearedCall(OpalCall & call);
+    virtual void DestroyCall(OpalCall * call);
+
+    void StartCall();
+    bool WaitForCompletion(unsigned count, PTimeInterval timeout);
+    bool WaitForDestruction(unsigned count, PTimeInterval timeout);
+    void ClearMain();
+
+    PTimeInterval                 m_holdTime;
+    PDECLARE_MUTEX(               m_mutex);
+    std::vector<PInt64>           m_setupTimes;
+    std::multimap<PTime, PString> m_clearTimes;
+    atomic<unsigned>              m_active;
+    atomic<unsigned>              m_established;
+    atomic<unsigned>              m_failed;
+    atomic<unsigned>              m_cleared;
+    atomic<unsigned>              m_destroyed;
+    PSyncPoint                    m_callCleared;
+    PThread                     * m_clearThread;
+    atomic<bool>                  m_running;
+};
+
+
+class CallRateTest : public OpalTestProcess
+{
+    PCLASSINFO(CallRateTest, OpalTestProcess)
+  public:
+    CallRateTest() : OpalTestProcess("Call Rate Test") { }
+
+    virtual void Main();
+};
+
+
+PCREATE_PROCESS(CallRateTest);
+
+
+void CallRateTest::Main()
+{
+  if (!ParseArguments("c-count: Total number of calls to make, default 10000\n"
+                      "r-rate: Target calls per second, default 0 (as fast as possible)\n"
+                      "m-max: Maximum simultaneous calls, default 1000\n"
+                      "H-hold: Call hold time in milliseconds, default 0\n"))
+    return;
+
+  PArgList & args = GetArguments();
+
+  unsigned count = args.GetOptionAs('c', 10000U);
+  unsigned rate = args.GetOptionAs('r', 0U);
+  unsigned maxActive = args.GetOptionAs('m', 1000U);
+
+  RateManager manager(PTimeInterval(args.GetOptionAs('H', 0U)));
+  new OpalLocalEndPoint(manager, "loca");
+  new OpalLocalEndPoint(manager, "locb");
+
+  cout << "Starting " << count << " calls"
+       << (rate > 0 ? PSTRSTRM(" at " << rate << " calls/second") : PString(" as fast as possible"))
+       << ", maximum " << maxActive << " simultaneous" << endl;
+
+  PTime start;
+  for (unsigned i = 0; i < count; ++i) {
+    if (rate > 0) {
+      PTimeInterval due(i*1000LL/rate);
+      PTimeInterval elapsed = PTime() - start;
+      if (due > elapsed)
+        PThread::Sleep(due - elapsed);
+    }
+
+    while (manager.m_active >= maxActive)
+      manager.m_callCleared.Wait(100);
+
+    manager.StartCall();
+  }
+
+  if (!manager.WaitForCompletion(count, PTimeInterval(0, 0, 1)))
+    Fail("Timed out waiting for calls to clear");
+
+  PTimeInterval elapsed = PTime() - start;
+
+  std::vector<PInt64> & times = manager.m_setupTimes;
+  std::sort(times.begin(), times.end());
+
+  cout << "Completed " << manager.m_cleared << " calls in " << elapsed << " seconds,"
+          " " << (manager.m_cleared*1000.0/std::max(elapsed.GetMilliSeconds(), (PInt64)1)) << " calls/second\n"
+          "  Established: " << manager.m_established << ", failed: " << manager.m_failed << '\n';
+  if (!times.empty())
+    cout << "  Setup time:"
+            " p50=" << times[times.size()/2] << "us"
+            " p90=" << times[times.size()*9/10] << "us"
+            " p99=" << times[times.size()*99/100] << "us"
+            " max=" << times.back() << "us\n";
+
+  OpalEventPool::Statistics stats;
+  manager.GetDecoupledEventPool().GetStatistics(stats);
+  cout << "  Event pool: " << stats << endl;
+
+  if (manager.m_established != count || manager.m_failed != 0)
+    Fail(PSTRSTRM("Only " << manager.m_established << " of " << count << " calls established"));
+
+  // Garbage collection is triggered by calls clearing, not a timer, so should be prompt
+  if (!manager.WaitForDestruction(count, PTimeInterval(0, 5)) || manager.GetCallCount() != 0)
+    Fail(PSTRSTRM("Only " << manager.m_destroyed << " of " << count << " calls deleted,"
+                  " " << manager.GetCallCount() << " still in dictionary"));
+
+  manager.ShutDownEndpoints();
+
+  if (GetTerminationValue() == 0)
+    cout << "All calls completed and deleted." << endl;
+}
+
+
+RateManager::RateManager(PTimeInterval holdTime)
+  : m_holdTime(holdTime)
+  , m_active(0)
+  , m_established(0)
+  , m_failed(0)
+  , m_cleared(0)
+  , m_destroyed(0)
+  , m_running(true)
+{
+  m_clearThread = new PThreadObj<RateManager>(*this, &RateManager::ClearMain, false, "Clearer");
+}
+
+
+RateManager::~RateManager()
+{
+  m_running = false;
+  PThread::WaitAndDelete(m_clearThread);
+}
+
+
+void RateManager::StartCall()
+{
+  ++m_active;
+  if (SetUpCall("loca:", "locb:") == NULL) {
+    --m_active;
+    ++m_failed;
+    ++m_cleared;
+  }
+}
+
+
+void RateManager::OnEstablishedCall(OpalCall & call)
+{
+  PTime now;
+  ++m_established;
+
+  PWaitAndSignal mutex(m_mutex);
+  m_setupTimes.push_back((now - call.GetStartTime()).GetMicroSeconds());
+  m_clearTimes.insert(std::make_pair(now + m_holdTime, call.GetToken()));
+}
+
+
+void RateManager::OnClearedCall(OpalCall & call)
+{
+  if (!call.IsEstablished())
+    ++m_failed;
+
+  --m_active;
+  ++m_cleared;
+  m_callCleared.Signal();
+}
+
+
+void RateManager::DestroyCall(OpalCall * call)
+{
+  OpalManager::DestroyCall(call);
+  ++m_destroyed;
+  m_callCleared.Signal();
+}
+
+
+void RateManager::ClearMain()
+{
+  while (m_running) {
+    PStringList tokens;
+
+    m_mutex.Wait();
+    PTime now;
+    while (!m_clearTimes.empty() && m_clearTimes.begin()->first <= now) {
+      tokens += m_clearTimes.begin()->second;
+      m_clearTimes.erase(m_clearTimes.begin());
+    }
+    m_mutex.Signal();
+
+    for (PStringList::iterator it = tokens.begin(); it != tokens.end(); ++it)
+      ClearCall(*it);
+
+    if (tokens.IsEmpty())
+      PThread::Sleep(5);
+  }
+}
+
+
+bool RateManager::WaitForCompletion(unsigned count, PTimeInterval timeout)
+{
+  PSimpleTimer timer(timeout);
+  while (m_cleared < count) {
+    if (timer.HasExpired())
+      return false;
+    m_callCleared.Wait(100);
+  }
+  return true;
+}
+
+
+bool RateManager::WaitForDestruction(unsigned count, PTimeInterval timeout)
+{
+  PSimpleTimer timer(timeout);
+  while (m_destroyed < count) {
+    if (timer.HasExpired())
+      return false;
+    m_callCleared.Wait(100);
+  }
+  return true;
+}
+
+
+// End of File ///////////////////////////////////////////////////////////////
@@ -0,0 +1,151 @@
+/*
+ * main.cxx
+ *
+ * OPAL binary media event trace decoder and benchmark
+ *
+ * Copyright (c) 2021 Vox Lucida Pty. Ltd.
+ *
+ * The contents of this file are subject to the Mozilla Public License
+ * Version 1.0 (the "License"); you may not use this file except in
+ * compliance with the License. You may obtain a copy of the License at
+ * http://www.mozilla.org/MPL/
+ *
+ * Software distributed under the License is distributed on an "AS IS"
+ * basis, WITHOUT WARRANTY OF ANY KIND, either express or implied. See
+ * the License for the specific language governing rights and limitations
+ * under the License.
+ *
+ * The Original Code is Open Phone Abstraction Library.
+ *
+ * The Initial Developer of the Original Code is Vox Lucida Pty. Ltd.
+ *
+ * Contributor(s): ______________________________________.
+ *
+ */
+
+#include "../opaltest.h"
+
+#include <opal/evtrace.h>
+
+#include <algorithm>
+
+
+class EventTraceTest : public OpalTestProcess
+{
+    PCLASSINFO(EventTraceTest, OpalTestProcess)
+  public:
+    EventTraceTest();
+
+    virtual void Main();
+
+  protected:
+    void Benchmark(PArgList & args, bool unfiltered);
+    PDECLARE_NOTIFIER(PThread, EventTraceTest, RecordMain);
+
+    unsigned m_events;
+    unsigned m_contexts;
+};
+
+
+PCREATE_PROCESS(EventTraceTest);
+
+
+EventTraceTest::EventTraceTest()
+  : OpalTestProcess("Event Trace Test")
+  , m_events(0)
+  , m_contexts(0)
+{
+}
+
+
+void EventTraceTest::Main()
+{
+  static const char Usage[] = "[ options ] <trace-file>";
+  if (!ParseArguments("f-filter: Only output context identifiers or SSRC values, comma separated (0x prefix for hex)\n"
+                      "b-benchmark: Record events to file, instead of decoding\n"
+                      "t-threads: Number of threads for benchmark, default 4\n"
+                      "e-events: Number of events per thread for benchmark, default 1000000\n"
+                      "c-contexts: Number of distinct contexts in benchmark, default 100\n",
+                      Usage))
+    return;
+
+  PArgList & args = GetArguments();
+  if (args.GetCount() == 0 && !args.HasOption('b')) {
+    args.Usage(cerr, Usage);
+    return;
+  }
+
+  std::vector<uint32_t> filter;
+  PStringArray ids = args.GetOptionString('f').Tokenise(",", false);
+  for (PINDEX i = 0; i < ids.GetSize(); ++i)
+    filter.push_back((ids[i].Left(2) *= "0x") ? ids[i].Mid(2).AsUnsigned(16) : ids[i].AsUnsigned());
+
+  if (args.HasOption('b')) {
+    OpalEventTracer::GetInstance().SetFilter(filter);
+    Benchmark(args, filter.empty());
+    return;
+  }
+
+  for (PINDEX i = 0; i < args.GetCount(); ++i) {
+    if (!OpalEventTracer::Decode(args[i], cout, filter))
+      Fail("Could not decode " + args[i]);
+  }
+}
+
+
+void EventTraceTest::Benchmark(PArgList & args, bool unfiltered)
+{
+  unsigned threads = std::max(args.GetOptionAs('t', 4U), 1U);
+  m_events = std::max(args.GetOptionAs('e', 1000000U), 1U);
+  m_contexts = std::max(args.GetOptionAs('c', 100U), 1U);
+
+  OpalEventTracer & tracer = OpalEventTracer::GetInstance();
+  PFilePath filename = args.GetOptionString('b');
+  if (!tracer.Start(filename)) {
+    Fail("Could not create " + filename);
+    return;
+  }
+
+  cout << "Recording " << m_events << " events on each of " << threads << " threads" << endl;
+
+  PTime start;
+  std::vector<PThread *> workers;
+  for (unsigned i = 0; i < threads; ++i)
+    workers.push_back(PThread::Create(PCREATE_NOTIFIER(RecordMain), i, PThread::NoAutoDeleteThread,
+                                      PThread::NormalPriority, PSTRSTRM("Record:" << i)));
+  for (size_t i = 0; i < workers.size(); ++i)
+    PThread::WaitAndDelete(workers[i]);
+  PInt64 elapsed = std::max((PTime() - start).GetMicroSeconds(), (PInt64)1);
+
+  tracer.Stop();
+
+  OpalEventTracer::Statistics stats;
+  tracer.GetStatistics(stats);
+
+  cout << fixed << setprecision(1)
+       << "  Elapsed: " << elapsed/1000 << "ms, "
+       << elapsed*1000.0/m_events << "ns per event per thread\n"
+          "  Tracer: " << stats << endl;
+
+  // Every event must be either in the file or counted as dropped
+  if (unfiltered && stats.m_recorded + stats.m_dropped != (uint64_t)threads*m_events)
+    Fail(PSTRSTRM("Expected " << (uint64_t)threads*m_events << " events, "
+                  "recorded " << stats.m_recorded << ", dropped " << stats.m_dropped));
+
+  PStringStream decoded;
+  if (!OpalEventTracer::Decode(filename, decoded))
+    Fail("Could not decode " + filename);
+}
+
+
+void EventTraceTest::RecordMain(PThread &, P_INT_PTR index)
+{
+  for (unsigned i = 0; i < m_events; ++i) {
+    uint32_t context = (uint32_t)(index*m_contexts + i%m_contexts + 1);
+    if (OpalEventTracer::IsActive(context, context))
+      OpalEventTracer::Record(OpalEventTracer::e_RTPReceive, context, context, i & 0xffff, i*160, 160);
+  }
+}
+
+
+// End of File ///////////////////////////////////////////////////////////////
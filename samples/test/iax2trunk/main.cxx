@@ -0,0 +1,175 @@
+/*
+ * main.cxx
+ *
+ * OPAL IAX2 trunking test, also reporting packet rate, bandwidth and thread usage
+ *
+ * Copyright (c) 2021 Vox Lucida Pty. Ltd.
+ *
+ * The contents of this file are subject to the Mozilla Public License
+ * Version 1.0 (the "License"); you may not use this file except in
+ * compliance with the License. You may obtain a copy of the License at
+ * http://www.mozilla.org/MPL/
+ *
+ * Software distributed under the License is distributed on an "AS IS"
+ * basis, WITHOUT WARRANTY OF ANY KIND, either express or implied. See
+ * the License for the specific language governing rights and limitations
+ * under the License.
+ *
+ * The Original Code is Open Phone Abstraction Library.
+ *
+ * The Initial Developer of the Original Code is Vox Lucida Pty. Ltd.
+ *
+ * Contributor(s): ______________________________________.
+ *
+ */
+
+#include "../opaltest.h"
+
+#include <opal/manager.h>
+#include <ep/localep.h>
+#include <iax2/iax2ep.h>
+#include <iax2/transmit.h>
+
+
+class TrunkTest : public OpalTestProcess
+{
+    PCLASSINFO(TrunkTest, OpalTestProcess)
+  public:
+    TrunkTest();
+
+    virtual void Main();
+};
+
+
+PCREATE_PROCESS(TrunkTest);
+
+
+TrunkTest::TrunkTest()
+  : OpalTestProcess("IAX2 Trunk Test")
+{
+}
+
+
+struct Site
+{
+  Site(WORD port, IAX2EndPoint::TrunkModes mode, bool timeStamps)
+  {
+    m_local = new OpalLocalEndPoint(m_manager);
+    m_local->SetDefaultAudioSynchronicity(OpalLocalEndPoint::e_SimulateSynchronous);
+    m_iax2 = new IAX2EndPoint(m_manager, port);
+    m_iax2->SetTrunking(mode, 20, timeStamps);
+    m_manager.AddRouteEntry("iax2:.* = local:");
+  }
+
+  ~Site()
+  {
+    m_manager.ShutDownEndpoints();
+  }
+
+  void GetCounts(PUInt64 & packets, PUInt64 & bytes, PUInt64 & trunkFrames, PUInt64 & miniFrames)
+  {
+    m_iax2->transmitter->GetTrafficCounts(packets, bytes, trunkFrames, miniFrames);
+  }
+
+  OpalManager         m_manager;
+  OpalLocalEndPoint * m_local;
+  IAX2EndPoint      * m_iax2;
+};
+
+
+void TrunkTest::Main()
+{
+  if (!ParseArguments("c-calls: Number of simultaneous calls, default 100\n"
+                      "d-duration: Measurement time in seconds, default 10\n"
+                      "m-mode: Trunk mode: off, on or auto, default on\n"
+                      "n-no-timestamps. Trunk entries do not carry time stamps\n"
+                      "p-port: Base UDP port, default 4569 (uses this and the next one)\n"))
+    return;
+
+  PArgList & args = GetArguments();
+  unsigned calls = args.GetOptionAs('c', 100U);
+  PTimeInterval duration(0, args.GetOptionAs('d', 10U));
+  WORD port = (WORD)args.GetOptionAs('p', (unsigned)IAX2EndPoint::DefaultUdpPort);
+  bool timeStamps = !args.HasOption('n');
+
+  PCaselessString modeStr = args.GetOptionString('m', "on");
+  IAX2EndPoint::TrunkModes mode;
+  if (modeStr == "off")
+    mode = IAX2EndPoint::TrunkDisabled;
+  else if (modeStr == "auto")
+    mode = IAX2EndPoint::TrunkAuto;
+  else
+    mode = IAX2EndPoint::TrunkEnabled;
+
+  // Calling site uses the mode, called site follows it when trunk frames arrive
+  Site caller(port, mode, timeStamps);
+  Site callee((WORD)(port+1), IAX2EndPoint::TrunkAuto, timeStamps);
+
+  cout << "Starting " << calls << " calls, trunk mode " << modeStr
+       << (timeStamps ? "" : " without time stamps") << endl;
+
+  PString destination = PSTRSTRM("iax2:127.0.0.1:" << (port+1) << "/100");
+  for (unsigned i = 0; i < calls; ++i) {
+    if (caller.m_manager.SetUpCall("local:", destination) == NULL)
+      Fail(PSTRSTRM("Could not start call " << i));
+  }
+
+  // Let the calls settle down
+  PThread::Sleep(3000);
+
+  if ((unsigned)callee.m_manager.GetCallCount() != calls)
+    Fail(PSTRSTRM("Only " << callee.m_manager.GetCallCount() << " of " << calls << " calls arrived"));
+
+  PUInt64 startPackets[2], startBytes[2], startTrunks[2], startMinis[2];
+  caller.GetCounts(startPackets[0], startBytes[0], startTrunks[0], startMinis[0]);
+  callee.GetCounts(startPackets[1], startBytes[1], startTrunks[1], startMinis[1]);
+
+  PTime start;
+  PThread::Sleep(duration);
+  PTimeInterval elapsed = PTime() - start;
+
+  PUInt64 endPackets[2], endBytes[2], endTrunks[2], endMinis[2];
+  caller.GetCounts(endPackets[0], endBytes[0], endTrunks[0], endMinis[0]);
+  callee.GetCounts(endPackets[1], endBytes[1], endTrunks[1], endMinis[1]);
+
+  /* A call sends a frame every 20ms, so without trunking that is the packet
+     rate per call. With trunking all calls share one packet per 20ms, so
+     allow plenty for control frames and still expect well under half. */
+  double seconds = elapsed.GetMilliSeconds()/1000.0;
+  double untrunkedRate = calls*50.0;
+  static const char * const Names[2] = { "Caller", "Callee" };
+  for (int i = 0; i < 2; ++i) {
+    PUInt64 packets = endPackets[i] - startPackets[i];
+    PUInt64 bytes = endBytes[i] - startBytes[i];
+    PUInt64 trunks = endTrunks[i] - startTrunks[i];
+    PUInt64 minis = endMinis[i] - startMinis[i];
+    cout << "  " << Names[i] << ": "
+         << fixed << setprecision(0) << packets/seconds << " packets/second, "
+         << setprecision(1) << bytes*8/seconds/1000 << " kbit/second (UDP payload), "
+         << trunks << " trunk frames carrying " << minis << " mini frames" << endl;
+
+    if (mode == IAX2EndPoint::TrunkEnabled) {
+      if (trunks == 0 || minis < trunks)
+        Fail(PSTRSTRM(Names[i] << " did not send media in trunk frames"));
+      else if (calls > 2 && packets/seconds > untrunkedRate/2)
+        Fail(PSTRSTRM(Names[i] << " trunking did not reduce the packet rate"));
+    }
+    else if (mode == IAX2EndPoint::TrunkDisabled && trunks != 0)
+      Fail(PSTRSTRM(Names[i] << " sent trunk frames with trunking disabled"));
+  }
+
+  OpalEventPool::Statistics stats;
+  caller.m_iax2->GetProcessorPool().GetStatistics(stats);
+  cout << "  Caller processor pool: " << stats << endl;
+  callee.m_iax2->GetProcessorPool().GetStatistics(stats);
+  cout << "  Callee processor pool: " << stats << endl;
+
+  caller.m_manager.ClearAllCalls();
+  callee.m_manager.ClearAllCalls();
+
+  if (GetTerminationValue() == 0)
+    cout << "All IAX2 trunk tests passed." << endl;
+}
+
+
+// End of File ///////////////////////////////////////////////////////////////
@@ -34,6 +34,7 @@
 #include <rtp/rtp.h>
 
 #include "main.h"
+#include <algorithm>
 #include "../../../version.h"
 
 
@@ -89,7 +90,7 @@ void JesterProcess::Main()
   args.Parse("a-audiodevice: audio device to play the output on\n"
              "D-start-delta: Start delta time between generator and playback (ms)\n"
              "d-drop. simulate dropped packets.\n"
-             "j-jitter: size of the jitter buffer in ms (100-1000)\n"
+             "j-jitter: size of the jitter buffer in ms (100-1000), may be repeated with -R\n"
              "r-rate: sample rate (default 8000Hz)\n"
              "g-generate: amount of jitter to simulate (see below)\n"
              "I-init-play-ts: Initial timestamp value for generator\n"
@@ -98,7 +99,13 @@ void JesterProcess::Main()
              "S-size: size of each RTP packet in ms\n"
              "m-marker. turn some of the marker bits off, that indicate speech bursts\n"
              "P-pcap: Read RTP data from PCAP file\n"
-             "R. Non real time test\n"
+             "-pcap-session: RTP session in PCAP file to use, default is to prompt\n"
+             "R. Non real time benchmark, using a virtual clock (see below)\n"
+             "T-duration: Duration of generated trace in seconds for -R (default 60)\n"
+             "L-loss: Random packet loss percentage for -R\n"
+             "-seed: Random number seed for generated trace for -R (default 1)\n"
+             "-type: Jitter buffer types for -R, comma separated \"audio\" and \"null\" (default audio)\n"
+             "-json. Output -R results in JSON\n"
              "v-version. report version and program info.\n"
              "w-wavfile: audio file from which the source data is read from\n"
              PTRACE_ARGLIST
@@ -110,6 +117,13 @@ void JesterProcess::Main()
             "jitter levels. e.g. \"0=30,16000=60,48000=120,64000=30\" would start at\n"
             "30ms, thena 2 seconds in generate 60ms of jitter, at 6 seconds 120ms,\n"
             "finally at 8 seconds back to 30ms for the remainder of the test.\n"
+            "\n"
+            "The -R benchmark replays the packets from the PCAP file, or generated\n"
+            "using the jitter profile, through each jitter buffer type, for each -j\n"
+            "value. No real time or audio device is used, so results are repeatable.\n"
+            "The -j value may have extra tuning parameters, e.g. 40-250:grow=20:shrink=5\n"
+            "where the parameter names are grow, shrink, shrink-period, silence-shrink,\n"
+            "silence-period, drift-period and overrun.\n"
             "\n";
     return;
   }
@@ -127,31 +141,6 @@ void JesterProcess::Main()
 
   m_sampleRate = args.GetOptionAs('r', 8000);
 
-  OpalJitterBuffer::Init init(OpalMediaType::Audio(), 50, 250, m_sampleRate/1000);
-
-  if (args.HasOption('j')) {
-    unsigned minJitterNew;
-    unsigned maxJitterNew;
-    PStringArray delays = args.GetOptionString('j').Tokenise(",-");
-
-    if (delays.GetSize() > 1) {
-      minJitterNew = delays[0].AsUnsigned();
-      maxJitterNew = delays[1].AsUnsigned();
-    } else {
-      maxJitterNew = delays[0].AsUnsigned();
-      minJitterNew = maxJitterNew;
-    }
-
-    if (minJitterNew >= 20 && minJitterNew <= maxJitterNew && maxJitterNew <= 1000) {
-      init.m_minJitterDelay = minJitterNew;
-      init.m_maxJitterDelay = maxJitterNew;
-    } else {
-      cerr << "Jitter should be between 20 milliseconds and 1 seconds, is "
-        << 20 << '-' << 1000 << endl;
-    }
-  } 
-  m_jitterBuffer.SetDelay(init);
-
   m_silenceSuppression = args.HasOption('s');
   m_dropPackets = args.HasOption('d');
   m_markerSuppression = args.HasOption('m');
@@ -171,6 +160,16 @@ void JesterProcess::Main()
     m_generateJitter[change[0].AsUnsigned()] = change[1].AsUnsigned();
   }
 
+  if (args.HasOption('R')) {
+    Benchmark(args);
+    return;
+  }
+
+  OpalJitterBuffer::Init init(OpalMediaType::Audio(), 50, 250, m_sampleRate/1000);
+  if (args.HasOption('j'))
+    ParseJitterDelay(args.GetOptionString('j').Lines()[0], init);
+  m_jitterBuffer.SetDelay(init);
+
   PString audioDevice = args.GetOptionString('a', PSoundChannel::GetDefaultDevice(PSoundChannel::Player));
   if (!m_player.Open(audioDevice, PSoundChannel::Player, 1, m_sampleRate)) {
     cerr << "Failed to open the sound device \"" << audioDevice 
@@ -184,28 +183,8 @@ void JesterProcess::Main()
   m_player.SetBuffers(m_bytesPerBlock, 160/(m_sampleRate/1000)/2);
 
   if (args.HasOption('P')) {
-    if (!m_pcap.Open(args.GetOptionString('P'))) {
-      cerr << "Could not open PCAP file \"" << args.GetOptionString('P') << '"' << endl;
+    if (!SelectPCAPSession(args))
       return;
-    }
-
-    cout << "Analysing PCAP file ... " << flush;
-    OpalPCAPFile::DiscoveredRTP discoveredRTP;
-    if (!m_pcap.DiscoverRTP(discoveredRTP)) {
-      cerr << "error: no RTP sessions found" << endl;
-      return;
-    }
-
-    cout << "\nSelect one of the following sessions:\n" << discoveredRTP << endl;
-    for (;;) {
-      cout << "Session? " << flush;
-      size_t session;
-      cin >> session;
-      if (m_pcap.SetFilters(discoveredRTP[session]))
-        break;
-      cout << "Session " << session << " is not valid" << endl;
-    }
-    cout << "\nPCAP file         : " << m_pcap.GetFilePath() << endl;
   }
   else {
     if (!m_wavFile.Open(args.GetOptionString('w', "../../callgen/ogm.wav"), PFile::ReadOnly)) {
@@ -223,81 +202,426 @@ void JesterProcess::Main()
 
   cout << "Jitter buffer size: " << init.m_minJitterDelay << ".." << init.m_maxJitterDelay << " timestamp units" << endl;
 
-  if (!args.HasOption('R'))
-    RealTimePlay();
-  else if (m_pcap.IsOpen())
-    NonRealTimePCAP();
-  else
-    NonRealTimeSimulation();
+  RealTimePlay();
 
   Report();
 }
 
 
-void JesterProcess::NonRealTimeSimulation()
+bool JesterProcess::ParseJitterDelay(const PString & spec, OpalJitterBuffer::Init & init)
 {
+  PStringArray params = spec.Tokenise(':');
+  if (params.IsEmpty())
+    return false;
+
+  unsigned minJitterNew;
+  unsigned maxJitterNew;
+  PStringArray delays = params[0].Tokenise(",-");
+
+  if (delays.GetSize() > 1) {
+    minJitterNew = delays[0].AsUnsigned();
+    maxJitterNew = delays[1].AsUnsigned();
+  } else {
+    maxJitterNew = delays[0].AsUnsigned();
+    minJitterNew = maxJitterNew;
+  }
+
+  if (minJitterNew < 20 || minJitterNew > maxJitterNew || maxJitterNew > 1000) {
+    cerr << "Jitter should be between 20 milliseconds and 1 seconds, is "
+         << minJitterNew << '-' << maxJitterNew << endl;
+    return false;
+  }
+
+  init.m_minJitterDelay = minJitterNew;
+  init.m_maxJitterDelay = maxJitterNew;
+  init.m_currentJitterDelay = minJitterNew;
+
+  for (PINDEX i = 1; i < params.GetSize(); ++i) {
+    PString key, value;
+    if (!params[i].Split('=', key, value)) {
+      cerr << "Illegal jitter buffer parameter \"" << params[i] << '"' << endl;
+      return false;
+    }
+
+    if (key == "grow")
+      init.m_jitterGrowTime = value.AsUnsigned();
+    else if (key == "shrink")
+      init.m_jitterShrinkTime = value.AsUnsigned();
+    else if (key == "shrink-period")
+      init.m_jitterShrinkPeriod = value.AsUnsigned();
+    else if (key == "silence-shrink")
+      init.m_silenceShrinkTime = value.AsUnsigned();
+    else if (key == "silence-period")
+      init.m_silenceShrinkPeriod = value.AsUnsigned();
+    else if (key == "drift-period")
+      init.m_jitterDriftPeriod = value.AsUnsigned();
+    else if (key == "overrun")
+      init.m_overrunFactor = value.AsUnsigned();
+    else {
+      cerr << "Unknown jitter buffer parameter \"" << key << '"' << endl;
+      return false;
+    }
+  }
+
+  return true;
 }
 
 
-void JesterProcess::NonRealTimePCAP()
+bool JesterProcess::SelectPCAPSession(PArgList & args)
 {
-  PTimeInterval genTick = m_startTimeDelta;
-  PTimeInterval outTick;
-  PINDEX lastReadTimeDelta = 80;
-  while (m_pcap.IsOpen() ? !m_pcap.IsEndOfFile() : (m_generateSequenceNumber < m_maxSequenceNumber)) {
-    RTP_DataFrame writeFrame;
-    PTimeInterval delay;
-    bool gotFrame = GenerateFrame(writeFrame, delay);
-    genTick += delay;
+  if (!m_pcap.Open(args.GetOptionString('P'))) {
+    cerr << "Could not open PCAP file \"" << args.GetOptionString('P') << '"' << endl;
+    return false;
+  }
 
-    while (outTick <= genTick) {
-      RTP_DataFrame readFrame(m_bytesPerBlock);
-      readFrame.SetTimestamp(m_playbackTimestamp);
-      if (!m_jitterBuffer.ReadData(readFrame, 0, outTick))
+  cerr << "Analysing PCAP file ... " << flush;
+  OpalPCAPFile::DiscoveredRTP discoveredRTP;
+  if (!m_pcap.DiscoverRTP(discoveredRTP)) {
+    cerr << "error: no RTP sessions found" << endl;
+    return false;
+  }
+
+  if (args.HasOption("pcap-session")) {
+    size_t session = args.GetOptionAs("pcap-session", 0U);
+    if (session >= discoveredRTP.size() || !m_pcap.SetFilters(discoveredRTP[session])) {
+      cerr << "\nSession " << session << " is not valid, available sessions:\n" << discoveredRTP << endl;
+      return false;
+    }
+  }
+  else {
+    cout << "\nSelect one of the following sessions:\n" << discoveredRTP << endl;
+    for (;;) {
+      cout << "Session? " << flush;
+      size_t session;
+      cin >> session;
+      if (m_pcap.SetFilters(discoveredRTP[session]))
         break;
+      cout << "Session " << session << " is not valid" << endl;
+    }
+  }
+
+  cerr << "\nPCAP file         : " << m_pcap.GetFilePath() << endl;
+  return true;
+}
+
+
+// Start virtual clock well away from zero, jitter buffer treats zero tick specially
+static const PTimeInterval TraceStartTick(0, 1);
+
+static RTP_Timestamp GetFrameSamples(const RTP_DataFrame & frame, RTP_Timestamp defaultSamples)
+{
+  PINDEX sz = frame.GetPayloadSize();
+  switch (frame.GetPayloadType()) {
+    case RTP_DataFrame::PCMA :
+    case RTP_DataFrame::PCMU :
+      return sz;
+    case RTP_DataFrame::G729 :
+      return sz/10*80;
+    case RTP_DataFrame::G723 :
+      return sz/24*240;
+    case RTP_DataFrame::L16_Mono :
+      return sz/2;
+    default :
+      return defaultSamples;
+  }
+}
+
+
+bool JesterProcess::BuildPCAPTrace(Trace & trace, unsigned & sent)
+{
+  PTime firstTime(0);
+  int64_t firstSequence = 0, lastSequence = 0;
+  RTP_SequenceNumber previousSequence = 0;
 
-      DWORD ts = readFrame.GetTimestamp();
-      PINDEX sz = readFrame.GetPayloadSize();
-      PTRACE(4, "Extracted frame : "
-                "ts=" << setw(8) << ts << " "
-                "tick=" << setw(7) << outTick << " "
-                "sz=" << sz);
-      if (sz == 0)
-        m_playbackTimestamp += lastReadTimeDelta;
+  while (!m_pcap.IsEndOfFile()) {
+    RTP_DataFrame rtp;
+    if (m_pcap.GetRTP(rtp) < 0)
+      continue;
+    rtp.MakeUnique();
+
+    if (!firstTime.IsValid()) {
+      firstTime = m_pcap.GetPacketTime();
+      previousSequence = rtp.GetSequenceNumber();
+    }
+
+    // Extend sequence number, allowing for wrap and out of order
+    lastSequence += (int16_t)(rtp.GetSequenceNumber() - previousSequence);
+    previousSequence = rtp.GetSequenceNumber();
+    if (firstSequence > lastSequence)
+      firstSequence = lastSequence;
+
+    trace.push_back(TraceEntry(TraceStartTick + (m_pcap.GetPacketTime() - firstTime), rtp));
+  }
+
+  sent = trace.empty() ? 0 : (unsigned)(lastSequence - firstSequence + 1);
+  return !trace.empty();
+}
+
+
+void JesterProcess::BuildModelTrace(Trace & trace, unsigned & sent, PTimeInterval duration, unsigned lossPercent, unsigned seed)
+{
+  PRandom rand(seed);
+
+  const RTP_Timestamp samplesPerPacket = m_bytesPerBlock/2;
+  const unsigned unitsPerMillisecond = m_sampleRate/1000;
+  const RTP_Timestamp endTimestamp = (RTP_Timestamp)(duration.GetMilliSeconds()*unitsPerMillisecond);
+
+  RTP_Timestamp talkBurstTimestamp = 0;
+  bool silent = true;
+  sent = 0;
+
+  for (RTP_Timestamp elapsed = 0; elapsed < endTimestamp; elapsed += samplesPerPacket) {
+    if (m_silenceSuppression) {
+      RTP_Timestamp inBurst = elapsed - talkBurstTimestamp;
+      if (!silent && inBurst > 10000*unitsPerMillisecond) {
+        silent = true;
+        talkBurstTimestamp = elapsed;
+      }
+      if (silent && elapsed > 0 && inBurst < 2000*unitsPerMillisecond)
+        continue;
+    }
+
+    bool marker = silent;
+    if (silent) {
+      talkBurstTimestamp = elapsed;
+      silent = false;
+    }
+
+    ++sent;
+    if ((m_dropPackets && sent%100 == 0) || (lossPercent > 0 && rand.Generate()%100 < lossPercent))
+      continue;
+
+    RTP_DataFrame frame(m_bytesPerBlock);
+    frame.SetPayloadType(RTP_DataFrame::L16_Mono);
+    frame.SetSyncSource(0x4a455354);
+    frame.SetSequenceNumber((RTP_SequenceNumber)sent);
+    frame.SetTimestamp(m_generateTimestamp + elapsed);
+    frame.SetMarker(marker && (!m_markerSuppression || (sent&1) == 0));
+
+    JitterProfileMap::const_iterator it = m_generateJitter.upper_bound(elapsed);
+    --it;
+    PTimeInterval sendTime(elapsed/unitsPerMillisecond);
+    PTimeInterval jitter(it->second > 0 ? rand.Generate()%(it->second+1) : 0);
+    trace.push_back(TraceEntry(TraceStartTick + sendTime + jitter, frame));
+  }
+
+  // Order of arrival, not sending
+  struct ByArrival {
+    bool operator()(const TraceEntry & a, const TraceEntry & b) const { return a.m_arrival < b.m_arrival; }
+  };
+  std::stable_sort(trace.begin(), trace.end(), ByArrival());
+}
+
+
+void JesterProcess::Benchmark(PArgList & args)
+{
+  bool json = args.HasOption("json");
+  ostream & info = json ? cerr : cout;
+
+  Trace trace;
+  unsigned sent;
+  if (args.HasOption('P')) {
+    if (!SelectPCAPSession(args))
+      return;
+    if (!BuildPCAPTrace(trace, sent)) {
+      cerr << "No RTP packets in PCAP file" << endl;
+      return;
+    }
+    info << "Replaying " << trace.size() << " packets from " << m_pcap.GetFilePath() << endl;
+  }
+  else {
+    BuildModelTrace(trace, sent,
+                    PTimeInterval(0, args.GetOptionAs('T', 60U)),
+                    args.GetOptionAs('L', 0U),
+                    args.GetOptionAs("seed", 1U));
+    if (trace.empty()) {
+      cerr << "No packets generated" << endl;
+      return;
+    }
+    info << "Generated " << sent << " packets of " << m_bytesPerBlock << " bytes,"
+            " jitter " << m_generateJitter << "ms,"
+            " arrived " << trace.size() << endl;
+  }
+
+  PStringArray tunings = args.HasOption('j') ? args.GetOptionString('j').Lines() : PStringArray(PString("50-250"));
+  PStringArray types = args.GetOptionString("type", "audio").Tokenise(",", false);
+
+  if (json)
+    cout << "{\n"
+            "  \"source\": \"" << (m_pcap.IsOpen() ? m_pcap.GetFilePath().GetFileName() : PString("model")) << "\",\n"
+            "  \"packets\": " << sent << ",\n"
+            "  \"results\": [";
+
+  bool first = true;
+  for (PINDEX t = 0; t < types.GetSize(); ++t) {
+    for (PINDEX j = 0; j < tunings.GetSize(); ++j) {
+      OpalJitterBuffer::Init init(OpalMediaType::Audio(), 50, 250, m_sampleRate/1000);
+      if (!ParseJitterDelay(tunings[j], init))
+        continue;
+
+      OpalJitterBuffer * jitterBuffer;
+      if (types[t] == "audio")
+        jitterBuffer = new OpalAudioJitterBuffer(init);
+      else if (types[t] == "null")
+        jitterBuffer = new OpalNonJitterBuffer(init);
       else {
-        switch (readFrame.GetPayloadType()) {
-          case RTP_DataFrame::PCMA :
-          case RTP_DataFrame::PCMU :
-            lastReadTimeDelta = sz;
-            break;
-          case RTP_DataFrame::G729 :
-            lastReadTimeDelta = sz/10*80;
-            break;
-          case RTP_DataFrame::G723 :
-            lastReadTimeDelta = sz/24*240;
-            break;
-          default :
-            lastReadTimeDelta = 160;
-        }
-        m_playbackTimestamp = ts + lastReadTimeDelta;
+        cerr << "Unknown jitter buffer type \"" << types[t] << '"' << endl;
+        continue;
       }
-      outTick += lastReadTimeDelta/(m_sampleRate/1000);
-#if 0
-      static unsigned adjust = 0;
-      outTick -= ++adjust % 3 > 0;
-#endif
+
+      Results results;
+      results.m_type = types[t];
+      results.m_tuning = tunings[j];
+      results.m_sent = sent;
+      Replay(trace, *jitterBuffer, results);
+      delete jitterBuffer;
+
+      if (!json)
+        results.PrintText(cout);
+      else {
+        if (!first)
+          cout << ',';
+        results.PrintJSON(cout);
+      }
+      first = false;
     }
+  }
 
-    if (gotFrame) {
-      DWORD ts = writeFrame.GetTimestamp();
-      PTRACE(4, "Inserting frame : "
-                "ts=" << setw(8) << ts << " "
-                "tick=" << setw(7) << genTick << " "
-                "(" << PTimeInterval(ts/(m_sampleRate/1000)) << ')');
-      if (!m_jitterBuffer.WriteData(writeFrame, genTick))
-        break;
+  if (json)
+    cout << "\n  ]\n"
+            "}" << endl;
+}
+
+
+void JesterProcess::Replay(const Trace & trace, OpalJitterBuffer & jitterBuffer, Results & results)
+{
+  const unsigned unitsPerMillisecond = m_sampleRate/1000;
+  const RTP_Timestamp defaultSamples = m_pcap.IsOpen() ? 160 : m_bytesPerBlock/2;
+  const RTP_Timestamp periodSamples = GetFrameSamples(trace.front().m_frame, defaultSamples);
+  const PTimeInterval period(periodSamples/unitsPerMillisecond);
+
+  std::map<RTP_Timestamp, PTimeInterval> arrivals;
+  for (Trace::const_iterator it = trace.begin(); it != trace.end(); ++it)
+    arrivals[it->m_frame.GetTimestamp()] = it->m_arrival;
+
+  std::vector<PInt64> delays;
+  delays.reserve(trace.size());
+
+  PTimeInterval outTick = trace.front().m_arrival + m_startTimeDelta;
+  PTimeInterval endTick = trace.back().m_arrival + jitterBuffer.GetMaxJitterDelay()/unitsPerMillisecond + 1000;
+  RTP_Timestamp playbackTimestamp = m_playbackTimestamp;
+  size_t index = 0;
+  RTP_DataFrame readFrame((PINDEX)0, m_bytesPerBlock);
+
+  PTime startTime;
+
+  while (outTick <= endTick) {
+    while (index < trace.size() && trace[index].m_arrival <= outTick) {
+      jitterBuffer.WriteData(trace[index].m_frame, trace[index].m_arrival);
+      ++results.m_arrived;
+      ++index;
     }
+
+    readFrame.SetTimestamp(playbackTimestamp);
+    jitterBuffer.ReadData(readFrame, 0 PTRACE_PARAM(, outTick));
+
+    if (readFrame.GetPayloadSize() == 0) {
+      ++results.m_silentReads;
+      playbackTimestamp += periodSamples;
+    }
+    else {
+      RTP_Timestamp ts = readFrame.GetTimestamp();
+      std::map<RTP_Timestamp, PTimeInterval>::iterator arrival = arrivals.find(ts);
+      if (arrival != arrivals.end())
+        delays.push_back((outTick - arrival->second).GetMilliSeconds());
+      ++results.m_played;
+      playbackTimestamp = ts + GetFrameSamples(readFrame, defaultSamples);
+    }
+
+    outTick += period;
   }
+
+  PInt64 elapsed = (PTime() - startTime).GetMicroSeconds();
+
+  results.m_cpuPerPacket = (double)elapsed/std::max(results.m_arrived, 1U);
+  results.m_tooLate = jitterBuffer.GetPacketsTooLate();
+  results.m_overruns = jitterBuffer.GetBufferOverruns();
+  results.m_finalJitterDelay = jitterBuffer.GetCurrentJitterDelay()/unitsPerMillisecond;
+
+  if (!delays.empty()) {
+    PInt64 total = 0;
+    for (size_t i = 0; i < delays.size(); ++i)
+      total += delays[i];
+    results.m_meanDelay = (double)total/delays.size();
+
+    std::sort(delays.begin(), delays.end());
+    results.m_p50Delay = delays[delays.size()/2];
+    results.m_p95Delay = delays[delays.size()*95/100];
+    results.m_p99Delay = delays[delays.size()*99/100];
+    results.m_maxDelay = delays.back();
+  }
+}
+
+
+JesterProcess::Results::Results()
+  : m_sent(0)
+  , m_arrived(0)
+  , m_played(0)
+  , m_tooLate(0)
+  , m_overruns(0)
+  , m_silentReads(0)
+  , m_meanDelay(0)
+  , m_p50Delay(0)
+  , m_p95Delay(0)
+  , m_p99Delay(0)
+  , m_maxDelay(0)
+  , m_finalJitterDelay(0)
+  , m_cpuPerPacket(0)
+{
+}
+
+
+void JesterProcess::Results::PrintText(ostream & strm) const
+{
+  strm << m_type << ' ' << m_tuning << ":\n"
+          "  Packets sent/arrived/played = " << m_sent << '/' << m_arrived << '/' << m_played << "\n"
+          "  Lost in network             = " << GetLost() << "\n"
+          "  Discarded by jitter buffer  = " << GetDiscarded() << "\n"
+          "  Too late/overrun count      = " << m_tooLate << '/' << m_overruns << "\n"
+          "  Silent reads                = " << m_silentReads << "\n"
+       << fixed << setprecision(1) <<
+          "  Added delay mean            = " << m_meanDelay << "ms\n"
+          "  Added delay p50/p95/p99/max = " << m_p50Delay << '/' << m_p95Delay << '/' << m_p99Delay << '/' << m_maxDelay << "ms\n"
+          "  Final jitter delay          = " << m_finalJitterDelay << "ms\n"
+       << setprecision(3) <<
+          "  CPU per packet              = " << m_cpuPerPacket << "us\n"
+       << endl;
+}
+
+
+void JesterProcess::Results::PrintJSON(ostream & strm) const
+{
+  strm << "\n    {"
+          " \"type\": \"" << m_type << "\","
+          " \"tuning\": \"" << m_tuning << "\","
+          " \"sent\": " << m_sent << ","
+          " \"arrived\": " << m_arrived << ","
+          " \"played\": " << m_played << ","
+          " \"lost\": " << GetLost() << ","
+          " \"discarded\": " << GetDiscarded() << ","
+          " \"too_late\": " << m_tooLate << ","
+          " \"overruns\": " << m_overruns << ","
+          " \"silent_reads\": " << m_silentReads << ","
+       << fixed << setprecision(1) <<
+          " \"delay_mean_ms\": " << m_meanDelay << ","
+          " \"delay_p50_ms\": " << m_p50Delay << ","
+          " \"delay_p95_ms\": " << m_p95Delay << ","
+          " \"delay_p99_ms\": " << m_p99Delay << ","
+          " \"delay_max_ms\": " << m_maxDelay << ","
+          " \"final_jitter_delay_ms\": " << m_finalJitterDelay << ","
+       << setprecision(3) <<
+          " \"cpu_us_per_packet\": " << m_cpuPerPacket
+       << " }";
 }
 
 
@@ -73,10 +73,54 @@ class JesterProcess : public PProcess
     void Main();
 
   protected:
-    void NonRealTimeSimulation();
-    void NonRealTimePCAP();
+    bool ParseJitterDelay(const PString & spec, OpalJitterBuffer::Init & init);
+    bool SelectPCAPSession(PArgList & args);
     void RealTimePlay();
 
+    /**A packet as received from the network, at a virtual time. */
+    struct TraceEntry
+    {
+      TraceEntry(const PTimeInterval & arrival, const RTP_DataFrame & frame)
+        : m_arrival(arrival), m_frame(frame) { }
+
+      PTimeInterval m_arrival;
+      RTP_DataFrame m_frame;
+    };
+    typedef std::vector<TraceEntry> Trace;
+
+    /**Results of replaying a trace through one jitter buffer. */
+    struct Results
+    {
+      Results();
+      void PrintText(ostream & strm) const;
+      void PrintJSON(ostream & strm) const;
+      unsigned GetLost() const { return m_sent > m_arrived ? m_sent - m_arrived : 0; }
+      unsigned GetDiscarded() const { return m_arrived > m_played ? m_arrived - m_played : 0; }
+
+      PString  m_type;
+      PString  m_tuning;
+      unsigned m_sent;          ///< Packets sent, including those lost in network
+      unsigned m_arrived;       ///< Packets written to jitter buffer
+      unsigned m_played;        ///< Packets read from jitter buffer
+      unsigned m_tooLate;       ///< From jitter buffer
+      unsigned m_overruns;      ///< From jitter buffer
+      unsigned m_silentReads;   ///< Reads that returned no audio
+      double   m_meanDelay;     ///< Added delay, arrival to play out, ms
+      PInt64   m_p50Delay;
+      PInt64   m_p95Delay;
+      PInt64   m_p99Delay;
+      PInt64   m_maxDelay;
+      unsigned m_finalJitterDelay; ///< Jitter buffer delay at end, ms
+      double   m_cpuPerPacket;  ///< Microseconds in jitter buffer per packet
+    };
+
+    /**Non real time benchmark, replaying a trace using a virtual clock, for
+       each jitter buffer type and tuning. */
+    void Benchmark(PArgList & args);
+    bool BuildPCAPTrace(Trace & trace, unsigned & sent);
+    void BuildModelTrace(Trace & trace, unsigned & sent, PTimeInterval duration, unsigned lossPercent, unsigned seed);
+    void Replay(const Trace & trace, OpalJitterBuffer & jitterBuffer, Results & results);
+
     /**Generate the Udp packets that we could have read from the internet. In
        other words, place packets in the jitter buffer. */
     void GeneratePackets();
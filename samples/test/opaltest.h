@@ -0,0 +1,79 @@
+/*
+ * opaltest.h
+ *
+ * Common scaffolding for the OPAL test and benchmark programs
+ *
+ * Copyright (c) 2021 Vox Lucida Pty. Ltd.
+ *
+ * The contents of this file are subject to the Mozilla Public License
+ * Version 1.0 (the "License"); you may not use this file except in
+ * compliance with the License. You may obtain a copy of the License at
+ * http://www.mozilla.org/MPL/
+ *
+ * Software distributed under the License is distributed on an "AS IS"
+ * basis, WITHOUT WARRANTY OF ANY KIND, either express or implied. See
+ * the License for the specific language governing rights and limitations
+ * under the License.
+ *
+ * The Original Code is Open Phone Abstraction Library.
+ *
+ * The Initial Developer of the Original Code is Vox Lucida Pty. Ltd.
+ *
+ * Contributor(s): ______________________________________.
+ *
+ */
+
+#ifndef OPAL_SAMPLES_TEST_OPALTEST_H
+#define OPAL_SAMPLES_TEST_OPALTEST_H
+
+#include <ptlib.h>
+#include <opal_config.h>
+
+
+/**Base process for the test programs, so they need only supply Main().
+   A test that fails should call Fail(), which sets a non-zero exit code so
+   "make check" stops.
+  */
+class OpalTestProcess : public PProcess
+{
+    PCLASSINFO(OpalTestProcess, PProcess)
+  public:
+    OpalTestProcess(const char * name)
+      : PProcess("Open Phone Abstraction Library", name, OPAL_MAJOR, OPAL_MINOR, ReleaseCode, OPAL_PATCH, false, false, OPAL_OEM)
+    {
+    }
+
+  protected:
+    /**Parse the command line with the standard trace and help options added
+       to those supplied, and initialise tracing. Returns false, having
+       displayed usage, if the options are wrong or help was asked for.
+      */
+    bool ParseArguments(
+      const char * options,                     ///< Test specific options, as for PArgList::Parse()
+      const char * usage = "[ options ]",       ///< Usage text for parameters
+      PINDEX minParameters = 0                  ///< Minimum number of non-option parameters
+    ) {
+      PArgList & args = GetArguments();
+      args.Parse(PSTRSTRM("[Options:]" << options << PTRACE_ARGLIST "h-help."), false);
+      if (!args.IsParsed() || args.HasOption('h') || args.GetCount() < minParameters) {
+        args.Usage(cerr, usage);
+        return false;
+      }
+
+      PTRACE_INITIALISE(args);
+      return true;
+    }
+
+    /// Report a failure and set the exit code.
+    void Fail(const PString & msg)
+    {
+      cerr << msg << endl;
+      SetTerminationValue(1);
+    }
+};
+
+
+#endif // OPAL_SAMPLES_TEST_OPALTEST_H
+
+
+// End of File ///////////////////////////////////////////////////////////////
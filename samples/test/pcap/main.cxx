@@ -0,0 +1,267 @@
+/*
+ * main.cxx
+ *
+ * OPAL PCAP/PCAPNG file discovery and decode test
+ *
+ * Copyright (c) 2021 Vox Lucida Pty. Ltd.
+ *
+ * The contents of this file are subject to the Mozilla Public License
+ * Version 1.0 (the "License"); you may not use this file except in
+ * compliance with the License. You may obtain a copy of the License at
+ * http://www.mozilla.org/MPL/
+ *
+ * Software distributed under the License is distributed on an "AS IS"
+ * basis, WITHOUT WARRANTY OF ANY KIND, either express or implied. See
+ * the License for the specific language governing rights and limitations
+ * under the License.
+ *
+ * The Original Code is Open Phone Abstraction Library.
+ *
+ * The Initial Developer of the Original Code is Vox Lucida Pty. Ltd.
+ *
+ * Contributor(s): ______________________________________.
+ *
+ */
+
+#include "../opaltest.h"
+
+#include <rtp/pcapfile.h>
+
+
+static const unsigned NumStreams       = 2;
+static const unsigned PacketsPerStream = 500;
+static const PINDEX   PayloadSize      = 160;
+
+static const RTP_SyncSourceId FirstSSRC = 0x1000;
+static const WORD             FirstPort = 5000;
+
+
+class PCAPTest : public OpalTestProcess
+{
+    PCLASSINFO(PCAPTest, OpalTestProcess)
+  public:
+    PCAPTest();
+
+    virtual void Main();
+
+  protected:
+    bool CreateClassic(const PFilePath & path);
+    bool CreateNextGen(const PFilePath & path);
+    void CheckFile(const PFilePath & path);
+    void CheckStreams(const OpalPCAPFile::DiscoveredRTP & streams, const char * how);
+
+    PDECLARE_NOTIFIER2(OpalPCAPFile, PCAPTest, OnProgress, OpalPCAPFile::Progress &);
+    PDECLARE_NOTIFIER2(OpalPCAPFile, PCAPTest, OnDecoded, OpalPCAPFile::DecodedRTP &);
+
+    unsigned              m_progressPackets;
+    std::vector<unsigned> m_decoded;
+};
+
+
+PCREATE_PROCESS(PCAPTest);
+
+
+PCAPTest::PCAPTest()
+  : OpalTestProcess("PCAP Test")
+  , m_progressPackets(0)
+{
+}
+
+
+void PCAPTest::Main()
+{
+  if (!ParseArguments("k-keep. Do not delete the generated capture files\n", "[ options ] [ directory ]"))
+    return;
+
+  PArgList & args = GetArguments();
+  PDirectory dir = args.GetCount() > 0 ? PDirectory(args[0]) : PDirectory::GetTemporary();
+
+  PFilePath classic = dir + "opaltest.pcap";
+  if (CreateClassic(classic))
+    CheckFile(classic);
+
+  PFilePath nextGen = dir + "opaltest.pcapng";
+  if (CreateNextGen(nextGen))
+    CheckFile(nextGen);
+
+  if (!args.HasOption('k')) {
+    PFile::Remove(classic);
+    PFile::Remove(nextGen);
+  }
+
+  if (GetTerminationValue() == 0)
+    cout << "All PCAP tests passed." << endl;
+}
+
+
+/* Two G.711 streams, interleaved, on different ports. The second starts
+   just before the sequence number wraps. */
+static RTP_DataFrame MakeRTP(unsigned stream, unsigned index)
+{
+  RTP_DataFrame rtp(PayloadSize);
+  rtp.SetPayloadType(stream == 0 ? RTP_DataFrame::PCMU : RTP_DataFrame::PCMA);
+  rtp.SetSequenceNumber((RTP_SequenceNumber)((stream == 0 ? 1000 : 65400) + index));
+  rtp.SetTimestamp(index*PayloadSize);
+  rtp.SetSyncSource(FirstSSRC + stream);
+  memset(rtp.GetPayloadPtr(), stream == 0 ? 0xff : 0xd5, PayloadSize); // Silence
+  return rtp;
+}
+
+
+bool PCAPTest::CreateClassic(const PFilePath & path)
+{
+  OpalPCAPFile pcap;
+  pcap.SetFilterSrcIP(PIPAddress("10.0.0.1"));
+  pcap.SetFilterDstIP(PIPAddress("10.0.0.2"));
+  if (!pcap.Open(path, PFile::WriteOnly)) {
+    Fail(PSTRSTRM("Could not create " << path));
+    return false;
+  }
+
+  for (unsigned i = 0; i < PacketsPerStream; ++i) {
+    for (unsigned stream = 0; stream < NumStreams; ++stream) {
+      if (!pcap.WriteRTP(MakeRTP(stream, i), (WORD)(FirstPort + stream*2))) {
+        Fail(PSTRSTRM("Could not write " << path));
+        return false;
+      }
+    }
+  }
+
+  return true;
+}
+
+
+bool PCAPTest::CreateNextGen(const PFilePath & path)
+{
+  PFile file;
+  if (!file.Open(path, PFile::WriteOnly)) {
+    Fail(PSTRSTRM("Could not create " << path));
+    return false;
+  }
+
+  // Section header, version 1.0, unknown section length
+  static const DWORD SectionHeader[] = { 0x0a0d0d0a, 28, 0x1a2b3c4d, 0x00000001, 0xffffffff, 0xffffffff, 28 };
+  // Ethernet interface, 65535 byte snap length, default microsecond timestamps
+  static const DWORD Interface[] = { 1, 20, 1, 65535, 20 };
+  // A block type nobody knows, which must be skipped
+  static const DWORD Unknown[] = { 0x0bad, 16, 0x12345678, 16 };
+
+  bool ok = file.Write(SectionHeader, sizeof(SectionHeader)) &&
+            file.Write(Interface, sizeof(Interface)) &&
+            file.Write(Unknown, sizeof(Unknown));
+
+  uint64_t timestamp = 1600000000000000ULL;
+  for (unsigned i = 0; ok && i < PacketsPerStream; ++i) {
+    for (unsigned stream = 0; ok && stream < NumStreams; ++stream) {
+      RTP_DataFrame rtp = MakeRTP(stream, i);
+      PEthSocket::Frame frame;
+      memcpy(frame.CreateUDP(PIPSocketAddressAndPort(PIPAddress("10.0.0.1"), (WORD)(FirstPort + stream*2)),
+                             PIPSocketAddressAndPort(PIPAddress("10.0.0.2"), (WORD)(FirstPort + stream*2)),
+                             rtp.GetPacketSize()),
+             rtp, rtp.GetPacketSize());
+
+      DWORD captured = frame.GetSize();
+      DWORD padding = ((captured + 3) & ~3) - captured;
+      DWORD length = 32 + captured + padding;
+      DWORD header[] = { 6, length, 0, (DWORD)(timestamp >> 32), (DWORD)timestamp, captured, captured };
+      static const BYTE Zeros[3] = { 0 };
+
+      ok = file.Write(header, sizeof(header)) &&
+           frame.Write(file) &&
+           (padding == 0 || file.Write(Zeros, padding)) &&
+           file.Write(&length, sizeof(length));
+
+      timestamp += 10000;
+    }
+  }
+
+  if (!ok)
+    Fail(PSTRSTRM("Could not write " << path));
+  return ok;
+}
+
+
+void PCAPTest::CheckFile(const PFilePath & path)
+{
+  OpalPCAPFile pcap;
+  if (!pcap.Open(path, PFile::ReadOnly)) {
+    Fail(PSTRSTRM("Could not open " << path));
+    return;
+  }
+
+  cout << "Checking " << pcap << (pcap.IsMapped() ? ", mapped" : ", not mapped") << endl;
+
+  unsigned count = 0;
+  while (!pcap.IsEndOfFile()) {
+    RTP_DataFrame rtp;
+    if (pcap.GetRTP(rtp) >= 0)
+      ++count;
+  }
+  if (count != NumStreams*PacketsPerStream)
+    Fail(PSTRSTRM("Read " << count << " RTP packets from " << path << ", expected " << NumStreams*PacketsPerStream));
+
+  OpalPCAPFile::DiscoveredRTP whole;
+  if (pcap.DiscoverRTP(whole, NULL, 1))
+    CheckStreams(whole, "single chunk");
+  else
+    Fail("Discovery in a single chunk failed");
+
+  /* Chunks are ended at the first record boundary after this size, and an
+     odd size means the limit falls in the middle of most packets. The per
+     chunk results must then be merged to give the same answer as above. */
+  pcap.SetDiscoveryChunkSize(1001);
+  m_progressPackets = 0;
+  OpalPCAPFile::DiscoveredRTP chunked;
+  if (!pcap.DiscoverRTP(chunked, PCREATE_NOTIFIER(OnProgress), 4)) {
+    Fail("Discovery in small chunks failed");
+    return;
+  }
+  CheckStreams(chunked, "small chunks");
+  if (pcap.IsMapped() && m_progressPackets != NumStreams*PacketsPerStream)
+    Fail(PSTRSTRM("Progress reported " << m_progressPackets << " packets, expected " << NumStreams*PacketsPerStream));
+
+  m_decoded.assign(chunked.GetSize(), 0);
+  if (!pcap.DecodeStreams(chunked, PCREATE_NOTIFIER(OnDecoded))) {
+    Fail("Decode of streams failed");
+    return;
+  }
+  for (PINDEX i = 0; i < chunked.GetSize(); ++i) {
+    if (m_decoded[i] != PacketsPerStream)
+      Fail(PSTRSTRM("Decoded " << m_decoded[i] << " packets from " << chunked[i] << ", expected " << PacketsPerStream));
+  }
+}
+
+
+void PCAPTest::CheckStreams(const OpalPCAPFile::DiscoveredRTP & streams, const char * how)
+{
+  if (streams.GetSize() != NumStreams) {
+    Fail(PSTRSTRM("Discovered " << streams.GetSize() << " streams in " << how << ", expected " << NumStreams));
+    return;
+  }
+
+  for (PINDEX i = 0; i < streams.GetSize(); ++i) {
+    const OpalPCAPFile::DiscoveredRTPInfo & info = streams[i];
+    unsigned stream = info.m_ssrc - FirstSSRC;
+    if (stream >= NumStreams ||
+        info.m_src.GetPort() != FirstPort + stream*2 ||
+        info.m_payloadType != (stream == 0 ? RTP_DataFrame::PCMU : RTP_DataFrame::PCMA) ||
+        info.m_packets != PacketsPerStream)
+      Fail(PSTRSTRM("Discovered wrong stream in " << how << ": " << info));
+  }
+}
+
+
+void PCAPTest::OnProgress(OpalPCAPFile &, OpalPCAPFile::Progress & progress)
+{
+  m_progressPackets = progress.m_packets;
+}
+
+
+void PCAPTest::OnDecoded(OpalPCAPFile &, OpalPCAPFile::DecodedRTP & decoded)
+{
+  // Called from a thread per stream, so each only touches its own count
+  ++m_decoded[decoded.m_stream];
+}
+
+
+// End of File ///////////////////////////////////////////////////////////////
@@ -0,0 +1,269 @@
+/*
+ * main.cxx
+ *
+ * OPAL shared media port routing table test
+ *
+ * Copyright (c) 2021 Vox Lucida Pty. Ltd.
+ *
+ * The contents of this file are subject to the Mozilla Public License
+ * Version 1.0 (the "License"); you may not use this file except in
+ * compliance with the License. You may obtain a copy of the License at
+ * http://www.mozilla.org/MPL/
+ *
+ * Software distributed under the License is distributed on an "AS IS"
+ * basis, WITHOUT WARRANTY OF ANY KIND, either express or implied. See
+ * the License for the specific language governing rights and limitations
+ * under the License.
+ *
+ * The Original Code is Open Phone Abstraction Library.
+ *
+ * The Initial Developer of the Original Code is Vox Lucida Pty. Ltd.
+ *
+ * Contributor(s): ______________________________________.
+ *
+ */
+
+#include "../opaltest.h"
+
+#include <opal/manager.h>
+#include <rtp/rtpmux.h>
+
+
+typedef OpalMediaMuxListener::Key Key;
+
+
+// Exposes the table internals so the probe sequences can be checked
+class TestListener : public OpalMediaMuxListener
+{
+  public:
+    TestListener(OpalManager & manager, unsigned maxRoutes)
+      : OpalMediaMuxListener(manager, maxRoutes)
+    {
+    }
+
+    size_t GetHomeSlot(Key key) const { return GetSlotIndex(key); }
+    size_t GetTableSize() const { return m_tableMask+1; }
+
+    unsigned CountUsedSlots() const
+    {
+      unsigned count = 0;
+      for (size_t i = 0; i <= m_tableMask; ++i) {
+        if (m_table[i].m_key != EmptyKey)
+          ++count;
+      }
+      return count;
+    }
+};
+
+
+class CountingTarget : public OpalMediaMuxListener::Target
+{
+  public:
+    CountingTarget() : m_packets(0) { }
+
+    virtual void OnMuxData(OpalMediaMuxListener &, OpalMediaTransportChannelTypes::SubChannels,
+                           const PBYTEArray &, const PIPSocketAddressAndPort &, unsigned)
+    {
+      ++m_packets;
+    }
+
+    atomic<unsigned> m_packets;
+};
+
+
+// Holds the read thread inside OnMuxData() until released
+class BlockingTarget : public OpalMediaMuxListener::Target
+{
+  public:
+    BlockingTarget() : m_finished(false) { }
+
+    virtual void OnMuxData(OpalMediaMuxListener &, OpalMediaTransportChannelTypes::SubChannels,
+                           const PBYTEArray &, const PIPSocketAddressAndPort &, unsigned)
+    {
+      m_entered.Signal();
+      m_release.Wait();
+      m_finished = true;
+    }
+
+    PSyncPoint   m_entered;
+    PSyncPoint   m_release;
+    atomic<bool> m_finished;
+};
+
+
+class RTPMuxTest : public OpalTestProcess
+{
+    PCLASSINFO(RTPMuxTest, OpalTestProcess)
+  public:
+    RTPMuxTest();
+
+    virtual void Main();
+
+  protected:
+    void TestCollisions(TestListener & listener);
+    void TestCapacity(TestListener & listener);
+    void TestQuiescence(TestListener & listener);
+    bool Check(bool ok, const char * what);
+};
+
+
+PCREATE_PROCESS(RTPMuxTest);
+
+
+RTPMuxTest::RTPMuxTest()
+  : OpalTestProcess("Media Mux Test")
+{
+}
+
+
+void RTPMuxTest::Main()
+{
+  if (!ParseArguments("n-no-socket. Do not test dispatch on a loopback socket\n"))
+    return;
+
+  OpalManager manager;
+
+  {
+    // Eight routes, so a table of sixteen slots, small enough to collide
+    TestListener listener(manager, 8);
+    TestCollisions(listener);
+    TestCapacity(listener);
+  }
+
+  if (!GetArguments().HasOption('n')) {
+    TestListener listener(manager, 8);
+    TestQuiescence(listener);
+  }
+
+  if (GetTerminationValue() == 0)
+    cout << "All media mux tests passed." << endl;
+}
+
+
+bool RTPMuxTest::Check(bool ok, const char * what)
+{
+  if (!ok)
+    Fail(PSTRSTRM("Failed: " << what));
+  return ok;
+}
+
+
+void RTPMuxTest::TestCollisions(TestListener & listener)
+{
+  // Find three SSRC keys that all hash to the same home slot
+  Key keys[3];
+  keys[0] = OpalMediaMuxListener::MakeKey(OpalMediaMuxListener::e_SSRC, 1);
+  size_t home = listener.GetHomeSlot(keys[0]);
+  unsigned found = 1;
+  for (uint32_t ssrc = 2; found < 3; ++ssrc) {
+    Key key = OpalMediaMuxListener::MakeKey(OpalMediaMuxListener::e_SSRC, ssrc);
+    if (listener.GetHomeSlot(key) == home)
+      keys[found++] = key;
+  }
+
+  CountingTarget targets[3];
+  for (unsigned i = 0; i < 3; ++i)
+    Check(listener.AddRoute(keys[i], targets[i]), "add colliding route");
+
+  for (unsigned i = 0; i < 3; ++i)
+    Check(listener.FindRoute(keys[i]) == &targets[i], "find colliding route");
+
+  Check(!listener.AddRoute(keys[0], targets[1]), "add key used by other target is refused");
+  Check(listener.AddRoute(keys[0], targets[0]), "add key again for same target");
+  Check(!listener.RemoveRoute(keys[0], &targets[1]), "remove with wrong target is refused");
+  Check(listener.FindRoute(keys[0]) == &targets[0], "route kept after refused remove");
+  Check(listener.CountUsedSlots() == 3, "three slots used");
+
+  // Middle of probe sequence leaves a tombstone, last entry is still found past it
+  Check(listener.RemoveRoute(keys[1]), "remove middle route");
+  Check(listener.FindRoute(keys[1]) == NULL, "removed route not found");
+  Check(listener.FindRoute(keys[2]) == &targets[2], "find route past tombstone");
+  Check(listener.CountUsedSlots() == 3, "tombstone left in middle of sequence");
+
+  // Re-adding reuses the tombstone
+  Check(listener.AddRoute(keys[1], targets[1]), "re-add removed route");
+  Check(listener.FindRoute(keys[1]) == &targets[1], "find re-added route");
+  Check(listener.CountUsedSlots() == 3, "tombstone reused");
+
+  // Removing the end of the sequence reclaims it and the tombstone before it
+  Check(listener.RemoveRoute(keys[1]), "remove middle route again");
+  Check(listener.RemoveRoute(keys[2]), "remove last route");
+  Check(listener.CountUsedSlots() == 1, "tombstones reclaimed");
+  Check(listener.FindRoute(keys[0]) == &targets[0], "first route kept");
+
+  Check(listener.RemoveRoute(keys[0]), "remove first route");
+  Check(!listener.RemoveRoute(keys[0]), "remove missing route");
+  Check(listener.CountUsedSlots() == 0, "table empty");
+}
+
+
+void RTPMuxTest::TestCapacity(TestListener & listener)
+{
+  // Table is kept at most half full
+  size_t maxRoutes = listener.GetTableSize()/2;
+
+  CountingTarget target;
+  uint32_t ssrc = 1000;
+  for (size_t i = 0; i < maxRoutes; ++i)
+    Check(listener.AddRoute(OpalMediaMuxListener::MakeKey(OpalMediaMuxListener::e_SSRC, ssrc++), target), "fill table");
+  Check(!listener.AddRoute(OpalMediaMuxListener::MakeKey(OpalMediaMuxListener::e_SSRC, ssrc), target), "full table refuses route");
+
+  OpalMediaMuxListener::Statistics stats;
+  listener.GetStatistics(stats);
+  Check(stats.m_routes == maxRoutes, "route count when full");
+
+  while (ssrc-- > 1000)
+    Check(listener.RemoveRoute(OpalMediaMuxListener::MakeKey(OpalMediaMuxListener::e_SSRC, ssrc), &target), "empty table");
+
+  listener.GetStatistics(stats);
+  Check(stats.m_routes == 0, "route count when empty");
+  Check(listener.CountUsedSlots() == 0, "no tombstones left when empty");
+}
+
+
+void RTPMuxTest::TestQuiescence(TestListener & listener)
+{
+  if (!Check(listener.Open(PIPAddress::GetLoopback(), 0, 1), "open listener on loopback"))
+    return;
+
+  OpalMediaMuxListener::Epoch epoch;
+  listener.GetEpoch(epoch);
+  Check(listener.IsQuiescent(epoch), "quiescent when idle");
+
+  static const uint32_t SSRC = 0x12345678;
+  BlockingTarget target;
+  Key key = OpalMediaMuxListener::MakeKey(OpalMediaMuxListener::e_SSRC, SSRC);
+  Check(listener.AddRoute(key, target), "add SSRC route");
+
+  // Minimal RTP header, routed by SSRC as nothing matches the address
+  BYTE rtp[12];
+  memset(rtp, 0, sizeof(rtp));
+  rtp[0] = 0x80;
+  *(PUInt32b *)(rtp+8) = SSRC;
+
+  PUDPSocket sender;
+  sender.Listen(PIPAddress::GetLoopback());
+  if (!Check(sender.WriteTo(rtp, sizeof(rtp), listener.GetLocalAddress()), "send RTP to listener") ||
+      !Check(target.m_entered.Wait(5000), "read thread dispatched packet")) {
+    listener.Close();
+    return;
+  }
+
+  // This is what a transport does before it may be deleted
+  listener.RemoveRoute(key, &target);
+  listener.GetEpoch(epoch);
+  Check(!listener.IsQuiescent(epoch), "not quiescent while read thread is in target");
+
+  target.m_release.Signal();
+
+  PSimpleTimer timeout(0, 5);
+  while (!listener.IsQuiescent(epoch) && timeout.IsRunning())
+    PThread::Sleep(10);
+  Check(listener.IsQuiescent(epoch), "quiescent after read thread left target");
+  Check(target.m_finished, "target not released until dispatch completed");
+
+  listener.Close();
+}
+
+
+// End of File ///////////////////////////////////////////////////////////////
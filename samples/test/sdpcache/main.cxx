@@ -0,0 +1,173 @@
+/*
+ * main.cxx
+ *
+ * OPAL SDP offer decode and media format matching cache test and benchmark
+ *
+ * Copyright (c) 2021 Vox Lucida Pty. Ltd.
+ *
+ * The contents of this file are subject to the Mozilla Public License
+ * Version 1.0 (the "License"); you may not use this file except in
+ * compliance with the License. You may obtain a copy of the License at
+ * http://www.mozilla.org/MPL/
+ *
+ * Software distributed under the License is distributed on an "AS IS"
+ * basis, WITHOUT WARRANTY OF ANY KIND, either express or implied. See
+ * the License for the specific language governing rights and limitations
+ * under the License.
+ *
+ * The Original Code is Open Phone Abstraction Library.
+ *
+ * The Initial Developer of the Original Code is Vox Lucida Pty. Ltd.
+ *
+ * Contributor(s): ______________________________________.
+ *
+ */
+
+#include "../opaltest.h"
+
+#include <sdp/sdp.h>
+
+#include <algorithm>
+
+
+class SDPCacheTest : public OpalTestProcess
+{
+    PCLASSINFO(SDPCacheTest, OpalTestProcess)
+  public:
+    SDPCacheTest();
+
+    virtual void Main();
+
+  protected:
+    unsigned Compare(const std::vector<PString> & uncached, const std::vector<PString> & cached, const char * how);
+};
+
+
+PCREATE_PROCESS(SDPCacheTest);
+
+
+SDPCacheTest::SDPCacheTest()
+  : OpalTestProcess("SDP Cache Test")
+{
+}
+
+
+/* Typical carrier trunk offer, only addresses, ports and session id vary per
+   call, except every other call offers fewer telephone events, so there are
+   exactly two distinct media descriptions to cache. */
+static PString MakeOffer(unsigned call)
+{
+  PStringStream sdp;
+  sdp << "v=0\r\n"
+         "o=- " << (1000000 + call) << ' ' << (1000000 + call) << " IN IP4 10.1." << (call/250%250) << '.' << (call%250+1) << "\r\n"
+         "s=Trunk\r\n"
+         "c=IN IP4 10.1." << (call/250%250) << '.' << (call%250+1) << "\r\n"
+         "t=0 0\r\n"
+         "m=audio " << (10000 + (call%20000)*2) << " RTP/AVP 0 8 18 101\r\n"
+         "a=rtpmap:0 PCMU/8000\r\n"
+         "a=rtpmap:8 PCMA/8000\r\n"
+         "a=rtpmap:18 G729/8000\r\n"
+         "a=fmtp:18 annexb=no\r\n"
+         "a=rtpmap:101 telephone-event/8000\r\n"
+         "a=fmtp:101 0-" << (call%2 == 0 ? 16 : 15) << "\r\n"
+         "a=ptime:20\r\n"
+         "a=sendrecv\r\n";
+  return sdp;
+}
+
+
+static PString GetFormats(const SDPSessionDescription & sdp)
+{
+  PStringStream strm;
+  OpalMediaFormatList formats = sdp.GetMediaFormats();
+  for (OpalMediaFormatList::iterator it = formats.begin(); it != formats.end(); ++it) {
+    strm << *it << ':';
+    it->PrintOptions(strm);
+  }
+  return strm;
+}
+
+
+static PInt64 Decode(unsigned calls, const OpalMediaFormatList & localFormats, SDPMediaFormatCache * cache, std::vector<PString> & results)
+{
+  PTime start;
+  for (unsigned call = 0; call < calls; ++call) {
+    SDPSessionDescription sdp(0, 0, OpalTransportAddress());
+    sdp.SetFormatCache(cache);
+    sdp.Decode(MakeOffer(call), localFormats);
+    if (call < results.size())
+      results[call] = GetFormats(sdp);
+  }
+  return (PTime() - start).GetMicroSeconds();
+}
+
+
+void SDPCacheTest::Main()
+{
+  if (!ParseArguments("c-calls: Number of offers to decode, default 10000\n"
+                      "s-size: Cache size, default 1000\n"))
+    return;
+
+  PArgList & args = GetArguments();
+  unsigned calls = std::max(args.GetOptionAs('c', 10000U), 2U);
+
+  OpalMediaFormatList localFormats = OpalMediaFormat::GetAllRegisteredMediaFormats();
+  SDPMediaFormatCache cache(args.GetOptionAs('s', 1000));
+
+  // First few results compared to make sure cache does not change anything
+  std::vector<PString> uncachedResults(std::min(calls, 100U)), cachedResults(uncachedResults.size());
+
+  PInt64 uncachedTime = Decode(calls, localFormats, NULL, uncachedResults);
+  PInt64 cachedTime = Decode(calls, localFormats, &cache, cachedResults);
+  unsigned mismatches = Compare(uncachedResults, cachedResults, "cached");
+
+  SDPMediaFormatCache::Statistics stats;
+  cache.GetStatistics(stats);
+
+  cout << "Decoded " << calls << " offers against " << localFormats.GetSize() << " local formats"
+       << (mismatches == 0 ? ", results identical" : ", results DIFFERENT") << '\n'
+       << fixed << setprecision(1)
+       << "  Uncached: " << (double)uncachedTime/calls << "us/call, "
+       << calls*1000000.0/std::max(uncachedTime, (PInt64)1) << " calls/sec/core\n"
+       << "  Cached:   " << (double)cachedTime/calls << "us/call, "
+       << calls*1000000.0/std::max(cachedTime, (PInt64)1) << " calls/sec/core\n"
+       << "  Cache: entries=" << stats.m_entries << " hits=" << stats.m_hits << " misses=" << stats.m_misses
+       << endl;
+
+  if (cache.GetMaxSize() >= 2 && (stats.m_entries != 2 || stats.m_misses != 2 || stats.m_hits != calls-2))
+    Fail("Cache did not hold exactly the two distinct media descriptions");
+
+  // A single entry cache is evicted by every call, so must never hit, and still give the same answers
+  SDPMediaFormatCache tiny(1);
+  std::vector<PString> evictedResults(uncachedResults.size());
+  Decode(calls, localFormats, &tiny, evictedResults);
+  Compare(uncachedResults, evictedResults, "evicted");
+
+  tiny.GetStatistics(stats);
+  if (stats.m_entries != 1 || stats.m_hits != 0 || stats.m_misses != calls)
+    Fail(PSTRSTRM("Single entry cache: entries=" << stats.m_entries << " hits=" << stats.m_hits
+                  << " misses=" << stats.m_misses << ", expected 1, 0 and " << calls));
+
+  if (GetTerminationValue() == 0)
+    cout << "All SDP cache tests passed." << endl;
+}
+
+
+unsigned SDPCacheTest::Compare(const std::vector<PString> & uncached, const std::vector<PString> & cached, const char * how)
+{
+  unsigned mismatches = 0;
+  for (size_t i = 0; i < uncached.size(); ++i) {
+    if (uncached[i] != cached[i]) {
+      if (++mismatches < 5)
+        Fail(PSTRSTRM("Mismatch on call " << i << ":\n"
+                      "  uncached: " << uncached[i] << "\n"
+                      "  " << setw(10) << left << (PString(how) + ':') << cached[i]));
+    }
+  }
+  if (mismatches > 0)
+    Fail(PSTRSTRM(mismatches << " " << how << " results differ from uncached"));
+  return mismatches;
+}
+
+
+// End of File ///////////////////////////////////////////////////////////////
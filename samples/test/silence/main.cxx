@@ -0,0 +1,234 @@
+/*
+ * main.cxx
+ *
+ * OPAL audio level / silence detector test and benchmark
+ *
+ * Copyright (c) 2021 Vox Lucida Pty. Ltd.
+ *
+ * The contents of this file are subject to the Mozilla Public License
+ * Version 1.0 (the "License"); you may not use this file except in
+ * compliance with the License. You may obtain a copy of the License at
+ * http://www.mozilla.org/MPL/
+ *
+ * Software distributed under the License is distributed on an "AS IS"
+ * basis, WITHOUT WARRANTY OF ANY KIND, either express or implied. See
+ * the License for the specific language governing rights and limitations
+ * under the License.
+ *
+ * The Original Code is Open Phone Abstraction Library.
+ *
+ * The Initial Developer of the Original Code is Vox Lucida Pty. Ltd.
+ *
+ * Contributor(s): ______________________________________.
+ *
+ */
+
+#include "../opaltest.h"
+
+#include <ptclib/random.h>
+
+#include <codec/silencedetect.h>
+
+#include <cmath>
+
+
+class SilenceTest : public OpalTestProcess
+{
+    PCLASSINFO(SilenceTest, OpalTestProcess)
+  public:
+    SilenceTest() : OpalTestProcess("Silence Test") { }
+
+    virtual void Main();
+
+    bool TestEquivalence(unsigned iterations, unsigned frameSamples);
+    bool TestBatch(unsigned frameSamples, unsigned streams);
+    void Benchmark(unsigned frames, unsigned frameSamples, unsigned streams);
+};
+
+
+PCREATE_PROCESS(SilenceTest);
+
+
+void SilenceTest::Main()
+{
+  if (!ParseArguments("i-iterations: Number of random frames for equivalence test, default 100000\n"
+                      "f-frames: Number of frames for benchmark, zero for none, default 1000000\n"
+                      "s-samples: Samples per frame, default 160\n"
+                      "S-streams: Number of streams per batch, default 16\n"))
+    return;
+
+  PArgList & args = GetArguments();
+  unsigned frameSamples = args.GetOptionAs('s', 160U);
+  unsigned streams = std::max(args.GetOptionAs('S', 16U), 1U);
+
+  if (!TestEquivalence(args.GetOptionAs('i', 100000U), frameSamples))
+    Fail("Audio level calculation does not match reference");
+
+  if (!TestBatch(frameSamples, streams))
+    Fail("Batch audio level calculation does not match single stream");
+
+  unsigned frames = args.GetOptionAs('f', 1000000U);
+  if (frames > 0)
+    Benchmark(frames, frameSamples, streams);
+}
+
+
+// The original floating point implementation, as the reference
+static int ReferenceDB(const short * samples, PINDEX count)
+{
+  double rmsSum = 0;
+  for (PINDEX i = 0; i < count; ++i) {
+    double sample = (double)samples[i] / std::numeric_limits<short>::max();
+    rmsSum += sample * sample;
+  }
+
+  double rms = std::sqrt(rmsSum / count);
+  if (rms <= 0)
+    return OpalSilenceDetector::MinAudioLevel;
+
+  double db = 20 * std::log10(rms);
+  if (db < OpalSilenceDetector::MinAudioLevel)
+    return OpalSilenceDetector::MinAudioLevel;
+  if (db > OpalSilenceDetector::MaxAudioLevel)
+    return OpalSilenceDetector::MaxAudioLevel;
+  return (int)rint(db);
+}
+
+
+static void GenerateFrame(PRandom & rand, std::vector<short> & frame)
+{
+  // Spread amplitudes logarithmically so every dB level gets exercised
+  double amplitude = std::pow(10.0, -(rand.Generate() % 1400)/200.0) * 32768;
+  double phase = rand.Generate() % 1000;
+  bool noise = (rand.Generate() & 1) != 0;
+
+  for (size_t i = 0; i < frame.size(); ++i) {
+    double value = noise ? ((int)(rand.Generate() % 65536) - 32768)/32768.0 : std::sin((phase + i)/7.0);
+    value *= amplitude;
+    if (value > 32767)
+      value = 32767;
+    else if (value < -32768)
+      value = -32768;
+    frame[i] = (short)value;
+  }
+}
+
+
+bool SilenceTest::TestEquivalence(unsigned iterations, unsigned frameSamples)
+{
+  cout << "Equivalence test: " << iterations << " frames of " << frameSamples << " samples" << endl;
+
+  PRandom rand(1);
+  std::vector<short> frame(frameSamples);
+  OpalSilenceDetector::CalculateDB calculator;
+  unsigned mismatches = 0;
+
+  // Edge cases first: silence, full scale positive and negative
+  static const short EdgeValues[] = { 0, 32767, -32768, 1, -1 };
+  for (PINDEX e = 0; e < PARRAYSIZE(EdgeValues); ++e) {
+    std::fill(frame.begin(), frame.end(), EdgeValues[e]);
+    int expected = ReferenceDB(frame.data(), frameSamples);
+    int actual = calculator.Accumulate(frame.data(), frameSamples*sizeof(short)).Finalise();
+    if (expected != actual) {
+      cout << "  Mismatch on constant " << EdgeValues[e] << ": expected=" << expected << ", actual=" << actual << endl;
+      ++mismatches;
+    }
+  }
+
+  for (unsigned i = 0; i < iterations; ++i) {
+    GenerateFrame(rand, frame);
+
+    // Use odd lengths too, to exercise the scalar tail of the vector code
+    PINDEX count = frameSamples - (i % 8);
+    int expected = ReferenceDB(frame.data(), count);
+    int actual = calculator.Accumulate(frame.data(), count*sizeof(short)).Finalise();
+    if (expected != actual) {
+      if (++mismatches < 10)
+        cout << "  Mismatch on frame " << i << ": expected=" << expected << ", actual=" << actual << endl;
+    }
+  }
+
+  cout << "  " << (mismatches == 0 ? "Passed" : "FAILED") << ", " << mismatches << " mismatches" << endl;
+  return mismatches == 0;
+}
+
+
+bool SilenceTest::TestBatch(unsigned frameSamples, unsigned streams)
+{
+  cout << "Batch test: " << streams << " streams of " << frameSamples << " samples" << endl;
+
+  PRandom rand(3);
+  std::vector< std::vector<short> > pcm(streams, std::vector<short>(frameSamples));
+  std::vector<OpalSilenceDetector::CalculateDB::Block> blocks(streams);
+  for (unsigned s = 0; s < streams; ++s) {
+    GenerateFrame(rand, pcm[s]);
+    // Different lengths per stream, as the batch must not assume they match
+    blocks[s] = OpalSilenceDetector::CalculateDB::Block(pcm[s].data(), (frameSamples - s%8)*sizeof(short));
+  }
+
+  std::vector<int> levels(streams);
+  OpalSilenceDetector::CalculateDB::CalculateBatch(blocks.data(), streams, levels.data());
+
+  OpalSilenceDetector::CalculateDB calculator;
+  unsigned mismatches = 0;
+  for (unsigned s = 0; s < streams; ++s) {
+    int expected = calculator.Accumulate(pcm[s].data(), (frameSamples - s%8)*sizeof(short)).Finalise();
+    if (levels[s] != expected) {
+      cout << "  Mismatch on stream " << s << ": expected=" << expected << ", actual=" << levels[s] << endl;
+      ++mismatches;
+    }
+  }
+
+  cout << "  " << (mismatches == 0 ? "Passed" : "FAILED") << ", " << mismatches << " mismatches" << endl;
+  return mismatches == 0;
+}
+
+
+void SilenceTest::Benchmark(unsigned frames, unsigned frameSamples, unsigned streams)
+{
+  PRandom rand(2);
+  std::vector< std::vector<short> > pcm(streams, std::vector<short>(frameSamples));
+  for (unsigned s = 0; s < streams; ++s)
+    GenerateFrame(rand, pcm[s]);
+
+  int total = 0; // Prevent optimiser from removing calculations
+
+  PTime start;
+  for (unsigned i = 0; i < frames; ++i)
+    total += ReferenceDB(pcm[i % streams].data(), frameSamples);
+  PTimeInterval referenceTime = PTime() - start;
+
+  OpalSilenceDetector::CalculateDB calculator;
+  start.SetCurrentTime();
+  for (unsigned i = 0; i < frames; ++i)
+    total += calculator.Accumulate(pcm[i % streams].data(), frameSamples*sizeof(short)).Finalise();
+  PTimeInterval calculatorTime = PTime() - start;
+
+  std::vector<OpalSilenceDetector::CalculateDB::Block> blocks(streams);
+  for (unsigned s = 0; s < streams; ++s)
+    blocks[s] = OpalSilenceDetector::CalculateDB::Block(pcm[s].data(), frameSamples*sizeof(short));
+  std::vector<int> levels(streams);
+  start.SetCurrentTime();
+  for (unsigned i = 0; i < frames; i += streams) {
+    OpalSilenceDetector::CalculateDB::CalculateBatch(blocks.data(), streams, levels.data());
+    total += levels[0];
+  }
+  PTimeInterval batchTime = PTime() - start;
+
+  OpalPCM16SilenceDetector detector;
+  start.SetCurrentTime();
+  for (unsigned i = 0; i < frames; ++i)
+    total += detector.Detect((const BYTE *)pcm[i % streams].data(), frameSamples*sizeof(short), i*frameSamples, INT_MAX);
+  PTimeInterval detectorTime = PTime() - start;
+
+  cout << "Benchmark: " << frames << " frames of " << frameSamples << " samples, checksum " << total << "\n"
+       << fixed << setprecision(0)
+       << "  Reference:  " << frames*1000.0/std::max(referenceTime.GetMilliSeconds(), (PInt64)1) << " frames/sec/core\n"
+       << "  Calculator: " << frames*1000.0/std::max(calculatorTime.GetMilliSeconds(), (PInt64)1) << " frames/sec/core\n"
+       << "  Batch(" << streams << "):  " << frames*1000.0/std::max(batchTime.GetMilliSeconds(), (PInt64)1) << " frames/sec/core\n"
+       << "  Detector:   " << frames*1000.0/std::max(detectorTime.GetMilliSeconds(), (PInt64)1) << " frames/sec/core"
+       << endl;
+}
+
+
+// End of File ///////////////////////////////////////////////////////////////
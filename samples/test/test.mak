@@ -0,0 +1,38 @@
+#
+# test.mak
+#
+# Common part of the Makefiles for OPAL test and benchmark programs.
+# Set PROG, SOURCES and, optionally, TEST_ARGS then include this file.
+# The "check" target builds the program and runs it with TEST_ARGS,
+# which should be a quick run that exits non-zero on failure.
+#
+# Copyright (c) 2021 Vox Lucida Pty. Ltd.
+#
+# The contents of this file are subject to the Mozilla Public License
+# Version 1.0 (the "License"); you may not use this file except in
+# compliance with the License. You may obtain a copy of the License at
+# http://www.mozilla.org/MPL/
+#
+# Software distributed under the License is distributed on an "AS IS"
+# basis, WITHOUT WARRANTY OF ANY KIND, either express or implied. See
+# the License for the specific language governing rights and limitations
+# under the License.
+#
+# The Original Code is Open Phone Abstraction Library.
+#
+# The Initial Developer of the Original Code is Vox Lucida Pty. Ltd.
+#
+# Contributor(s): ______________________________________.
+#
+
+OPAL_MAKE_DIR := $(if $(OPALDIR),$(OPALDIR)/make,$(shell pkg-config opal --variable=makedir))
+ifeq ($(OPAL_MAKE_DIR),)
+  $(error Cannot build without OPAL installed or OPALDIR set)
+endif
+include $(OPAL_MAKE_DIR)/opal.mak
+
+.PHONY: check
+check: $(TARGET)
+	$(TARGET) $(TEST_ARGS)
+
+# End of test.mak
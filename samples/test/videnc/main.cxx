@@ -0,0 +1,250 @@
+/*
+ * main.cxx
+ *
+ * OPAL video encoder test and throughput benchmark
+ *
+ * Copyright (c) 2021 Vox Lucida Pty. Ltd.
+ *
+ * The contents of this file are subject to the Mozilla Public License
+ * Version 1.0 (the "License"); you may not use this file except in
+ * compliance with the License. You may obtain a copy of the License at
+ * http://www.mozilla.org/MPL/
+ *
+ * Software distributed under the License is distributed on an "AS IS"
+ * basis, WITHOUT WARRANTY OF ANY KIND, either express or implied. See
+ * the License for the specific language governing rights and limitations
+ * under the License.
+ *
+ * The Original Code is Open Phone Abstraction Library.
+ *
+ * The Initial Developer of the Original Code is Vox Lucida Pty. Ltd.
+ *
+ * Contributor(s): ______________________________________.
+ *
+ */
+
+#include "../opaltest.h"
+
+#include <ptlib/vconvert.h>
+
+#include <opal/transcoders.h>
+#include <codec/vidcodec.h>
+
+#include <algorithm>
+#include <cmath>
+
+
+class VideoEncodeTest : public OpalTestProcess
+{
+    PCLASSINFO(VideoEncodeTest, OpalTestProcess)
+  public:
+    VideoEncodeTest();
+
+    virtual void Main();
+};
+
+
+PCREATE_PROCESS(VideoEncodeTest);
+
+
+VideoEncodeTest::VideoEncodeTest()
+  : OpalTestProcess("Video Encode Test")
+{
+}
+
+
+// Gradient background with a bright block moving across it, so there is real motion to encode
+static void BuildFrame(RTP_DataFrame & frame, unsigned width, unsigned height, unsigned index, unsigned motion)
+{
+  frame.SetPayloadSize(sizeof(PluginCodec_Video_FrameHeader) + PVideoFrameInfo::CalculateFrameBytes(width, height));
+  PluginCodec_Video_FrameHeader * header = (PluginCodec_Video_FrameHeader *)frame.GetPayloadPtr();
+  header->x = header->y = 0;
+  header->width = width;
+  header->height = height;
+
+  BYTE * yuv = OpalVideoFrameDataPtr(header);
+  unsigned offset = index*motion;
+  for (unsigned y = 0; y < height; ++y) {
+    for (unsigned x = 0; x < width; ++x)
+      *yuv++ = (BYTE)((x + y + offset) & 0xff);
+  }
+  memset(yuv, 0x80, width*height/2);
+
+  unsigned blockSize = std::min(width, height)/4;
+  PColourConverter::FillYUV420P((offset % (width - blockSize)) & ~1, ((offset/2) % (height - blockSize)) & ~1,
+                                blockSize, blockSize, width, height, OpalVideoFrameDataPtr(header), 255, 255, 255);
+}
+
+
+// Peak signal to noise ratio of the luminance, or zero if the decoded frame is the wrong size
+static double CalculatePSNR(const RTP_DataFrame & original, const RTP_DataFrame & decoded)
+{
+  if (decoded.GetPayloadSize() < (PINDEX)sizeof(PluginCodec_Video_FrameHeader))
+    return 0;
+
+  const PluginCodec_Video_FrameHeader * originalHeader = (const PluginCodec_Video_FrameHeader *)original.GetPayloadPtr();
+  const PluginCodec_Video_FrameHeader * decodedHeader = (const PluginCodec_Video_FrameHeader *)decoded.GetPayloadPtr();
+  if (decodedHeader->width != originalHeader->width || decodedHeader->height != originalHeader->height)
+    return 0;
+
+  unsigned pixels = originalHeader->width*originalHeader->height;
+  const BYTE * a = OpalVideoFrameDataPtr(originalHeader);
+  const BYTE * b = OpalVideoFrameDataPtr(decodedHeader);
+  double sumSquares = 0;
+  for (unsigned i = 0; i < pixels; ++i) {
+    int diff = (int)a[i] - (int)b[i];
+    sumSquares += diff*diff;
+  }
+
+  if (sumSquares == 0)
+    return 100; // Identical, call it very good
+  return 10*log10(255.0*255.0*pixels/sumSquares);
+}
+
+
+void VideoEncodeTest::Main()
+{
+  if (!ParseArguments("F-format: Encoder media format, default " OPAL_H264 "\n"
+                      "s-size: Frame size, default 1920x1080\n"
+                      "f-frames: Number of frames to encode, default 300\n"
+                      "r-rate: Frame rate, default 30\n"
+                      "b-bitrate: Target bit rate in kbps, default 2000\n"
+                      "m-motion: Pixels of motion per frame, default 4\n"
+                      "k-key: Request key frame every N frames, default 0 (encoder decides)\n"
+                      "n-no-decode. Do not decode and check the encoded output\n"
+                      "-min-psnr: Minimum average decoded luminance PSNR in dB, default 25\n"))
+    return;
+
+  PArgList & args = GetArguments();
+  unsigned width = 1920, height = 1080;
+  if (args.HasOption('s') && !PVideoFrameInfo::ParseSize(args.GetOptionString('s'), width, height)) {
+    Fail("Invalid frame size");
+    return;
+  }
+
+  unsigned frames = std::max(args.GetOptionAs('f', 300U), 1U);
+  unsigned frameRate = std::max(args.GetOptionAs('r', 30U), 1U);
+  unsigned bitRate = args.GetOptionAs('b', 2000U);
+  unsigned motion = args.GetOptionAs('m', 4U);
+  unsigned keyInterval = args.GetOptionAs('k', 0U);
+  double minPSNR = args.GetOptionString("min-psnr", "25").AsReal();
+
+  OpalMediaFormat rawFormat = OpalYUV420P;
+  OpalMediaFormat encodedFormat = args.GetOptionString('F', OPAL_H264);
+  if (!encodedFormat.IsValid()) {
+    Fail(PSTRSTRM("Unknown media format \"" << args.GetOptionString('F', OPAL_H264) << '"'));
+    return;
+  }
+
+  rawFormat.SetOptionInteger(OpalVideoFormat::FrameWidthOption(), width);
+  rawFormat.SetOptionInteger(OpalVideoFormat::FrameHeightOption(), height);
+  rawFormat.SetOptionInteger(OpalMediaFormat::FrameTimeOption(), rawFormat.GetClockRate()/frameRate);
+  encodedFormat.SetOptionInteger(OpalVideoFormat::FrameWidthOption(), width);
+  encodedFormat.SetOptionInteger(OpalVideoFormat::FrameHeightOption(), height);
+  encodedFormat.SetOptionInteger(OpalMediaFormat::FrameTimeOption(), encodedFormat.GetClockRate()/frameRate);
+  encodedFormat.SetOptionInteger(OpalMediaFormat::MaxBitRateOption(), bitRate*1000);
+  encodedFormat.SetOptionInteger(OpalMediaFormat::TargetBitRateOption(), bitRate*1000);
+
+  // Codecs are plug ins, so a build without them is not a failure
+  OpalTranscoder * encoder = OpalTranscoder::Create(rawFormat, encodedFormat);
+  if (encoder == NULL) {
+    cout << "No encoder from " << rawFormat << " to " << encodedFormat << ", is the plug in installed? Test skipped." << endl;
+    return;
+  }
+
+  OpalTranscoder * decoder = NULL;
+  if (!args.HasOption('n') && (decoder = OpalTranscoder::Create(encodedFormat, rawFormat)) == NULL)
+    cout << "No decoder from " << encodedFormat << " to " << rawFormat << ", output not checked." << endl;
+
+  // Pre-build input so the benchmark only measures the encoder
+  std::vector<RTP_DataFrame> inputs(std::min(frames, 30U));
+  for (size_t i = 0; i < inputs.size(); ++i)
+    BuildFrame(inputs[i], width, height, (unsigned)i, motion);
+
+  cout << "Encoding " << frames << " frames of " << width << 'x' << height
+       << " to " << encodedFormat << " at " << frameRate << "fps, " << bitRate << "kbps" << endl;
+
+  std::vector<PInt64> times;
+  times.reserve(frames);
+  PInt64 elapsed = 0;
+  uint64_t packets = 0, bytes = 0;
+  unsigned decodedFrames = 0;
+  double totalPSNR = 0;
+  RTP_DataFrameList output, decoded;
+
+  for (unsigned f = 0; f < frames; ++f) {
+    RTP_DataFrame & input = inputs[f % inputs.size()];
+    input.SetTimestamp(f*rawFormat.GetClockRate()/frameRate);
+
+    if (keyInterval > 0 && f % keyInterval == 0)
+      encoder->ExecuteCommand(OpalVideoUpdatePicture());
+
+    PTime frameStart;
+    if (!encoder->ConvertFrames(input, output)) {
+      Fail(PSTRSTRM("Encode failed at frame " << f));
+      break;
+    }
+    PInt64 frameTime = (PTime() - frameStart).GetMicroSeconds();
+    times.push_back(frameTime);
+    elapsed += frameTime;
+
+    packets += output.size();
+    for (RTP_DataFrameList::iterator it = output.begin(); it != output.end(); ++it) {
+      bytes += it->GetPayloadSize();
+
+      // Decoder completes the picture on the last packet, which is compared to what went in
+      if (decoder != NULL && decoder->ConvertFrames(*it, decoded)) {
+        for (RTP_DataFrameList::iterator frame = decoded.begin(); frame != decoded.end(); ++frame) {
+          ++decodedFrames;
+          totalPSNR += CalculatePSNR(input, *frame);
+        }
+      }
+    }
+  }
+  elapsed = std::max(elapsed, (PInt64)1);
+
+  delete encoder;
+  delete decoder;
+
+  if (times.empty())
+    return;
+
+  size_t encoded = times.size();
+  std::sort(times.begin(), times.end());
+  double frameBytes = (double)inputs.front().GetPacketSize();
+  double kbps = bytes*8.0*frameRate/encoded/1000;
+
+  cout << fixed << setprecision(1)
+       << "  Throughput: " << encoded*1000000.0/elapsed << " frames/second, "
+       << encoded*frameBytes/elapsed << " MB/s raw input\n"
+          "  Frame time:"
+          " p50=" << times[encoded/2] << "us"
+          " p90=" << times[encoded*9/10] << "us"
+          " p99=" << times[encoded*99/100] << "us"
+          " max=" << times.back() << "us\n"
+          "  Output: " << setprecision(2) << (double)packets/encoded << " packets/frame, "
+       << setprecision(1) << kbps << "kbps";
+  if (decodedFrames > 0)
+    cout << ", " << decodedFrames << " frames decoded, average PSNR " << totalPSNR/decodedFrames << "dB";
+  cout << endl;
+
+  if (packets == 0)
+    Fail("Encoder produced no output");
+
+  // Rate control is never exact, especially over a short run, so allow plenty
+  if (bitRate > 0 && kbps > bitRate*2.0)
+    Fail(PSTRSTRM("Output of " << kbps << "kbps is more than double the target of " << bitRate << "kbps"));
+
+  if (decoder != NULL) {
+    if (decodedFrames < encoded*9/10)
+      Fail(PSTRSTRM("Only " << decodedFrames << " of " << encoded << " frames decoded"));
+    else if (totalPSNR/decodedFrames < minPSNR)
+      Fail(PSTRSTRM("Average PSNR of " << totalPSNR/decodedFrames << "dB is below " << minPSNR << "dB"));
+  }
+
+  if (GetTerminationValue() == 0)
+    cout << "All video encode tests passed." << endl;
+}
+
+
+// End of File ///////////////////////////////////////////////////////////////
@@ -0,0 +1,137 @@
+/*
+ * main.cxx
+ *
+ * OPAL video mixer compositing benchmark
+ *
+ * Copyright (c) 2021 Vox Lucida Pty. Ltd.
+ *
+ * The contents of this file are subject to the Mozilla Public License
+ * Version 1.0 (the "License"); you may not use this file except in
+ * compliance with the License. You may obtain a copy of the License at
+ * http://www.mozilla.org/MPL/
+ *
+ * Software distributed under the License is distributed on an "AS IS"
+ * basis, WITHOUT WARRANTY OF ANY KIND, either express or implied. See
+ * the License for the specific language governing rights and limitations
+ * under the License.
+ *
+ * The Original Code is Open Phone Abstraction Library.
+ *
+ * The Initial Developer of the Original Code is Vox Lucida Pty. Ltd.
+ *
+ * Contributor(s): ______________________________________.
+ *
+ */
+
+#include "../opaltest.h"
+
+#include <ptlib/vconvert.h>
+#include <ptclib/random.h>
+
+#include <ep/opalmixer.h>
+
+
+class VideoMixerTest : public OpalTestProcess
+{
+    PCLASSINFO(VideoMixerTest, OpalTestProcess)
+  public:
+    VideoMixerTest() : OpalTestProcess("Video Mixer Test") { }
+
+    virtual void Main();
+};
+
+
+PCREATE_PROCESS(VideoMixerTest);
+
+
+static bool Run(unsigned threads,
+                unsigned tiles,
+                unsigned frames,
+                unsigned changePercent,
+                unsigned outputWidth,
+                unsigned outputHeight,
+                const std::vector<RTP_DataFrame> & inputs)
+{
+  OpalVideoMixer mixer(OpalVideoMixer::eGrid, outputWidth, outputHeight, 25, false);
+  mixer.SetCompositorThreads(threads);
+
+  for (unsigned t = 0; t < tiles; ++t)
+    mixer.AddStream(PSTRSTRM(t));
+
+  PRandom rand(1);
+  RTP_DataFrame output;
+  unsigned regions = 0;
+
+  PTime start;
+  for (unsigned f = 0; f < frames; ++f) {
+    for (unsigned t = 0; t < tiles; ++t) {
+      if (f == 0 || rand.Generate() % 100 < changePercent)
+        mixer.WriteStream(PSTRSTRM(t), inputs[t % inputs.size()]);
+    }
+    if (!mixer.ReadMixed(output))
+      return false;
+    regions += mixer.GetChangedRegions().size();
+  }
+  PTimeInterval elapsed = PTime() - start;
+
+  cout << "  Threads=" << threads << ": "
+       << fixed << setprecision(1) << frames*1000.0/std::max(elapsed.GetMilliSeconds(), (PInt64)1) << " frames/second,"
+          " " << setprecision(2) << (double)regions/frames << " changed regions/frame" << endl;
+  return true;
+}
+
+
+void VideoMixerTest::Main()
+{
+  if (!ParseArguments("n-tiles: Number of input streams, default 25\n"
+                      "o-output: Output frame size, default 1920x1080\n"
+                      "i-input: Input frame size, default 1280x720\n"
+                      "f-frames: Number of output frames, default 250\n"
+                      "c-change: Percentage of inputs with a new frame on each output frame, default 100\n"
+                      "t-threads: Compositor threads, default number of cores less one\n"))
+    return;
+
+  PArgList & args = GetArguments();
+
+  unsigned outputWidth = 1920, outputHeight = 1080;
+  if (args.HasOption('o') && !PVideoFrameInfo::ParseSize(args.GetOptionString('o'), outputWidth, outputHeight)) {
+    Fail("Invalid output frame size");
+    return;
+  }
+
+  unsigned inputWidth = 1280, inputHeight = 720;
+  if (args.HasOption('i') && !PVideoFrameInfo::ParseSize(args.GetOptionString('i'), inputWidth, inputHeight)) {
+    Fail("Invalid input frame size");
+    return;
+  }
+
+  unsigned tiles = args.GetOptionAs('n', 25U);
+  unsigned frames = args.GetOptionAs('f', 250U);
+  unsigned changePercent = args.GetOptionAs('c', 100U);
+  unsigned threads = args.GetOptionAs('t', std::max(PThread::GetNumProcessors(), 1U) - 1);
+
+  // A few different coloured inputs, so the output is recognisable if dumped
+  std::vector<RTP_DataFrame> inputs(8);
+  for (size_t i = 0; i < inputs.size(); ++i) {
+    unsigned w = inputWidth;
+    unsigned h = inputHeight;
+    inputs[i].SetPayloadSize(sizeof(PluginCodec_Video_FrameHeader) + PVideoFrameInfo::CalculateFrameBytes(w, h));
+    PluginCodec_Video_FrameHeader * header = (PluginCodec_Video_FrameHeader *)inputs[i].GetPayloadPtr();
+    header->x = header->y = 0;
+    header->width = w;
+    header->height = h;
+    PColourConverter::FillYUV420P(0, 0, w, h, w, h, OpalVideoFrameDataPtr(header),
+                                  (BYTE)(i*37), (BYTE)(i*91), (BYTE)(255 - i*29));
+  }
+
+  cout << "Mixing " << tiles << " tiles of " << inputWidth << 'x' << inputHeight
+       << " into " << outputWidth << 'x' << outputHeight
+       << ", " << changePercent << "% changing per frame" << endl;
+
+  if (!Run(0, tiles, frames, changePercent, outputWidth, outputHeight, inputs) ||
+      (threads > 0 && !Run(threads, tiles, frames, changePercent, outputWidth, outputHeight, inputs)))
+    Fail("Mix failed");
+}
+
+
+// End of File ///////////////////////////////////////////////////////////////
@@ -47,29 +47,32 @@ extern "C" {
 #include <codec/echocancel.h>
 
 
+#define PTraceModule() "EchoCancel"
+
+// Largest frame we expect to see without a reallocation, 60ms at 48kHz
+static const size_t MaxFrameSamples = 48000*60/1000;
+
+// Number of reads over which the minimum fill is measured for drift compensation
+static const unsigned DriftWindow = 100;
+
+
 ///////////////////////////////////////////////////////////////////////////////
 
 OpalEchoCanceler::OpalEchoCanceler()
   : receiveHandler(PCREATE_NOTIFIER(ReceivedPacket))
   , sendHandler(PCREATE_NOTIFIER(SentPacket))
+  , mean(0)
+  , clockRate(8000)
+  , echoState(NULL)
+  , preprocessState(NULL)
+  , m_frameSamples(0)
 {
-  echoState = NULL;
-  preprocessState = NULL;
-
-  e_buf = NULL;
-  echo_buf = NULL;
-  ref_buf = NULL;
-  noise = NULL;
-
-  echo_chan = new PQueueChannel();
-  echo_chan->Open(10000);
-  echo_chan->SetReadTimeout(10);
-  echo_chan->SetWriteTimeout(10);
-
-  mean = 0;
-  clockRate = 8000;
+  m_refBuffer.reserve(MaxFrameSamples);
+  m_echoBuffer.reserve(MaxFrameSamples);
+  m_cancelledBuffer.reserve(MaxFrameSamples);
+  m_noiseBuffer.reserve(MaxFrameSamples+1);
 
-  PTRACE(4, "Echo Canceler\tHandler created");
+  PTRACE(4, "Handler created");
 }
 
 
@@ -85,18 +88,6 @@ OpalEchoCanceler::~OpalEchoCanceler()
     speex_preprocess_state_destroy(preprocessState);
     preprocessState = NULL;
   }
-
-  if (ref_buf)
-    free(ref_buf);
-  if (e_buf)
-    free(e_buf);
-  if (echo_buf)
-    free(echo_buf);
-  if (noise)
-    free(noise);
-  
-  echo_chan->Close();
-  delete(echo_chan);
 }
 
 
@@ -114,20 +105,27 @@ void OpalEchoCanceler::SetParameters(const Params& newParam)
     speex_preprocess_state_destroy(preprocessState);
     preprocessState = NULL;
   }
+
+  m_reference.Resynchronise();
 }
 
 
 void OpalEchoCanceler::SetClockRate(const int rate)
 {
-  clockRate = rate;
+  if (clockRate != rate) {
+    clockRate = rate;
+    m_reference.Resynchronise();
+  }
 }
 
 
 void OpalEchoCanceler::SentPacket(RTP_DataFrame& echo_frame, P_INT_PTR)
 {
-  /* Write to the soundcard, and write the frame to the PQueueChannel */
+  /* Write to the soundcard, and write the frame to the reference buffer */
   if (param.m_enabled && echo_frame.GetPayloadSize() > 0)
-    echo_chan->Write(echo_frame.GetPayloadPtr(), echo_frame.GetPayloadSize());
+    m_reference.Write((const short *)echo_frame.GetPayloadPtr(),
+                      echo_frame.GetPayloadSize()/sizeof(short),
+                      echo_frame.GetTimestamp());
 }
 
 
@@ -136,69 +134,201 @@ void OpalEchoCanceler::ReceivedPacket(RTP_DataFrame& input_frame, P_INT_PTR)
   if (!param.m_enabled || input_frame.GetPayloadSize() == 0)
     return;
 
-  size_t inputSize = input_frame.GetPayloadSize(); // Size is in bytes
+  unsigned frameSamples = input_frame.GetPayloadSize()/sizeof(short);
 
   PWaitAndSignal m(stateMutex);
 
+  if (m_frameSamples != frameSamples) {
+    // Speex state is fixed to a frame size, so start again if it changes
+    if (echoState != NULL) {
+      speex_echo_state_destroy(echoState);
+      echoState = NULL;
+    }
+    if (preprocessState != NULL) {
+      speex_preprocess_state_destroy(preprocessState);
+      preprocessState = NULL;
+    }
+    m_frameSamples = frameSamples;
+    m_refBuffer.resize(frameSamples);
+    m_echoBuffer.resize(frameSamples);
+    m_cancelledBuffer.resize(frameSamples);
+    m_noiseBuffer.resize(frameSamples+1);
+  }
+
   if (echoState == NULL) 
-    echoState = speex_echo_state_init(inputSize/sizeof(short), param.m_duration);
+    echoState = speex_echo_state_init(frameSamples, param.m_duration);
 
   if (preprocessState == NULL) { 
-    preprocessState = speex_preprocess_state_init(inputSize/sizeof(short), clockRate);
+    preprocessState = speex_preprocess_state_init(frameSamples, clockRate);
     int dummy = 0;
     speex_preprocess_ctl(preprocessState, SPEEX_PREPROCESS_SET_DENOISE, &dummy);
   }
 
-  if (echo_buf == NULL)
-    echo_buf = (spx_int16_t *) malloc(inputSize);
-  if (noise == NULL)
+  spx_int16_t * ref_buf = (spx_int16_t *)m_refBuffer.data();
+  spx_int16_t * echo_buf = (spx_int16_t *)m_echoBuffer.data();
+  spx_int16_t * e_buf = (spx_int16_t *)m_cancelledBuffer.data();
 #if OPAL_SPEEX_FLOAT_NOISE
-    noise = malloc((inputSize/sizeof(short)+1)*sizeof(float));
+  float * noise = (float *)m_noiseBuffer.data();
 #else
-    noise = malloc((inputSize/sizeof(short)+1)*sizeof(spx_int32_t));
+  spx_int32_t * noise = (spx_int32_t *)m_noiseBuffer.data();
 #endif
-  if (e_buf == NULL)
-    e_buf = (spx_int16_t *) malloc(inputSize);
-  if (ref_buf == NULL)
-    ref_buf = (spx_int16_t *) malloc(inputSize);
 
   /* Remove the DC offset */
   short *j = (short *) input_frame.GetPayloadPtr();
-  for (size_t i = 0 ; i < inputSize/sizeof(short) ; i++) {
+  for (unsigned i = 0 ; i < frameSamples; i++) {
     mean = 0.999*mean + 0.001*j[i];
-    ((spx_int16_t *)ref_buf)[i] = j[i] - (short) mean;
+    ref_buf[i] = j[i] - (short) mean;
   }
   
-  /* Read from the PQueueChannel a reference echo frame of the size
+  /* Read from the reference buffer an echo frame of the size
    * of the captured frame. */
-  if (!echo_chan->Read((short *) echo_buf, input_frame.GetPayloadSize())) {
+  if (!m_reference.Read(echo_buf, frameSamples)) {
     
     /* Nothing to read from the speaker signal, only suppress the noise
      * and return.
      */
-    speex_preprocess(preprocessState, (spx_int16_t *)ref_buf, NULL);
-    memcpy(input_frame.GetPayloadPtr(), (spx_int16_t *)ref_buf, input_frame.GetPayloadSize());
+    speex_preprocess(preprocessState, ref_buf, NULL);
+    memcpy(input_frame.GetPayloadPtr(), ref_buf, input_frame.GetPayloadSize());
 
     return;
   }
    
   /* Cancel the echo in this frame */
-#if OPAL_SPEEX_FLOAT_NOISE
-  speex_echo_cancel(echoState, (short *)ref_buf, (short *)echo_buf, (short *)e_buf, (float *)noise);
-#else
-  speex_echo_cancel(echoState, (short *)ref_buf, (short *)echo_buf, (short *)e_buf, (spx_int32_t *)noise);
-#endif
+  speex_echo_cancel(echoState, ref_buf, echo_buf, e_buf, noise);
   
   /* Suppress the noise */
-#if OPAL_SPEEX_FLOAT_NOISE
-  speex_preprocess(preprocessState, (spx_int16_t *)e_buf, (float *)noise);
-#else
-  speex_preprocess(preprocessState, (spx_int16_t *)e_buf, (spx_int32_t *)noise);
-#endif
+  speex_preprocess(preprocessState, e_buf, noise);
 
   /* Use the result of the echo cancelation as capture frame */
   memcpy(input_frame.GetPayloadPtr(), e_buf, input_frame.GetPayloadSize());
 }
 
 
+///////////////////////////////////////////////////////////////////////////////
+
+OpalEchoCanceler::ReferenceBuffer::ReferenceBuffer(unsigned size)
+  : m_writePosition(0)
+  , m_readPosition(0)
+  , m_resynchronise(false)
+  , m_firstWrite(true)
+  , m_nextTimestamp(0)
+  , m_minimumFill(std::numeric_limits<uint64_t>::max())
+  , m_readsInWindow(0)
+  , m_estimatedDelay(0)
+  , m_driftAdjustments(0)
+  , m_underruns(0)
+{
+  unsigned powerOfTwo = 1;
+  while (powerOfTwo < size)
+    powerOfTwo <<= 1;
+  m_samples.resize(powerOfTwo);
+  m_mask = powerOfTwo-1;
+}
+
+
+void OpalEchoCanceler::ReferenceBuffer::Write(const short * samples, unsigned count, unsigned timestamp)
+{
+  uint64_t position = m_writePosition.load();
+
+  if (m_firstWrite)
+    m_firstWrite = false;
+  else {
+    int gap = (int)(timestamp - m_nextTimestamp);
+    if (gap < 0) {
+      // Overlaps what we already have, e.g. out of order or duplicate packet
+      if ((unsigned)-gap >= count)
+        return;
+      samples += -gap;
+      count -= -gap;
+      timestamp += -gap;
+    }
+    else if (gap > 0) {
+      /* Silence suppression, or packet loss, on the far end means the speaker
+         played nothing, so keep the reference time aligned with silence. A
+         really big gap is more than the ring can hold, so just restart. */
+      unsigned fill = std::min((unsigned)gap, (unsigned)m_samples.size());
+      for (unsigned i = 0; i < fill; ++i)
+        m_samples[(position + i) & m_mask] = 0;
+      position += fill;
+    }
+  }
+
+  // More than the ring can hold, only the most recent samples are kept
+  if (count > m_samples.size()) {
+    unsigned excess = count - (unsigned)m_samples.size();
+    samples += excess;
+    count -= excess;
+    timestamp += excess;
+    position += excess;
+  }
+
+  uint64_t offset = position & m_mask;
+  unsigned first = std::min(count, (unsigned)(m_samples.size() - offset));
+  memcpy(&m_samples[offset], samples, first*sizeof(short));
+  memcpy(&m_samples[0], samples+first, (count-first)*sizeof(short));
+
+  m_nextTimestamp = timestamp + count;
+  m_writePosition.store(position + count);
+}
+
+
+bool OpalEchoCanceler::ReferenceBuffer::Read(short * samples, unsigned count)
+{
+  uint64_t writePosition = m_writePosition.load();
+  uint64_t readPosition = m_readPosition.load();
+
+  if (m_resynchronise.exchange(false)) {
+    readPosition = writePosition;
+    m_minimumFill = std::numeric_limits<uint64_t>::max();
+    m_readsInWindow = 0;
+  }
+
+  uint64_t fill = writePosition - readPosition;
+
+  // The producer has lapped us, jump forward to the most recent frame
+  if (fill > m_samples.size() - count) {
+    PTRACE(4, "Reference buffer overrun, skipping " << (fill - count) << " samples");
+    readPosition = writePosition - count;
+    fill = count;
+  }
+
+  /* Drift compensation. If, over a window of reads, there were always more
+     samples than needed, the producer clock is faster than ours. Discard the
+     excess so the reference does not lag further and further behind the
+     echo it is supposed to be cancelling. */
+  if (fill < m_minimumFill)
+    m_minimumFill = fill;
+  if (++m_readsInWindow >= DriftWindow) {
+    if (m_minimumFill != std::numeric_limits<uint64_t>::max() && m_minimumFill > count) {
+      uint64_t excess = m_minimumFill - count;
+      readPosition += excess;
+      fill -= excess;
+      ++m_driftAdjustments;
+      PTRACE(4, "Drift compensation discarded " << excess << " samples");
+    }
+    m_minimumFill = std::numeric_limits<uint64_t>::max();
+    m_readsInWindow = 0;
+  }
+
+  m_estimatedDelay = (unsigned)fill;
+
+  if (fill == 0) {
+    ++m_underruns;
+    m_readPosition.store(readPosition);
+    return false;
+  }
+
+  unsigned available = (unsigned)std::min(fill, (uint64_t)count);
+  for (unsigned i = 0; i < available; ++i)
+    samples[i] = m_samples[(readPosition + i) & m_mask];
+  if (available < count) {
+    ++m_underruns;
+    memset(samples+available, 0, (count-available)*sizeof(short));
+  }
+
+  m_readPosition.store(readPosition + available);
+  return true;
+}
+
+
 #endif // OPAL_AEC
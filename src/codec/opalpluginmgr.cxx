@@ -48,6 +48,7 @@
 #if OPAL_VIDEO
 #include <ptlib/videoio.h>
 #include <codec/vidcodec.h>
+#include <algorithm>
 #endif
 
 
@@ -597,6 +598,7 @@ OpalPluginTranscoder::OpalPluginTranscoder(const PluginCodec_Definition * defn,
   , getOutputDataSizeControl(defn, PLUGINCODEC_CONTROL_GET_OUTPUT_DATA_SIZE)
   , getCodecStatistics(defn, PLUGINCODEC_CONTROL_GET_STATISTICS)
   , setInstanceId(defn, PLUGINCODEC_CONTROL_SET_INSTANCE_ID)
+  , transcodeFrameControl(defn, PLUGINCODEC_CONTROL_TRANSCODE_FRAME)
 {
 #if PTRACING
   m_firstLoggedUpdateOptions[true] = m_firstLoggedUpdateOptions[false] = true;
@@ -918,6 +920,9 @@ OpalPluginVideoTranscoder::OpalPluginVideoTranscoder(const OpalTranscoderKey & k
   , OpalPluginTranscoder(codecDefn, isEncoder)
   , m_bufferRTP(NULL)
   , m_totalFrames(0)
+  , m_useTranscodeFrame(transcodeFrameControl.Exists())
+  , m_encodeBatchSize(4)
+  , m_accessUnitSize(0)
   , m_markersState(e_MarkersInitial)
   , m_lastPacketMarker(false)
   , m_currentFrameTimestamp(UINT_MAX)
@@ -930,11 +935,14 @@ OpalPluginVideoTranscoder::OpalPluginVideoTranscoder(const OpalTranscoderKey & k
   acceptEmptyPayload = (codecDef->flags & PluginCodec_EmptyPayloadMask) == PluginCodec_EmptyPayload;
   acceptOtherPayloads = (codecDef->flags & PluginCodec_OtherPayloadMask) == PluginCodec_OtherPayload;
   m_errorConcealment = (codecDef->flags & PluginCodec_ErrorConcealmentMask) == PluginCodec_ErrorConcealment;
+  PTRACE_IF(4, m_useTranscodeFrame, "Using frame level transcode for \"" << codecDef->descr << '"');
 }
 
 OpalPluginVideoTranscoder::~OpalPluginVideoTranscoder()
 { 
   delete m_bufferRTP;
+  for (size_t i = 0; i < m_encodeBuffers.size(); ++i)
+    delete m_encodeBuffers[i];
 }
 
 
@@ -1006,7 +1014,15 @@ bool OpalPluginVideoTranscoder::EncodeFrames(const RTP_DataFrame & src, RTP_Data
 
   bool foreIFrame = m_encodingIntraFrameControl.RequireIntraFrame();
   PTRACE_IF(4, foreIFrame, "I-Frame forced from video codec at frame " << m_totalFrames+1);
-  do {
+
+  int batchResult = -1;
+  if (m_useTranscodeFrame) {
+    batchResult = EncodeFrameBatch(src, outputDataSize, foreIFrame || m_totalFrames == 0 ? PluginCodec_CoderForceIFrame : 0, dstList);
+    if (batchResult == 0)
+      return false;
+  }
+
+  if (batchResult < 0) do {
     // Some plug ins a very rude and use more memory than we say they can, so add an extra 1k
     RTP_DataFrame * dst = new RTP_DataFrame((PINDEX)0, outputDataSize+1024);
     dst->CopyHeader(src);
@@ -1091,6 +1107,83 @@ bool OpalPluginVideoTranscoder::EncodeFrames(const RTP_DataFrame & src, RTP_Data
 }
 
 
+/* Encode whole frame in one call to the plug in, output buffers are kept from
+   frame to frame and only the ones that are used are passed on. Returns -1 if
+   the plug in cannot do it, so the per packet method should be used. */
+int OpalPluginVideoTranscoder::EncodeFrameBatch(const RTP_DataFrame & src,
+                                                unsigned outputDataSize,
+                                                unsigned flags,
+                                                RTP_DataFrameList & dstList)
+{
+  PluginCodec_Packet input;
+  input.data = const_cast<BYTE *>((const BYTE *)src);
+  input.length = src.GetHeaderSize() + src.GetPayloadSize();
+  input.flags = flags;
+
+  for (;;) {
+    while (m_encodeBuffers.size() < m_encodeBatchSize)
+      m_encodeBuffers.push_back(new RTP_DataFrame((PINDEX)0, outputDataSize+1024)); // Extra 1k for rude plug ins, as above
+
+    m_encodePackets.resize(m_encodeBuffers.size());
+    for (size_t i = 0; i < m_encodeBuffers.size(); ++i) {
+      RTP_DataFrame & dst = *m_encodeBuffers[i];
+      if (!dst.SetMinSize(dst.GetHeaderSize() + outputDataSize + 1024))
+        return 0;
+      dst.CopyHeader(src);
+      dst.SetPayloadType(GetPayloadType(false));
+      m_encodePackets[i].data = dst.GetPointer();
+      m_encodePackets[i].length = dst.GetHeaderSize() + outputDataSize;
+      m_encodePackets[i].flags = 0;
+    }
+
+    PluginCodec_FrameBatch batch;
+    batch.version = PLUGINCODEC_FRAME_BATCH_VERSION;
+    batch.input = &input;
+    batch.inputCount = 1;
+    batch.output = &m_encodePackets[0];
+    batch.outputCount = (unsigned)m_encodePackets.size();
+    batch.flags = 0;
+
+    int result = TranscodeFrame(batch);
+    if (result < 0) {
+      PTRACE(3, "Plug in does not support frame level transcode version "
+             << PLUGINCODEC_FRAME_BATCH_VERSION << ", using per packet transcode");
+      m_useTranscodeFrame = false;
+      return -1;
+    }
+    if (result == 0)
+      return 0;
+
+    if ((batch.flags & PluginCodec_ReturnCoderIFrame) != 0)
+      m_lastFrameWasIFrame = true;
+
+    for (unsigned i = 0; i < batch.outputCount; ++i) {
+      RTP_DataFrame * dst = m_encodeBuffers[i];
+      unsigned toLen = m_encodePackets[i].length;
+      if (toLen >= RTP_DataFrame::MinHeaderSize && (PINDEX)toLen >= dst->GetHeaderSize()) {
+        dst->SetPayloadSize(toLen - dst->GetHeaderSize());
+        dst->SetMarker((m_encodePackets[i].flags & PluginCodec_ReturnCoderLastFrame) != 0);
+        dstList.Append(dst);
+        m_encodeBuffers[i] = NULL;
+      }
+    }
+    m_encodeBuffers.erase(std::remove(m_encodeBuffers.begin(), m_encodeBuffers.end(), (RTP_DataFrame *)NULL), m_encodeBuffers.end());
+
+    if ((batch.flags & PluginCodec_ReturnCoderLastFrame) != 0)
+      return 1;
+
+    if (batch.outputCount == 0) {
+      PTRACE(1, "Frame level transcode made no progress, error in plug in.");
+      return 0;
+    }
+
+    // Ran out of buffers, have more ready for next call and next frame
+    m_encodeBatchSize += m_encodeBatchSize;
+    PTRACE(4, "Increased encoder frame batch size to " << m_encodeBatchSize);
+  }
+}
+
+
 static unsigned VideoDecodeBufferFudgeFactor = 1000;  // Fudge factor in case of badly behaved codec
 
 bool OpalPluginVideoTranscoder::DecodeFrames(const RTP_DataFrame & src, RTP_DataFrameList & dstList)
@@ -1238,8 +1331,10 @@ bool OpalPluginVideoTranscoder::DecodeFrames(const RTP_DataFrame & src, RTP_Data
 
 bool OpalPluginVideoTranscoder::DecodeFrame(const RTP_DataFrame & src, RTP_DataFrameList & dstList)
 {
+  if (m_useTranscodeFrame)
+    return QueueAccessUnit(src, dstList);
+
   // Detect packet loss
-  DWORD sequenceNumber = src.GetSequenceNumber();
   bool packetsLost = src.GetDiscontinuity() > 0;
 
   // call the codec function
@@ -1254,29 +1349,46 @@ bool OpalPluginVideoTranscoder::DecodeFrame(const RTP_DataFrame & src, RTP_DataF
   if (!Transcode((const BYTE *)src, &fromLen, m_bufferRTP->GetPointer(), &toLen, &flags))
     return false;
 
-  if ((flags & PluginCodec_ReturnCoderBufferTooSmall) != 0) {
-    PINDEX newSize = getOutputDataSizeControl.Call((void *)NULL, (unsigned *)NULL, context)+VideoDecodeBufferFudgeFactor;
-    PTRACE(3, "Buffer too small: needs=" << newSize << ", actual=" << m_bufferRTP->GetSize() << ", ptr=" << m_bufferRTP);
-    if (!m_bufferRTP->SetMinSize(newSize))
-      return false;
+  if ((flags & PluginCodec_ReturnCoderBufferTooSmall) != 0 && !RetryDecode(src, toLen, flags))
+    return false;
 
-    // Send an empty payload frame that has a marker bit
-    RTP_DataFrame marker(src, src.GetHeaderSize());
-    marker.SetMarker(true);
+  return CompleteDecode(src, packetsLost, flags, toLen, dstList);
+}
 
-    fromLen = marker.GetHeaderSize();
-    toLen = m_bufferRTP->GetSize();
-    flags = 0;
 
-    if (!Transcode((const BYTE *)marker, &fromLen, m_bufferRTP->GetPointer(), &toLen, &flags))
-      return false;
+bool OpalPluginVideoTranscoder::RetryDecode(const RTP_DataFrame & src, unsigned & toLen, unsigned & flags)
+{
+  PINDEX newSize = getOutputDataSizeControl.Call((void *)NULL, (unsigned *)NULL, context)+VideoDecodeBufferFudgeFactor;
+  PTRACE(3, "Buffer too small: needs=" << newSize << ", actual=" << m_bufferRTP->GetSize() << ", ptr=" << m_bufferRTP);
+  if (!m_bufferRTP->SetMinSize(newSize))
+    return false;
 
-    if ((flags & PluginCodec_ReturnCoderBufferTooSmall) != 0) {
-      PTRACE(1, "New output buffer size requested and allocated, still not big enough, error in plug in.");
-      return false;
-    }
+  // Send an empty payload frame that has a marker bit
+  RTP_DataFrame marker(src, src.GetHeaderSize());
+  marker.SetMarker(true);
+
+  unsigned fromLen = marker.GetHeaderSize();
+  toLen = m_bufferRTP->GetSize();
+  flags = 0;
+
+  if (!Transcode((const BYTE *)marker, &fromLen, m_bufferRTP->GetPointer(), &toLen, &flags))
+    return false;
+
+  if ((flags & PluginCodec_ReturnCoderBufferTooSmall) != 0) {
+    PTRACE(1, "New output buffer size requested and allocated, still not big enough, error in plug in.");
+    return false;
   }
 
+  return true;
+}
+
+
+bool OpalPluginVideoTranscoder::CompleteDecode(const RTP_DataFrame & src,
+                                               bool packetsLost,
+                                               unsigned flags,
+                                               unsigned toLen,
+                                               RTP_DataFrameList & dstList)
+{
   PTRACE_IF(3, (flags & PluginCodec_ReturnCoderRequestIFrame) != 0, "Could not decode frame, "
                       "sending OpalVideoPictureLoss in hope of an I-Frame: " << setw(1) << src);
 
@@ -1288,7 +1400,7 @@ bool OpalPluginVideoTranscoder::DecodeFrame(const RTP_DataFrame & src, RTP_DataF
   PTRACE_IF(3, packetsLost, "Packets lost, sending OpalVideoPictureLoss in hope of an I-Frame: " << setw(1) << src);
   bool pictureLost = packetsLost || (flags & PluginCodec_ReturnCoderRequestIFrame) != 0;
   if (pictureLost)
-    SendIFrameRequest(sequenceNumber, src.GetTimestamp());
+    SendIFrameRequest(src.GetSequenceNumber(), src.GetTimestamp());
 
   if ((flags & PluginCodec_ReturnCoderIFrame) != 0) {
     m_decodingIntraFrameControl.IntraFrameDetected();
@@ -1340,6 +1452,122 @@ bool OpalPluginVideoTranscoder::DecodeFrame(const RTP_DataFrame & src, RTP_DataF
 };
 
 
+static size_t const MaxAccessUnitPackets = 1000; // Safety net if the marker bit logic above fails
+
+/* Gather the packets of an access unit, and pass them all to the plug in, in
+   one call, when the marker arrives. As the decoder cannot produce anything
+   until then, this adds no latency. The packets are copied into one buffer,
+   which is kept from frame to frame. */
+bool OpalPluginVideoTranscoder::QueueAccessUnit(const RTP_DataFrame & src, RTP_DataFrameList & dstList)
+{
+  PINDEX length = src.GetPacketSize();
+  PINDEX needed = m_accessUnitSize + length;
+  if (needed > m_accessUnitData.GetSize() && !m_accessUnitData.SetSize(std::max(needed, m_accessUnitData.GetSize()*2)))
+    return false;
+
+  memcpy(m_accessUnitData.GetPointer() + m_accessUnitSize, (const BYTE *)src, length);
+  m_accessUnitOffsets.push_back(m_accessUnitSize);
+  m_accessUnitSize = needed;
+
+  PluginCodec_Packet packet;
+  packet.data = NULL; // Set in DecodeAccessUnit() as buffer may move
+  packet.length = length;
+  packet.flags = src.GetDiscontinuity() > 0 ? PluginCodec_CoderPacketLoss : 0;
+  m_accessUnitPackets.push_back(packet);
+
+  if (!src.GetMarker() && m_accessUnitPackets.size() < MaxAccessUnitPackets)
+    return true;
+
+  return DecodeAccessUnit(dstList);
+}
+
+
+bool OpalPluginVideoTranscoder::DecodeAccessUnit(RTP_DataFrameList & dstList)
+{
+  BYTE * base = m_accessUnitData.GetPointer();
+  for (size_t i = 0; i < m_accessUnitPackets.size(); ++i)
+    m_accessUnitPackets[i].data = base + m_accessUnitOffsets[i];
+
+  PluginCodec_Packet * input = &m_accessUnitPackets[0];
+  unsigned remaining = (unsigned)m_accessUnitPackets.size();
+  bool ok = true;
+
+  while (ok && remaining > 0) {
+    if (m_bufferRTP == NULL) {
+      int outputDataSize = getOutputDataSizeControl.Call((void *)NULL, (unsigned *)NULL, context);
+      if (outputDataSize <= 0)
+        outputDataSize = GetOptimalDataFrameSize(false);
+      m_bufferRTP = new RTP_DataFrame((PINDEX)0, outputDataSize + VideoDecodeBufferFudgeFactor);
+      m_lastFrameWasIFrame = false;
+    }
+
+    RTP_DataFrame last(input[remaining-1].data, input[remaining-1].length, false);
+    m_bufferRTP->SetPayloadSize(0);
+    m_bufferRTP->CopyHeader(last);
+    m_bufferRTP->SetPadding(false);
+
+    PluginCodec_Packet output;
+    output.data = m_bufferRTP->GetPointer();
+    output.length = m_bufferRTP->GetSize();
+    output.flags = 0;
+
+    PluginCodec_FrameBatch batch;
+    batch.version = PLUGINCODEC_FRAME_BATCH_VERSION;
+    batch.input = input;
+    batch.inputCount = remaining;
+    batch.output = &output;
+    batch.outputCount = 1;
+    batch.flags = 0;
+
+    int result = TranscodeFrame(batch);
+    if (result < 0) {
+      PTRACE(3, "Plug in does not support frame level transcode version "
+             << PLUGINCODEC_FRAME_BATCH_VERSION << ", using per packet transcode");
+      m_useTranscodeFrame = false;
+      for (; ok && remaining > 0; ++input, --remaining) {
+        RTP_DataFrame packet(input->data, input->length, false);
+        packet.SetDiscontinuity((input->flags & PluginCodec_CoderPacketLoss) != 0 ? 1 : 0);
+        ok = DecodeFrame(packet, dstList);
+      }
+      break;
+    }
+
+    if (result == 0 || batch.inputCount == 0 || batch.inputCount > remaining) {
+      PTRACE_IF(1, result != 0, "Frame level transcode made no progress, error in plug in.");
+      ok = false;
+      break;
+    }
+
+    bool packetsLost = false;
+    for (unsigned i = 0; i < batch.inputCount; ++i) {
+      if ((input[i].flags & PluginCodec_CoderPacketLoss) != 0)
+        packetsLost = true;
+    }
+
+    // The packet that completed the frame, or needs a bigger buffer
+    RTP_DataFrame completed(input[batch.inputCount-1].data, input[batch.inputCount-1].length, false);
+
+    unsigned toLen = output.length;
+    unsigned flags = batch.flags;
+    if ((flags & PluginCodec_ReturnCoderBufferTooSmall) != 0)
+      ok = RetryDecode(completed, toLen, flags);
+    else if (batch.outputCount == 0)
+      flags &= ~PluginCodec_ReturnCoderLastFrame;
+
+    if (ok)
+      ok = CompleteDecode(completed, packetsLost, flags, toLen, dstList);
+
+    input += batch.inputCount;
+    remaining -= batch.inputCount;
+  }
+
+  m_accessUnitSize = 0;
+  m_accessUnitOffsets.clear();
+  m_accessUnitPackets.clear();
+  return ok;
+}
+
+
 #if OPAL_STATISTICS
 void OpalPluginVideoTranscoder::GetStatistics(OpalMediaStatistics & statistics) const
 {
@@ -36,6 +36,12 @@
 
 #include <cmath>
 
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+  #include <emmintrin.h>
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+  #include <arm_neon.h>
+#endif
+
 
 #define new PNEW
 #define PTraceModule() "Silence"
@@ -65,63 +71,105 @@ class OpalSilenceDetector::MyData : public PObject
   {
     unsigned m_timestamp;
     int      m_level;
-    Sample(unsigned timestamp, int level) : m_timestamp(timestamp), m_level(level) { }
+    Sample(unsigned timestamp = 0, int level = 0) : m_timestamp(timestamp), m_level(level) { }
   };
 
-  struct History : std::deque<Sample>
+  /* Fixed ring of samples, sized so that a full period of 10ms frames fits
+     without reallocation. Only grows (doubling) if frames are smaller. */
+  struct History
   {
+    std::vector<Sample> m_ring;
+    size_t   m_first;
+    size_t   m_count;
     unsigned m_period;
     int64_t  m_sum;
     int      m_average;
 
     History()
-      : m_period(0)
+      : m_ring(16)
+      , m_first(0)
+      , m_count(0)
+      , m_period(0)
       , m_sum(0)
       , m_average(OpalSilenceDetector::MinAudioLevel)
     {
     }
 
+    void SetPeriod(unsigned period, unsigned periodMS)
+    {
+      m_period = period;
+
+      size_t size = m_ring.size();
+      while (size < periodMS/10+2)
+        size *= 2;
+      if (size != m_ring.size())
+        Resize(size);
+    }
+
+    void Resize(size_t size)
+    {
+      std::vector<Sample> ring(size);
+      for (size_t i = 0; i < m_count; ++i)
+        ring[i] = At(i);
+      m_ring.swap(ring);
+      m_first = 0;
+    }
+
+    Sample & At(size_t index) { return m_ring[(m_first + index) & (m_ring.size()-1)]; }
+    Sample & Front() { return m_ring[m_first]; }
+    Sample & Back() { return At(m_count-1); }
+
+    void PopFront()
+    {
+      m_first = (m_first + 1) & (m_ring.size()-1);
+      --m_count;
+    }
+
+    void PushBack(unsigned timestamp, int level)
+    {
+      if (m_count >= m_ring.size())
+        Resize(m_ring.size()*2);
+      At(m_count++) = Sample(timestamp, level);
+    }
+
     void Reset()
     {
-      clear();
+      m_first = m_count = 0;
       m_sum = 0;
     }
 
     void Process(unsigned timestamp, int level)
     {
-      if (size() >= 2) {
+      if (m_count >= 2) {
         unsigned thresholdTimestamp = timestamp - m_period;
 
         // had a big pause and whole history has aged
-        if (back().m_timestamp < thresholdTimestamp)
+        if (Back().m_timestamp < thresholdTimestamp)
           Reset();
         else {
-          // REmove the old entries
-          iterator next = begin();
-          iterator earliest = next++;
-          while (next != end() && next->m_timestamp <= thresholdTimestamp) {
-            m_sum -= (int64_t)(next->m_timestamp - earliest->m_timestamp) * earliest->m_level;
-            erase(earliest++);
-            ++next;
+          // Remove the old entries
+          while (m_count > 1 && At(1).m_timestamp <= thresholdTimestamp) {
+            m_sum -= (int64_t)(At(1).m_timestamp - Front().m_timestamp) * Front().m_level;
+            PopFront();
           }
           // In case we have split a period, keep old level and just shorten the period
-          if (thresholdTimestamp > earliest->m_timestamp) {
-            m_sum -= (int64_t)(thresholdTimestamp - earliest->m_timestamp) * earliest->m_level;
-            earliest->m_timestamp = thresholdTimestamp;
+          if (thresholdTimestamp > Front().m_timestamp) {
+            m_sum -= (int64_t)(thresholdTimestamp - Front().m_timestamp) * Front().m_level;
+            Front().m_timestamp = thresholdTimestamp;
           }
         }
       }
 
-      if (empty()) {
+      if (m_count == 0) {
         Reset();
         m_average = level;
       }
-      else if (timestamp > front().m_timestamp) {
-        m_sum += (int64_t)(timestamp - back().m_timestamp) * back().m_level;
-        m_average = (int)(m_sum / (timestamp - front().m_timestamp));
+      else if (timestamp > Front().m_timestamp) {
+        m_sum += (int64_t)(timestamp - Back().m_timestamp) * Back().m_level;
+        m_average = (int)(m_sum / (timestamp - Front().m_timestamp));
       }
 
-      push_back(Sample(timestamp, level));
+      PushBack(timestamp, level);
     }
   };
 
@@ -150,8 +198,8 @@ public:
     m_signalDeadband = m_owner.m_params.m_signalDeadband*m_owner.m_params.m_sampleRate/1000;
     m_silenceDeadband = m_owner.m_params.m_silenceDeadband*m_owner.m_params.m_sampleRate/1000;
     m_adaptivePeriod = m_owner.m_params.m_adaptivePeriod*m_owner.m_params.m_sampleRate/1000;
-    m_shortTerm.m_period = m_owner.m_params.m_shortTermPeriod*m_owner.m_params.m_sampleRate/1000;
-    m_longTerm.m_period = m_owner.m_params.m_longTermPeriod*m_owner.m_params.m_sampleRate/1000;
+    m_shortTerm.SetPeriod(m_owner.m_params.m_shortTermPeriod*m_owner.m_params.m_sampleRate/1000, m_owner.m_params.m_shortTermPeriod);
+    m_longTerm.SetPeriod(m_owner.m_params.m_longTermPeriod*m_owner.m_params.m_sampleRate/1000, m_owner.m_params.m_longTermPeriod);
 
     switch (m_owner.m_params.m_mode) {
       case NoSilenceDetection :
@@ -468,44 +516,112 @@ void OpalSilenceDetector::CalculateDB::Reset()
 
 OpalSilenceDetector::CalculateDB & OpalSilenceDetector::CalculateDB::Accumulate(const void * pcm, PINDEX size)
 {
-  const short * samplePtr = (const short *)pcm;
   PINDEX sampleCount = size/sizeof(short);
-
+  m_rmsSum += SumOfSquares((const short *)pcm, sampleCount);
   m_rmsSamples += sampleCount;
+  return *this;
+}
+
+
+int OpalSilenceDetector::CalculateDB::Finalise()
+{
+  int level = SumOfSquaresToDB(m_rmsSum, m_rmsSamples);
+  Reset(); // Ready for next block
+  return level;
+}
+
 
-  while (sampleCount-- > 0) {
-    double sample = (double)(*samplePtr++) / std::numeric_limits<short>::max();
-    m_rmsSum += sample * sample;
+uint64_t OpalSilenceDetector::CalculateDB::SumOfSquares(const short * samples, PINDEX count)
+{
+  uint64_t sum = 0;
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+  /* The pairwise sum from _mm_madd_epi16 is at most 2*32768^2 = 2^31, which
+     fits an unsigned 32 bit lane, so zero extend to 64 bits to accumulate. */
+  const __m128i zero = _mm_setzero_si128();
+  __m128i acc = zero;
+  while (count >= 8) {
+    __m128i pcm = _mm_loadu_si128((const __m128i *)samples);
+    __m128i squares = _mm_madd_epi16(pcm, pcm);
+    acc = _mm_add_epi64(acc, _mm_unpacklo_epi32(squares, zero));
+    acc = _mm_add_epi64(acc, _mm_unpackhi_epi32(squares, zero));
+    samples += 8;
+    count -= 8;
   }
+  uint64_t lanes[2];
+  _mm_storeu_si128((__m128i *)lanes, acc);
+  sum = lanes[0] + lanes[1];
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+  int64x2_t acc = vdupq_n_s64(0);
+  while (count >= 8) {
+    int16x8_t pcm = vld1q_s16(samples);
+    acc = vpadalq_s32(acc, vmull_s16(vget_low_s16(pcm), vget_low_s16(pcm)));
+    acc = vpadalq_s32(acc, vmull_s16(vget_high_s16(pcm), vget_high_s16(pcm)));
+    samples += 8;
+    count -= 8;
+  }
+  sum = (uint64_t)(vgetq_lane_s64(acc, 0) + vgetq_lane_s64(acc, 1));
+#endif
 
-  return *this;
+  while (count-- > 0) {
+    int sample = *samples++;
+    sum += (unsigned)(sample * sample);
+  }
+
+  return sum;
 }
 
 
-int OpalSilenceDetector::CalculateDB::Finalise()
+/* Table of mean square values, scaled to PCM-16 full scale, at which the
+   rounded dBov value changes. Entry N is the lowest mean square that still
+   rounds to -N dBov, so that a binary search replaces the log10() call. */
+static struct DBThresholdTable
 {
-  // Calculate the root mean square (RMS) of the signal.
-  double rms = std::sqrt(m_rmsSum / m_rmsSamples);
+  enum { Size = -OpalSilenceDetector::MinAudioLevel };
+  double m_threshold[Size];
 
-  Reset(); // Ready for next block
+  DBThresholdTable()
+  {
+    const double fullScale = (double)std::numeric_limits<short>::max()*std::numeric_limits<short>::max();
+    for (int i = 0; i < Size; ++i)
+      m_threshold[i] = fullScale*std::pow(10.0, -(i + 0.5)/10.0);
+  }
+} const s_dbThresholds;
 
-  /* The audio level is a logarithmic measure of the rms level of an audio
-     sample relative to a reference value and is measured in decibels. */
-  if (rms <= 0)
-    return MinAudioLevel; // zero RMS is digital silence
-
-  /* The "zero" reference level is the overload level, which corresponds to
-     1.0 in this calculation, because the samples are normalized in
-     calculating the RMS. */
-  double db = 20 * std::log10(rms);
-
-  /* Ensure that the calculated level is within the minimum and maximum range
-     permitted. */
-  if (db < MinAudioLevel)
+
+int OpalSilenceDetector::CalculateDB::SumOfSquaresToDB(uint64_t sumOfSquares, uint64_t sampleCount)
+{
+  /* A zero sum is digital silence, no samples at all also considered so, as
+     there is nothing to indicate otherwise. */
+  if (sumOfSquares == 0 || sampleCount == 0)
     return MinAudioLevel;
-  if (db > MaxAudioLevel)
-    return MaxAudioLevel;
-  return (int)rint(db);
+
+  /* The audio level is a logarithmic measure of the rms level of an audio
+     sample relative to the overload level, and is measured in decibels.
+     20*log10(rms) == 10*log10(mean square), so no square root needed. */
+  double meanSquare = (double)sumOfSquares / sampleCount;
+
+  int low = 0;
+  int high = DBThresholdTable::Size;
+  while (low < high) {
+    int mid = (low + high) / 2;
+    if (meanSquare >= s_dbThresholds.m_threshold[mid])
+      high = mid;
+    else
+      low = mid + 1;
+  }
+
+  // Falling off the end of the table clamps to MinAudioLevel
+  return -low;
+}
+
+
+void OpalSilenceDetector::CalculateDB::CalculateBatch(const Block * blocks, size_t count, int * levels)
+{
+  for (size_t i = 0; i < count; ++i) {
+    PINDEX sampleCount = blocks[i].m_size/sizeof(short);
+    levels[i] = SumOfSquaresToDB(SumOfSquares((const short *)blocks[i].m_pcm, sampleCount), sampleCount);
+  }
 }
 
 
@@ -36,6 +36,9 @@
 #include <ep/ivr.h>
 #include <opal/call.h>
 #include <opal/patch.h>
+#include <opal/transcoders.h>
+
+#include <algorithm>
 
 
 #define new PNEW
@@ -45,6 +48,324 @@
 #if OPAL_IVR
 
 
+/////////////////////////////////////////////////////////////////////////////
+
+OpalIVRPromptCache::Statistics::Statistics()
+  : m_prompts(0)
+  , m_pcmBytes(0)
+  , m_encodings(0)
+  , m_encodedBytes(0)
+  , m_reloads(0)
+  , m_hits(0)
+  , m_misses(0)
+{
+}
+
+
+void OpalIVRPromptCache::Statistics::PrintOn(ostream & strm) const
+{
+  strm << "prompts=" << m_prompts
+       << " pcm=" << m_pcmBytes
+       << " encodings=" << m_encodings
+       << " encoded=" << m_encodedBytes
+       << " reloads=" << m_reloads
+       << " hits=" << m_hits
+       << " misses=" << m_misses;
+}
+
+
+OpalIVRPromptCache::OpalIVRPromptCache()
+  : m_enabled(true)
+  , m_failureLifetime(0, 60)
+{
+}
+
+
+OpalIVRPromptCache::~OpalIVRPromptCache()
+{
+  PTRACE_IF(3, !m_prompts.empty(), "Prompt cache: " << m_statistics);
+}
+
+
+bool OpalIVRPromptCache::GetPrompt(const PFilePath & fn, const OpalMediaFormat & format, PBYTEArray & data)
+{
+  if (!m_enabled || format.GetMediaType() != OpalMediaType::Audio())
+    return false;
+
+  // A changed file costs a stat for every prompt played, but saves a read
+  PFileInfo info;
+  PInt64 fileSize = PFile::GetInfo(fn, info) ? (PInt64)info.size : -1;
+
+  if (!IsCurrent(fn, fileSize, info.modified)) {
+    // File I/O is outside the lock, so other calls are not kept waiting
+    Prompt prompt(fileSize, info.modified);
+    if (prompt.Load(fn)) {
+      PTRACE(4, "Loaded prompt " << fn << ", " << prompt.m_pcm.GetSize() << " bytes at " << prompt.m_sampleRate << "Hz");
+    }
+    Store(fn, prompt);
+  }
+
+  PBYTEArray pcm;
+  unsigned sampleRate;
+  {
+    PWaitAndSignal mutex(m_mutex);
+
+    PromptMap::iterator it = m_prompts.find(fn);
+    if (it == m_prompts.end() || it->second.m_pcm.IsEmpty() || format.GetClockRate() != it->second.m_sampleRate) {
+      ++m_statistics.m_misses;
+      return false;
+    }
+
+    Prompt & prompt = it->second;
+    if (!format.IsTransportable()) {
+      if (format.GetOptionInteger(OpalAudioFormat::ChannelsOption(), 1) != 1) {
+        ++m_statistics.m_misses;
+        return false;
+      }
+      data = prompt.m_pcm;
+      ++m_statistics.m_hits;
+      return true;
+    }
+
+    std::map<PString, PBYTEArray>::iterator enc = prompt.m_encoded.find(format.GetName());
+    if (enc != prompt.m_encoded.end()) {
+      if (enc->second.IsEmpty()) {
+        ++m_statistics.m_misses;
+        return false;
+      }
+      data = enc->second;
+      ++m_statistics.m_hits;
+      return true;
+    }
+
+    pcm = prompt.m_pcm;
+    sampleRate = prompt.m_sampleRate;
+  }
+
+  // Transcoding the whole prompt takes a while, do not block other calls
+  PBYTEArray encoded;
+  if (Encode(pcm, sampleRate, format, encoded)) {
+    PTRACE(3, "Encoded prompt " << fn << " to " << format << ", " << encoded.GetSize() << " bytes");
+  }
+
+  PWaitAndSignal mutex(m_mutex);
+
+  // Keep it, unless the prompt was reloaded, or another call encoded it, meanwhile
+  PromptMap::iterator it = m_prompts.find(fn);
+  if (it != m_prompts.end() &&
+      (const BYTE *)it->second.m_pcm == (const BYTE *)pcm &&
+      it->second.m_encoded.insert(make_pair(format.GetName(), encoded)).second &&
+      !encoded.IsEmpty()) {
+    ++m_statistics.m_encodings;
+    m_statistics.m_encodedBytes += encoded.GetSize();
+  }
+
+  if (encoded.IsEmpty()) {
+    ++m_statistics.m_misses;
+    return false;
+  }
+
+  data = encoded;
+  ++m_statistics.m_hits;
+  return true;
+}
+
+
+void OpalIVRPromptCache::GetStatistics(Statistics & statistics) const
+{
+  PWaitAndSignal mutex(m_mutex);
+  statistics = m_statistics;
+}
+
+
+bool OpalIVRPromptCache::IsCurrent(const PFilePath & fn, PInt64 fileSize, const PTime & modified)
+{
+  PWaitAndSignal mutex(m_mutex);
+  PromptMap::const_iterator it = m_prompts.find(fn);
+  return it != m_prompts.end() && IsCurrent(it->second, fileSize, modified);
+}
+
+
+bool OpalIVRPromptCache::IsCurrent(const Prompt & prompt, PInt64 fileSize, const PTime & modified) const
+{
+  // Failures are tried again after a while, in case it was something transient
+  if (prompt.m_pcm.IsEmpty() && prompt.m_loaded.GetElapsed() > m_failureLifetime)
+    return false;
+
+  return prompt.m_fileSize == fileSize && (fileSize < 0 || prompt.m_modified == modified);
+}
+
+
+void OpalIVRPromptCache::Store(const PFilePath & fn, const Prompt & prompt)
+{
+  PWaitAndSignal mutex(m_mutex);
+
+  PromptMap::iterator it = m_prompts.find(fn);
+  if (it == m_prompts.end()) {
+    // Do not let failures for files that come and go accumulate
+    PromptMap::iterator expired = m_prompts.begin();
+    while (expired != m_prompts.end()) {
+      if (expired->second.m_pcm.IsEmpty() && expired->second.m_loaded.GetElapsed() > m_failureLifetime)
+        m_prompts.erase(expired++);
+      else
+        ++expired;
+    }
+    it = m_prompts.insert(make_pair(fn, prompt)).first;
+  }
+  else {
+    // Another call may have beaten us to it
+    if (IsCurrent(it->second, prompt.m_fileSize, prompt.m_modified))
+      return;
+
+    /* Calls playing the old one have their own reference to the data, so it
+       is released when the last of them is done. */
+    if (!it->second.m_pcm.IsEmpty()) {
+      PTRACE(3, "Prompt " << fn << " changed, reloaded");
+      ++m_statistics.m_reloads;
+      --m_statistics.m_prompts;
+      m_statistics.m_pcmBytes -= it->second.m_pcm.GetSize();
+    }
+    for (std::map<PString, PBYTEArray>::iterator enc = it->second.m_encoded.begin(); enc != it->second.m_encoded.end(); ++enc) {
+      if (!enc->second.IsEmpty()) {
+        --m_statistics.m_encodings;
+        m_statistics.m_encodedBytes -= enc->second.GetSize();
+      }
+    }
+    it->second = prompt;
+  }
+
+  if (!prompt.m_pcm.IsEmpty()) {
+    ++m_statistics.m_prompts;
+    m_statistics.m_pcmBytes += prompt.m_pcm.GetSize();
+  }
+}
+
+
+OpalIVRPromptCache::Prompt::Prompt(PInt64 fileSize, const PTime & modified)
+  : m_fileSize(fileSize)
+  , m_modified(modified)
+  , m_sampleRate(0)
+{
+}
+
+
+bool OpalIVRPromptCache::Prompt::Load(const PFilePath & fn)
+{
+#if PBYTE_ORDER == PBIG_ENDIAN
+  PTRACE(4, "Cannot cache prompt " << fn << ", WAV data is little endian");
+  return false;
+#else
+  if (m_fileSize < 44 || m_fileSize > P_MAX_INDEX || !(fn.GetType() *= ".wav"))
+    return false;
+
+  // Read the whole file in one go, it is the size from the stat
+  PFile file;
+  PBYTEArray wav;
+  if (!file.Open(fn, PFile::ReadOnly) || !file.ReadBlock(wav.GetPointer((PINDEX)m_fileSize), (PINDEX)m_fileSize)) {
+    PTRACE(3, "Could not read prompt " << fn << ": " << file.GetErrorText());
+    return false;
+  }
+
+  const BYTE * wavData = wav;
+  size_t wavSize = wav.GetSize();
+
+  if (memcmp(wavData, "RIFF", 4) != 0 || memcmp(wavData+8, "WAVE", 4) != 0) {
+    PTRACE(3, "Prompt " << fn << " is not a WAV file");
+    return false;
+  }
+
+  // Find the format and data chunks
+  unsigned formatTag = 0, channels = 0, bitsPerSample = 0;
+  const BYTE * pcm = NULL;
+  size_t pcmSize = 0;
+  size_t pos = 12;
+  while (pos + 8 <= wavSize) {
+    const BYTE * chunk = wavData + pos;
+    size_t chunkSize = (uint32_t)*(const PUInt32l *)(chunk+4);
+    const BYTE * body = chunk + 8;
+    size_t available = std::min(chunkSize, wavSize - pos - 8);
+
+    if (memcmp(chunk, "fmt ", 4) == 0 && available >= 16) {
+      formatTag = *(const PUInt16l *)(body);
+      channels = *(const PUInt16l *)(body+2);
+      m_sampleRate = *(const PUInt32l *)(body+4);
+      bitsPerSample = *(const PUInt16l *)(body+14);
+    }
+    else if (memcmp(chunk, "data", 4) == 0) {
+      pcm = body;
+      pcmSize = available;
+      break;
+    }
+
+    pos += 8 + chunkSize + (chunkSize & 1);
+  }
+
+  if (formatTag != 1 || channels != 1 || bitsPerSample != 16 || pcm == NULL || pcmSize < 2) {
+    PTRACE(4, "Cannot cache prompt " << fn << ", not PCM-16 mono:"
+           " format=" << formatTag << " channels=" << channels << " bits=" << bitsPerSample);
+    return false;
+  }
+
+  /* Our own copy of just the samples, so a prompt file being rewritten can
+     never change, or truncate, the data under a call playing it. */
+  m_pcm = PBYTEArray(pcm, (PINDEX)(pcmSize & ~(size_t)1));
+  return true;
+#endif
+}
+
+
+bool OpalIVRPromptCache::Encode(const PBYTEArray & pcm, unsigned sampleRate, const OpalMediaFormat & format, PBYTEArray & encoded)
+{
+  unsigned frameTime = format.GetFrameTime();
+  PINDEX frameSize = format.GetFrameSize();
+  if (frameTime == 0 || frameSize == 0) {
+    PTRACE(4, "Cannot cache " << format << ", not a fixed frame size codec");
+    return false;
+  }
+
+  std::auto_ptr<OpalTranscoder> encoder(OpalTranscoder::Create(GetOpalPCM16(sampleRate), format));
+  if (encoder.get() == NULL) {
+    PTRACE(4, "Cannot cache " << format << ", no encoder");
+    return false;
+  }
+
+  PINDEX inputSize = frameTime*sizeof(short);
+  PINDEX frames = (pcm.GetSize() + inputSize - 1)/inputSize;
+  encoded.SetSize(frames*frameSize);
+  PINDEX used = 0;
+
+  RTP_DataFrame input(inputSize);
+  RTP_DataFrameList output;
+  for (PINDEX offset = 0; offset < pcm.GetSize(); offset += inputSize) {
+    PINDEX length = std::min(inputSize, pcm.GetSize() - offset);
+    memcpy(input.GetPayloadPtr(), (const BYTE *)pcm + offset, length);
+    if (length < inputSize)
+      memset(input.GetPayloadPtr() + length, 0, inputSize - length); // Pad last frame with silence
+    input.SetTimestamp(offset/sizeof(short));
+
+    if (!encoder->ConvertFrames(input, output)) {
+      PTRACE(2, "Encoding prompt to " << format << " failed");
+      encoded.SetSize(0);
+      return false;
+    }
+
+    for (RTP_DataFrameList::iterator it = output.begin(); it != output.end(); ++it) {
+      PINDEX size = it->GetPayloadSize();
+      if (size % frameSize != 0) {
+        PTRACE(4, "Cannot cache " << format << ", variable frame size of " << size << " bytes");
+        encoded.SetSize(0);
+        return false;
+      }
+      memcpy(encoded.GetPointer(used + size) + used, it->GetPayloadPtr(), size);
+      used += size;
+    }
+  }
+
+  encoded.SetSize(used);
+  return used > 0;
+}
+
+
 /////////////////////////////////////////////////////////////////////////////
 
 OpalIVREndPoint::OpalIVREndPoint(OpalManager & mgr, const char * prefix)
@@ -373,6 +694,13 @@ void OpalIVRConnection::OnEndDialog()
 }
 
 
+bool OpalIVRConnection::GetCachedPrompt(const PFilePath & fn, PBYTEArray & data)
+{
+  OpalMediaStreamPtr stream = GetMediaStream(OpalMediaType::Audio(), true);
+  return stream != NULL && endpoint.GetPromptCache().GetPrompt(fn, stream->GetMediaFormat(), data);
+}
+
+
 OpalMediaFormatList OpalIVRConnection::GetMediaFormats() const
 {
   OpalMediaFormatList mediaFormats = m_endpoint.GetMediaFormats();
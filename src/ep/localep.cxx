@@ -550,7 +550,7 @@ void OpalLocalConnection::AcceptIncoming()
 {
   PTRACE(3, "Accepting incoming call " << *this);
   GetEndPoint().GetManager().QueueDecoupledEvent(
-        new PSafeWorkNoArg<OpalLocalConnection>(this, &OpalLocalConnection::InternalAcceptIncoming));
+        new PSafeWorkNoArg<OpalLocalConnection>(this, &OpalLocalConnection::InternalAcceptIncoming), GetCall().GetToken());
 }
 
 
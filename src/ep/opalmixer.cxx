@@ -36,11 +36,23 @@
 #include <opal/patch.h>
 #include <rtp/rtp.h>
 #include <rtp/jitter.h>
+#include <codec/silencedetect.h>
 #include <ptlib/vconvert.h>
 #include <ptclib/pwavfile.h>
+#include <ptclib/random.h>
 #include <sip/handlers.h>
 #include <sip/sipcon.h>
 
+#include <algorithm>
+#include <functional>
+#include <list>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+  #include <emmintrin.h>
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+  #include <arm_neon.h>
+#endif
+
 
 #define DETAIL_LOG_LEVEL 6
 
@@ -89,6 +101,8 @@ OpalBaseMixer::OpalBaseMixer(bool pushThread, unsigned periodMS, unsigned period
   , m_pushFrame(NULL)
   , m_workerThread(NULL)
   , m_threadRunning(false)
+  , m_placementPolicy(NULL)
+  , m_placementGroup(-1)
 {
 }
 
@@ -228,6 +242,9 @@ void OpalBaseMixer::StopPushThread(bool lock)
 void OpalBaseMixer::PushThreadMain()
 {
   PTRACE(4, "PushThread start " << m_periodMS << " ms");
+  if (m_placementPolicy != NULL)
+    m_placementPolicy->BindThread(m_placementGroup);
+
   PAdaptiveDelay delay(500);
   while (m_threadRunning && OnPush())
     delay.Delay(m_periodMS);
@@ -365,6 +382,31 @@ bool OpalAudioMixer::SetJitterBufferSize(const Key_T & key, const OpalJitterBuff
 }
 
 
+void OpalAudioMixer::GetAudioLevels(AudioLevelMap & levels)
+{
+  PWaitAndSignal mutex(m_mutex);
+
+  size_t streamCount = m_inputStreams.size();
+  if (streamCount == 0)
+    return;
+
+  std::vector<OpalSilenceDetector::CalculateDB::Block> blocks(streamCount);
+  std::vector<int> dB(streamCount);
+
+  size_t i = 0;
+  for (StreamMap_T::iterator iter = m_inputStreams.begin(); iter != m_inputStreams.end(); ++iter, ++i) {
+    const PShortArray & samples = ((AudioStream *)iter->second)->m_cacheSamples;
+    blocks[i] = OpalSilenceDetector::CalculateDB::Block((const short *)samples, samples.GetSize()*sizeof(short));
+  }
+
+  OpalSilenceDetector::CalculateDB::CalculateBatch(blocks.data(), streamCount, dB.data());
+
+  i = 0;
+  for (StreamMap_T::iterator iter = m_inputStreams.begin(); iter != m_inputStreams.end(); ++iter, ++i)
+    levels[iter->first] = dB[i];
+}
+
+
 void OpalAudioMixer::PreMixStreams()
 {
   // Expected to already be mutexed
@@ -528,6 +570,199 @@ const short * OpalAudioMixer::AudioStream::GetAudioDataPtr()
 
 #if OPAL_VIDEO
 
+// Scaling is bilinear, using 8 bit fixed point fractions.
+static unsigned const FractionBits = 8;
+static unsigned const FractionOne = 1 << FractionBits;
+
+// Below this many output pixels, it is not worth waking up compositor threads
+static unsigned const MinParallelPixels = 640*360;
+
+
+static void BlendRows(const BYTE * row0, const BYTE * row1, unsigned fraction, BYTE * out, unsigned width)
+{
+  unsigned i = 0;
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+  __m128i const zero = _mm_setzero_si128();
+  __m128i const weight0 = _mm_set1_epi16((short)(FractionOne - fraction));
+  __m128i const weight1 = _mm_set1_epi16((short)fraction);
+  for (; i + 16 <= width; i += 16) {
+    __m128i a = _mm_loadu_si128((const __m128i *)(row0 + i));
+    __m128i b = _mm_loadu_si128((const __m128i *)(row1 + i));
+    // Values are at most 255*256, so unsigned 16 bit arithmetic cannot overflow
+    __m128i lo = _mm_add_epi16(_mm_mullo_epi16(_mm_unpacklo_epi8(a, zero), weight0),
+                               _mm_mullo_epi16(_mm_unpacklo_epi8(b, zero), weight1));
+    __m128i hi = _mm_add_epi16(_mm_mullo_epi16(_mm_unpackhi_epi8(a, zero), weight0),
+                               _mm_mullo_epi16(_mm_unpackhi_epi8(b, zero), weight1));
+    _mm_storeu_si128((__m128i *)(out + i), _mm_packus_epi16(_mm_srli_epi16(lo, FractionBits),
+                                                            _mm_srli_epi16(hi, FractionBits)));
+  }
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+  // Fraction is never zero here, so both weights fit in eight bits
+  uint8x8_t const weight0 = vdup_n_u8((uint8_t)(FractionOne - fraction));
+  uint8x8_t const weight1 = vdup_n_u8((uint8_t)fraction);
+  for (; i + 16 <= width; i += 16) {
+    uint8x16_t a = vld1q_u8(row0 + i);
+    uint8x16_t b = vld1q_u8(row1 + i);
+    uint16x8_t lo = vmlal_u8(vmull_u8(vget_low_u8(a), weight0), vget_low_u8(b), weight1);
+    uint16x8_t hi = vmlal_u8(vmull_u8(vget_high_u8(a), weight0), vget_high_u8(b), weight1);
+    vst1q_u8(out + i, vcombine_u8(vshrn_n_u16(lo, FractionBits), vshrn_n_u16(hi, FractionBits)));
+  }
+#endif
+
+  for (; i < width; ++i)
+    out[i] = (BYTE)((row0[i]*(FractionOne - fraction) + row1[i]*fraction) >> FractionBits);
+}
+
+
+typedef OpalVideoMixer::ScaleScratch::Step ScaleStep;
+
+
+// Map destination positions to source positions, aligning pixel centres.
+static void CalculateSteps(unsigned srcSize, unsigned dstSize, std::vector<ScaleStep> & steps)
+{
+  steps.resize(dstSize);
+  uint64_t step = ((uint64_t)srcSize << 16) / dstSize;
+  int64_t position = (int64_t)(step >> 1) - 0x8000;
+  for (unsigned i = 0; i < dstSize; ++i, position += step) {
+    uint64_t clamped = position > 0 ? (uint64_t)position : 0;
+    unsigned index = (unsigned)(clamped >> 16);
+    if (index >= srcSize - 1) {
+      steps[i].m_index0 = steps[i].m_index1 = srcSize - 1;
+      steps[i].m_fraction = 0;
+    }
+    else {
+      steps[i].m_index0 = index;
+      steps[i].m_index1 = index + 1;
+      steps[i].m_fraction = (unsigned)(clamped >> (16 - FractionBits)) & (FractionOne - 1);
+    }
+  }
+}
+
+
+static void ScalePlane(const BYTE * src, unsigned srcWidth, unsigned srcHeight,
+                       BYTE * dst, unsigned dstStride, unsigned dstWidth, unsigned dstHeight,
+                       OpalVideoMixer::ScaleScratch & scratch)
+{
+  if (srcWidth == dstWidth && srcHeight == dstHeight) {
+    for (unsigned y = 0; y < dstHeight; ++y)
+      memcpy(dst + y*dstStride, src + y*srcWidth, dstWidth);
+    return;
+  }
+
+  const std::vector<ScaleStep> & columns = scratch.m_columns;
+  const std::vector<ScaleStep> & rows = scratch.m_rows;
+  CalculateSteps(srcWidth, dstWidth, scratch.m_columns);
+  CalculateSteps(srcHeight, dstHeight, scratch.m_rows);
+
+  scratch.m_line.resize(srcWidth);
+  BYTE * blended = scratch.m_line.data();
+
+  for (unsigned y = 0; y < dstHeight; ++y) {
+    const ScaleStep & row = rows[y];
+    const BYTE * line = src + row.m_index0*srcWidth;
+    if (row.m_fraction != 0) {
+      BlendRows(line, src + row.m_index1*srcWidth, row.m_fraction, blended, srcWidth);
+      line = blended;
+    }
+
+    BYTE * out = dst + y*dstStride;
+    if (srcWidth == dstWidth)
+      memcpy(out, line, dstWidth);
+    else {
+      for (unsigned x = 0; x < dstWidth; ++x) {
+        const ScaleStep & col = columns[x];
+        out[x] = (BYTE)((line[col.m_index0]*(FractionOne - col.m_fraction) +
+                         line[col.m_index1]*col.m_fraction) >> FractionBits);
+      }
+    }
+  }
+}
+
+
+/* One set of compositor threads for the whole process, rather than a set per
+   mixer, so a large number of conferences does not mean a large number of
+   threads. A mixer queues an entry for each helper it wants, does what it can
+   itself, then withdraws any entries no thread got around to. */
+class OpalVideoCompositorPool
+{
+  public:
+    static OpalVideoCompositorPool & GetInstance()
+    {
+      // Deliberately never deleted, mixers may be destroyed during static destruction
+      static OpalVideoCompositorPool * instance = new OpalVideoCompositorPool();
+      return *instance;
+    }
+
+    unsigned GetThreadCount() const { return m_threadCount; }
+
+    void Queue(OpalVideoMixer & mixer, unsigned helpers)
+    {
+      m_mutex.Wait();
+      if (m_threads.empty())
+        StartThreads();
+      for (unsigned i = 0; i < helpers; ++i)
+        m_queue.push_back(&mixer);
+      m_mutex.Signal();
+
+      for (unsigned i = 0; i < helpers; ++i)
+        m_available.Signal();
+    }
+
+    unsigned Withdraw(OpalVideoMixer & mixer)
+    {
+      PWaitAndSignal lock(m_mutex);
+      size_t before = m_queue.size();
+      m_queue.remove(&mixer);
+      return (unsigned)(before - m_queue.size());
+    }
+
+  protected:
+    OpalVideoCompositorPool()
+      : m_threadCount(std::min(std::max(PThread::GetNumProcessors(), 1U) - 1, 8U))
+      , m_available(0, INT_MAX)
+    {
+    }
+
+    void StartThreads()
+    {
+      for (unsigned i = 0; i < m_threadCount; ++i)
+        m_threads.push_back(new PThreadObj1Arg<OpalVideoCompositorPool, unsigned>(*this, i, &OpalVideoCompositorPool::Main,
+                                                                                  false, "Compositor", PThread::NormalPriority));
+      PTRACE(4, "Started " << m_threadCount << " compositor threads");
+    }
+
+    void Main(unsigned PTRACE_PARAM(index))
+    {
+      PTRACE(5, "Compositor " << index << " started");
+
+      OpalVideoMixer::ScaleScratch scratch;
+      for (;;) {
+        m_available.Wait();
+
+        m_mutex.Wait();
+        if (m_queue.empty()) {
+          // Withdrawn by the mixer before we got to it
+          m_mutex.Signal();
+          continue;
+        }
+        OpalVideoMixer * mixer = m_queue.front();
+        m_queue.pop_front();
+        m_mutex.Signal();
+
+        mixer->CompositeNextTiles(scratch);
+        mixer->m_compositeDone.Signal();
+      }
+    }
+
+    unsigned                    m_threadCount;
+    PDECLARE_MUTEX(m_mutex);
+    std::list<OpalVideoMixer *> m_queue;
+    PSemaphore                  m_available;
+    std::vector<PThread *>      m_threads;
+};
+
+
 OpalVideoMixer::OpalVideoMixer(Styles style, unsigned width, unsigned height, unsigned rate, bool pushThread)
   : OpalBaseMixer(pushThread, 1000/rate, OpalMediaFormat::VideoClockRate/rate)
   , m_style(style)
@@ -535,11 +770,22 @@ OpalVideoMixer::OpalVideoMixer(Styles style, unsigned width, unsigned height, un
   , m_bgFillGreen(0)
   , m_bgFillBlue(0)
   , m_lastStreamCount(0)
+  , m_redrawAll(true)
+  , m_nextTile(0)
+  , m_compositeTarget(NULL)
+  , m_compositorThreads(OpalVideoCompositorPool::GetInstance().GetThreadCount())
+  , m_compositeDone(0, INT_MAX)
 {
   SetFrameSize(width, height);
 }
 
 
+OpalVideoMixer::~OpalVideoMixer()
+{
+  StopPushThread();
+}
+
+
 bool OpalVideoMixer::SetFrameRate(unsigned rate)
 {
   if (rate == 0 || rate > 100)
@@ -561,15 +807,32 @@ bool OpalVideoMixer::SetFrameSize(unsigned width, unsigned height)
 
   m_width = width;
   m_height = height;
-  PColourConverter::FillYUV420P(0, 0, m_width, m_height, m_width, m_height,
-                                m_frameStore.GetPointer(PVideoFrameInfo::CalculateFrameBytes(m_width, m_height)),
-                                m_bgFillRed, m_bgFillGreen, m_bgFillBlue);
+  m_frameStore.SetSize(PVideoFrameInfo::CalculateFrameBytes(m_width, m_height));
+  FillFrameStore();
 
   m_mutex.Signal();
   return true;
 }
 
 
+void OpalVideoMixer::SetCompositorThreads(unsigned threads)
+{
+  PWaitAndSignal mutex(m_mutex);
+
+  m_compositorThreads = std::min(threads, OpalVideoCompositorPool::GetInstance().GetThreadCount());
+  PTRACE(4, "Compositor threads set to " << m_compositorThreads);
+}
+
+
+void OpalVideoMixer::FillFrameStore()
+{
+  PColourConverter::FillYUV420P(0, 0, m_width, m_height, m_width, m_height,
+                                m_frameStore.GetPointer(),
+                                m_bgFillRed, m_bgFillGreen, m_bgFillBlue);
+  m_redrawAll = true;
+}
+
+
 OpalBaseMixer::Stream * OpalVideoMixer::CreateStream()
 {
   return new VideoStream(*this);
@@ -578,9 +841,13 @@ OpalBaseMixer::Stream * OpalVideoMixer::CreateStream()
 
 bool OpalVideoMixer::MixStreams(RTP_DataFrame & frame)
 {
+  m_tiles.clear();
+
   if (!MixVideo())
     return false;
 
+  CompositeTiles();
+
   frame.SetPayloadSize(GetOutputSize());
   PluginCodec_Video_FrameHeader * video = (PluginCodec_Video_FrameHeader *)frame.GetPayloadPtr();
   video->width = m_width;
@@ -648,9 +915,7 @@ bool OpalVideoMixer::StartMix(unsigned & x, unsigned & y, unsigned & w, unsigned
       x = left = 0;
       y = 0;
       if (m_lastStreamCount != m_inputStreams.size()) {
-        PColourConverter::FillYUV420P(0, 0, m_width, m_height, m_width, m_height,
-                                      m_frameStore.GetPointer(),
-                                      m_bgFillRed, m_bgFillGreen, m_bgFillBlue);
+        FillFrameStore();
         m_lastStreamCount = m_inputStreams.size();
       }
       switch (m_lastStreamCount) {
@@ -680,9 +945,15 @@ bool OpalVideoMixer::StartMix(unsigned & x, unsigned & y, unsigned & w, unsigned
           break;
 
         default:
-          w = m_width / 4;
-          h = m_height / 4;
+        {
+          // Smallest square grid that fits them all, 4x4, 5x5 etc
+          unsigned side = 4;
+          while (side*side < m_lastStreamCount)
+            ++side;
+          w = m_width / side;
+          h = m_height / side;
           break;
+        }
       }
       break;
 
@@ -714,6 +985,56 @@ void OpalVideoMixer::InsertVideoFrame(const StreamMap_T::iterator & it, unsigned
 }
 
 
+void OpalVideoMixer::CompositeTiles()
+{
+  m_changedRegions.clear();
+  if (m_redrawAll)
+    m_changedRegions.push_back(Region(0, 0, m_width, m_height));
+  else {
+    for (size_t i = 0; i < m_tiles.size(); ++i)
+      m_changedRegions.push_back(m_tiles[i]->m_tile);
+  }
+  m_redrawAll = false;
+
+  if (m_tiles.empty())
+    return;
+
+  unsigned pixels = 0;
+  for (size_t i = 0; i < m_tiles.size(); ++i)
+    pixels += m_tiles[i]->m_tile.m_width*m_tiles[i]->m_tile.m_height;
+
+  unsigned helpers = 0;
+  if (pixels >= MinParallelPixels)
+    helpers = std::min((unsigned)m_tiles.size()-1, m_compositorThreads);
+
+  m_compositeTarget = m_frameStore.GetPointer();
+  m_nextTile = 0;
+
+  OpalVideoCompositorPool & pool = OpalVideoCompositorPool::GetInstance();
+  if (helpers > 0)
+    pool.Queue(*this, helpers);
+
+  // This thread does its share too
+  CompositeNextTiles(m_scratch);
+
+  /* The pool may be busy with other mixers, in which case we probably did all
+     the work ourselves, so do not wait for threads that never started. */
+  if (helpers > 0)
+    helpers -= pool.Withdraw(*this);
+
+  for (unsigned i = 0; i < helpers; ++i)
+    m_compositeDone.Wait();
+}
+
+
+void OpalVideoMixer::CompositeNextTiles(ScaleScratch & scratch)
+{
+  size_t index;
+  while ((index = m_nextTile++) < m_tiles.size())
+    m_tiles[index]->CompositeVideoFrame(m_compositeTarget, scratch);
+}
+
+
 size_t OpalVideoMixer::GetOutputSize() const
 {
   return m_frameStore.GetSize() + sizeof(PluginCodec_Video_FrameHeader);
@@ -734,26 +1055,62 @@ void OpalVideoMixer::VideoStream::QueuePacket(const RTP_DataFrame & rtp)
 
 void OpalVideoMixer::VideoStream::InsertVideoFrame(unsigned x, unsigned y, unsigned w, unsigned h)
 {
-  if (m_queue.empty())
+  if (!m_queue.empty()) {
+    m_lastFrame = m_queue.front();
+
+    /* To avoid continual build up of frames in queue if input frame rate
+       greater than mixer frame, we flush the queue, but keep one to allow for
+       slight mismatches in timing when frame rates are identical. */
+    do {
+      m_queue.pop();
+    } while (m_queue.size() > 1);
+  }
+  else if (!m_mixer.m_redrawAll && m_tile.m_x == x && m_tile.m_y == y && m_tile.m_width == w && m_tile.m_height == h)
+    return; // Nothing has changed, leave what is in the frame store
+
+  if (m_lastFrame.GetPayloadSize() < (PINDEX)sizeof(PluginCodec_Video_FrameHeader))
+    return; // Never had a frame
+
+  const PluginCodec_Video_FrameHeader * header = (const PluginCodec_Video_FrameHeader *)m_lastFrame.GetPayloadPtr();
+  if (header->width < 2 || header->height < 2 || m_lastFrame.GetPayloadSize() <
+          (PINDEX)(sizeof(PluginCodec_Video_FrameHeader) + PVideoFrameInfo::CalculateFrameBytes(header->width, header->height))) {
+    PTRACE(2, "Invalid video frame " << header->width << 'x' << header->height << ", size " << m_lastFrame.GetPayloadSize());
+    m_lastFrame.SetPayloadSize(0);
     return;
+  }
 
-  PluginCodec_Video_FrameHeader * header = (PluginCodec_Video_FrameHeader *)m_queue.front().GetPayloadPtr();
+  m_tile = Region(x, y, w, h);
+  m_mixer.m_tiles.push_back(this);
+}
+
+
+void OpalVideoMixer::VideoStream::CompositeVideoFrame(BYTE * dst, ScaleScratch & scratch)
+{
+  const PluginCodec_Video_FrameHeader * header = (const PluginCodec_Video_FrameHeader *)m_lastFrame.GetPayloadPtr();
+  unsigned srcWidth = header->width;
+  unsigned srcHeight = header->height;
+  const BYTE * src = OpalVideoFrameDataPtr(header);
 
-  PTRACE(DETAIL_LOG_LEVEL, "Copying video: " << header->width << 'x' << header->height
-         << " -> " << x << ',' << y << '/' << w << 'x' << h);
+  PTRACE(DETAIL_LOG_LEVEL, "Copying video: " << srcWidth << 'x' << srcHeight
+         << " -> " << m_tile.m_x << ',' << m_tile.m_y << '/' << m_tile.m_width << 'x' << m_tile.m_height);
 
-  PColourConverter::CopyYUV420P(0, 0, header->width, header->height,
-                                header->width, header->height, OpalVideoFrameDataPtr(header),
-                                x, y, w, h,
-                                m_mixer.m_width, m_mixer.m_height, m_mixer.m_frameStore.GetPointer(),
-                                PVideoFrameInfo::eScale);
+  unsigned frameWidth = m_mixer.m_width;
+  unsigned frameHeight = m_mixer.m_height;
 
-  /* To avoid continual build up of frames in queue if input frame rate
-     greater than mixer frame, we flush the queue, but keep one to allow for
-     slight mismatches in timing when frame rates are identical. */
-  do {
-    m_queue.pop();
-  } while (m_queue.size() > 1);
+  // Y plane
+  ScalePlane(src, srcWidth, srcHeight,
+             dst + m_tile.m_y*frameWidth + m_tile.m_x, frameWidth,
+             m_tile.m_width, m_tile.m_height, scratch);
+
+  // U and V planes
+  unsigned srcPlane = srcWidth*srcHeight;
+  unsigned dstPlane = frameWidth*frameHeight;
+  unsigned chromaOffset = (m_tile.m_y/2)*(frameWidth/2) + m_tile.m_x/2;
+  for (int plane = 0; plane < 2; ++plane) {
+    ScalePlane(src + srcPlane + plane*(srcPlane/4), srcWidth/2, srcHeight/2,
+               dst + dstPlane + plane*(dstPlane/4) + chromaOffset, frameWidth/2,
+               m_tile.m_width/2, m_tile.m_height/2, scratch);
+  }
 }
 
 
@@ -1126,6 +1483,7 @@ OpalMixerMediaStream::OpalMixerMediaStream(OpalConnection & conn,
   : OpalMediaStream(conn, format, sessionID, isSource)
   , m_node(node)
   , m_listenOnly(listenOnly)
+  , m_formatGeneration(0)
 #if OPAL_VIDEO
   , m_mixedVideoWidth(0)
   , m_mixedVideoHeight(0)
@@ -1137,11 +1495,14 @@ OpalMixerMediaStream::OpalMixerMediaStream(OpalConnection & conn,
      codec type so the OpalPatch system creates the codec for us. With the
      transmitter (source) we keep the required media format so the mixed data
      thread can cache and optimise an encoded frame across multiple remote
-     connections. */
+     connections. When selectively forwarding video, the sink also keeps the
+     network codec, as the media is never decoded. */
   if (IsSink()) {
 #if OPAL_VIDEO
-    if (m_mediaFormat.GetMediaType() == OpalMediaType::Video())
-      m_mediaFormat = OpalYUV420P;
+    if (m_mediaFormat.GetMediaType() == OpalMediaType::Video()) {
+      if (!m_node->GetNodeInfo().m_selectiveForwarding)
+        m_mediaFormat = OpalYUV420P;
+    }
     else
 #endif
       m_mediaFormat = OpalPCM16;
@@ -1192,6 +1553,16 @@ PBoolean OpalMixerMediaStream::WritePacket(RTP_DataFrame & packet)
 }
 
 
+PBoolean OpalMixerMediaStream::SetDataSize(PINDEX dataSize, PINDEX frameTime)
+{
+  if (!OpalMediaStream::SetDataSize(dataSize, frameTime))
+    return false;
+
+  ++m_formatGeneration;
+  return true;
+}
+
+
 PBoolean OpalMixerMediaStream::IsSynchronous() const
 {
   return false;
@@ -1204,6 +1575,25 @@ PBoolean OpalMixerMediaStream::RequiresPatchThread() const
 }
 
 
+bool OpalMixerMediaStream::InternalExecuteCommand(const OpalMediaCommand & command)
+{
+  if (IsSource() && m_node->ExecuteCommand(*this, command))
+    return true;
+
+  return OpalMediaStream::InternalExecuteCommand(command);
+}
+
+
+bool OpalMixerMediaStream::InternalUpdateMediaFormat(const OpalMediaFormat & mediaFormat)
+{
+  if (!OpalMediaStream::InternalUpdateMediaFormat(mediaFormat))
+    return false;
+
+  ++m_formatGeneration;
+  return true;
+}
+
+
 bool OpalMixerMediaStream::InternalSetJitterBuffer(const OpalJitterBuffer::Init & init)
 {
   return IsSink() && m_node->SetJitterBufferSize(GetID(), init);
@@ -1230,10 +1620,13 @@ OpalMixerNode::OpalMixerNode(OpalMixerNodeManager & manager,
   : m_manager(manager)
   , m_info(info != NULL ? info : new OpalMixerNodeInfo)
   , m_shuttingDown(false)
+  , m_placementGroup(manager.GetManager().GetPlacementPolicy().AssignGroup(m_guid.AsString()))
   , m_audioMixer(manager.CreateAudioMixer(*m_info))
 {
   PTRACE_CONTEXT_ID_NEW();
 
+  m_audioMixer->SetPlacement(m_manager.GetManager().GetPlacementPolicy(), m_placementGroup);
+
   m_connections.DisallowDeleteObjects();
 
   AddName(m_info->m_name);
@@ -1249,6 +1642,8 @@ OpalMixerNode::~OpalMixerNode()
   delete m_audioMixer;
   delete m_info;
 
+  m_manager.GetManager().GetPlacementPolicy().ReleaseGroup(m_guid.AsString());
+
   PTRACE(4, "Destroyed " << *this);
 }
 
@@ -1274,6 +1669,9 @@ void OpalMixerNode::ShutDown()
     for (VideoMixerMap::iterator it = m_videoMixers.begin(); it != m_videoMixers.end(); ++it)
       delete it->second;
     m_videoMixers.clear();
+    for (VideoForwarderMap::iterator it = m_videoForwarders.begin(); it != m_videoForwarders.end(); ++it)
+      delete it->second;
+    m_videoForwarders.clear();
 #endif
     m_manager.RemoveNodeNames(GetNames());
     m_names.RemoveAll();
@@ -1379,12 +1777,33 @@ bool OpalMixerNode::AttachStream(OpalMixerMediaStream * stream)
 #if OPAL_VIDEO
   if (stream->GetMediaFormat().GetMediaType() == OpalMediaType::Video()) {
     OpalVideoFormat::ContentRole role = stream->GetMediaFormat().GetOptionEnum(OpalVideoFormat::ContentRoleOption(), OpalVideoFormat::eNoRole);
+
+    if (m_info->m_selectiveForwarding) {
+      OpalVideoStreamForwarder * forwarder;
+      VideoForwarderMap::iterator it = m_videoForwarders.find(role);
+      if (it != m_videoForwarders.end())
+        forwarder = it->second;
+      else {
+        forwarder = m_manager.CreateVideoForwarder(*m_info);
+        m_videoForwarders[role] = forwarder;
+      }
+
+      m_mixerById[id] = forwarder;
+
+      if (stream->IsSink())
+        return forwarder->AddInput(*stream);
+
+      forwarder->AddOutput(stream);
+      return true;
+    }
+
     OpalVideoStreamMixer * videoMixer;
     VideoMixerMap::iterator it = m_videoMixers.find(role);
     if (it != m_videoMixers.end())
       videoMixer = it->second;
     else {
       videoMixer = m_manager.CreateVideoMixer(*m_info);
+      videoMixer->SetPlacement(m_manager.GetManager().GetPlacementPolicy(), m_placementGroup);
       m_videoMixers[role] = videoMixer;
     }
 
@@ -1418,6 +1837,17 @@ void OpalMixerNode::DetachStream(OpalMixerMediaStream * stream)
 
 #if OPAL_VIDEO
   if (stream->GetMediaFormat().GetMediaType() == OpalMediaType::Video()) {
+    if (m_info->m_selectiveForwarding) {
+      VideoForwarderMap::iterator it = m_videoForwarders.find(stream->GetMediaFormat().GetOptionEnum(OpalVideoFormat::ContentRoleOption(), OpalVideoFormat::eNoRole));
+      if (it == m_videoForwarders.end())
+        return;
+      if (stream->IsSource())
+        it->second->RemoveOutput(stream);
+      else
+        it->second->RemoveStream(stream->GetID());
+      return;
+    }
+
     VideoMixerMap::iterator it = m_videoMixers.find(stream->GetMediaFormat().GetOptionEnum(OpalVideoFormat::ContentRoleOption(), OpalVideoFormat::eNoRole));
     if (it == m_videoMixers.end())
       return;
@@ -1484,12 +1914,44 @@ bool OpalMixerNode::WritePacket(const OpalMixerMediaStream & stream, const RTP_D
 }
 
 
+#if OPAL_VIDEO
+bool OpalMixerNode::ExecuteCommand(const OpalMixerMediaStream & stream, const OpalMediaCommand & command)
+{
+  if (!m_info->m_selectiveForwarding || stream.GetMediaFormat().GetMediaType() != OpalMediaType::Video())
+    return false;
+
+  MixerByIdMap::iterator it = m_mixerById.find(stream.GetID());
+  if (it == m_mixerById.end())
+    return false;
+
+  OpalVideoStreamForwarder * forwarder = dynamic_cast<OpalVideoStreamForwarder *>(it->second);
+  return forwarder != NULL && forwarder->ExecuteCommand(stream, command);
+}
+
+
+void OpalMixerNode::SetVideoFocus(const PString & token)
+{
+  PSafeLockReadOnly mutex(*this);
+  if (!mutex.IsLocked())
+    return;
+
+  for (VideoForwarderMap::iterator it = m_videoForwarders.begin(); it != m_videoForwarders.end(); ++it)
+    it->second->SetFocus(token);
+}
+#else
+bool OpalMixerNode::ExecuteCommand(const OpalMixerMediaStream &, const OpalMediaCommand &)
+{
+  return false;
+}
+#endif
+
+
 void OpalMixerNode::BroadcastUserInput(const OpalConnection * connection, const PString & value)
 {
   for (PSafePtr<OpalConnection> conn(m_connections, PSafeReference); conn != NULL; ++conn) {
     if (connection != conn)
       conn->GetEndPoint().GetManager().QueueDecoupledEvent(
-            new PSafeWorkArg1<OpalConnection, PString>(conn, value, &OpalConnection::OnUserInputStringCallback));
+            new PSafeWorkArg1<OpalConnection, PString>(conn, value, &OpalConnection::OnUserInputStringCallback), conn->GetCall().GetToken());
   }
 }
 
@@ -1671,11 +2133,20 @@ PFACTORY_CREATE(SIPEventPackageFactory, SIPConferenceEventPackageHandler, SIPSub
 ///////////////////////////////////////////////////////////////////////////////
 
 OpalMediaStreamMixer::OpalMediaStreamMixer()
+  : m_outputGroupsValid(false)
 {
   m_outputStreams.DisallowDeleteObjects();
 }
 
 
+OpalMediaStreamMixer::~OpalMediaStreamMixer()
+{
+  PWaitAndSignal mutex(m_outputGroupsMutex);
+  for (OutputGroupMap::iterator it = m_outputGroups.begin(); it != m_outputGroups.end(); ++it)
+    delete it->second;
+}
+
+
 void OpalMediaStreamMixer::Append(const PSafePtr<OpalMixerMediaStream> & stream)
 {
   for (StreamDict::iterator it = m_outputStreams.begin(); it != m_outputStreams.end(); ++it) {
@@ -1683,183 +2154,345 @@ void OpalMediaStreamMixer::Append(const PSafePtr<OpalMixerMediaStream> & stream)
       return;
   }
   m_outputStreams.SetAt(stream->GetID(), stream);
+  InvalidateOutputGroups();
 }
 
 
-void OpalMediaStreamMixer::CloseOne(const PSafePtr<OpalMixerMediaStream> & stream)
+void OpalMediaStreamMixer::Remove(const PSafePtr<OpalMixerMediaStream> & stream)
 {
-  stream->GetConnection().GetEndPoint().GetManager().QueueDecoupledEvent(
-                            new PSafeWorkNoArg<OpalMixerMediaStream, bool>(stream, &OpalMediaStream::Close));
   m_outputStreams.RemoveAt(stream->GetID());
+  InvalidateOutputGroups();
+
+  // Must not keep a reference to stream after it is removed
+  PWaitAndSignal mutex(m_outputGroupsMutex);
+  for (OutputGroupMap::iterator itGroup = m_outputGroups.begin(); itGroup != m_outputGroups.end(); ++itGroup) {
+    std::vector<OutputGroup::Member> & members = itGroup->second->m_members;
+    for (std::vector<OutputGroup::Member>::iterator it = members.begin(); it != members.end(); ++it) {
+      if (it->m_stream == stream) {
+        members.erase(it);
+        return;
+      }
+    }
+  }
 }
 
 
-///////////////////////////////////////////////////////////////////////////////
-
-OpalAudioStreamMixer::OpalAudioStreamMixer(const OpalMixerNodeInfo & info)
-  : OpalAudioMixer(false, info.m_sampleRate)
-#if OPAL_MIXER_AUDIO_DEBUG
-  , m_audioDebug(new PAudioMixerDebug(info.m_name))
-#endif
+void OpalMediaStreamMixer::CloseOne(const PSafePtr<OpalMixerMediaStream> & stream)
 {
+  stream->GetConnection().GetEndPoint().GetManager().QueueDecoupledEvent(
+                            new PSafeWorkNoArg<OpalMixerMediaStream, bool>(stream, &OpalMediaStream::Close),
+                            stream->GetConnection().GetCall().GetToken());
+  m_outputStreams.RemoveAt(stream->GetID());
+  InvalidateOutputGroups();
 }
 
 
-OpalAudioStreamMixer::~OpalAudioStreamMixer()
+PString OpalMediaStreamMixer::GetOutputGroupKey(PSafePtr<OpalMixerMediaStream> & stream)
 {
-  StopPushThread();
+  return stream->GetID();
 }
 
 
-void OpalAudioStreamMixer::PushOne(PSafePtr<OpalMixerMediaStream> & stream,
-                                   CachedAudio & cache,
-                                   const short * audioToSubtract)
+OpalMediaStreamMixer::OutputGroup * OpalMediaStreamMixer::CreateOutputGroup(const PString &, PSafePtr<OpalMixerMediaStream> &)
 {
-  MIXER_DEBUG_OUT(stream->GetID() << ',');
-
-  switch (cache.m_state) {
-    case CachedAudio::Collecting :
-      MixAdditive(cache.m_raw, audioToSubtract);
-      cache.m_state = CachedAudio::Collected;
-      m_mutex.Signal();
-      break;
-
-    case CachedAudio::Collected :
-      m_mutex.Signal();
-      MIXER_DEBUG_OUT(",,,");
-      return;
-
-    case CachedAudio::Completed :
-      m_mutex.Signal();
-      MIXER_DEBUG_OUT(cache.m_encoded.GetPayloadType() << ','
-          << cache.m_encoded.GetTimestamp() << ','
-          << cache.m_encoded.GetPayloadSize() << ',');
-      stream.SetSafetyMode(PSafeReference); // OpalMediaStream::PushPacket might block
-      PTRACE(6, "Pushing cached encoded packet: pt=" << cache.m_encoded.GetPayloadType()
-             << " ts=" << cache.m_encoded.GetTimestamp() << " sz=" << cache.m_encoded.GetPayloadSize());
-      stream->PushPacket(cache.m_encoded);
-      stream.SetSafetyMode(PSafeReadOnly); // restore lock
-      return;
-  }
-
-  OpalMediaFormat mediaFormat = stream->GetMediaFormat();
-  if (mediaFormat == OpalPCM16) {
-    if (cache.m_raw.GetPayloadSize() < stream->GetDataSize()) {
-      MIXER_DEBUG_OUT(','
-                   << cache.m_raw.GetTimestamp() << ','
-                   << cache.m_raw.GetPayloadSize() << ',');
-      return;
-    }
+  return new OutputGroup;
+}
 
-    cache.m_state = CachedAudio::Completed;
-    MIXER_DEBUG_OUT("PCM-16,"
-        << cache.m_raw.GetTimestamp() << ','
-        << cache.m_raw.GetPayloadSize() << ',');
-    MIXER_DEBUG_WAV(stream->GetID(), cache.m_raw);
-    stream.SetSafetyMode(PSafeReference); // OpalMediaStream::PushPacket might block
-    PTRACE(6, "Pushing raw packet: ts=" << cache.m_raw.GetTimestamp() << " sz=" << cache.m_raw.GetPayloadSize());
-    stream->PushPacket(cache.m_raw);
-    stream.SetSafetyMode(PSafeReadOnly); // restore lock
-    return;
-  }
 
-  if (cache.m_transcoder == NULL) {
-    cache.m_transcoder = OpalTranscoder::Create(OpalPCM16, mediaFormat);
-    if (cache.m_transcoder == NULL) {
-      PTRACE(2, "Could not create transcoder to "
-             << mediaFormat << " for stream id " << stream->GetID());
-      CloseOne(stream);
-      return;
+void OpalMediaStreamMixer::UpdateOutputGroups(OutputGroupList & groups)
+{
+  bool changed = !m_outputGroupsValid;
+  for (OutputGroupMap::iterator itGroup = m_outputGroups.begin(); !changed && itGroup != m_outputGroups.end(); ++itGroup) {
+    std::vector<OutputGroup::Member> & members = itGroup->second->m_members;
+    for (std::vector<OutputGroup::Member>::iterator it = members.begin(); it != members.end(); ++it) {
+      if (it->m_formatGeneration != it->m_stream->GetFormatGeneration()) {
+        changed = true;
+        break;
+      }
     }
-    PTRACE(3, "Created transcoder to " << mediaFormat << " for stream id " << stream->GetID());
   }
 
-  if (cache.m_raw.GetPayloadSize() < cache.m_transcoder->GetOptimalDataFrameSize(true)) {
-    MIXER_DEBUG_OUT(','
-                 << cache.m_raw.GetTimestamp() << ','
-                 << cache.m_raw.GetPayloadSize() << ',');
-    return;
-  }
+  if (changed)
+    RegroupOutputStreams();
 
-  if (cache.m_encoded.SetPayloadSize(cache.m_transcoder->GetOptimalDataFrameSize(false)) &&
-      cache.m_transcoder->Convert(cache.m_raw, cache.m_encoded)) {
-    cache.m_encoded.SetPayloadType(cache.m_transcoder->GetPayloadType(false));
-    cache.m_encoded.SetTimestamp(cache.m_raw.GetTimestamp());
-    cache.m_state = CachedAudio::Completed;
-    MIXER_DEBUG_OUT(cache.m_encoded.GetPayloadType() << ','
-        << cache.m_encoded.GetTimestamp() << ','
-        << cache.m_encoded.GetPayloadSize() << ',');
-    MIXER_DEBUG_WAV(stream->GetID(), cache.m_raw);
-    stream.SetSafetyMode(PSafeReference); // OpalMediaStream::PushPacket might block
-    PTRACE(6, "Pushing new packet: pt=" << cache.m_encoded.GetPayloadType()
-            << " ts=" << cache.m_encoded.GetTimestamp() << " sz=" << cache.m_encoded.GetPayloadSize());
-    stream->PushPacket(cache.m_encoded);
-    stream.SetSafetyMode(PSafeReadOnly); // restore lock
-  }
-  else {
-    PTRACE(2, "Could not convert audio to " << mediaFormat << " for stream id " << stream->GetID());
-    CloseOne(stream);
+  // Copy members so the mixer thread can push to them without m_outputGroupsMutex
+  groups.clear();
+  for (OutputGroupMap::iterator it = m_outputGroups.begin(); it != m_outputGroups.end(); ++it) {
+    it->second->m_pushing = it->second->m_members;
+    groups.push_back(it->second);
   }
 }
 
 
-bool OpalAudioStreamMixer::OnPush()
+void OpalMediaStreamMixer::RegroupOutputStreams()
 {
-  MIXER_DEBUG_OUT(PTimer::Tick().GetMilliSeconds() << ',' << m_outputTimestamp << ',');
+  m_outputGroupsValid = true;
 
-  m_mutex.Wait();
-  PreMixStreams();
-  m_mutex.Signal();
+  // Keep groups, and their encoders, that are still needed
+  for (OutputGroupMap::iterator it = m_outputGroups.begin(); it != m_outputGroups.end(); ++it)
+    it->second->m_members.clear();
 
   for (StreamDict::iterator it = m_outputStreams.begin(); it != m_outputStreams.end(); ++it) {
     PSafePtr<OpalMixerMediaStream> stream = it->second;
-    m_mutex.Wait(); // Signal() call for this mutex is inside PushOne()
+    PString key = GetOutputGroupKey(stream);
+    if (key.IsEmpty())
+      continue;
 
-    // Check for full participant, so can subtract their signal
-    StreamMap_T::iterator inputStream = m_inputStreams.find(it->first);
-    if (inputStream != m_inputStreams.end())
-      PushOne(stream, m_cache[stream->GetID()], ((AudioStream *)inputStream->second)->m_cacheSamples);
-    else {
-      // Listen only participant, can use cached encoded audio
-      PString encodedFrameKey = stream->GetMediaFormat();
-      encodedFrameKey.sprintf(":%u", stream->GetDataSize());
-      PushOne(stream, m_cache[encodedFrameKey], NULL);
+    OutputGroupMap::iterator itGroup = m_outputGroups.find(key);
+    if (itGroup == m_outputGroups.end()) {
+      OutputGroup * group = CreateOutputGroup(key, stream);
+      if (group == NULL) {
+        CloseOne(stream);
+        continue;
+      }
+      itGroup = m_outputGroups.insert(OutputGroupMap::value_type(key, group)).first;
+      PTRACE(4, "Created output group \"" << key << '"');
     }
-  }
 
-  for (std::map<PString, CachedAudio>::iterator iterCache = m_cache.begin(); iterCache != m_cache.end(); ++iterCache) {
-    switch (iterCache->second.m_state) {
-      case CachedAudio::Collected :
-        iterCache->second.m_state = CachedAudio::Collecting;
-        break;
-
-      case CachedAudio::Completed :
-        iterCache->second.m_raw.SetPayloadSize(0);
-        iterCache->second.m_encoded.SetPayloadSize(0);
-        iterCache->second.m_state = CachedAudio::Collecting;
-        break;
+    itGroup->second->m_members.push_back(OutputGroup::Member(stream));
+  }
 
-      default :
-        break;
+  OutputGroupMap::iterator it = m_outputGroups.begin();
+  while (it != m_outputGroups.end()) {
+    if (!it->second->m_members.empty())
+      ++it;
+    else {
+      PTRACE(4, "Removed output group \"" << it->first << '"');
+      delete it->second;
+      m_outputGroups.erase(it++);
     }
   }
 
-  MIXER_DEBUG_OUT(endl);
+  PTRACE(5, "Regrouped " << m_outputStreams.GetSize() << " output streams into " << m_outputGroups.size() << " groups");
+}
+
+
+void OpalMediaStreamMixer::CloseGroup(OutputGroup & group)
+{
+  std::vector<OutputGroup::Member> members;
+  {
+    PWaitAndSignal mutex(m_outputGroupsMutex);
+    members.swap(group.m_members);
+  }
+  group.m_pushing.clear();
+  for (std::vector<OutputGroup::Member>::iterator it = members.begin(); it != members.end(); ++it)
+    CloseOne(it->m_stream);
+}
+
+
+OpalMediaStreamMixer::OutputGroup::Member::Member(const PSafePtr<OpalMixerMediaStream> & stream)
+  : m_stream(stream)
+  , m_formatGeneration(stream->GetFormatGeneration())
+{
+  m_stream.SetSafetyMode(PSafeReference); // OpalMediaStream::PushPacket might block
+}
+
+
+void OpalMediaStreamMixer::OutputGroup::PushToMembers(const RTP_DataFrame & frame)
+{
+  for (std::vector<Member>::iterator it = m_pushing.begin(); it != m_pushing.end(); ++it) {
+    if (it->m_stream->IsPaused())
+      continue;
+
+    /* Each member gets a reference to the same buffer, so no copy unless
+       downstream needs to change the size of the header, or encrypt it. */
+    RTP_DataFrame shared(frame);
+    it->m_stream->PushPacket(shared);
+  }
+}
+
+
+void OpalMediaStreamMixer::OutputGroup::PushToMembers(const RTP_DataFrameList & frames)
+{
+  for (std::vector<Member>::iterator it = m_pushing.begin(); it != m_pushing.end(); ++it) {
+    if (it->m_stream->IsPaused())
+      continue;
+
+    for (RTP_DataFrameList::const_iterator frame = frames.begin(); frame != frames.end(); ++frame) {
+      RTP_DataFrame shared(*frame);
+      it->m_stream->PushPacket(shared);
+    }
+  }
+}
+
+
+///////////////////////////////////////////////////////////////////////////////
+
+OpalAudioStreamMixer::OpalAudioStreamMixer(const OpalMixerNodeInfo & info)
+  : OpalAudioMixer(false, info.m_sampleRate)
+#if OPAL_MIXER_AUDIO_DEBUG
+  , m_audioDebug(new PAudioMixerDebug(info.m_name))
+#endif
+{
+}
+
+
+OpalAudioStreamMixer::~OpalAudioStreamMixer()
+{
+  StopPushThread();
+}
+
+
+bool OpalAudioStreamMixer::AddStream(const Key_T & key)
+{
+  if (!OpalAudioMixer::AddStream(key))
+    return false;
+
+  // Output for this participant now needs their own audio removed
+  InvalidateOutputGroups();
+  return true;
+}
+
+
+void OpalAudioStreamMixer::RemoveStream(const Key_T & key)
+{
+  InvalidateOutputGroups();
+  OpalAudioMixer::RemoveStream(key);
+}
+
+
+void OpalAudioStreamMixer::RemoveAllStreams()
+{
+  InvalidateOutputGroups();
+  OpalAudioMixer::RemoveAllStreams();
+}
+
+
+PString OpalAudioStreamMixer::GetOutputGroupKey(PSafePtr<OpalMixerMediaStream> & stream)
+{
+  PString key = stream->GetMediaFormat();
+  key.sprintf(":%u", stream->GetDataSize());
+
+  // A full participant hears everyone but themselves, so cannot share
+  PWaitAndSignal mutex(m_mutex);
+  if (m_inputStreams.find(stream->GetID()) != m_inputStreams.end())
+    key = stream->GetID() + ':' + key;
+
+  return key;
+}
+
+
+OpalMediaStreamMixer::OutputGroup * OpalAudioStreamMixer::CreateOutputGroup(const PString & key, PSafePtr<OpalMixerMediaStream> & stream)
+{
+  OpalMediaFormat mediaFormat = stream->GetMediaFormat();
+
+  AudioGroup * group;
+  {
+    PWaitAndSignal mutex(m_mutex);
+    group = new AudioGroup(m_inputStreams.find(stream->GetID()) != m_inputStreams.end() ? stream->GetID() : PString::Empty(), mediaFormat);
+  }
+
+  if (mediaFormat == OpalPCM16)
+    group->m_rawSize = stream->GetDataSize();
+  else {
+    group->m_transcoder = OpalTranscoder::Create(OpalPCM16, mediaFormat);
+    if (group->m_transcoder == NULL) {
+      PTRACE(2, "Could not create transcoder to " << mediaFormat << " for stream id " << stream->GetID());
+      delete group;
+      return NULL;
+    }
+    group->m_rawSize = group->m_transcoder->GetOptimalDataFrameSize(true);
+    PTRACE(3, "Created transcoder to " << mediaFormat << " for group \"" << key << '"');
+  }
+
+  return group;
+}
+
+
+void OpalAudioStreamMixer::PushGroup(AudioGroup & group)
+{
+  MIXER_DEBUG_OUT(group.m_format << ',');
+
+  if (group.m_raw.GetPayloadSize() < group.m_rawSize) {
+    MIXER_DEBUG_OUT(','
+                 << group.m_raw.GetTimestamp() << ','
+                 << group.m_raw.GetPayloadSize() << ',');
+    return; // Need more mixer periods before have a whole frame
+  }
+
+  if (group.m_transcoder == NULL) {
+    MIXER_DEBUG_OUT("PCM-16,"
+        << group.m_raw.GetTimestamp() << ','
+        << group.m_raw.GetPayloadSize() << ',');
+    PTRACE(6, "Pushing raw packet: ts=" << group.m_raw.GetTimestamp() << " sz=" << group.m_raw.GetPayloadSize()
+           << " to " << group.m_members.size() << " streams");
+    group.PushToMembers(group.m_raw);
+  }
+  else {
+    // Never alter a frame already pushed, in case still referenced downstream
+    group.m_encoded.MakeUnique();
+    if (group.m_encoded.SetPayloadSize(group.m_transcoder->GetOptimalDataFrameSize(false)) &&
+        group.m_transcoder->Convert(group.m_raw, group.m_encoded)) {
+      group.m_encoded.SetPayloadType(group.m_transcoder->GetPayloadType(false));
+      group.m_encoded.SetTimestamp(group.m_raw.GetTimestamp());
+      MIXER_DEBUG_OUT(group.m_encoded.GetPayloadType() << ','
+          << group.m_encoded.GetTimestamp() << ','
+          << group.m_encoded.GetPayloadSize() << ',');
+      PTRACE(6, "Pushing encoded packet: pt=" << group.m_encoded.GetPayloadType()
+             << " ts=" << group.m_encoded.GetTimestamp() << " sz=" << group.m_encoded.GetPayloadSize()
+             << " to " << group.m_pushing.size() << " streams");
+      group.PushToMembers(group.m_encoded);
+    }
+    else {
+      PTRACE(2, "Could not convert audio to " << group.m_format);
+      CloseGroup(group);
+    }
+  }
+
+  group.m_raw.MakeUnique();
+  group.m_raw.SetPayloadSize(0);
+}
+
 
+bool OpalAudioStreamMixer::OnPush()
+{
+  MIXER_DEBUG_OUT(PTimer::Tick().GetMilliSeconds() << ',' << m_outputTimestamp << ',');
+
+  OutputGroupList groups;
+  m_outputGroupsMutex.Wait();
+  UpdateOutputGroups(groups);
+  m_outputGroupsMutex.Signal();
+
+  /* Mix once per group, participants get everyone except themselves. Groups
+     are only created and deleted by this thread, so are safe to use without
+     m_outputGroupsMutex, and members are pushed to from the copy taken. */
+  m_mutex.Wait();
+  PreMixStreams();
+  for (OutputGroupList::iterator it = groups.begin(); it != groups.end(); ++it) {
+    AudioGroup & group = *static_cast<AudioGroup *>(*it);
+    const short * audioToSubtract = NULL;
+    if (!group.m_inputKey.IsEmpty()) {
+      StreamMap_T::iterator inputStream = m_inputStreams.find(group.m_inputKey);
+      if (inputStream != m_inputStreams.end())
+        audioToSubtract = ((AudioStream *)inputStream->second)->m_cacheSamples;
+    }
+    MixAdditive(group.m_raw, audioToSubtract);
+  }
   m_outputTimestamp += m_periodTS;
+  m_mutex.Signal();
+
+  // Encode once per group and fan out, outside of mutexes as PushPacket might block
+  for (OutputGroupList::iterator it = groups.begin(); it != groups.end(); ++it) {
+    PushGroup(*static_cast<AudioGroup *>(*it));
+    (*it)->m_pushing.clear(); // Do not hold streams that may have been removed
+  }
+
+  MIXER_DEBUG_OUT(endl);
 
   return true;
 }
 
 
-OpalAudioStreamMixer::CachedAudio::CachedAudio()
-  : m_state(Collecting)
+OpalAudioStreamMixer::AudioGroup::AudioGroup(const Key_T & inputKey, const OpalMediaFormat & format)
+  : m_inputKey(inputKey)
+  , m_format(format)
+  , m_rawSize(0)
   , m_transcoder(NULL)
 {
 }
 
 
-OpalAudioStreamMixer::CachedAudio::~CachedAudio()
+OpalAudioStreamMixer::AudioGroup::~AudioGroup()
 {
   delete m_transcoder;
 }
@@ -1870,6 +2503,9 @@ OpalAudioStreamMixer::CachedAudio::~CachedAudio()
 #if OPAL_VIDEO
 OpalVideoStreamMixer::OpalVideoStreamMixer(const OpalMixerNodeInfo & info)
   : OpalVideoMixer(info.m_style, info.m_width, info.m_height, info.m_rate)
+  , m_mixedWidth(0)
+  , m_mixedHeight(0)
+  , m_frameRateChanged(false)
 {
 }
 
@@ -1885,124 +2521,679 @@ bool OpalVideoStreamMixer::SetFrameRate(unsigned rate)
   if (!OpalVideoMixer::SetFrameRate(rate))
     return false;
 
-  for (TranscoderMap::iterator it = m_transcoders.begin(); it != m_transcoders.end(); ++it) {
-    OpalMediaFormat mediaFormat;
-    mediaFormat.SetOptionInteger(OpalMediaFormat::FrameTimeOption(), m_periodTS);
-    it->second.UpdateMediaFormats(OpalMediaFormat(), mediaFormat);
-  }
+  // Encoders only touched by mixer thread, so tell it to update them
+  m_frameRateChanged = true;
   return true;
 }
 
 
+PString OpalVideoStreamMixer::GetOutputGroupKey(PSafePtr<OpalMixerMediaStream> & stream)
+{
+  OpalMediaFormat mediaFormat = stream->GetMediaFormat();
+  if (mediaFormat == OpalYUV420P)
+    return mediaFormat;
+
+  if (stream->CheckMixedVideoSize(m_mixedWidth, m_mixedHeight)) {
+    // Try and set outgoing video to same size as mixed frame store
+    mediaFormat.SetOptionInteger(OpalVideoFormat::FrameWidthOption(), m_mixedWidth);
+    mediaFormat.SetOptionInteger(OpalVideoFormat::FrameHeightOption(), m_mixedHeight);
+    if (stream->UpdateMediaFormat(mediaFormat, true))
+      mediaFormat = stream->GetMediaFormat();
+    else {
+      PTRACE(2, "Could not adjust media format to " << m_mixedWidth << 'x' << m_mixedHeight);
+      mediaFormat = stream->GetMediaFormat();
+    }
+    PTRACE(4, "Output of " << mediaFormat << " started at "
+           << mediaFormat.GetOptionInteger(OpalVideoFormat::FrameWidthOption()) << 'x'
+           << mediaFormat.GetOptionInteger(OpalVideoFormat::FrameHeightOption())
+           << " (" << m_mixedWidth << 'x' << m_mixedHeight << ")"
+              " to stream id " << stream->GetID());
+  }
+
+  return PSTRSTRM(mediaFormat << ' '
+                  << mediaFormat.GetOptionInteger(OpalVideoFormat::FrameWidthOption()) << 'x'
+                  << mediaFormat.GetOptionInteger(OpalVideoFormat::FrameHeightOption()));
+}
+
+
+OpalMediaStreamMixer::OutputGroup * OpalVideoStreamMixer::CreateOutputGroup(const PString & key, PSafePtr<OpalMixerMediaStream> & stream)
+{
+  OpalMediaFormat mediaFormat = stream->GetMediaFormat();
+  VideoGroup * group = new VideoGroup(mediaFormat,
+                                      mediaFormat.GetOptionInteger(OpalVideoFormat::FrameWidthOption()),
+                                      mediaFormat.GetOptionInteger(OpalVideoFormat::FrameHeightOption()));
+  if (mediaFormat == OpalYUV420P)
+    return group;
+
+  mediaFormat.SetOptionInteger(OpalMediaFormat::FrameTimeOption(), m_periodTS);
+  group->m_transcoder = OpalTranscoder::Create(OpalYUV420P, mediaFormat);
+  if (group->m_transcoder == NULL) {
+    PTRACE(2, "Could not create transcoder to " << mediaFormat << " for stream id " << stream->GetID());
+    delete group;
+    return NULL;
+  }
+
+  PTRACE(3, "Created transcoder for group \"" << key << '"');
+  return group;
+}
+
+
 bool OpalVideoStreamMixer::OnMixed(RTP_DataFrame * & output)
 {
-  typedef std::map<PString, RTP_DataFrameList> CachedPackets;
-  CachedPackets cachedPackets;
+  const OpalVideoTranscoder::FrameHeader * header = (const OpalVideoTranscoder::FrameHeader *)output->GetPayloadPtr();
+  if (m_mixedWidth != header->width || m_mixedHeight != header->height) {
+    m_mixedWidth = header->width;
+    m_mixedHeight = header->height;
+    InvalidateOutputGroups();
+  }
+
+  OutputGroupList groups;
+  m_outputGroupsMutex.Wait();
+  UpdateOutputGroups(groups);
+  m_outputGroupsMutex.Signal();
+
+  if (m_frameRateChanged.exchange(false)) {
+    for (OutputGroupList::iterator it = groups.begin(); it != groups.end(); ++it) {
+      VideoGroup & group = *static_cast<VideoGroup *>(*it);
+      if (group.m_transcoder != NULL) {
+        OpalMediaFormat mediaFormat;
+        mediaFormat.SetOptionInteger(OpalMediaFormat::FrameTimeOption(), m_periodTS);
+        group.m_transcoder->UpdateMediaFormats(OpalMediaFormat(), mediaFormat);
+      }
+    }
+  }
+
   typedef std::map<unsigned, RTP_DataFrame> CachedFrameStore;
   CachedFrameStore cachedFrameStore;
 
-  for (StreamDict::iterator it = m_outputStreams.begin(); it != m_outputStreams.end(); ++it) {
-    PSafePtr<OpalMixerMediaStream> stream = it->second;
-    if (stream->IsPaused())
+  // Encode once per group and fan out to all members, outside of mutex as PushPacket might block
+  for (OutputGroupList::iterator it = groups.begin(); it != groups.end(); ++it) {
+    VideoGroup & group = *static_cast<VideoGroup *>(*it);
+
+    if (group.m_transcoder == NULL) {
+      group.PushToMembers(*output);
       continue;
+    }
 
-    OpalMediaFormat mediaFormat = stream->GetMediaFormat();
-    if (mediaFormat == OpalYUV420P) {
-      stream.SetSafetyMode(PSafeReference); // OpalMediaStream::PushPacket might block
-      stream->PushPacket(*output);
-      stream.SetSafetyMode(PSafeReadOnly); // restore lock
+    unsigned width = group.m_width;
+    unsigned height = group.m_height;
+
+    RTP_DataFrame * rawRTP;
+    if (header->width == width && header->height == height) {
+      PTRACE(5, "Using mixer video frame: " << width << 'x' << height);
+      rawRTP = output;
     }
     else {
-      unsigned width, height;
-      const OpalVideoTranscoder::FrameHeader * header = (const OpalVideoTranscoder::FrameHeader *)output->GetPayloadPtr();
-      if (stream->CheckMixedVideoSize(header->width, header->height)) {
-        // Try and set outgoing video to same size as mixed frame store
-        mediaFormat.SetOptionInteger(OpalVideoFormat::FrameWidthOption(), header->width);
-        mediaFormat.SetOptionInteger(OpalVideoFormat::FrameHeightOption(), header->height);
-        if (!stream->UpdateMediaFormat(mediaFormat, true)) {
-          PTRACE(2, "Could not adjust media format to " << header->width << 'x' << header->height);
-          continue;
-        }
-        mediaFormat = stream->GetMediaFormat();
-        width = mediaFormat.GetOptionInteger(OpalVideoFormat::FrameWidthOption());
-        height = mediaFormat.GetOptionInteger(OpalVideoFormat::FrameHeightOption());
-        PTRACE(4, "Output of " << mediaFormat << " started at " << width << 'x' << height
-               << " (" << header->width << 'x' << header->height << ")"
-                  " to stream id " << stream->GetID());
+      unsigned frameStoreKey = width + height*65536;
+      CachedFrameStore::iterator itFrameStore = cachedFrameStore.find(frameStoreKey);
+      if (itFrameStore != cachedFrameStore.end()) {
+        PTRACE(5, "Using cached video frame: " << header->width << 'x' << header->height << " to " << width << 'x' << height);
+        rawRTP = &itFrameStore->second;
       }
       else {
-        width = mediaFormat.GetOptionInteger(OpalVideoFormat::FrameWidthOption());
-        height = mediaFormat.GetOptionInteger(OpalVideoFormat::FrameHeightOption());
+        PTRACE(5, "Scaling video frame: " << header->width << 'x' << header->height << " to " << width << 'x' << height);
+        rawRTP = &cachedFrameStore[frameStoreKey];
+        rawRTP->CopyHeader(*output);
+        rawRTP->SetPayloadSize(PVideoFrameInfo::CalculateFrameBytes(width, height)+sizeof(OpalVideoTranscoder::FrameHeader));
+        OpalVideoTranscoder::FrameHeader * resized = (OpalVideoTranscoder::FrameHeader *)rawRTP->GetPayloadPtr();
+        resized->width = width;
+        resized->height = height;
+        PColourConverter::CopyYUV420P(0, 0, header->width, header->height,
+                                      header->width, header->height, OpalVideoFrameDataPtr(header),
+                                      0, 0, width, height,
+                                      width, height, OpalVideoFrameDataPtr(resized),
+                                      PVideoFrameInfo::eScale);
       }
+    }
 
-      PStringStream keyPackets;
-      keyPackets << mediaFormat << ' ' << width << 'x' << height;
-
-      CachedPackets::iterator itPackets = cachedPackets.find(keyPackets);
-      if (itPackets == cachedPackets.end()) {
-        OpalTranscoder * transcoder = m_transcoders.GetAt(keyPackets);
-        if (transcoder == NULL) {
-          mediaFormat.SetOptionInteger(OpalMediaFormat::FrameTimeOption(), m_periodTS);
-          transcoder = OpalTranscoder::Create(OpalYUV420P, mediaFormat);
-          if (transcoder == NULL) {
-            PTRACE(2, "Could not create transcoder to " << mediaFormat << " for stream id " << stream->GetID());
-            CloseOne(stream);
-            continue;
-          }
-          PTRACE(3, "Created transcoder to " << mediaFormat << ' '
-                 << width << 'x' << height << " for stream id " << stream->GetID());
-          m_transcoders.SetAt(keyPackets, transcoder);
-        }
+    if (!group.m_transcoder->ConvertFrames(*rawRTP, group.m_packets)) {
+      PTRACE(2, "Could not convert video to " << group.m_format);
+      CloseGroup(group);
+      continue;
+    }
 
-        RTP_DataFrame * rawRTP;
-        if (header->width == width && header->height == height) {
-          PTRACE(5, "Using mixer video frame: " << width << 'x' << height);
-          rawRTP = output;
-        }
-        else {
-          unsigned frameStoreKey = width + height*65536;
-          CachedFrameStore::iterator itFrameStore = cachedFrameStore.find(frameStoreKey);
-          if (itFrameStore != cachedFrameStore.end()) {
-            PTRACE(5, "Using cached video frame: " << header->width << 'x' << header->height << " to " << width << 'x' << height);
-            rawRTP = &itFrameStore->second;
-          }
-          else {
-            PTRACE(5, "Scaling video frame: " << header->width << 'x' << header->height << " to " << width << 'x' << height);
-            rawRTP = &cachedFrameStore[frameStoreKey];
-            rawRTP->CopyHeader(*output);
-            rawRTP->SetPayloadSize(PVideoFrameInfo::CalculateFrameBytes(width, height)+sizeof(OpalVideoTranscoder::FrameHeader));
-            OpalVideoTranscoder::FrameHeader * resized = (OpalVideoTranscoder::FrameHeader *)rawRTP->GetPayloadPtr();
-            resized->width = width;
-            resized->height = height;
-            PColourConverter::CopyYUV420P(0, 0, header->width, header->height,
-                                          header->width, header->height, OpalVideoFrameDataPtr(header),
-                                          0, 0, width, height,
-                                          width, height, OpalVideoFrameDataPtr(resized),
-                                          PVideoFrameInfo::eScale);
-          }
-        }
+    PTRACE(6, "Pushing " << group.m_packets.GetSize() << " packets to " << group.m_pushing.size() << " streams");
+    group.PushToMembers(group.m_packets);
+  }
+
+  // Do not hold streams that may have been removed
+  for (OutputGroupList::iterator it = groups.begin(); it != groups.end(); ++it)
+    (*it)->m_pushing.clear();
+
+  return true;
+}
+
+
+OpalVideoStreamMixer::VideoGroup::VideoGroup(const OpalMediaFormat & format, unsigned width, unsigned height)
+  : m_format(format)
+  , m_width(width)
+  , m_height(height)
+  , m_transcoder(NULL)
+{
+}
+
+
+OpalVideoStreamMixer::VideoGroup::~VideoGroup()
+{
+  delete m_transcoder;
+}
+
+
+///////////////////////////////////////////////////////////////////////////////
+
+#undef  PTraceModule
+#define PTraceModule() "MixerSFU"
+
+static const PTimeInterval LayerWindow(1000);
+static const PTimeInterval LayerTimeout(2000);
+static const PTimeInterval UpdateRequestInterval(1000);
+
+
+// Extract temporal layer index from RFC 7741 VP8 payload descriptor
+static bool GetVP8TemporalId(const BYTE * payload, PINDEX size, unsigned & tid, bool & layerSync)
+{
+  if (size < 2 || (payload[0] & 0x80) == 0)
+    return false; // No extended control bits
+
+  BYTE ext = payload[1];
+  PINDEX pos = 2;
+  if (ext & 0x80) { // PictureID present
+    if (pos >= size)
+      return false;
+    pos += (payload[pos] & 0x80) ? 2 : 1;
+  }
+  if (ext & 0x40) // TL0PICIDX present
+    ++pos;
+  if ((ext & 0x20) == 0 || pos >= size) // TID present
+    return false;
+
+  tid = payload[pos] >> 6;
+  layerSync = (payload[pos] & 0x20) != 0;
+  return true;
+}
+
+
+OpalVideoStreamForwarder::Layer::Layer(RTP_SyncSourceId ssrc)
+  : m_ssrc(ssrc)
+  , m_windowStart(PTimer::Tick())
+  , m_windowBytes(0)
+  , m_bitRate(0)
+  , m_lastPacket(m_windowStart)
+  , m_lastUpdateRequest(0)
+{
+}
+
+
+OpalVideoStreamForwarder::Input::Input(OpalMixerMediaStream & stream)
+  : m_stream(&stream, PSafeReference)
+  , m_token(stream.GetConnection().GetToken())
+  , m_format(stream.GetMediaFormat())
+  , m_temporalLayers(m_format.GetEncodingName() == "VP8")
+{
+}
+
+
+OpalVideoStreamForwarder::Input::~Input()
+{
+  for (LayerMap::iterator it = m_layers.begin(); it != m_layers.end(); ++it)
+    delete it->second;
+}
+
+
+bool OpalVideoStreamForwarder::Input::Rank(const PTimeInterval & now)
+{
+  std::vector< std::pair<unsigned, RTP_SyncSourceId> > order;
+
+  LayerMap::iterator it = m_layers.begin();
+  while (it != m_layers.end()) {
+    if (now - it->second->m_lastPacket > LayerTimeout) {
+      PTRACE(4, "Layer SSRC=" << RTP_TRACE_SRC(it->first) << " stopped on input " << m_stream->GetID());
+      delete it->second;
+      m_layers.erase(it++);
+    }
+    else {
+      order.push_back(std::make_pair(it->second->m_bitRate, it->first));
+      ++it;
+    }
+  }
+
+  std::sort(order.begin(), order.end(), std::greater< std::pair<unsigned, RTP_SyncSourceId> >());
+
+  std::vector<RTP_SyncSourceId> ranked(order.size());
+  for (size_t i = 0; i < order.size(); ++i)
+    ranked[i] = order[i].second;
+
+  if (ranked == m_ranked)
+    return false;
+
+  m_ranked.swap(ranked);
+  return true;
+}
+
+
+OpalVideoStreamForwarder::Output::Output()
+  : m_currentSSRC(0)
+  , m_currentTemporalId(MaxTemporalId)
+  , m_targetSSRC(0)
+  , m_targetTemporalId(MaxTemporalId)
+  , m_maxBitRate(0)
+  , m_bandwidth(0)
+  , m_ssrc(PRandom::Number())
+  , m_sequenceNumber((RTP_SequenceNumber)PRandom::Number(1, 32768))
+  , m_timestampOffset(0)
+  , m_lastTimestamp(0)
+  , m_started(false)
+{
+}
+
+
+OpalVideoStreamForwarder::OpalVideoStreamForwarder(const OpalMixerNodeInfo & info)
+  : OpalBaseMixer(false, 1000/info.m_rate, OpalMediaFormat::VideoClockRate/info.m_rate)
+{
+}
+
+
+OpalVideoStreamForwarder::~OpalVideoStreamForwarder()
+{
+  RemoveAllStreams();
+}
+
+
+bool OpalVideoStreamForwarder::AddInput(OpalMixerMediaStream & stream)
+{
+  PTimeInterval now = PTimer::Tick();
+  UpdateRequests requests;
+
+  {
+    PWaitAndSignal mutex(m_mutex);
+
+    Key_T key = stream.GetID();
+    if (m_inputs.find(key) != m_inputs.end())
+      return false;
+
+    m_inputs[key] = new Input(stream);
+    PTRACE(4, "Added input " << stream.GetMediaFormat() << " at key " << key);
+
+    // Anyone not yet receiving anything might now be able to
+    for (OutputMap::iterator it = m_outputs.begin(); it != m_outputs.end(); ++it) {
+      if (it->second.m_targetInput.IsEmpty())
+        SelectTarget(it->second, now, requests);
+    }
+  }
+
+  SendUpdateRequests(requests);
+  return true;
+}
+
+
+void OpalVideoStreamForwarder::AddOutput(const PSafePtr<OpalMixerMediaStream> & stream)
+{
+  PTimeInterval now = PTimer::Tick();
+  UpdateRequests requests;
+
+  {
+    PWaitAndSignal mutex(m_mutex);
+
+    Append(stream);
+
+    Output & output = m_outputs[stream->GetID()];
+    output.m_token = stream->GetConnection().GetToken();
+    output.m_format = stream->GetMediaFormat();
+    output.m_maxBitRate = output.m_bandwidth = output.m_format.GetMaxBandwidth();
+    SelectTarget(output, now, requests);
+  }
+
+  SendUpdateRequests(requests);
+}
+
+
+void OpalVideoStreamForwarder::RemoveOutput(const PSafePtr<OpalMixerMediaStream> & stream)
+{
+  PWaitAndSignal mutex(m_mutex);
+  Remove(stream);
+  m_outputs.erase(stream->GetID());
+}
+
+
+void OpalVideoStreamForwarder::RemoveStream(const Key_T & key)
+{
+  PTimeInterval now = PTimer::Tick();
+  UpdateRequests requests;
+
+  {
+    PWaitAndSignal mutex(m_mutex);
+
+    InputMap::iterator itInput = m_inputs.find(key);
+    if (itInput == m_inputs.end())
+      return;
+
+    delete itInput->second;
+    m_inputs.erase(itInput);
+    PTRACE(4, "Removed input at key " << key);
+
+    for (OutputMap::iterator it = m_outputs.begin(); it != m_outputs.end(); ++it) {
+      if (it->second.m_currentInput == key)
+        it->second.m_currentInput.MakeEmpty();
+      if (it->second.m_targetInput == key)
+        SelectTarget(it->second, now, requests);
+    }
+  }
+
+  SendUpdateRequests(requests);
+}
+
+
+void OpalVideoStreamForwarder::RemoveAllStreams()
+{
+  PWaitAndSignal mutex(m_mutex);
+
+  for (InputMap::iterator it = m_inputs.begin(); it != m_inputs.end(); ++it)
+    delete it->second;
+  m_inputs.clear();
+  m_outputs.clear();
+}
+
+
+bool OpalVideoStreamForwarder::WriteStream(const Key_T & key, const RTP_DataFrame & rtp)
+{
+  if (rtp.GetPayloadSize() == 0)
+    return true;
+
+  PTimeInterval now = PTimer::Tick();
+  UpdateRequests requests;
+  Forwards forwards;
+
+  {
+    PWaitAndSignal mutex(m_mutex);
+
+    // Search for input, note: writing a stream not yet attached is non-fatal
+    InputMap::iterator itInput = m_inputs.find(key);
+    if (itInput == m_inputs.end())
+      return true;
+
+    Input & input = *itInput->second;
+    RTP_SyncSourceId ssrc = rtp.GetSyncSource();
+
+    Layer * layer;
+    LayerMap::iterator itLayer = input.m_layers.find(ssrc);
+    bool rerank = itLayer == input.m_layers.end();
+    if (!rerank)
+      layer = itLayer->second;
+    else {
+      layer = input.m_layers[ssrc] = new Layer(ssrc);
+      PTRACE(4, "Layer SSRC=" << RTP_TRACE_SRC(ssrc) << " started on input " << key);
+    }
+
+    layer->m_lastPacket = now;
+    layer->m_windowBytes += rtp.GetPayloadSize();
+    PTimeInterval window = now - layer->m_windowStart;
+    if (window >= LayerWindow) {
+      layer->m_bitRate = (unsigned)(layer->m_windowBytes*8000LL/window.GetMilliSeconds());
+      layer->m_windowBytes = 0;
+      layer->m_windowStart = now;
+      rerank = true;
+    }
+
+    // Bit rates have changed, so see if anyone should be on a different layer
+    if (rerank && input.Rank(now)) {
+      for (OutputMap::iterator it = m_outputs.begin(); it != m_outputs.end(); ++it) {
+        if (it->second.m_targetInput == key || it->second.m_targetInput.IsEmpty())
+          SelectTarget(it->second, now, requests);
+      }
+    }
 
-        RTP_DataFrameList packets;
-        if (!transcoder->ConvertFrames(*rawRTP, packets)) {
-          PTRACE(2, "Could not convert video to " << mediaFormat << " for stream id " << stream->GetID());
-          CloseOne(stream);
+    OpalVideoFormat::FrameType frameType = input.m_format.GetFrameType(rtp.GetPayloadPtr(), rtp.GetPayloadSize(), layer->m_detector);
+
+    unsigned temporalId = 0;
+    bool layerSync = false;
+    bool hasTemporalId = input.m_temporalLayers && GetVP8TemporalId(rtp.GetPayloadPtr(), rtp.GetPayloadSize(), temporalId, layerSync);
+
+    for (StreamDict::iterator it = m_outputStreams.begin(); it != m_outputStreams.end(); ++it) {
+      PSafePtr<OpalMixerMediaStream> stream = it->second;
+      if (stream->IsPaused())
+        continue;
+
+      OutputMap::iterator itOutput = m_outputs.find(it->first);
+      if (itOutput == m_outputs.end())
+        continue;
+
+      Output & output = itOutput->second;
+
+      // Switch layer, or participant, only on an intra frame
+      bool switched = false;
+      if (output.m_targetInput == key && output.m_targetSSRC == ssrc &&
+                (output.m_currentInput != key || output.m_currentSSRC != ssrc)) {
+        if (frameType != OpalVideoFormat::e_IntraFrame) {
+          RequestUpdate(input, ssrc, now, requests);
           continue;
         }
 
-        itPackets = cachedPackets.insert(CachedPackets::value_type(keyPackets, packets)).first;
+        PTRACE(4, "Switching output " << it->first << " to input " << key << " SSRC=" << RTP_TRACE_SRC(ssrc));
+        output.m_currentInput = key;
+        output.m_currentSSRC = ssrc;
+        output.m_currentTemporalId = output.m_targetTemporalId;
+        switched = true;
+      }
+
+      if (output.m_currentInput != key || output.m_currentSSRC != ssrc)
+        continue;
+
+      if (hasTemporalId) {
+        // Going down can happen at any time, up only at a layer sync point
+        if (output.m_targetTemporalId < output.m_currentTemporalId)
+          output.m_currentTemporalId = output.m_targetTemporalId;
+        else if (temporalId > output.m_currentTemporalId && temporalId <= output.m_targetTemporalId &&
+                     (layerSync || frameType == OpalVideoFormat::e_IntraFrame))
+          output.m_currentTemporalId = temporalId;
+
+        if (temporalId > output.m_currentTemporalId)
+          continue;
       }
 
-      stream.SetSafetyMode(PSafeReference); // OpalMediaStream::PushPacket might block
+      forwards.push_back(Forwards::value_type(stream, RTP_DataFrame()));
+      forwards.back().first.SetSafetyMode(PSafeReference); // OpalMediaStream::PushPacket might block
+      if (!RewritePacket(output, rtp, switched, now, forwards.back().second))
+        forwards.pop_back();
+    }
+  }
+
+  // Done outside of the mutex as PushPacket might block, and other inputs should not wait
+  for (Forwards::iterator it = forwards.begin(); it != forwards.end(); ++it) {
+    if (!it->first->PushPacket(it->second))
+      CloseOne(it->first);
+  }
+
+  SendUpdateRequests(requests);
+  return true;
+}
+
+
+bool OpalVideoStreamForwarder::RewritePacket(Output & output,
+                                             const RTP_DataFrame & rtp,
+                                             bool switched,
+                                             const PTimeInterval & now,
+                                             RTP_DataFrame & packet)
+{
+  if (switched) {
+    // Make timestamps continuous across the switch, using elapsed real time
+    RTP_Timestamp next = rtp.GetTimestamp();
+    if (output.m_started) {
+      PInt64 elapsed = (now - output.m_lastTick).GetMilliSeconds()*output.m_format.GetClockRate()/1000;
+      next = output.m_lastTimestamp + (RTP_Timestamp)std::max(elapsed, (PInt64)1);
+    }
+    output.m_timestampOffset = next - rtp.GetTimestamp();
+  }
+
+  packet = RTP_DataFrame((const BYTE *)rtp, rtp.GetPacketSize());
+  if (packet.IsEmpty())
+    return false;
+
+  packet.SetSyncSource(output.m_ssrc);
+  packet.SetSequenceNumber(output.m_sequenceNumber++);
+  packet.SetTimestamp(rtp.GetTimestamp() + output.m_timestampOffset);
+  packet.SetPayloadType(output.m_format.GetPayloadType());
+
+  output.m_lastTimestamp = packet.GetTimestamp();
+  output.m_lastTick = now;
+  output.m_started = true;
+  return true;
+}
+
+
+bool OpalVideoStreamForwarder::ExecuteCommand(const OpalMixerMediaStream & stream, const OpalMediaCommand & command)
+{
+  PTimeInterval now = PTimer::Tick();
+  UpdateRequests requests;
+
+  {
+    PWaitAndSignal mutex(m_mutex);
+
+    OutputMap::iterator itOutput = m_outputs.find(stream.GetID());
+    if (itOutput == m_outputs.end())
+      return false;
 
-      for (RTP_DataFrameList::iterator frame = itPackets->second.begin(); frame != itPackets->second.end(); ++frame)
-        stream->PushPacket(*frame);
+    Output & output = itOutput->second;
 
-      stream.SetSafetyMode(PSafeReadOnly); // restore lock
+    const OpalMediaFlowControl * flow = dynamic_cast<const OpalMediaFlowControl *>(&command);
+    const OpalMediaPacketLoss * loss = dynamic_cast<const OpalMediaPacketLoss *>(&command);
+    if (flow != NULL) {
+      output.m_maxBitRate = output.m_bandwidth = flow->GetMaxBitRate();
+      PTRACE(4, "Output " << stream.GetID() << " bandwidth set to " << flow->GetMaxBitRate());
+      SelectTarget(output, now, requests);
     }
+    else if (loss != NULL) {
+      // Back off quickly on loss, recover slowly up to the last flow control limit
+      unsigned percent = loss->GetPacketLoss();
+      if (percent > 10)
+        output.m_bandwidth -= (unsigned)((uint64_t)output.m_bandwidth*percent/200);
+      else if (percent < 2)
+        output.m_bandwidth = std::min(output.m_maxBitRate, output.m_bandwidth + output.m_bandwidth/20 + 1);
+      else
+        return true;
+      PTRACE(5, "Output " << stream.GetID() << " loss " << percent << "%, bandwidth now " << output.m_bandwidth);
+      SelectTarget(output, now, requests);
+    }
+    else if (PIsDescendant(&command, OpalVideoUpdatePicture)) {
+      InputMap::iterator itInput = m_inputs.find(output.m_currentInput);
+      if (itInput == m_inputs.end())
+        return false;
+      RequestUpdate(*itInput->second, output.m_currentSSRC, now, requests);
+    }
+    else
+      return false;
   }
 
+  SendUpdateRequests(requests);
   return true;
 }
+
+
+void OpalVideoStreamForwarder::SetFocus(const PString & token)
+{
+  PTimeInterval now = PTimer::Tick();
+  UpdateRequests requests;
+
+  {
+    PWaitAndSignal mutex(m_mutex);
+
+    if (m_focus == token)
+      return;
+
+    PTRACE(3, "Focus set to " << token);
+    m_focus = token;
+
+    for (OutputMap::iterator it = m_outputs.begin(); it != m_outputs.end(); ++it)
+      SelectTarget(it->second, now, requests);
+  }
+
+  SendUpdateRequests(requests);
+}
+
+
+OpalVideoStreamForwarder::Input * OpalVideoStreamForwarder::SelectInput(const Output & output)
+{
+  Input * first = NULL;
+  for (InputMap::iterator it = m_inputs.begin(); it != m_inputs.end(); ++it) {
+    Input * input = it->second;
+    if (input->m_token == output.m_token || input->m_format != output.m_format || input->m_ranked.empty())
+      continue;
+    if (input->m_token == m_focus)
+      return input;
+    if (first == NULL)
+      first = input;
+  }
+  return first;
+}
+
+
+void OpalVideoStreamForwarder::SelectTarget(Output & output, const PTimeInterval & now, UpdateRequests & requests)
+{
+  Input * input = SelectInput(output);
+  if (input == NULL) {
+    output.m_targetInput.MakeEmpty();
+    output.m_targetSSRC = 0;
+    return;
+  }
+
+  // Best layer that fits, or the lowest one if none do
+  RTP_SyncSourceId ssrc = input->m_ranked.back();
+  for (std::vector<RTP_SyncSourceId>::iterator it = input->m_ranked.begin(); it != input->m_ranked.end(); ++it) {
+    if (input->m_layers[*it]->m_bitRate <= output.m_bandwidth) {
+      ssrc = *it;
+      break;
+    }
+  }
+
+  /* If still too much, drop temporal layers. Typical three layer allocations
+     have the base layer at 40%, and the first two at 60%, of the total. */
+  unsigned bitRate = input->m_layers[ssrc]->m_bitRate;
+  if (!input->m_temporalLayers || bitRate <= output.m_bandwidth)
+    output.m_targetTemporalId = MaxTemporalId;
+  else if (output.m_bandwidth*10ULL >= bitRate*6ULL)
+    output.m_targetTemporalId = 1;
+  else
+    output.m_targetTemporalId = 0;
+
+  PString key = input->m_stream->GetID();
+  if (output.m_targetInput == key && output.m_targetSSRC == ssrc)
+    return;
+
+  PTRACE(4, "Output selecting input " << key << " SSRC=" << RTP_TRACE_SRC(ssrc)
+         << " at " << bitRate << "bps for bandwidth " << output.m_bandwidth << "bps");
+  output.m_targetInput = key;
+  output.m_targetSSRC = ssrc;
+
+  if (output.m_currentInput != key || output.m_currentSSRC != ssrc)
+    RequestUpdate(*input, ssrc, now, requests);
+}
+
+
+void OpalVideoStreamForwarder::RequestUpdate(Input & input, RTP_SyncSourceId ssrc, const PTimeInterval & now, UpdateRequests & requests)
+{
+  LayerMap::iterator it = input.m_layers.find(ssrc);
+  if (it == input.m_layers.end())
+    return;
+
+  // Many receivers can want the same layer at once, only ask the sender occasionally
+  if (now - it->second->m_lastUpdateRequest < UpdateRequestInterval)
+    return;
+
+  it->second->m_lastUpdateRequest = now;
+  requests.push_back(UpdateRequests::value_type(input.m_stream, ssrc));
+}
+
+
+void OpalVideoStreamForwarder::SendUpdateRequests(const UpdateRequests & requests)
+{
+  // Done outside of the mutex as this goes back through the participants media patch
+  for (UpdateRequests::const_iterator it = requests.begin(); it != requests.end(); ++it) {
+    PTRACE(4, "Requesting intra frame on input " << it->first->GetID() << " SSRC=" << RTP_TRACE_SRC(it->second));
+    it->first->ExecuteCommand(OpalVideoUpdatePicture(0, it->second));
+  }
+}
+
+#undef  PTraceModule
+#define PTraceModule() "MixerNode"
 #endif
 
 
@@ -2127,5 +3318,11 @@ OpalVideoStreamMixer * OpalMixerNodeManager::CreateVideoMixer(const OpalMixerNod
 {
   return new OpalVideoStreamMixer(info);
 }
+
+
+OpalVideoStreamForwarder * OpalMixerNodeManager::CreateVideoForwarder(const OpalMixerNodeInfo & info)
+{
+  return new OpalVideoStreamForwarder(info);
+}
 #endif
 #endif // OPAL_HAS_MIXER
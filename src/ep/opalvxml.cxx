@@ -88,6 +88,21 @@ bool OpalVXMLSession::OnTransfer(const PString & destination, TransferType type)
 }
 
 
+PBoolean OpalVXMLSession::PlayFile(const PString & fn, PINDEX repeat, PINDEX delay, PBoolean autoDelete)
+{
+  // Temporary files, e.g. recordings, are not worth caching
+  if (!autoDelete) {
+    PBYTEArray data;
+    if (m_connection.GetCachedPrompt(fn, data)) {
+      PTRACE(4, "IVR\tPlaying cached prompt " << fn << ' ' << repeat << " times, " << delay << "ms");
+      return PlayData(data, repeat, delay);
+    }
+  }
+
+  return PVXMLSession::PlayFile(fn, repeat, delay, autoDelete);
+}
+
+
 #endif // OPAL_IVR
 
 
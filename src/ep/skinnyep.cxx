@@ -1390,7 +1390,7 @@ bool OpalSkinnyConnection::OnReceiveMsg(const OpalSkinnyEndPoint::CloseReceiveCh
   if (mediaStream != NULL)
     m_endpoint.GetManager().QueueDecoupledEvent(
                      new PSafeWorkArg1<OpalSkinnyConnection, OpalMediaStreamPtr>(this,
-                            mediaStream, &OpalSkinnyConnection::DelayCloseMediaStream));
+                            mediaStream, &OpalSkinnyConnection::DelayCloseMediaStream), GetCall().GetToken());
   m_passThruMedia.erase(it);
   return true;
 }
@@ -1415,7 +1415,7 @@ bool OpalSkinnyConnection::OnReceiveMsg(const OpalSkinnyEndPoint::StopMediaTrans
   if (mediaStream != NULL)
     m_endpoint.GetManager().QueueDecoupledEvent(
                      new PSafeWorkArg1<OpalSkinnyConnection, OpalMediaStreamPtr>(this,
-                            mediaStream, &OpalSkinnyConnection::DelayCloseMediaStream));
+                            mediaStream, &OpalSkinnyConnection::DelayCloseMediaStream), GetCall().GetToken());
   m_passThruMedia.erase(it);
   return true;
 }
@@ -5560,7 +5560,7 @@ void H323Connection::UserInputIndicationTimeout(PTimer&, P_INT_PTR)
   GetEndPoint().GetManager().QueueDecoupledEvent(
             new PSafeWorkArg2<OpalConnection, char, unsigned>(this, m_lastUserInputIndication,
                                                               (unsigned)m_lastUserInputIndicationStart.GetElapsed().GetMilliSeconds(),
-                                                              &OpalConnection::OnUserInputTone));
+                                                              &OpalConnection::OnUserInputTone), GetCall().GetToken());
 }
 
 
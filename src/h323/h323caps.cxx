@@ -440,6 +440,27 @@ OpalMediaFormat H323Capability::GetMediaFormat() const
 }
 
 
+PString H323Capability::GetCapabilityPDUKey() const
+{
+  // Non-standard data is from a virtual, so could be anything
+  if (dynamic_cast<const H323NonStandardCapabilityInfo *>(this) != NULL)
+    return PString::Empty();
+
+  PStringStream key;
+  key << GetClass() << ',' << GetFormatName() << ',' << GetCapabilityNumber()
+      << ',' << GetMainType() << ',' << GetSubType() << ',' << GetCapabilityDirection();
+
+  // Members of the generic mix-in that are not media format options
+  const H323GenericCapabilityInfo * generic = dynamic_cast<const H323GenericCapabilityInfo *>(this);
+  if (generic != NULL)
+    generic->PrintCapabilityPDUKey(key);
+
+  key << ',';
+  GetMediaFormat().PrintOptions(key);
+  return key;
+}
+
+
 bool H323Capability::UpdateMediaFormat(const OpalMediaFormat & mediaFormat)
 {
   return GetWritableMediaFormat().Update(mediaFormat);
@@ -695,6 +716,12 @@ H323GenericCapabilityInfo::H323GenericCapabilityInfo(const PString & standardId,
 }
 
 
+void H323GenericCapabilityInfo::PrintCapabilityPDUKey(ostream & strm) const
+{
+  strm << ',' << m_identifier << ',' << m_bitRateMode << ',' << (OpalBandwidth::int_type)m_maxBitRate;
+}
+
+
 struct OpalMediaOptionSortByPosition
 {
   bool operator()(OpalMediaOption const * const & o1, OpalMediaOption const * const & o2)
@@ -1533,6 +1560,18 @@ unsigned H323ExtendedVideoCapability::GetSubType() const
 }
 
 
+PString H323ExtendedVideoCapability::GetCapabilityPDUKey() const
+{
+  PStringStream key;
+  key << H323GenericVideoCapability::GetCapabilityPDUKey();
+  for (OpalMediaFormatList::const_iterator videoFormat = m_videoFormats.begin(); videoFormat != m_videoFormats.end(); ++videoFormat) {
+    key << ',' << *videoFormat << ',';
+    videoFormat->PrintOptions(key);
+  }
+  return key;
+}
+
+
 PBoolean H323ExtendedVideoCapability::OnSendingPDU(H245_VideoCapability & pdu, CommandType type) const
 {
   pdu.SetTag(H245_VideoCapability::e_extendedVideoCapability);
@@ -1854,6 +1893,16 @@ PString H235SecurityCapability::GetFormatName() const
 }
 
 
+PString H235SecurityCapability::GetCapabilityPDUKey() const
+{
+  PStringStream key;
+  key << H323Capability::GetCapabilityPDUKey() << ',' << m_mediaCapabilityNumber;
+  for (OpalMediaCryptoSuite::List::const_iterator it = m_cryptoSuites.begin(); it != m_cryptoSuites.end(); ++it)
+    key << ',' << it->GetFactoryName();
+  return key;
+}
+
+
 PBoolean H235SecurityCapability::OnSendingPDU(H245_Capability & pdu) const
 {
   pdu.SetTag(H245_Capability::e_h235SecurityCapability);
@@ -2382,6 +2431,14 @@ unsigned H323DataCapability::GetDefaultSessionID() const
 }
 
 
+PString H323DataCapability::GetCapabilityPDUKey() const
+{
+  PStringStream key;
+  key << H323Capability::GetCapabilityPDUKey() << ',' << (OpalBandwidth::int_type)m_maxBitRate;
+  return key;
+}
+
+
 PBoolean H323DataCapability::OnSendingPDU(H245_Capability & cap) const
 {
   static unsigned const tags[NumCapabilityDirections] = {
@@ -2854,6 +2911,14 @@ PString H323FECCapability::GetFormatName() const
 }
 
 
+PString H323FECCapability::GetCapabilityPDUKey() const
+{
+  PStringStream key;
+  key << H323Capability::GetCapabilityPDUKey() << ',' << m_scheme << ',' << m_protectedCapability;
+  return key;
+}
+
+
 PBoolean H323FECCapability::OnSendingPDU(H245_Capability & pdu) const
 {
   pdu.SetTag(H245_Capability::e_fecCapability);
@@ -3710,6 +3775,49 @@ void H323Capabilities::BuildPDU(const H323Connection & connection,
   if (tableSize == 0 || setSize == 0)
     return;
 
+  /* Build the key for the cache from everything that goes into the PDU. Note
+     that the customised options are needed for the key, and the capability
+     is expected to have them regardless of whether the cache is used. */
+  H323CapabilitiesPDUCache & cache = connection.GetEndPoint().GetCapabilitiesPDUCache();
+  PStringStream key;
+  bool cacheable = cache.GetMaxSize() > 0;
+
+  PINDEX i;
+  for (i = 0; i < tableSize; i++) {
+    H323Capability & capability = m_table[i];
+    if (capability.IsUsable(connection)) {
+      capability.GetWritableMediaFormat().ToCustomisedOptions();
+      if (cacheable) {
+        PString capKey = capability.GetCapabilityPDUKey();
+        if (capKey.IsEmpty())
+          cacheable = false;
+        else
+          key << capKey << '\n';
+      }
+    }
+  }
+
+  if (cacheable) {
+    for (PINDEX outer = 0; outer < setSize; outer++) {
+      key << m_set[outer].m_capabilityDescriptorNumber << '{';
+      for (PINDEX middle = 0; middle < m_set[outer].GetSize(); middle++) {
+        key << '[';
+        for (PINDEX inner = 0; inner < m_set[outer][middle].GetSize(); inner++) {
+          H323Capability & capability = m_set[outer][middle][inner];
+          if (capability.IsUsable(connection))
+            key << capability.GetCapabilityNumber() << ' ';
+        }
+        key << ']';
+      }
+      key << '}';
+    }
+
+    if (cache.Lookup(key, pdu)) {
+      PTRACE(5, "H323\tUsing cached capability table PDU");
+      return;
+    }
+  }
+
   // Set the table of capabilities
   pdu.IncludeOptionalField(H245_TerminalCapabilitySet::e_capabilityTable);
 
@@ -3718,7 +3826,6 @@ void H323Capabilities::BuildPDU(const H323Connection & connection,
 
   // encode the capabilities
   PINDEX count = 0;
-  PINDEX i;
   for (i = 0; i < tableSize; i++) {
     H323Capability & capability = m_table[i];
     if (capability.IsUsable(connection)) {
@@ -3726,7 +3833,6 @@ void H323Capabilities::BuildPDU(const H323Connection & connection,
       H245_CapabilityTableEntry & entry = pdu.m_capabilityTable[count++];
       entry.m_capabilityTableEntryNumber = capability.GetCapabilityNumber();
       entry.IncludeOptionalField(H245_CapabilityTableEntry::e_capability);
-      capability.GetWritableMediaFormat().ToCustomisedOptions();
       if (capability.OnSendingPDU(entry.m_capability))
         mediaPacketizations.Union(capability.GetMediaFormat().GetMediaPacketizationSet());
       else
@@ -3762,6 +3868,107 @@ void H323Capabilities::BuildPDU(const H323Connection & connection,
       }
     }
   }
+
+  if (cacheable)
+    cache.Store(key, pdu);
+}
+
+
+///////////////////////////////////////////////////////////////////////////////
+
+H323CapabilitiesPDUCache::H323CapabilitiesPDUCache(PINDEX maxSize)
+  : m_maxSize(maxSize)
+{
+}
+
+
+H323CapabilitiesPDUCache::~H323CapabilitiesPDUCache()
+{
+  RemoveAll();
+}
+
+
+bool H323CapabilitiesPDUCache::Lookup(const PString & key, H245_TerminalCapabilitySet & pdu)
+{
+  PWaitAndSignal mutex(m_mutex);
+
+  EntryMap::iterator it = m_entries.find(key);
+  if (it == m_entries.end())
+    return false;
+
+  const H245_TerminalCapabilitySet & cached = *it->second;
+
+  if (cached.HasOptionalField(H245_TerminalCapabilitySet::e_capabilityTable)) {
+    pdu.IncludeOptionalField(H245_TerminalCapabilitySet::e_capabilityTable);
+    pdu.m_capabilityTable = cached.m_capabilityTable;
+  }
+
+  if (cached.HasOptionalField(H245_TerminalCapabilitySet::e_capabilityDescriptors)) {
+    pdu.IncludeOptionalField(H245_TerminalCapabilitySet::e_capabilityDescriptors);
+    pdu.m_capabilityDescriptors = cached.m_capabilityDescriptors;
+  }
+
+  const H245_H2250Capability & cachedH2250 = cached.m_multiplexCapability;
+  if (cachedH2250.m_mediaPacketizationCapability.HasOptionalField(H245_MediaPacketizationCapability::e_rtpPayloadType)) {
+    H245_H2250Capability & h225_0 = pdu.m_multiplexCapability;
+    h225_0.m_mediaPacketizationCapability.IncludeOptionalField(H245_MediaPacketizationCapability::e_rtpPayloadType);
+    h225_0.m_mediaPacketizationCapability.m_rtpPayloadType = cachedH2250.m_mediaPacketizationCapability.m_rtpPayloadType;
+  }
+
+  // Move to most recently used
+  m_order.remove(key);
+  m_order.push_back(key);
+  return true;
+}
+
+
+void H323CapabilitiesPDUCache::Store(const PString & key, const H245_TerminalCapabilitySet & pdu)
+{
+  PWaitAndSignal mutex(m_mutex);
+
+  if (m_maxSize <= 0)
+    return;
+
+  EntryMap::iterator it = m_entries.find(key);
+  if (it != m_entries.end()) {
+    *it->second = pdu;
+    return;
+  }
+
+  while ((PINDEX)m_entries.size() >= m_maxSize) {
+    EntryMap::iterator oldest = m_entries.find(m_order.front());
+    delete oldest->second;
+    m_entries.erase(oldest);
+    m_order.pop_front();
+  }
+
+  m_entries[key] = new H245_TerminalCapabilitySet(pdu);
+  m_order.push_back(key);
+}
+
+
+void H323CapabilitiesPDUCache::SetMaxSize(PINDEX maxSize)
+{
+  PWaitAndSignal mutex(m_mutex);
+
+  m_maxSize = maxSize;
+  while ((PINDEX)m_entries.size() > std::max(m_maxSize, (PINDEX)0)) {
+    EntryMap::iterator oldest = m_entries.find(m_order.front());
+    delete oldest->second;
+    m_entries.erase(oldest);
+    m_order.pop_front();
+  }
+}
+
+
+void H323CapabilitiesPDUCache::RemoveAll()
+{
+  PWaitAndSignal mutex(m_mutex);
+
+  for (EntryMap::iterator it = m_entries.begin(); it != m_entries.end(); ++it)
+    delete it->second;
+  m_entries.clear();
+  m_order.clear();
 }
 
 
@@ -264,10 +264,8 @@ void H460_FeatureStd19::OnReceiveOLCGenericInformation(unsigned sessionID, const
 H46019Server::H46019Server(H323EndPoint & ep)
   : m_endpoint(ep)
   , m_keepAliveTTL(20)
-  , m_keepAliveSocket(NULL)
-  , m_rtpSocket(NULL)
-  , m_rtcpSocket(NULL)
-  , m_multiplexThread(NULL)
+  , m_rtpListener(ep.GetManager())
+  , m_rtcpListener(ep.GetManager())
 {
 }
 
@@ -275,46 +273,40 @@ H46019Server::H46019Server(H323EndPoint & ep)
 H46019Server::H46019Server(H323EndPoint & ep, const PIPSocket::Address & localInterface)
   : m_endpoint(ep)
   , m_keepAliveTTL(20)
-{
-  m_keepAliveSocket = m_rtpSocket = new PUDPSocket;
-  m_rtcpSocket = m_rtpSocket = new PUDPSocket;
-
-  PIPSocket * sockets[2] = { m_rtpSocket, m_rtcpSocket };
-  if (ep.GetManager().GetRtpIpPortRange().Listen(sockets, 2, localInterface))
-    m_multiplexThread = new PThreadObj<H46019Server>(*this, &H46019Server::MultiplexThread, false, "MuxH.460.19");
-  else {
-    delete m_rtpSocket;
-    delete m_rtcpSocket;
-    m_keepAliveSocket = m_rtcpSocket = m_rtpSocket = NULL;
-    m_multiplexThread = NULL;
+  , m_rtpListener(ep.GetManager())
+  , m_rtcpListener(ep.GetManager())
+{
+  // Every packet has the four byte multiplex ID prepended, which selects the session
+  const PIPSocket::PortRange & ports = ep.GetManager().GetRtpIpPortRange();
+  for (unsigned port = ports.GetBase(); port < ports.GetMax(); port += 2) {
+    if (m_rtpListener.Open(localInterface, (WORD)port, 1, true, OpalMediaTransportChannelTypes::e_Media) &&
+        m_rtcpListener.Open(localInterface, (WORD)(port+1), 1, true, OpalMediaTransportChannelTypes::e_Control))
+      return;
+    m_rtpListener.Close();
   }
+
+  PTRACE(1, "No ports available for multiplexed media on " << localInterface);
 }
 
 
 H46019Server::~H46019Server()
 {
-  if (m_keepAliveSocket != m_rtpSocket)
-    delete m_keepAliveSocket;
-  delete m_rtpSocket;
-  delete m_rtcpSocket;
+  // Stop read threads before the relays they refer to are destroyed
+  m_rtpListener.Close();
+  m_rtcpListener.Close();
 }
 
 
 H323TransportAddress H46019Server::GetKeepAliveAddress() const
 {
-  PIPSocketAddressAndPort ipAndPort;
-  if (m_keepAliveSocket != NULL && m_keepAliveSocket->GetLocalAddress(ipAndPort))
-    return H323TransportAddress(ipAndPort);
-
-  return H323TransportAddress();
+  return GetMuxRTPAddress();
 }
 
 
 H323TransportAddress H46019Server::GetMuxRTPAddress() const
 {
-  PIPSocketAddressAndPort ipAndPort;
-  if (m_rtpSocket != NULL && m_rtpSocket->GetLocalAddress(ipAndPort))
-    return H323TransportAddress(ipAndPort);
+  if (m_rtpListener.IsOpen())
+    return H323TransportAddress(m_rtpListener.GetLocalAddress());
 
   return H323TransportAddress();
 }
@@ -322,9 +314,8 @@ H323TransportAddress H46019Server::GetMuxRTPAddress() const
 
 H323TransportAddress H46019Server::GetMuxRTCPAddress() const
 {
-  PIPSocketAddressAndPort ipAndPort;
-  if (m_rtcpSocket != NULL && m_rtcpSocket->GetLocalAddress(ipAndPort))
-    return H323TransportAddress(ipAndPort);
+  if (m_rtcpListener.IsOpen())
+    return H323TransportAddress(m_rtcpListener.GetLocalAddress());
 
   return H323TransportAddress();
 }
@@ -332,60 +323,34 @@ H323TransportAddress H46019Server::GetMuxRTCPAddress() const
 
 unsigned H46019Server::CreateMultiplexID(const PIPSocketAddressAndPort & rtp, const PIPSocketAddressAndPort & rtcp)
 {
-  unsigned id;
-  do {
-    id = PRandom::Number();
-  } while (!m_multiplexedSockets.insert(MuxMap::value_type(id, SocketPair(rtp, rtcp))).second);
-  return id;
-}
-
-
-void H46019Server::MultiplexThread()
-{
-  PTRACE(4, "Started multiplex thread");
+  PWaitAndSignal lock(m_mutex);
 
-  while (m_rtpSocket->IsOpen()) {
-    int selectStatus = PSocket::Select(*m_rtpSocket, *m_rtcpSocket, PMaxTimeInterval);
-    if (selectStatus > 0) {
-      PTRACE(1, "Select error: " << PChannel::GetErrorText((PChannel::Errors)selectStatus));
-      break;
-    }
+  for (;;) {
+    unsigned id = PRandom::Number();
+    std::pair<MuxMap::iterator, bool> result = m_multiplexedSockets.insert(MuxMap::value_type(id, SocketPair(rtp, rtcp)));
+    if (!result.second)
+      continue;
 
-    if ((-selectStatus & 1) != 0 && !Multiplex(false))
-      break;
+    OpalMediaMuxListener::Key key = OpalMediaMuxListener::MakeKey(OpalMediaMuxListener::e_MuxID, id);
+    if (m_rtpListener.AddRoute(key, result.first->second) && m_rtcpListener.AddRoute(key, result.first->second))
+      return id;
 
-    if ((-selectStatus & 2) != 0 && !Multiplex(true))
-      break;
+    PTRACE(2, "Could not add route for multiplex ID " << id);
+    m_rtpListener.RemoveRoute(key, &result.first->second);
+    m_multiplexedSockets.erase(result.first);
+    return 0;
   }
-
-  PTRACE(4, "Ended multiplex thread");
 }
 
 
-bool H46019Server::Multiplex(bool rtcp)
+void H46019Server::SocketPair::OnMuxData(OpalMediaMuxListener & listener,
+                                         OpalMediaTransportChannelTypes::SubChannels subchannel,
+                                         const PBYTEArray & data,
+                                         const PIPSocketAddressAndPort &,
+                                         unsigned shard)
 {
-  struct {
-    PUInt32b m_muxId;
-    BYTE     m_packet[65532];
-  } buffer;
-
-  PUDPSocket & socket = *(rtcp ? m_rtcpSocket : m_rtpSocket);
-  if (!socket.Read(&buffer, sizeof(buffer))) {
-    PTRACE(3, "Multiplex socket read error: " << socket.GetErrorText(PChannel::LastReadError));
-    return false;
-  }
-
-  MuxMap::iterator it = m_multiplexedSockets.find(buffer.m_muxId);
-  if (it == m_multiplexedSockets.end()) {
-    PTRACE(3, "Received packet with unknown multiplex ID: " << buffer.m_muxId);
-    return true;
-  }
-
-  if (socket.WriteTo(buffer.m_packet, socket.GetLastReadCount()-sizeof(buffer.m_muxId), rtcp ? it->second.m_rtcp : it->second.m_rtp))
-    return true;
-
-  PTRACE(3, "Multiplex socket write error: " << socket.GetErrorText(PChannel::LastWriteError));
-  return false;
+  if (!listener.WriteTo(data, data.GetSize(), subchannel == OpalMediaTransportChannelTypes::e_Control ? m_rtcp : m_rtp, shard))
+    PTRACE(3, "Multiplex socket write error to " << (subchannel == OpalMediaTransportChannelTypes::e_Control ? m_rtcp : m_rtp));
 }
 
 
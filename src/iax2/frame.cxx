@@ -46,6 +46,80 @@
 #include <ptclib/cypher.h>
 
 
+#if !PMEMORY_CHECK
+
+/*Free lists of frame memory, one per size in 16 byte units. There are only
+  a handful of frame classes, so only a handful of lists are ever used. The
+  pool is never destroyed, as frames may be deleted during static
+  destruction. */
+class IAX2FramePool
+{
+ public:
+  enum {
+    Granularity = 16,
+    MaxPooledSize = 1024,
+    MaxFreePerSize = 512
+  };
+
+  void * Allocate(size_t size)
+  {
+    if (size > MaxPooledSize)
+      return ::operator new(size);
+
+    size_t bucket = (size + Granularity - 1)/Granularity;
+    {
+      PWaitAndSignal m(mutex);
+      std::vector<void *> & freeList = freeLists[bucket];
+      if (!freeList.empty()) {
+        void * ptr = freeList.back();
+        freeList.pop_back();
+        return ptr;
+      }
+    }
+    return ::operator new(bucket*Granularity);
+  }
+
+  void Free(void * ptr, size_t size)
+  {
+    if (ptr == NULL)
+      return;
+
+    if (size <= MaxPooledSize) {
+      size_t bucket = (size + Granularity - 1)/Granularity;
+      PWaitAndSignal m(mutex);
+      std::vector<void *> & freeList = freeLists[bucket];
+      if (freeList.size() < MaxFreePerSize) {
+        freeList.push_back(ptr);
+        return;
+      }
+    }
+    ::operator delete(ptr);
+  }
+
+ protected:
+  PDECLARE_MUTEX(mutex);
+  std::vector<void *> freeLists[MaxPooledSize/Granularity + 1];
+};
+
+static IAX2FramePool & GetFramePool()
+{
+  static IAX2FramePool * pool = new IAX2FramePool;
+  return *pool;
+}
+
+void * IAX2Frame::operator new(size_t nSize)
+{
+  return GetFramePool().Allocate(nSize);
+}
+
+void IAX2Frame::operator delete(void * ptr, size_t nSize)
+{
+  GetFramePool().Free(ptr, nSize);
+}
+
+#endif // !PMEMORY_CHECK
+
+
 #define new PNEW
 
 
@@ -76,6 +150,7 @@ void IAX2Frame::ZeroAllValues()
   isFullFrame       = false;
   isVideo           = false;
   isAudio           = false;
+  isMetaTrunk       = false;
   
   currentReadIndex  = 0;
   currentWriteIndex = 0;
@@ -97,13 +172,15 @@ void IAX2Frame::SetTimeStamp(DWORD newValue)
 
 PBoolean IAX2Frame::ReadNetworkPacket(PUDPSocket &sock)
 {
-  data.SetSize(4096);  //Surely no packets > 4096 bytes in length
+  /*Read into a local buffer, so data is allocated once at the right size,
+    rather than at 4096 bytes and then shrunk. */
+  BYTE buffer[4096];  //Surely no packets > 4096 bytes in length
   
   WORD     portNo;
   PIPSocket::Address addr;
   sock.GetLocalAddress(addr);
   
-  PBoolean res = sock.ReadFrom(data.GetPointer(), 4096, addr, portNo);
+  PBoolean res = sock.ReadFrom(buffer, sizeof(buffer), addr, portNo);
   remote.SetRemoteAddress(addr);
   remote.SetRemotePort(portNo);
   
@@ -112,7 +189,7 @@ PBoolean IAX2Frame::ReadNetworkPacket(PUDPSocket &sock)
     return false;
   }
   
-  data.SetSize(sock.GetLastReadCount());
+  data = PBYTEArray(buffer, sock.GetLastReadCount());
   
   if (data.GetSize() < 4) {
     PTRACE(3, "Frame\tRead a very very small packet from the network - < 4 bytes");
@@ -217,7 +294,14 @@ PBoolean IAX2Frame::ProcessNetworkPacket()
     remote.SetDestCallNumber(a & 0x7fff);
     return true;
   }
-  if (a == 0) {    //We have a mini frame here, of video type.
+  if (a == 0) {
+    if ((data[2] & 0x80) == 0) {
+      /*Meta frame, as video mini frames have the V bit set. The only meta
+	frame defined is the trunk frame, which is split up by the receiver */
+      isMetaTrunk = true;
+      return true;
+    }
+    //We have a mini frame here, of video type.
     isVideo = true;
     PINDEX b = 0;
     Read2Bytes(b);
@@ -230,6 +314,58 @@ PBoolean IAX2Frame::ProcessNetworkPacket()
   return true;
 }
 
+PBoolean IAX2Frame::SplitMetaTrunkFrame(IAX2FrameList & frames)
+{
+  if (!isMetaTrunk || data.GetSize() < metaTrunkHeaderSize)
+    return false;
+
+  currentReadIndex = 2;
+  BYTE command = 0, commandData = 0;
+  DWORD trunkTimeStamp = 0;
+  Read1Byte(command);
+  Read1Byte(commandData);
+  Read4Bytes(trunkTimeStamp);
+
+  if (command != metaTrunkCommand) {
+    PTRACE(3, "Frame\tUnknown meta command " << (unsigned)command << " in " << IdString());
+    return false;
+  }
+
+  PBoolean withTimeStamps = (commandData & metaTrunkTimeStamps) != 0;
+  PINDEX entries = 0;
+
+  while (GetUnReadBytes() > 0) {
+    PINDEX callNumber = 0, length = 0, entryTimeStamp = trunkTimeStamp & 0xffff;
+    PBoolean ok;
+    if (withTimeStamps)
+      ok = Read2Bytes(length) && Read2Bytes(callNumber) && Read2Bytes(entryTimeStamp);
+    else
+      ok = Read2Bytes(callNumber) && Read2Bytes(length);
+
+    callNumber &= 0x7fff;
+    if (!ok || length > GetUnReadBytes() || callNumber == 0) {
+      PTRACE(3, "Frame\tMalformed meta trunk frame " << IdString() << " after " << entries << " entries");
+      return entries > 0;
+    }
+
+    /*Rebuild the mini frame, exactly as if it had arrived on its own */
+    IAX2Frame *mini = new IAX2Frame(endpoint);
+    mini->remote.Assign(remote);
+    mini->data.SetSize(4 + length);
+    mini->Write2Bytes(callNumber);
+    mini->Write2Bytes(entryTimeStamp);
+    memcpy(mini->data.GetPointer() + 4, data.GetPointer() + currentReadIndex, length);
+    currentReadIndex += length;
+
+    mini->ProcessNetworkPacket();
+    frames.AddNewFrame(mini);
+    entries++;
+  }
+
+  PTRACE(5, "Frame\tSplit meta trunk frame " << IdString() << " into " << entries << " mini frames");
+  return true;
+}
+
 void IAX2Frame::BuildConnectionToken()
 {
   connectionToken = remote.BuildConnectionToken();
@@ -421,6 +557,7 @@ IAX2MiniFrame::IAX2MiniFrame(IAX2Processor * iax2Processor, PBYTEArray &sound,
 		     PBoolean _isAudio, DWORD usersTimeStamp) 
   : IAX2Frame(iax2Processor->GetEndPoint())
 {
+  ZeroAllValues();
   isAudio = _isAudio;
   presetTimeStamp = usersTimeStamp;
   InitialiseHeader(iax2Processor);  
@@ -459,6 +596,7 @@ PBoolean IAX2MiniFrame::ProcessNetworkPacket()
 
 void IAX2MiniFrame::ZeroAllValues()
 {
+  canTrunk = false;
 }
 
 void IAX2MiniFrame::AlterTimeStamp(PINDEX newValue)
@@ -560,7 +698,7 @@ void IAX2FullFrame::ZeroAllValues()
   sequence.ZeroAllValues();
   canRetransmitFrame = true;
   
-  transmissionTimer.SetNotifier(PCREATE_NOTIFIER(OnTransmissionTimeout));
+  retransmitTick = 0;
   
   retryDelta = PTimeInterval(minRetryTime);
   retries = maxRetries;
@@ -591,9 +729,8 @@ PBoolean IAX2FullFrame::TransmitPacket(PUDPSocket &sock)
     return false;    //Give up on this packet, it has exceeded the allowed number of retries.
   }
   
-  PTRACE(6, "Start timer running for " << IdString() << connectionToken);
-  transmissionTimer.SetInterval(retryDelta.GetMilliSeconds());
-  transmissionTimer.Reset();   //*This causes the timer to start running.
+  PTRACE(6, "Set retransmit time for " << IdString() << connectionToken);
+  retransmitTick = PTimer::Tick() + retryDelta;
   ClearListFlags();
   
   return IAX2Frame::TransmitPacket(sock);
@@ -798,7 +935,6 @@ PBoolean IAX2FullFrame::WriteHeader()
 
 void IAX2FullFrame::MarkVnakSendNow()
 {
-  transmissionTimer.Stop();
   sendFrameNow = true;
   deleteFrameNow = false;    
   retryDelta = PTimeInterval(minRetryTime);
@@ -808,12 +944,11 @@ void IAX2FullFrame::MarkVnakSendNow()
 void IAX2FullFrame::MarkDeleteNow()
 {
   PTRACE(5, "MarkDeleteNow() method on " << IdString());
-  transmissionTimer.Stop();
   deleteFrameNow = true;
   retries = P_MAX_INDEX;
 }
 
-void IAX2FullFrame::OnTransmissionTimeout(PTimer &, P_INT_PTR)
+void IAX2FullFrame::OnTransmissionTimeout()
 {
   PTRACE(4, "Has had a TX timeout " << IdString() << " " << connectionToken);
   retryDelta = 4 * retryDelta.GetMilliSeconds();
@@ -831,8 +966,6 @@ void IAX2FullFrame::OnTransmissionTimeout(PTimer &, P_INT_PTR)
     sendFrameNow = true;
     PTRACE(5, "Tx timeout, so Mark as Send now " << IdString() << " " << connectionToken);
   }
-
-  endpoint.transmitter->ProcessLists();
 }
 
 PString IAX2FullFrame::GetFullFrameName() const
@@ -1521,113 +1654,109 @@ IAX2Frame *IAX2FrameList::GetLastFrame()
 
 void IAX2FrameList::DeleteMatchingSendFrame(IAX2FullFrame *reply)
 {
-  iterator currentIter;
-  IAX2FullFrame *sent;
-
   PWaitAndSignal m(mutex);
   //Look for a frame that has been sent, which is waiting for a reply/ack.
   PTRACE(5, "Frame\tID# Delete matchingSendFrame start, test on " 
 	 << reply->IdString());
 
   for (iterator it = begin(); it != end(); ++it) {
-    sent = NULL;
     PTRACE(5, "ID#DeleteMatching " << it->IdString());
     if (!it->IsFullFrame())
       continue;
 
-    sent = (IAX2FullFrame *)&*it;
-    currentIter = it; /* If a match is found, we delete this one */
-
-    if (sent->DeleteFrameNow()) {
-      // Skip this frame, as it is marked, delete now
-      continue;
-    }
-
-    if (sent->IsNewFrame() &&
-	reply->IsCallTokenFrame()) {
-      if(sent->GetRemoteInfo().SourceCallNumber() == 
-	 reply->GetRemoteInfo().DestCallNumber()) 
-	goto foundMatch;
+    IAX2FullFrame *sent = (IAX2FullFrame *)&*it;
+    if (IsMatchingSendFrame(sent, reply)) {
+      delete sent;
+      erase(it);
+      return;
     }
+  }
+  // No match found, so no sent frame will be deleted 
+}  
 
-    if (!(sent->GetRemoteInfo() *= reply->GetRemoteInfo())) {
-      PTRACE(5, "mismatch in remote info");
-      continue;
-    } 
+PBoolean IAX2FrameList::IsMatchingSendFrame(IAX2FullFrame *sent, IAX2FullFrame *reply)
+{
+  if (sent->DeleteFrameNow()) {
+    // Skip this frame, as it is marked, delete now
+    return false;
+  }
 
-    if (sent->IsNewFrame() &&
-	reply->GetSequenceInfo().IsFirstReplyFrame()) {
-      PTRACE(5, "Frame\tHave a match on a new frame we sent out");
-      goto foundMatch;
-    }
-        
-    if (sent->IsRegReqFrame() && 
-        (reply->IsRegAckFrame() || reply->IsRegAuthFrame() || reply->IsRegRejFrame())) {
-      PTRACE(5, "have read a RegAck, RegAuth or RegRej packet for a RegReq frame we have sent, delete this RegReq");
-      PTRACE(5, "reg type frame, so MarkDeleteNow on " << sent->IdString());
-      goto foundMatch;
-    }
-    
-    if (sent->IsRegRelFrame() && 
-        (reply->IsRegAckFrame() || reply->IsRegAuthFrame() || reply->IsRegRejFrame())) {
-      PTRACE(5, "have read a RegAck, RegAuth or RegRej packet for a RegRel frame we have sent, delete this RegRel");
-      PTRACE(5, "reg rel/authoframe, so MarkDeleteNow on " << sent->IdString());
-      goto foundMatch;
-    }
-   
-    if (sent->GetTimeStamp() != reply->GetTimeStamp()) {
-      PTRACE(5, "Time stamps differ, so give up on the test" << sent->IdString());
-      continue;
-    } else {
-      PTRACE(5, "Time stamps are the same, so check in seqno vs oseqno " << sent->IdString());
-    }
+  if (sent->IsNewFrame() &&
+      reply->IsCallTokenFrame()) {
+    if(sent->GetRemoteInfo().SourceCallNumber() == 
+       reply->GetRemoteInfo().DestCallNumber()) 
+      return true;
+  }
 
-    PTRACE(5, "SeqNos\tSent is " << sent->GetSequenceInfo().OutSeqNo() 
-	   << " " << sent->GetSequenceInfo().InSeqNo());
-    PTRACE(5, "SeqNos\tRepl is " << reply->GetSequenceInfo().OutSeqNo() 
-	   << " " << reply->GetSequenceInfo().InSeqNo());
+  if (!(sent->GetRemoteInfo() *= reply->GetRemoteInfo())) {
+    PTRACE(5, "mismatch in remote info");
+    return false;
+  } 
 
-    if (reply->IsLagRpFrame() && sent->IsLagRqFrame()) {
-      PTRACE(5, "have read a LagRp packet for a LagRq frame  we have sent, delete this LagRq " 
-	     << sent->IdString());
-      PTRACE(5, "LAG frame, so MarkDeleteNow on " << sent->IdString());
-      goto foundMatch;
-    }
+  if (sent->IsNewFrame() &&
+      reply->GetSequenceInfo().IsFirstReplyFrame()) {
+    PTRACE(5, "Frame\tHave a match on a new frame we sent out");
+    return true;
+  }
+      
+  if (sent->IsRegReqFrame() && 
+      (reply->IsRegAckFrame() || reply->IsRegAuthFrame() || reply->IsRegRejFrame())) {
+    PTRACE(5, "have read a RegAck, RegAuth or RegRej packet for a RegReq frame we have sent, delete this RegReq");
+    PTRACE(5, "reg type frame, so MarkDeleteNow on " << sent->IdString());
+    return true;
+  }
+  
+  if (sent->IsRegRelFrame() && 
+      (reply->IsRegAckFrame() || reply->IsRegAuthFrame() || reply->IsRegRejFrame())) {
+    PTRACE(5, "have read a RegAck, RegAuth or RegRej packet for a RegRel frame we have sent, delete this RegRel");
+    PTRACE(5, "reg rel/authoframe, so MarkDeleteNow on " << sent->IdString());
+    return true;
+  }
+ 
+  if (sent->GetTimeStamp() != reply->GetTimeStamp()) {
+    PTRACE(5, "Time stamps differ, so give up on the test" << sent->IdString());
+    return false;
+  } else {
+    PTRACE(5, "Time stamps are the same, so check in seqno vs oseqno " << sent->IdString());
+  }
 
-    if (reply->IsPongFrame() && sent->IsPingFrame()) {
-      PTRACE(5, "have read a Pong packet for a PING frame  we have sent: delete the Pong " 
-	     << sent->IdString());
-      PTRACE(5, "PONG frame, so MarkDeleteNow on " << sent->IdString());
-      goto foundMatch;
-    }
+  PTRACE(5, "SeqNos\tSent is " << sent->GetSequenceInfo().OutSeqNo() 
+	 << " " << sent->GetSequenceInfo().InSeqNo());
+  PTRACE(5, "SeqNos\tRepl is " << reply->GetSequenceInfo().OutSeqNo() 
+	 << " " << reply->GetSequenceInfo().InSeqNo());
 
-    if (sent->GetSequenceInfo().InSeqNo() == reply->GetSequenceInfo().OutSeqNo()) {
-      PTRACE(5, "Timestamp, and inseqno matches oseqno " << sent->IdString());
-      if (reply->IsAckFrame()) {
-        PTRACE(5, "have read an ack packet for one we have sent, so delete this one " << sent->IdString());
-	PTRACE(5, "ack for existing frame, MarkDeleteNow " << sent->IdString());
-        goto foundMatch;
-      }    
-    } else {
-      PTRACE(5, "No match:: sent=" << sent->IdString() << " and reply=" << reply->IdString() 
-	     << PString(reply->IsAckFrame() ? "reply is ack frame " : "reply is not ack frame ")
-	     << PString("Sequence numbers are:: sentIn" ) 
-	     << sent->GetSequenceInfo().InSeqNo() << "  rcvdOut" << reply->GetSequenceInfo().OutSeqNo());
-    }	
-	  
-    PTRACE(5, " sequence " << sent->GetSequenceInfo().OutSeqNo() 
-	   << " and " << reply->GetSequenceInfo().InSeqNo() << " are different");
-    
+  if (reply->IsLagRpFrame() && sent->IsLagRqFrame()) {
+    PTRACE(5, "have read a LagRp packet for a LagRq frame  we have sent, delete this LagRq " 
+	   << sent->IdString());
+    PTRACE(5, "LAG frame, so MarkDeleteNow on " << sent->IdString());
+    return true;
   }
-  // No match found, so no sent frame will be deleted 
-  return;
 
- foundMatch:
+  if (reply->IsPongFrame() && sent->IsPingFrame()) {
+    PTRACE(5, "have read a Pong packet for a PING frame  we have sent: delete the Pong " 
+	   << sent->IdString());
+    PTRACE(5, "PONG frame, so MarkDeleteNow on " << sent->IdString());
+    return true;
+  }
 
-  delete sent;
-  erase(currentIter);
-  return;
-}  
+  if (sent->GetSequenceInfo().InSeqNo() == reply->GetSequenceInfo().OutSeqNo()) {
+    PTRACE(5, "Timestamp, and inseqno matches oseqno " << sent->IdString());
+    if (reply->IsAckFrame()) {
+      PTRACE(5, "have read an ack packet for one we have sent, so delete this one " << sent->IdString());
+      PTRACE(5, "ack for existing frame, MarkDeleteNow " << sent->IdString());
+      return true;
+    }    
+  } else {
+    PTRACE(5, "No match:: sent=" << sent->IdString() << " and reply=" << reply->IdString() 
+	   << PString(reply->IsAckFrame() ? "reply is ack frame " : "reply is not ack frame ")
+	   << PString("Sequence numbers are:: sentIn" ) 
+	   << sent->GetSequenceInfo().InSeqNo() << "  rcvdOut" << reply->GetSequenceInfo().OutSeqNo());
+  }	
+	
+  PTRACE(5, " sequence " << sent->GetSequenceInfo().OutSeqNo() 
+	 << " and " << reply->GetSequenceInfo().InSeqNo() << " are different");
+  return false;
+}
 
 void IAX2FrameList::SendVnakRequestedFrames(IAX2FullFrameProtocol &src)
 {
@@ -1713,6 +1842,232 @@ void IAX2FrameList::MarkAllAsResent()
   }
 }
 
+////////////////////////////////////////////////////////////////////////////////
+
+IAX2AckingFrameList::IAX2AckingFrameList()
+  : wheelTick(PTimer::Tick().GetMilliSeconds()/WheelSlotTime*WheelSlotTime)
+  , count(0)
+{
+}
+
+IAX2AckingFrameList::~IAX2AckingFrameList()
+{
+  PWaitAndSignal m(mutex);
+  for (std::map<PINDEX, FrameVector>::iterator it = byCallNumber.begin(); it != byCallNumber.end(); ++it) {
+    for (FrameVector::iterator frame = it->second.begin(); frame != it->second.end(); ++frame)
+      delete *frame;
+  }
+}
+
+void IAX2AckingFrameList::ReportList(PString & answer)
+{
+  PStringStream reply;
+  {
+    PWaitAndSignal m(mutex);
+
+    PINDEX index = 0;
+    for (std::map<PINDEX, FrameVector>::iterator it = byCallNumber.begin(); it != byCallNumber.end(); ++it) {
+      for (FrameVector::iterator frame = it->second.begin(); frame != it->second.end(); ++frame) {
+	reply << "     #" << ++index << " of " 
+	      << count << "   "
+	      << (*frame)->GetConnectionToken() << " " 
+	      << (*frame)->GetTimeStamp() << " "
+	      << (*frame)->GetSequenceInfo().AsString() << " " 
+	      << (*frame)->GetFullFrameName() << endl;
+      }
+    }
+  }
+  answer = reply;
+}
+
+PINDEX IAX2AckingFrameList::GetSize()
+{
+  PWaitAndSignal m(mutex);
+  return count;
+}
+
+void IAX2AckingFrameList::AddNewFrame(IAX2FullFrame *newFrame)
+{
+  if (newFrame == NULL)
+    return;
+
+  PTRACE(5, "Frame\tAdd " << newFrame->IdString() 
+	 << " " << newFrame->GetRemoteInfo() << " to acking list");
+
+  PWaitAndSignal m(mutex);
+  byCallNumber[newFrame->GetRemoteInfo().SourceCallNumber()].push_back(newFrame);
+  ScheduleFrame(newFrame);
+  ++count;
+}
+
+void IAX2AckingFrameList::ScheduleFrame(IAX2FullFrame *frame)
+{
+  /*A tick already in the past goes in the next slot to be examined */
+  PInt64 tick = frame->GetRetransmitTick().GetMilliSeconds();
+  if (tick < wheelTick)
+    tick = wheelTick;
+  wheel[SlotOf(tick)].push_back(frame);
+}
+
+PBoolean IAX2AckingFrameList::RemoveFromVector(FrameVector & frames, IAX2FullFrame *frame)
+{
+  for (FrameVector::iterator it = frames.begin(); it != frames.end(); ++it) {
+    if (*it == frame) {
+      frames.erase(it);
+      return true;
+    }
+  }
+  return false;
+}
+
+void IAX2AckingFrameList::RemoveFromWheel(IAX2FullFrame *frame)
+{
+  if (RemoveFromVector(wheel[SlotOf(frame->GetRetransmitTick().GetMilliSeconds())], frame) ||
+      RemoveFromVector(dueNow, frame))
+    return;
+
+  /*Was scheduled with a tick already in the past, so search the lot */
+  for (PINDEX i = 0; i < WheelSlots; ++i) {
+    if (RemoveFromVector(wheel[i], frame))
+      return;
+  }
+}
+
+void IAX2AckingFrameList::RemoveFromCallIndex(IAX2FullFrame *frame)
+{
+  std::map<PINDEX, FrameVector>::iterator it = byCallNumber.find(frame->GetRemoteInfo().SourceCallNumber());
+  if (it != byCallNumber.end()) {
+    RemoveFromVector(it->second, frame);
+    if (it->second.empty())
+      byCallNumber.erase(it);
+  }
+
+  --count;
+}
+
+void IAX2AckingFrameList::DeleteMatchingSendFrame(IAX2FullFrame *reply)
+{
+  PWaitAndSignal m(mutex);
+  PTRACE(5, "Frame\tID# Delete matchingSendFrame start, test on " 
+	 << reply->IdString());
+
+  /*A reply always has a destination call number equal to the source call
+    number of the frame we sent. */
+  std::map<PINDEX, FrameVector>::iterator it = byCallNumber.find(reply->GetRemoteInfo().DestCallNumber());
+  if (it == byCallNumber.end())
+    return;
+
+  FrameVector & frames = it->second;
+  for (FrameVector::iterator frame = frames.begin(); frame != frames.end(); ++frame) {
+    IAX2FullFrame *sent = *frame;
+    if (IAX2FrameList::IsMatchingSendFrame(sent, reply)) {
+      RemoveFromWheel(sent);
+      RemoveFromCallIndex(sent);
+      delete sent;
+      return;
+    }
+  }
+}
+
+void IAX2AckingFrameList::SendVnakRequestedFrames(IAX2FullFrameProtocol &src)
+{
+  PINDEX srcOutSeqNo = src.GetSequenceInfo().OutSeqNo();
+  PWaitAndSignal m(mutex);
+  PTRACE(4, "Look for a frame that has been sent, waiting to be acked etc, that matches the supplied Vnak frame");
+
+  std::map<PINDEX, FrameVector>::iterator it = byCallNumber.find(src.GetRemoteInfo().DestCallNumber());
+  if (it == byCallNumber.end())
+    return;
+
+  FrameVector & frames = it->second;
+  for (FrameVector::iterator frame = frames.begin(); frame != frames.end(); ++frame) {
+    IAX2FullFrame *sent = *frame;
+
+    if (sent->DeleteFrameNow() || sent->SendFrameNow())
+      continue;
+
+    if (!(sent->GetRemoteInfo() *= src.GetRemoteInfo())) {
+      PTRACE(5, "mismatch in remote info");
+      continue;
+    }
+
+    if (sent->GetSequenceInfo().OutSeqNo() <= srcOutSeqNo) {
+      /*Move it from the wheel to the list of frames to go now */
+      RemoveFromWheel(sent);
+      sent->MarkVnakSendNow();
+      dueNow.push_back(sent);
+    }
+  }
+}
+
+void IAX2AckingFrameList::GetResendFramesDeleteOldFrames(IAX2FrameList &framesToSend)
+{
+  PWaitAndSignal m(mutex);
+
+  for (FrameVector::iterator it = dueNow.begin(); it != dueNow.end(); ++it) {
+    RemoveFromCallIndex(*it);
+    framesToSend.AddNewFrame(*it);
+  }
+  dueNow.clear();
+
+  /*Examine each slot from the last one examined, up to and including the
+    one for now, but never go around more than once, even if we have not
+    been called for a long time. The slot for now is examined again next
+    time, as it may hold frames due later in the slot. */
+  PInt64 now = PTimer::Tick().GetMilliSeconds();
+  PInt64 nowSlotTick = now/WheelSlotTime*WheelSlotTime;
+  if (nowSlotTick < wheelTick)
+    return;
+
+  PInt64 slotsDue = (nowSlotTick - wheelTick)/WheelSlotTime + 1;
+  if (slotsDue > WheelSlots)
+    slotsDue = WheelSlots;
+
+  for (PInt64 i = 0; i < slotsDue; ++i) {
+    FrameVector & slot = wheel[SlotOf(nowSlotTick - i*WheelSlotTime)];
+    FrameVector stillWaiting;
+
+    for (FrameVector::iterator it = slot.begin(); it != slot.end(); ++it) {
+      IAX2FullFrame *active = *it;
+
+      /*Later in this slot, or on a later revolution of the wheel */
+      if (active->GetRetransmitTick().GetMilliSeconds() > now) {
+	stillWaiting.push_back(active);
+	continue;
+      }
+
+      active->OnTransmissionTimeout();
+      RemoveFromCallIndex(active);
+
+      if (active->DeleteFrameNow()) {
+	PTRACE(5, "marked as delete now, so delete" << *active);
+	delete active;
+      }
+      else
+	framesToSend.AddNewFrame(active);
+    }
+
+    slot.swap(stillWaiting);
+  }
+
+  wheelTick = nowSlotTick;
+
+  PTRACE_IF(4, framesToSend.GetSize() > 0, "Have collected " << framesToSend.GetSize() << " frames to onsend");
+}
+
+PBoolean IAX2AckingFrameList::GetNextTimeout(PTimeInterval & tick)
+{
+  PWaitAndSignal m(mutex);
+  if (count == 0)
+    return false;
+
+  if (dueNow.empty())
+    tick = PTimeInterval(wheelTick + WheelSlotTime);
+  else
+    tick = 0;
+  return true;
+}
+
 
 #endif // OPAL_IAX2
 
@@ -48,8 +48,13 @@
 
 ////////////////////////////////////////////////////////////////////////////////
 
-IAX2EndPoint::IAX2EndPoint(OpalManager & mgr)
+IAX2EndPoint::IAX2EndPoint(OpalManager & mgr, WORD listenPort)
   : OpalEndPoint(mgr, "iax2", IsNetworkEndPoint | SupportsE164)
+  , m_listenPort(listenPort)
+  , m_processorPool(0, 0, "IAX2-Proc")
+  , m_trunkMode(TrunkAuto)
+  , m_trunkPeriod(20)
+  , m_trunkTimeStamps(true)
   , m_callsEstablished(0)
 {
   m_localUserName = mgr.GetDefaultUserName();
@@ -108,6 +113,9 @@ IAX2EndPoint::~IAX2EndPoint()
     PTRACE(6, "Iax2Ep\tDestructor - cleaned up the iax2 special packet handler");
   }
   specialPacketHandler = NULL;
+
+  m_processorPool.Shutdown();
+  PTRACE(6, "Iax2Ep\tDestructor - cleaned up the processor pool");
   
   if (transmitter != NULL)
     delete transmitter;
@@ -459,7 +467,7 @@ PBoolean IAX2EndPoint::Initialise()
   rand.SetSeed((DWORD)(PTime().GetTimeInSeconds() + 1));
   m_callnumbs = PRandom::Number() % 32000;
   
-  m_sock = new PUDPSocket(GetDefaultSignalPort());
+  m_sock = new PUDPSocket(m_listenPort);
   PTRACE(4, "IAX2EndPoint\tCreate Socket " << m_sock->GetPort());
   
   if (!m_sock->Listen(INADDR_ANY, 0, m_sock->GetPort())) {
@@ -717,6 +725,15 @@ void IAX2EndPoint::SetPassword(PString newValue)
   m_password = newValue; 
 }
 
+void IAX2EndPoint::SetTrunking(TrunkModes mode, PINDEX period, PBoolean withTimeStamps)
+{
+  m_trunkMode = mode;
+  m_trunkPeriod = period > 0 ? period : 20;
+  m_trunkTimeStamps = withTimeStamps;
+  PTRACE(4, "Iax2Ep\tTrunk mode " << mode << ", period " << m_trunkPeriod
+	 << " ms, " << (withTimeStamps ? "with" : "without") << " time stamps");
+}
+
 void IAX2EndPoint::SetLocalUserName(PString newValue)
 { 
   m_localUserName = newValue; 
@@ -109,13 +109,36 @@ PString IAX2WaitingForAck::GetResponseAsString() const
 
 ////////////////////////////////////////////////////////////////////////////////
 
+/*The processor is not a PSafeObject, so override Work() directly. The
+  processor cannot be deleted while this is queued, as the destructor
+  waits for the processor to terminate.*/
+class IAX2ProcessorWork : public PSafeWork
+{
+ public:
+  IAX2ProcessorWork(IAX2Processor & processor)
+    : PSafeWork(NULL)
+    , m_processor(processor)
+  { }
+
+  virtual void Work() { m_processor.Main(); }
+  virtual void CallFunction(PSafeObject &) { }
+
+ protected:
+  IAX2Processor & m_processor;
+};
+
+////////////////////////////////////////////////////////////////////////////////
+
 IAX2Processor::IAX2Processor(IAX2EndPoint &ep)
-  : PThread(1000, NoAutoDeleteThread, NormalPriority, "IAX2 Processor")
-  , endpoint(ep)
+  : endpoint(ep)
+  , endProcessing(false)
+  , started(false)
+  , scheduled(false)
+  , activatePending(false)
+  , terminated(false)
   , controlFramesSent(0)
   , controlFramesRcvd(0)
 {
-  endThread = false;
   
   remote.SetDestCallNumber(0);
   remote.SetRemoteAddress(0);
@@ -143,9 +166,7 @@ IAX2Processor::~IAX2Processor()
 
 void IAX2Processor::SetCallToken(const PString & newToken) 
 {
-  if (!IsHandlingSpecialPackets())
-    SetThreadName("Proc" + newToken);
-
+  PTRACE(4, "Processor\tCall token set to " << newToken);
   callToken = newToken;
 } 
 
@@ -156,18 +177,43 @@ PString IAX2Processor::GetCallToken()
 
 void IAX2Processor::Main()
 {
-  PTRACE(3, "Processor\tStart of iax2 processing thread");
-  PString name = GetThreadName();
-  if (IsHandlingSpecialPackets())
-    SetThreadName("Special Iax packets");
-
-  while(endThread == false) {
-    activate.Wait();
+  for (PINDEX pass = 0; ; ++pass) {
+    scheduleMutex.Wait();
+    
+    if (!activatePending) {
+      scheduled = false;
+      if (endProcessing) {
+	/*All done with the mutex held, WaitForTermination() takes it after
+	  seeing the flag, so the processor may be deleted as soon as it is
+	  released. Nothing of this object can be touched after that. */
+	PTRACE(3, "Processor\tEnd of iax processing " << callToken);
+	terminated = true;
+	terminatedSync.Signal();
+      }
+      scheduleMutex.Signal();
+      return;
+    }
+    
+    if (pass >= MaxPassesPerRun) {
+      /*Still busy, go to the back of the queue so other processors get a
+	turn on this worker */
+      scheduleMutex.Signal();
+      Schedule();
+      return;
+    }
+    
+    activatePending = false;
+    scheduleMutex.Signal();
+    
     ProcessLists();
   }
-  ProcessLists();
-    
-  PTRACE(3, "End of iax connection processing");
+}
+
+void IAX2Processor::Schedule()
+{
+  /*If the pool has been shut down, the work is deleted, so do it now */
+  if (!endpoint.GetProcessorPool().AddWork(new IAX2ProcessorWork(*this), PString(remote.SourceCallNumber())))
+    Main();
 }
 
 PBoolean IAX2Processor::IsStatusQueryEthernetFrame(IAX2Frame *frame)
@@ -195,7 +241,7 @@ PBoolean IAX2Processor::IsStatusQueryEthernetFrame(IAX2Frame *frame)
 
 void IAX2Processor::IncomingEthernetFrame(IAX2Frame *frame)
 {
-  if (endThread) {
+  if (endProcessing) {
     PTRACE(3, "IAX2Con\t***** incoming frame during termination " << frame->IdString());
     // snuck in here during termination. may be an ack for hangup or other re-transmitted frames
     IAX2Frame *af = frame->BuildAppropriateFrameType(GetEncryptionInfo());
@@ -226,19 +272,59 @@ void IAX2Processor::OnNoResponseTimeoutStart(PTimer &, P_INT_PTR)
 
 void IAX2Processor::Activate()
 {
-  activate.Signal();
+  {
+    PWaitAndSignal m(scheduleMutex);
+    activatePending = true;
+    if (!started || scheduled || terminated)
+      return;
+    scheduled = true;
+  }
+  
+  Schedule();
+}
+
+void IAX2Processor::Start()
+{
+  {
+    PWaitAndSignal m(scheduleMutex);
+    if (started)
+      return;
+    started = true;
+    if (!activatePending || scheduled)
+      return;
+    scheduled = true;
+  }
+  
+  Schedule();
 }
 
 void IAX2Processor::Terminate()
 {
-  endThread = true;
-  if (IsSuspended())
-    Resume();
+  endProcessing = true;
 
   PTRACE(4, "Processor\tProcessor has been directed to end. " 
 	 << (IsTerminated() ? "Has already ended" : "So end now."));
   
+  /*Make sure there is one final run, even if never started */
   Activate();
+  Start();
+}
+
+PBoolean IAX2Processor::WaitForTermination(const PTimeInterval & maxWait)
+{
+  PTimeInterval startTick = PTimer::Tick();
+  while (!terminated) {
+    if (maxWait != PMaxTimeInterval && (PTimer::Tick() - startTick) > maxWait) {
+      PTRACE(2, "Processor\tTimed out waiting for processor to end " << callToken);
+      return false;
+    }
+    terminatedSync.Wait(100);
+  }
+  
+  /*Main() sets the flag with the mutex held, wait for it to let go before
+    the caller is allowed to delete us */
+  PWaitAndSignal m(scheduleMutex);
+  return true;
 }
 
 PBoolean IAX2Processor::ProcessOneIncomingEthernetFrame()
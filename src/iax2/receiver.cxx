@@ -37,6 +37,7 @@
 
 #include <iax2/receiver.h>
 #include <iax2/iax2ep.h>
+#include <iax2/transmit.h>
 
 #define new PNEW
 
@@ -103,6 +104,18 @@ void IAX2Receiver::Main()
 void IAX2Receiver::AddNewReceivedFrame(IAX2Frame *newFrame)
 {
   /**This method may split a frame up (if it is trunked) */
+  if (newFrame->IsMetaTrunkFrame()) {
+    IAX2FrameList miniFrames;
+    miniFrames.Initialise();
+    if (newFrame->SplitMetaTrunkFrame(miniFrames))
+      endpoint.transmitter->OnMetaTrunkReceived(newFrame->GetRemoteInfo());
+    PTRACE(6, "IAX2 Rx\tAdd " << miniFrames.GetSize() << " trunked frames to list of received frames from " 
+	   << newFrame->IdString());
+    delete newFrame;
+    fromNetworkFrames.GrabContents(miniFrames);
+    return;
+  }
+
   PTRACE(6, "IAX2 Rx\tAdd frame to list of received frames " << newFrame->IdString());
   fromNetworkFrames.AddNewFrame(newFrame);
 }
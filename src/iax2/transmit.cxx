@@ -39,15 +39,100 @@
 
 #define new PNEW
 
+IAX2TrunkBuffer::IAX2TrunkBuffer(IAX2Remote & _remote, PBoolean _withTimeStamps)
+  : idleTicks(0),
+    withTimeStamps(_withTimeStamps),
+    data(MaxTrunkFrameSize),
+    dataSize(IAX2Frame::metaTrunkHeaderSize),
+    entries(0)
+{
+  remote.Assign(_remote);
+}
+
+PBoolean IAX2TrunkBuffer::AddMiniFrame(IAX2MiniFrame & frame)
+{
+  PINDEX mediaSize = frame.GetMediaDataSize();
+  PINDEX entrySize = mediaSize + (withTimeStamps ? 6 : 4);
+  if (dataSize + entrySize > data.GetSize()) {
+    if (entries > 0)
+      return false;
+    data.SetSize(dataSize + entrySize);  /*Oversize frame, send it on its own */
+  }
+
+  BYTE * ptr = data.GetPointer() + dataSize;
+  PINDEX callNumber = frame.GetRemoteInfo().SourceCallNumber() & 0x7fff;
+  if (withTimeStamps) {
+    /*Asterisk ast_iax2_meta_trunk_mini: length, then a mini frame header */
+    ptr[0] = (BYTE)(mediaSize >> 8);
+    ptr[1] = (BYTE)mediaSize;
+    ptr[2] = (BYTE)(callNumber >> 8);
+    ptr[3] = (BYTE)callNumber;
+    ptr[4] = (BYTE)(frame.GetTimeStamp() >> 8);
+    ptr[5] = (BYTE)frame.GetTimeStamp();
+    ptr += 6;
+  } else {
+    /*Asterisk ast_iax2_meta_trunk_entry: call number, then length */
+    ptr[0] = (BYTE)(callNumber >> 8);
+    ptr[1] = (BYTE)callNumber;
+    ptr[2] = (BYTE)(mediaSize >> 8);
+    ptr[3] = (BYTE)mediaSize;
+    ptr += 4;
+  }
+  memcpy(ptr, frame.GetMediaDataPointer(), mediaSize);
+
+  dataSize += entrySize;
+  entries++;
+  idleTicks = 0;
+  return true;
+}
+
+PINDEX IAX2TrunkBuffer::Transmit(PUDPSocket & sock, DWORD timeStamp)
+{
+  if (entries == 0)
+    return 0;
+
+  BYTE * ptr = data.GetPointer();
+  ptr[0] = 0;
+  ptr[1] = 0;
+  ptr[2] = IAX2Frame::metaTrunkCommand;
+  ptr[3] = (BYTE)(withTimeStamps ? IAX2Frame::metaTrunkTimeStamps : 0);
+  ptr[4] = (BYTE)(timeStamp >> 24);
+  ptr[5] = (BYTE)(timeStamp >> 16);
+  ptr[6] = (BYTE)(timeStamp >> 8);
+  ptr[7] = (BYTE)timeStamp;
+
+  PINDEX sent = dataSize;
+  PTRACE(6, "IAX2Transmit\tSend trunk frame of " << entries << " entries, " 
+	 << dataSize << " bytes to " << remote);
+  if (!sock.WriteTo(ptr, dataSize, remote.RemoteAddress(), (unsigned short)remote.RemotePort())) {
+    PTRACE(3, "IAX2Transmit\tFailed to send trunk frame to " << remote
+	   << " - " << sock.GetErrorText());
+    sent = 0;
+  }
+
+  dataSize = IAX2Frame::metaTrunkHeaderSize;
+  entries = 0;
+  return sent;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
 IAX2Transmit::IAX2Transmit(IAX2EndPoint & _newEndpoint, PUDPSocket & _newSocket)
   : PThread(1000, NoAutoDeleteThread, NormalPriority, "IAX2 Transmitter"),
      ep(_newEndpoint),
      sock(_newSocket)
 {
   sendNowFrames.Initialise();
-  ackingFrames.Initialise();
   
   keepGoing = true;
+
+  trunkPending = 0;
+  trunkStartTick = PTimer::Tick();
+  nextTrunkTick = trunkStartTick;
+  packetsSent = 0;
+  bytesSent = 0;
+  trunkFramesSent = 0;
+  trunkedMiniFrames = 0;
   
   PTRACE(6,"IAX2Transmit\tConstructor - IAX2 Transmitter");
   Resume();
@@ -58,9 +143,9 @@ IAX2Transmit::~IAX2Transmit()
   Terminate();
   WaitForTermination();
   sendNowFrames.AllowDeleteObjects();
-  
-  IAX2FrameList notUsed; /* These frames will be destroyed at method end. */
-  ackingFrames.GrabContents(notUsed);
+
+  trunkBuffers.AllowDeleteObjects();
+  trunkBuffers.RemoveAll();
   PTRACE(5, "IAX2Transmit\tDestructor finished");
 }
 
@@ -72,6 +157,9 @@ void IAX2Transmit::Terminate()
 
 void IAX2Transmit::SendFrame(IAX2Frame *newFrame)
 {
+  if (TrunkFrame(newFrame))
+    return;
+
   sendNowFrames.AddNewFrame(newFrame);
   
   activate.Signal();
@@ -91,6 +179,7 @@ void IAX2Transmit::SendVnakRequestedFrames(IAX2FullFrameProtocol &src)
 {
   PTRACE(4, "IAX2Transmit\tSendVnakRequestedFrames to " << src);
   ackingFrames.SendVnakRequestedFrames(src);
+  activate.Signal();
 }
 
 void IAX2Transmit::Main()
@@ -100,7 +189,28 @@ void IAX2Transmit::Main()
     if (!keepGoing)
       break;
 
-    activate.Wait();
+    /*Wait for something to send, or the next trunk tick, or for the
+      retransmit timer wheel to move on to the next slot */
+    PTimeInterval wakeTick;
+    trunkMutex.Wait();
+    PBoolean timed = trunkPending > 0;
+    if (timed)
+      wakeTick = nextTrunkTick;
+    trunkMutex.Signal();
+
+    PTimeInterval ackingTick;
+    if (ackingFrames.GetNextTimeout(ackingTick) && (!timed || ackingTick < wakeTick)) {
+      wakeTick = ackingTick;
+      timed = true;
+    }
+
+    if (!timed)
+      activate.Wait();
+    else {
+      PTimeInterval untilWakeTick = wakeTick - PTimer::Tick();
+      if (untilWakeTick > 0)
+	activate.Wait(untilWakeTick);
+    }
     
     if (!keepGoing)
       break;
@@ -108,6 +218,8 @@ void IAX2Transmit::Main()
     ProcessAckingList();
     
     ProcessSendList();
+
+    ProcessTrunks();
   }
   PTRACE(6, "IAX2Transmit\tEnd of the Transmit thread.");  
 }
@@ -168,6 +280,11 @@ void IAX2Transmit::ProcessSendList()
       delete active;
       continue;
     }
+
+    trunkMutex.Wait();
+    packetsSent++;
+    bytesSent += active->DataSize();
+    trunkMutex.Signal();
     
     if (!isFullFrame) {
       PTRACE(5, "IAX2Transmit\tDelete this frame as it is a mini frame, and continue" << active->IdString());
@@ -188,10 +305,136 @@ void IAX2Transmit::ProcessSendList()
     
     PTRACE(5, "IAX2Transmit\tAdd frame " << *active 
 	   << " to list of frames waiting on acks");
-    ackingFrames.AddNewFrame(active);
+    ackingFrames.AddNewFrame(f);
+  }
+}
+
+PString IAX2Transmit::TrunkKey(IAX2Remote & remote)
+{
+  return remote.RemoteAddress().AsString() + ":" + PString(remote.RemotePort());
+}
+
+PBoolean IAX2Transmit::TrunkFrame(IAX2Frame *frame)
+{
+  IAX2EndPoint::TrunkModes mode = ep.GetTrunkMode();
+  if (mode == IAX2EndPoint::TrunkDisabled)
+    return false;
+
+  if (frame->IsFullFrame() || !frame->IsAudio() || !PIsDescendant(frame, IAX2MiniFrame))
+    return false;
+
+  IAX2MiniFrame *mini = (IAX2MiniFrame *)frame;
+  if (!mini->CanTrunk())
+    return false;
+
+  PString key = TrunkKey(frame->GetRemoteInfo());
+
+  {
+    PWaitAndSignal m(trunkMutex);
+    if (mode == IAX2EndPoint::TrunkAuto && !trunkPeers.Contains(key))
+      return false;
+  }
+
+  if (!ep.ConnectionForFrameIsAlive(frame)) {
+    PTRACE(3, "IAX2Transmit\tConnection not found, call has been terminated. " 
+	   << frame->IdString());
+    delete frame;
+    return true;
+  }
+
+  PWaitAndSignal m(trunkMutex);
+
+  IAX2TrunkBuffer *buffer = trunkBuffers.GetAt(key);
+  if (buffer == NULL) {
+    PTRACE(4, "IAX2Transmit\tStart trunking to " << key);
+    buffer = new IAX2TrunkBuffer(frame->GetRemoteInfo(), ep.GetTrunkTimeStamps());
+    trunkBuffers.SetAt(key, buffer);
+  }
+
+  if (!buffer->AddMiniFrame(*mini)) {
+    /*No room left, so send what we have now, and start again */
+    trunkPending -= buffer->GetEntries();
+    TransmitTrunk(*buffer);
+    buffer->AddMiniFrame(*mini);
+  }
+  delete frame;
+
+  if (trunkPending++ == 0) {
+    /*First frame since the last tick, wake up the transmit thread so it
+      waits for the right time. The tick is kept in phase, if possible */
+    PTimeInterval now = PTimer::Tick();
+    if (nextTrunkTick <= now) {
+      PInt64 period = ep.GetTrunkPeriod();
+      PInt64 behind = (now - nextTrunkTick).GetMilliSeconds();
+      nextTrunkTick += PTimeInterval((behind/period + 1)*period);
+    }
+    activate.Signal();
+  }
+
+  return true;
+}
+
+void IAX2Transmit::TransmitTrunk(IAX2TrunkBuffer & buffer)
+{
+  PINDEX entries = buffer.GetEntries();
+  PINDEX sent = buffer.Transmit(sock, (DWORD)(PTimer::Tick() - trunkStartTick).GetMilliSeconds());
+  if (sent > 0) {
+    packetsSent++;
+    bytesSent += sent;
+    trunkFramesSent++;
+    trunkedMiniFrames += entries;
   }
 }
 
+void IAX2Transmit::ProcessTrunks()
+{
+  PWaitAndSignal m(trunkMutex);
+
+  if (trunkPending == 0 || PTimer::Tick() < nextTrunkTick)
+    return;
+
+  PStringList idle;
+  for (PDictionary<PString, IAX2TrunkBuffer>::iterator it = trunkBuffers.begin(); it != trunkBuffers.end(); ++it) {
+    if (!it->second.IsEmpty())
+      TransmitTrunk(it->second);
+    else if (++it->second.idleTicks > 50)
+      idle.AppendString(it->first);
+  }
+  trunkPending = 0;
+  nextTrunkTick += PTimeInterval(ep.GetTrunkPeriod());
+
+  /*Discard buffers for hosts we have not sent anything to for a while */
+  for (PStringList::iterator it = idle.begin(); it != idle.end(); ++it) {
+    PTRACE(4, "IAX2Transmit\tStop trunking to " << *it);
+    trunkBuffers.RemoveAt(*it);
+  }
+}
+
+void IAX2Transmit::OnMetaTrunkReceived(IAX2Remote & remote)
+{
+  PString key = TrunkKey(remote);
+
+  PWaitAndSignal m(trunkMutex);
+  if (trunkPeers.Contains(key))
+    return;
+
+  PTRACE(3, "IAX2Transmit\tRemote " << key << " sends trunk frames"
+	 << (ep.GetTrunkMode() == IAX2EndPoint::TrunkAuto ? ", trunking to it" : ""));
+  trunkPeers += key;
+}
+
+void IAX2Transmit::GetTrafficCounts(PUInt64 & packets,
+				    PUInt64 & bytes,
+				    PUInt64 & trunkFrames,
+				    PUInt64 & trunkedFrames)
+{
+  PWaitAndSignal m(trunkMutex);
+  packets = packetsSent;
+  bytes = bytesSent;
+  trunkFrames = trunkFramesSent;
+  trunkedFrames = trunkedMiniFrames;
+}
+
 
 #endif // OPAL_IAX2
 
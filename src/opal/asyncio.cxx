@@ -0,0 +1,415 @@
+/*
+ * asyncio.cxx
+ *
+ * Asynchronous, write behind, file output
+ *
+ * Open Phone Abstraction Library (OPAL)
+ *
+ * Copyright (c) 2021 Vox Lucida Pty. Ltd.
+ *
+ * The contents of this file are subject to the Mozilla Public License
+ * Version 1.0 (the "License"); you may not use this file except in
+ * compliance with the License. You may obtain a copy of the License at
+ * http://www.mozilla.org/MPL/
+ *
+ * Software distributed under the License is distributed on an "AS IS"
+ * basis, WITHOUT WARRANTY OF ANY KIND, either express or implied. See
+ * the License for the specific language governing rights and limitations
+ * under the License.
+ *
+ * The Original Code is Open Phone Abstraction Library.
+ *
+ * The Initial Developer of the Original Code is Vox Lucida Pty. Ltd.
+ *
+ * Contributor(s): ______________________________________.
+ */
+
+#include <ptlib.h>
+
+#ifdef __GNUC__
+#pragma implementation "asyncio.h"
+#endif
+
+#include <opal_config.h>
+
+#include <opal/asyncio.h>
+
+#include <algorithm>
+
+
+#define PTraceModule() "AsyncIO"
+
+
+///////////////////////////////////////////////////////////////////////////////
+
+OpalAsyncIOService::OpalAsyncIOService(unsigned threads, PINDEX maxBuffered)
+  : m_available(0, INT_MAX)
+  , m_running(true)
+  , m_maxBuffered(maxBuffered)
+  , m_buffered(0)
+{
+  if (threads == 0)
+    threads = 2;
+
+  for (unsigned i = 0; i < threads; ++i)
+    m_threads.push_back(new PThreadObj<OpalAsyncIOService>(*this, &OpalAsyncIOService::ThreadMain, false,
+                                                           "AsyncIO", PThread::HighPriority));
+
+  PTRACE(4, "Started " << threads << " threads, max buffered " << maxBuffered << " bytes");
+}
+
+
+OpalAsyncIOService::~OpalAsyncIOService()
+{
+  m_running = false;
+  for (size_t i = 0; i < m_threads.size(); ++i)
+    m_available.Signal();
+  for (size_t i = 0; i < m_threads.size(); ++i)
+    PThread::WaitAndDelete(m_threads[i]);
+
+  PAssert(m_ready.empty(), "Async I/O service destroyed with writers pending");
+}
+
+
+OpalAsyncIOService & OpalAsyncIOService::GetInstance()
+{
+  // Deliberately never deleted, as writers may be closed during static destruction
+  static OpalAsyncIOService * instance = new OpalAsyncIOService();
+  return *instance;
+}
+
+
+void OpalAsyncIOService::Schedule(OpalAsyncWriter & writer)
+{
+  m_mutex.Wait();
+  m_ready.push_back(&writer);
+  m_mutex.Signal();
+
+  m_available.Signal();
+}
+
+
+void OpalAsyncIOService::Unschedule(OpalAsyncWriter & writer)
+{
+  PWaitAndSignal mutex(m_mutex);
+  m_ready.erase(std::remove(m_ready.begin(), m_ready.end(), &writer), m_ready.end());
+}
+
+
+bool OpalAsyncIOService::Reserve(PINDEX bytes)
+{
+  if ((m_buffered += bytes) <= m_maxBuffered)
+    return true;
+
+  m_buffered -= bytes;
+  return false;
+}
+
+
+void OpalAsyncIOService::Release(PINDEX bytes)
+{
+  m_buffered -= bytes;
+}
+
+
+void OpalAsyncIOService::ThreadMain()
+{
+  PTRACE(4, "Thread started");
+
+  while (m_running) {
+    m_available.Wait();
+
+    m_mutex.Wait();
+    if (m_ready.empty()) {
+      m_mutex.Signal();
+      continue;
+    }
+    OpalAsyncWriter * writer = m_ready.front();
+    m_ready.pop_front();
+    m_mutex.Signal();
+
+    writer->ExecutePending();
+  }
+
+  PTRACE(4, "Thread ended");
+}
+
+
+///////////////////////////////////////////////////////////////////////////////
+
+OpalAsyncWriter::Statistics::Statistics()
+  : m_bytesWritten(0)
+  , m_writes(0)
+  , m_batches(0)
+  , m_flushes(0)
+  , m_failures(0)
+  , m_rejected(0)
+  , m_rejectedBytes(0)
+  , m_buffered(0)
+  , m_maxBuffered(0)
+{
+}
+
+
+void OpalAsyncWriter::Statistics::PrintOn(ostream & strm) const
+{
+  strm << "bytes=" << m_bytesWritten
+       << " writes=" << m_writes
+       << " batches=" << m_batches
+       << " flushes=" << m_flushes
+       << " failures=" << m_failures
+       << " rejected=" << m_rejected << '/' << m_rejectedBytes
+       << " buffered=" << m_buffered << '/' << m_maxBuffered
+       << " write-time=" << m_writeTime
+       << " max-write-time=" << m_maxWriteTime;
+}
+
+
+OpalAsyncWriter::OpalAsyncWriter(const PString & name,
+                                 bool coalesce,
+                                 PINDEX batchSize,
+                                 PINDEX maxBuffered,
+                                 OpalAsyncIOService & service)
+  : m_service(service)
+  , m_name(name)
+  , m_coalesce(coalesce)
+  , m_batchSize(std::max(batchSize, (PINDEX)512))
+  , m_maxBuffered(std::max(maxBuffered, m_batchSize*2))
+  , m_current(NULL)
+  , m_scheduled(false)
+  , m_closed(false)
+  , m_backPressured(false)
+{
+}
+
+
+OpalAsyncWriter::~OpalAsyncWriter()
+{
+  PAssert(m_closed || (m_current == NULL && m_pending.empty()), "Async writer not closed by derived class");
+
+  m_service.Unschedule(*this);
+
+  delete m_current;
+  for (std::deque<Batch *>::iterator it = m_pending.begin(); it != m_pending.end(); ++it) {
+    m_service.Release((*it)->m_used);
+    delete *it;
+  }
+}
+
+
+bool OpalAsyncWriter::Write(const void * data, PINDEX length, unsigned tag)
+{
+  if (length <= 0)
+    return true;
+
+  m_mutex.Wait();
+
+  if (m_closed) {
+    m_mutex.Signal();
+    return false;
+  }
+
+  if (m_statistics.m_buffered + length > m_maxBuffered || !m_service.Reserve(length)) {
+    ++m_statistics.m_rejected;
+    m_statistics.m_rejectedBytes += length;
+    m_mutex.Signal();
+
+    PTRACE(m_throttleRejected, "Back pressure on " << m_name << ", rejected " << length << " bytes" << m_throttleRejected);
+    InternalSetBackPressure(true);
+    return false;
+  }
+
+  m_statistics.m_buffered += length;
+  if (m_statistics.m_maxBuffered < m_statistics.m_buffered)
+    m_statistics.m_maxBuffered = m_statistics.m_buffered;
+
+  if (m_current != NULL && m_current->m_used + length > m_current->m_data.GetSize())
+    InternalSubmit();
+
+  if (m_current == NULL) {
+    m_current = new Batch;
+    m_current->m_data.SetSize(std::max(m_batchSize, length));
+    m_current->m_used = 0;
+  }
+
+  memcpy(m_current->m_data.GetPointer() + m_current->m_used, data, length);
+  if (m_coalesce && !m_current->m_segments.empty() && m_current->m_segments.back().m_tag == tag)
+    m_current->m_segments.back().m_length += length;
+  else
+    m_current->m_segments.push_back(Segment(m_current->m_used, length, tag));
+  m_current->m_used += length;
+
+  if (m_current->m_used >= m_batchSize)
+    InternalSubmit();
+
+  bool relieved = m_statistics.m_buffered < m_maxBuffered/2;
+
+  m_mutex.Signal();
+
+  if (relieved)
+    InternalSetBackPressure(false);
+  return true;
+}
+
+
+bool OpalAsyncWriter::Flush(bool wait)
+{
+  m_mutex.Wait();
+  ++m_statistics.m_flushes;
+  InternalSubmit();
+  m_mutex.Signal();
+
+  while (wait) {
+    m_mutex.Wait();
+    bool busy = m_scheduled;
+    m_mutex.Signal();
+    if (!busy)
+      break;
+    m_drained.Wait();
+  }
+
+  PWaitAndSignal mutex(m_mutex);
+  return m_statistics.m_failures == 0;
+}
+
+
+void OpalAsyncWriter::Close()
+{
+  m_mutex.Wait();
+  bool wasClosed = m_closed;
+  m_mutex.Signal();
+  if (wasClosed)
+    return;
+
+  Flush(true);
+
+  m_mutex.Wait();
+  m_closed = true;
+  m_mutex.Signal();
+
+  PTRACE(3, "Closed " << m_name << ": " << m_statistics);
+}
+
+
+void OpalAsyncWriter::GetStatistics(Statistics & statistics) const
+{
+  PWaitAndSignal mutex(m_mutex);
+  statistics = m_statistics;
+}
+
+
+bool OpalAsyncWriter::InternalSubmit()
+{
+  if (m_current == NULL || m_current->m_used == 0)
+    return false;
+
+  m_pending.push_back(m_current);
+  m_current = NULL;
+  ++m_statistics.m_batches;
+
+  if (!m_scheduled) {
+    m_scheduled = true;
+    m_service.Schedule(*this);
+  }
+  return true;
+}
+
+
+void OpalAsyncWriter::InternalSetBackPressure(bool pressure)
+{
+  if (m_backPressured.exchange(pressure) == pressure)
+    return;
+
+  PTRACE(3, "Back pressure " << (pressure ? "started" : "ended") << " on " << m_name);
+  if (!m_backPressureNotifier.IsNULL())
+    m_backPressureNotifier(*this, pressure);
+}
+
+
+void OpalAsyncWriter::ExecutePending()
+{
+  m_mutex.Wait();
+  if (m_pending.empty()) {
+    m_scheduled = false;
+    m_drained.Signal();
+    m_mutex.Signal();
+    return;
+  }
+  Batch * batch = m_pending.front();
+  m_pending.pop_front();
+  m_mutex.Signal();
+
+  // Actual I/O, without any locks held
+  unsigned failures = 0;
+  PTime start;
+  for (std::vector<Segment>::iterator it = batch->m_segments.begin(); it != batch->m_segments.end(); ++it) {
+    if (!OnWrite(batch->m_data.GetPointer() + it->m_offset, it->m_length, it->m_tag))
+      ++failures;
+  }
+  PTimeInterval duration = PTime() - start;
+
+  m_mutex.Wait();
+  m_statistics.m_bytesWritten += batch->m_used;
+  m_statistics.m_writes += batch->m_segments.size();
+  m_statistics.m_failures += failures;
+  m_statistics.m_buffered -= batch->m_used;
+  m_statistics.m_writeTime += duration;
+  if (m_statistics.m_maxWriteTime < duration)
+    m_statistics.m_maxWriteTime = duration;
+  bool relieved = m_statistics.m_buffered < m_maxBuffered/2;
+  m_mutex.Signal();
+
+  m_service.Release(batch->m_used);
+  delete batch;
+
+  PTRACE_IF(2, failures > 0, "Write failed " << failures << " times on " << m_name);
+  PTRACE_IF(3, duration > 500, "Slow write of " << duration << " on " << m_name);
+
+  if (relieved)
+    InternalSetBackPressure(false);
+
+  /* Once m_scheduled is clear, Flush() may return and the writer be deleted,
+     so this must be the last thing done, and with the mutex held so Flush()
+     cannot see the flag until we have finished with the object. */
+  m_mutex.Wait();
+  if (m_pending.empty()) {
+    m_scheduled = false;
+    m_drained.Signal();
+  }
+  else {
+    // Go to back of queue so other writers get a turn
+    m_service.Schedule(*this);
+  }
+  m_mutex.Signal();
+}
+
+
+///////////////////////////////////////////////////////////////////////////////
+
+OpalAsyncChannelWriter::OpalAsyncChannelWriter(PChannel & channel,
+                                               PINDEX batchSize,
+                                               PINDEX maxBuffered,
+                                               OpalAsyncIOService & service)
+  : OpalAsyncWriter(channel.GetName(), true, batchSize, maxBuffered, service)
+  , m_channel(channel)
+{
+}
+
+
+OpalAsyncChannelWriter::~OpalAsyncChannelWriter()
+{
+  Close();
+}
+
+
+bool OpalAsyncChannelWriter::OnWrite(const BYTE * data, PINDEX length, unsigned)
+{
+  if (m_channel.Write(data, length))
+    return true;
+
+  PTRACE(2, "Could not write " << length << " bytes to " << m_name << ": " << m_channel.GetErrorText(PChannel::LastWriteError));
+  return false;
+}
+
+
+// End of File ///////////////////////////////////////////////////////////////
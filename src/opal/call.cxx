@@ -113,6 +113,7 @@ void OpalCallStatistics::ToJSON(PJSON::Object & obj) const
 OpalCall::OpalCall(OpalManager & mgr)
   : m_manager(mgr)
   , m_token(mgr.GetNextToken('C'))
+  , m_placementGroup(mgr.GetPlacementPolicy().AssignGroup(m_token))
   , m_isEstablished(false)
   , m_isClearing(false)
   , m_handlingHold(false)
@@ -150,6 +151,8 @@ OpalCall::~OpalCall()
   delete m_recordManager;
 #endif
 
+  m_manager.GetPlacementPolicy().ReleaseGroup(m_token);
+
 #if OPAL_SCRIPT
   PScriptLanguage * script = m_manager.GetScript();
   if (script != NULL) {
@@ -1020,6 +1023,13 @@ bool OpalCall::IsRecording() const
 }
 
 
+bool OpalCall::IsRecordingPassThrough() const
+{
+  PSafeLockReadOnly lock(*this);
+  return lock.IsLocked() && m_recordManager != NULL && m_recordManager->IsPassThrough();
+}
+
+
 bool OpalCall::StopRecording()
 {
   PSafeLockReadWrite lock(*this);
@@ -1072,6 +1082,14 @@ void OpalCall::OnRecordVideo(const PString & streamId, const RTP_DataFrame & fra
 
 #endif
 
+
+void OpalCall::OnRecordEncoded(const PString & streamId, const RTP_DataFrame & frame)
+{
+  PSafeLockReadOnly lock(*this);
+  if (lock.IsLocked() && m_recordManager != NULL && !m_recordManager->WriteStream(streamId, frame))
+    m_recordManager->CloseStream(streamId);
+}
+
 #endif
 
 
@@ -202,6 +202,7 @@ OpalConnection::OpalConnection(OpalCall & call,
 #if OPAL_VIDEO
   , m_recordVideoNotifier(PCREATE_NOTIFIER(OnRecordVideo))
 #endif
+  , m_recordEncodedNotifier(PCREATE_NOTIFIER(OnRecordEncoded))
 #endif
 {
   PTRACE_CONTEXT_ID_FROM(call);
@@ -1071,11 +1072,31 @@ static PString MakeRecordingKey(const OpalMediaPatch & patch)
 }
 
 
+// Encoded media is recorded at whichever end of the patch is on the wire
+static OpalMediaFormat GetEncodedRecordingFormat(const OpalMediaPatch & patch)
+{
+  OpalMediaFormat format = patch.GetSource().GetMediaFormat();
+  return format.IsTransportable() ? format : patch.GetSinkFormat();
+}
+
+
 void OpalConnection::OnStartRecording(OpalMediaPatch * patch)
 {
   if (patch == NULL)
     return;
 
+  if (m_ownerCall.IsRecordingPassThrough()) {
+    OpalMediaFormat format = GetEncodedRecordingFormat(*patch);
+    if (!format.IsTransportable() || !m_ownerCall.OnStartRecording(MakeRecordingKey(*patch), format)) {
+      PTRACE(4, "No encoded record filter added on connection " << *this << ", patch " << *patch);
+      return;
+    }
+
+    patch->AddFilter(m_recordEncodedNotifier, format);
+    PTRACE(4, "Added encoded record filter for " << format << " on connection " << *this << ", patch " << *patch);
+    return;
+  }
+
   if (!m_ownerCall.OnStartRecording(MakeRecordingKey(*patch), patch->GetSource().GetMediaFormat())) {
     PTRACE(4, "No record filter added on connection " << *this << ", patch " << *patch);
     return;
@@ -1101,6 +1122,7 @@ void OpalConnection::OnStopRecording(OpalMediaPatch * patch)
 #if OPAL_VIDEO
   patch->RemoveFilter(m_recordVideoNotifier, OPAL_YUV420P);
 #endif
+  patch->RemoveFilter(m_recordEncodedNotifier, GetEncodedRecordingFormat(*patch));
 
   PTRACE(4, "Removed record filter on " << *patch);
 }
@@ -1226,6 +1248,24 @@ void OpalConnection::InternalOnRecordVideo(PString key, std::auto_ptr<RTP_DataFr
 
 #endif // OPAL_VIDEO
 
+
+void OpalConnection::OnRecordEncoded(RTP_DataFrame & frame, P_INT_PTR param)
+{
+  if (frame.GetPayloadSize() == 0)
+    return;
+
+  const OpalMediaPatch * patch = (const OpalMediaPatch *)param;
+  std::auto_ptr<RTP_DataFrame> copyFrame(new RTP_DataFrame(frame.GetPointer(), frame.GetPacketSize()));
+  GetEndPoint().GetManager().QueueDecoupledEvent(new PSafeWorkArg2<OpalConnection, PString, std::auto_ptr<RTP_DataFrame> >(
+                   this, MakeRecordingKey(*patch), copyFrame, &OpalConnection::InternalOnRecordEncoded), psprintf("%p", this));
+}
+
+
+void OpalConnection::InternalOnRecordEncoded(PString key, std::auto_ptr<RTP_DataFrame> frame)
+{
+  m_ownerCall.OnRecordEncoded(key, *frame);
+}
+
 #endif // OPAL_HAS_MIXER
 
 
@@ -1551,7 +1591,7 @@ void OpalConnection::OnDetectInBandDTMF(RTP_DataFrame & frame, P_INT_PTR)
     PTRACE(3, "DTMF detected: \"" << tones << '"');
     for (PINDEX i = 0; i < tones.GetLength(); i++)
       GetEndPoint().GetManager().QueueDecoupledEvent(new PSafeWorkArg2<OpalConnection, char, unsigned>(
-                            this, tones[i], PDTMFDecoder::DetectTime, &OpalConnection::OnUserInputTone));
+                            this, tones[i], PDTMFDecoder::DetectTime, &OpalConnection::OnUserInputTone), GetCall().GetToken());
   }
 }
 
@@ -1930,7 +1970,7 @@ bool OpalConnection::ExecuteMediaCommand(const OpalMediaCommand & command, bool
                     new PSafeWorkArg1<OpalConnection, OpalMediaCommand *>(
                             const_cast<OpalConnection *>(this),
                             command.CloneAs<OpalMediaCommand>(),
-                            &OpalConnection::InternalExecuteMediaCommand));
+                            &OpalConnection::InternalExecuteMediaCommand), GetCall().GetToken());
     return true;
   }
 
@@ -34,6 +34,7 @@
 #include <opal/console_mgr.h>
 
 #include <opal/patch.h>
+#include <opal/evtrace.h>
 #include <h323/gkclient.h>
 #include <codec/vidcodec.h>
 #include <rtp/srtp_session.h>
@@ -1978,6 +1979,7 @@ PString OpalManagerConsole::GetArgumentSpec() const
          "-rtp-max:          Set RTP port max (default base+199)\n"
          "-rtp-tos:          Set RTP packet IP TOS bits to n\n"
          "-rtp-size:         Set RTP maximum payload size in bytes.\n"
+         "-placement:        Set call placement on CPU cores: none, node or group[,n]\n"
          "-aud-qos:          Set Audio RTP Quality of Service to n\n"
          "-vid-qos:          Set Video RTP Quality of Service to n\n"
 
@@ -2221,6 +2223,11 @@ bool OpalManagerConsole::Initialise(PArgList & args, bool verbose, const PString
     SetMaxRtpPayloadSize(size);
   }
 
+  if (args.HasOption("placement") && !SetPlacementMode(args.GetOptionString("placement"))) {
+    output << "Invalid call placement \"" << args.GetOptionString("placement") << "\"\n";
+    return false;
+  }
+
   if (verbose)
     output << "TCP ports: " << GetTCPPortRange() << "\n"
               "UDP ports: " << GetUDPPortRange() << "\n"
@@ -2927,6 +2934,10 @@ bool OpalManagerCLI::Initialise(PArgList & args, bool verbose, const PString & d
                     "Set trace level (1..6) and filename",
                     "[ --option <opt> ] <n> [ <filename> ]",
                     "O-option: Specify trace option(s),\r" PTRACE_ARGLIST_OPT_HELP);
+  m_cli->SetCommand("trace events", PCREATE_NOTIFIER(CmdEventTrace),
+                    "Start or stop binary media event tracing, decode file with evtrace test program",
+                    "[ --filter <id>[,<id>...] ] <filename> | off",
+                    "f-filter: Only trace call context identifiers or SSRC values (0x prefix for hex)");
 #endif
 
 #if OPAL_STATISTICS
@@ -3016,6 +3027,7 @@ bool OpalManagerCLI::Initialise(PArgList & args, bool verbose, const PString & d
                     "<format> [ <name> [ <value> ] ]");
 
   m_cli->SetCommand("show calls", PCREATE_NOTIFIER(CmdShowCalls), "Show all active calls");
+  m_cli->SetCommand("show placement", PCREATE_NOTIFIER(CmdShowPlacement), "Show call placement and load on CPU cores");
   m_cli->SetCommand("send input", PCREATE_NOTIFIER(CmdSendUserInput), "Send user input indication",
                     "[ --call ] <string>", "c-call: Token for call.");
   m_cli->SetCommand("hangup", PCREATE_NOTIFIER(CmdHangUp), "Hang up call",
@@ -3221,6 +3233,36 @@ void OpalManagerCLI::CmdTrace(PCLI::Arguments & args, P_INT_PTR)
 
   PTrace::PrintInfo(args.GetContext());
 }
+
+
+void OpalManagerCLI::CmdEventTrace(PCLI::Arguments & args, P_INT_PTR)
+{
+  if (args.GetCount() < 1) {
+    args.WriteUsage();
+    return;
+  }
+
+  OpalEventTracer & tracer = OpalEventTracer::GetInstance();
+
+  if (args[0] *= "off") {
+    tracer.Stop();
+    OpalEventTracer::Statistics stats;
+    tracer.GetStatistics(stats);
+    args.GetContext() << "Event trace stopped: " << stats << endl;
+    return;
+  }
+
+  std::vector<uint32_t> filter;
+  PStringArray ids = args.GetOptionString('f').Tokenise(",", false);
+  for (PINDEX i = 0; i < ids.GetSize(); ++i)
+    filter.push_back((ids[i].Left(2) *= "0x") ? ids[i].Mid(2).AsUnsigned(16) : ids[i].AsUnsigned());
+  tracer.SetFilter(filter);
+
+  if (tracer.Start(args[0]))
+    args.GetContext() << "Event trace started to " << args[0] << endl;
+  else
+    args.WriteError() << "Could not start event trace to " << args[0] << endl;
+}
 #endif // PTRACING
 
 
@@ -3751,6 +3793,21 @@ void OpalManagerCLI::CmdShowCalls(PCLI::Arguments & args, P_INT_PTR)
 }
 
 
+void OpalManagerCLI::CmdShowPlacement(PCLI::Arguments & args, P_INT_PTR)
+{
+  ostream & out = args.GetContext();
+
+  if (!GetPlacementPolicy().IsEnabled()) {
+    out << "Call placement not enabled." << endl;
+    return;
+  }
+
+  OpalPlacementPolicy::Statistics stats;
+  GetPlacementPolicy().GetStatistics(stats);
+  out << stats << endl;
+}
+
+
 void OpalManagerCLI::CmdSendUserInput(PCLI::Arguments & args, P_INT_PTR)
 {
   if (args.GetCount() == 0) {
@@ -528,6 +528,7 @@ void OpalEndPoint::OnReleased(OpalConnection & connection)
   PTRACE(4, "OnReleased " << connection);
   m_connectionsActive.RemoveAt(connection.GetToken());
   m_manager.OnReleased(connection);
+  m_manager.SignalGarbageCollection();
 }
 
 
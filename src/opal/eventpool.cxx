@@ -0,0 +1,452 @@
+/*
+ * eventpool.cxx
+ *
+ * Adaptive, affinity ordered, work stealing thread pool for decoupled events.
+ *
+ * Open Phone Abstraction Library (OPAL)
+ *
+ * Copyright (c) 2021 Vox Lucida Pty. Ltd.
+ *
+ * The contents of this file are subject to the Mozilla Public License
+ * Version 1.0 (the "License"); you may not use this file except in
+ * compliance with the License. You may obtain a copy of the License at
+ * http://www.mozilla.org/MPL/
+ *
+ * Software distributed under the License is distributed on an "AS IS"
+ * basis, WITHOUT WARRANTY OF ANY KIND, either express or implied. See
+ * the License for the specific language governing rights and limitations
+ * under the License.
+ *
+ * The Original Code is Open Phone Abstraction Library.
+ *
+ * The Initial Developer of the Original Code is Vox Lucida Pty. Ltd.
+ *
+ * Contributor(s): ______________________________________.
+ */
+
+#include <ptlib.h>
+
+#ifdef __GNUC__
+#pragma implementation "eventpool.h"
+#endif
+
+#include <opal_config.h>
+
+#include <opal/eventpool.h>
+
+
+#define new PNEW
+#define PTraceModule() "EventPool"
+
+
+// Time an extra worker thread must be idle before it exits
+static PTimeInterval const WorkerIdleTime(0, 10);
+
+// Maximum items from one affinity queue executed before giving others a go
+static unsigned const MaxItemsPerTurn = 8;
+
+
+///////////////////////////////////////////////////////////////////////////////
+
+const unsigned OpalEventPool::Histogram::BucketLimits[NumBuckets] = {
+  100, 250, 500, 1000, 2500, 5000, 10000, 25000, 50000, 100000, 1000000, UINT_MAX
+};
+
+
+OpalEventPool::Histogram::Histogram()
+  : m_total(0)
+  , m_maximum(0)
+{
+  memset(m_counts, 0, sizeof(m_counts));
+}
+
+
+void OpalEventPool::Histogram::Add(PInt64 microseconds)
+{
+  PINDEX bucket = 0;
+  while (bucket < NumBuckets-1 && microseconds > BucketLimits[bucket])
+    ++bucket;
+  ++m_counts[bucket];
+  ++m_total;
+  if (m_maximum < microseconds)
+    m_maximum = microseconds;
+}
+
+
+void OpalEventPool::Histogram::Merge(const Histogram & other)
+{
+  for (PINDEX i = 0; i < NumBuckets; ++i)
+    m_counts[i] += other.m_counts[i];
+  m_total += other.m_total;
+  if (m_maximum < other.m_maximum)
+    m_maximum = other.m_maximum;
+}
+
+
+PInt64 OpalEventPool::Histogram::GetPercentile(unsigned percent) const
+{
+  if (m_total == 0)
+    return 0;
+
+  uint64_t threshold = (m_total*percent + 99)/100;
+  uint64_t count = 0;
+  for (PINDEX i = 0; i < NumBuckets-1; ++i) {
+    count += m_counts[i];
+    if (count >= threshold)
+      return std::min((PInt64)BucketLimits[i], m_maximum);
+  }
+  return m_maximum;
+}
+
+
+OpalEventPool::Statistics::Statistics()
+  : m_workers(0)
+  , m_busyWorkers(0)
+  , m_peakWorkers(0)
+  , m_queueDepth(0)
+  , m_peakQueueDepth(0)
+  , m_affinityQueues(0)
+  , m_executed(0)
+  , m_stolen(0)
+{
+}
+
+
+void OpalEventPool::Statistics::PrintOn(ostream & strm) const
+{
+  strm << "workers=" << m_workers << " (busy=" << m_busyWorkers << ", peak=" << m_peakWorkers << "),"
+          " queue=" << m_queueDepth << " (peak=" << m_peakQueueDepth << ", keys=" << m_affinityQueues << "),"
+          " executed=" << m_executed << " (stolen=" << m_stolen << "),"
+          " latency p50=" << m_queueLatency.GetPercentile(50) << "us"
+          " p99=" << m_queueLatency.GetPercentile(99) << "us"
+          " max=" << m_queueLatency.m_maximum << "us,"
+          " execution p50=" << m_executionTime.GetPercentile(50) << "us"
+          " p99=" << m_executionTime.GetPercentile(99) << "us"
+          " max=" << m_executionTime.m_maximum << "us";
+}
+
+
+///////////////////////////////////////////////////////////////////////////////
+
+OpalEventPool::OpalEventPool(unsigned minWorkers, unsigned maxWorkers, const char * threadName)
+  : m_threadName(threadName != NULL ? threadName : "Event Pool")
+  , m_minWorkers(0)
+  , m_maxWorkers(0)
+  , m_runningWorkers(0)
+  , m_busyWorkers(0)
+  , m_peakWorkers(0)
+  , m_nextWorker(0)
+  , m_readySignal(0, INT_MAX)
+  , m_shutdown(false)
+  , m_queueDepth(0)
+  , m_peakQueueDepth(0)
+{
+  /* All the slots are allocated here and the vector is never changed after,
+     so workers and schedulers can index it without locking. */
+  unsigned cores = std::max(PThread::GetNumProcessors(), 1U);
+  size_t slots = std::max(std::max(minWorkers, maxWorkers), cores*4);
+  m_workers.reserve(slots);
+  while (m_workers.size() < slots)
+    m_workers.push_back(new Worker);
+
+  SetWorkerLimits(minWorkers, maxWorkers);
+}
+
+
+OpalEventPool::~OpalEventPool()
+{
+  Shutdown();
+
+  for (size_t i = 0; i < m_workers.size(); ++i)
+    delete m_workers[i];
+}
+
+
+void OpalEventPool::SetWorkerLimits(unsigned minWorkers, unsigned maxWorkers)
+{
+  unsigned cores = std::max(PThread::GetNumProcessors(), 1U);
+  if (minWorkers == 0)
+    minWorkers = cores;
+  if (maxWorkers == 0)
+    maxWorkers = cores*4;
+  if (maxWorkers < minWorkers)
+    maxWorkers = minWorkers;
+
+  unsigned slots = (unsigned)m_workers.size();
+  PTRACE_IF(2, maxWorkers > slots, "Worker limit " << maxWorkers << " reduced to " << slots);
+  maxWorkers = std::min(maxWorkers, slots);
+  minWorkers = std::min(minWorkers, slots);
+
+  PWaitAndSignal lock(m_workersMutex);
+
+  m_minWorkers = minWorkers;
+  m_maxWorkers = maxWorkers;
+  PTRACE(4, "Worker limits set: min=" << m_minWorkers << ", max=" << m_maxWorkers);
+}
+
+
+bool OpalEventPool::AddWork(PSafeWork * work, const PString & affinity)
+{
+  if (work == NULL)
+    return false;
+
+  if (m_shutdown) {
+    delete work;
+    return false;
+  }
+
+  AffinityQueue * queue;
+  bool schedule;
+
+  m_queuesMutex.Wait();
+
+  if (affinity.IsEmpty())
+    queue = new AffinityQueue(affinity);
+  else {
+    AffinityMap::iterator it = m_affinityQueues.find(affinity);
+    if (it != m_affinityQueues.end())
+      queue = it->second;
+    else
+      m_affinityQueues[affinity] = queue = new AffinityQueue(affinity);
+  }
+
+  queue->m_items.push(Item(work));
+  schedule = !queue->m_scheduled;
+  queue->m_scheduled = true;
+
+  if (++m_queueDepth > m_peakQueueDepth)
+    m_peakQueueDepth = m_queueDepth;
+  unsigned queueDepth = m_queueDepth;
+
+  m_queuesMutex.Signal();
+
+  /* Keep the same key on the same worker where possible, for cache locality.
+     Work with no key is just spread around the workers. */
+  if (schedule)
+    Schedule(queue, affinity.IsEmpty() ? m_nextWorker++ : (size_t)affinity.HashFunction());
+
+  // Need more workers?
+  unsigned running = m_runningWorkers;
+  if (running < m_minWorkers || (m_busyWorkers >= running && queueDepth > 0 && running < m_maxWorkers))
+    StartWorker();
+
+  return true;
+}
+
+
+void OpalEventPool::Schedule(AffinityQueue * queue, size_t preferredWorker)
+{
+  size_t count = m_workers.size();
+  Worker & worker = *m_workers[preferredWorker % count];
+  worker.m_mutex.Wait();
+  worker.m_ready.push_back(queue);
+  worker.m_mutex.Signal();
+  m_readySignal.Signal();
+}
+
+
+OpalEventPool::AffinityQueue * OpalEventPool::GetReady(size_t index)
+{
+  Worker & self = *m_workers[index];
+
+  self.m_mutex.Wait();
+  if (!self.m_ready.empty()) {
+    AffinityQueue * queue = self.m_ready.front();
+    self.m_ready.pop_front();
+    self.m_mutex.Signal();
+    return queue;
+  }
+  self.m_mutex.Signal();
+
+  // Nothing of our own, steal from the back of someone else's list
+  size_t count = m_workers.size();
+  for (size_t offset = 1; offset < count; ++offset) {
+    Worker & other = *m_workers[(index + offset) % count];
+    other.m_mutex.Wait();
+    if (!other.m_ready.empty()) {
+      AffinityQueue * queue = other.m_ready.back();
+      other.m_ready.pop_back();
+      other.m_mutex.Signal();
+      PWaitAndSignal lock(self.m_mutex);
+      ++self.m_stolen;
+      return queue;
+    }
+    other.m_mutex.Signal();
+  }
+
+  return NULL;
+}
+
+
+void OpalEventPool::Execute(size_t index, AffinityQueue * queue)
+{
+  Worker & self = *m_workers[index];
+
+  for (unsigned turn = 0; turn < MaxItemsPerTurn; ++turn) {
+    m_queuesMutex.Wait();
+    Item item = queue->m_items.front();
+    queue->m_items.pop();
+    --m_queueDepth;
+    m_queuesMutex.Signal();
+
+    PTime start;
+
+    ++m_busyWorkers;
+    item.m_work->Work();
+    delete item.m_work;
+    --m_busyWorkers;
+
+    self.m_mutex.Wait();
+    self.m_queueLatency.Add((start - item.m_queued).GetMicroSeconds());
+    self.m_executionTime.Add((PTime() - start).GetMicroSeconds());
+    ++self.m_executed;
+    self.m_mutex.Signal();
+
+    PWaitAndSignal lock(m_queuesMutex);
+    if (queue->m_items.empty()) {
+      // Nothing more for this key, it can go
+      if (!queue->m_key.IsEmpty())
+        m_affinityQueues.erase(queue->m_key);
+      delete queue;
+      return;
+    }
+    if (m_shutdown)
+      break;
+  }
+
+  // Still more to do, but let other keys have a turn first
+  Schedule(queue, index);
+}
+
+
+void OpalEventPool::StartWorker()
+{
+  PWaitAndSignal lock(m_workersMutex);
+
+  if (m_shutdown || m_runningWorkers >= m_maxWorkers)
+    return;
+
+  for (size_t index = 0; index < m_workers.size(); ++index) {
+    Worker & worker = *m_workers[index];
+    if (!worker.m_running) {
+      /* A previous worker in this slot that exited while idle has already
+         released the lock for the last time, so it is safe to wait here. */
+      PThread::WaitAndDelete(worker.m_thread);
+
+      worker.m_running = true;
+      if (++m_runningWorkers > m_peakWorkers)
+        m_peakWorkers = m_runningWorkers;
+      worker.m_thread = new PThreadObj1Arg<OpalEventPool, size_t>(*this, index, &OpalEventPool::WorkerMain, false, m_threadName);
+      PTRACE(4, "Started worker " << index << ", running=" << m_runningWorkers);
+      return;
+    }
+  }
+}
+
+
+void OpalEventPool::WorkerMain(size_t index)
+{
+  Worker & self = *m_workers[index];
+
+  while (!m_shutdown) {
+    AffinityQueue * queue = GetReady(index);
+    if (queue != NULL) {
+      Execute(index, queue);
+      continue;
+    }
+
+    if (m_readySignal.Wait(WorkerIdleTime))
+      continue;
+
+    // Been idle for a while, exit if we have more than we need
+    PWaitAndSignal lock(m_workersMutex);
+    if (m_runningWorkers > m_minWorkers) {
+      PWaitAndSignal lock2(self.m_mutex);
+      if (self.m_ready.empty()) {
+        PTRACE(4, "Idle worker " << index << " exiting, running=" << (m_runningWorkers-1));
+        break;
+      }
+    }
+  }
+
+  // Thread object is deleted by StartWorker() reusing the slot, or Shutdown()
+  PWaitAndSignal lock(m_workersMutex);
+  self.m_running = false;
+  --m_runningWorkers;
+}
+
+
+void OpalEventPool::Shutdown()
+{
+  if (m_shutdown.exchange(true))
+    return;
+
+  PTRACE(4, "Shutting down, running=" << m_runningWorkers);
+
+  // Wake everyone up so they notice the shut down
+  for (size_t i = 0; i < m_workers.size(); ++i)
+    m_readySignal.Signal();
+
+  /* No new threads can be started once m_shutdown is set, so collect them
+     all, then wait outside the lock as exiting workers need it. */
+  std::vector<PThread *> threads;
+  m_workersMutex.Wait();
+  for (size_t i = 0; i < m_workers.size(); ++i) {
+    if (m_workers[i]->m_thread != NULL) {
+      threads.push_back(m_workers[i]->m_thread);
+      m_workers[i]->m_thread = NULL;
+    }
+  }
+  m_workersMutex.Signal();
+
+  for (size_t i = 0; i < threads.size(); ++i)
+    PThread::WaitAndDelete(threads[i]);
+
+  // Delete anything left
+  PWaitAndSignal lock(m_queuesMutex);
+
+  for (size_t i = 0; i < m_workers.size(); ++i) {
+    std::deque<AffinityQueue *> & ready = m_workers[i]->m_ready;
+    while (!ready.empty()) {
+      AffinityQueue * queue = ready.front();
+      ready.pop_front();
+      while (!queue->m_items.empty()) {
+        delete queue->m_items.front().m_work;
+        queue->m_items.pop();
+      }
+      if (!queue->m_key.IsEmpty())
+        m_affinityQueues.erase(queue->m_key);
+      delete queue;
+    }
+  }
+
+  m_queueDepth = 0;
+}
+
+
+void OpalEventPool::GetStatistics(Statistics & statistics) const
+{
+  statistics.m_workers = m_runningWorkers;
+  statistics.m_busyWorkers = m_busyWorkers;
+
+  m_workersMutex.Wait();
+  statistics.m_peakWorkers = m_peakWorkers;
+  for (size_t i = 0; i < m_workers.size(); ++i) {
+    const Worker & worker = *m_workers[i];
+    PWaitAndSignal lock(worker.m_mutex);
+    statistics.m_queueLatency.Merge(worker.m_queueLatency);
+    statistics.m_executionTime.Merge(worker.m_executionTime);
+    statistics.m_executed += worker.m_executed;
+    statistics.m_stolen += worker.m_stolen;
+  }
+  m_workersMutex.Signal();
+
+  m_queuesMutex.Wait();
+  statistics.m_queueDepth = m_queueDepth;
+  statistics.m_peakQueueDepth = m_peakQueueDepth;
+  statistics.m_affinityQueues = m_affinityQueues.size();
+  m_queuesMutex.Signal();
+}
+
+
+// End of File ///////////////////////////////////////////////////////////////
@@ -0,0 +1,540 @@
+/*
+ * evtrace.cxx
+ *
+ * Binary event tracing for media hot paths
+ *
+ * Open Phone Abstraction Library (OPAL)
+ *
+ * Copyright (c) 2021 Vox Lucida Pty. Ltd.
+ *
+ * The contents of this file are subject to the Mozilla Public License
+ * Version 1.0 (the "License"); you may not use this file except in
+ * compliance with the License. You may obtain a copy of the License at
+ * http://www.mozilla.org/MPL/
+ *
+ * Software distributed under the License is distributed on an "AS IS"
+ * basis, WITHOUT WARRANTY OF ANY KIND, either express or implied. See
+ * the License for the specific language governing rights and limitations
+ * under the License.
+ *
+ * The Original Code is Open Phone Abstraction Library.
+ *
+ * The Initial Developer of the Original Code is Vox Lucida Pty. Ltd.
+ *
+ * Contributor(s): ______________________________________.
+ */
+
+#include <ptlib.h>
+
+#ifdef __GNUC__
+#pragma implementation "evtrace.h"
+#endif
+
+#include <opal_config.h>
+
+#include <opal/evtrace.h>
+
+#include <algorithm>
+#include <map>
+
+
+#define PTraceModule() "EvTrace"
+
+
+static const char FileMagic[8] = { 'O', 'P', 'A', 'L', 'E', 'V', 'T', '1' };
+
+static const struct {
+  const char * m_name;
+  const char * m_args[3];
+} EventInfo[OpalEventTracer::NumEvents] = {
+  { "Thread",          { "length" } },
+  { "Dropped",         { "count" } },
+  { "Transport-Read",  { "length", "subchannel" } },
+  { "RTP-Receive",     { "sn", "ts", "size" } },
+  { "RTP-Send",        { "sn", "ts", "size" } },
+  { "RTP-OutOfOrder",  { "sn", "expected" } },
+  { "RTP-TransportSN", { "twcc-sn", "hdr-len" } },
+  { "Patch-Write",     { "ts", "size", "bypassed" } },
+  { "Patch-Video",     { "ts", "frames", "key-frames" } },
+  { "SRTP-Protect",    { "subchannel", "in", "out" } },
+  { "SRTP-Unprotect",  { "subchannel", "in", "out" } }
+};
+
+#pragma pack(1)
+
+struct EventFileHeader
+{
+  char     m_magic[8];
+  PUInt32l m_seconds;
+  PUInt32l m_microseconds;
+  PUInt16l m_numEvents;
+  PUInt16l m_reserved;
+};
+
+struct EventFileEntry
+{
+  PUInt32l m_timeLow;     // Microseconds since start of file
+  PUInt32l m_timeHigh;
+  PUInt16l m_event;
+  PUInt16l m_thread;
+  PUInt32l m_context;
+  PUInt32l m_ssrc;
+  PUInt32l m_args[3];
+};
+
+#pragma pack()
+
+
+/* Thread local pointer to the threads buffer. A buffer is only ever given to
+   another thread once the owner has let it go, either by exiting or by noticing
+   the tracer was restarted, so the single writer rule is never broken. */
+struct OpalEventTracerThreadBuffer
+{
+  OpalEventTracer::Buffer * m_buffer;
+  unsigned                  m_generation;
+};
+
+#if __cplusplus >= 201103L
+  struct OpalEventTracerThreadBufferOwner : OpalEventTracerThreadBuffer
+  {
+    OpalEventTracerThreadBufferOwner() { m_buffer = NULL; m_generation = 0; }
+    ~OpalEventTracerThreadBufferOwner() { if (m_buffer != NULL) m_buffer->m_released = true; }
+  };
+  static thread_local OpalEventTracerThreadBufferOwner t_threadBuffer;
+#elif defined(_MSC_VER)
+  static __declspec(thread) OpalEventTracerThreadBuffer t_threadBuffer;
+#else
+  static __thread OpalEventTracerThreadBuffer t_threadBuffer;
+#endif
+
+
+atomic<bool>     OpalEventTracer::s_active(false);
+atomic<unsigned> OpalEventTracer::s_filterCount(0);
+atomic<uint32_t> OpalEventTracer::s_filters[OpalEventTracer::MaxFilters];
+atomic<unsigned> OpalEventTracer::s_generation(1);
+
+
+///////////////////////////////////////////////////////////////////////////////
+
+OpalEventTracer::Statistics::Statistics()
+  : m_buffers(0)
+  , m_recorded(0)
+  , m_dropped(0)
+  , m_bytes(0)
+{
+}
+
+
+void OpalEventTracer::Statistics::PrintOn(ostream & strm) const
+{
+  strm << "buffers=" << m_buffers
+       << " recorded=" << m_recorded
+       << " dropped=" << m_dropped
+       << " bytes=" << m_bytes;
+}
+
+
+OpalEventTracer::Buffer::Buffer(unsigned size, unsigned index)
+  : m_entries(size)
+  , m_mask(size-1)
+  , m_index(index)
+  , m_head(0)
+  , m_tail(0)
+  , m_dropped(0)
+  , m_released(false)
+  , m_reported(0)
+  , m_named(false)
+{
+}
+
+
+///////////////////////////////////////////////////////////////////////////////
+
+OpalEventTracer::OpalEventTracer()
+  : m_bufferSize(0)
+  , m_nextIndex(0)
+  , m_drainThread(NULL)
+  , m_draining(false)
+{
+}
+
+
+OpalEventTracer::~OpalEventTracer()
+{
+  Stop();
+}
+
+
+OpalEventTracer & OpalEventTracer::GetInstance()
+{
+  // Deliberately never deleted, as media threads may record during static destruction
+  static OpalEventTracer * instance = new OpalEventTracer();
+  return *instance;
+}
+
+
+bool OpalEventTracer::Start(const PFilePath & filename, unsigned bufferRecords, const PTimeInterval & drainInterval)
+{
+  Stop();
+
+  PWaitAndSignal mutex(m_mutex);
+
+  if (!m_file.Open(filename, PFile::WriteOnly, PFile::Create|PFile::Truncate)) {
+    PTRACE(2, "Could not create " << filename << ": " << m_file.GetErrorText());
+    return false;
+  }
+
+  PTime now;
+  EventFileHeader header;
+  memcpy(header.m_magic, FileMagic, sizeof(FileMagic));
+  header.m_seconds = (uint32_t)now.GetTimeInSeconds();
+  header.m_microseconds = now.GetMicrosecond();
+  header.m_numEvents = NumEvents;
+  header.m_reserved = 0;
+
+  // Event names are in the file so older decoders can read newer files
+  PBYTEArray data((const BYTE *)&header, sizeof(header));
+  for (PINDEX e = 0; e < NumEvents; ++e) {
+    PStringStream names;
+    names << EventInfo[e].m_name;
+    for (PINDEX a = 0; a < 3; ++a)
+      names << '\t' << (EventInfo[e].m_args[a] != NULL ? EventInfo[e].m_args[a] : "");
+    names << '\n';
+    data.Concatenate(PBYTEArray((const BYTE *)names.GetPointer(), names.GetLength()));
+  }
+
+  if (!m_file.Write(data, data.GetSize())) {
+    PTRACE(2, "Could not write " << filename << ": " << m_file.GetErrorText());
+    m_file.Close();
+    return false;
+  }
+
+  unsigned size = 256;
+  while (size < bufferRecords && size < 0x1000000)
+    size <<= 1;
+
+  // Spare buffers are owned by no thread, so can be resized
+  if (size != m_bufferSize) {
+    for (size_t i = 0; i < m_spare.size(); ++i)
+      delete m_spare[i];
+    m_spare.clear();
+    m_bufferSize = size;
+  }
+
+  for (size_t i = 0; i < m_buffers.size(); ++i)
+    m_buffers[i]->m_named = false;
+
+  m_statistics = Statistics();
+  m_statistics.m_buffers = (unsigned)(m_buffers.size() + m_spare.size());
+  m_statistics.m_bytes = data.GetSize();
+  m_drainInterval = drainInterval;
+  m_startTick = PTimer::Tick();
+  ++s_generation;
+  s_active = true;
+
+  m_draining = true;
+  m_drainThread = new PThreadObj<OpalEventTracer>(*this, &OpalEventTracer::DrainMain, false, "EvTrace", PThread::LowPriority);
+
+  PTRACE(3, "Started event trace to " << filename << ", buffer=" << size << " events");
+  return true;
+}
+
+
+void OpalEventTracer::Stop()
+{
+  if (!m_draining.exchange(false))
+    return;
+
+  s_active = false;
+  m_drainWakeUp.Signal();
+  PThread::WaitAndDelete(m_drainThread);
+
+  PWaitAndSignal mutex(m_mutex);
+  m_file.Close();
+
+  PTRACE(3, "Stopped event trace: " << m_statistics);
+}
+
+
+void OpalEventTracer::SetFilter(const std::vector<uint32_t> & contexts)
+{
+  PWaitAndSignal mutex(m_mutex);
+
+  // Disable filtering while changing, briefly recording a little too much is harmless
+  s_filterCount = 0;
+
+  unsigned count = (unsigned)std::min(contexts.size(), (size_t)MaxFilters);
+  for (unsigned i = 0; i < count; ++i)
+    s_filters[i] = contexts[i];
+
+  s_filterCount = count;
+
+  PTRACE_IF(2, contexts.size() > MaxFilters, "Too many filters, only using first " << MaxFilters);
+}
+
+
+bool OpalEventTracer::MatchFilter(uint32_t context, uint32_t ssrc)
+{
+  unsigned count = s_filterCount;
+  for (unsigned i = 0; i < count; ++i) {
+    uint32_t filter = s_filters[i];
+    if (filter == context || (ssrc != 0 && filter == ssrc))
+      return true;
+  }
+  return false;
+}
+
+
+void OpalEventTracer::Record(Events event, uint32_t context, uint32_t ssrc, uint32_t arg1, uint32_t arg2, uint32_t arg3)
+{
+  OpalEventTracer & tracer = GetInstance();
+  OpalEventTracerThreadBuffer & threadBuffer = t_threadBuffer;
+
+  unsigned generation = s_generation;
+  if (threadBuffer.m_buffer == NULL || threadBuffer.m_generation != generation) {
+    if (threadBuffer.m_buffer != NULL)
+      threadBuffer.m_buffer->m_released = true;
+    threadBuffer.m_buffer = tracer.AllocateBuffer();
+    threadBuffer.m_generation = generation;
+    if (threadBuffer.m_buffer == NULL)
+      return;
+  }
+
+  Buffer & buffer = *threadBuffer.m_buffer;
+
+  uint64_t head = buffer.m_head;
+  if (head - buffer.m_tail > buffer.m_mask) {
+    ++buffer.m_dropped;
+    return;
+  }
+
+  Entry & entry = buffer.m_entries[head & buffer.m_mask];
+  entry.m_time = (PTimer::Tick() - tracer.m_startTick).GetMicroSeconds();
+  entry.m_event = (uint16_t)event;
+  entry.m_thread = (uint16_t)buffer.m_index;
+  entry.m_context = context;
+  entry.m_ssrc = ssrc;
+  entry.m_args[0] = arg1;
+  entry.m_args[1] = arg2;
+  entry.m_args[2] = arg3;
+
+  // Publish to drain thread
+  buffer.m_head = head + 1;
+}
+
+
+OpalEventTracer::Buffer * OpalEventTracer::AllocateBuffer()
+{
+  PWaitAndSignal mutex(m_mutex);
+
+  if (m_bufferSize == 0)
+    return NULL;
+
+  Buffer * buffer;
+  if (m_spare.empty()) {
+    buffer = new Buffer(m_bufferSize, m_nextIndex++);
+    ++m_statistics.m_buffers;
+  }
+  else {
+    buffer = m_spare.back();
+    m_spare.pop_back();
+    buffer->m_index = m_nextIndex++;
+    buffer->m_head = buffer->m_tail = 0;
+    buffer->m_dropped = buffer->m_reported = 0;
+    buffer->m_released = false;
+  }
+
+  buffer->m_named = false;
+  buffer->m_threadName = PThread::GetThreadName(PThread::GetCurrentThreadId());
+  m_buffers.push_back(buffer);
+  return buffer;
+}
+
+
+void OpalEventTracer::DrainMain()
+{
+  PTRACE(4, "Drain thread started");
+
+  while (m_draining) {
+    m_drainWakeUp.Wait(m_drainInterval);
+    Drain();
+  }
+
+  // Catch anything recorded while stopping
+  Drain();
+
+  PTRACE(4, "Drain thread ended");
+}
+
+
+bool OpalEventTracer::Drain()
+{
+  PWaitAndSignal mutex(m_mutex);
+
+  if (!m_file.IsOpen())
+    return false;
+
+  PBYTEArray data;
+  PINDEX used = 0;
+  uint64_t recorded = 0;
+
+  for (size_t i = 0; i < m_buffers.size(); ) {
+    Buffer & buffer = *m_buffers[i];
+
+    uint64_t head = buffer.m_head;
+    uint64_t tail = buffer.m_tail;
+    uint64_t dropped = buffer.m_dropped;
+    unsigned extra = (buffer.m_named ? 0 : 1) + (dropped != buffer.m_reported ? 1 : 0);
+    PINDEX nameLength = buffer.m_named ? 0 : buffer.m_threadName.GetLength();
+
+    EventFileEntry * out = (EventFileEntry *)(data.GetPointer(used + (PINDEX)(head - tail + extra)*sizeof(EventFileEntry) + nameLength) + used);
+
+    if (!buffer.m_named) {
+      memset(out, 0, sizeof(*out));
+      out->m_event = e_ThreadName;
+      out->m_thread = (uint16_t)buffer.m_index;
+      out->m_args[0] = nameLength;
+      memcpy(++out, buffer.m_threadName.GetPointer(), nameLength);
+      out = (EventFileEntry *)((BYTE *)out + nameLength);
+      buffer.m_named = true;
+    }
+
+    for (; tail != head; ++tail) {
+      const Entry & entry = buffer.m_entries[tail & buffer.m_mask];
+      out->m_timeLow = (uint32_t)entry.m_time;
+      out->m_timeHigh = (uint32_t)(entry.m_time >> 32);
+      out->m_event = entry.m_event;
+      out->m_thread = entry.m_thread;
+      out->m_context = entry.m_context;
+      out->m_ssrc = entry.m_ssrc;
+      out->m_args[0] = entry.m_args[0];
+      out->m_args[1] = entry.m_args[1];
+      out->m_args[2] = entry.m_args[2];
+      ++out;
+      ++recorded;
+    }
+    buffer.m_tail = head;
+
+    if (dropped != buffer.m_reported) {
+      memset(out, 0, sizeof(*out));
+      out->m_event = e_Dropped;
+      out->m_thread = (uint16_t)buffer.m_index;
+      out->m_args[0] = (uint32_t)(dropped - buffer.m_reported);
+      ++out;
+      m_statistics.m_dropped += dropped - buffer.m_reported;
+      buffer.m_reported = dropped;
+    }
+
+    used = (PINDEX)((BYTE *)out - data.GetPointer());
+
+    // Thread has exited, and everything it wrote is out, buffer can be reused
+    if (buffer.m_released && buffer.m_head == head) {
+      m_spare.push_back(&buffer);
+      m_buffers.erase(m_buffers.begin() + i);
+    }
+    else
+      ++i;
+  }
+
+  m_statistics.m_recorded += recorded;
+
+  if (used == 0)
+    return true;
+
+  m_statistics.m_bytes += used;
+  if (m_file.Write(data, used))
+    return true;
+
+  PTRACE(1, "Could not write to " << m_file.GetFilePath() << ": " << m_file.GetErrorText());
+  return false;
+}
+
+
+void OpalEventTracer::GetStatistics(Statistics & statistics) const
+{
+  PWaitAndSignal mutex(m_mutex);
+  statistics = m_statistics;
+}
+
+
+bool OpalEventTracer::Decode(const PFilePath & filename, ostream & output, const std::vector<uint32_t> & contexts)
+{
+  PFile file(filename, PFile::ReadOnly);
+  if (!file.IsOpen()) {
+    output << "Could not open " << filename << ": " << file.GetErrorText() << endl;
+    return false;
+  }
+
+  EventFileHeader header;
+  if (!file.Read(&header, sizeof(header)) || file.GetLastReadCount() != sizeof(header) ||
+                memcmp(header.m_magic, FileMagic, sizeof(FileMagic)) != 0) {
+    output << filename << " is not an event trace file" << endl;
+    return false;
+  }
+
+  // Event names, one line each, name and argument names separated by tabs
+  std::vector<PStringArray> events;
+  while (events.size() < header.m_numEvents) {
+    PString line;
+    char c;
+    while (file.Read(&c, 1) && file.GetLastReadCount() == 1 && c != '\n')
+      line += c;
+    if (file.GetLastReadCount() != 1) {
+      output << filename << " is truncated" << endl;
+      return false;
+    }
+    events.push_back(line.Tokenise('\t', true));
+  }
+
+  PTime startTime((time_t)(uint32_t)header.m_seconds, (uint32_t)header.m_microseconds);
+  output << "Event trace started " << startTime.AsString(PTime::LongISO8601) << '\n';
+
+  std::map<unsigned, PString> threadNames;
+  EventFileEntry entry;
+  while (file.Read(&entry, sizeof(entry)) && file.GetLastReadCount() == sizeof(entry)) {
+    unsigned event = entry.m_event;
+    unsigned thread = entry.m_thread;
+
+    if (event == e_ThreadName) {
+      PINDEX length = entry.m_args[0];
+      PString name;
+      if (length > 0 && (!file.Read(name.GetPointerAndSetLength(length), length) || file.GetLastReadCount() != length)) {
+        output << filename << " is truncated" << endl;
+        return false;
+      }
+      threadNames[thread] = name;
+      continue;
+    }
+
+    if (!contexts.empty() && event != e_Dropped &&
+        std::find(contexts.begin(), contexts.end(), (uint32_t)entry.m_context) == contexts.end() &&
+        ((uint32_t)entry.m_ssrc == 0 || std::find(contexts.begin(), contexts.end(), (uint32_t)entry.m_ssrc) == contexts.end()))
+      continue;
+
+    uint64_t time = ((uint64_t)(uint32_t)entry.m_timeHigh << 32) | (uint32_t)entry.m_timeLow;
+    output << setw(7) << time/1000000 << '.' << setfill('0') << setw(6) << time%1000000 << setfill(' ')
+           << ' ' << left << setw(16) << threadNames[thread] << right << ' ';
+
+    if (event < events.size() && !events[event].IsEmpty())
+      output << events[event][0];
+    else
+      output << "Event-" << event;
+
+    if (entry.m_context != 0)
+      output << " ctx=" << (uint32_t)entry.m_context;
+    if (entry.m_ssrc != 0)
+      output << " ssrc=0x" << hex << setfill('0') << setw(8) << (uint32_t)entry.m_ssrc << dec << setfill(' ');
+
+    for (PINDEX a = 0; a < 3; ++a) {
+      if (event < events.size() && a+1 < events[event].GetSize() && !events[event][a+1].IsEmpty())
+        output << ' ' << events[event][a+1] << '=' << (uint32_t)entry.m_args[a];
+    }
+    output << '\n';
+  }
+
+  output.flush();
+  return true;
+}
+
+
+// End of File ///////////////////////////////////////////////////////////////
@@ -46,6 +46,8 @@
 #include <codec/opalpluginmgr.h>
 #include <im/im_ep.h>
 #include <ep/opalmixer.h>
+#include <rtp/rtpmux.h>
+#include <rtp/dtls_srtp_session.h>
 
 #if OPAL_HAS_H281
   #include <h224/h281.h>
@@ -313,8 +315,10 @@ OpalManager::OpalManager()
   , m_staleReceiverTimeout(0,0,1) // Minutes
 #if OPAL_SRTP
   , m_dtlsTimeout(0, 3)           // Seconds
+  , m_dtlsIdentityPool(new OpalDTLSIdentityPool)
 #endif
   , m_rtpIpPorts(5000, 5999)
+  , m_mediaMuxListener(NULL)
 #if OPAL_PTLIB_SSL
   , m_caFiles(PProcess::Current().GetHomeDirectory() + "certificates")
   , m_certificateFile(PProcess::Current().GetHomeDirectory() + "opal_certificate.pem")
@@ -329,7 +333,8 @@ OpalManager::OpalManager()
   , P_DISABLE_MSVC_WARNINGS(4355, m_activeCalls(*this))
   , m_clearingAllCallsCount(0)
   , m_garbageCollector(NULL)
-  , m_decoupledEventPool(5, 0, "OPAL-Event")
+  , m_garbageCollectExit(false)
+  , m_decoupledEventPool(0, 0, "OPAL-Event")
 #if OPAL_SCRIPT
   , m_script(NULL)
 #endif
@@ -399,12 +404,20 @@ OpalManager::~OpalManager()
 #endif
 
   // Shut down the cleaner thread
-  m_garbageCollectExit.Signal();
+  m_garbageCollectExit = true;
+  m_garbageCollectSignal.Signal();
   PThread::WaitAndDelete(m_garbageCollector);
 
   // Clean up any calls that the cleaner thread missed on the way out
   GarbageCollection();
 
+  // All media transports are gone, so nothing can be routed to
+  delete m_mediaMuxListener;
+
+#if OPAL_SRTP
+  delete m_dtlsIdentityPool;
+#endif
+
 #if OPAL_PTLIB_NAT
   PInterfaceMonitor::GetInstance().RemoveNotifier(m_onInterfaceChange);
   delete m_natMethods;
@@ -808,8 +821,10 @@ void OpalManager::InternalClearAllCalls(OpalConnection::CallEndReason reason, bo
 
   if (firstThread) {
     // Clear all the currentyl active calls
-    for (PSafePtr<OpalCall> call = m_activeCalls; call != NULL; ++call)
-      call->Clear(reason);
+    for (PINDEX shard = 0; shard < CallDict::NumShards; ++shard) {
+      for (PSafePtr<OpalCall> call(m_activeCalls.GetShard(shard), PSafeReference); call != NULL; ++call)
+        call->Clear(reason);
+    }
   }
 
   if (wait) {
@@ -2115,6 +2130,28 @@ void OpalManager::SetUDPPorts(unsigned udpBase, unsigned udpMax)
 }
 
 
+bool OpalManager::SetMediaMuxPort(const PString & iface, WORD port, unsigned shards)
+{
+  // Listener is never deleted while running, as transports may still refer to it
+  if (port == 0) {
+    if (m_mediaMuxListener != NULL)
+      m_mediaMuxListener->Close();
+    return true;
+  }
+
+  PIPAddress ip(iface.IsEmpty() || iface == "*" ? PIPAddress::GetAny(4) : PIPAddress(iface));
+  if (!ip.IsValid()) {
+    PTRACE(2, "Invalid interface for media mux port: \"" << iface << '"');
+    return false;
+  }
+
+  if (m_mediaMuxListener == NULL)
+    m_mediaMuxListener = new OpalMediaMuxListener(*this);
+
+  return m_mediaMuxListener->Open(ip, port, shards);
+}
+
+
 void OpalManager::SetRtpIpPorts(unsigned rtpIpBase, unsigned rtpIpMax)
 {
   m_rtpIpPorts.Set(rtpIpBase&0xfffe, rtpIpMax&0xfffe, 198, 5000);
@@ -2243,16 +2280,99 @@ void OpalManager::GarbageCollection()
 }
 
 
-void OpalManager::CallDict::DeleteObject(PObject * object) const
+void OpalManager::GarbageMain(PThread &, P_INT_PTR)
 {
-  manager.DestroyCall(PDownCast(OpalCall, object));
+  /* Woken immediately when a call or connection is released, the timeout is
+     only a backstop for objects that do not signal, e.g. media streams. */
+  while (!m_garbageCollectExit) {
+    m_garbageCollectSignal.Wait(1000);
+    GarbageCollection();
+  }
 }
 
 
-void OpalManager::GarbageMain(PThread &, P_INT_PTR)
+OpalManager::CallDict::CallDict(OpalManager & mgr)
+  : m_manager(mgr)
+  , m_size(0)
 {
-  while (!m_garbageCollectExit.Wait(1000))
-    GarbageCollection();
+  for (PINDEX i = 0; i < NumShards; ++i)
+    m_shards[i] = new Shard(mgr);
+}
+
+
+OpalManager::CallDict::~CallDict()
+{
+  for (PINDEX i = 0; i < NumShards; ++i)
+    delete m_shards[i];
+}
+
+
+OpalManager::CallDict::Shard & OpalManager::CallDict::GetShard(const PString & token) const
+{
+  // FNV-1a, tokens are mostly sequential so need good mixing of low bits
+  uint32_t hash = 2166136261U;
+  for (const char * ptr = token; *ptr != '\0'; ++ptr)
+    hash = (hash ^ (BYTE)*ptr) * 16777619U;
+  return *m_shards[hash & (NumShards-1)];
+}
+
+
+PSafePtr<OpalCall> OpalManager::CallDict::Find(const PString & token, PSafetyMode mode) const
+{
+  return GetShard(token).Find(token, mode);
+}
+
+
+void OpalManager::CallDict::SetAt(const PString & token, OpalCall * call)
+{
+  GetShard(token).SetAt(token, call);
+  ++m_size;
+}
+
+
+void OpalManager::CallDict::RemoveAt(const PString & token)
+{
+  Shard & shard = GetShard(token);
+  if (shard.RemoveAt(token)) {
+    --m_size;
+    shard.m_removed = true;
+    m_manager.SignalGarbageCollection();
+  }
+}
+
+
+PArray<PString> OpalManager::CallDict::GetKeys() const
+{
+  PArray<PString> keys;
+  for (PINDEX i = 0; i < NumShards; ++i) {
+    PArray<PString> shardKeys = m_shards[i]->GetKeys();
+    for (PINDEX j = 0; j < shardKeys.GetSize(); ++j)
+      keys.Append(new PString(shardKeys[j]));
+  }
+  return keys;
+}
+
+
+bool OpalManager::CallDict::DeleteObjectsToBeRemoved()
+{
+  bool allDeleted = true;
+
+  for (PINDEX i = 0; i < NumShards; ++i) {
+    Shard & shard = *m_shards[i];
+    if (shard.m_removed.exchange(false) && !shard.DeleteObjectsToBeRemoved()) {
+      // Still referenced somewhere, try again next time
+      shard.m_removed = true;
+      allDeleted = false;
+    }
+  }
+
+  return allDeleted && m_size == 0;
+}
+
+
+void OpalManager::CallDict::Shard::DeleteObject(PObject * object) const
+{
+  m_manager.DestroyCall(PDownCast(OpalCall, object));
 }
 
 
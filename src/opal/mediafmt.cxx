@@ -126,6 +126,13 @@ static PMutex & GetMediaFormatsListMutex()
 }
 
 
+static unsigned NextFormatGeneration()
+{
+  static atomic<unsigned> generation(0);
+  return ++generation;
+}
+
+
 static void Clamp(OpalMediaFormatInternal & fmt1, const OpalMediaFormatInternal & fmt2, const PString & variableOption, const PString & minOption, const PString & maxOption)
 {
   if (fmt1.FindOption(variableOption) == NULL)
@@ -954,11 +961,15 @@ PBoolean OpalMediaFormat::MakeUnique()
 
   PWaitAndSignal m2(m_info->m_mutex);
 
-  if (PContainer::MakeUnique())
+  if (PContainer::MakeUnique()) {
+    // Caller is about to change it
+    m_info->m_generation = NextFormatGeneration();
     return true;
+  }
 
   m_info = (OpalMediaFormatInternal *)m_info->Clone();
   m_info->options.MakeUnique();
+  m_info->m_generation = NextFormatGeneration();
   return false;
 }
 
@@ -1304,6 +1315,7 @@ OpalMediaFormatInternal::OpalMediaFormatInternal(const char * fullName,
   , codecVersionTime(ts)
   , forceIsTransportable(false)
   , m_allowMultiple(am)
+  , m_generation(NextFormatGeneration())
 {
 
   AddOption(new OpalMediaOptionString(OpalMediaFormat::DescriptionOption(), true, fullName));
@@ -1396,6 +1408,7 @@ void OpalMediaFormatInternal::DeconflictPayloadTypes(OpalMediaFormatList & forma
     RTP_DataFrame::PayloadTypes newPT = (RTP_DataFrame::PayloadTypes)nextUnused;
     PTRACE(4, "Replacing payload type " << rtpPayloadType << " with " << newPT << " for " << formatName);
     rtpPayloadType = newPT;
+    m_generation = NextFormatGeneration();
   }
   else {
     PTRACE(3, "Conflicting payload type: "
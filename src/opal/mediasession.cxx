@@ -37,6 +37,7 @@
 #include <opal/connection.h>
 #include <opal/endpoint.h>
 #include <opal/manager.h>
+#include <opal/evtrace.h>
 //#include <h323/h323caps.h>
 #include <sdp/sdp.h>
 
@@ -659,6 +660,8 @@ OpalMediaTransport::OpalMediaTransport(const PString & name)
   , m_opened(false)
   , m_established(false)
   , m_started(false)
+  , m_placementPolicy(NULL)
+  , m_placementGroup(-1)
   , m_congestionControl(NULL)
 {
   m_ccTimer.SetNotifier(PCREATE_NOTIFIER(ProcessCongestionControl), "RTP-CC");
@@ -880,6 +883,9 @@ void OpalMediaTransport::ChannelInfo::ThreadMain()
   PTRACE_CONTEXT_ID_PUSH_THREAD(m_owner);
   PTRACE(4, &m_owner, m_owner << m_subchannel << " media transport read thread starting");
 
+  if (m_owner.m_placementPolicy != NULL)
+    m_owner.m_placementPolicy->BindThread(m_owner.m_placementGroup);
+
   while (m_channel->IsOpen()) {
     PBYTEArray data(m_owner.m_packetSize);
 
@@ -890,6 +896,7 @@ void OpalMediaTransport::ChannelInfo::ThreadMain()
 
     if (m_channel->Read(data.GetPointer(), data.GetSize())) {
       data.SetSize(m_channel->GetLastReadCount());
+      OPAL_EVENT_TRACE(e_TransportRead, m_owner, 0, data.GetSize(), m_subchannel, 0);
       PTRACE_IF(4, m_remoteGoneError != PChannel::Timeout, &m_owner, m_owner << m_subchannel << " first receive data: sz=" << data.GetSize());
       if (m_owner.InternalRxData(m_subchannel, data))
         m_remoteGoneError = PChannel::Timeout;
@@ -1018,6 +1025,14 @@ bool OpalMediaTransport::InternalRxData(SubChannels subchannel, const PBYTEArray
 }
 
 
+void OpalMediaTransport::SetPlacement(OpalMediaSession & session)
+{
+  OpalCall & call = session.GetConnection().GetCall();
+  m_placementPolicy = &call.GetManager().GetPlacementPolicy();
+  m_placementGroup = call.GetPlacementGroup();
+}
+
+
 void OpalMediaTransport::Start()
 {
   if (m_started.exchange(true))
@@ -1092,8 +1107,9 @@ OpalTCPMediaTransport::OpalTCPMediaTransport(const PString & name)
 }
 
 
-bool OpalTCPMediaTransport::Open(OpalMediaSession &, PINDEX, const PString & localInterface, const OpalTransportAddress &)
+bool OpalTCPMediaTransport::Open(OpalMediaSession & session, PINDEX, const PString & localInterface, const OpalTransportAddress &)
 {
+  SetPlacement(session);
   return m_opened = dynamic_cast<PTCPSocket &>(*m_subchannels[0].m_channel).Listen(PIPAddress(localInterface));
 }
 
@@ -1359,6 +1375,7 @@ bool OpalUDPMediaTransport::Open(OpalMediaSession & session,
 
   OpalManager & manager = session.GetConnection().GetEndPoint().GetManager();
 
+  SetPlacement(session);
   m_packetSize = manager.GetMaxRtpPacketSize();
   if (session.IsRemoteBehindNAT())
     SetRemoteBehindNAT();
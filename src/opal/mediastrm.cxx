@@ -35,6 +35,7 @@
 
 #include <opal/mediastrm.h>
 #include <opal/mediasession.h>
+#include <opal/asyncio.h>
 
 #if OPAL_VIDEO
 #include <ptlib/videoio.h>
@@ -972,6 +973,7 @@ OpalFileMediaStream::OpalFileMediaStream(OpalConnection & conn,
                                          PBoolean autoDel)
   : OpalRawMediaStream(conn, mediaFormat, sessionID, isSource, file, autoDel)
   , OpalMediaStreamPacing(mediaFormat)
+  , m_writer(isSource || m_channel == NULL ? NULL : new OpalAsyncChannelWriter(*m_channel))
 {
 }
 
@@ -985,10 +987,18 @@ OpalFileMediaStream::OpalFileMediaStream(OpalConnection & conn,
                        new PFile(path, isSource ? PFile::ReadOnly : PFile::WriteOnly),
                        true)
   , OpalMediaStreamPacing(mediaFormat)
+  , m_writer(isSource || m_channel == NULL ? NULL : new OpalAsyncChannelWriter(*m_channel))
 {
 }
 
 
+OpalFileMediaStream::~OpalFileMediaStream()
+{
+  Close();
+  delete m_writer;
+}
+
+
 PBoolean OpalFileMediaStream::IsSynchronous() const
 {
   return false;
@@ -1010,14 +1020,48 @@ PBoolean OpalFileMediaStream::ReadData(BYTE * data, PINDEX size, PINDEX & length
   */
 PBoolean OpalFileMediaStream::WriteData(const BYTE * data, PINDEX length, PINDEX & written)
 {
-  if (!OpalRawMediaStream::WriteData(data, length, written))
-    return false;
+  if (m_writer == NULL) {
+    if (!OpalRawMediaStream::WriteData(data, length, written))
+      return false;
+  }
+  else {
+    if (!IsOpen()) {
+      PTRACE(1, "Tried to write to closed media stream");
+      return false;
+    }
+
+    if (data != NULL && length != 0)
+      m_silence.SetMinSize(length);
+    else {
+      length = m_silence.GetSize();
+      data = m_silence;
+    }
+
+    /* The disk write is done in the background. If it cannot keep up, the
+       media is dropped, rather than stalling the patch thread. */
+    m_writer->Write(data, length);
+    written = length;
+
+    m_dbCalculatorMutex.Wait();
+    m_dbCalculator.Accumulate(data, written);
+    m_dbCalculatorMutex.Signal();
+  }
 
   Pace(false, written, m_marker);
   return true;
 }
 
 
+void OpalFileMediaStream::InternalClose()
+{
+  // Make sure everything is written before file is closed
+  if (m_writer != NULL)
+    m_writer->Close();
+
+  OpalRawMediaStream::InternalClose();
+}
+
+
 ///////////////////////////////////////////////////////////////////////////////
 
 #if OPAL_PTLIB_AUDIO
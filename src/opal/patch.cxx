@@ -39,6 +39,7 @@
 #include <opal/mediastrm.h>
 #include <opal/endpoint.h>
 #include <opal/transcoders.h>
+#include <opal/evtrace.h>
 #include <rtp/rtpconn.h>
 
 #if OPAL_VIDEO
@@ -646,7 +647,8 @@ PBoolean OpalMediaPatch::ExecuteCommand(const OpalMediaCommand & command)
 void OpalMediaPatch::InternalOnMediaCommand1(OpalMediaCommand & command, P_INT_PTR)
 {
   m_source.GetConnection().GetEndPoint().GetManager().QueueDecoupledEvent(new PSafeWorkArg1<OpalMediaPatch, OpalMediaCommand *>(
-              this, command.CloneAs<OpalMediaCommand>(), &OpalMediaPatch::InternalOnMediaCommand2));
+              this, command.CloneAs<OpalMediaCommand>(), &OpalMediaPatch::InternalOnMediaCommand2),
+              m_source.GetConnection().GetCall().GetToken());
 }
 
 
@@ -716,6 +718,9 @@ void OpalMediaPatch::Main()
 {
   PTRACE(4, "Thread started for " << *this);
 
+  OpalCall & call = m_source.GetConnection().GetCall();
+  call.GetManager().GetPlacementPolicy().BindThread(call.GetPlacementGroup());
+
 #if OPAL_STATISTICS
   m_patchThreadId = PThread::GetCurrentThreadId();
 #endif
@@ -789,7 +794,8 @@ void OpalMediaPatch::Main()
     PTRACE(4, "Closing source media stream as no sinks in " << *this);
     m_source.GetConnection().GetEndPoint().GetManager().QueueDecoupledEvent(
                 new PSafeWorkArg1<OpalConnection, OpalMediaStreamPtr, bool>(&m_source.GetConnection(),
-                                                        &m_source, &OpalConnection::CloseMediaStream));
+                                                        &m_source, &OpalConnection::CloseMediaStream),
+                m_source.GetConnection().GetCall().GetToken());
   }
 
   PTRACE(4, "Thread ended for " << *this);
@@ -954,6 +960,9 @@ bool OpalMediaPatch::Sink::WriteFrame(RTP_DataFrame & sourceFrame, bool bypassin
   if (m_stream->IsPaused())
     return true;
 
+  OPAL_EVENT_TRACE(e_PatchWrite, m_patch, sourceFrame.GetSyncSource(),
+                   sourceFrame.GetTimestamp(), sourceFrame.GetPayloadSize(), bypassing);
+
   if (bypassing || m_primaryCodec == NULL) {
 #if OPAL_STATISTICS
     OpalAudioFormat::FrameType audioFrameType;
@@ -1016,6 +1025,8 @@ bool OpalMediaPatch::Sink::WriteFrame(RTP_DataFrame & sourceFrame, bool bypassin
         PTRACE(5, "P-Frame detected: SSRC=" << RTP_TRACE_SRC(ssrc)
                 << ", ts=" << sourceFrame.GetTimestamp() << ", total=" << m_videoStatistics[ssrc].m_totalFrames
                 << ", key=" << m_videoStatistics[ssrc].m_keyFrames << ", on " << m_patch);
+        OPAL_EVENT_TRACE(e_PatchVideoFrame, m_patch, ssrc, sourceFrame.GetTimestamp(),
+                         (uint32_t)m_videoStatistics[ssrc].m_totalFrames, (uint32_t)m_videoStatistics[ssrc].m_keyFrames);
         m_statsMutex.Signal();
         break;
 
@@ -1090,7 +1101,8 @@ void OpalPassiveMediaPatch::Start()
   if (CanStart()) {
     m_started = true;
     PTRACE(4, "Passive media patch started: " << *this);
-    m_source.GetConnection().GetEndPoint().GetManager().QueueDecoupledEvent(new PSafeWorkNoArg<OpalMediaPatch, bool>(this, &OpalMediaPatch::OnStartMediaPatch));
+    m_source.GetConnection().GetEndPoint().GetManager().QueueDecoupledEvent(new PSafeWorkNoArg<OpalMediaPatch, bool>(this, &OpalMediaPatch::OnStartMediaPatch),
+                                                                                   m_source.GetConnection().GetCall().GetToken());
   }
 }
 
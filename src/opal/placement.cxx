@@ -0,0 +1,451 @@
+/*
+ * placement.cxx
+ *
+ * NUMA and core aware placement of calls and media threads
+ *
+ * Open Phone Abstraction Library (OPAL)
+ *
+ * Copyright (c) 2021 Vox Lucida Pty. Ltd.
+ *
+ * The contents of this file are subject to the Mozilla Public License
+ * Version 1.0 (the "License"); you may not use this file except in
+ * compliance with the License. You may obtain a copy of the License at
+ * http://www.mozilla.org/MPL/
+ *
+ * Software distributed under the License is distributed on an "AS IS"
+ * basis, WITHOUT WARRANTY OF ANY KIND, either express or implied. See
+ * the License for the specific language governing rights and limitations
+ * under the License.
+ *
+ * The Original Code is Open Phone Abstraction Library.
+ *
+ * The Initial Developer of the Original Code is Vox Lucida Pty. Ltd.
+ *
+ * Contributor(s): ______________________________________.
+ */
+
+#include <ptlib.h>
+
+#ifdef __GNUC__
+#pragma implementation "placement.h"
+#endif
+
+#include <opal_config.h>
+
+#include <opal/placement.h>
+
+#include <algorithm>
+
+#ifdef P_LINUX
+#include <sched.h>
+#include <pthread.h>
+#endif
+
+
+#define PTraceModule() "Placement"
+
+static unsigned const DefaultGroupSize = 4;
+
+
+///////////////////////////////////////////////////////////////////////////////
+
+OpalPlacementPolicy::GroupStatistics::GroupStatistics()
+  : m_node(0)
+  , m_calls(0)
+  , m_assigned(0)
+  , m_threadsBound(0)
+{
+}
+
+
+OpalPlacementPolicy::Statistics::Statistics()
+  : m_mode(e_Disabled)
+  , m_socketsBound(0)
+  , m_bindFailures(0)
+{
+}
+
+
+void OpalPlacementPolicy::Statistics::PrintOn(ostream & strm) const
+{
+  static const char * const ModeNames[] = { "none", "node", "group" };
+  strm << "mode=" << ModeNames[m_mode]
+       << " groups=" << m_groups.size()
+       << " sockets=" << m_socketsBound
+       << " failures=" << m_bindFailures;
+
+  for (size_t i = 0; i < m_groups.size(); ++i) {
+    const GroupStatistics & group = m_groups[i];
+    strm << "\n  group " << i << ": node=" << group.m_node
+         << " calls=" << group.m_calls << '/' << group.m_assigned
+         << " threads=" << group.m_threadsBound
+         << " load=";
+    for (size_t c = 0; c < group.m_cpus.size(); ++c) {
+      if (c > 0)
+        strm << ',';
+      strm << group.m_cpus[c] << ':';
+      if (c < group.m_cpuLoad.size())
+        strm << group.m_cpuLoad[c] << '%';
+      else
+        strm << '?';
+    }
+  }
+}
+
+
+///////////////////////////////////////////////////////////////////////////////
+
+OpalPlacementPolicy::OpalPlacementPolicy()
+  : m_mode(e_Disabled)
+  , m_socketsBound(0)
+  , m_bindFailures(0)
+{
+}
+
+
+bool OpalPlacementPolicy::Configure(Modes mode, unsigned groupSize)
+{
+  PWaitAndSignal mutex(m_mutex);
+
+  m_groups.clear();
+  m_mode = mode;
+  if (mode == e_Disabled) {
+    PTRACE(3, "Disabled");
+    return true;
+  }
+
+  if (groupSize == 0)
+    groupSize = DefaultGroupSize;
+
+  Topology topology;
+  GetTopology(topology);
+
+  for (Topology::iterator node = topology.begin(); node != topology.end(); ++node) {
+    const std::vector<unsigned> & cpus = node->second;
+    if (mode == e_ByNode) {
+      m_groups.push_back(Group(node->first));
+      m_groups.back().m_cpus = cpus;
+    }
+    else {
+      for (size_t i = 0; i < cpus.size(); ++i) {
+        if (i % groupSize == 0)
+          m_groups.push_back(Group(node->first));
+        m_groups.back().m_cpus.push_back(cpus[i]);
+      }
+    }
+  }
+
+  // Assignments are kept, but may refer to groups that no longer exist
+  for (AssignmentMap::iterator it = m_assignments.begin(); it != m_assignments.end(); ++it) {
+    if (it->second >= (int)m_groups.size())
+      it->second = -1;
+    else if (it->second >= 0)
+      ++m_groups[it->second].m_calls;
+  }
+
+  if (m_groups.empty()) {
+    PTRACE(2, "Could not determine CPU topology, placement disabled");
+    m_mode = e_Disabled;
+    return false;
+  }
+
+  PTRACE(3, "Configured " << m_groups.size() << " group(s) across " << topology.size() << " node(s)");
+  return true;
+}
+
+
+bool OpalPlacementPolicy::Configure(const PString & str)
+{
+  PCaselessString mode = str.Left(str.Find(',')).Trim();
+  unsigned groupSize = str.Find(',') != P_MAX_INDEX ? str.Mid(str.Find(',')+1).AsUnsigned() : 0;
+
+  if (mode.IsEmpty() || mode == "none" || mode == "off")
+    return Configure(e_Disabled);
+  if (mode == "node" || mode == "numa")
+    return Configure(e_ByNode);
+  if (mode == "group" || mode == "core")
+    return Configure(e_ByCoreGroup, groupSize);
+
+  PTRACE(2, "Unknown placement mode \"" << str << '"');
+  return false;
+}
+
+
+unsigned OpalPlacementPolicy::GetGroupCount() const
+{
+  PWaitAndSignal mutex(m_mutex);
+  return (unsigned)m_groups.size();
+}
+
+
+unsigned OpalPlacementPolicy::GetCPUCount() const
+{
+  PWaitAndSignal mutex(m_mutex);
+
+  unsigned count = 0;
+  for (size_t i = 0; i < m_groups.size(); ++i)
+    count += (unsigned)m_groups[i].m_cpus.size();
+  return count;
+}
+
+
+unsigned OpalPlacementPolicy::GetCPU(unsigned index) const
+{
+  PWaitAndSignal mutex(m_mutex);
+
+  for (size_t i = 0; i < m_groups.size(); ++i) {
+    if (index < m_groups[i].m_cpus.size())
+      return m_groups[i].m_cpus[index];
+    index -= (unsigned)m_groups[i].m_cpus.size();
+  }
+  return 0;
+}
+
+
+int OpalPlacementPolicy::GetGroupOfCPU(unsigned cpu) const
+{
+  PWaitAndSignal mutex(m_mutex);
+
+  for (size_t i = 0; i < m_groups.size(); ++i) {
+    if (std::find(m_groups[i].m_cpus.begin(), m_groups[i].m_cpus.end(), cpu) != m_groups[i].m_cpus.end())
+      return (int)i;
+  }
+  return -1;
+}
+
+
+int OpalPlacementPolicy::AssignGroup(const PString & key)
+{
+  if (m_mode == e_Disabled)
+    return -1;
+
+  PWaitAndSignal mutex(m_mutex);
+
+  if (m_groups.empty())
+    return -1;
+
+  AssignmentMap::iterator it = m_assignments.find(key);
+  if (it != m_assignments.end())
+    return it->second;
+
+  // Fewest calls per core, so groups of differing size are evenly loaded
+  size_t best = 0;
+  for (size_t i = 1; i < m_groups.size(); ++i) {
+    if (m_groups[i].m_calls*m_groups[best].m_cpus.size() < m_groups[best].m_calls*m_groups[i].m_cpus.size())
+      best = i;
+  }
+
+  ++m_groups[best].m_calls;
+  ++m_groups[best].m_assigned;
+  m_assignments[key] = (int)best;
+
+  PTRACE(4, "Assigned " << key << " to group " << best << ", calls=" << m_groups[best].m_calls);
+  return (int)best;
+}
+
+
+void OpalPlacementPolicy::ReleaseGroup(const PString & key)
+{
+  PWaitAndSignal mutex(m_mutex);
+
+  AssignmentMap::iterator it = m_assignments.find(key);
+  if (it == m_assignments.end())
+    return;
+
+  if (it->second >= 0 && it->second < (int)m_groups.size() && m_groups[it->second].m_calls > 0)
+    --m_groups[it->second].m_calls;
+  m_assignments.erase(it);
+}
+
+
+int OpalPlacementPolicy::GetGroup(const PString & key) const
+{
+  PWaitAndSignal mutex(m_mutex);
+
+  AssignmentMap::const_iterator it = m_assignments.find(key);
+  return it != m_assignments.end() ? it->second : -1;
+}
+
+
+bool OpalPlacementPolicy::BindThread(int group)
+{
+  if (group < 0)
+    return false;
+
+  PWaitAndSignal mutex(m_mutex);
+
+  if (group >= (int)m_groups.size())
+    return false;
+
+#ifdef P_LINUX
+  cpu_set_t set;
+  CPU_ZERO(&set);
+  for (size_t i = 0; i < m_groups[group].m_cpus.size(); ++i)
+    CPU_SET(m_groups[group].m_cpus[i], &set);
+
+  int err = pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+  if (err == 0) {
+    ++m_groups[group].m_threadsBound;
+    PTRACE(4, "Bound thread " << PThread::GetCurrentThreadId() << " to group " << group);
+    return true;
+  }
+
+  PTRACE(2, "Could not bind thread to group " << group << ": error=" << err);
+#endif
+
+  ++m_bindFailures;
+  return false;
+}
+
+
+bool OpalPlacementPolicy::BindSocket(PIPSocket & socket, unsigned cpu)
+{
+#ifdef SO_INCOMING_CPU
+  if (socket.SetOption(SO_INCOMING_CPU, (int)cpu)) {
+    PWaitAndSignal mutex(m_mutex);
+    ++m_socketsBound;
+    PTRACE(4, "Bound socket " << socket.GetHandle() << " to cpu " << cpu);
+    return true;
+  }
+
+  PTRACE(2, "Could not bind socket to cpu " << cpu << ": " << socket.GetErrorText());
+#endif
+
+  PWaitAndSignal mutex(m_mutex);
+  ++m_bindFailures;
+  return false;
+}
+
+
+void OpalPlacementPolicy::GetStatistics(Statistics & statistics)
+{
+  CPUTimesMap times;
+  GetCPUTimes(times);
+
+  PWaitAndSignal mutex(m_mutex);
+
+  statistics.m_mode = m_mode;
+  statistics.m_socketsBound = m_socketsBound;
+  statistics.m_bindFailures = m_bindFailures;
+  statistics.m_groups.resize(m_groups.size());
+
+  for (size_t i = 0; i < m_groups.size(); ++i) {
+    const Group & group = m_groups[i];
+    GroupStatistics & stats = statistics.m_groups[i];
+    stats.m_node = group.m_node;
+    stats.m_cpus = group.m_cpus;
+    stats.m_calls = group.m_calls;
+    stats.m_assigned = group.m_assigned;
+    stats.m_threadsBound = group.m_threadsBound;
+
+    stats.m_cpuLoad.clear();
+    for (size_t c = 0; c < group.m_cpus.size(); ++c) {
+      CPUTimesMap::iterator now = times.find(group.m_cpus[c]);
+      CPUTimesMap::iterator last = m_lastTimes.find(group.m_cpus[c]);
+      if (now == times.end())
+        break;
+
+      uint64_t busy = now->second.m_busy, total = now->second.m_total;
+      if (last != m_lastTimes.end()) {
+        busy -= last->second.m_busy;
+        total -= last->second.m_total;
+      }
+      stats.m_cpuLoad.push_back(total > 0 ? (unsigned)(busy*100/total) : 0);
+    }
+  }
+
+  m_lastTimes = times;
+}
+
+
+#ifdef P_LINUX
+
+static void ParseCPUList(const PString & list, std::vector<unsigned> & cpus)
+{
+  PStringArray ranges = list.Tokenise(',', false);
+  for (PINDEX i = 0; i < ranges.GetSize(); ++i) {
+    PINDEX dash = ranges[i].Find('-');
+    unsigned first = ranges[i].Left(dash).AsUnsigned();
+    unsigned last = dash != P_MAX_INDEX ? ranges[i].Mid(dash+1).AsUnsigned() : first;
+    for (unsigned cpu = first; cpu <= last; ++cpu)
+      cpus.push_back(cpu);
+  }
+}
+
+
+void OpalPlacementPolicy::GetTopology(Topology & topology)
+{
+  cpu_set_t allowed;
+  CPU_ZERO(&allowed);
+  bool restricted = sched_getaffinity(0, sizeof(allowed), &allowed) == 0;
+
+  static const unsigned MaxNodes = 64;
+  for (unsigned node = 0; node < MaxNodes; ++node) {
+    PTextFile file(PSTRSTRM("/sys/devices/system/node/node" << node << "/cpulist"), PFile::ReadOnly);
+    if (!file.IsOpen())
+      continue;
+
+    PString line;
+    file.ReadLine(line);
+
+    std::vector<unsigned> cpus;
+    ParseCPUList(line.Trim(), cpus);
+    for (size_t i = 0; i < cpus.size(); ++i) {
+      if (!restricted || CPU_ISSET(cpus[i], &allowed))
+        topology[node].push_back(cpus[i]);
+    }
+  }
+
+  if (!topology.empty())
+    return;
+
+  // No NUMA information in sysfs, treat as one node
+  unsigned count = std::max(PThread::GetNumProcessors(), 1U);
+  for (unsigned cpu = 0; cpu < count; ++cpu) {
+    if (!restricted || CPU_ISSET(cpu, &allowed))
+      topology[0].push_back(cpu);
+  }
+}
+
+
+void OpalPlacementPolicy::GetCPUTimes(CPUTimesMap & times)
+{
+  PTextFile file("/proc/stat", PFile::ReadOnly);
+  if (!file.IsOpen())
+    return;
+
+  PString line;
+  while (file.ReadLine(line)) {
+    // Format is: cpuN user nice system idle iowait irq softirq steal ...
+    if (line.NumCompare("cpu", 3) != EqualTo || !isdigit(line[3]))
+      continue;
+
+    PStringArray fields = line.Tokenise(' ', false);
+    if (fields.GetSize() < 5)
+      continue;
+
+    CPUTimes & cpu = times[fields[0].Mid(3).AsUnsigned()];
+    for (PINDEX i = 1; i < fields.GetSize() && i <= 8; ++i)
+      cpu.m_total += fields[i].AsUnsigned64();
+    cpu.m_busy = cpu.m_total - fields[4].AsUnsigned64() - (fields.GetSize() > 5 ? fields[5].AsUnsigned64() : 0);
+  }
+}
+
+#else // P_LINUX
+
+void OpalPlacementPolicy::GetTopology(Topology & topology)
+{
+  unsigned count = std::max(PThread::GetNumProcessors(), 1U);
+  for (unsigned cpu = 0; cpu < count; ++cpu)
+    topology[0].push_back(cpu);
+}
+
+
+void OpalPlacementPolicy::GetCPUTimes(CPUTimesMap &)
+{
+}
+
+#endif // P_LINUX
+
+
+// End of File ///////////////////////////////////////////////////////////////
@@ -35,8 +35,12 @@
 #include <opal/recording.h>
 
 #include <ep/opalmixer.h>
+#include <opal/transcoders.h>
+#include <opal/asyncio.h>
 #include <ptclib/mediafile.h>
 
+#include <algorithm>
+
 
 #define PTraceModule() "OpalRecord"
 
@@ -162,6 +166,23 @@ class OpalMediaFileRecordManager : public OpalRecordManager
     mutable PDECLARE_MUTEX(m_mutex);
     PSmartPtr<PMediaFile> m_file;
 
+    // Mixed media is written to the file from the async I/O threads
+    struct MediaFileWriter : public OpalAsyncWriter
+    {
+      enum { VideoTag = 0x80000000 };
+
+      MediaFileWriter(const PSmartPtr<PMediaFile> & file, const PFilePath & fn)
+        : OpalAsyncWriter(fn, false, 256*1024, 16*1024*1024)
+        , m_file(file)
+      { }
+      ~MediaFileWriter() { Close(); }
+      virtual bool OnWrite(const BYTE * data, PINDEX length, unsigned tag);
+
+      PSmartPtr<PMediaFile> m_file;
+      PDECLARE_MUTEX(m_fileMutex); // Protect file track changes from concurrent writes
+    };
+    MediaFileWriter * m_writer;
+
     // Audio
     virtual bool WriteAudio(const PString & strmId, const RTP_DataFrame & rtp);
     virtual bool OnPushAudio();
@@ -217,7 +238,8 @@ class OpalMediaFileRecordManager : public OpalRecordManager
 
 
 OpalMediaFileRecordManager::OpalMediaFileRecordManager()
-  : m_audioTrack(numeric_limits<unsigned>::max())
+  : m_writer(NULL)
+  , m_audioTrack(numeric_limits<unsigned>::max())
 #if OPAL_VIDEO
   , m_videoTrack(numeric_limits<unsigned>::max())
 #endif
@@ -250,6 +272,8 @@ bool OpalMediaFileRecordManager::OpenFile(const PFilePath & fn)
     return false;
   }
 
+  m_writer = new MediaFileWriter(m_file, fn);
+
   m_audioMixer = new AudioMixer(*this,
                                 m_options.m_stereo,
                                 8000, // Really need to make this more flexible ....
@@ -338,8 +362,14 @@ bool OpalMediaFileRecordManager::Close()
   PSmartPtr<PMediaFile> file = m_file;
   m_file = NULL;
 
+  MediaFileWriter * writer = m_writer;
+  m_writer = NULL;
+
   m_mutex.Signal();
 
+  // Wait for everything mixed so far to get to the file
+  delete writer;
+
   return true;
 }
 
@@ -351,6 +381,11 @@ bool OpalMediaFileRecordManager::OpenStream(const PString & strmId, const OpalMe
   if (!OpalRecordManager::OpenStream(strmId, format))
     return false;
 
+  if (m_writer == NULL)
+    return false;
+
+  PWaitAndSignal fileMutex(m_writer->m_fileMutex);
+
   OpalMediaType mediaType = format.GetMediaType();
 
   unsigned trackId;
@@ -506,11 +541,9 @@ bool OpalMediaFileRecordManager::OnMixedAudio(const RTP_DataFrame & frame)
   if (m_audioTrack >= m_file->GetTrackCount())
     return true; // No audio to mix is not an error
 
-  PINDEX written;
-  if (!m_file->WriteAudio(m_audioTrack, frame.GetPayloadPtr(), frame.GetPayloadSize(), written))
-    return false;
-
-  PTRACE(6, "Written " << written << " audio samples");
+  // Under back pressure the audio is dropped, rather than stall the mixer
+  if (m_writer->Write(frame.GetPayloadPtr(), frame.GetPayloadSize(), m_audioTrack))
+    PTRACE(6, "Queued " << frame.GetPayloadSize() << " bytes of audio");
   return true;
 }
 
@@ -560,16 +593,30 @@ bool OpalMediaFileRecordManager::OnMixedVideo(const RTP_DataFrame & frame)
     return false;
   }
 
-  if (!m_file->WriteVideo(m_videoTrack, OPAL_VIDEO_FRAME_DATA_PTR(header)))
-    return false;
-
-  PTRACE(6, "Written video frame");
+  if (m_writer->Write(OPAL_VIDEO_FRAME_DATA_PTR(header),
+                      PVideoFrameInfo::CalculateFrameBytes(header->width, header->height),
+                      m_videoTrack | MediaFileWriter::VideoTag))
+    PTRACE(6, "Queued video frame");
   return true;
 }
 
 #endif // OPAL_VIDEO
 
 
+bool OpalMediaFileRecordManager::MediaFileWriter::OnWrite(const BYTE * data, PINDEX length, unsigned tag)
+{
+  PWaitAndSignal mutex(m_fileMutex);
+
+#if OPAL_VIDEO
+  if (tag & VideoTag)
+    return m_file->WriteVideo(tag & ~VideoTag, data);
+#endif
+
+  PINDEX written;
+  return m_file->WriteAudio(tag, data, length, written);
+}
+
+
 OpalMediaFileRecordManager::FactoryInitialiser::FactoryInitialiser()
 {
   PStringSet fileTypes = PMediaFile::GetAllFileTypes();
@@ -595,6 +642,598 @@ OpalRecordManager * OpalMediaFileRecordManager::FactoryInitialiser::Create(OpalR
 static OpalMediaFileRecordManager::FactoryInitialiser OpalMediaFileRecordManager_FactoryInitialiser_instance;
 
 
+//////////////////////////////////////////////////////////////////////////////
+
+static const char EncodedFileMagic[] = "OPALREC1";
+static const char EncodedIndexMagic[] = "OPALRIDX";
+static const unsigned EncodedIndexIntervalMS = 1000;
+
+enum EncodedRecordTypes {
+  e_StreamRecord = 1,
+  e_PacketRecord,
+  e_IndexRecord
+};
+
+#pragma pack(1)
+
+struct EncodedFileHeader
+{
+  char     m_magic[8];
+  PUInt32l m_seconds;
+  PUInt32l m_microseconds;
+};
+
+struct EncodedRecordHeader
+{
+  BYTE     m_type;
+  BYTE     m_stream;
+  BYTE     m_payloadType; // Top bit is RTP marker
+  BYTE     m_reserved;
+  PUInt32l m_length;
+  PUInt32l m_time;        // Milliseconds since start of file
+  PUInt32l m_timestamp;
+  PUInt16l m_sequence;
+  PUInt16l m_reserved2;
+};
+
+struct EncodedIndexEntry
+{
+  PUInt32l m_time;
+  PUInt32l m_positionLow;
+  PUInt32l m_positionHigh;
+};
+
+struct EncodedFileTrailer
+{
+  char     m_magic[8];
+  PUInt32l m_positionLow;
+  PUInt32l m_positionHigh;
+};
+
+#pragma pack()
+
+// Largest packet or stream record, no RTP payload can be bigger
+static const unsigned MaxEncodedRecordSize = 65536;
+
+// Largest index, an entry every interval for the whole 32 bit millisecond time
+static const unsigned MaxEncodedIndexSize = (0xffffffff/EncodedIndexIntervalMS + 1)*sizeof(EncodedIndexEntry);
+
+
+/* The length in a header read back from a file cannot be trusted, so it is
+   checked before anything is allocated or read. The position is that of the
+   record data, just after the header, and the limit is where records end. */
+static bool IsValidRecordLength(const EncodedRecordHeader & header, off_t position, off_t limit)
+{
+  unsigned maximum = header.m_type == e_IndexRecord ? MaxEncodedIndexSize : MaxEncodedRecordSize;
+  if (header.m_length <= maximum && (off_t)header.m_length <= limit - position)
+    return true;
+
+  PTRACE(2, "Invalid record length " << header.m_length << " at " << position << " in encoded recording");
+  return false;
+}
+
+
+OpalEncodedRecordFile::OpalEncodedRecordFile(PINDEX bufferSize)
+  : m_startTime(0)
+  , m_endOfPackets(0)
+  , m_writing(false)
+  , m_writer(NULL)
+  , m_buffer(std::max(bufferSize, (PINDEX)1024))
+  , m_bufferUsed(0)
+  , m_position(0)
+{
+}
+
+
+OpalEncodedRecordFile::~OpalEncodedRecordFile()
+{
+  Close();
+}
+
+
+bool OpalEncodedRecordFile::Create(const PFilePath & fn)
+{
+  Close();
+
+  PWaitAndSignal mutex(m_mutex);
+
+  if (!m_file.Open(fn, PFile::WriteOnly, PFile::Create|PFile::Truncate)) {
+    PTRACE(2, "Could not create encoded recording \"" << fn << "\": " << m_file.GetErrorText());
+    return false;
+  }
+
+  m_writing = true;
+  m_writer = new OpalAsyncChannelWriter(m_file, m_buffer.GetSize());
+  m_startTime.SetCurrentTime();
+  m_streams.clear();
+  m_index.clear();
+
+  EncodedFileHeader header;
+  memcpy(header.m_magic, EncodedFileMagic, sizeof(header.m_magic));
+  header.m_seconds = (uint32_t)m_startTime.GetTimeInSeconds();
+  header.m_microseconds = m_startTime.GetMicrosecond();
+  memcpy(m_buffer.GetPointer(), &header, sizeof(header));
+  m_bufferUsed = m_position = sizeof(header);
+
+  PTRACE(3, "Created encoded recording \"" << fn << '"');
+  return true;
+}
+
+
+bool OpalEncodedRecordFile::Open(const PFilePath & fn)
+{
+  Close();
+
+  PWaitAndSignal mutex(m_mutex);
+
+  if (!m_file.Open(fn, PFile::ReadOnly)) {
+    PTRACE(2, "Could not open encoded recording \"" << fn << "\": " << m_file.GetErrorText());
+    return false;
+  }
+
+  m_writing = false;
+  m_streams.clear();
+  m_index.clear();
+
+  EncodedFileHeader header;
+  if (!m_file.Read(&header, sizeof(header)) || memcmp(header.m_magic, EncodedFileMagic, sizeof(header.m_magic)) != 0) {
+    PTRACE(2, "Not an encoded recording \"" << fn << '"');
+    m_file.Close();
+    return false;
+  }
+  m_startTime = PTime(header.m_seconds, header.m_microseconds);
+
+  // Use index if file was closed correctly, otherwise rebuild it
+  bool indexed = false;
+  off_t length = m_file.GetLength();
+  if (length >= (off_t)(sizeof(header) + sizeof(EncodedFileTrailer))) {
+    EncodedFileTrailer trailer;
+    if (m_file.SetPosition(length - sizeof(trailer)) &&
+        m_file.Read(&trailer, sizeof(trailer)) &&
+        memcmp(trailer.m_magic, EncodedIndexMagic, sizeof(trailer.m_magic)) == 0)
+      indexed = ReadDirectory(((off_t)(uint32_t)trailer.m_positionHigh << 32) | (uint32_t)trailer.m_positionLow);
+  }
+
+  if (!indexed && !ScanFile()) {
+    m_file.Close();
+    return false;
+  }
+
+  PTRACE(3, "Opened encoded recording \"" << fn << "\" "
+         << (indexed ? "with" : "without") << " index, " << m_streams.size() << " streams");
+  return m_file.SetPosition(sizeof(header));
+}
+
+
+bool OpalEncodedRecordFile::Close()
+{
+  PWaitAndSignal mutex(m_mutex);
+
+  if (!m_file.IsOpen())
+    return false;
+
+  if (m_writing) {
+    m_writing = false;
+
+    // Make sure there is room for the directory
+    Flush();
+    m_writer->Flush(true);
+
+    // Append copy of stream descriptions, then index, then trailer pointing to them
+    off_t directory = m_position;
+    for (size_t i = 0; i < m_streams.size(); ++i) {
+      PString text = m_streams[i].m_id + '\t' + m_streams[i].m_format;
+      WriteRecord(e_StreamRecord, (BYTE)i, text.GetPointer(), text.GetLength());
+    }
+
+    std::vector<EncodedIndexEntry> entries(m_index.size());
+    for (size_t i = 0; i < m_index.size(); ++i) {
+      entries[i].m_time = m_index[i].m_time;
+      entries[i].m_positionLow = (uint32_t)m_index[i].m_position;
+      entries[i].m_positionHigh = (uint32_t)((uint64_t)m_index[i].m_position >> 32);
+    }
+    WriteRecord(e_IndexRecord, 0, entries.empty() ? NULL : &entries[0], entries.size()*sizeof(EncodedIndexEntry));
+
+    EncodedFileTrailer trailer;
+    memcpy(trailer.m_magic, EncodedIndexMagic, sizeof(trailer.m_magic));
+    trailer.m_positionLow = (uint32_t)directory;
+    trailer.m_positionHigh = (uint32_t)((uint64_t)directory >> 32);
+    if (m_bufferUsed + (PINDEX)sizeof(trailer) > m_buffer.GetSize())
+      Flush();
+    memcpy(m_buffer.GetPointer() + m_bufferUsed, &trailer, sizeof(trailer));
+    m_bufferUsed += sizeof(trailer);
+    Flush();
+
+    // Wait for everything to get to disk
+    delete m_writer;
+    m_writer = NULL;
+
+    PTRACE(3, "Closed encoded recording \"" << m_file.GetFilePath() << "\", "
+           << m_streams.size() << " streams, " << (m_position + sizeof(trailer)) << " bytes");
+  }
+
+  return m_file.Close();
+}
+
+
+PINDEX OpalEncodedRecordFile::AddStream(const PString & id, const PString & format)
+{
+  PWaitAndSignal mutex(m_mutex);
+
+  if (!m_writing || m_streams.size() > 255) {
+    PTRACE(2, "Cannot add stream " << id << " to encoded recording");
+    return P_MAX_INDEX;
+  }
+
+  PINDEX index = m_streams.size();
+  m_streams.push_back(StreamInfo(id, format));
+
+  PString text = id + '\t' + format;
+  if (!WriteRecord(e_StreamRecord, (BYTE)index, text.GetPointer(), text.GetLength()))
+    return P_MAX_INDEX;
+
+  PTRACE(4, "Added stream " << index << " id=" << id << " format=" << format);
+  return index;
+}
+
+
+bool OpalEncodedRecordFile::WritePacket(PINDEX stream, const RTP_DataFrame & rtp)
+{
+  PWaitAndSignal mutex(m_mutex);
+
+  if (!m_writing || stream >= (PINDEX)m_streams.size())
+    return false;
+
+  unsigned time = (unsigned)(PTime() - m_startTime).GetMilliSeconds();
+  return WriteRecord(e_PacketRecord, (BYTE)stream, rtp.GetPayloadPtr(), rtp.GetPayloadSize(), &rtp, time);
+}
+
+
+bool OpalEncodedRecordFile::WriteRecord(BYTE type, BYTE stream, const void * data, PINDEX length, const RTP_DataFrame * rtp, unsigned time)
+{
+  PINDEX total = sizeof(EncodedRecordHeader) + length;
+  if (m_bufferUsed + total > m_buffer.GetSize()) {
+    Flush();
+    if (total > m_buffer.GetSize())
+      m_buffer.SetSize(total);
+  }
+
+  if (type == e_PacketRecord && (m_index.empty() || time >= m_index.back().m_time + EncodedIndexIntervalMS))
+    m_index.push_back(IndexEntry(time, m_position));
+
+  BYTE * ptr = m_buffer.GetPointer() + m_bufferUsed;
+  EncodedRecordHeader & header = *(EncodedRecordHeader *)ptr;
+  memset(ptr, 0, sizeof(header));
+  header.m_type = type;
+  header.m_stream = stream;
+  header.m_length = length;
+  header.m_time = time;
+  if (rtp != NULL) {
+    header.m_payloadType = (BYTE)((rtp->GetPayloadType()&0x7f) | (rtp->GetMarker() ? 0x80 : 0));
+    header.m_timestamp = rtp->GetTimestamp();
+    header.m_sequence = rtp->GetSequenceNumber();
+  }
+  if (length > 0)
+    memcpy(ptr + sizeof(header), data, length);
+
+  m_bufferUsed += total;
+  m_position += total;
+  return true;
+}
+
+
+bool OpalEncodedRecordFile::Flush()
+{
+  if (m_bufferUsed == 0)
+    return true;
+
+  if (m_writer->Write(m_buffer, m_bufferUsed)) {
+    m_bufferUsed = 0;
+    return true;
+  }
+
+  // Disk cannot keep up, drop whole records so file remains consistent
+  PTRACE(2, "Dropped " << m_bufferUsed << " bytes of encoded recording due to back pressure");
+  m_position -= m_bufferUsed;
+  while (!m_index.empty() && m_index.back().m_position >= m_position)
+    m_index.pop_back();
+  m_bufferUsed = 0;
+  return false;
+}
+
+
+bool OpalEncodedRecordFile::ReadDirectory(off_t position)
+{
+  if (!m_file.SetPosition(position))
+    return false;
+
+  off_t length = m_file.GetLength();
+  EncodedRecordHeader header;
+  while (m_file.Read(&header, sizeof(header))) {
+    if (!IsValidRecordLength(header, m_file.GetPosition(), length))
+      break;
+
+    PBYTEArray data;
+    if (header.m_length > 0 && !m_file.Read(data.GetPointer(header.m_length), header.m_length))
+      break;
+
+    switch (header.m_type) {
+      case e_StreamRecord :
+      {
+        PString text((const char *)(const BYTE *)data, data.GetSize());
+        PINDEX tab = text.Find('\t');
+        if (m_streams.size() <= header.m_stream)
+          m_streams.resize(header.m_stream+1);
+        m_streams[header.m_stream] = StreamInfo(text.Left(tab), text.Mid(tab+1));
+        break;
+      }
+
+      case e_IndexRecord :
+      {
+        const EncodedIndexEntry * entries = (const EncodedIndexEntry *)(const BYTE *)data;
+        size_t count = data.GetSize()/sizeof(EncodedIndexEntry);
+        for (size_t i = 0; i < count; ++i)
+          m_index.push_back(IndexEntry(entries[i].m_time,
+                                       ((off_t)(uint32_t)entries[i].m_positionHigh << 32) | (uint32_t)entries[i].m_positionLow));
+        m_endOfPackets = position;
+        return true;
+      }
+    }
+  }
+
+  PTRACE(2, "Invalid index in encoded recording");
+  m_streams.clear();
+  m_index.clear();
+  return false;
+}
+
+
+bool OpalEncodedRecordFile::ScanFile()
+{
+  m_endOfPackets = sizeof(EncodedFileHeader);
+  if (!m_file.SetPosition(m_endOfPackets))
+    return false;
+
+  off_t length = m_file.GetLength();
+  EncodedRecordHeader header;
+  while (m_file.Read(&header, sizeof(header))) {
+    if (!IsValidRecordLength(header, m_endOfPackets + sizeof(header), length))
+      break; // Truncated at crash, or corrupt
+
+    off_t next = m_endOfPackets + sizeof(header) + header.m_length;
+
+    if (header.m_type == e_StreamRecord) {
+      PString text;
+      if (!m_file.Read(text.GetPointerAndSetLength(header.m_length), header.m_length))
+        break;
+      PINDEX tab = text.Find('\t');
+      if (m_streams.size() <= header.m_stream)
+        m_streams.resize(header.m_stream+1);
+      m_streams[header.m_stream] = StreamInfo(text.Left(tab), text.Mid(tab+1));
+    }
+    else if (header.m_type == e_PacketRecord) {
+      if (m_index.empty() || header.m_time >= m_index.back().m_time + EncodedIndexIntervalMS)
+        m_index.push_back(IndexEntry(header.m_time, m_endOfPackets));
+      if (!m_file.SetPosition(next))
+        break;
+    }
+    else
+      break; // Directory of partially closed file
+
+    m_endOfPackets = next;
+  }
+
+  PTRACE(3, "Scanned encoded recording, " << m_endOfPackets << " bytes usable");
+  return !m_streams.empty();
+}
+
+
+bool OpalEncodedRecordFile::ReadPacket(PINDEX & stream, PTimeInterval & offset, RTP_DataFrame & rtp)
+{
+  PWaitAndSignal mutex(m_mutex);
+
+  if (m_writing || !m_file.IsOpen())
+    return false;
+
+  EncodedRecordHeader header;
+  while (m_file.GetPosition() < m_endOfPackets && m_file.Read(&header, sizeof(header))) {
+    if (!IsValidRecordLength(header, m_file.GetPosition(), m_endOfPackets))
+      return false;
+
+    if (header.m_type != e_PacketRecord) {
+      if (!m_file.SetPosition(m_file.GetPosition() + header.m_length))
+        return false;
+      continue;
+    }
+
+    rtp.SetPayloadSize(header.m_length);
+    if (!m_file.Read(rtp.GetPayloadPtr(), header.m_length))
+      return false;
+
+    rtp.SetPayloadType((RTP_DataFrame::PayloadTypes)(header.m_payloadType&0x7f));
+    rtp.SetMarker((header.m_payloadType&0x80) != 0);
+    rtp.SetTimestamp(header.m_timestamp);
+    rtp.SetSequenceNumber(header.m_sequence);
+    stream = header.m_stream;
+    offset = PTimeInterval((PInt64)header.m_time);
+    return true;
+  }
+
+  return false;
+}
+
+
+bool OpalEncodedRecordFile::Seek(const PTimeInterval & offset)
+{
+  PWaitAndSignal mutex(m_mutex);
+
+  if (m_writing || !m_file.IsOpen())
+    return false;
+
+  unsigned time = (unsigned)offset.GetMilliSeconds();
+  Index::iterator it = m_index.begin();
+  while (it != m_index.end() && it->m_time <= time)
+    ++it;
+
+  return m_file.SetPosition(it == m_index.begin() ? (off_t)sizeof(EncodedFileHeader) : (it-1)->m_position);
+}
+
+
+bool OpalEncodedRecordFile::Render(const PFilePath & input, const PFilePath & output, const OpalRecordManager::Options & options)
+{
+  OpalEncodedRecordFile file;
+  if (!file.Open(input))
+    return false;
+
+  std::auto_ptr<OpalRecordManager> manager(OpalRecordManager::Factory::CreateInstance(output.GetType()));
+  if (manager.get() == NULL || manager->IsPassThrough()) {
+    PTRACE(2, "Cannot render to file type " << output);
+    return false;
+  }
+
+  // No threads, media is pushed according to the recorded times
+  OpalRecordManager::Options renderOptions = options;
+  renderOptions.m_pushThreads = false;
+  if (!manager->Open(output, renderOptions))
+    return false;
+
+  const StreamList & streams = file.GetStreams();
+  std::vector<OpalTranscoder *> decoders(streams.size());
+  for (size_t i = 0; i < streams.size(); ++i) {
+    OpalMediaFormat encoded(streams[i].m_format);
+    OpalMediaFormat raw;
+    if (encoded.GetMediaType() == OpalMediaType::Audio())
+      raw = GetOpalPCM16(encoded.GetClockRate());
+#if OPAL_VIDEO
+    else if (encoded.GetMediaType() == OpalMediaType::Video())
+      raw = OpalYUV420P;
+#endif
+    else {
+      PTRACE(2, "Cannot render stream " << streams[i].m_id << " with format \"" << streams[i].m_format << '"');
+      continue;
+    }
+
+    decoders[i] = OpalTranscoder::Create(encoded, raw);
+    if (decoders[i] == NULL) {
+      PTRACE(2, "No decoder for stream " << streams[i].m_id << " from " << encoded << " to " << raw);
+      continue;
+    }
+
+    if (!manager->OpenStream(streams[i].m_id, raw)) {
+      delete decoders[i];
+      decoders[i] = NULL;
+    }
+  }
+
+  PINDEX stream;
+  PTimeInterval offset;
+  RTP_DataFrame encodedFrame;
+  RTP_DataFrameList decodedFrames;
+  while (file.ReadPacket(stream, offset, encodedFrame)) {
+    if (stream >= (PINDEX)decoders.size() || decoders[stream] == NULL)
+      continue;
+
+    if (!manager->OnPushMedia(file.GetStartTime() + offset))
+      break;
+
+    if (!decoders[stream]->ConvertFrames(encodedFrame, decodedFrames)) {
+      PTRACE(4, "Decode failed on stream " << streams[stream].m_id);
+      continue;
+    }
+
+    for (RTP_DataFrameList::iterator it = decodedFrames.begin(); it != decodedFrames.end(); ++it)
+      manager->WriteStream(streams[stream].m_id, *it);
+  }
+
+  // Push out anything left in the mixers
+  manager->OnPushMedia(file.GetStartTime() + offset + PTimeInterval(0, 1));
+
+  for (size_t i = 0; i < decoders.size(); ++i) {
+    if (decoders[i] != NULL) {
+      manager->CloseStream(streams[i].m_id);
+      delete decoders[i];
+    }
+  }
+
+  PTRACE(3, "Rendered \"" << input << "\" to \"" << output << '"');
+  return manager->Close();
+}
+
+
+//////////////////////////////////////////////////////////////////////////////
+
+/** This class manages the pass through recording of OPAL calls to an
+    OpalEncodedRecordFile.
+  */
+class OpalEncodedRecordManager : public OpalRecordManager
+{
+  public:
+    ~OpalEncodedRecordManager()
+    {
+      Close();
+    }
+
+    virtual bool OpenFile(const PFilePath & fn)
+    {
+      return OpalRecordManager::OpenFile(fn) && m_file.Create(fn);
+    }
+
+    virtual bool IsOpen() const { return m_file.IsOpen(); }
+    virtual bool Close() { return m_file.Close(); }
+    virtual bool IsPassThrough() const { return true; }
+
+    virtual bool OpenStream(const PString & strmId, const OpalMediaFormat & format)
+    {
+      PWaitAndSignal mutex(m_mutex);
+
+      if (!OpalRecordManager::OpenStream(strmId, format))
+        return false;
+
+      PINDEX index = m_file.AddStream(strmId, format.GetName());
+      if (index == P_MAX_INDEX)
+        return false;
+
+      m_streamIndex[strmId] = index;
+      return true;
+    }
+
+    virtual bool WriteStream(const PString & strmId, const RTP_DataFrame & rtp)
+    {
+      m_mutex.Wait();
+      std::map<PString, PINDEX>::const_iterator it = m_streamIndex.find(strmId);
+      PINDEX index = it != m_streamIndex.end() ? it->second : P_MAX_INDEX;
+      m_mutex.Signal();
+
+      return index != P_MAX_INDEX && m_file.WritePacket(index, rtp);
+    }
+
+    virtual bool CloseStream(const PString & strmId)
+    {
+      PWaitAndSignal mutex(m_mutex);
+      m_streamIndex.erase(strmId);
+      return OpalRecordManager::CloseStream(strmId);
+    }
+
+  protected:
+    // Nothing to mix, so nothing to push
+    virtual bool OnPushAudio() { return true; }
+    virtual unsigned GetPushAudioPeriodMS() const { return 1000; }
+    virtual bool WriteAudio(const PString & strmId, const RTP_DataFrame & rtp) { return WriteStream(strmId, rtp); }
+#if OPAL_VIDEO
+    virtual bool OnPushVideo() { return true; }
+    virtual unsigned GetPushVideoPeriodMS() const { return 1000; }
+    virtual bool WriteVideo(const PString & strmId, const RTP_DataFrame & rtp) { return WriteStream(strmId, rtp); }
+#endif
+
+    OpalEncodedRecordFile     m_file;
+    std::map<PString, PINDEX> m_streamIndex;
+    PDECLARE_MUTEX(m_mutex);
+};
+
+PFACTORY_CREATE(OpalRecordManager::Factory, OpalEncodedRecordManager, ".oprec", false);
+
+
+
 #endif // OPAL_HAS_MIXER
 
 
@@ -43,11 +43,197 @@
 #include <opal/manager.h>
 #include <opal/endpoint.h>
 #include <opal/connection.h>
+#include <ptclib/random.h>
+
+#include <openssl/ssl.h>
+#include <openssl/evp.h>
+#include <openssl/ec.h>
+
+#include <algorithm>
 
 
 #define PTraceModule() "DTLS"
 
 
+OpalDTLSIdentity::OpalDTLSIdentity()
+  : m_created(0)
+{
+}
+
+
+PSSLCertificateFingerprint OpalDTLSIdentity::GetFingerprint(PSSLCertificateFingerprint::HashType hashType) const
+{
+  if (hashType < PSSLCertificateFingerprint::NumHashType && m_fingerprints[hashType].IsValid())
+    return m_fingerprints[hashType];
+  return PSSLCertificateFingerprint(hashType, m_certificate);
+}
+
+
+OpalDTLSIdentityPool::OpalDTLSIdentityPool(unsigned size, const PTimeInterval & lifetime)
+  : m_size(std::max(size, 1U))
+  , m_lifetime(lifetime)
+  , m_next(0)
+  , m_ticketKeysCreated(0)
+  , m_thread(NULL)
+  , m_running(false)
+{
+  RotateTicketKeys();
+}
+
+
+OpalDTLSIdentityPool::~OpalDTLSIdentityPool()
+{
+  m_running = false;
+  m_wakeUp.Signal();
+  PThread::WaitAndDelete(m_thread);
+}
+
+
+void OpalDTLSIdentityPool::SetSize(unsigned size)
+{
+  PWaitAndSignal lock(m_mutex);
+  m_size = std::max(size, 1U);
+  if (m_identities.size() > m_size)
+    m_identities.resize(m_size);
+  m_wakeUp.Signal();
+}
+
+
+PBYTEArray OpalDTLSIdentityPool::GetTicketKeys() const
+{
+  PWaitAndSignal lock(m_mutex);
+  return m_ticketKeys;
+}
+
+
+void OpalDTLSIdentityPool::RotateTicketKeys()
+{
+  // Replace rather than overwrite, transports may still have the old ones
+  PBYTEArray keys(48);
+  PRandom::Octets(keys.GetPointer(), keys.GetSize());
+  m_ticketKeys = keys;
+  m_ticketKeysCreated.SetCurrentTime();
+  PTRACE(4, "DTLS session ticket keys rotated");
+}
+
+
+static bool CreateECDSAKey(PSSLPrivateKey & key)
+{
+  // ECDSA P-256 as per WebRTC, about a hundred times faster than RSA to create
+  EVP_PKEY * pkey = NULL;
+  EVP_PKEY_CTX * ctx = EVP_PKEY_CTX_new_id(EVP_PKEY_EC, NULL);
+  if (ctx != NULL &&
+      EVP_PKEY_keygen_init(ctx) > 0 &&
+      EVP_PKEY_CTX_set_ec_paramgen_curve_nid(ctx, NID_X9_62_prime256v1) > 0 &&
+      EVP_PKEY_keygen(ctx, &pkey) > 0) {
+    int length = i2d_PrivateKey(pkey, NULL);
+    if (length > 0) {
+      PBYTEArray der(length);
+      BYTE * ptr = der.GetPointer();
+      i2d_PrivateKey(pkey, &ptr);
+      key = PSSLPrivateKey(der, length);
+    }
+  }
+  EVP_PKEY_free(pkey);
+  EVP_PKEY_CTX_free(ctx);
+
+  return key.IsValid();
+}
+
+
+bool OpalDTLSIdentityPool::Generate(OpalDTLSIdentity & identity)
+{
+  PTRACE(4, "Generating DTLS identity");
+
+  PStringStream subject;
+  subject << "/O=" << PProcess::Current().GetManufacturer() << "/CN=" << PProcess::Current().GetName();
+
+  // Some OpenSSL builds can make an EC key but not sign a certificate with it
+  if (!CreateECDSAKey(identity.m_privateKey) || !identity.m_certificate.CreateRoot(subject, identity.m_privateKey)) {
+    PTRACE(2, "Could not create ECDSA identity for DTLS, using RSA");
+    identity.m_privateKey = PSSLPrivateKey();
+    identity.m_certificate = PSSLCertificate();
+    if (!identity.m_privateKey.Create(1024) || !identity.m_certificate.CreateRoot(subject, identity.m_privateKey))
+      return false;
+  }
+
+  // These are the ones SDP uses
+  identity.m_fingerprints[PSSLCertificateFingerprint::HashSha1] =
+                PSSLCertificateFingerprint(PSSLCertificateFingerprint::HashSha1, identity.m_certificate);
+  identity.m_fingerprints[PSSLCertificateFingerprint::HashSha256] =
+                PSSLCertificateFingerprint(PSSLCertificateFingerprint::HashSha256, identity.m_certificate);
+
+  identity.m_created.SetCurrentTime();
+  return true;
+}
+
+
+bool OpalDTLSIdentityPool::GetIdentity(OpalDTLSIdentity & identity)
+{
+  {
+    PWaitAndSignal lock(m_mutex);
+
+    if (!m_running.exchange(true))
+      m_thread = new PThreadObj<OpalDTLSIdentityPool>(*this, &OpalDTLSIdentityPool::GeneratorMain, false, "DTLS-Identity", PThread::LowPriority);
+
+    if (!m_identities.empty()) {
+      identity = m_identities[m_next++ % m_identities.size()];
+      return true;
+    }
+  }
+
+  // Background thread has not got there yet, have to do it here
+  PTRACE(3, "No pooled DTLS identity available, generating one");
+  return Generate(identity);
+}
+
+
+void OpalDTLSIdentityPool::GeneratorMain()
+{
+  PTRACE(4, "DTLS identity generator started");
+
+  while (m_running) {
+    m_mutex.Wait();
+    if (m_ticketKeysCreated + m_lifetime <= PTime())
+      RotateTicketKeys();
+    PTimeInterval untilRotation = m_ticketKeysCreated + m_lifetime - PTime();
+
+    size_t count = m_identities.size();
+    size_t oldest = 0;
+    for (size_t i = 1; i < count; ++i) {
+      if (m_identities[i].m_created < m_identities[oldest].m_created)
+        oldest = i;
+    }
+    bool needMore = count < m_size;
+    PTimeInterval untilExpiry = count > 0 ? m_identities[oldest].m_created + m_lifetime - PTime() : PTimeInterval(0);
+    m_mutex.Signal();
+
+    if (!needMore && untilExpiry > 0) {
+      m_wakeUp.Wait(std::min(untilExpiry, untilRotation));
+      continue;
+    }
+
+    // Generate outside the lock, so transports are never kept waiting
+    OpalDTLSIdentity identity;
+    if (!Generate(identity)) {
+      PTRACE(1, "Could not generate DTLS identity");
+      m_wakeUp.Wait(PTimeInterval(0, 10));
+      continue;
+    }
+
+    PWaitAndSignal lock(m_mutex);
+    if (m_identities.size() < m_size)
+      m_identities.push_back(identity);
+    else if (oldest < m_identities.size())
+      m_identities[oldest] = identity;
+  }
+
+  PTRACE(4, "DTLS identity generator ended");
+}
+
+
+/////////////////////////////////////////////////////////////////////////////
+
 class OpalDTLSContext : public PSSLContext
 {
     PCLASSINFO(OpalDTLSContext, PSSLContext);
@@ -55,18 +241,26 @@ class OpalDTLSContext : public PSSLContext
     OpalDTLSContext(const OpalDTLSMediaTransport & transport)
       : PSSLContext(PSSLContext::DTLSv1_2_v1_0)
     {
-      if (!UseCertificate(transport.m_certificate))
+      if (!UseCertificate(transport.m_identity.m_certificate))
       {
         PTRACE(1, "Could not use DTLS certificate.");
         return;
       }
 
-      if (!UsePrivateKey(transport.m_privateKey))
+      if (!UsePrivateKey(transport.m_identity.m_privateKey))
       {
         PTRACE(1, "Could not use private key for DTLS.");
         return;
       }
 
+      // Same ticket key in every context, so any transport can resume a session
+      if (transport.m_ticketKeys.GetSize() == 48) {
+        ssl_ctx_st * ctx = *this;
+        SSL_CTX_clear_options(ctx, SSL_OP_NO_TICKET);
+        if (SSL_CTX_set_tlsext_ticket_keys(ctx, (void *)(const BYTE *)transport.m_ticketKeys, 48) <= 0)
+          PTRACE(2, "Could not set DTLS session ticket keys.");
+      }
+
       /* Place into the DTLS negotiation extension the crypto suites we support in order
         of their strength. Especially 80 bit salt over 32 bit salt. */
       std::map<unsigned, PString> cryptoSuitesByStrength;
@@ -242,7 +436,6 @@ OpalDTLSMediaTransport::OpalDTLSMediaTransport(const PString & name, bool passiv
   , m_passiveMode(passiveMode)
   , m_handshakeTimeout(0, 2)
   , m_MTU(1400)
-  , m_privateKey(1024)
   , m_remoteFingerprint(fp)
 {
 }
@@ -253,15 +446,15 @@ bool OpalDTLSMediaTransport::Open(OpalMediaSession & session,
                                   const PString & localInterface,
                                   const OpalTransportAddress & remoteAddress)
 {
-  PStringStream subject;
-  subject << "/O=" + PProcess::Current().GetManufacturer() << "/CN=" << GetLocalAddress().Mid(4);
-  if (!m_certificate.CreateRoot(subject, m_privateKey)) {
+  OpalManager & manager = session.GetConnection().GetEndPoint().GetManager();
+  OpalDTLSIdentityPool & identities = manager.GetDTLSIdentityPool();
+  if (!identities.GetIdentity(m_identity)) {
     PTRACE(1, "Could not create certificate for DTLS.");
     return false;
   }
+  m_ticketKeys = identities.GetTicketKeys();
 
-  m_handshakeTimeout = session.GetStringOptions().GetVar(OPAL_OPT_DTLS_TIMEOUT,
-                       session.GetConnection().GetEndPoint().GetManager().GetDTLSTimeout());
+  m_handshakeTimeout = session.GetStringOptions().GetVar(OPAL_OPT_DTLS_TIMEOUT, manager.GetDTLSTimeout());
   m_MTU = session.GetConnection().GetMaxRtpPayloadSize();
 
   return OpalDTLSMediaTransportParent::Open(session, count, localInterface, remoteAddress);
@@ -296,7 +489,7 @@ bool OpalDTLSMediaTransport::GetKeyInfo(OpalMediaCryptoKeyInfo * keyInfo[2])
 
 PSSLCertificateFingerprint OpalDTLSMediaTransport::GetLocalFingerprint(PSSLCertificateFingerprint::HashType hashType) const
 {
-  return PSSLCertificateFingerprint(hashType, m_certificate);
+  return m_identity.GetFingerprint(hashType);
 }
 
 
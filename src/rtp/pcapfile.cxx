@@ -36,6 +36,15 @@
 #include <rtp/pcapfile.h>
 #include <codec/vidcodec.h>
 
+#include <algorithm>
+#include <limits>
+#include <list>
+#include <queue>
+
+#ifndef _WIN32
+#include <sys/mman.h>
+#endif
+
 
 #define PTraceModule() "PCAPFile"
 
@@ -55,10 +64,51 @@ void Reverse(char * ptr, size_t sz)
 #define REVERSE(p) Reverse((char *)&p, sizeof(p))
 
 
+static DWORD GetDWORD(const BYTE * ptr, bool otherEndian)
+{
+  DWORD value;
+  memcpy(&value, ptr, sizeof(value));
+  if (otherEndian)
+    REVERSE(value);
+  return value;
+}
+
+
+static WORD GetWORD(const BYTE * ptr, bool otherEndian)
+{
+  WORD value;
+  memcpy(&value, ptr, sizeof(value));
+  if (otherEndian)
+    REVERSE(value);
+  return value;
+}
+
+
+static const DWORD ClassicMagic              = 0xa1b2c3d4;
+static const DWORD ClassicNanoMagic          = 0xa1b23c4d;
+static const DWORD SectionHeaderBlock        = 0x0a0d0d0a;
+static const DWORD ByteOrderMagic            = 0x1a2b3c4d;
+static const DWORD InterfaceDescriptionBlock = 1;
+static const DWORD SimplePacketBlock         = 3;
+static const DWORD EnhancedPacketBlock       = 6;
+static const WORD  TimestampResolutionOption = 9;
+static const size_t MinBlockSize             = 12;
+static const size_t MaxRecordSize            = 0x10000000; // Sanity check when not mapped
+static const off_t DiscoveryChunkSize        = 16*1024*1024;
+
+
 ///////////////////////////////////////////////////////////////////////////////
 
 OpalPCAPFile::OpalPCAPFile()
-  : m_filterSSRC(0)
+  : m_dataStart(sizeof(m_fileHeader))
+  , m_discoveryChunkSize(DiscoveryChunkSize)
+  , m_mappedData(NULL)
+  , m_mappedSize(0)
+  , m_mappedPosition(0)
+#ifdef _WIN32
+  , m_mappingHandle(NULL)
+#endif
+  , m_filterSSRC(0)
 {
   OpalMediaFormatList list = OpalMediaFormat::GetAllRegisteredMediaFormats();
   for (OpalMediaFormatList::iterator it = list.begin(); it != list.end(); ++it) {
@@ -72,6 +122,112 @@ OpalPCAPFile::OpalPCAPFile()
 }
 
 
+OpalPCAPFile::~OpalPCAPFile()
+{
+  UnmapFile();
+}
+
+
+PBoolean OpalPCAPFile::Close()
+{
+  UnmapFile();
+  return PFile::Close();
+}
+
+
+PBoolean OpalPCAPFile::IsEndOfFile() const
+{
+  return m_mappedData != NULL ? m_mappedPosition >= m_mappedSize : PFile::IsEndOfFile();
+}
+
+
+off_t OpalPCAPFile::GetPosition() const
+{
+  return m_mappedData != NULL ? m_mappedPosition : PFile::GetPosition();
+}
+
+
+PBoolean OpalPCAPFile::SetPosition(off_t pos, FilePositionOrigin origin)
+{
+  if (m_mappedData == NULL)
+    return PFile::SetPosition(pos, origin);
+
+  switch (origin) {
+    case Current :
+      pos += m_mappedPosition;
+      break;
+    case End :
+      pos += m_mappedSize;
+      break;
+    default :
+      break;
+  }
+
+  if (pos < 0 || pos > m_mappedSize)
+    return false;
+
+  m_mappedPosition = pos;
+  return true;
+}
+
+
+bool OpalPCAPFile::MapFile()
+{
+  off_t length = GetLength();
+  if (length <= 0 || (uint64_t)length > (uint64_t)std::numeric_limits<size_t>::max())
+    return false;
+
+#ifdef _WIN32
+  m_mappingHandle = CreateFileMapping((HANDLE)_get_osfhandle(GetHandle()), NULL, PAGE_READONLY, 0, 0, NULL);
+  if (m_mappingHandle == NULL) {
+    PTRACE(3, "Could not create mapping for \"" << GetFilePath() << "\", error=" << ::GetLastError());
+    return false;
+  }
+
+  m_mappedData = (const BYTE *)MapViewOfFile(m_mappingHandle, FILE_MAP_READ, 0, 0, 0);
+  if (m_mappedData == NULL) {
+    PTRACE(3, "Could not map view of \"" << GetFilePath() << "\", error=" << ::GetLastError());
+    CloseHandle(m_mappingHandle);
+    m_mappingHandle = NULL;
+    return false;
+  }
+#else
+  void * mapping = mmap(NULL, (size_t)length, PROT_READ, MAP_SHARED, GetHandle(), 0);
+  if (mapping == MAP_FAILED) {
+    PTRACE(3, "Could not memory map \"" << GetFilePath() << "\", errno=" << errno);
+    return false;
+  }
+#ifdef MADV_SEQUENTIAL
+  madvise(mapping, (size_t)length, MADV_SEQUENTIAL);
+#endif
+  m_mappedData = (const BYTE *)mapping;
+#endif
+
+  m_mappedSize = length;
+  m_mappedPosition = PFile::GetPosition();
+  PTRACE(4, "Memory mapped " << length << " bytes of \"" << GetFilePath() << '"');
+  return true;
+}
+
+
+void OpalPCAPFile::UnmapFile()
+{
+  if (m_mappedData == NULL)
+    return;
+
+#ifdef _WIN32
+  UnmapViewOfFile(m_mappedData);
+  CloseHandle(m_mappingHandle);
+  m_mappingHandle = NULL;
+#else
+  munmap((void *)m_mappedData, (size_t)m_mappedSize);
+#endif
+
+  m_mappedData = NULL;
+  m_mappedSize = m_mappedPosition = 0;
+}
+
+
 bool OpalPCAPFile::InternalOpen(OpenMode mode, OpenOptions opts, PFileInfo::Permissions permissions)
 {
   PAssert(mode != PFile::ReadWrite, PInvalidParameter);
@@ -100,33 +256,54 @@ bool OpalPCAPFile::InternalOpen(OpenMode mode, OpenOptions opts, PFileInfo::Perm
     return false;
   }
 
-  if (m_fileHeader.magic_number == 0xa1b2c3d4)
-    m_rawPacket.m_otherEndian = false;
-  else if (m_fileHeader.magic_number == 0xd4c3b2a1)
-    m_rawPacket.m_otherEndian = true;
-  else {
-    PTRACE(1, "File \"" << GetFilePath() << "\" is not a PCAP file, bad magic number.");
-    return false;
+  m_format = RecordFormat();
+
+  if (m_fileHeader.magic_number == SectionHeaderBlock) {
+    // pcapng, the section header block is parsed as the first record
+    const BYTE * header = (const BYTE *)&m_fileHeader;
+    m_format.m_nextGen = true;
+    m_format.m_otherEndian = GetDWORD(header+8, false) != ByteOrderMagic;
+    m_fileHeader.version_major = GetWORD(header+12, m_format.m_otherEndian);
+    m_fileHeader.version_minor = GetWORD(header+14, m_format.m_otherEndian);
+    m_dataStart = 0;
   }
+  else {
+    DWORD magic = m_fileHeader.magic_number;
+    if (magic != ClassicMagic && magic != ClassicNanoMagic) {
+      REVERSE(magic);
+      m_format.m_otherEndian = true;
+    }
+
+    if (magic == ClassicNanoMagic)
+      m_format.m_nanoSeconds = true;
+    else if (magic != ClassicMagic) {
+      PTRACE(1, "File \"" << GetFilePath() << "\" is not a PCAP file, bad magic number.");
+      return false;
+    }
 
-  if (m_rawPacket.m_otherEndian) {
-    REVERSE(m_fileHeader.version_major);
-    REVERSE(m_fileHeader.version_minor);
-    REVERSE(m_fileHeader.thiszone);
-    REVERSE(m_fileHeader.sigfigs);
-    REVERSE(m_fileHeader.snaplen);
-    REVERSE(m_fileHeader.network);
+    if (m_format.m_otherEndian) {
+      REVERSE(m_fileHeader.version_major);
+      REVERSE(m_fileHeader.version_minor);
+      REVERSE(m_fileHeader.thiszone);
+      REVERSE(m_fileHeader.sigfigs);
+      REVERSE(m_fileHeader.snaplen);
+      REVERSE(m_fileHeader.network);
+    }
+
+    m_format.m_interfaces.push_back(RecordFormat::Interface(m_fileHeader.network, m_fileHeader.snaplen));
+    m_dataStart = sizeof(m_fileHeader);
   }
 
-  m_rawPacket.SetDataLinkType(m_fileHeader.network);
+  // If we cannot map it, just read it
+  MapFile();
 
-  return true;
+  return Restart();
 }
 
 
 bool OpalPCAPFile::Restart()
 {
-  if (SetPosition(sizeof(m_fileHeader)))
+  if (SetPosition(m_dataStart))
     return true;
 
   PTRACE(2, "Could not seek beginning of \"" << GetFilePath() << '"');
@@ -136,7 +313,7 @@ bool OpalPCAPFile::Restart()
 
 void OpalPCAPFile::PrintOn(ostream & strm) const
 {
-  strm << "PCAP v" << m_fileHeader.version_major << '.' << m_fileHeader.version_minor
+  strm << (m_format.m_nextGen ? "PCAPNG v" : "PCAP v") << m_fileHeader.version_major << '.' << m_fileHeader.version_minor
                    << " file \"" << GetFilePath() << '"';
 }
 
@@ -163,44 +340,230 @@ bool OpalPCAPFile::WriteRTP(const RTP_DataFrame & rtp, WORD port)
 }
 
 
-bool OpalPCAPFile::Frame::Read(PChannel & channel, PINDEX)
+void OpalPCAPFile::Frame::Attach(const BYTE * data, PINDEX size, time_t seconds, unsigned microseconds, unsigned linkType)
 {
   PreRead();
+  SetDataLinkType(linkType);
+  m_timestamp.SetTimestamp(seconds, microseconds);
+  m_rawData.Attach(data, size); // No copy, points into mapping or record buffer, see CopyPayload()
+  m_rawSize = size;
+}
 
-  RecordHeader recordHeader;
-  if (!channel.Read(&recordHeader, sizeof(recordHeader))) {
-    PTRACE(1, "Truncated file \"" << channel.GetName() << '"');
-    return false;
+
+OpalPCAPFile::RecordFormat::RecordFormat()
+  : m_nextGen(false)
+  , m_otherEndian(false)
+  , m_nanoSeconds(false)
+{
+}
+
+
+size_t OpalPCAPFile::RecordFormat::Parse(const BYTE * data, size_t available, bool & isPacket, Frame * frame)
+{
+  isPacket = false;
+
+  if (!m_nextGen) {
+    if (available < sizeof(RecordHeader) || m_interfaces.empty())
+      return 0;
+
+    DWORD length = GetDWORD(data+8, m_otherEndian);
+    if (length > available - sizeof(RecordHeader))
+      return 0;
+
+    isPacket = true;
+    if (frame != NULL) {
+      DWORD fraction = GetDWORD(data+4, m_otherEndian);
+      frame->Attach(data+sizeof(RecordHeader), length, GetDWORD(data, m_otherEndian),
+                    m_nanoSeconds ? fraction/1000 : fraction, m_interfaces.front().m_linkType);
+    }
+    return sizeof(RecordHeader)+length;
   }
 
-  if (m_otherEndian) {
-    REVERSE(recordHeader.ts_sec);
-    REVERSE(recordHeader.ts_usec);
-    REVERSE(recordHeader.incl_len);
-    REVERSE(recordHeader.orig_len);
+  if (available < MinBlockSize)
+    return 0;
+
+  DWORD type = GetDWORD(data, m_otherEndian);
+  if (type == SectionHeaderBlock) {
+    // Each section can have a different byte order, and has its own interfaces
+    DWORD magic = GetDWORD(data+8, false);
+    if (magic == ByteOrderMagic)
+      m_otherEndian = false;
+    else {
+      REVERSE(magic);
+      if (magic != ByteOrderMagic)
+        return 0;
+      m_otherEndian = true;
+    }
+    m_interfaces.clear();
   }
 
-  m_timestamp.SetTimestamp(recordHeader.ts_sec, recordHeader.ts_usec);
+  DWORD length = GetDWORD(data+4, m_otherEndian);
+  if (length < MinBlockSize || (length&3) != 0 || length > available)
+    return 0;
 
-  if (!channel.Read(m_rawData.GetPointer(recordHeader.incl_len), recordHeader.incl_len)) {
-    PTRACE(1, "Truncated file \"" << channel.GetName() << '"');
+  switch (type) {
+    case InterfaceDescriptionBlock :
+      if (length >= 20) {
+        Interface intf(GetWORD(data+8, m_otherEndian), GetDWORD(data+12, m_otherEndian));
+
+        const BYTE * option = data+16;
+        const BYTE * end = data+length-4;
+        while (option+4 <= end) {
+          WORD code = GetWORD(option, m_otherEndian);
+          WORD optionLength = GetWORD(option+2, m_otherEndian);
+          if (code == 0 || option+4+optionLength > end)
+            break;
+
+          if (code == TimestampResolutionOption && optionLength >= 1) {
+            BYTE resolution = option[4];
+            unsigned exponent = resolution&0x7f;
+            if ((resolution&0x80) != 0) {
+              if (exponent < 64)
+                intf.m_unitsPerSecond = (uint64_t)1 << exponent;
+            }
+            else if (exponent < 20) {
+              intf.m_unitsPerSecond = 1;
+              while (exponent-- > 0)
+                intf.m_unitsPerSecond *= 10;
+            }
+          }
+
+          option += 4 + ((optionLength+3)&~3);
+        }
+
+        m_interfaces.push_back(intf);
+      }
+      break;
+
+    case EnhancedPacketBlock :
+      if (length >= 32) {
+        DWORD id = GetDWORD(data+8, m_otherEndian);
+        DWORD captured = GetDWORD(data+20, m_otherEndian);
+        if (id < m_interfaces.size() && captured <= length-32) {
+          isPacket = true;
+          if (frame != NULL) {
+            const Interface & intf = m_interfaces[id];
+            uint64_t timestamp = ((uint64_t)GetDWORD(data+12, m_otherEndian) << 32) | GetDWORD(data+16, m_otherEndian);
+            frame->Attach(data+28, captured,
+                          (time_t)(timestamp/intf.m_unitsPerSecond),
+                          (unsigned)((timestamp%intf.m_unitsPerSecond)*1e6/intf.m_unitsPerSecond),
+                          intf.m_linkType);
+          }
+        }
+      }
+      break;
+
+    case SimplePacketBlock :
+      if (length >= 16 && !m_interfaces.empty()) {
+        isPacket = true;
+        if (frame != NULL) {
+          const Interface & intf = m_interfaces.front();
+          DWORD captured = std::min(GetDWORD(data+8, m_otherEndian), (DWORD)length-16);
+          if (intf.m_snapLength > 0 && captured > intf.m_snapLength)
+            captured = intf.m_snapLength;
+          frame->Attach(data+12, captured, 0, 0, intf.m_linkType); // No timestamp in this block type
+        }
+      }
+      break;
+
+    default :
+      break; // Skip everything else
+  }
+
+  return length;
+}
+
+
+bool OpalPCAPFile::ReadRecord(const BYTE * & data, size_t & available)
+{
+  if (m_mappedData != NULL) {
+    if (m_mappedPosition >= m_mappedSize)
+      return false;
+    data = m_mappedData + m_mappedPosition;
+    available = (size_t)(m_mappedSize - m_mappedPosition);
+    return true;
+  }
+
+  // Read enough to get the record length, then the rest of it
+  size_t headerSize = m_format.m_nextGen ? MinBlockSize : sizeof(RecordHeader);
+  BYTE * header = m_recordBuffer.GetPointer(headerSize);
+  if (!Read(header, headerSize))
+    return false;
+
+  size_t length;
+  if (m_format.m_nextGen) {
+    bool otherEndian = m_format.m_otherEndian;
+    if (GetDWORD(header, false) == SectionHeaderBlock)
+      otherEndian = GetDWORD(header+8, false) != ByteOrderMagic;
+    length = GetDWORD(header+4, otherEndian);
+  }
+  else
+    length = sizeof(RecordHeader) + GetDWORD(header+8, m_format.m_otherEndian);
+
+  if (length < headerSize || length > MaxRecordSize) {
+    PTRACE(1, "Corrupt record in file \"" << GetFilePath() << '"');
+    return false;
+  }
+
+  if (length > headerSize && !Read(m_recordBuffer.GetPointer(length)+headerSize, length-headerSize)) {
+    PTRACE(1, "Truncated file \"" << GetFilePath() << '"');
     return false;
   }
 
-  m_rawSize = recordHeader.incl_len;
+  data = m_recordBuffer;
+  available = length;
   return true;
 }
 
 
+bool OpalPCAPFile::ReadFrame(Frame & frame)
+{
+  const BYTE * data;
+  size_t available;
+  while (ReadRecord(data, available)) {
+    bool isPacket;
+    size_t length = m_format.Parse(data, available, isPacket, &frame);
+    if (length == 0) {
+      PTRACE(1, "Truncated or corrupt file \"" << GetFilePath() << '"');
+      SetPosition(0, End);
+      return false;
+    }
+
+    if (m_mappedData != NULL)
+      m_mappedPosition += length;
+
+    if (isPacket)
+      return true;
+  }
+
+  return false;
+}
+
+
+/* Frames refer directly to the read only memory mapped file, or to a buffer
+   reused for the next record, so packets handed out get their own copy which
+   the caller is free to modify, e.g. RTP header setters, or keep. */
+static void CopyPayload(PBYTEArray & payload)
+{
+  PBYTEArray copy((const BYTE *)payload, payload.GetSize());
+  payload = copy;
+}
+
+
 int OpalPCAPFile::GetDataLink(PBYTEArray & payload)
 {
-  return m_rawPacket.Read(*this) ? m_rawPacket.GetDataLink(payload) : -1;
+  if (!ReadFrame(m_rawPacket))
+    return -1;
+
+  int type = m_rawPacket.GetDataLink(payload);
+  CopyPayload(payload);
+  return type;
 }
 
 
 int OpalPCAPFile::GetIP(PBYTEArray & payload)
 {
-  if (!m_rawPacket.Read(*this))
+  if (!ReadFrame(m_rawPacket))
     return -1;
 
   PIPSocket::Address src, dst;
@@ -211,34 +574,43 @@ int OpalPCAPFile::GetIP(PBYTEArray & payload)
   m_packetSrc.SetAddress(src);
   m_packetDst.SetAddress(dst);
 
-  return (m_filterSrc.GetAddress().IsValid() && m_filterSrc.GetAddress() != src) ||
-         (m_filterDst.GetAddress().IsValid() || m_filterDst.GetAddress() == dst) ? -1 : type;
+  if ((m_filterSrc.GetAddress().IsValid() && m_filterSrc.GetAddress() != src) ||
+      (m_filterDst.GetAddress().IsValid() || m_filterDst.GetAddress() == dst))
+    return -1;
+
+  CopyPayload(payload);
+  return type;
 }
 
 
 int OpalPCAPFile::GetTCP(PBYTEArray & payload)
 {
-  return m_rawPacket.Read(*this) &&
-         m_rawPacket.GetTCP(payload, m_packetSrc, m_packetDst) &&
-         m_packetSrc.MatchWildcard(m_filterSrc) &&
-         m_packetDst.MatchWildcard(m_filterDst)
-         ? payload.GetSize() : -1;
+  if (!ReadFrame(m_rawPacket) ||
+      !m_rawPacket.GetTCP(payload, m_packetSrc, m_packetDst) ||
+      !m_packetSrc.MatchWildcard(m_filterSrc) ||
+      !m_packetDst.MatchWildcard(m_filterDst))
+    return -1;
+
+  CopyPayload(payload);
+  return payload.GetSize();
 }
 
 
 int OpalPCAPFile::GetUDP(PBYTEArray & payload)
 {
-  return m_rawPacket.Read(*this) &&
-         m_rawPacket.GetUDP(payload, m_packetSrc, m_packetDst) &&
-         m_packetSrc.MatchWildcard(m_filterSrc) &&
-         m_packetDst.MatchWildcard(m_filterDst)
-         ? payload.GetSize() : -1;
+  if (!ReadFrame(m_rawPacket) ||
+      !m_rawPacket.GetUDP(payload, m_packetSrc, m_packetDst) ||
+      !m_packetSrc.MatchWildcard(m_filterSrc) ||
+      !m_packetDst.MatchWildcard(m_filterDst))
+    return -1;
+
+  CopyPayload(payload);
+  return payload.GetSize();
 }
 
 
-int OpalPCAPFile::GetRTP(RTP_DataFrame & rtp)
+static int CheckRTP(RTP_DataFrame & rtp, int packetLength, RTP_SyncSourceId filterSSRC)
 {
-  int packetLength = GetUDP(rtp);
   if (packetLength < 0)
     return -1;
 
@@ -253,7 +625,7 @@ int OpalPCAPFile::GetRTP(RTP_DataFrame & rtp)
     return -1;
 
   RTP_SyncSourceId ssrc = rtp.GetSyncSource();
-  if (ssrc == 0 || (m_filterSSRC != 0 && m_filterSSRC != ssrc))
+  if (ssrc == 0 || (filterSSRC != 0 && filterSSRC != ssrc))
     return -1;
 
   if (rtp.GetContribSrcCount() > 4) // While possible, extremely unlikely in modern usage
@@ -263,6 +635,12 @@ int OpalPCAPFile::GetRTP(RTP_DataFrame & rtp)
 }
 
 
+int OpalPCAPFile::GetRTP(RTP_DataFrame & rtp)
+{
+  return CheckRTP(rtp, GetUDP(rtp), m_filterSSRC);
+}
+
+
 int OpalPCAPFile::GetDecodedRTP(RTP_DataFrame & decodedRTP, DecodeContext & context)
 {
   RTP_DataFrame encodedRTP;
@@ -284,13 +662,9 @@ int OpalPCAPFile::DecodeRTP(RTP_DataFrame & encodedRTP, RTP_DataFrame & decodedR
 int OpalPCAPFile::InternalDecodeRTP(RTP_DataFrame & encodedRTP, RTP_DataFrame & decodedRTP, DecodeContext & context)
 {
   if (context.m_transcoder == NULL) {
-    OpalMediaFormat srcFmt = GetMediaFormat(encodedRTP);
-    if (!srcFmt.IsValid())
-      return -1;
-
-    OpalMediaFormatList dstFmts = OpalTranscoder::GetDestinationFormats(srcFmt);
-    if (dstFmts.IsEmpty() || (context.m_transcoder = OpalTranscoder::Create(srcFmt, dstFmts.front())) == NULL)
-        return -2;
+    int result = OpenTranscoder(context, GetMediaFormat(encodedRTP));
+    if (result < 0)
+      return result;
   }
 
   RTP_SyncSourceId   thisSSRC = encodedRTP.GetSyncSource();
@@ -337,6 +711,25 @@ int OpalPCAPFile::InternalDecodeRTP(RTP_DataFrame & encodedRTP, RTP_DataFrame &
   context.m_lastSequenceNumber = thisSequenceNumber;
   context.m_lastSSRC = thisSSRC;
 
+  return TranscodeRTP(encodedRTP, decodedRTP, context);
+}
+
+
+int OpalPCAPFile::OpenTranscoder(DecodeContext & context, const OpalMediaFormat & srcFmt)
+{
+  if (!srcFmt.IsValid())
+    return -1;
+
+  OpalMediaFormatList dstFmts = OpalTranscoder::GetDestinationFormats(srcFmt);
+  if (dstFmts.IsEmpty() || (context.m_transcoder = OpalTranscoder::Create(srcFmt, dstFmts.front())) == NULL)
+    return -2;
+
+  return 0;
+}
+
+
+int OpalPCAPFile::TranscodeRTP(RTP_DataFrame & encodedRTP, RTP_DataFrame & decodedRTP, DecodeContext & context)
+{
   RTP_DataFrameList output;
   if (!context.m_transcoder->ConvertFrames(encodedRTP, output))
     return -3;
@@ -380,6 +773,7 @@ void OpalPCAPFile::DiscoveredRTPKey::PrintOn(ostream & strm) const
 
 OpalPCAPFile::DiscoveredRTPInfo::DiscoveredRTPInfo()
   : m_payloadType(RTP_DataFrame::IllegalPayloadType)
+  , m_packets(0)
 {
 }
 
@@ -387,6 +781,7 @@ OpalPCAPFile::DiscoveredRTPInfo::DiscoveredRTPInfo()
 OpalPCAPFile::DiscoveredRTPInfo::DiscoveredRTPInfo(const DiscoveredRTPKey & key)
   : DiscoveredRTPKey(key)
   , m_payloadType(RTP_DataFrame::IllegalPayloadType)
+  , m_packets(0)
 {
 }
 
@@ -400,12 +795,16 @@ void OpalPCAPFile::DiscoveredRTPInfo::PrintOn(ostream & strm) const
     strm << m_mediaFormat;
   else
     strm << "Unknown media format";
+  if (m_packets > 0)
+    strm << ", " << m_packets << " packets";
 }
 
 
 struct OpalPCAPFile::DiscoveryInfo
 {
   unsigned           m_totalPackets;
+  RTP_SequenceNumber m_firstSequenceNumber;
+  RTP_Timestamp      m_firstTimestamp;
   RTP_SequenceNumber m_expectedSequenceNumber;
   unsigned           m_matchedSequenceNumber;
   RTP_Timestamp      m_lastTimestamp;
@@ -417,6 +816,8 @@ struct OpalPCAPFile::DiscoveryInfo
 
   DiscoveryInfo(const RTP_DataFrame & rtp)
     : m_totalPackets(1)
+    , m_firstSequenceNumber(rtp.GetSequenceNumber())
+    , m_firstTimestamp(rtp.GetTimestamp())
     , m_expectedSequenceNumber(rtp.GetSequenceNumber()+1)
     , m_matchedSequenceNumber(0)
     , m_lastTimestamp(rtp.GetTimestamp())
@@ -444,6 +845,40 @@ struct OpalPCAPFile::DiscoveryInfo
     AddPacket(rtp);
   }
 
+  static void Add(DiscoveryMap & discoveryMap, const DiscoveredRTPKey & key, const RTP_DataFrame & rtp)
+  {
+    DiscoveryMap::iterator it;
+    if ((it = discoveryMap.find(key)) != discoveryMap.end())
+      it->second.ProcessPacket(rtp);
+    else {
+      discoveryMap.insert(make_pair(key, rtp));
+      PTRACE(4, "Adding RTP discovery possibility: " << key);
+    }
+  }
+
+  // Merge results from the immediately following part of the file
+  void Merge(const DiscoveryInfo & later)
+  {
+    m_totalPackets += later.m_totalPackets;
+
+    if (m_expectedSequenceNumber == later.m_firstSequenceNumber)
+      ++m_matchedSequenceNumber;
+    m_matchedSequenceNumber += later.m_matchedSequenceNumber;
+    m_expectedSequenceNumber = later.m_expectedSequenceNumber;
+
+    // Later part always counted its first timestamp as monotonic
+    m_matchedTimestamps += later.m_matchedTimestamps;
+    if (later.m_firstTimestamp < m_lastTimestamp)
+      --m_matchedTimestamps;
+    m_lastTimestamp = later.m_lastTimestamp;
+
+    for (map<RTP_DataFrame::PayloadTypes, unsigned>::const_iterator it = later.m_payloadTypes.begin(); it != later.m_payloadTypes.end(); ++it)
+      m_payloadTypes[it->first] += it->second;
+
+    for (RTP_DataFrameList::const_iterator it = later.m_firstFrames.begin(); it != later.m_firstFrames.end() && m_firstFrames.size() <= 100; ++it)
+      AddPacket(*it);
+  }
+
   void AddPacket(const RTP_DataFrame & rtp)
   {
     if (m_firstFrames.size() > 100)
@@ -461,6 +896,7 @@ struct OpalPCAPFile::DiscoveryInfo
       return false;
     }
 
+    info.m_packets = m_totalPackets;
     unsigned matchThreshold = m_totalPackets/2; // 50%
 
     if (m_matchedSequenceNumber < matchThreshold) { // Most of them consecutive
@@ -533,46 +969,180 @@ struct OpalPCAPFile::DiscoveryInfo
 };
 
 
-bool OpalPCAPFile::DiscoverRTP(DiscoveredRTP & discoveredRTP, const ProgressNotifier & progressNotifier)
+struct OpalPCAPFile::DiscoveryChunk
 {
-  if (!Restart())
-    return false;
+  DiscoveryChunk(const RecordFormat & format, off_t start, PSemaphore & slots)
+    : m_format(format)
+    , m_start(start)
+    , m_end(start)
+    , m_slots(slots)
+    , m_thread(NULL)
+  { }
+
+  void MergeInto(DiscoveryMap & discoveryMap)
+  {
+    PThread::WaitAndDelete(m_thread);
+
+    for (DiscoveryMap::iterator it = m_results.begin(); it != m_results.end(); ++it) {
+      DiscoveryMap::iterator existing = discoveryMap.find(it->first);
+      if (existing == discoveryMap.end())
+        discoveryMap.insert(*it);
+      else
+        existing->second.Merge(it->second);
+    }
+  }
 
-  PTRACE(3, "Starting RTP discovery");
+  RecordFormat m_format;  // As at m_start
+  off_t        m_start;
+  off_t        m_end;
+  DiscoveryMap m_results;
+  PSemaphore & m_slots;
+  PThread    * m_thread;
+};
 
-  map<DiscoveredRTPKey, DiscoveryInfo> discoveryMap;
 
-  Progress progress(GetLength());
-  while (!IsEndOfFile()) {
-    ++progress.m_packets;
-    progress.m_filePosition = GetPosition();
+void OpalPCAPFile::DiscoverChunk(DiscoveryChunk & chunk)
+{
+  Frame frame;
+  PIPSocketAddressAndPort src, dst;
 
-    if (!progressNotifier.IsNULL())
-      progressNotifier(*this, progress);
-    if (progress.m_abort)
-      return false;
+  off_t position = chunk.m_start;
+  while (position < chunk.m_end) {
+    bool isPacket;
+    size_t length = chunk.m_format.Parse(m_mappedData+position, (size_t)(chunk.m_end-position), isPacket, &frame);
+    if (length == 0)
+      break;
+    position += length;
 
     RTP_DataFrame rtp;
-    if (GetRTP(rtp) < 0)
+    if (!isPacket ||
+        !frame.GetUDP(rtp, src, dst) ||
+        !src.MatchWildcard(m_filterSrc) ||
+        !dst.MatchWildcard(m_filterDst) ||
+        CheckRTP(rtp, rtp.GetSize(), m_filterSSRC) < 0)
       continue;
 
     DiscoveredRTPKey key;
-    key.m_src = m_packetSrc;
-    key.m_dst = m_packetDst;
+    key.m_src = src;
+    key.m_dst = dst;
     key.m_ssrc = rtp.GetSyncSource();
+    DiscoveryInfo::Add(chunk.m_results, key, rtp);
+  }
+}
 
-    map<DiscoveredRTPKey, DiscoveryInfo>::iterator it;
-    if ((it = discoveryMap.find(key)) != discoveryMap.end())
-      it->second.ProcessPacket(rtp);
-    else {
-      discoveryMap.insert(make_pair(key, rtp));
-      PTRACE(4, "Adding RTP discovery possibility: " << key);
+
+void OpalPCAPFile::DiscoveryWorker(DiscoveryChunk * chunk)
+{
+  DiscoverChunk(*chunk);
+  chunk->m_slots.Signal();
+}
+
+
+bool OpalPCAPFile::DiscoverParallel(DiscoveryMap & discoveryMap,
+                                    Progress & progress,
+                                    const ProgressNotifier & progressNotifier,
+                                    unsigned threads)
+{
+  if (threads == 0)
+    threads = std::max(PThread::GetNumProcessors(), 1U);
+
+  PTRACE(4, "Discovering in " << m_discoveryChunkSize << " byte chunks, using " << threads << " threads");
+
+  /* Only the record headers are examined here, to find chunk boundaries,
+     which also has the effect of pre-faulting the pages in file order for
+     the workers, who do the real work. */
+  PSemaphore slots(threads, threads);
+  std::list<DiscoveryChunk *> chunks;
+  RecordFormat format = m_format;
+  off_t position = m_mappedPosition;
+
+  while (position < m_mappedSize) {
+    DiscoveryChunk * chunk = new DiscoveryChunk(format, position, slots);
+
+    off_t limit = position + std::max(m_discoveryChunkSize, (off_t)1);
+    while (position < limit && position < m_mappedSize) {
+      bool isPacket;
+      size_t length = format.Parse(m_mappedData+position, (size_t)(m_mappedSize-position), isPacket, NULL);
+      if (length == 0) {
+        PTRACE(1, "Truncated or corrupt file \"" << GetFilePath() << "\" at " << position);
+        position = m_mappedSize;
+        break;
+      }
+      position += length;
+      chunk->m_end = position;
+      if (isPacket)
+        ++progress.m_packets;
+    }
+
+    progress.m_filePosition = position;
+    if (!progressNotifier.IsNULL())
+      progressNotifier(*this, progress);
+    if (progress.m_abort) {
+      delete chunk;
+      break;
+    }
+
+    slots.Wait();
+    chunk->m_thread = new PThreadObj1Arg<OpalPCAPFile, DiscoveryChunk *>(*this, chunk, &OpalPCAPFile::DiscoveryWorker, false, "PCAP Discover");
+    chunks.push_back(chunk);
+
+    // Merge completed chunks as we go, in file order so sequence numbers etc are correct
+    while (!chunks.empty() && chunks.front()->m_thread->IsTerminated()) {
+      chunks.front()->MergeInto(discoveryMap);
+      delete chunks.front();
+      chunks.pop_front();
+    }
+  }
+
+  while (!chunks.empty()) {
+    chunks.front()->MergeInto(discoveryMap);
+    delete chunks.front();
+    chunks.pop_front();
+  }
+
+  return !progress.m_abort;
+}
+
+
+bool OpalPCAPFile::DiscoverRTP(DiscoveredRTP & discoveredRTP, const ProgressNotifier & progressNotifier, unsigned threads)
+{
+  if (!Restart())
+    return false;
+
+  PTRACE(3, "Starting RTP discovery");
+
+  DiscoveryMap discoveryMap;
+
+  Progress progress(GetLength());
+  if (m_mappedData != NULL) {
+    if (!DiscoverParallel(discoveryMap, progress, progressNotifier, threads))
+      return false;
+  }
+  else {
+    while (!IsEndOfFile()) {
+      ++progress.m_packets;
+      progress.m_filePosition = GetPosition();
+
+      if (!progressNotifier.IsNULL())
+        progressNotifier(*this, progress);
+      if (progress.m_abort)
+        return false;
+
+      RTP_DataFrame rtp;
+      if (GetRTP(rtp) < 0)
+        continue;
+
+      DiscoveredRTPKey key;
+      key.m_src = m_packetSrc;
+      key.m_dst = m_packetDst;
+      key.m_ssrc = rtp.GetSyncSource();
+      DiscoveryInfo::Add(discoveryMap, key, rtp);
     }
   }
 
   PTRACE(4, "Finalising RTP discovery: " << discoveryMap.size() << " possibilities");
 
-  for (map<DiscoveredRTPKey, DiscoveryInfo>::iterator it = discoveryMap.begin(); it != discoveryMap.end(); ++it) {
+  for (DiscoveryMap::iterator it = discoveryMap.begin(); it != discoveryMap.end(); ++it) {
     DiscoveredRTPInfo * info = new DiscoveredRTPInfo(it->first);
     if (it->second.Finalise(*info, m_payloadType2mediaFormat))
       discoveredRTP.Append(info);
@@ -586,6 +1156,189 @@ bool OpalPCAPFile::DiscoverRTP(DiscoveredRTP & discoveredRTP, const ProgressNoti
 }
 
 
+struct OpalPCAPFile::DecodeStream
+{
+  enum { QueueSize = 1000, ReorderWindow = 100, MaxGap = 3000 };
+
+  struct Packet
+  {
+    Packet() : m_end(false) { }
+    RTP_DataFrame m_rtp;
+    PTime         m_time;
+    bool          m_end;
+  };
+
+  DecodeStream(PINDEX index, const DiscoveredRTPInfo & info, const DecodedNotifier & notifier)
+    : m_index(index)
+    , m_info(info)
+    , m_notifier(notifier)
+    , m_available(0, QueueSize)
+    , m_space(QueueSize, QueueSize)
+    , m_thread(NULL)
+  { }
+
+  void Enqueue(const Packet & packet)
+  {
+    m_space.Wait();
+    m_mutex.Wait();
+    m_queue.push(packet);
+    m_mutex.Signal();
+    m_available.Signal();
+  }
+
+  Packet Dequeue()
+  {
+    m_available.Wait();
+    PWaitAndSignal mutex(m_mutex);
+    Packet packet = m_queue.front();
+    m_queue.pop();
+    m_space.Signal();
+    return packet;
+  }
+
+  PINDEX                    m_index;
+  const DiscoveredRTPInfo & m_info;
+  DecodedNotifier           m_notifier;
+  DecodeContext             m_context;
+  std::queue<Packet>        m_queue;
+  PDECLARE_MUTEX(           m_mutex);
+  PSemaphore                m_available;
+  PSemaphore                m_space;
+  PThread                 * m_thread;
+};
+
+
+void OpalPCAPFile::DecodeWorker(DecodeStream * stream)
+{
+  PTRACE(4, "Decoding stream " << stream->m_info);
+
+  // Re-order within a window, keyed by extended sequence number
+  typedef std::map<int64_t, DecodeStream::Packet> PendingMap;
+  PendingMap pending;
+  int64_t nextSequence = -1;
+  int64_t highestSequence = 0;
+  bool failed = false;
+
+  for (;;) {
+    DecodeStream::Packet packet = stream->Dequeue();
+
+    if (!packet.m_end) {
+      RTP_SequenceNumber sn = packet.m_rtp.GetSequenceNumber();
+      int64_t extended = sn;
+      if (nextSequence < 0)
+        nextSequence = highestSequence = extended;
+      else {
+        extended = highestSequence + (int16_t)(sn - (RTP_SequenceNumber)highestSequence);
+        if (extended > highestSequence)
+          highestSequence = extended;
+      }
+
+      if (extended < nextSequence || pending.find(extended) != pending.end()) {
+        PTRACE(4, "Skipping duplicate or late RTP packet " << sn << " in " << stream->m_info);
+        continue;
+      }
+
+      pending[extended] = packet;
+    }
+
+    while (!pending.empty() && (packet.m_end ||
+                                pending.begin()->first == nextSequence ||
+                                pending.size() > DecodeStream::ReorderWindow)) {
+      PendingMap::iterator it = pending.begin();
+      int64_t missing = it->first - nextSequence;
+      if (missing > 0 && missing < DecodeStream::MaxGap) {
+        PTRACE(4, "Detected " << missing << " missing RTP packets in " << stream->m_info);
+        it->second.m_rtp.SetDiscontinuity((unsigned)missing);
+      }
+      nextSequence = it->first + 1;
+
+      if (!failed && stream->m_context.m_transcoder == NULL) {
+        OpalMediaFormat mediaFormat = stream->m_info.m_mediaFormat;
+        if (!mediaFormat.IsValid())
+          mediaFormat = GetMediaFormat(it->second.m_rtp);
+        failed = OpenTranscoder(stream->m_context, mediaFormat) < 0;
+        PTRACE_IF(2, failed, "Could not create transcoder for " << stream->m_info);
+      }
+
+      if (!failed) {
+        DecodedRTP decoded(stream->m_index, stream->m_info);
+        decoded.m_packetTime = it->second.m_time;
+        if (TranscodeRTP(it->second.m_rtp, decoded.m_decoded, stream->m_context) > 0)
+          stream->m_notifier(*this, decoded);
+      }
+
+      pending.erase(it);
+    }
+
+    if (packet.m_end)
+      break;
+  }
+
+  PTRACE(4, "Finished decoding stream " << stream->m_info);
+}
+
+
+bool OpalPCAPFile::DecodeStreams(const DiscoveredRTP & streams,
+                                 const DecodedNotifier & notifier,
+                                 const ProgressNotifier & progressNotifier)
+{
+  if (streams.IsEmpty() || notifier.IsNULL() || !Restart())
+    return false;
+
+  PTRACE(3, "Starting decode of " << streams.GetSize() << " streams");
+
+  typedef std::map<DiscoveredRTPKey, DecodeStream *> StreamMap;
+  StreamMap streamMap;
+  for (PINDEX i = 0; i < streams.GetSize(); ++i) {
+    DecodeStream * stream = new DecodeStream(i, streams[i], notifier);
+    if (!streamMap.insert(make_pair((const DiscoveredRTPKey &)streams[i], stream)).second) {
+      delete stream;
+      continue;
+    }
+    stream->m_thread = new PThreadObj1Arg<OpalPCAPFile, DecodeStream *>(*this, stream, &OpalPCAPFile::DecodeWorker, false, "PCAP Decode");
+  }
+
+  Progress progress(GetLength());
+  while (!IsEndOfFile()) {
+    if ((++progress.m_packets % 1000) == 0 && !progressNotifier.IsNULL()) {
+      progress.m_filePosition = GetPosition();
+      progressNotifier(*this, progress);
+      if (progress.m_abort)
+        break;
+    }
+
+    DecodeStream::Packet packet;
+    if (GetRTP(packet.m_rtp) < 0)
+      continue;
+
+    DiscoveredRTPKey key;
+    key.m_src = m_packetSrc;
+    key.m_dst = m_packetDst;
+    key.m_ssrc = packet.m_rtp.GetSyncSource();
+    StreamMap::iterator it = streamMap.find(key);
+    if (it == streamMap.end())
+      continue;
+
+    packet.m_rtp.MakeUnique(); // Detach from mapping/read buffer, as it is used by another thread
+    packet.m_time = GetPacketTime();
+    it->second->Enqueue(packet);
+  }
+
+  DecodeStream::Packet end;
+  end.m_end = true;
+  for (StreamMap::iterator it = streamMap.begin(); it != streamMap.end(); ++it)
+    it->second->Enqueue(end);
+  for (StreamMap::iterator it = streamMap.begin(); it != streamMap.end(); ++it) {
+    PThread::WaitAndDelete(it->second->m_thread);
+    delete it->second;
+  }
+
+  PTRACE(3, "Completed decode of " << streams.GetSize() << " streams");
+
+  return !progress.m_abort && Restart();
+}
+
+
 bool OpalPCAPFile::SetFilters(const DiscoveredRTPInfo & info, const PString & format)
 {
   if (!SetPayloadMap(info.m_payloadType, format.IsEmpty() ? info.m_mediaFormat : OpalMediaFormat(format)))
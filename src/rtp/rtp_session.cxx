@@ -42,6 +42,8 @@
 #include <rtp/rtpconn.h>
 #include <rtp/rtp_stream.h>
 #include <rtp/metrics.h>
+#include <rtp/rtpmux.h>
+#include <opal/evtrace.h>
 #include <codec/vidcodec.h>
 
 #include <ptclib/random.h>
@@ -184,6 +186,14 @@ RTP_SyncSourceId OpalRTPSession::AddSyncSource(RTP_SyncSourceId id, Direction di
   }
 
   m_SSRC[id] = CreateSyncSource(id, dir, cname);
+
+  // Shared port can route by SSRC, for when remote address not known or changes
+  if (dir == e_Receiver && m_transport != NULL) {
+    OpalMuxMediaTransport * mux = dynamic_cast<OpalMuxMediaTransport *>(&*m_transport);
+    if (mux != NULL)
+      mux->AddSyncSource(id);
+  }
+
   return id;
 }
 
@@ -748,6 +758,7 @@ OpalRTPSession::SendReceiveStatus OpalRTPSession::SyncSource::OnSendData(RTP_Dat
   CalculateStatistics(frame, now);
 
   PTRACE(m_throttleSendData, &m_session, m_session << "sending packet " << setw(1) << frame << m_throttleSendData);
+  OPAL_EVENT_TRACE(e_RTPSend, m_session, frame.GetSyncSource(), frame.GetSequenceNumber(), frame.GetTimestamp(), frame.GetPayloadSize());
   return e_ProcessPacket;
 }
 
@@ -762,6 +773,8 @@ OpalRTPSession::SendReceiveStatus OpalRTPSession::SyncSource::OnReceiveData(RTP_
   RTP_SequenceNumber expectedSequenceNumber = m_lastSequenceNumber + 1;
   RTP_SequenceNumber sequenceDelta = sequenceNumber - expectedSequenceNumber;
 
+  OPAL_EVENT_TRACE(e_RTPReceive, m_session, frame.GetSyncSource(), sequenceNumber, frame.GetTimestamp(), frame.GetPayloadSize());
+
   // Check packet sequence numbers
   if (m_packets == 0) {
     m_firstPacketTime = m_lastPacketNetTime = now;
@@ -785,6 +798,7 @@ OpalRTPSession::SendReceiveStatus OpalRTPSession::SyncSource::OnReceiveData(RTP_
       case e_RxFromNetwork :
         if (HasPendingFrames()) {
           PTRACE(5, &m_session, *this << "received out of order packet " << sequenceNumber);
+          OPAL_EVENT_TRACE(e_RTPOutOfOrder, m_session, frame.GetSyncSource(), sequenceNumber, expectedSequenceNumber, 0);
           ++m_packetsOutOfOrder; // it arrived after all!
         }
         break;
@@ -1076,7 +1090,9 @@ bool OpalRTPSession::ResequenceOutOfOrderPackets(SyncSource & receiver) const
 void OpalRTPSession::SyncSource::SaveSentData(const RTP_DataFrame & frame, const PTime & now)
 {
   if (IsNackEnabled()) {
-    m_pendingTxPackets.insert(std::make_pair(frame.GetSequenceNumber(), TxPacket(frame)));
+    // Frame buffer may be shared, e.g. by a mixer, so keep our own copy
+    std::pair<TxPacketMap::iterator, bool> result = m_pendingTxPackets.insert(std::make_pair(frame.GetSequenceNumber(), TxPacket(frame)));
+    result.first->second.MakeUnique();
     m_pendingTxPacketTime[now] = frame.GetSequenceNumber();
 
     // Clean old packets
@@ -1290,6 +1306,14 @@ void OpalRTPSession::InternalAttachTransport(const OpalMediaTransportPtr & newTr
   if (ssrc == 0)
     ssrc = AddSyncSource(0, e_Sender); // Add default sender SSRC
 
+  OpalMuxMediaTransport * mux = dynamic_cast<OpalMuxMediaTransport *>(&*newTransport);
+  if (mux != NULL) {
+    for (SyncSourceMap::iterator it = m_SSRC.begin(); it != m_SSRC.end(); ++it) {
+      if (it->second->m_direction == e_Receiver)
+        mux->AddSyncSource(it->first);
+    }
+  }
+
   m_endpoint.RegisterLocalRTP(this, false);
 
   PTRACE(3, *this << from << ": "
@@ -1832,6 +1856,7 @@ OpalRTPSession::SendReceiveStatus OpalRTPSession::OnReceiveData(RTP_DataFrame &
     uint16_t sn = *(PUInt16b *)exthdr;
     OpalMediaTransport::CongestionControl * cc = GetCongestionControl();
     PTRACE(6, *this << "Received TWCC sequence number: len=" << hdrlen << " sn=" << sn << " cc=" << cc);
+    OPAL_EVENT_TRACE(e_RTPTransportSN, *this, frame.GetSyncSource(), sn, hdrlen, 0);
     if (cc != NULL)
       cc->HandleReceivePacket(sn, frame.GetMetaData().m_receivedTime);
   }
@@ -3164,6 +3189,10 @@ OpalMediaStream * OpalRTPSession::CreateMediaStream(const OpalMediaFormat & medi
 
 OpalMediaTransport * OpalRTPSession::CreateMediaTransport(const PString & name)
 {
+  OpalMediaMuxListener * mux = m_manager.GetMediaMuxListener();
+  if (mux != NULL && mux->IsOpen() && m_stringOptions.GetBoolean(OPAL_OPT_MEDIA_MUX, true))
+    return new OpalMuxMediaTransport(name, *mux);
+
 #if OPAL_ICE
   return new OpalICEMediaTransport(name);
 #else
@@ -3368,7 +3397,8 @@ void OpalRTPSession::OnRxDataPacket(OpalMediaTransport &, PBYTEArray data)
 
   if (m_sendEstablished && IsEstablished()) {
     m_sendEstablished = false;
-    m_manager.QueueDecoupledEvent(new PSafeWorkNoArg<OpalConnection, bool>(&m_connection, &OpalConnection::InternalOnEstablished));
+    m_manager.QueueDecoupledEvent(new PSafeWorkNoArg<OpalConnection, bool>(&m_connection, &OpalConnection::InternalOnEstablished),
+                                  m_connection.GetCall().GetToken());
   }
 
   // Check for single port operation, incoming RTCP on RTP
@@ -3523,7 +3553,8 @@ void OpalRTPSession::SessionFailed(SubChannels subchannel PTRACE_PARAM(, const c
      get one failed without the other, we don't bother. */
   if (subchannel == e_Data && m_connection.OnMediaFailed(m_sessionId, error)) {
     PTRACE(2, *this << "aborting transport, error " << error << ", queuing close of media session.");
-    m_manager.QueueDecoupledEvent(new PSafeWorkNoArg<OpalRTPSession, bool>(this, &OpalRTPSession::Close));
+    m_manager.QueueDecoupledEvent(new PSafeWorkNoArg<OpalRTPSession, bool>(this, &OpalRTPSession::Close),
+                                  m_connection.GetCall().GetToken());
   }
 }
 
@@ -701,7 +701,7 @@ void OpalRTPConnection::OnUserInputInlineRFC2833(OpalRFC2833Info & info, OpalRFC
             new PSafeWorkArg2<OpalConnection, char, unsigned>(
                   this, info.GetTone(),
                   info.GetDuration(),
-                  &OpalConnection::OnUserInputTone));
+                  &OpalConnection::OnUserInputTone), GetCall().GetToken());
   }
 }
 
@@ -0,0 +1,862 @@
+/*
+ * rtpmux.cxx
+ *
+ * Shared socket, demultiplexing, media listener
+ *
+ * Open Phone Abstraction Library (OPAL)
+ *
+ * Copyright (c) 2021 Vox Lucida Pty. Ltd.
+ *
+ * The contents of this file are subject to the Mozilla Public License
+ * Version 1.0 (the "License"); you may not use this file except in
+ * compliance with the License. You may obtain a copy of the License at
+ * http://www.mozilla.org/MPL/
+ *
+ * Software distributed under the License is distributed on an "AS IS"
+ * basis, WITHOUT WARRANTY OF ANY KIND, either express or implied. See
+ * the License for the specific language governing rights and limitations
+ * under the License.
+ *
+ * The Original Code is Open Phone Abstraction Library.
+ *
+ * The Initial Developer of the Original Code is Vox Lucida Pty. Ltd.
+ *
+ * Contributor(s): ______________________________________.
+ *
+ */
+
+#include <ptlib.h>
+
+#ifdef __GNUC__
+#pragma implementation "rtpmux.h"
+#endif
+
+#include <rtp/rtpmux.h>
+
+#include <opal/manager.h>
+#include <opal/connection.h>
+#include <opal/endpoint.h>
+
+#include <algorithm>
+
+
+#define PTraceModule() "MediaMux"
+
+
+static const unsigned KeyTypeShift = 56;
+static const OpalMediaMuxListener::Key KeyValueMask = (1ULL << KeyTypeShift) - 1;
+
+static const DWORD STUNMagicCookie = 0x2112A442;
+static const WORD  STUNUserName = 0x0006;
+
+const OpalMediaMuxListener::Key OpalMediaMuxListener::DeletedKey = ~(OpalMediaMuxListener::Key)0;
+
+
+// FNV-1a, for keys that do not fit in 56 bits
+static uint64_t HashBytes(const void * data, size_t length, uint64_t hash = 14695981039346656037ULL)
+{
+  const BYTE * ptr = (const BYTE *)data;
+  while (length-- > 0) {
+    hash ^= *ptr++;
+    hash *= 1099511628211ULL;
+  }
+  return hash;
+}
+
+
+static OpalMediaMuxListener::Key MakeTypedKey(OpalMediaMuxListener::KeyTypes type, uint64_t value)
+{
+  // Type is offset by one so a key is never EmptyKey, and never DeletedKey as NumKeyTypes < 255
+  return ((OpalMediaMuxListener::Key)(type+1) << KeyTypeShift) | (value & KeyValueMask);
+}
+
+
+#if PTRACING
+static ostream & operator<<(ostream & strm, OpalMediaMuxListener::KeyTypes type)
+{
+  static const char * const Names[OpalMediaMuxListener::NumKeyTypes] = { "address", "mux-id", "ice-user", "ssrc" };
+  if (type < OpalMediaMuxListener::NumKeyTypes)
+    return strm << Names[type];
+  return strm << "key<" << (unsigned)type << '>';
+}
+#endif
+
+
+OpalMediaMuxListener::Key OpalMediaMuxListener::MakeKey(const PIPSocketAddressAndPort & remote)
+{
+  const PIPAddress & addr = remote.GetAddress();
+  uint64_t value;
+  if (addr.GetVersion() != 6)
+    value = ((uint64_t)(DWORD)addr << 16) | remote.GetPort();
+  else {
+    WORD port = remote.GetPort();
+    value = HashBytes(&port, sizeof(port), HashBytes(addr.GetPointer(), addr.GetSize()));
+  }
+  return MakeTypedKey(e_RemoteAddress, value);
+}
+
+
+OpalMediaMuxListener::Key OpalMediaMuxListener::MakeKey(KeyTypes type, uint32_t value)
+{
+  return MakeTypedKey(type, value);
+}
+
+
+OpalMediaMuxListener::Key OpalMediaMuxListener::MakeKey(const PString & iceUser)
+{
+  return MakeTypedKey(e_ICEUser, HashBytes(iceUser.GetPointer(), iceUser.GetLength()));
+}
+
+
+OpalMediaMuxListener::OpalMediaMuxListener(OpalManager & manager, unsigned maxRoutes)
+  : m_manager(manager)
+  , m_muxIdPrefix(false)
+  , m_subchannel(e_AllSubChannels)
+  , m_routeCount(0)
+{
+  size_t capacity = 16;
+  while (capacity < (size_t)maxRoutes*2)
+    capacity <<= 1;
+  m_table = new Slot[capacity];
+  m_tableMask = capacity - 1;
+}
+
+
+OpalMediaMuxListener::~OpalMediaMuxListener()
+{
+  Close();
+  delete [] m_table;
+}
+
+
+bool OpalMediaMuxListener::Socket::ListenShared(const PIPAddress & localInterface, WORD localPort)
+{
+#if defined(SO_REUSEPORT) && !defined(_WIN32)
+  // Need the option set before bind, which Listen() does not allow for
+  int family = localInterface.GetVersion() == 6 ? AF_INET6 : AF_INET;
+  if (!ConvertOSError(os_handle = os_socket(family, SOCK_DGRAM, 0)))
+    return false;
+
+  if (!SetOption(SO_REUSEPORT, 1)) {
+    os_close();
+    os_handle = -1;
+    return false;
+  }
+
+  int status;
+  if (family == AF_INET6) {
+    sockaddr_in6 sa;
+    memset(&sa, 0, sizeof(sa));
+    sa.sin6_family = AF_INET6;
+    sa.sin6_addr = localInterface;
+    sa.sin6_port = htons(localPort);
+    status = ::bind(os_handle, (sockaddr *)&sa, sizeof(sa));
+  }
+  else {
+    sockaddr_in sa;
+    memset(&sa, 0, sizeof(sa));
+    sa.sin_family = AF_INET;
+    sa.sin_addr = localInterface;
+    sa.sin_port = htons(localPort);
+    status = ::bind(os_handle, (sockaddr *)&sa, sizeof(sa));
+  }
+
+  if (!ConvertOSError(status)) {
+    os_close();
+    os_handle = -1;
+    return false;
+  }
+
+  PIPSocketAddressAndPort ap;
+  if (GetLocalAddress(ap))
+    port = ap.GetPort();
+  return true;
+#else
+  return Listen(localInterface, 0, localPort);
+#endif
+}
+
+
+bool OpalMediaMuxListener::Open(const PIPAddress & localInterface,
+                                WORD port,
+                                unsigned shards,
+                                bool muxIdPrefix,
+                                SubChannels subchannel)
+{
+  Close();
+
+  m_muxIdPrefix = muxIdPrefix;
+  m_subchannel = subchannel;
+
+  OpalPlacementPolicy & placement = m_manager.GetPlacementPolicy();
+
+#if defined(SO_REUSEPORT) && !defined(_WIN32)
+  if (shards == 0)
+    shards = placement.IsEnabled() ? placement.GetCPUCount() : PThread::GetNumProcessors();
+#else
+  shards = 1;
+#endif
+
+  for (unsigned i = 0; i < shards; ++i) {
+    Shard * shard = new Shard;
+    shard->m_socket = new Socket;
+    if (!shard->m_socket->ListenShared(localInterface, port)) {
+      PTRACE(1, "could not listen on " << PIPSocketAddressAndPort(localInterface, port)
+             << ": " << shard->m_socket->GetErrorText());
+      delete shard->m_socket;
+      delete shard;
+      if (m_shards.empty())
+        return false;
+      break; // Carry on with what we have
+    }
+
+    if (i == 0) {
+      shard->m_socket->GetLocalAddress(m_localAddress);
+      port = m_localAddress.GetPort(); // Rest must use the same port, even if first was allocated by OS
+    }
+
+    // Lots of sessions on this socket, make sure kernel can absorb a burst
+    shard->m_socket->SetOption(SO_RCVBUF, 0x400000);
+    shard->m_socket->SetOption(SO_SNDBUF, 0x100000);
+
+    if (placement.IsEnabled() && shards > 1) {
+      unsigned cpu = placement.GetCPU(i % placement.GetCPUCount());
+      placement.BindSocket(*shard->m_socket, cpu);
+      shard->m_placementGroup = placement.GetGroupOfCPU(cpu);
+    }
+
+    m_shards.push_back(shard);
+  }
+
+  for (size_t i = 0; i < m_shards.size(); ++i)
+    m_shards[i]->m_thread = new PThreadObj1Arg<OpalMediaMuxListener, size_t>(*this, i, &OpalMediaMuxListener::ReadMain,
+                                                                              false, PSTRSTRM("MediaMux:" << i),
+                                                                              PThread::HighPriority);
+
+  PTRACE(3, "listening on " << m_localAddress << " with " << m_shards.size() << " shard(s),"
+            " capacity=" << (m_tableMask+1)/2 << (m_muxIdPrefix ? ", mux-id prefixed" : ""));
+  return true;
+}
+
+
+void OpalMediaMuxListener::Close()
+{
+  if (m_shards.empty())
+    return;
+
+  PTRACE(3, "closing " << m_localAddress);
+
+  for (size_t i = 0; i < m_shards.size(); ++i)
+    m_shards[i]->m_socket->Close();
+
+  for (size_t i = 0; i < m_shards.size(); ++i) {
+    PThread::WaitAndDelete(m_shards[i]->m_thread);
+    delete m_shards[i]->m_socket;
+    delete m_shards[i];
+  }
+
+  m_shards.clear();
+}
+
+
+size_t OpalMediaMuxListener::GetSlotIndex(Key key) const
+{
+  // Mixer from splitmix64, IPv4 addresses and SSRCs do not spread well as is
+  key ^= key >> 30;
+  key *= 0xbf58476d1ce4e5b9ULL;
+  key ^= key >> 27;
+  key *= 0x94d049bb133111ebULL;
+  key ^= key >> 31;
+  return (size_t)key & m_tableMask;
+}
+
+
+bool OpalMediaMuxListener::AddRoute(Key key, Target & target)
+{
+  if (!PAssert(key != EmptyKey && key != DeletedKey, PInvalidParameter))
+    return false;
+
+  PWaitAndSignal lock(m_tableMutex);
+
+  size_t freeSlot = m_tableMask+1;
+  size_t index = GetSlotIndex(key);
+  for (size_t probes = 0; probes <= m_tableMask; ++probes, index = (index+1) & m_tableMask) {
+    Key slotKey = m_table[index].m_key;
+    if (slotKey == key) {
+      if (m_table[index].m_target == &target)
+        return true;
+      PTRACE(2, "route " << (KeyTypes)((key >> KeyTypeShift)-1) << " key=0x" << hex << key << dec << " already in use");
+      return false;
+    }
+
+    if (slotKey == DeletedKey) {
+      if (freeSlot > m_tableMask)
+        freeSlot = index;
+    }
+    else if (slotKey == EmptyKey) {
+      if (freeSlot > m_tableMask)
+        freeSlot = index;
+      break;
+    }
+  }
+
+  if (freeSlot > m_tableMask || m_routeCount >= (m_tableMask+1)/2) {
+    PTRACE(1, "routing table full, " << m_routeCount << " routes");
+    return false;
+  }
+
+  // Target first, so a reader that sees the key sees the target
+  m_table[freeSlot].m_target = &target;
+  m_table[freeSlot].m_key = key;
+  ++m_routeCount;
+  return true;
+}
+
+
+bool OpalMediaMuxListener::RemoveRoute(Key key, Target * target)
+{
+  PWaitAndSignal lock(m_tableMutex);
+
+  size_t index = GetSlotIndex(key);
+  for (size_t probes = 0; probes <= m_tableMask; ++probes, index = (index+1) & m_tableMask) {
+    Slot & slot = m_table[index];
+    Key slotKey = slot.m_key;
+    if (slotKey == EmptyKey)
+      return false;
+
+    if (slotKey == key) {
+      if (target != NULL && slot.m_target != target)
+        return false;
+
+      slot.m_target = NULL;
+      slot.m_key = DeletedKey;
+      --m_routeCount;
+
+      /* If nothing follows, no probe sequence passes through here, so can
+         reclaim this, and any tombstones before it, as empty slots. */
+      if (m_table[(index+1) & m_tableMask].m_key == EmptyKey) {
+        while (m_table[index].m_key == DeletedKey) {
+          m_table[index].m_key = EmptyKey;
+          index = (index-1) & m_tableMask;
+        }
+      }
+      return true;
+    }
+  }
+
+  return false;
+}
+
+
+OpalMediaMuxListener::Target * OpalMediaMuxListener::FindRoute(Key key) const
+{
+  size_t index = GetSlotIndex(key);
+  for (size_t probes = 0; probes <= m_tableMask; ++probes, index = (index+1) & m_tableMask) {
+    const Slot & slot = m_table[index];
+    Key slotKey = slot.m_key;
+    if (slotKey == EmptyKey)
+      return NULL;
+
+    if (slotKey == key) {
+      Target * target = slot.m_target;
+      // If key changed while getting target, it was removed, so treat as not found
+      return slot.m_key == key ? target : NULL;
+    }
+  }
+
+  return NULL;
+}
+
+
+OpalMediaMuxListener::Target * OpalMediaMuxListener::FindSTUNRoute(const BYTE * data, PINDEX length) const
+{
+  // RFC 5389 message header is 20 bytes, top two bits zero and the magic cookie
+  if (length < 20 || (data[0] & 0xc0) != 0 || (DWORD)*(const PUInt32b *)(data+4) != STUNMagicCookie)
+    return NULL;
+
+  PINDEX end = std::min(length, (PINDEX)(20 + *(const PUInt16b *)(data+2)));
+  PINDEX pos = 20;
+  while (pos + 4 <= end) {
+    WORD type = *(const PUInt16b *)(data+pos);
+    PINDEX attrLen = *(const PUInt16b *)(data+pos+2);
+    if (pos + 4 + attrLen > end)
+      break;
+
+    if (type == STUNUserName) {
+      // Is "local:remote" from our point of view, only want local part
+      const char * user = (const char *)data+pos+4;
+      const char * colon = (const char *)memchr(user, ':', attrLen);
+      return FindRoute(MakeKey(PString(user, colon != NULL ? colon - user : attrLen)));
+    }
+
+    pos += 4 + ((attrLen + 3) & ~3);
+  }
+
+  return NULL;
+}
+
+
+void OpalMediaMuxListener::ReadMain(size_t index)
+{
+  Shard & shard = *m_shards[index];
+  PTRACE(4, "read thread " << index << " started");
+
+  m_manager.GetPlacementPolicy().BindThread(shard.m_placementGroup);
+
+  PINDEX packetSize = m_manager.GetMaxRtpPacketSize() + (m_muxIdPrefix ? 4 : 0);
+  while (shard.m_socket->IsOpen()) {
+    PBYTEArray data(packetSize);
+    PIPAddress remoteAddr;
+    WORD remotePort;
+    if (shard.m_socket->ReadFrom(data.GetPointer(), data.GetSize(), remoteAddr, remotePort)) {
+      data.SetSize(shard.m_socket->GetLastReadCount());
+      Dispatch(index, data, PIPSocketAddressAndPort(remoteAddr, remotePort));
+      continue;
+    }
+
+    switch (shard.m_socket->GetErrorCode(PChannel::LastReadError)) {
+      case PChannel::BufferTooSmall :
+        PTRACE(2, "read packet too large for buffer of " << data.GetSize() << " bytes.");
+        break;
+
+      case PChannel::Interrupted :
+      case PChannel::NoError :
+      case PChannel::Timeout :
+      case PChannel::Unavailable : // ICMP from some remote, not relevant to anyone else
+        break;
+
+      default :
+        PTRACE_IF(1, shard.m_socket->IsOpen(), "read error: " << shard.m_socket->GetErrorText(PChannel::LastReadError));
+        shard.m_socket->Close();
+        break;
+    }
+  }
+
+  PTRACE(4, "read thread " << index << " ended");
+}
+
+
+void OpalMediaMuxListener::Dispatch(size_t index, PBYTEArray & data, const PIPSocketAddressAndPort & remote)
+{
+  Shard & shard = *m_shards[index];
+  ++shard.m_received;
+
+  // Odd until delivery complete, a target will not be deleted till this changes
+  ++shard.m_dispatch;
+
+  Target * target = NULL;
+  KeyTypes routedBy = e_MuxID;
+
+  if (m_muxIdPrefix) {
+    if (data.GetSize() > 4) {
+      target = FindRoute(MakeKey(e_MuxID, *(const PUInt32b *)(const BYTE *)data));
+      PINDEX length = data.GetSize() - 4;
+      memmove(data.GetPointer(), (const BYTE *)data + 4, length);
+      data.SetSize(length);
+    }
+  }
+  else {
+    routedBy = e_RemoteAddress;
+    target = FindRoute(MakeKey(remote));
+  }
+
+  const BYTE * ptr = data;
+  PINDEX length = data.GetSize();
+
+  if (target == NULL && (target = FindSTUNRoute(ptr, length)) != NULL)
+    routedBy = e_ICEUser;
+
+  // RTCP payload types are 192 to 223, as per RFC 5761
+  bool isRTCP = length >= 8 && ptr[1] >= 192 && ptr[1] <= 223;
+
+  if (target == NULL && length >= 12 && (ptr[0] & 0xc0) == 0x80) {
+    // SSRC is in a different place for RTP and RTCP
+    if ((target = FindRoute(MakeKey(e_SSRC, *(const PUInt32b *)(ptr + (isRTCP ? 4 : 8))))) != NULL)
+      routedBy = e_SSRC;
+  }
+
+  if (target != NULL) {
+    ++shard.m_routed[routedBy];
+    target->OnMuxData(*this, m_subchannel != e_AllSubChannels ? m_subchannel : (isRTCP ? e_Control : e_Media), data, remote, (unsigned)index);
+  }
+  else {
+    ++shard.m_unrouted;
+    PTRACE(m_throttleUnrouted, "no route for packet from " << remote << ", size=" << length << m_throttleUnrouted);
+  }
+
+  ++shard.m_dispatch;
+}
+
+
+bool OpalMediaMuxListener::WriteTo(const void * data, PINDEX length, const PIPSocketAddressAndPort & remote, unsigned shard)
+{
+  if (m_shards.empty())
+    return false;
+
+  Socket & socket = *m_shards[shard < m_shards.size() ? shard : 0]->m_socket;
+  if (socket.WriteTo(data, length, remote))
+    return true;
+
+  PTRACE(m_throttleUnrouted, "write to " << remote << " failed: " << socket.GetErrorText(PChannel::LastWriteError));
+  return false;
+}
+
+
+void OpalMediaMuxListener::GetEpoch(Epoch & epoch) const
+{
+  epoch.resize(m_shards.size());
+  for (size_t i = 0; i < m_shards.size(); ++i)
+    epoch[i] = m_shards[i]->m_dispatch;
+}
+
+
+bool OpalMediaMuxListener::IsQuiescent(const Epoch & epoch) const
+{
+  // Listener closed since, so no threads
+  if (epoch.size() != m_shards.size())
+    return true;
+
+  for (size_t i = 0; i < epoch.size(); ++i) {
+    if ((epoch[i] & 1) != 0 && m_shards[i]->m_dispatch == epoch[i])
+      return false;
+  }
+
+  return true;
+}
+
+
+OpalMediaMuxListener::Statistics::Statistics()
+  : m_shards(0)
+  , m_routes(0)
+  , m_capacity(0)
+  , m_received(0)
+  , m_unrouted(0)
+{
+  for (PINDEX i = 0; i < NumKeyTypes; ++i)
+    m_routed[i] = 0;
+}
+
+
+void OpalMediaMuxListener::Statistics::PrintOn(ostream & strm) const
+{
+  strm << "shards=" << m_shards
+       << " routes=" << m_routes << '/' << m_capacity
+       << " received=" << m_received
+       << " by-address=" << m_routed[e_RemoteAddress]
+       << " by-mux-id=" << m_routed[e_MuxID]
+       << " by-ice=" << m_routed[e_ICEUser]
+       << " by-ssrc=" << m_routed[e_SSRC]
+       << " unrouted=" << m_unrouted;
+}
+
+
+void OpalMediaMuxListener::GetStatistics(Statistics & statistics) const
+{
+  statistics = Statistics();
+  statistics.m_shards = (unsigned)m_shards.size();
+  statistics.m_routes = m_routeCount;
+  statistics.m_capacity = (unsigned)(m_tableMask+1)/2;
+
+  for (size_t i = 0; i < m_shards.size(); ++i) {
+    const Shard & shard = *m_shards[i];
+    statistics.m_received += shard.m_received;
+    statistics.m_unrouted += shard.m_unrouted;
+    for (PINDEX k = 0; k < NumKeyTypes; ++k)
+      statistics.m_routed[k] += shard.m_routed[k];
+  }
+}
+
+
+///////////////////////////////////////////////////////////////////////////////
+
+OpalMuxMediaTransport::OpalMuxMediaTransport(const PString & name, OpalMediaMuxListener & listener)
+  : OpalMediaTransport(name)
+  , m_listener(listener)
+  , m_shard(0)
+  , m_routesRemoved(false)
+{
+  m_timeoutTimer.SetNotifier(PCREATE_NOTIFIER(CheckMediaTimeout), "MuxTimeout");
+}
+
+
+OpalMuxMediaTransport::~OpalMuxMediaTransport()
+{
+  InternalClose();
+}
+
+
+PString OpalMuxMediaTransport::GetType()
+{
+  return "udp";
+}
+
+
+bool OpalMuxMediaTransport::Open(OpalMediaSession & session,
+                                 PINDEX subchannelCount,
+                                 const PString & localInterface,
+                                 const OpalTransportAddress & remoteAddress)
+{
+  PTRACE_CONTEXT_ID_FROM(session);
+
+  if (!PAssert(subchannelCount > 0 && subchannelCount <= 2, PInvalidParameter))
+    return false;
+
+  if (!m_listener.IsOpen()) {
+    PTRACE(2, session << "cannot open, media mux listener not open");
+    return false;
+  }
+
+  OpalManager & manager = session.GetConnection().GetEndPoint().GetManager();
+
+  m_packetSize = manager.GetMaxRtpPacketSize();
+  if (session.IsRemoteBehindNAT())
+    SetRemoteBehindNAT();
+  m_mediaTimeout = session.GetStringOptions().GetVar(OPAL_OPT_MEDIA_RX_TIMEOUT, manager.GetNoMediaTimeout());
+  m_maxNoTransmitTime = session.GetStringOptions().GetVar(OPAL_OPT_MEDIA_TX_TIMEOUT, manager.GetTxMediaTimeout());
+
+  // Listener may be on all interfaces, so advertise the one we were asked for
+  PIPSocketAddressAndPort localAP = m_listener.GetLocalAddress();
+  if (localAP.GetAddress().IsAny())
+    localAP.SetAddress(PIPAddress(localInterface));
+
+  PTRACE(4, session << "opening " << subchannelCount << " subchannel(s) on shared " << localAP << ", remote=" << remoteAddress);
+
+  // All subchannels on the one port, RTCP is told apart by payload type
+  OpalTransportAddress localAddress(localAP, OpalTransportAddress::UdpPrefix());
+  for (PINDEX i = 0; i < subchannelCount; ++i) {
+    m_subchannels.push_back(ChannelInfo(*this, (SubChannels)i, NULL));
+    m_subchannels.back().m_localAddress = localAddress;
+  }
+
+  m_mediaTimer = m_mediaTimeout;
+  m_timeoutTimer.RunContinuous(std::max(m_mediaTimeout/4, PTimeInterval(0, 1)));
+
+  m_opened = true;
+  return true;
+}
+
+
+bool OpalMuxMediaTransport::SetRemoteAddress(const OpalTransportAddress & remoteAddress, SubChannels subchannel)
+{
+  PIPAddressAndPort ap;
+  if (!remoteAddress.GetIpAndPort(ap)) {
+    PTRACE(2, "Illegal IP address, or no port specified: channel=" << subchannel << ", addr=\"" << remoteAddress << '"');
+    return false;
+  }
+
+  return InternalSetRemoteAddress(ap, subchannel, e_RemoteAddressFromSignalling);
+}
+
+
+bool OpalMuxMediaTransport::InternalSetRemoteAddress(const PIPSocketAddressAndPort & newAP,
+                                                     SubChannels subchannel,
+                                                     RemoteAddressSources source)
+{
+  if (!newAP.IsValid())
+    return false;
+
+  P_INSTRUMENTED_LOCK_READ_WRITE(return false);
+
+  if ((size_t)subchannel >= m_subchannels.size())
+    return false;
+
+  ChannelInfo & info = m_subchannels[subchannel];
+  PIPSocketAddressAndPort & currentAP = m_remoteAddress[subchannel];
+  if (newAP == currentAP)
+    return true;
+
+  if (m_remoteBehindNAT && source == e_RemoteAddressFromSignalling && info.m_remoteAddressSource != e_RemoteAddressUnknown) {
+    PTRACE(3, *this << "ignoring signalled remote address, as is behind NAT.");
+    return true;
+  }
+
+  OpalMediaMuxListener::Key newKey = OpalMediaMuxListener::MakeKey(newAP);
+  if (!InternalAddRoute(newKey)) {
+    PTRACE(2, *this << source << " cannot set remote " << subchannel << " address to " << newAP << ", in use by another session");
+    return false;
+  }
+
+  // Only remove old route if other subchannel is not also using it, e.g. rtcp-mux
+  if (currentAP.IsValid()) {
+    OpalMediaMuxListener::Key oldKey = OpalMediaMuxListener::MakeKey(currentAP);
+    PIPSocketAddressAndPort & otherAP = m_remoteAddress[subchannel == e_Control ? e_Media : e_Control];
+    if (oldKey != newKey && (!otherAP.IsValid() || OpalMediaMuxListener::MakeKey(otherAP) != oldKey))
+      InternalRemoveRoute(oldKey);
+  }
+
+  currentAP = newAP;
+  info.m_remoteAddressSource = source;
+  info.m_remoteAddress = OpalTransportAddress(newAP, OpalTransportAddress::UdpPrefix());
+  info.m_consecutiveUnavailableErrors = 0;
+
+  if (subchannel == e_Data)
+    m_established = true;
+
+  PTRACE(3, *this << source << " set remote " << subchannel << " address to " << newAP);
+  return true;
+}
+
+
+bool OpalMuxMediaTransport::Write(const void * data, PINDEX length, SubChannels subchannel, const PIPSocketAddressAndPort * dest, int *)
+{
+  PIPSocketAddressAndPort sendAddr;
+  {
+    P_INSTRUMENTED_LOCK_READ_ONLY(return false);
+
+    if (!m_opened || (size_t)subchannel >= m_subchannels.size()) {
+      PTRACE(4, *this << "write to closed/unopened subchannel " << subchannel);
+      return false;
+    }
+
+    if (dest != NULL)
+      sendAddr = *dest;
+    else
+      sendAddr = m_remoteAddress[subchannel];
+  }
+
+  if (!sendAddr.IsValid()) {
+    PTRACE(4, *this << "UDP write has no destination address on subchannel " << subchannel);
+    // Same as UDP transport, keep trying for a while, then give up
+    return m_subchannels[subchannel].HandleUnavailableError();
+  }
+
+  PTRACE(m_subchannels[subchannel].m_throttleWritePacket,
+         *this << "writing UDP media data: subchannel=" << subchannel << ", size=" << length << ", dest=" << sendAddr);
+  return m_listener.WriteTo(data, length, sendAddr, m_shard);
+}
+
+
+void OpalMuxMediaTransport::SetCandidates(const PString & user, const PString &, const PNatCandidateList &)
+{
+  // The remote uses our user fragment first in the STUN USERNAME
+  if (!user.IsEmpty())
+    AddICEUser(user);
+}
+
+
+bool OpalMuxMediaTransport::AddSyncSource(uint32_t ssrc)
+{
+  return InternalAddRoute(OpalMediaMuxListener::MakeKey(OpalMediaMuxListener::e_SSRC, ssrc));
+}
+
+
+bool OpalMuxMediaTransport::AddICEUser(const PString & user)
+{
+  return InternalAddRoute(OpalMediaMuxListener::MakeKey(user));
+}
+
+
+bool OpalMuxMediaTransport::InternalAddRoute(OpalMediaMuxListener::Key key)
+{
+  PWaitAndSignal lock(m_routesMutex);
+
+  if (m_routesRemoved)
+    return false;
+
+  if (std::find(m_routes.begin(), m_routes.end(), key) != m_routes.end())
+    return true;
+
+  if (!m_listener.AddRoute(key, *this))
+    return false;
+
+  m_routes.push_back(key);
+  return true;
+}
+
+
+void OpalMuxMediaTransport::InternalRemoveRoute(OpalMediaMuxListener::Key key)
+{
+  PWaitAndSignal lock(m_routesMutex);
+
+  std::vector<OpalMediaMuxListener::Key>::iterator it = std::find(m_routes.begin(), m_routes.end(), key);
+  if (it != m_routes.end()) {
+    m_listener.RemoveRoute(key, this);
+    m_routes.erase(it);
+  }
+}
+
+
+void OpalMuxMediaTransport::OnMuxData(OpalMediaMuxListener &,
+                                      SubChannels subchannel,
+                                      const PBYTEArray & data,
+                                      const PIPSocketAddressAndPort & remote,
+                                      unsigned shard)
+{
+  if (!m_opened)
+    return;
+
+  // Session with single subchannel gets RTCP on the data channel
+  if ((size_t)subchannel >= m_subchannels.size())
+    subchannel = e_Media;
+
+  // Reply from the socket the remote is sending to, so any NAT binding stays consistent
+  m_shard = shard;
+
+  if (!LockReadOnly(P_DEBUG_LOCATION))
+    return;
+  ChannelInfo & info = m_subchannels[subchannel];
+  bool learn = remote != m_remoteAddress[subchannel] &&
+               (m_remoteBehindNAT || info.m_remoteAddressSource == e_RemoteAddressUnknown);
+  info.m_remoteGoneError = PChannel::Timeout;
+  UnlockReadOnly(P_DEBUG_LOCATION);
+
+  if (learn)
+    InternalSetRemoteAddress(remote, subchannel, e_RemoteAddressFromFirstPacket);
+
+  InternalRxData(subchannel, data);
+}
+
+
+void OpalMuxMediaTransport::CheckMediaTimeout(PTimer &, P_INT_PTR)
+{
+  if (!m_opened || !m_mediaTimer.HasExpired())
+    return;
+
+  PTRACE(1, *this << "timed out (" << m_mediaTimeout << "s), closing");
+  InternalClose();
+
+  // Send and empty packet to consumer to indicate transport has closed.
+  for (size_t i = 0; i < m_subchannels.size(); ++i) {
+    if (!LockReadOnly(P_DEBUG_LOCATION))
+      return;
+    ChannelInfo & info = m_subchannels[i];
+    info.m_lastError = info.m_remoteGoneError;
+    ChannelInfo::NotifierList notifiers = info.m_notifiers;
+    UnlockReadOnly(P_DEBUG_LOCATION);
+    notifiers(*this, PBYTEArray());
+  }
+}
+
+
+void OpalMuxMediaTransport::InternalClose()
+{
+  m_opened = m_established = false;
+  m_timeoutTimer.Stop(false);
+
+  PWaitAndSignal lock(m_routesMutex);
+  if (m_routesRemoved)
+    return;
+
+  PTRACE(4, *this << "removing " << m_routes.size() << " route(s) from media mux");
+  for (std::vector<OpalMediaMuxListener::Key>::iterator it = m_routes.begin(); it != m_routes.end(); ++it)
+    m_listener.RemoveRoute(*it, this);
+  m_routes.clear();
+
+  // Must not be deleted till every read thread is past anything it found before now
+  m_listener.GetEpoch(m_closedEpoch);
+  m_routesRemoved = true;
+}
+
+
+bool OpalMuxMediaTransport::GarbageCollection()
+{
+  if (!m_routesRemoved)
+    InternalClose();
+
+  m_ccTimer.Stop();
+
+  return m_listener.IsQuiescent(m_closedEpoch);
+}
+
+
+// End of File ///////////////////////////////////////////////////////////////
@@ -38,6 +38,7 @@
 #include <opal.h>
 #include <rtp/dtls_srtp_session.h>
 #include <h323/h323caps.h>
+#include <opal/evtrace.h>
 #include <ptclib/cypher.h>
 #include <ptclib/random.h>
 
@@ -48,7 +49,9 @@
 static const unsigned MaxConsecutiveErrors = 100;
 
 #if PTRACING
-  #define OPAL_SRTP_TRACE(level, dir, subchan, ssrc, item, arg) PTRACE(GetThrottle(level, dir, subchan, ssrc, item), \
+  // Check level first, so the throttle map lookup is not done for every packet when not tracing
+  #define OPAL_SRTP_TRACE(level, dir, subchan, ssrc, item, arg) \
+    if (!PTrace::CanTrace(level)) ; else PTRACE(GetThrottle(level, dir, subchan, ssrc, item), \
                 *this << "SSRC=" << RTP_TRACE_SRC(ssrc) << ", " << arg << GetThrottle(level, dir, subchan, ssrc, item))
 
   PTrace::ThrottleBase & OpalSRTPSession::GetThrottle(unsigned level, Direction dir, SubChannels subchannel, RTP_SyncSourceId ssrc, int item)
@@ -706,6 +709,7 @@ OpalRTPSession::SendReceiveStatus OpalSRTPSession::OnSendData(RewriteMode & rewr
     return status;
 
   OPAL_SRTP_TRACE(3, e_Sender, e_Data, ssrc, 2, "protected RTP packet: " << frame.GetPacketSize() << "->" << len);
+  OPAL_EVENT_TRACE(e_SRTPProtect, *this, ssrc, e_Data, frame.GetPacketSize(), len);
 
   frame.SetPayloadSize(len - frame.GetHeaderSize());
 
@@ -742,6 +746,7 @@ OpalRTPSession::SendReceiveStatus OpalSRTPSession::OnSendControl(RTP_ControlFram
     return status;
 
   OPAL_SRTP_TRACE(3, e_Sender, e_Control, ssrc, 2, "protected RTCP packet: " << frame.GetPacketSize() << "->" << len);
+  OPAL_EVENT_TRACE(e_SRTPProtect, *this, ssrc, e_Control, frame.GetPacketSize(), len);
 
   frame.SetPacketSize(len);
 
@@ -783,6 +788,7 @@ OpalRTPSession::SendReceiveStatus OpalSRTPSession::OnReceiveData(RTP_DataFrame &
     return status;
 
   OPAL_SRTP_TRACE(3, e_Receiver, e_Data, ssrc, 2, "unprotected RTP packet: " << frame.GetPacketSize() << "->" << len);
+  OPAL_EVENT_TRACE(e_SRTPUnprotect, *this, ssrc, e_Data, frame.GetPacketSize(), len);
 
   frame.SetPayloadSize(len - frame.GetHeaderSize());
 
@@ -829,6 +835,7 @@ OpalRTPSession::SendReceiveStatus OpalSRTPSession::OnReceiveControl(RTP_ControlF
 
 
   OPAL_SRTP_TRACE(3, e_Receiver, e_Control, ssrc, 2, "unprotected RTCP packet: " << decoded.GetPacketSize() << "->" << len);
+  OPAL_EVENT_TRACE(e_SRTPUnprotect, *this, ssrc, e_Control, decoded.GetPacketSize(), len);
 
   decoded.SetPacketSize(len);
 
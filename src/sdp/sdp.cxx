@@ -495,6 +495,147 @@ bool SDPMediaFormat::AdjustMediaFormat(OpalMediaFormat & mediaFormat, unsigned b
 }
 
 
+bool SDPMediaFormat::SetCachedMediaFormat(const OpalMediaFormat & mediaFormat)
+{
+  if (!mediaFormat.IsValid())
+    return false;
+
+  m_mediaFormat = mediaFormat;
+  if (m_encodingName.IsEmpty())
+    m_encodingName = m_mediaFormat.GetEncodingName();
+  return true;
+}
+
+
+//////////////////////////////////////////////////////////////////////////////
+
+SDPMediaFormatCache::SDPMediaFormatCache(PINDEX maxSize)
+  : m_maxSize(maxSize)
+  , m_hits(0)
+  , m_misses(0)
+{
+}
+
+
+bool SDPMediaFormatCache::Lookup(const PString & key, Matches & matches)
+{
+  PWaitAndSignal mutex(m_mutex);
+
+  KeyMap::iterator it = m_keys.find(key);
+  if (it == m_keys.end()) {
+    ++m_misses;
+    return false;
+  }
+
+  m_entries.splice(m_entries.begin(), m_entries, it->second);
+  matches = it->second->second;
+  ++m_hits;
+  return true;
+}
+
+
+void SDPMediaFormatCache::Store(const PString & key, const Matches & matches)
+{
+  PWaitAndSignal mutex(m_mutex);
+
+  if (m_maxSize == 0)
+    return;
+
+  KeyMap::iterator it = m_keys.find(key);
+  if (it != m_keys.end()) {
+    it->second->second = matches;
+    m_entries.splice(m_entries.begin(), m_entries, it->second);
+    return;
+  }
+
+  m_entries.push_front(std::make_pair(key, matches));
+  m_keys[key] = m_entries.begin();
+
+  while ((PINDEX)m_entries.size() > m_maxSize) {
+    m_keys.erase(m_entries.back().first);
+    m_entries.pop_back();
+  }
+}
+
+
+void SDPMediaFormatCache::SetMaxSize(PINDEX maxSize)
+{
+  PWaitAndSignal mutex(m_mutex);
+
+  m_maxSize = maxSize;
+  while ((PINDEX)m_entries.size() > m_maxSize) {
+    m_keys.erase(m_entries.back().first);
+    m_entries.pop_back();
+  }
+}
+
+
+void SDPMediaFormatCache::RemoveAll()
+{
+  PWaitAndSignal mutex(m_mutex);
+  m_entries.clear();
+  m_keys.clear();
+  m_fingerprints.clear();
+}
+
+
+static const PINDEX MaxFingerprints = 100;
+
+
+static void HashString(uint64_t & hash, const PString & str)
+{
+  // FNV-1a, with terminating null so concatenations are distinct
+  const char * ptr = str;
+  do {
+    hash ^= (BYTE)*ptr;
+    hash *= 1099511628211ULL;
+  } while (*ptr++ != '\0');
+}
+
+
+PString SDPMediaFormatCache::GetFingerprint(const OpalMediaFormatList & mediaFormats)
+{
+  std::vector<unsigned> generations;
+  generations.reserve(mediaFormats.GetSize());
+  for (OpalMediaFormatList::const_iterator it = mediaFormats.begin(); it != mediaFormats.end(); ++it)
+    generations.push_back(it->GetGeneration());
+
+  PWaitAndSignal mutex(m_mutex);
+
+  FingerprintMap::const_iterator previous = m_fingerprints.find(generations);
+  if (previous != m_fingerprints.end())
+    return previous->second;
+
+  uint64_t hash = 14695981039346656037ULL;
+  for (OpalMediaFormatList::const_iterator it = mediaFormats.begin(); it != mediaFormats.end(); ++it) {
+    HashString(hash, it->GetName());
+    HashString(hash, PString(PString::Unsigned, it->GetPayloadType()));
+    for (PINDEX i = 0; i < it->GetOptionCount(); ++i) {
+      const OpalMediaOption & option = it->GetOption(i);
+      HashString(hash, option.GetName());
+      HashString(hash, option.AsString());
+    }
+  }
+
+  // Only a handful of distinct lists are expected, so just start again if it gets silly
+  if ((PINDEX)m_fingerprints.size() >= MaxFingerprints)
+    m_fingerprints.clear();
+
+  PString fingerprint = PString(PString::Unsigned, (unsigned)(hash >> 32), 16) + PString(PString::Unsigned, (unsigned)hash, 16);
+  m_fingerprints[generations] = fingerprint;
+  return fingerprint;
+}
+
+
+void SDPMediaFormatCache::GetStatistics(Statistics & statistics) const
+{
+  PWaitAndSignal mutex(m_mutex);
+  statistics.m_entries = m_entries.size();
+  statistics.m_hits = m_hits;
+  statistics.m_misses = m_misses;
+}
+
+
 //////////////////////////////////////////////////////////////////////////////
 
 OpalBandwidth & SDPBandwidth::operator[](const PCaselessString & type)
@@ -742,6 +883,7 @@ SDPMediaDescription::SDPMediaDescription()
   : m_port(0)
   , m_portCount(1)
   , m_bundleOnly(false)
+  , m_formatCache(NULL)
 {
 }
 
@@ -752,6 +894,7 @@ SDPMediaDescription::SDPMediaDescription(const OpalTransportAddress & address, c
   , m_portCount(1)
   , m_mediaType(type)
   , m_bundleOnly(false)
+  , m_formatCache(NULL)
 {
   PIPSocket::Address ip;
   if (m_mediaAddress.GetIpAndPort(ip, m_port))
@@ -954,18 +1097,42 @@ bool SDPMediaDescription::PostDecode(const OpalMediaFormatList & mediaFormats)
       bw *= 1000;
   }
 
+  SDPMediaFormatCache::Matches matches;
+  bool cached = m_formatCache != NULL && m_formatCache->Lookup(m_formatCacheKey, matches);
+  PTRACE_IF(4, cached, "Using cached media format matches for " << GetSDPMediaType());
+
   SDPMediaFormatList::iterator format = m_formats.begin();
   while (format != m_formats.end()) {
-    if (format->PostDecode(mediaFormats, bw))
+    bool matched;
+    SDPMediaFormatCache::Matches::const_iterator it;
+    if (cached && (it = matches.find(format->GetPayloadType())) != matches.end())
+      matched = format->SetCachedMediaFormat(it->second);
+    else {
+      matched = format->PostDecode(mediaFormats, bw);
+      if (m_formatCache != NULL)
+        matches[format->GetPayloadType()] = matched ? format->GetMediaFormat() : OpalMediaFormat();
+    }
+
+    if (matched)
       ++format;
     else
       m_formats.erase(format++);
   }
 
+  if (m_formatCache != NULL && !cached)
+    m_formatCache->Store(m_formatCacheKey, matches);
+
   return true;
 }
 
 
+void SDPMediaDescription::SetFormatCache(SDPMediaFormatCache * cache, const PString & key)
+{
+  m_formatCache = cache;
+  m_formatCacheKey = key;
+}
+
+
 #if OPAL_SRTP
 
 void SDPMediaDescription::SetCryptoKeys(OpalMediaCryptoKeyList &)
@@ -2771,6 +2938,7 @@ SDPSessionDescription::SDPSessionDescription(time_t sessionId, unsigned version,
   , ownerVersion(version)
   , ownerAddress(address)
   , defaultConnectAddress(address)
+  , m_formatCache(NULL)
 {
 }
 
@@ -2885,6 +3053,37 @@ bool SDPSessionDescription::Decode(const PString & str, const OpalMediaFormatLis
 }
 
 
+// Lines which are different on every call, but do not affect media format matching
+static bool IsPerCallLine(const PString & line)
+{
+  switch (line[0]) {
+    case 'o' : // owner/creator and session identifier
+    case 'c' : // connection information
+    case 's' : // session name
+    case 'i' : // session information
+      return true;
+    case 'a' :
+      break;
+    default :
+      return false;
+  }
+
+  static PConstCaselessString const PerCallAttributes[] = {
+    "candidate", "remote-candidates", "end-of-candidates",
+    "ice-ufrag", "ice-pwd", "ice-options", "ice-lite",
+    "crypto", "fingerprint", "setup", "rtcp",
+    "ssrc", "ssrc-group", "msid", "msid-semantic", "label"
+  };
+
+  PCaselessString attr = line(2, line.Find(':')-1);
+  for (PINDEX i = 0; i < PARRAYSIZE(PerCallAttributes); ++i) {
+    if (attr == PerCallAttributes[i])
+      return true;
+  }
+  return false;
+}
+
+
 bool SDPSessionDescription::Decode(const PStringArray & lines, const OpalMediaFormatList & mediaFormats)
 {
   PTRACE(5, "Decode using media formats:\n    " << setfill(',') << mediaFormats << setfill(' '));
@@ -2893,6 +3092,14 @@ bool SDPSessionDescription::Decode(const PStringArray & lines, const OpalMediaFo
   bool ok = true;
   bool defaultConnectAddressPresent = false;
 
+  /* Build normalised text of each media description, and the session level
+     lines that are copied into them, for format matching cache key. */
+  bool useCache = m_formatCache != NULL && m_formatCache->GetMaxSize() > 0;
+  PString sessionKey, mediaKey;
+  if (useCache)
+    sessionKey = PSTRSTRM(m_formatCache->GetFingerprint(mediaFormats)
+                          << ' ' << GetStringOptions().GetBoolean(OPAL_OPT_FORCE_RTCP_FB) << '\n');
+
   // parse keyvalue pairs
   SDPMediaDescription * currentMedia = NULL;
   for (PINDEX lineIndex = 0; lineIndex < lines.GetSize(); lineIndex++) {
@@ -2900,6 +3107,9 @@ bool SDPSessionDescription::Decode(const PStringArray & lines, const OpalMediaFo
     if (line.GetLength() < 3 || line[1] != '=')
       continue; // Ignore illegal lines
 
+    if (useCache && line[0] != 'm' && !IsPerCallLine(line))
+      (currentMedia != NULL ? mediaKey : sessionKey) += line + '\n';
+
     PString value = line.Mid(2).Trim();
 
     /////////////////////////////////
@@ -2952,6 +3162,8 @@ bool SDPSessionDescription::Decode(const PStringArray & lines, const OpalMediaFo
             if (currentMedia != NULL) {
               PTRACE(3, "Parsed media session with " << currentMedia->GetSDPMediaFormats().GetSize()
                                                           << " '" << currentMedia->GetSDPMediaType() << "' formats");
+              if (useCache)
+                currentMedia->SetFormatCache(m_formatCache, mediaKey);
               if (!currentMedia->PostDecode(mediaFormats))
                 ok = false;
             }
@@ -2961,6 +3173,16 @@ bool SDPSessionDescription::Decode(const PStringArray & lines, const OpalMediaFo
             OpalMediaType mediaType;
             OpalMediaTypeDefinition * defn;
             PStringArray tokens = value.Tokenise(WhiteSpace, false); // Spec says space only, but lets be forgiving
+
+            if (useCache) {
+              // Everything but the port
+              mediaKey = sessionKey + "m=";
+              for (PINDEX i = 0; i < tokens.GetSize(); ++i) {
+                if (i != 1)
+                  mediaKey += tokens[i] + ' ';
+              }
+              mediaKey += '\n';
+            }
             if (tokens.GetSize() < 4) {
               PTRACE(1, "Media session has only " << tokens.GetSize() << " elements");
             }
@@ -3003,6 +3225,8 @@ bool SDPSessionDescription::Decode(const PStringArray & lines, const OpalMediaFo
   }
 
   if (currentMedia != NULL) {
+    if (useCache)
+      currentMedia->SetFormatCache(m_formatCache, mediaKey);
     if (!currentMedia->PostDecode(mediaFormats))
       ok = false;
 
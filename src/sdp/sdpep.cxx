@@ -41,6 +41,7 @@
 #include <opal/patch.h>
 #include <ptclib/random.h>
 #include <sdp/ice.h>
+#include <rtp/rtpmux.h>
 
 
 #define PTraceModule() "SDP-EP"
@@ -92,7 +93,9 @@ PStringList OpalSDPEndPoint::GetAvailableStringOptions() const
 
 SDPSessionDescription * OpalSDPEndPoint::CreateSDP(time_t sessionId, unsigned version, const OpalTransportAddress & address)
 {
-  return new SDPSessionDescription(sessionId, version, address);
+  SDPSessionDescription * sdp = new SDPSessionDescription(sessionId, version, address);
+  sdp->SetFormatCache(&m_formatCache);
+  return sdp;
 }
 
 
@@ -176,7 +179,7 @@ bool OpalSDPConnection::HoldRemote(bool placeOnHold)
     case eHoldInProgress :
       PTRACE(4, "Hold " << (placeOnHold ? "on" : "off") << " request deferred as in progress for " << *this);
       GetEndPoint().GetManager().QueueDecoupledEvent(new PSafeWorkArg1<OpalSDPConnection, bool>(
-                                         this, placeOnHold, &OpalSDPConnection::RetryHoldRemote));
+                                         this, placeOnHold, &OpalSDPConnection::RetryHoldRemote), GetCall().GetToken());
       return true;
   }
 
@@ -430,6 +433,20 @@ struct OpalSDPConnection::BundleMergeInfo
 };
 
 
+#if OPAL_ICE
+// The shared media port does not answer ICE connectivity checks
+static void DisableMediaMux(OpalMediaSession & session)
+{
+  if (session.IsOpen() || !session.GetStringOptions().GetBoolean(OPAL_OPT_MEDIA_MUX, true))
+    return;
+
+  PStringOptions options = session.GetStringOptions();
+  options.SetBoolean(OPAL_OPT_MEDIA_MUX, false);
+  session.SetStringOptions(options);
+}
+#endif
+
+
 OpalMediaSession * OpalSDPConnection::SetUpMediaSession(const unsigned   sessionId,
                                                    const OpalMediaType & mediaType,
                                              const SDPMediaDescription & mediaDescription,
@@ -453,8 +470,10 @@ OpalMediaSession * OpalSDPConnection::SetUpMediaSession(const unsigned   session
 
   OpalTransportAddress remoteMediaAddress;
 #if OPAL_ICE
-  if (mediaDescription.HasICE())
+  if (mediaDescription.HasICE()) {
+    DisableMediaMux(*session);
     remoteMediaAddress = GetRemoteMediaAddress();
+  }
   else
 #endif
   {
@@ -650,6 +669,11 @@ bool OpalSDPConnection::OnSendOfferSDPSession(unsigned   sessionId,
       rtpSession->SetSinglePortRx();
   }
 
+#if OPAL_ICE
+  if (m_stringOptions.GetBoolean(OPAL_OPT_OFFER_ICE))
+    DisableMediaMux(*mediaSession);
+#endif
+
   if (!mediaSession->Open(GetMediaInterface(), GetRemoteMediaAddress())) {
     PTRACE(1, "Could not open RTP session " << sessionId << " for media type " << mediaType);
     return false;
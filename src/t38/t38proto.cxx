@@ -802,7 +802,7 @@ void OpalFaxConnection::OnStopMediaPatch(OpalMediaPatch & patch)
   OpalMediaStreamPtr src = &patch.GetSource();
   if (&src->GetConnection() == this)
     GetEndPoint().GetManager().QueueDecoupledEvent(
-              new PSafeWorkArg1<OpalConnection, OpalMediaStreamPtr, bool>(this, src, &OpalConnection::CloseMediaStream));
+              new PSafeWorkArg1<OpalConnection, OpalMediaStreamPtr, bool>(this, src, &OpalConnection::CloseMediaStream), GetCall().GetToken());
   OpalLocalConnection::OnStopMediaPatch(patch);
 }
 
@@ -884,7 +884,7 @@ void OpalFaxConnection::OnSwitchTimeout(PTimer &, P_INT_PTR)
 
   PTRACE(2, "Did not switch to T.38 mode, forcing switch");
   GetEndPoint().GetManager().QueueDecoupledEvent(
-          new PSafeWorkNoArg<OpalFaxConnection>(this, &OpalFaxConnection::InternalOpenFaxStreams));
+          new PSafeWorkNoArg<OpalFaxConnection>(this, &OpalFaxConnection::InternalOpenFaxStreams), GetCall().GetToken());
 }
 
 